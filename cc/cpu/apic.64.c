@@ -30,6 +30,8 @@ int8_t apic_enabled = 0;
 uint32_t lapic_initial_timer_count = 0;
 uint64_t apic_ap_count = 0;
 boolean_t apic_x2apic = false;
+boolean_t apic_tsc_deadline_supported = false;
+boolean_t apic_timer_oneshot_enabled = false;
 
 list_t* irq_remappings = NULL;
 
@@ -322,6 +324,9 @@ int8_t apic_init_timer(void) {
 
     PRINTLOG(APIC, LOG_INFO, "delta is 0x%016llx", delta);
 
+    if(time_timer_enable_tickless() != 0) {
+        PRINTLOG(APIC, LOG_INFO, "tickless timer is not supported, periodic timer is used");
+    }
 
     return 0;
 }
@@ -344,6 +349,13 @@ uint8_t apic_configure_lapic(void) {
     apic_write_lvt_lint1(APIC_ICR_DELIVERY_MODE_NMI);
 
     apic_write_timer_divide_configuration(0x3);
+
+    if(apic_timer_oneshot_enabled) {
+        apic_timer_enable_oneshot();
+
+        return 0;
+    }
+
     apic_write_timer_initial_value(lapic_initial_timer_count);
 
     apic_write_timer_lvt(APIC_TIMER_PERIODIC | APIC_INTERRUPT_ENABLED | 0x20);
@@ -351,6 +363,78 @@ uint8_t apic_configure_lapic(void) {
     return 0;
 }
 
+int8_t apic_timer_enable_oneshot(void) {
+    if(!apic_enabled || lapic_initial_timer_count == 0) {
+        PRINTLOG(APIC, LOG_ERROR, "apic timer is not calibrated");
+
+        return -1;
+    }
+
+    if(!apic_timer_oneshot_enabled) {
+        cpu_cpuid_regs_t query = {0};
+        cpu_cpuid_regs_t result;
+
+        query.eax = 0x1;
+
+        cpu_cpuid(query, &result);
+
+        apic_tsc_deadline_supported = (result.ecx >> 24) & 0x1;
+
+        PRINTLOG(APIC, LOG_INFO, "tsc deadline timer supported %i", apic_tsc_deadline_supported);
+    }
+
+    // stop periodic timer before mode change
+    apic_write_timer_initial_value(0);
+
+    if(apic_tsc_deadline_supported) {
+        apic_write_timer_lvt(APIC_TIMER_TSC_DEADLINE | APIC_INTERRUPT_ENABLED | 0x20);
+        // lvt write and deadline msr write should not be reordered
+        asm volatile ("mfence" ::: "memory");
+        cpu_write_msr(APIC_MSR_IA32_TSC_DEADLINE, 0);
+    } else {
+        apic_write_timer_divide_configuration(0x3);
+        apic_write_timer_lvt(APIC_TIMER_ONESHOT | APIC_INTERRUPT_ENABLED | 0x20);
+    }
+
+    apic_timer_oneshot_enabled = true;
+
+    return 0;
+}
+
+void apic_timer_set_deadline(uint64_t tsc_deadline) {
+    if(apic_tsc_deadline_supported) {
+        cpu_write_msr(APIC_MSR_IA32_TSC_DEADLINE, tsc_deadline);
+
+        return;
+    }
+
+    if(tsc_deadline == 0) {
+        apic_write_timer_initial_value(0);
+
+        return;
+    }
+
+    uint64_t now = rdtsc();
+    uint64_t count = 1;
+
+    // lapic_initial_timer_count is apic timer count of 1ms
+    if(tsc_deadline > now && time_timer_rdtsc_delta) {
+        uint64_t delta = tsc_deadline - now;
+
+        if(delta / time_timer_rdtsc_delta >= 0xFFFFFFFFULL / lapic_initial_timer_count) {
+            count = 0xFFFFFFFF;
+        } else {
+            count = (delta * lapic_initial_timer_count) / time_timer_rdtsc_delta;
+        }
+    }
+
+    if(count == 0) {
+        count = 1;
+    }
+
+    apic_write_timer_initial_value(count);
+}
+
 boolean_t apic_is_waiting_timer(void) {
     if(apic_enabled) {
         uint32_t current_lvt = apic_read_timer_lvt();
@@ -281,9 +281,15 @@ static void interrupt_print_frame_ext(interrupt_frame_ext_t* frame) {
 }
 
 static boolean_t interrupt_xsave_mask_memorized = false;
+static boolean_t interrupt_xsavec_supported = false;
 static uint64_t interrupt_xsave_mask_lo = 0;
 static uint64_t interrupt_xsave_mask_hi = 0;
 
+/*! offset of xsave header at xsave area */
+#define INTERRUPT_XSAVE_HEADER_OFFSET 0x200
+/*! size of xsave header */
+#define INTERRUPT_XSAVE_HEADER_SIZE   0x40
+
 static void interrupt_save_restore_avx512f(boolean_t save, interrupt_frame_ext_t* frame) {
     if(!interrupt_xsave_mask_memorized) {
         cpu_cpuid_regs_t query = {0};
@@ -296,6 +302,12 @@ static void interrupt_save_restore_avx512f(boolean_t save, interrupt_frame_ext_t
         interrupt_xsave_mask_lo = result.eax;
         interrupt_xsave_mask_hi = result.edx;
 
+        query.ecx = 0x1;
+
+        cpu_cpuid(query, &result);
+
+        interrupt_xsavec_supported = (result.eax & 0x2) == 0x2;
+
         interrupt_xsave_mask_memorized = true;
     }
 
@@ -305,18 +317,33 @@ static void interrupt_save_restore_avx512f(boolean_t save, interrupt_frame_ext_t
     avx512f_offset = (avx512f_offset + 0x3F) & ~0x3F;
 
     if(save) {
-        memory_memclean((void*)avx512f_offset, 0x2000);
-
-        asm volatile (
-            "mov %[avx512f_offset], %%rbx\n"
-            "xsave (%%rbx)\n"
-            :
-            :
-            [avx512f_offset] "r" (avx512f_offset),
-            "rax" (interrupt_xsave_mask_lo),
-            "rdx" (interrupt_xsave_mask_hi)
-            : "rbx"
-            );
+        // xrstor only checks header for reserved bits, rest of the area is written by xsave
+        memory_memclean((void*)(avx512f_offset + INTERRUPT_XSAVE_HEADER_OFFSET), INTERRUPT_XSAVE_HEADER_SIZE);
+
+        if(interrupt_xsavec_supported) {
+            // compacted save skips components at initial state, most handlers do not touch simd state
+            asm volatile (
+                "mov %[avx512f_offset], %%rbx\n"
+                "xsavec (%%rbx)\n"
+                :
+                :
+                [avx512f_offset] "r" (avx512f_offset),
+                "rax" (interrupt_xsave_mask_lo),
+                "rdx" (interrupt_xsave_mask_hi)
+                : "rbx", "memory"
+                );
+        } else {
+            asm volatile (
+                "mov %[avx512f_offset], %%rbx\n"
+                "xsave (%%rbx)\n"
+                :
+                :
+                [avx512f_offset] "r" (avx512f_offset),
+                "rax" (interrupt_xsave_mask_lo),
+                "rdx" (interrupt_xsave_mask_hi)
+                : "rbx", "memory"
+                );
+        }
     } else {
         asm volatile (
             "mov %[avx512f_offset], %%rbx\n"
@@ -326,7 +353,7 @@ static void interrupt_save_restore_avx512f(boolean_t save, interrupt_frame_ext_t
             [avx512f_offset] "r" (avx512f_offset),
             "rax" (interrupt_xsave_mask_lo),
             "rdx" (interrupt_xsave_mask_hi)
-            : "rbx"
+            : "rbx", "memory"
             );
     }
 }
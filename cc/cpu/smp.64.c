@@ -13,6 +13,7 @@
 #include <logging.h>
 #include <memory.h>
 #include <memory/paging.h>
+#include <memory/tlb.h>
 #include <memory/frame.h>
 #include <cpu.h>
 #include <cpu/crx.h>
@@ -253,6 +254,13 @@ int32_t smp_ap_boot(uint8_t cpu_id) {
 
     apic_configure_lapic();
 
+    if(memory_tlb_init() != 0) {
+        PRINTLOG(APIC, LOG_ERROR, "SMP: AP %i Failed to init tlb", cpu_id);
+        cpu_hlt();
+
+        return -1;
+    }
+
     task_set_current_and_idle_task(smp_ap_boot, stack_base, smp_data->stack_size);
 
     PRINTLOG(APIC, LOG_INFO, "SMP: AP %i Booting local apic id %i", cpu_id, local_apic_id);
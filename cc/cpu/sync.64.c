@@ -15,14 +15,47 @@
 
 MODULE("turnstone.kernel.cpu.sync");
 
+/**
+ * @struct sync_waiter_t
+ * @brief a waiting task, it lives at waiter's stack until it is granted
+ */
+typedef struct sync_waiter_t {
+    struct sync_waiter_t* next; ///< next waiter at queue
+    task_t*               task; ///< waiting task, NULL before tasking
+    uint64_t              task_id; ///< waiting task id
+    uint64_t              count; ///< requested semaphore count or rwlock mode
+    volatile boolean_t    granted; ///< set by releaser while holding queue guard
+} sync_waiter_t;
+
+/**
+ * @struct sync_wait_queue_t
+ * @brief fifo waiter queue guarded by a short spin lock taken with interrupts disabled
+ */
+typedef struct sync_wait_queue_t {
+    volatile uint64_t guard; ///< spin lock of queue
+    sync_waiter_t*    head; ///< first waiter
+    sync_waiter_t*    tail; ///< last waiter
+} sync_wait_queue_t;
+
 typedef struct lock_t {
     memory_heap_t*    heap;
     volatile uint64_t lock_value;
     uint64_t          owner_task_id;
     uint64_t          owner_cpu_id;
     boolean_t         for_future;
+    sync_wait_queue_t waiters;
 }lock_t;
 
+_Static_assert(sizeof(lock_t) == SYNC_LOCK_SIZE, "lock_t size should be equal to SYNC_LOCK_SIZE");
+
+/*! spin count before a contended lock parks its task */
+#define SYNC_SPIN_COUNT 128
+
+/*! rwlock waiter modes */
+#define SYNC_RWLOCK_READER 0
+/*! rwlock waiter modes */
+#define SYNC_RWLOCK_WRITER 1
+
 void video_text_print(const char* str);
 
 boolean_t KERNEL_PANIC_DISABLE_LOCKS = false;
@@ -30,10 +63,14 @@ boolean_t KERNEL_PANIC_DISABLE_LOCKS = false;
 typedef uint32_t (*lock_get_local_apic_id_getter_f)(void);
 typedef task_t   * (*lock_current_task_getter_f)(void);
 typedef void     (*lock_task_yielder_f)(void);
+typedef boolean_t (*lock_task_blocker_f)(void);
+typedef void      (*lock_task_waker_f)(task_t* task);
 
 lock_get_local_apic_id_getter_f lock_get_local_apic_id_getter = NULL;
 lock_current_task_getter_f lock_get_current_task_getter = NULL;
 lock_task_yielder_f lock_task_yielder = NULL;
+lock_task_blocker_f lock_task_can_block = NULL;
+lock_task_waker_f lock_task_waker = NULL;
 
 void future_task_wait_toggler(uint64_t task_id);
 
@@ -60,6 +97,139 @@ void lock_task_yield(void) {
     }
 }
 
+static uint64_t sync_get_current_task_id(task_t* current_task) {
+    if(current_task != NULL) {
+        return current_task->task_id;
+    }
+
+    return lock_get_local_apic_id() + 1; // add one for preventing bsp cpu id 0
+}
+
+static boolean_t sync_guard_lock(sync_wait_queue_t* queue) {
+    boolean_t intflag = cpu_cli();
+
+    while(__atomic_exchange_n(&queue->guard, 1, __ATOMIC_ACQUIRE)) {
+        asm volatile ("pause" ::: "memory");
+    }
+
+    return intflag;
+}
+
+static void sync_guard_unlock(sync_wait_queue_t* queue, boolean_t intflag) {
+    __atomic_store_n(&queue->guard, 0, __ATOMIC_RELEASE);
+
+    if(intflag) {
+        cpu_sti();
+    }
+}
+
+static void sync_wait_queue_push(sync_wait_queue_t* queue, sync_waiter_t* waiter) {
+    waiter->next = NULL;
+
+    if(queue->tail) {
+        queue->tail->next = waiter;
+    } else {
+        __atomic_store_n(&queue->head, waiter, __ATOMIC_SEQ_CST);
+    }
+
+    queue->tail = waiter;
+}
+
+static sync_waiter_t* sync_wait_queue_pop(sync_wait_queue_t* queue) {
+    sync_waiter_t* waiter = queue->head;
+
+    if(waiter) {
+        __atomic_store_n(&queue->head, waiter->next, __ATOMIC_SEQ_CST);
+
+        if(!waiter->next) {
+            queue->tail = NULL;
+        }
+
+        waiter->next = NULL;
+    }
+
+    return waiter;
+}
+
+static void sync_wait_queue_remove(sync_wait_queue_t* queue, sync_waiter_t* waiter) {
+    sync_waiter_t* prev = NULL;
+    sync_waiter_t* cur = queue->head;
+
+    while(cur && cur != waiter) {
+        prev = cur;
+        cur = cur->next;
+    }
+
+    if(!cur) {
+        return;
+    }
+
+    if(prev) {
+        prev->next = cur->next;
+    } else {
+        __atomic_store_n(&queue->head, cur->next, __ATOMIC_SEQ_CST);
+    }
+
+    if(queue->tail == cur) {
+        queue->tail = prev;
+    }
+
+    cur->next = NULL;
+}
+
+/**
+ * @brief grants waiter and wakes its task up, queue guard should be held.
+ * waiter checks its grant while holding guard, so task is not touched after it leaves.
+ */
+static void sync_waiter_grant(sync_waiter_t* waiter) {
+    task_t* task = waiter->task;
+
+    __atomic_store_n(&waiter->granted, true, __ATOMIC_SEQ_CST);
+
+    if(task == NULL) {
+        return;
+    }
+
+    task_state_t expected = TASK_STATE_LOCKED;
+
+    // waiter may not be parked yet, then it sees its grant before parking
+    if(__atomic_compare_exchange_n(&task->state, &expected, TASK_STATE_SUSPENDED, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        if(lock_task_waker) {
+            lock_task_waker(task);
+        }
+    }
+}
+
+/**
+ * @brief waits until waiter is granted, queue guard should be held and waiter should be queued.
+ * releases guard and restores interrupt flag before return.
+ */
+static void sync_waiter_wait(sync_wait_queue_t* queue, sync_waiter_t* waiter, boolean_t intflag) {
+    // tasks at interrupt handlers or with disabled interrupts cannot be parked, they spin
+    boolean_t can_block = intflag && waiter->task && lock_task_can_block && lock_task_can_block();
+
+    while(!waiter->granted) {
+        if(can_block) {
+            waiter->task->state = TASK_STATE_LOCKED;
+
+            // interrupts are disabled until task is switched out
+            sync_guard_unlock(queue, false);
+            lock_task_yield();
+        } else {
+            sync_guard_unlock(queue, intflag);
+            asm volatile ("pause" ::: "memory");
+
+            if(intflag) {
+                lock_task_yield();
+            }
+        }
+
+        sync_guard_lock(queue);
+    }
+
+    sync_guard_unlock(queue, intflag);
+}
+
 lock_t* lock_create_with_heap_for_future(memory_heap_t* heap, boolean_t for_future, uint64_t task_id) {
     heap = memory_get_heap(heap);
     lock_t* lock = memory_malloc_ext(heap, sizeof(lock_t), 0x0);
@@ -87,6 +257,26 @@ int8_t lock_destroy(lock_t* lock){
     return memory_free_ext(lock->heap, lock);
 }
 
+static void lock_wait(lock_t* lock, task_t* current_task, uint64_t current_task_id) {
+    sync_waiter_t waiter = {0};
+    waiter.task = current_task;
+    waiter.task_id = current_task_id;
+
+    boolean_t intflag = sync_guard_lock(&lock->waiters);
+
+    sync_wait_queue_push(&lock->waiters, &waiter);
+
+    // releaser may have missed our waiter, it clears lock value before looking at queue
+    if(!bit_locked_set(&lock->lock_value, 0)) {
+        sync_wait_queue_remove(&lock->waiters, &waiter);
+        sync_guard_unlock(&lock->waiters, intflag);
+
+        return;
+    }
+
+    sync_waiter_wait(&lock->waiters, &waiter, intflag);
+}
+
 void lock_acquire(lock_t* lock) {
     if(lock == NULL) {
         return;
@@ -101,41 +291,45 @@ void lock_acquire(lock_t* lock) {
 
     task_t* current_task = lock_get_current_task();
 
-
-    uint64_t current_task_id = current_cpu_id;
-
-    if(current_task != NULL) {
-        current_task_id = current_task->task_id;
-    }
-
+    uint64_t current_task_id = sync_get_current_task_id(current_task);
 
     if(lock->lock_value && !lock->for_future && lock->owner_cpu_id == current_cpu_id && lock->owner_task_id == current_task_id) {
         return;
     }
 
-    while(bit_locked_set(&lock->lock_value, 0)) {
-#if 0
-        if(!lock->for_future) {
-            // lock_task_yield();
-            cpu_sti();
+    // task switch allocates from heaps while parking a task, so heap locks never park their waiters
+    if(lock->heap && lock->heap->lock == lock) {
+        while(bit_locked_set(&lock->lock_value, 0)) {
             asm volatile ("pause" ::: "memory");
-        } else {
-            if(lock->owner_task_id == 0) { // when it is gpu sets future's owner task id 0
-                lock_task_yield();
-            } else {
-                cpu_sti();
+
+            lock_task_yield();
+        }
+    } else if(bit_locked_set(&lock->lock_value, 0)) {
+        boolean_t acquired = false;
+
+        // owner at another cpu probably releases soon, spinning is cheaper than a task switch
+        if(!lock->for_future) {
+            for(uint64_t i = 0; i < SYNC_SPIN_COUNT; i++) {
+                if(lock->owner_cpu_id == current_cpu_id) {
+                    break;
+                }
+
+                if(!lock->lock_value && !bit_locked_set(&lock->lock_value, 0)) {
+                    acquired = true;
+
+                    break;
+                }
+
                 asm volatile ("pause" ::: "memory");
             }
         }
-#else
-        asm volatile ("pause" ::: "memory");
 
-        lock_task_yield();
-#endif
+        if(!acquired) {
+            // lock is handed off to us by releaser, lock value is never cleared between
+            lock_wait(lock, current_task, current_task_id);
+        }
     }
 
-    asm volatile ("pause" ::: "memory");
-
     if(!lock->for_future) {
         lock->owner_task_id = current_task_id;
     }
@@ -151,19 +345,38 @@ void lock_release(lock_t* lock) {
 
         lock->owner_task_id = 0;
         lock->owner_cpu_id = 0;
-        lock->lock_value = 0;
-        asm volatile ("pause" ::: "memory");
+        __atomic_store_n(&lock->lock_value, 0, __ATOMIC_SEQ_CST);
+
+        if(!__atomic_load_n(&lock->waiters.head, __ATOMIC_SEQ_CST)) {
+            return;
+        }
+
+        boolean_t intflag = sync_guard_lock(&lock->waiters);
+
+        // a spinner may take lock meanwhile, then it hands off at its release
+        if(lock->waiters.head && !bit_locked_set(&lock->lock_value, 0)) {
+            sync_waiter_t* waiter = sync_wait_queue_pop(&lock->waiters);
+
+            if(!lock->for_future) {
+                lock->owner_task_id = waiter->task_id;
+            }
+
+            sync_waiter_grant(waiter);
+        }
+
+        sync_guard_unlock(&lock->waiters, intflag);
     }
 }
 
 typedef struct semaphore_t {
-    memory_heap_t* heap;
-    lock_t*        lock;
-    uint64_t       initial_count;
-    uint64_t       current_count;
+    memory_heap_t*    heap;
+    sync_wait_queue_t waiters;
+    uint64_t          initial_count;
+    uint64_t          current_count;
 }semaphore_t;
 
 semaphore_t* semaphore_create_with_heap(memory_heap_t* heap, uint64_t count){
+    heap = memory_get_heap(heap);
     semaphore_t* semaphore = memory_malloc_ext(heap, sizeof(semaphore_t), 0x0);
 
     if(semaphore == NULL) {
@@ -171,7 +384,6 @@ semaphore_t* semaphore_create_with_heap(memory_heap_t* heap, uint64_t count){
     }
 
     semaphore->heap = heap;
-    semaphore->lock = lock_create_with_heap(heap);
     semaphore->initial_count = count;
     semaphore->current_count = count;
 
@@ -179,7 +391,9 @@ semaphore_t* semaphore_create_with_heap(memory_heap_t* heap, uint64_t count){
 }
 
 int8_t semaphore_destroy(semaphore_t* semaphore){
-    lock_destroy(semaphore->lock);
+    if(semaphore == NULL) {
+        return -1;
+    }
 
     return memory_free_ext(semaphore->heap, semaphore);
 }
@@ -189,28 +403,32 @@ int8_t semaphore_acquire_with_count(semaphore_t* semaphore, uint64_t count){
         return -1;
     }
 
-    lock_acquire(semaphore->lock);
-
     if(semaphore->initial_count < count) {
-        lock_release(semaphore->lock);
-
         return -1;
     }
 
-    while(true) {
-        lock_acquire(semaphore->lock);
+    boolean_t intflag = sync_guard_lock(&semaphore->waiters);
 
-        if(semaphore->current_count >= count) {
-            semaphore->current_count -= count;
-            lock_release(semaphore->lock);
-
-            return 0;
-        }
+    // queued waiters go first, otherwise small requests starve big ones
+    if(!semaphore->waiters.head && semaphore->current_count >= count) {
+        semaphore->current_count -= count;
+        sync_guard_unlock(&semaphore->waiters, intflag);
 
-        lock_release(semaphore->lock);
-        lock_task_yielder();
+        return 0;
     }
 
+    task_t* current_task = lock_get_current_task();
+
+    sync_waiter_t waiter = {0};
+    waiter.task = current_task;
+    waiter.task_id = sync_get_current_task_id(current_task);
+    waiter.count = count;
+
+    sync_wait_queue_push(&semaphore->waiters, &waiter);
+
+    // releaser decreases count for us before granting
+    sync_waiter_wait(&semaphore->waiters, &waiter, intflag);
+
     return 0;
 }
 
@@ -219,17 +437,267 @@ int8_t semaphore_release_with_count(semaphore_t* semaphore, uint64_t count){
         return -1;
     }
 
-    lock_acquire(semaphore->lock);
+    boolean_t intflag = sync_guard_lock(&semaphore->waiters);
 
     if(semaphore->current_count + count > semaphore->initial_count) {
-        lock_release(semaphore->lock);
+        sync_guard_unlock(&semaphore->waiters, intflag);
 
         return -1;
     }
 
     semaphore->current_count += count;
 
-    lock_release(semaphore->lock);
+    while(semaphore->waiters.head && semaphore->waiters.head->count <= semaphore->current_count) {
+        sync_waiter_t* waiter = sync_wait_queue_pop(&semaphore->waiters);
+
+        semaphore->current_count -= waiter->count;
+
+        sync_waiter_grant(waiter);
+    }
+
+    sync_guard_unlock(&semaphore->waiters, intflag);
 
     return 0;
 }
+
+typedef struct rwlock_t {
+    memory_heap_t*    heap;
+    sync_wait_queue_t waiters;
+    uint64_t          reader_count;
+    uint64_t          writer_task_id;
+    uint64_t          writer_depth;
+}rwlock_t;
+
+rwlock_t* rwlock_create_with_heap(memory_heap_t* heap) {
+    heap = memory_get_heap(heap);
+    rwlock_t* rwlock = memory_malloc_ext(heap, sizeof(rwlock_t), 0x0);
+
+    if(rwlock == NULL) {
+        return NULL;
+    }
+
+    rwlock->heap = heap;
+
+    return rwlock;
+}
+
+int8_t rwlock_destroy(rwlock_t* rwlock) {
+    if(rwlock == NULL) {
+        return -1;
+    }
+
+    return memory_free_ext(rwlock->heap, rwlock);
+}
+
+/**
+ * @brief grants waiters after rwlock becomes free, guard should be held.
+ * a writer at head takes lock alone, otherwise readers at head take it together.
+ */
+static void rwlock_grant_waiters(rwlock_t* rwlock) {
+    if(rwlock->reader_count || rwlock->writer_depth) {
+        return;
+    }
+
+    sync_waiter_t* waiter = rwlock->waiters.head;
+
+    if(!waiter) {
+        return;
+    }
+
+    if(waiter->count == SYNC_RWLOCK_WRITER) {
+        sync_wait_queue_pop(&rwlock->waiters);
+
+        rwlock->writer_task_id = waiter->task_id;
+        rwlock->writer_depth = 1;
+
+        sync_waiter_grant(waiter);
+
+        return;
+    }
+
+    while(rwlock->waiters.head && rwlock->waiters.head->count == SYNC_RWLOCK_READER) {
+        waiter = sync_wait_queue_pop(&rwlock->waiters);
+
+        rwlock->reader_count++;
+
+        sync_waiter_grant(waiter);
+    }
+}
+
+static void rwlock_acquire(rwlock_t* rwlock, uint64_t mode) {
+    if(rwlock == NULL || KERNEL_PANIC_DISABLE_LOCKS) {
+        return;
+    }
+
+    task_t* current_task = lock_get_current_task();
+    uint64_t current_task_id = sync_get_current_task_id(current_task);
+
+    for(uint64_t i = 0; i <= SYNC_SPIN_COUNT; i++) {
+        boolean_t intflag = sync_guard_lock(&rwlock->waiters);
+
+        // writer may take lock again or read what it writes
+        if(rwlock->writer_depth && rwlock->writer_task_id == current_task_id) {
+            rwlock->writer_depth++;
+            sync_guard_unlock(&rwlock->waiters, intflag);
+
+            return;
+        }
+
+        // queued writers block new readers, otherwise a steady read load starves writers
+        boolean_t free = !rwlock->writer_depth && !rwlock->waiters.head;
+
+        if(free && mode == SYNC_RWLOCK_READER) {
+            rwlock->reader_count++;
+            sync_guard_unlock(&rwlock->waiters, intflag);
+
+            return;
+        }
+
+        if(free && mode == SYNC_RWLOCK_WRITER && !rwlock->reader_count) {
+            rwlock->writer_task_id = current_task_id;
+            rwlock->writer_depth = 1;
+            sync_guard_unlock(&rwlock->waiters, intflag);
+
+            return;
+        }
+
+        if(i == SYNC_SPIN_COUNT) {
+            sync_waiter_t waiter = {0};
+            waiter.task = current_task;
+            waiter.task_id = current_task_id;
+            waiter.count = mode;
+
+            sync_wait_queue_push(&rwlock->waiters, &waiter);
+
+            // releaser updates reader count or writer before granting
+            sync_waiter_wait(&rwlock->waiters, &waiter, intflag);
+
+            return;
+        }
+
+        sync_guard_unlock(&rwlock->waiters, intflag);
+
+        asm volatile ("pause" ::: "memory");
+    }
+}
+
+static void rwlock_release(rwlock_t* rwlock) {
+    if(rwlock == NULL || KERNEL_PANIC_DISABLE_LOCKS) {
+        return;
+    }
+
+    boolean_t intflag = sync_guard_lock(&rwlock->waiters);
+
+    if(rwlock->writer_depth) {
+        rwlock->writer_depth--;
+
+        if(!rwlock->writer_depth) {
+            rwlock->writer_task_id = 0;
+        }
+    } else if(rwlock->reader_count) {
+        rwlock->reader_count--;
+    }
+
+    rwlock_grant_waiters(rwlock);
+
+    sync_guard_unlock(&rwlock->waiters, intflag);
+}
+
+void rwlock_read_acquire(rwlock_t* rwlock) {
+    rwlock_acquire(rwlock, SYNC_RWLOCK_READER);
+}
+
+void rwlock_read_release(rwlock_t* rwlock) {
+    rwlock_release(rwlock);
+}
+
+void rwlock_write_acquire(rwlock_t* rwlock) {
+    rwlock_acquire(rwlock, SYNC_RWLOCK_WRITER);
+}
+
+void rwlock_write_release(rwlock_t* rwlock) {
+    rwlock_release(rwlock);
+}
+
+typedef struct condvar_t {
+    memory_heap_t*    heap;
+    sync_wait_queue_t waiters;
+}condvar_t;
+
+condvar_t* condvar_create_with_heap(memory_heap_t* heap) {
+    heap = memory_get_heap(heap);
+    condvar_t* condvar = memory_malloc_ext(heap, sizeof(condvar_t), 0x0);
+
+    if(condvar == NULL) {
+        return NULL;
+    }
+
+    condvar->heap = heap;
+
+    return condvar;
+}
+
+int8_t condvar_destroy(condvar_t* condvar) {
+    if(condvar == NULL) {
+        return -1;
+    }
+
+    return memory_free_ext(condvar->heap, condvar);
+}
+
+int8_t condvar_wait(condvar_t* condvar, lock_t* lock) {
+    if(condvar == NULL || lock == NULL) {
+        return -1;
+    }
+
+    task_t* current_task = lock_get_current_task();
+
+    sync_waiter_t waiter = {0};
+    waiter.task = current_task;
+    waiter.task_id = sync_get_current_task_id(current_task);
+
+    boolean_t intflag = sync_guard_lock(&condvar->waiters);
+
+    // waiter is queued before lock is released, so a signal after state change is not lost
+    sync_wait_queue_push(&condvar->waiters, &waiter);
+
+    lock_release(lock);
+
+    sync_waiter_wait(&condvar->waiters, &waiter, intflag);
+
+    lock_acquire(lock);
+
+    return 0;
+}
+
+void condvar_signal(condvar_t* condvar) {
+    if(condvar == NULL) {
+        return;
+    }
+
+    boolean_t intflag = sync_guard_lock(&condvar->waiters);
+
+    sync_waiter_t* waiter = sync_wait_queue_pop(&condvar->waiters);
+
+    if(waiter) {
+        sync_waiter_grant(waiter);
+    }
+
+    sync_guard_unlock(&condvar->waiters, intflag);
+}
+
+void condvar_broadcast(condvar_t* condvar) {
+    if(condvar == NULL) {
+        return;
+    }
+
+    boolean_t intflag = sync_guard_lock(&condvar->waiters);
+
+    sync_waiter_t* waiter;
+
+    while((waiter = sync_wait_queue_pop(&condvar->waiters)) != NULL) {
+        sync_waiter_grant(waiter);
+    }
+
+    sync_guard_unlock(&condvar->waiters, intflag);
+}
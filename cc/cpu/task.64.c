@@ -14,6 +14,7 @@
 #include <cpu/sync.h>
 #include <memory/paging.h>
 #include <memory/frame.h>
+#include <memory/tlb.h>
 #include <list.h>
 #include <time.h>
 #include <time/timer.h>
@@ -36,12 +37,23 @@ void video_text_print(const char_t* str);
 typedef task_t * (*memory_current_task_getter_f)(void);
 void memory_set_current_task_getter(memory_current_task_getter_f getter);
 
+typedef uint64_t (*memory_current_cpu_id_getter_f)(void);
+void memory_set_current_cpu_id_getter(memory_current_cpu_id_getter_f getter);
+
 typedef task_t * (*lock_current_task_getter_f)(void);
 extern lock_current_task_getter_f lock_get_current_task_getter;
 
 typedef void (*lock_task_yielder_f)(void);
 extern lock_task_yielder_f lock_task_yielder;
 
+typedef boolean_t (*lock_task_blocker_f)(void);
+extern lock_task_blocker_f lock_task_can_block;
+
+typedef void (*lock_task_waker_f)(task_t* task);
+extern lock_task_waker_f lock_task_waker;
+
+static boolean_t task_can_block(void);
+
 typedef buffer_t * (*stdbuf_task_buffer_getter_f)(void);
 extern stdbuf_task_buffer_getter_f stdbufs_task_get_input_buffer;
 extern stdbuf_task_buffer_getter_f stdbufs_task_get_output_buffer;
@@ -61,12 +73,13 @@ volatile boolean_t task_tasking_initialized = false;
 
 memory_heap_t* task_map_heap = NULL;
 memory_heap_t** task_queue_and_cleanup_heaps = NULL;
-list_t** task_queues = NULL;
-list_t** task_sleep_queues; ///< task sleep lists
+task_run_queue_t** task_run_queues = NULL;
+uint64_t task_run_queue_count = 0;
 list_t** task_wait_queues; ///< task wait lists
 list_t** task_cleanup_queues = NULL;
 hashmap_t* task_map = NULL;
 uint64_t task_xsave_mask = 0;
+boolean_t task_xsaveopt_supported = false;
 uint32_t task_mxcsr_mask = 0;
 
 uint64_t task_max_tick_count_limit = 0;
@@ -96,13 +109,10 @@ uint32_t task_get_task_mxcsr_mask(void) {
 }
 
 
-static int8_t task_sleep_queue_comparator(const void* item1, const void* item2) {
-    const task_t* t1 = (const task_t*)item1;
-    const task_t* t2 = (const task_t*)item2;
-
-    if(t1->wake_tick < t2->wake_tick) {
+static int8_t task_identity_comparator(const void* item1, const void* item2) {
+    if(item1 < item2) {
         return -1;
-    } else if(t1->wake_tick > t2->wake_tick) {
+    } else if(item1 > item2) {
         return 1;
     }
 
@@ -206,8 +216,7 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
     uint32_t cpu_count = apic_get_ap_count() + 1;
 
     task_queue_and_cleanup_heaps = memory_malloc_ext(heap, sizeof(memory_heap_t*) * cpu_count, 0x0);
-    task_queues = memory_malloc_ext(heap, sizeof(list_t*) * cpu_count, 0x0);
-    task_sleep_queues = memory_malloc_ext(heap, sizeof(list_t*) * cpu_count, 0x0);
+    task_run_queues = memory_malloc_ext(heap, sizeof(task_run_queue_t*) * cpu_count, 0x0);
     task_wait_queues = memory_malloc_ext(heap, sizeof(list_t*) * cpu_count, 0x0);
     task_cleanup_queues = memory_malloc_ext(heap, sizeof(list_t*) * cpu_count, 0x0);
 
@@ -237,12 +246,23 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
         PRINTLOG(TASKING, LOG_INFO, "cpu 0x%x task related heap 0x%p", i, task_related_heap);
 
         task_queue_and_cleanup_heaps[i] = task_related_heap;
-        task_queues[i] = list_create_queue_with_heap(task_related_heap);
-        task_sleep_queues[i] = list_create_sortedlist_with_heap(task_related_heap, &task_sleep_queue_comparator);
+        task_run_queues[i] = memory_malloc_ext(task_related_heap, sizeof(task_run_queue_t), 0x40);
+
+        if(task_run_queues[i] == NULL) {
+            PRINTLOG(TASKING, LOG_FATAL, "cannot allocate run queue for cpu 0x%x", i);
+
+            return -1;
+        }
+
+        task_run_queues[i]->overflow_queue = list_create_queue_with_heap(task_related_heap);
         task_wait_queues[i] = list_create_queue_with_heap(task_related_heap);
+        // tasks are removed from wait list by identity when woken up
+        list_set_equality_comparator(task_wait_queues[i], &task_identity_comparator);
         task_cleanup_queues[i] = list_create_queue_with_heap(task_related_heap);
     }
 
+    task_run_queue_count = cpu_count;
+
     {
         frame_t* task_related_heap_frames = NULL;
 
@@ -271,8 +291,7 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
     }
 
 
-    current_cpu_state->task_queue = task_queues[0];
-    current_cpu_state->task_sleep_queue = task_sleep_queues[0];
+    current_cpu_state->task_queue = task_run_queues[0];
     current_cpu_state->task_wait_queue = task_wait_queues[0];
     current_cpu_state->task_cleanup_queue = task_cleanup_queues[0];
 
@@ -291,6 +310,7 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
     kernel_task->heap_size = kernel->program_heap_size;
     kernel_task->task_id = cpu_count + 1;
     kernel_task->state = TASK_STATE_RUNNING;
+    kernel_task->attributes = TASK_ATTRIBUTE_PINNED; // kernel init tasks do cpu specific work
     kernel_task->entry_point = kmain64;
     kernel_task->page_table = memory_paging_get_table();
     kernel_task->registers = memory_malloc_ext(task_map_heap, sizeof(task_registers_t), 0x40);
@@ -325,6 +345,14 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
 
     PRINTLOG(TASKING, LOG_INFO, "xsave mask 0x%llx", task_xsave_mask);
 
+    query.ecx = 0x1;
+
+    cpu_cpuid(query, &result);
+
+    task_xsaveopt_supported = (result.eax & 0x1) == 0x1;
+
+    PRINTLOG(TASKING, LOG_INFO, "xsaveopt supported %i", task_xsaveopt_supported);
+
     // get mxcsr
     task_save_registers(kernel_task->registers);
 
@@ -373,9 +401,12 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
     PRINTLOG(TASKING, LOG_INFO, "tasking system initialization ended, kernel task address 0x%p lapic id %d", kernel_task, apic_id);
 
     memory_set_current_task_getter(&task_get_current_task);
+    memory_set_current_cpu_id_getter(&task_get_cpu_id);
 
     lock_get_current_task_getter = &task_get_current_task;
     lock_task_yielder = &task_yield;
+    lock_task_can_block = &task_can_block;
+    lock_task_waker = &task_wakeup;
 
     stdbufs_task_get_input_buffer = &task_get_input_buffer;
     stdbufs_task_get_output_buffer = &task_get_output_buffer;
@@ -386,6 +417,9 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
     task_tasking_initialized = true;
     cpu_state->tasking_enabled = true;
 
+    // at tickless mode kernel task's time slice should be armed, there is no periodic tick
+    time_timer_wheel_program(rdtsc() + task_max_tick_count_limit);
+
     return 0;
 }
 #pragma GCC diagnostic pop
@@ -396,14 +430,13 @@ int8_t task_set_current_and_idle_task(void* entry_point, uint64_t stack_base, ui
 
     uint32_t apic_id = apic_get_local_apic_id();
 
-    if(task_queues[apic_id] == NULL || task_cleanup_queues[apic_id] == NULL) {
+    if(task_run_queues[apic_id] == NULL || task_cleanup_queues[apic_id] == NULL) {
         PRINTLOG(TASKING, LOG_FATAL, "task queues for apic id %d are null", apic_id);
 
         return -1;
     }
 
-    cpu_state->task_queue = task_queues[apic_id];
-    cpu_state->task_sleep_queue = task_sleep_queues[apic_id];
+    cpu_state->task_queue = task_run_queues[apic_id];
     cpu_state->task_wait_queue = task_wait_queues[apic_id];
     cpu_state->task_cleanup_queue = task_cleanup_queues[apic_id];
 
@@ -431,6 +464,7 @@ int8_t task_set_current_and_idle_task(void* entry_point, uint64_t stack_base, ui
     current_task->heap = heap;
     current_task->heap_size = kernel->program_heap_size;
     current_task->state = TASK_STATE_RUNNING;
+    current_task->attributes = TASK_ATTRIBUTE_PINNED; // kernel init tasks do cpu specific work
     current_task->entry_point = entry_point;
     current_task->page_table = memory_paging_get_table();
     current_task->registers = memory_malloc_ext(heap, sizeof(task_registers_t), 0x40);
@@ -473,6 +507,9 @@ int8_t task_set_current_and_idle_task(void* entry_point, uint64_t stack_base, ui
 
     cpu_state->tasking_enabled = true;
 
+    // at tickless mode kernel init task's time slice should be armed, there is no periodic tick
+    time_timer_wheel_program(rdtsc() + task_max_tick_count_limit);
+
     return 0;
 }
 
@@ -499,7 +536,13 @@ __attribute__((naked, no_stack_protector, noinline)) void task_save_registers(ta
         "mov %[xsave_mask_lo], %%eax\n"
         "mov %[xsave_mask_hi], %%edx\n"
         "lea %[avx512f], %%rbx\n"
+        "cmpl $0x0, %[xsave_optimized]\n"
+        "je 1f\n"
+        "xsaveopt (%%rbx)\n"
+        "jmp 2f\n"
+        "1:\n"
         "xsave (%%rbx)\n"
+        "2:\n"
         "pop %%rdx\n"
         "pop %%rax\n"
         "pop %%rbx\n"
@@ -534,7 +577,8 @@ __attribute__((naked, no_stack_protector, noinline)) void task_save_registers(ta
         [rsp]    "m" (registers->rsp),
         [cr3]     "m" (registers->cr3),
         [xsave_mask_lo] "m" (registers->xsave_mask_lo),
-        [xsave_mask_hi] "m" (registers->xsave_mask_hi)
+        [xsave_mask_hi] "m" (registers->xsave_mask_hi),
+        [xsave_optimized] "m" (registers->xsave_optimized)
         );
 }
 
@@ -560,7 +604,9 @@ __attribute__((naked, no_stack_protector, noinline)) void task_load_registers(ta
         "push %%rax\n"
         "popfq\n"
         "mov %%cr3, %%rax\n"
-        "cmp %[cr3], %%rax\n"
+        "mov %[cr3], %%rbx\n"
+        "btr $63, %%rbx\n" // ignore pcid no flush bit, cr3 reads never return it
+        "cmp %%rbx, %%rax\n"
         "je 1f\n"
         "mov %[cr3], %%rax\n"
         "mov %%rax, %%cr3\n"
@@ -663,6 +709,271 @@ static void task_cleanup_task(task_t* task) {
     memory_free_ext(task->creator_heap, task);
 }
 
+static boolean_t task_run_queue_push(task_run_queue_t* run_queue, task_t* task) {
+    uint64_t tail = run_queue->tail;
+    uint64_t head = __atomic_load_n(&run_queue->head, __ATOMIC_ACQUIRE);
+
+    if(tail - head >= TASK_RUN_QUEUE_SIZE) {
+        return false;
+    }
+
+    run_queue->tasks[tail & (TASK_RUN_QUEUE_SIZE - 1)] = task;
+    __atomic_store_n(&run_queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    run_queue->push_count++;
+
+    return true;
+}
+
+static task_t* task_run_queue_pop(task_run_queue_t* run_queue, boolean_t steal) {
+    while(true) {
+        uint64_t head = __atomic_load_n(&run_queue->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = __atomic_load_n(&run_queue->tail, __ATOMIC_ACQUIRE);
+
+        if(head >= tail) {
+            return NULL;
+        }
+
+        task_t* task = run_queue->tasks[head & (TASK_RUN_QUEUE_SIZE - 1)];
+
+        // vmcs is loaded per cpu, and pinned tasks should stay at their cpu, a blocked head stops stealing from this queue
+        if(steal && ((task->attributes & TASK_ATTRIBUTE_PINNED) || task->vm || task->vmcs_physical_address)) {
+            return NULL;
+        }
+
+        if(__atomic_compare_exchange_n(&run_queue->head, &head, head + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return task;
+        }
+    }
+}
+
+static inline uint64_t task_run_queue_depth(task_run_queue_t* run_queue) {
+    uint64_t head = __atomic_load_n(&run_queue->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&run_queue->tail, __ATOMIC_ACQUIRE);
+
+    return tail > head ? tail - head : 0;
+}
+
+/**
+ * @brief at tickless mode idle cpus are not interrupted periodically, wakes one of them to steal queued tasks.
+ * @param[in] run_queue run queue which has new tasks
+ */
+static void task_run_queue_kick_idle(task_run_queue_t* run_queue) {
+    if(!time_timer_is_tickless()) {
+        return;
+    }
+
+    // pairs with idle flag set at task_find_next_task, either pushed task is seen there or idle flag is seen here
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if(task_run_queue_depth(run_queue) == 0) {
+        return;
+    }
+
+    for(uint64_t i = 0; i < task_run_queue_count; i++) {
+        task_run_queue_t* idle_queue = task_run_queues[i];
+
+        if(idle_queue == run_queue) {
+            continue;
+        }
+
+        uint64_t expected = 1;
+
+        // only one kicker wakes an idle cpu, it sets its flag again if there is nothing to steal
+        if(__atomic_compare_exchange_n(&idle_queue->idle, &expected, 0, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            apic_send_ipi(i, 0xFE, false);
+
+            return;
+        }
+    }
+}
+
+/**
+ * @brief adds a runnable task to current cpu's run queue, it is safe to call at task context.
+ * @param[in] task runnable task
+ */
+static void task_run_queue_add(task_t* task) {
+    boolean_t intr = cpu_cli();
+
+    task_run_queue_t* run_queue = cpu_state->task_queue;
+
+    if(!task_run_queue_push(run_queue, task)) {
+        list_queue_push(run_queue->overflow_queue, task);
+    }
+
+    task_run_queue_kick_idle(run_queue);
+
+    if(intr) {
+        cpu_sti();
+    }
+}
+
+static task_t* task_run_queue_steal(void) {
+    task_run_queue_t* own_queue = cpu_state->task_queue;
+    task_run_queue_t* victim = NULL;
+    uint64_t victim_depth = 0;
+
+    for(uint64_t i = 0; i < task_run_queue_count; i++) {
+        task_run_queue_t* run_queue = task_run_queues[i];
+
+        if(run_queue == own_queue) {
+            continue;
+        }
+
+        uint64_t depth = task_run_queue_depth(run_queue);
+
+        if(depth > victim_depth) {
+            victim_depth = depth;
+            victim = run_queue;
+        }
+    }
+
+    if(!victim) {
+        return NULL;
+    }
+
+    task_t* task = task_run_queue_pop(victim, true);
+
+    if(task) {
+        own_queue->steal_count++;
+        __atomic_add_fetch(&victim->stolen_count, 1, __ATOMIC_RELAXED);
+    }
+
+    return task;
+}
+
+static boolean_t task_has_message(const task_t* task) {
+    if(!task->message_queues) {
+        return false;
+    }
+
+    for(uint64_t q_idx = 0; q_idx < list_size(task->message_queues); q_idx++) {
+        list_t* q = (list_t*)list_get_data_at_position(task->message_queues, q_idx);
+
+        if(list_size(q)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static boolean_t task_is_wait_ended(const task_t* task) {
+    // these waits end with a state change before wake up
+    if(task->state == TASK_STATE_FUTURE_WAITING || task->state == TASK_STATE_SLEEPING || task->state == TASK_STATE_LOCKED) {
+        return false;
+    }
+
+    if(task->state == TASK_STATE_MESSAGE_WAITING) {
+        return task_has_message(task);
+    }
+
+    return true;
+}
+
+static void task_wait_queue_release(task_run_queue_t* run_queue, task_t* task) {
+    run_queue->wake_count++;
+
+    // wake up arrived while task is switching out, we are still at its stack
+    if(task == cpu_state->current_task) {
+        run_queue->pending_task = task;
+
+        return;
+    }
+
+    if(!task_run_queue_push(run_queue, task)) {
+        list_queue_push(run_queue->overflow_queue, task);
+    }
+
+    task_run_queue_kick_idle(run_queue);
+}
+
+static boolean_t task_wake_queue_push(task_run_queue_t* run_queue, task_t* task) {
+    uint64_t tail = __atomic_load_n(&run_queue->wake_tail, __ATOMIC_ACQUIRE);
+
+    while(true) {
+        uint64_t head = __atomic_load_n(&run_queue->wake_head, __ATOMIC_ACQUIRE);
+
+        if(tail - head >= TASK_RUN_QUEUE_WAKE_SIZE) {
+            return false;
+        }
+
+        if(__atomic_compare_exchange_n(&run_queue->wake_tail, &tail, tail + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+    }
+
+    __atomic_store_n(&run_queue->wakes[tail & (TASK_RUN_QUEUE_WAKE_SIZE - 1)], task, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static void task_wake_queue_drain(task_run_queue_t* run_queue) {
+    list_t* wait_queue = cpu_state->task_wait_queue;
+    uint64_t head = run_queue->wake_head;
+
+    while(head < __atomic_load_n(&run_queue->wake_tail, __ATOMIC_ACQUIRE)) {
+        task_t* task = __atomic_exchange_n(&run_queue->wakes[head & (TASK_RUN_QUEUE_WAKE_SIZE - 1)], NULL, __ATOMIC_ACQ_REL);
+
+        if(!task) {
+            // waker reserved the slot but not written yet, it will be taken at next task switch
+            break;
+        }
+
+        head++;
+        __atomic_store_n(&run_queue->wake_head, head, __ATOMIC_RELEASE);
+
+        // new tasks created by other cpus are not at wait queue, only first wake up of them is taken
+        if(task->handover && __atomic_exchange_n(&task->handover, false, __ATOMIC_ACQ_REL)) {
+            task_wait_queue_release(run_queue, task);
+
+            continue;
+        }
+
+        size_t position = 0;
+
+        // stale or duplicate wake ups are ignored, task should be parked and its wait should be ended
+        if(!task_is_wait_ended(task) || list_get_position(wait_queue, task, &position) != 0) {
+            continue;
+        }
+
+        list_delete_at_position(wait_queue, position);
+        task_wait_queue_release(run_queue, task);
+    }
+
+    if(__atomic_exchange_n(&run_queue->wake_overflow, 0, __ATOMIC_ACQ_REL)) {
+        // some wake ups are lost, fallback to scanning wait queue
+        for(uint64_t i = 0; i < list_size(wait_queue);) {
+            task_t* task = (task_t*)list_get_data_at_position(wait_queue, i);
+
+            if(task_is_wait_ended(task)) {
+                list_delete_at_position(wait_queue, i);
+                task_wait_queue_release(run_queue, task);
+            } else {
+                i++;
+            }
+        }
+    }
+}
+
+void task_wakeup(task_t* task) {
+    if(!task || !task_run_queues || task->cpu_id >= task_run_queue_count) {
+        return;
+    }
+
+    uint64_t cpu_id = task->cpu_id;
+    task_run_queue_t* run_queue = task_run_queues[cpu_id];
+
+    if(!task_wake_queue_push(run_queue, task)) {
+        __atomic_store_n(&run_queue->wake_overflow, 1, __ATOMIC_RELEASE);
+    }
+
+    // an idle cpu is not switched until next interrupt, at tickless mode it may never come
+    if(cpu_id != cpu_state->local_apic_id || cpu_state->current_task == cpu_state->idle_task) {
+        apic_send_ipi(cpu_id, 0xFE, false);
+    }
+}
+
 void task_cleanup(void){
     while(list_size(cpu_state->task_cleanup_queue)) {
         task_t* task = (task_t*)list_queue_pop(cpu_state->task_cleanup_queue);
@@ -670,72 +981,57 @@ void task_cleanup(void){
     }
 }
 
-task_t* task_find_next_task(void) {
-    task_t* tmp_task = NULL;
+/**
+ * @brief finds a runnable task at own queues or steals one, ended tasks are moved to cleanup queue.
+ * @param[in] run_queue cpu's run queue
+ * @return runnable task or NULL
+ */
+static task_t* task_find_runnable_task(task_run_queue_t* run_queue) {
+    while(true) {
+        task_wake_queue_drain(run_queue);
 
-    if(list_size(cpu_state->task_sleep_queue)) {
-        task_t* t = (task_t*)list_get_data_at_position(cpu_state->task_sleep_queue, 0);
+        task_t* tmp_task = task_run_queue_pop(run_queue, false);
 
-        if(t->wake_tick < time_timer_get_tick_count()) {
-            tmp_task = (task_t*)list_delete_at_position(cpu_state->task_sleep_queue, 0);
+        if(!tmp_task && list_size(run_queue->overflow_queue)) {
+            tmp_task = (task_t*)list_queue_pop(run_queue->overflow_queue);
         }
-    }
 
-    if(!tmp_task && list_size(cpu_state->task_wait_queue)) {
-        uint64_t found_index = -1;
-
-        for(uint64_t i = 0; i < list_size(cpu_state->task_wait_queue); i++) {
-            task_t* t = (task_t*)list_get_data_at_position(cpu_state->task_wait_queue, i);
-
-            if(t->state == TASK_STATE_FUTURE_WAITING) {
-                continue;
-            } else if(t->state == TASK_STATE_INTERRUPT_RECEIVED) {
-                found_index = i;
-                break;
-            } else if(t->state == TASK_STATE_MESSAGE_WAITING) {
-                if(t->message_queues) {
-                    for(uint64_t q_idx = 0; q_idx < list_size(t->message_queues); q_idx++) {
-                        list_t* q = (list_t*)list_get_data_at_position(t->message_queues, q_idx);
-
-                        if(list_size(q)) {
-                            found_index = i;
-                            break;
-                        }
-                    }
-                }
-
-            } else { // wait status cleared task
-                if(t->state != TASK_STATE_SUSPENDED) {
-                    video_text_print("task_find_next_task: task state is not suspended: 0x");
-                    char_t buf[16] = {0};
-                    utoh_with_buffer(buf, t->state);
-                    video_text_print(buf);
-                    video_text_print("\n");
-                }
-
-                found_index = i;
-                break;
-            }
+        if(!tmp_task && run_queue->pending_task) {
+            tmp_task = run_queue->pending_task;
+            run_queue->pending_task = NULL;
         }
 
-        if(found_index != -1ULL) {
-            tmp_task = (task_t*)list_delete_at_position(cpu_state->task_wait_queue, found_index);
+        if(!tmp_task) {
+            tmp_task = task_run_queue_steal();
         }
-    }
 
-    if(!tmp_task && list_size(cpu_state->task_queue)) {
-        tmp_task = (task_t*)list_queue_pop(cpu_state->task_queue);
+        if(!tmp_task || tmp_task->state != TASK_STATE_ENDED) {
+            return tmp_task;
+        }
+
+        list_queue_push(cpu_state->task_cleanup_queue, tmp_task);
     }
+}
+
+task_t* task_find_next_task(void) {
+    task_run_queue_t* run_queue = cpu_state->task_queue;
+
+    task_t* tmp_task = task_find_runnable_task(run_queue);
 
     if(!tmp_task) {
-        tmp_task = (task_t*)cpu_state->idle_task;
+        // cpu is idle before last look, a task queued after it kicks this cpu
+        __atomic_store_n(&run_queue->idle, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        tmp_task = task_find_runnable_task(run_queue);
     }
 
-    if(tmp_task->state == TASK_STATE_ENDED) {
-        list_queue_push(cpu_state->task_cleanup_queue, tmp_task);
-        tmp_task = (task_t*)cpu_state->idle_task;
+    if(!tmp_task) {
+        return (task_t*)cpu_state->idle_task;
     }
 
+    __atomic_store_n(&run_queue->idle, 0, __ATOMIC_RELEASE);
+
     return tmp_task;
 }
 
@@ -752,15 +1048,46 @@ void task_task_switch_exit(void) {
 
 static char_t task_switch_task_id_buf[100] = {0};
 
+/**
+ * @brief at tickless mode programs cpu's one shot timer for task's time slice end and timer wheel events.
+ * idle task does not have a time slice.
+ * @param[in] task task which will run
+ */
+static inline void task_program_timer(const task_t* task) {
+    if(!time_timer_is_tickless()) {
+        return;
+    }
+
+    uint64_t slice_deadline = 0;
+
+    if(task != cpu_state->idle_task) {
+        slice_deadline = task->last_tick_count + task_max_tick_count_limit;
+    }
+
+    time_timer_wheel_program(slice_deadline);
+}
+
 __attribute__((no_stack_protector)) void task_switch_task(void) {
     task_t* current_task = cpu_state->current_task;
 
+    task_run_queue_t* run_queue = cpu_state->task_queue;
+
+    // previous switched out task's stack is not in use anymore, publish it for thieves
+    if(run_queue->pending_task) {
+        if(!task_run_queue_push(run_queue, run_queue->pending_task)) {
+            list_queue_push(run_queue->overflow_queue, run_queue->pending_task);
+        }
+
+        run_queue->pending_task = NULL;
+    }
+
     uint64_t current_tick = rdtsc();
 
     if(current_task != cpu_state->idle_task &&
        current_task->state == TASK_STATE_RUNNING &&
        (current_tick - current_task->last_tick_count) < task_max_tick_count_limit &&
        current_tick > current_task->last_tick_count) {
+        task_program_timer(current_task);
 
         return;
     }
@@ -779,7 +1106,20 @@ __attribute__((no_stack_protector)) void task_switch_task(void) {
         }
     }
 
-    task_save_registers(current_task->registers);
+    task_registers_t* registers = current_task->registers;
+
+    if(cpu_state->task_switch_paramters_need_eoi) {
+        // switched at interrupt, interrupt return restores extended state from interrupt frame
+        registers->xsave_mask_lo = 0;
+        registers->xsave_mask_hi = 0;
+    } else {
+        // modified optimization is valid only if last load restored all components from this area
+        registers->xsave_optimized = task_xsaveopt_supported && (registers->xsave_mask_lo || registers->xsave_mask_hi);
+        registers->xsave_mask_lo = task_xsave_mask & 0xFFFFFFFF;
+        registers->xsave_mask_hi = task_xsave_mask >> 32;
+    }
+
+    task_save_registers(registers);
 
     if(current_task->state == TASK_STATE_RUNNING) {
         current_task->state = TASK_STATE_SUSPENDED;
@@ -789,14 +1129,22 @@ __attribute__((no_stack_protector)) void task_switch_task(void) {
         switch(current_task->state) {
         case TASK_STATE_SUSPENDED:
         case TASK_STATE_STARTING:
-            list_queue_push(cpu_state->task_queue, current_task);
+        case TASK_STATE_INTERRUPT_RECEIVED: // woken up before parking
+            // we are still at its stack, other cpus should not steal it until next switch
+            run_queue->pending_task = current_task;
+            break;
+        case TASK_STATE_MESSAGE_WAITING:
+            // messages arrived before parking do not trigger a wake up
+            if(task_has_message(current_task)) {
+                current_task->state = TASK_STATE_SUSPENDED;
+                run_queue->pending_task = current_task;
+            } else {
+                list_queue_push(cpu_state->task_wait_queue, current_task);
+            }
             break;
         case TASK_STATE_ENDED:
             list_queue_push(cpu_state->task_cleanup_queue, current_task);
             break;
-        case TASK_STATE_SLEEPING:
-            list_sortedlist_insert(cpu_state->task_sleep_queue, current_task);
-            break;
         default:
             list_queue_push(cpu_state->task_wait_queue, current_task);
             break;
@@ -810,6 +1158,7 @@ __attribute__((no_stack_protector)) void task_switch_task(void) {
     current_task = task_find_next_task();
     current_task->last_tick_count = rdtsc();
     current_task->task_switch_count++;
+    current_task->cpu_id = cpu_state->local_apic_id;
 
     switch(current_task->state) {
     case TASK_STATE_CREATED:
@@ -822,6 +1171,12 @@ __attribute__((no_stack_protector)) void task_switch_task(void) {
 
     cpu_state->current_task = current_task;
 
+    task_program_timer(current_task);
+
+    if(current_task->page_table) {
+        current_task->registers->cr3 = memory_tlb_get_cr3(current_task->page_table);
+    }
+
     if(current_task->vmcs_physical_address) {
         if(cpu_get_type() == CPU_TYPE_INTEL) {
             if(vmx_vmptrld(current_task->vmcs_physical_address) != 0) {
@@ -929,22 +1284,34 @@ void task_kill_task(uint64_t task_id, boolean_t force) {
         }
     }
 
-    if(task->state == TASK_STATE_SLEEPING) {
-        list_list_delete(cpu_state->task_sleep_queue, task);
-        list_queue_push(cpu_state->task_queue, task);
-    } else if(task->state == TASK_STATE_FUTURE_WAITING ||
-              task->state == TASK_STATE_INTERRUPT_RECEIVED ||
-              task->state == TASK_STATE_MESSAGE_WAITING) {
-        list_list_delete(cpu_state->task_wait_queue, task);
-        list_queue_push(cpu_state->task_queue, task);
+    task_state_t old_state = task->state;
+
+    if(old_state == TASK_STATE_LOCKED) {
+        // its waiter is linked into a lock queue from its stack, task can end only after it is granted
+        PRINTLOG(TASKING, LOG_WARNING, "task 0x%llx is blocked on a lock, it cannot be killed", task->task_id);
+
+        return;
+    }
+
+    if(old_state == TASK_STATE_SLEEPING && task->sleep_timer) {
+        // timer is at task's stack, it should be gone before task cleanup
+        time_timer_cancel(task->sleep_timer);
     }
 
     task->state = TASK_STATE_ENDED;
 
+    if(old_state == TASK_STATE_SLEEPING ||
+       old_state == TASK_STATE_FUTURE_WAITING ||
+       old_state == TASK_STATE_MESSAGE_WAITING) {
+        // owner cpu moves it from its wait queue to cleanup queue
+        task_wakeup(task);
+    }
+
     PRINTLOG(TASKING, LOG_INFO, "task 0x%llx will be ended", task->task_id);
 }
 
-uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name) {
+static uint64_t task_create_task_ext(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name,
+                                     uint64_t cpu_id, task_attribute_t attributes) {
     heap = task_map_heap; // override heap
 
     task_t* new_task = memory_malloc_ext(heap, sizeof(task_t), 0x0);
@@ -966,6 +1333,7 @@ uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stac
 
     frame_t* stack_frames;
     uint64_t stack_frames_cnt = (stack_size + FRAME_SIZE - 1) / FRAME_SIZE;
+    stack_frames_cnt = MEMORY_PAGING_HUGE_PAGE_FRAME_COUNT(stack_frames_cnt);
     stack_size = stack_frames_cnt * FRAME_SIZE;
 
     if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), stack_frames_cnt, FRAME_ALLOCATION_TYPE_USED | FRAME_ALLOCATION_TYPE_BLOCK, &stack_frames, NULL) != 0) {
@@ -978,6 +1346,8 @@ uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stac
 
     frame_t* heap_frames;
     uint64_t heap_frames_cnt = (heap_size + FRAME_SIZE - 1) / FRAME_SIZE;
+    // large heaps are backed by 2m pages, hash heap pools and big buffers inside them use less tlb entries
+    heap_frames_cnt = MEMORY_PAGING_HUGE_PAGE_FRAME_COUNT(heap_frames_cnt);
     heap_size = heap_frames_cnt * FRAME_SIZE;
 
     if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), heap_frames_cnt, FRAME_ALLOCATION_TYPE_USED | FRAME_ALLOCATION_TYPE_BLOCK, &heap_frames, NULL) != 0) {
@@ -1077,29 +1447,44 @@ uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stac
     PRINTLOG(TASKING, LOG_INFO, "scheduling new task %s 0x%llx 0x%p stack at 0x%llx-0x%llx heap at 0x%p[0x%llx]",
              new_task->task_name, new_task->task_id, new_task, registers->rsp, registers->rbp, new_task->heap, new_task->heap_size);
 
-    uint64_t cpu_count = apic_get_ap_count() + 1;
-    size_t min_queue_size = -1;
-    list_t* min_queue = NULL;
+    new_task->attributes = attributes;
+
+    hashmap_put(task_map, (void*)new_task->task_id, new_task);
 
-    for(uint64_t i = 0; i < cpu_count; i++) {
-        list_t* queue = task_queues[i];
+    if(cpu_id < task_run_queue_count && cpu_id != cpu_state->local_apic_id) {
+        // only owner cpu pushes its run queue, new task waits at wake queue of target cpu until it is drained
+        new_task->cpu_id = cpu_id;
+        new_task->handover = true;
 
-        if(list_size(queue) < min_queue_size) {
-            min_queue_size = list_size(queue);
-            min_queue = queue;
-            new_task->cpu_id = i;
+        if(task_wake_queue_push(task_run_queues[cpu_id], new_task)) {
+            apic_send_ipi(cpu_id, 0xFE, false);
+        } else {
+            PRINTLOG(TASKING, LOG_WARNING, "wake queue of cpu 0x%llx is full, task 0x%llx stays at current cpu", cpu_id, new_task->task_id);
+
+            new_task->handover = false;
+            new_task->cpu_id = cpu_state->local_apic_id;
+            task_run_queue_add(new_task);
         }
+    } else {
+        // task starts at creator's cpu, idle cpus steal it if creator's cpu is busy and it is not pinned
+        new_task->cpu_id = cpu_state->local_apic_id;
+        task_run_queue_add(new_task);
     }
 
-    hashmap_put(task_map, (void*)new_task->task_id, new_task);
-    list_stack_push(min_queue, new_task);
-
 
     PRINTLOG(TASKING, LOG_INFO, "task %s 0x%llx added to task queue on cpu 0x%llx", new_task->task_name, new_task->task_id, new_task->cpu_id);
 
     return new_task->task_id;
 }
 
+uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name) {
+    return task_create_task_ext(heap, heap_size, stack_size, entry_point, args_cnt, args, task_name, cpu_state->local_apic_id, TASK_ATTRIBUTE_NONE);
+}
+
+uint64_t task_create_task_on_cpu(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name, uint64_t cpu_id) {
+    return task_create_task_ext(heap, heap_size, stack_size, entry_point, args_cnt, args, task_name, cpu_id, TASK_ATTRIBUTE_PINNED);
+}
+
 void task_idle_task(void) {
     cpu_cpuid_regs_t query = {0};
     query.eax = 0x1;
@@ -1249,6 +1634,18 @@ int8_t task_create_idle_task(void) {
 }
 #pragma GCC diagnostic pop
 
+/**
+ * @brief checks current task can be parked by a lock, idle task and early boot tasks cannot wait
+ * @return true if current task can be switched out until it is woken up
+ */
+static boolean_t task_can_block(void) {
+    if(!task_tasking_initialized || !cpu_state->tasking_enabled) {
+        return false;
+    }
+
+    return cpu_state->current_task != NULL && cpu_state->current_task != cpu_state->idle_task;
+}
+
 void task_yield(void) {
     if(!task_tasking_initialized || !cpu_state->tasking_enabled) {
         return;
@@ -33,6 +33,8 @@ void video_text_print(const char_t* str);
 
 extern volatile cpu_state_t __seg_gs * cpu_state;
 extern hashmap_t* task_map;
+extern task_run_queue_t** task_run_queues;
+extern uint64_t task_run_queue_count;
 
 uint64_t task_get_id(void) {
     uint64_t id = apic_get_local_apic_id() + 1;
@@ -50,13 +52,51 @@ uint64_t task_get_cpu_id(void) {
     return apic_get_local_apic_id();
 }
 
+uint64_t task_get_cpu_count(void) {
+    return task_run_queue_count;
+}
+
+static void task_sleep_timer_callback(time_timer_t* timer, void* data) {
+    UNUSED(timer);
+
+    task_t* task = (task_t*)data;
+    task_state_t expected = TASK_STATE_SLEEPING;
+
+    // task may be killed meanwhile
+    if(__atomic_compare_exchange_n(&task->state, &expected, TASK_STATE_SUSPENDED, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        task_wakeup(task);
+    }
+}
+
 void task_current_task_sleep(uint64_t wake_tick) {
     task_t* current_task = task_get_current_task();
 
-    if(current_task) {
-        current_task->wake_tick = wake_tick;
-        current_task->state = TASK_STATE_SLEEPING;
-        task_yield();
+    if(!current_task) {
+        return;
+    }
+
+    time_timer_t sleep_timer;
+
+    time_timer_init(&sleep_timer, &task_sleep_timer_callback, current_task);
+
+    // timer should not expire before task is marked as sleeping
+    boolean_t intflag = cpu_cli();
+
+    current_task->sleep_timer = &sleep_timer;
+    current_task->state = TASK_STATE_SLEEPING;
+
+    if(time_timer_start(&sleep_timer, wake_tick, 0) != 0) {
+        current_task->state = TASK_STATE_RUNNING;
+    }
+
+    task_yield();
+
+    // timer callback may still be running at other cpu
+    time_timer_cancel(&sleep_timer);
+    current_task->sleep_timer = NULL;
+
+    if(intflag) {
+        cpu_sti();
     }
 }
 
@@ -65,6 +105,7 @@ void task_clear_message_waiting(uint64_t tid) {
 
     if(task) {
         task->state = TASK_STATE_SUSPENDED;
+        task_wakeup(task);
     } else {
         PRINTLOG(TASKING, LOG_ERROR, "task not found 0x%llx", tid);
     }
@@ -72,14 +113,10 @@ void task_clear_message_waiting(uint64_t tid) {
 
 void task_set_interrupt_received(uint64_t tid) {
     task_t* task = (task_t*)hashmap_get(task_map, (void*)tid);
-    task_t* current_task = cpu_state->current_task;
 
     if(task) {
         task->state = TASK_STATE_INTERRUPT_RECEIVED;
-
-        if(current_task->cpu_id != task->cpu_id) {
-            apic_send_ipi(task->cpu_id, 0xFE, false);
-        }
+        task_wakeup(task);
 
     } else {
         video_text_print("int recv: task not found\n");
@@ -89,14 +126,10 @@ void task_set_interrupt_received(uint64_t tid) {
 
 void task_set_message_received(uint64_t tid) {
     task_t* task = (task_t*)hashmap_get(task_map, (void*)tid);
-    task_t* current_task = cpu_state->current_task;
 
     if(task) {
         task->state = TASK_STATE_SUSPENDED;
-
-        if(current_task->cpu_id != task->cpu_id) {
-            apic_send_ipi(task->cpu_id, 0xFE, false);
-        }
+        task_wakeup(task);
 
     } else {
         video_text_print("msg recv: task not found\n");
@@ -113,6 +146,18 @@ void task_set_interruptible(void) {
 }
 
 void task_print_all(buffer_t* buffer) {
+    for(uint64_t i = 0; i < task_run_queue_count; i++) {
+        task_run_queue_t* run_queue = task_run_queues[i];
+
+        uint64_t head = run_queue->head;
+        uint64_t tail = run_queue->tail;
+
+        buffer_printf(buffer,
+                      "\tcpu 0x%llx run queue depth %lli overflow %lli pushed %lli steals %lli stolen %lli wakes %lli\n",
+                      i, tail > head ? tail - head : 0, list_size(run_queue->overflow_queue),
+                      run_queue->push_count, run_queue->steal_count, run_queue->stolen_count, run_queue->wake_count);
+    }
+
     iterator_t* it = hashmap_iterator_create(task_map);
 
     while(it->end_of_iterator(it) != 0) {
@@ -375,6 +420,22 @@ void* task_get_vm(void) {
     return vm;
 }
 
+static void task_message_queue_notifier(list_t* queue, void* notifier_data) {
+    UNUSED(queue);
+
+    task_t* task = (task_t*)hashmap_get(task_map, notifier_data);
+
+    if(!task) {
+        return;
+    }
+
+    task_state_t expected = TASK_STATE_MESSAGE_WAITING;
+
+    if(__atomic_compare_exchange_n(&task->state, &expected, TASK_STATE_SUSPENDED, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        task_wakeup(task);
+    }
+}
+
 void task_add_message_queue(list_t* queue){
     task_t* current_task = task_get_current_task();
 
@@ -387,6 +448,23 @@ void task_add_message_queue(list_t* queue){
     }
 
     list_list_insert(current_task->message_queues, queue);
+    list_set_notifier(queue, &task_message_queue_notifier, (void*)current_task->task_id);
+}
+
+void task_remove_message_queue(list_t* queue){
+    task_t* current_task = task_get_current_task();
+
+    if(!current_task || !current_task->message_queues) {
+        return;
+    }
+
+    size_t position = 0;
+
+    if(list_get_position(current_task->message_queues, queue, &position) == 0) {
+        list_delete_at_position(current_task->message_queues, position);
+    }
+
+    list_set_notifier(queue, NULL, NULL);
 }
 
 list_t* task_get_message_queue(uint64_t task_id, uint64_t queue_number) {
@@ -411,6 +489,17 @@ void task_set_message_waiting(void){
     }
 }
 
+void task_cancel_message_waiting(void){
+    task_t* current_task = task_get_current_task();
+
+    if(current_task) {
+        task_state_t expected = TASK_STATE_MESSAGE_WAITING;
+
+        // interrupt or message wake up may have changed state already, scheduler handles them
+        __atomic_compare_exchange_n(&current_task->state, &expected, TASK_STATE_RUNNING, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+}
+
 void task_toggle_wait_for_future(uint64_t tid) {
     if(tid == 0 || tid == apic_get_local_apic_id() + 1) {
         return;
@@ -427,6 +516,11 @@ void task_toggle_wait_for_future(uint64_t tid) {
         video_text_print(task->state == TASK_STATE_FUTURE_WAITING ? "true" : "false");
         video_text_print("\n");
 
-        task->state = task->state == TASK_STATE_FUTURE_WAITING ? TASK_STATE_SUSPENDED : TASK_STATE_FUTURE_WAITING;
+        if(task->state == TASK_STATE_FUTURE_WAITING) {
+            task->state = TASK_STATE_SUSPENDED;
+            task_wakeup(task);
+        } else {
+            task->state = TASK_STATE_FUTURE_WAITING;
+        }
     }
 }
@@ -16,7 +16,6 @@
 #include <device/hpet.h>
 #include <time.h>
 #include <random.h>
-#include <hypervisor/hypervisor_vm.h>
 
 MODULE("turnstone.kernel.timer");
 
@@ -26,13 +25,21 @@ MODULE("turnstone.kernel.timer");
 #define TIME_TIMER_PIT_COMMAND_ONE_SHOT 0x32
 #define TIME_TIMER_PIT_DATA_PORT     0x40
 
+/*! epoch is re-read from rtc with this period in ticks */
+#define TIME_TIMER_EPOCH_SYNC_PERIOD (1000 * 60 * 15)
+
 __volatile__ uint64_t time_timer_tick_count = 0;
 __volatile__ uint64_t time_timer_old_tick_count = 0;
 __volatile__ uint64_t time_timer_ap1_tick_count = 0;
 
+boolean_t time_timer_tickless = false; ///< apic timers are one shot, tick count is derived from tsc
+uint64_t time_timer_tsc_base = 0; ///< tsc value when tickless mode is enabled
+uint64_t time_timer_tick_base = 0; ///< tick count when tickless mode is enabled
+
 
 extern volatile uint64_t time_timer_spinsleep_counter_value;
 extern volatile uint8_t time_timer_start_spinsleep_counter;
+extern volatile uint64_t time_timer_rdtsc_delta;
 
 void time_timer_reset_tick_count(void) {
     time_timer_tick_count = 0;
@@ -79,9 +86,116 @@ void time_timer_pit_sleep(uint64_t usecs) {
 
 extern volatile boolean_t task_tasking_initialized;
 
+static void time_timer_update_epoch(uint64_t old_tick, uint64_t new_tick) {
+    if(TIME_EPOCH == 0 || (old_tick / TIME_TIMER_EPOCH_SYNC_PERIOD) != (new_tick / TIME_TIMER_EPOCH_SYNC_PERIOD)) {
+        TIME_EPOCH = rtc_get_time() * 1000000;
+        srand(TIME_EPOCH);
+    } else if(!hpet_enabled) {
+        TIME_EPOCH += 1000 * (new_tick - old_tick);
+    }
+}
+
+static void time_timer_update_tick_count(void) {
+    uint64_t tick = time_timer_tick_base + (rdtsc() - time_timer_tsc_base) / time_timer_rdtsc_delta;
+    uint64_t old_tick = __atomic_load_n(&time_timer_tick_count, __ATOMIC_ACQUIRE);
+
+    while(old_tick < tick) {
+        // only one cpu advances tick count and epoch for same period
+        if(__atomic_compare_exchange_n(&time_timer_tick_count, &old_tick, tick, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            time_timer_update_epoch(old_tick, tick);
+
+            break;
+        }
+    }
+}
+
+int8_t time_timer_enable_tickless(void) {
+    if(time_timer_tickless) {
+        return 0;
+    }
+
+    if(time_timer_rdtsc_delta == 0) {
+        PRINTLOG(TIMER, LOG_ERROR, "tsc is not calibrated");
+
+        return -1;
+    }
+
+    cpu_cpuid_regs_t query = {0};
+    cpu_cpuid_regs_t result;
+
+    query.eax = 0x80000000;
+
+    cpu_cpuid(query, &result);
+
+    if(result.eax < 0x80000007) {
+        return -1;
+    }
+
+    query.eax = 0x80000007;
+
+    cpu_cpuid(query, &result);
+
+    // ticks are derived from tsc, it should not stop or change its rate at power states
+    if(!((result.edx >> 8) & 0x1)) {
+        PRINTLOG(TIMER, LOG_INFO, "tsc is not invariant");
+
+        return -1;
+    }
+
+    boolean_t intflag = cpu_cli();
+
+    time_timer_tsc_base = rdtsc();
+    time_timer_tick_base = time_timer_tick_count;
+
+    int8_t res = apic_timer_enable_oneshot();
+
+    if(res == 0) {
+        time_timer_tickless = true;
+    }
+
+    if(intflag) {
+        cpu_sti();
+    }
+
+    if(res == 0) {
+        PRINTLOG(TIMER, LOG_INFO, "tickless timer is enabled");
+    }
+
+    return res;
+}
+
+boolean_t time_timer_is_tickless(void) {
+    return time_timer_tickless;
+}
+
+uint64_t time_timer_tick_to_tsc(uint64_t tick) {
+    if(tick <= time_timer_tick_base) {
+        return time_timer_tsc_base;
+    }
+
+    return time_timer_tsc_base + (tick - time_timer_tick_base) * time_timer_rdtsc_delta;
+}
+
 int8_t time_timer_apic_isr(interrupt_frame_ext_t* frame) {
     UNUSED(frame);
 
+    if(time_timer_tickless) {
+        time_timer_update_tick_count();
+        time_timer_wheel_run();
+
+        if(task_tasking_initialized) {
+            // task switch programs next deadline of this cpu
+            task_task_switch_set_parameters(true);
+            task_switch_task();
+            task_task_switch_exit();
+        } else {
+            time_timer_wheel_program(0);
+            apic_eoi();
+        }
+
+        return 0;
+    }
+
     uint32_t apic_id = apic_get_local_apic_id();
 
     if(apic_id == 0) {
@@ -89,21 +203,13 @@ int8_t time_timer_apic_isr(interrupt_frame_ext_t* frame) {
             time_timer_tick_count = time_timer_ap1_tick_count;
         }
 
-        time_timer_tick_count++;
+        uint64_t old_tick = time_timer_tick_count++;
 
         if(time_timer_start_spinsleep_counter) {
             time_timer_start_spinsleep_counter = 0;
         }
 
-        if(TIME_EPOCH == 0 || (time_timer_tick_count % (1000 * 60 * 15)) == 0) {
-            TIME_EPOCH = rtc_get_time() * 1000000;
-        } else if(!hpet_enabled) {
-            TIME_EPOCH += 1000;
-        }
-
-        srand(TIME_EPOCH);
-
-        hypervisor_vm_notify_timers();
+        time_timer_update_epoch(old_tick, time_timer_tick_count);
     }
 
     if(apic_id == 1) {
@@ -114,6 +220,8 @@ int8_t time_timer_apic_isr(interrupt_frame_ext_t* frame) {
         time_timer_ap1_tick_count++;
     }
 
+    time_timer_wheel_run();
+
     if(task_tasking_initialized && (time_timer_tick_count % TASK_MAX_TICK_COUNT) == 0) {
         task_task_switch_set_parameters(true);
         task_switch_task();
@@ -126,6 +234,10 @@ int8_t time_timer_apic_isr(interrupt_frame_ext_t* frame) {
 }
 
 uint64_t time_timer_get_tick_count(void) {
+    if(time_timer_tickless) {
+        time_timer_update_tick_count();
+    }
+
     return time_timer_tick_count;
 }
 
@@ -0,0 +1,462 @@
+/**
+ * @file time_timer_wheel.64.c
+ * @brief per-cpu hierarchical timer wheels.
+ *
+ * each cpu has a wheel with four levels of 256 slots. level n slot holds timers expiring in
+ * 256^n to 256^(n+1) ticks, so arm and cancel are O(1). when level 0 wraps, next slot of upper
+ * level is cascaded to lower levels. wheels are processed at apic timer interrupt of their cpu
+ * and they follow global tick count. at tickless mode each cpu's one shot timer is programmed
+ * for its wheel's next event.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <time/timer.h>
+#include <logging.h>
+#include <memory.h>
+#include <cpu.h>
+#include <apic.h>
+
+MODULE("turnstone.kernel.timer");
+
+/*! maximum tick distance which a wheel can hold */
+#define TIME_TIMER_WHEEL_MAX_DELTA ((1ULL << (TIME_TIMER_WHEEL_LEVEL_COUNT * TIME_TIMER_WHEEL_SLOT_BITS)) - 1)
+
+/**
+ * @struct time_timer_wheel_t
+ * @brief per-cpu timer wheel
+ */
+typedef struct time_timer_wheel_t {
+    volatile uint64_t lock; ///< spin lock, taken with interrupts disabled
+    uint64_t          current_tick; ///< next tick to process
+    time_timer_t*     running_timer; ///< timer whose callback is running, NULL if it is cancelled inside callback
+    uint64_t          pending_count; ///< armed timer count
+    uint64_t          fired_count; ///< expired timer count
+    uint64_t          cascade_count; ///< timers moved to lower levels
+    uint64_t          programmed_deadline; ///< tsc deadline of cpu's one shot timer, zero if disarmed
+    time_timer_t*     slots[TIME_TIMER_WHEEL_LEVEL_COUNT][TIME_TIMER_WHEEL_SLOT_COUNT]; ///< slot heads
+} time_timer_wheel_t;
+
+time_timer_wheel_t** time_timer_wheels = NULL;
+uint64_t time_timer_wheel_count = 0;
+
+extern volatile uint64_t time_timer_tick_count;
+
+static inline void time_timer_wheel_lock(time_timer_wheel_t* wheel) {
+    while(__atomic_exchange_n(&wheel->lock, 1, __ATOMIC_ACQUIRE)) {
+        while(__atomic_load_n(&wheel->lock, __ATOMIC_RELAXED)) {
+            asm volatile ("pause" ::: "memory");
+        }
+    }
+}
+
+static inline void time_timer_wheel_unlock(time_timer_wheel_t* wheel) {
+    __atomic_store_n(&wheel->lock, 0, __ATOMIC_RELEASE);
+}
+
+int8_t time_timer_wheel_init(void) {
+    if(time_timer_wheels) {
+        return 0;
+    }
+
+    uint64_t cpu_count = apic_get_ap_count() + 1;
+
+    time_timer_wheel_t** wheels = memory_malloc(sizeof(time_timer_wheel_t*) * cpu_count);
+
+    if(wheels == NULL) {
+        PRINTLOG(TIMER, LOG_ERROR, "cannot allocate timer wheel list");
+
+        return -1;
+    }
+
+    for(uint64_t i = 0; i < cpu_count; i++) {
+        wheels[i] = memory_malloc_aligned(sizeof(time_timer_wheel_t), 0x40);
+
+        if(wheels[i] == NULL) {
+            PRINTLOG(TIMER, LOG_ERROR, "cannot allocate timer wheel for cpu 0x%llx", i);
+
+            for(uint64_t j = 0; j < i; j++) {
+                memory_free(wheels[j]);
+            }
+
+            memory_free(wheels);
+
+            return -1;
+        }
+
+        wheels[i]->current_tick = time_timer_tick_count;
+    }
+
+    time_timer_wheel_count = cpu_count;
+    time_timer_wheels = wheels;
+
+    PRINTLOG(TIMER, LOG_DEBUG, "timer wheels are created for 0x%llx cpus", cpu_count);
+
+    return 0;
+}
+
+static void time_timer_wheel_insert(time_timer_wheel_t* wheel, time_timer_t* timer) {
+    uint64_t expires = timer->expires;
+
+    if(expires < wheel->current_tick) {
+        expires = wheel->current_tick;
+    }
+
+    uint64_t delta = expires - wheel->current_tick;
+
+    if(delta > TIME_TIMER_WHEEL_MAX_DELTA) {
+        // too far, it will be cascaded again when upper slot comes
+        delta = TIME_TIMER_WHEEL_MAX_DELTA;
+        expires = wheel->current_tick + delta;
+    }
+
+    uint64_t level = 0;
+
+    while(level < TIME_TIMER_WHEEL_LEVEL_COUNT - 1 && delta >= (1ULL << ((level + 1) * TIME_TIMER_WHEEL_SLOT_BITS))) {
+        level++;
+    }
+
+    uint64_t slot = (expires >> (level * TIME_TIMER_WHEEL_SLOT_BITS)) & (TIME_TIMER_WHEEL_SLOT_COUNT - 1);
+
+    time_timer_t** head = &wheel->slots[level][slot];
+
+    timer->next = *head;
+
+    if(timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void time_timer_wheel_unlink(time_timer_t* timer) {
+    *timer->pprev = timer->next;
+
+    if(timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void time_timer_wheel_cascade(time_timer_wheel_t* wheel, uint64_t level, uint64_t slot) {
+    time_timer_t* timer = wheel->slots[level][slot];
+
+    wheel->slots[level][slot] = NULL;
+
+    while(timer) {
+        time_timer_t* next = timer->next;
+
+        time_timer_wheel_insert(wheel, timer);
+        wheel->cascade_count++;
+
+        timer = next;
+    }
+}
+
+void time_timer_init(time_timer_t* timer, time_timer_callback_f callback, void* data) {
+    if(timer == NULL) {
+        return;
+    }
+
+    memory_memclean(timer, sizeof(time_timer_t));
+
+    timer->callback = callback;
+    timer->data = data;
+}
+
+boolean_t time_timer_cancel(time_timer_t* timer) {
+    if(timer == NULL || time_timer_wheels == NULL) {
+        return false;
+    }
+
+    while(true) {
+        uint64_t cpu_id = timer->cpu_id;
+        time_timer_wheel_t* wheel = time_timer_wheels[cpu_id];
+
+        boolean_t intflag = cpu_cli();
+        time_timer_wheel_lock(wheel);
+
+        if(timer->cpu_id != cpu_id) {
+            // moved to another wheel meanwhile
+            time_timer_wheel_unlock(wheel);
+
+            if(intflag) {
+                cpu_sti();
+            }
+
+            continue;
+        }
+
+        if(timer->state == TIME_TIMER_STATE_PENDING) {
+            time_timer_wheel_unlink(timer);
+            timer->state = TIME_TIMER_STATE_IDLE;
+            wheel->pending_count--;
+
+            time_timer_wheel_unlock(wheel);
+
+            if(intflag) {
+                cpu_sti();
+            }
+
+            return true;
+        }
+
+        if(timer->state == TIME_TIMER_STATE_RUNNING) {
+            if(cpu_id == apic_get_local_apic_id()) {
+                // cancelled inside its own callback, wheel should not touch it after callback
+                wheel->running_timer = NULL;
+                timer->state = TIME_TIMER_STATE_IDLE;
+
+                time_timer_wheel_unlock(wheel);
+
+                if(intflag) {
+                    cpu_sti();
+                }
+
+                return false;
+            }
+
+            // wait callback at other cpu, owner may release timer memory after cancel
+            time_timer_wheel_unlock(wheel);
+
+            if(intflag) {
+                cpu_sti();
+            }
+
+            asm volatile ("pause" ::: "memory");
+
+            continue;
+        }
+
+        time_timer_wheel_unlock(wheel);
+
+        if(intflag) {
+            cpu_sti();
+        }
+
+        return false;
+    }
+}
+
+int8_t time_timer_start(time_timer_t* timer, uint64_t deadline, uint64_t period) {
+    if(timer == NULL || timer->callback == NULL) {
+        return -1;
+    }
+
+    if(time_timer_wheels == NULL) {
+        PRINTLOG(TIMER, LOG_ERROR, "timer wheels are not initialized");
+
+        return -1;
+    }
+
+    time_timer_cancel(timer);
+
+    boolean_t intflag = cpu_cli();
+
+    uint64_t cpu_id = apic_get_local_apic_id();
+    time_timer_wheel_t* wheel = time_timer_wheels[cpu_id];
+
+    time_timer_wheel_lock(wheel);
+
+    timer->expires = deadline;
+    timer->period = period;
+    timer->cpu_id = cpu_id;
+    timer->state = TIME_TIMER_STATE_PENDING;
+
+    time_timer_wheel_insert(wheel, timer);
+    wheel->pending_count++;
+
+    if(time_timer_is_tickless()) {
+        uint64_t tsc_deadline = time_timer_tick_to_tsc(deadline);
+
+        if(wheel->programmed_deadline == 0 || tsc_deadline < wheel->programmed_deadline) {
+            wheel->programmed_deadline = tsc_deadline;
+            apic_timer_set_deadline(tsc_deadline);
+        }
+    }
+
+    time_timer_wheel_unlock(wheel);
+
+    if(intflag) {
+        cpu_sti();
+    }
+
+    return 0;
+}
+
+time_timer_t* time_timer_add(uint64_t deadline, time_timer_callback_f callback, void* data) {
+    time_timer_t* timer = memory_malloc(sizeof(time_timer_t));
+
+    if(timer == NULL) {
+        PRINTLOG(TIMER, LOG_ERROR, "cannot allocate timer");
+
+        return NULL;
+    }
+
+    time_timer_init(timer, callback, data);
+    timer->allocated = true;
+
+    if(time_timer_start(timer, deadline, 0) != 0) {
+        memory_free(timer);
+
+        return NULL;
+    }
+
+    return timer;
+}
+
+void time_timer_free(time_timer_t* timer) {
+    if(timer == NULL) {
+        return;
+    }
+
+    time_timer_cancel(timer);
+
+    if(!timer->allocated) {
+        PRINTLOG(TIMER, LOG_ERROR, "timer 0x%p is not created by time_timer_add", timer);
+
+        return;
+    }
+
+    memory_free(timer);
+}
+
+static void time_timer_wheel_run_tick(time_timer_wheel_t* wheel) {
+    uint64_t tick = wheel->current_tick;
+    uint64_t slot = tick & (TIME_TIMER_WHEEL_SLOT_COUNT - 1);
+
+    if(slot == 0) {
+        for(uint64_t level = 1; level < TIME_TIMER_WHEEL_LEVEL_COUNT; level++) {
+            uint64_t level_slot = (tick >> (level * TIME_TIMER_WHEEL_SLOT_BITS)) & (TIME_TIMER_WHEEL_SLOT_COUNT - 1);
+
+            time_timer_wheel_cascade(wheel, level, level_slot);
+
+            if(level_slot != 0) {
+                break;
+            }
+        }
+    }
+
+    // re-armed timers with past deadlines go to next tick's slot
+    wheel->current_tick = tick + 1;
+
+    while(wheel->slots[0][slot]) {
+        time_timer_t* timer = wheel->slots[0][slot];
+
+        time_timer_wheel_unlink(timer);
+        wheel->pending_count--;
+        wheel->fired_count++;
+
+        timer->state = TIME_TIMER_STATE_RUNNING;
+        wheel->running_timer = timer;
+
+        time_timer_wheel_unlock(wheel);
+
+        timer->callback(timer, timer->data);
+
+        time_timer_wheel_lock(wheel);
+
+        if(wheel->running_timer == timer && timer->state == TIME_TIMER_STATE_RUNNING) {
+            if(timer->period) {
+                timer->expires += timer->period;
+                timer->state = TIME_TIMER_STATE_PENDING;
+
+                time_timer_wheel_insert(wheel, timer);
+                wheel->pending_count++;
+            } else {
+                timer->state = TIME_TIMER_STATE_IDLE;
+            }
+        }
+
+        wheel->running_timer = NULL;
+    }
+}
+
+void time_timer_wheel_run(void) {
+    if(time_timer_wheels == NULL) {
+        return;
+    }
+
+    uint64_t cpu_id = apic_get_local_apic_id();
+
+    if(cpu_id >= time_timer_wheel_count) {
+        return;
+    }
+
+    time_timer_wheel_t* wheel = time_timer_wheels[cpu_id];
+
+    uint64_t now = time_timer_get_tick_count();
+
+    time_timer_wheel_lock(wheel);
+
+    // one shot timer is fired, next deadline is programmed after wheel run
+    wheel->programmed_deadline = 0;
+
+    while(wheel->current_tick <= now) {
+        time_timer_wheel_run_tick(wheel);
+    }
+
+    time_timer_wheel_unlock(wheel);
+}
+
+static uint64_t time_timer_wheel_next_event(time_timer_wheel_t* wheel) {
+    if(wheel->pending_count == 0) {
+        return 0;
+    }
+
+    uint64_t tick = wheel->current_tick;
+    // upper levels are cascaded at level 0 wrap, so next event is at latest wrap tick
+    uint64_t wrap_tick = (tick | (TIME_TIMER_WHEEL_SLOT_COUNT - 1)) + 1;
+
+    for(; tick < wrap_tick; tick++) {
+        if(wheel->slots[0][tick & (TIME_TIMER_WHEEL_SLOT_COUNT - 1)]) {
+            return tick;
+        }
+    }
+
+    return wrap_tick;
+}
+
+void time_timer_wheel_program(uint64_t tsc_deadline) {
+    if(!time_timer_is_tickless() || time_timer_wheels == NULL) {
+        return;
+    }
+
+    uint64_t cpu_id = apic_get_local_apic_id();
+
+    if(cpu_id >= time_timer_wheel_count) {
+        return;
+    }
+
+    time_timer_wheel_t* wheel = time_timer_wheels[cpu_id];
+
+    boolean_t intflag = cpu_cli();
+
+    time_timer_wheel_lock(wheel);
+
+    uint64_t next_tick = time_timer_wheel_next_event(wheel);
+
+    if(next_tick) {
+        uint64_t wheel_deadline = time_timer_tick_to_tsc(next_tick);
+
+        if(tsc_deadline == 0 || wheel_deadline < tsc_deadline) {
+            tsc_deadline = wheel_deadline;
+        }
+    }
+
+    // idle cpu without timers is not interrupted until a timer is armed or an ipi arrives
+    if(wheel->programmed_deadline != tsc_deadline) {
+        wheel->programmed_deadline = tsc_deadline;
+        apic_timer_set_deadline(tsc_deadline);
+    }
+
+    time_timer_wheel_unlock(wheel);
+
+    if(intflag) {
+        cpu_sti();
+    }
+}
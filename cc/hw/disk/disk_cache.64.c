@@ -0,0 +1,822 @@
+/**
+ * @file disk_cache.64.c
+ * @brief shared block cache for disks and partitions.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <disk_cache.h>
+#include <cache.h>
+#include <hashmap.h>
+#include <list.h>
+#include <memory.h>
+#include <logging.h>
+#include <utils.h>
+#include <cpu/sync.h>
+#include <cpu/task.h>
+#include <time/timer.h>
+
+MODULE("turnstone.kernel.hw.disk.cache");
+
+typedef struct disk_cache_shard_t disk_cache_shard_t;
+
+/**
+ * @struct disk_cache_page_t
+ * @brief cached page of a disk
+ */
+typedef struct disk_cache_page_t {
+    disk_cache_shard_t* shard; ///< owner shard
+    uint64_t            page_no; ///< page number, first lba of page is page_no * page block count
+    uint64_t            block_count; ///< valid block count of page, last page of disk can be short
+    boolean_t           is_dirty; ///< page has data not written to disk
+    boolean_t           is_evicted; ///< page is dropped from cache, it stays at dirty map until written
+    uint8_t*            data; ///< page data
+} disk_cache_page_t;
+
+/**
+ * @struct disk_cache_shard_t
+ * @brief a lock and an lru cache for a subset of pages
+ */
+struct disk_cache_shard_t {
+    disk_context_t* ctx; ///< owner cache context
+    lock_t*         lock; ///< shard lock
+    cache_t*        pages; ///< page cache, key is page number
+    hashmap_t*      dirty_pages; ///< dirty pages and pages being written, key is page number
+};
+
+struct disk_context_t {
+    disk_or_partition_t* dp; ///< underlying disk or partition
+    memory_heap_t*       heap; ///< heap of underlying disk
+    uint64_t             block_size; ///< block size of underlying disk
+    uint64_t             block_count; ///< block count of underlying disk
+    uint64_t             page_block_count; ///< block count of a page
+    uint64_t             page_size; ///< page size in bytes
+    uint64_t             page_count; ///< page count of underlying disk
+    uint64_t             shard_count; ///< shard count
+    disk_cache_shard_t*  shards; ///< shards
+    uint64_t             readahead_count; ///< read-ahead page count
+    uint64_t             next_sequential_lba; ///< lba expected by a sequential read
+    volatile uint64_t    invalidation_count; ///< increased when disk is written around cache, older disk reads are not cached
+    uint64_t             writeback_period; ///< write-back period in milliseconds
+    lock_t*              writeback_lock; ///< serializes write-back passes, pages are written without shard locks
+    uint64_t             writeback_task_id; ///< write-back task id
+    void**               writeback_task_args; ///< write-back task arguments
+    volatile boolean_t   is_closing; ///< cache is closing, write-back task should exit
+    volatile boolean_t   writeback_task_exited; ///< write-back task exited
+};
+
+memory_heap_t* disk_cache_get_heap(const disk_or_partition_t* d);
+uint64_t       disk_cache_get_size(const disk_or_partition_t* d);
+uint64_t       disk_cache_get_block_size(const disk_or_partition_t* d);
+int8_t         disk_cache_write(const disk_or_partition_t* d, uint64_t lba, uint64_t count, uint8_t* data);
+int8_t         disk_cache_read(const disk_or_partition_t* d, uint64_t lba, uint64_t count, uint8_t** data);
+int8_t         disk_cache_writev(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count);
+int8_t         disk_cache_readv(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count);
+int8_t         disk_cache_flush(const disk_or_partition_t* d);
+int8_t         disk_cache_close(const disk_or_partition_t* d);
+int32_t        disk_cache_writeback_task(int32_t argc, char_t** argv);
+
+static inline disk_cache_shard_t* disk_cache_get_shard(disk_context_t* ctx, uint64_t page_no) {
+    return &ctx->shards[page_no % ctx->shard_count];
+}
+
+static void disk_cache_page_free(disk_cache_page_t* page) {
+    memory_heap_t* heap = page->shard->ctx->heap;
+
+    memory_free_ext(heap, page->data);
+    memory_free_ext(heap, page);
+}
+
+/**
+ * @brief writes a dirty page to disk, shard lock is released while disk is written. write-back lock should be held
+ * @param[in] shard shard of page
+ * @param[in] page_no page number
+ * @param[in] buf page sized buffer, page data is copied into it under shard lock
+ * @return 0 on success or if page is not dirty
+ */
+static int8_t disk_cache_page_sync(disk_cache_shard_t* shard, uint64_t page_no, uint8_t* buf) {
+    disk_context_t* ctx = shard->ctx;
+
+    lock_acquire(shard->lock);
+
+    // page is not freed while it is at dirty map, only this function removes it
+    disk_cache_page_t* page = (disk_cache_page_t*)hashmap_get(shard->dirty_pages, (void*)page_no);
+
+    if(!page || !page->is_dirty) {
+        lock_release(shard->lock);
+
+        return 0;
+    }
+
+    uint64_t block_count = page->block_count;
+
+    memory_memcopy(page->data, buf, block_count * ctx->block_size);
+    page->is_dirty = false;
+
+    lock_release(shard->lock);
+
+    int8_t res = ctx->dp->write(ctx->dp, page_no * ctx->page_block_count, block_count, buf);
+
+    lock_acquire(shard->lock);
+
+    if(res != 0) {
+        PRINTLOG(DISK, LOG_ERROR, "cannot write back page 0x%llx", page_no);
+        page->is_dirty = true;
+    } else if(!page->is_dirty) {
+        // page is not written again while disk write is running
+        hashmap_delete(shard->dirty_pages, (void*)page_no);
+
+        if(page->is_evicted) {
+            disk_cache_page_free(page);
+        }
+    }
+
+    lock_release(shard->lock);
+
+    return res == 0 ? 0 : -1;
+}
+
+static boolean_t disk_cache_page_destroyer(const void* key, const void* item) {
+    UNUSED(key);
+
+    disk_cache_page_t* page = (disk_cache_page_t*)item;
+    disk_cache_shard_t* shard = page->shard;
+
+    // dirty pages are not written under shard lock, they wait write-back at dirty map
+    if(!shard->ctx->is_closing && hashmap_get(shard->dirty_pages, (void*)page->page_no)) {
+        page->is_evicted = true;
+
+        return true;
+    }
+
+    if(page->is_dirty) {
+        PRINTLOG(DISK, LOG_ERROR, "dirty page 0x%llx is dropped at close", page->page_no);
+    }
+
+    hashmap_delete(shard->dirty_pages, (void*)page->page_no);
+    disk_cache_page_free(page);
+
+    return true;
+}
+
+/**
+ * @brief finds a page at shard, evicted pages waiting write-back are put into cache again. shard lock should be held
+ * @param[in] shard shard of page
+ * @param[in] page_no page number
+ * @return page or NULL
+ */
+static disk_cache_page_t* disk_cache_page_get(disk_cache_shard_t* shard, uint64_t page_no) {
+    disk_cache_page_t* page = (disk_cache_page_t*)cache_get(shard->pages, (void*)page_no);
+
+    if(page) {
+        return page;
+    }
+
+    // evicted page is newer than disk
+    page = (disk_cache_page_t*)hashmap_get(shard->dirty_pages, (void*)page_no);
+
+    if(page && page->is_evicted && cache_put_by_count(shard->pages, (void*)page_no, page)) {
+        page->is_evicted = false;
+    }
+
+    return page;
+}
+
+static uint64_t disk_cache_page_block_count(disk_context_t* ctx, uint64_t page_no) {
+    uint64_t page_lba = page_no * ctx->page_block_count;
+
+    return MIN(ctx->page_block_count, ctx->block_count - page_lba);
+}
+
+/**
+ * @brief creates a page and puts into shard's cache, shard lock should be held
+ * @param[in] shard shard of page
+ * @param[in] page_no page number
+ * @param[in] data page data to copy, if NULL page is read from disk
+ * @return page
+ */
+static disk_cache_page_t* disk_cache_page_create(disk_cache_shard_t* shard, uint64_t page_no, const uint8_t* data) {
+    disk_context_t* ctx = shard->ctx;
+
+    disk_cache_page_t* page = memory_malloc_ext(ctx->heap, sizeof(disk_cache_page_t), 0);
+
+    if(!page) {
+        return NULL;
+    }
+
+    page->shard = shard;
+    page->page_no = page_no;
+    page->block_count = disk_cache_page_block_count(ctx, page_no);
+    page->data = memory_malloc_ext(ctx->heap, ctx->page_size, 0x1000);
+
+    if(!page->data) {
+        memory_free_ext(ctx->heap, page);
+
+        return NULL;
+    }
+
+    if(data) {
+        memory_memcopy(data, page->data, page->block_count * ctx->block_size);
+    } else {
+        uint8_t* disk_data = NULL;
+
+        if(ctx->dp->read(ctx->dp, page_no * ctx->page_block_count, page->block_count, &disk_data) != 0 || !disk_data) {
+            PRINTLOG(DISK, LOG_ERROR, "cannot read page 0x%llx", page_no);
+            memory_free_ext(ctx->heap, page->data);
+            memory_free_ext(ctx->heap, page);
+
+            return NULL;
+        }
+
+        memory_memcopy(disk_data, page->data, page->block_count * ctx->block_size);
+        memory_free_ext(ctx->heap, disk_data);
+    }
+
+    if(!cache_put_by_count(shard->pages, (void*)page_no, page)) {
+        memory_free_ext(ctx->heap, page->data);
+        memory_free_ext(ctx->heap, page);
+
+        return NULL;
+    }
+
+    return page;
+}
+
+static boolean_t disk_cache_is_cached(disk_context_t* ctx, uint64_t page_no) {
+    disk_cache_shard_t* shard = disk_cache_get_shard(ctx, page_no);
+
+    lock_acquire(shard->lock);
+    boolean_t res = disk_cache_page_get(shard, page_no) != NULL;
+    lock_release(shard->lock);
+
+    return res;
+}
+
+/**
+ * @brief copies cached part of a page into destination
+ * @param[in] ctx cache context
+ * @param[in] page_no page number
+ * @param[in] data if page is not cached, page is created from this data
+ * @param[in] invalidation_count invalidation count before data is read, data is not cached if range is invalidated meanwhile
+ * @param[in] offset offset inside page
+ * @param[in] length length to copy
+ * @param[out] dest destination, can be NULL to only fill the cache
+ * @return true if page is copied
+ */
+static boolean_t disk_cache_copy_from_page(disk_context_t* ctx, uint64_t page_no, const uint8_t* data, uint64_t invalidation_count,
+                                           uint64_t offset, uint64_t length, uint8_t* dest) {
+    disk_cache_shard_t* shard = disk_cache_get_shard(ctx, page_no);
+
+    lock_acquire(shard->lock);
+
+    disk_cache_page_t* page = disk_cache_page_get(shard, page_no);
+
+    if(!page && data && invalidation_count == ctx->invalidation_count) {
+        page = disk_cache_page_create(shard, page_no, data);
+    }
+
+    if(page && dest) {
+        memory_memcopy(page->data + offset, dest, length);
+    }
+
+    lock_release(shard->lock);
+
+    return page != NULL;
+}
+
+int8_t disk_cache_read(const disk_or_partition_t* d, uint64_t lba, uint64_t count, uint8_t** data) {
+    disk_context_t* ctx = d->context;
+
+    if(!data || !count || lba + count > ctx->block_count) {
+        return -1;
+    }
+
+    uint64_t buffer_len = count * ctx->block_size;
+
+    if(buffer_len % 0x1000) {
+        buffer_len += 0x1000 - (buffer_len % 0x1000);
+    }
+
+    *data = memory_malloc_ext(ctx->heap, buffer_len, 0x1000);
+
+    if(*data == NULL) {
+        return -1;
+    }
+
+    uint8_t* out = *data;
+
+    boolean_t is_sequential = lba == ctx->next_sequential_lba;
+    ctx->next_sequential_lba = lba + count;
+
+    uint64_t req_end = lba + count; // exclusive
+    uint64_t first_page = lba / ctx->page_block_count;
+    uint64_t last_page = (req_end - 1) / ctx->page_block_count;
+    uint64_t page_no = first_page;
+
+    while(page_no <= last_page) {
+        uint64_t page_lba = page_no * ctx->page_block_count;
+        uint64_t copy_start = MAX(lba, page_lba);
+        uint64_t copy_end = MIN(req_end, page_lba + ctx->page_block_count);
+
+        if(disk_cache_copy_from_page(ctx, page_no, NULL, 0,
+                                     (copy_start - page_lba) * ctx->block_size,
+                                     (copy_end - copy_start) * ctx->block_size,
+                                     out + (copy_start - lba) * ctx->block_size)) {
+            page_no++;
+
+            continue;
+        }
+
+        // read all consecutive missing pages with one disk read
+        uint64_t run_end = page_no;
+
+        while(run_end < last_page && !disk_cache_is_cached(ctx, run_end + 1)) {
+            run_end++;
+        }
+
+        if(is_sequential && run_end == last_page) {
+            uint64_t ra_limit = MIN(last_page + ctx->readahead_count, ctx->page_count - 1);
+
+            while(run_end < ra_limit && !disk_cache_is_cached(ctx, run_end + 1)) {
+                run_end++;
+            }
+        }
+
+        uint64_t run_lba = page_no * ctx->page_block_count;
+        uint64_t run_block_count = MIN((run_end + 1) * ctx->page_block_count, ctx->block_count) - run_lba;
+        uint8_t* run_data = NULL;
+        uint64_t invalidation_count = ctx->invalidation_count;
+
+        if(ctx->dp->read(ctx->dp, run_lba, run_block_count, &run_data) != 0 || !run_data) {
+            PRINTLOG(DISK, LOG_ERROR, "cannot read 0x%llx blocks at 0x%llx", run_block_count, run_lba);
+            memory_free_ext(ctx->heap, *data);
+            *data = NULL;
+
+            return -1;
+        }
+
+        for(uint64_t p = page_no; p <= run_end; p++) {
+            page_lba = p * ctx->page_block_count;
+            uint8_t* dest = NULL;
+            copy_start = 0;
+            copy_end = 0;
+
+            if(p <= last_page) {
+                copy_start = MAX(lba, page_lba);
+                copy_end = MIN(req_end, page_lba + ctx->page_block_count);
+                dest = out + (copy_start - lba) * ctx->block_size;
+            }
+
+            if(!disk_cache_copy_from_page(ctx, p, run_data + (page_lba - run_lba) * ctx->block_size, invalidation_count,
+                                          (copy_start - page_lba) * ctx->block_size,
+                                          (copy_end - copy_start) * ctx->block_size,
+                                          dest) && dest) {
+                // cache is full of unwritable pages or range is invalidated, serve request from disk data
+                memory_memcopy(run_data + (copy_start - run_lba) * ctx->block_size, dest, (copy_end - copy_start) * ctx->block_size);
+            }
+        }
+
+        memory_free_ext(ctx->heap, run_data);
+
+        page_no = run_end + 1;
+    }
+
+    return 0;
+}
+
+int8_t disk_cache_write(const disk_or_partition_t* d, uint64_t lba, uint64_t count, uint8_t* data) {
+    disk_context_t* ctx = d->context;
+
+    if(!data || !count || lba + count > ctx->block_count) {
+        return -1;
+    }
+
+    uint64_t req_end = lba + count; // exclusive
+    uint64_t first_page = lba / ctx->page_block_count;
+    uint64_t last_page = (req_end - 1) / ctx->page_block_count;
+
+    for(uint64_t page_no = first_page; page_no <= last_page; page_no++) {
+        uint64_t page_lba = page_no * ctx->page_block_count;
+        uint64_t copy_start = MAX(lba, page_lba);
+        uint64_t copy_end = MIN(req_end, page_lba + ctx->page_block_count);
+        const uint8_t* src = data + (copy_start - lba) * ctx->block_size;
+
+        disk_cache_shard_t* shard = disk_cache_get_shard(ctx, page_no);
+
+        lock_acquire(shard->lock);
+
+        disk_cache_page_t* page = disk_cache_page_get(shard, page_no);
+
+        if(!page) {
+            boolean_t full_page = copy_start == page_lba && copy_end - copy_start == disk_cache_page_block_count(ctx, page_no);
+
+            // partial page writes need rest of the page from disk
+            page = disk_cache_page_create(shard, page_no, full_page ? src : NULL);
+        }
+
+        if(!page) {
+            lock_release(shard->lock);
+            PRINTLOG(DISK, LOG_ERROR, "cannot cache page 0x%llx for write", page_no);
+
+            return -1;
+        }
+
+        memory_memcopy(src, page->data + (copy_start - page_lba) * ctx->block_size, (copy_end - copy_start) * ctx->block_size);
+
+        if(!page->is_dirty) {
+            page->is_dirty = true;
+            // page may be still at dirty map while it is written back
+            hashmap_put(shard->dirty_pages, (void*)page_no, page);
+        }
+
+        lock_release(shard->lock);
+    }
+
+    return 0;
+}
+
+static int8_t disk_cache_shard_write_back(disk_cache_shard_t* shard, uint8_t* buf) {
+    int8_t res = 0;
+
+    lock_acquire(shard->lock);
+
+    if(hashmap_size(shard->dirty_pages) == 0) {
+        lock_release(shard->lock);
+
+        return 0;
+    }
+
+    list_t* page_nos = list_create_list_with_heap(shard->ctx->heap);
+
+    if(!page_nos) {
+        lock_release(shard->lock);
+
+        return -1;
+    }
+
+    iterator_t* iter = hashmap_iterator_create(shard->dirty_pages);
+
+    while(iter->end_of_iterator(iter) != 0) {
+        const disk_cache_page_t* page = (const disk_cache_page_t*)iter->get_item(iter);
+
+        list_list_insert(page_nos, (void*)page->page_no);
+
+        iter = iter->next(iter);
+    }
+
+    iter->destroy(iter);
+
+    lock_release(shard->lock);
+
+    for(uint64_t i = 0; i < list_size(page_nos); i++) {
+        if(disk_cache_page_sync(shard, (uint64_t)list_get_data_at_position(page_nos, i), buf) != 0) {
+            res = -1;
+        }
+    }
+
+    list_destroy(page_nos);
+
+    return res;
+}
+
+static int8_t disk_cache_write_back(disk_context_t* ctx) {
+    int8_t res = 0;
+
+    uint8_t* buf = memory_malloc_ext(ctx->heap, ctx->page_size, 0x1000);
+
+    if(!buf) {
+        return -1;
+    }
+
+    lock_acquire(ctx->writeback_lock);
+
+    for(uint64_t i = 0; i < ctx->shard_count; i++) {
+        if(disk_cache_shard_write_back(&ctx->shards[i], buf) != 0) {
+            res = -1;
+        }
+    }
+
+    lock_release(ctx->writeback_lock);
+
+    memory_free_ext(ctx->heap, buf);
+
+    return res;
+}
+
+/**
+ * @brief writes dirty pages of a block range to disk, vectored io bypasses the cache
+ * @param[in] ctx cache context
+ * @param[in] lba first lba
+ * @param[in] count block count
+ * @return 0 on success
+ */
+static int8_t disk_cache_sync_range(disk_context_t* ctx, uint64_t lba, uint64_t count) {
+    uint64_t first_page = lba / ctx->page_block_count;
+    uint64_t last_page = (lba + count - 1) / ctx->page_block_count;
+    int8_t res = 0;
+
+    uint8_t* buf = memory_malloc_ext(ctx->heap, ctx->page_size, 0x1000);
+
+    if(!buf) {
+        return -1;
+    }
+
+    lock_acquire(ctx->writeback_lock);
+
+    for(uint64_t page_no = first_page; page_no <= last_page; page_no++) {
+        disk_cache_shard_t* shard = disk_cache_get_shard(ctx, page_no);
+
+        if(disk_cache_page_sync(shard, page_no, buf) != 0) {
+            res = -1;
+        }
+    }
+
+    lock_release(ctx->writeback_lock);
+
+    memory_free_ext(ctx->heap, buf);
+
+    return res;
+}
+
+/**
+ * @brief drops pages of a block range after disk content is changed by vectored write
+ * @param[in] ctx cache context
+ * @param[in] lba first lba
+ * @param[in] count block count
+ */
+static void disk_cache_drop_range(disk_context_t* ctx, uint64_t lba, uint64_t count) {
+    uint64_t first_page = lba / ctx->page_block_count;
+    uint64_t last_page = (lba + count - 1) / ctx->page_block_count;
+
+    // reads started before this point may have old disk data, they should not cache it
+    __atomic_add_fetch(&ctx->invalidation_count, 1, __ATOMIC_SEQ_CST);
+
+    for(uint64_t page_no = first_page; page_no <= last_page; page_no++) {
+        disk_cache_shard_t* shard = disk_cache_get_shard(ctx, page_no);
+
+        // a page written meanwhile stays at dirty map, destroyer frees only clean pages
+        lock_acquire(shard->lock);
+        cache_delete(shard->pages, (void*)page_no);
+        lock_release(shard->lock);
+    }
+}
+
+static uint64_t disk_cache_iovec_block_count(disk_context_t* ctx, const disk_iovec_t* iov, uint64_t iov_count) {
+    uint64_t size = 0;
+
+    for(uint64_t i = 0; i < iov_count; i++) {
+        size += iov[i].length;
+    }
+
+    return size / ctx->block_size;
+}
+
+int8_t disk_cache_writev(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count) {
+    disk_context_t* ctx = d->context;
+
+    uint64_t count = disk_cache_iovec_block_count(ctx, iov, iov_count);
+
+    if(!count || disk_cache_sync_range(ctx, lba, count) != 0) {
+        return -1;
+    }
+
+    int8_t res = ctx->dp->writev(ctx->dp, lba, iov, iov_count);
+
+    // pages cached while disk is written may have old data, so range is dropped after write
+    disk_cache_drop_range(ctx, lba, count);
+
+    return res;
+}
+
+int8_t disk_cache_readv(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count) {
+    disk_context_t* ctx = d->context;
+
+    uint64_t count = disk_cache_iovec_block_count(ctx, iov, iov_count);
+
+    if(!count || disk_cache_sync_range(ctx, lba, count) != 0) {
+        return -1;
+    }
+
+    return ctx->dp->readv(ctx->dp, lba, iov, iov_count);
+}
+
+int8_t disk_cache_flush(const disk_or_partition_t* d) {
+    disk_context_t* ctx = d->context;
+
+    int8_t res = disk_cache_write_back(ctx);
+
+    if(ctx->dp->flush(ctx->dp) != 0) {
+        res = -1;
+    }
+
+    return res;
+}
+
+int32_t disk_cache_writeback_task(int32_t argc, char_t** argv) {
+    if(argc != 1) {
+        return -1;
+    }
+
+    disk_context_t* ctx = (disk_context_t*)argv[0];
+
+    while(!ctx->is_closing) {
+        time_timer_msleep(ctx->writeback_period);
+
+        if(ctx->is_closing) {
+            break;
+        }
+
+        disk_cache_write_back(ctx);
+    }
+
+    ctx->writeback_task_exited = true;
+
+    return 0;
+}
+
+memory_heap_t* disk_cache_get_heap(const disk_or_partition_t* d) {
+    disk_context_t* ctx = d->context;
+
+    return ctx->heap;
+}
+
+uint64_t disk_cache_get_size(const disk_or_partition_t* d) {
+    disk_context_t* ctx = d->context;
+
+    return ctx->block_count * ctx->block_size;
+}
+
+uint64_t disk_cache_get_block_size(const disk_or_partition_t* d) {
+    disk_context_t* ctx = d->context;
+
+    return ctx->block_size;
+}
+
+static void disk_cache_evicted_page_destroyer(const memory_heap_t* heap, const void* item) {
+    UNUSED(heap);
+
+    disk_cache_page_t* page = (disk_cache_page_t*)item;
+
+    PRINTLOG(DISK, LOG_ERROR, "dirty page 0x%llx is dropped at close", page->page_no);
+
+    disk_cache_page_free(page);
+}
+
+static void disk_cache_free_shards(disk_context_t* ctx) {
+    for(uint64_t i = 0; i < ctx->shard_count; i++) {
+        disk_cache_shard_t* shard = &ctx->shards[i];
+
+        // pages are destroyed before dirty map, destroyer uses it. remaining ones are evicted pages whose write-back failed
+        cache_destroy(shard->pages);
+        hashmap_destroy_with_item_destroyer(shard->dirty_pages, disk_cache_evicted_page_destroyer);
+        lock_destroy(shard->lock);
+    }
+
+    lock_destroy(ctx->writeback_lock);
+    memory_free_ext(ctx->heap, ctx->shards);
+}
+
+int8_t disk_cache_close(const disk_or_partition_t* d) {
+    disk_context_t* ctx = d->context;
+
+    ctx->is_closing = true;
+
+    if(ctx->writeback_task_id) {
+        while(!ctx->writeback_task_exited) {
+            task_yield();
+        }
+    }
+
+    disk_cache_flush(d);
+
+    memory_heap_t* heap = ctx->heap;
+    disk_or_partition_t* dp = ctx->dp;
+
+    disk_cache_free_shards(ctx);
+
+    memory_free_ext(heap, ctx->writeback_task_args);
+    memory_free_ext(heap, ctx);
+    memory_free_ext(heap, (void*)d);
+
+    return dp->close(dp);
+}
+
+disk_or_partition_t* disk_cache_new(disk_or_partition_t* dp, const disk_cache_config_t* config) {
+    if(!dp) {
+        return NULL;
+    }
+
+    disk_cache_config_t cfg = {0};
+
+    if(config) {
+        memory_memcopy(config, &cfg, sizeof(disk_cache_config_t));
+    }
+
+    cfg.page_count = cfg.page_count?cfg.page_count:DISK_CACHE_DEFAULT_PAGE_COUNT;
+    cfg.shard_count = cfg.shard_count?cfg.shard_count:DISK_CACHE_DEFAULT_SHARD_COUNT;
+    cfg.readahead_count = cfg.readahead_count?cfg.readahead_count:DISK_CACHE_DEFAULT_READAHEAD_COUNT;
+    cfg.writeback_period = cfg.writeback_period?cfg.writeback_period:DISK_CACHE_DEFAULT_WRITEBACK_PERIOD;
+
+    memory_heap_t* heap = dp->get_heap(dp);
+
+    disk_context_t* ctx = memory_malloc_ext(heap, sizeof(disk_context_t), 0);
+
+    if(!ctx) {
+        PRINTLOG(DISK, LOG_ERROR, "cannot create disk cache context");
+
+        return NULL;
+    }
+
+    ctx->dp = dp;
+    ctx->heap = heap;
+    ctx->block_size = dp->get_block_size(dp);
+    ctx->block_count = dp->get_size(dp) / ctx->block_size;
+    ctx->page_block_count = ctx->block_size < 0x1000 ? 0x1000 / ctx->block_size : 1;
+    ctx->page_size = ctx->page_block_count * ctx->block_size;
+    ctx->page_count = (ctx->block_count + ctx->page_block_count - 1) / ctx->page_block_count;
+    ctx->shard_count = cfg.shard_count;
+    ctx->readahead_count = cfg.readahead_count;
+    ctx->writeback_period = cfg.writeback_period;
+    ctx->next_sequential_lba = -1ULL;
+    ctx->writeback_lock = lock_create_with_heap(heap);
+
+    ctx->shards = memory_malloc_ext(heap, sizeof(disk_cache_shard_t) * ctx->shard_count, 0);
+
+    if(!ctx->writeback_lock || !ctx->shards) {
+        PRINTLOG(DISK, LOG_ERROR, "cannot create disk cache shards");
+        lock_destroy(ctx->writeback_lock);
+        memory_free_ext(heap, ctx->shards);
+        memory_free_ext(heap, ctx);
+
+        return NULL;
+    }
+
+    uint64_t shard_page_count = MAX(cfg.page_count / ctx->shard_count, 2ULL);
+
+    cache_config_t cc = {0};
+    cc.policy = CACHE_POLICY_COUNT;
+    cc.hard_limit = shard_page_count;
+    cc.soft_limit = shard_page_count / 2;
+    cc.item_key_destroyer = disk_cache_page_destroyer;
+
+    for(uint64_t i = 0; i < ctx->shard_count; i++) {
+        disk_cache_shard_t* shard = &ctx->shards[i];
+
+        shard->ctx = ctx;
+        shard->lock = lock_create_with_heap(heap);
+        shard->pages = cache_new(&cc);
+        shard->dirty_pages = hashmap_integer_with_heap(heap, 128);
+
+        if(!shard->lock || !shard->pages || !shard->dirty_pages) {
+            PRINTLOG(DISK, LOG_ERROR, "cannot create disk cache shard %lli", i);
+            ctx->shard_count = i + 1;
+            disk_cache_free_shards(ctx);
+            memory_free_ext(heap, ctx);
+
+            return NULL;
+        }
+    }
+
+    disk_or_partition_t* d = memory_malloc_ext(heap, sizeof(disk_or_partition_t), 0);
+
+    if(!d) {
+        PRINTLOG(DISK, LOG_ERROR, "cannot create cached disk");
+        disk_cache_free_shards(ctx);
+        memory_free_ext(heap, ctx);
+
+        return NULL;
+    }
+
+    d->context = ctx;
+    d->get_heap = disk_cache_get_heap;
+    d->get_size = disk_cache_get_size;
+    d->get_block_size = disk_cache_get_block_size;
+    d->write = disk_cache_write;
+    d->read = disk_cache_read;
+    d->writev = dp->writev?disk_cache_writev:NULL;
+    d->readv = dp->readv?disk_cache_readv:NULL;
+    d->flush = disk_cache_flush;
+    d->close = disk_cache_close;
+
+    ctx->writeback_task_args = memory_malloc_ext(heap, sizeof(void*), 0);
+
+    if(ctx->writeback_task_args) {
+        ctx->writeback_task_args[0] = ctx;
+
+        ctx->writeback_task_id = task_create_task(NULL, 2 << 20, 64 << 10, disk_cache_writeback_task, 1, ctx->writeback_task_args, "disk cache writeback");
+
+        if(ctx->writeback_task_id == -1ULL) {
+            ctx->writeback_task_id = 0;
+        }
+    }
+
+    if(!ctx->writeback_task_id) {
+        PRINTLOG(DISK, LOG_WARNING, "cannot create write-back task, dirty pages are written only at flush");
+    }
+
+    PRINTLOG(DISK, LOG_DEBUG, "disk cache created with 0x%llx pages of 0x%llx bytes at %lli shards",
+             shard_page_count * ctx->shard_count, ctx->page_size, ctx->shard_count);
+
+    return d;
+}
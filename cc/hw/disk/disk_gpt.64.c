@@ -465,6 +465,8 @@ uint64_t                        disk_partition_get_size(const disk_or_partition_
 uint64_t                        disk_partition_get_block_size(const disk_or_partition_t* d);
 int8_t                          disk_partition_write(const disk_or_partition_t* d, uint64_t lba, uint64_t count, uint8_t* data);
 int8_t                          disk_partition_read(const disk_or_partition_t* d, uint64_t lba, uint64_t count, uint8_t** data);
+int8_t                          disk_partition_writev(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count);
+int8_t                          disk_partition_readv(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count);
 int8_t                          disk_partition_flush(const disk_or_partition_t* d);
 int8_t                          disk_partition_close(const disk_or_partition_t* d);
 const disk_partition_context_t* disk_partition_get_context(const disk_partition_t* p);
@@ -505,6 +507,8 @@ disk_partition_t* gpt_get_partition(const disk_t* d, uint8_t partno) {
     res->partition.close = disk_partition_close;
     res->partition.read = disk_partition_read;
     res->partition.write = disk_partition_write;
+    res->partition.writev = d->disk.writev?disk_partition_writev:NULL;
+    res->partition.readv = d->disk.readv?disk_partition_readv:NULL;
     res->partition.flush = disk_partition_flush;
     res->partition.get_heap = disk_partition_get_heap;
     res->partition.get_size = disk_partition_get_size;
@@ -580,6 +584,8 @@ disk_partition_t* gpt_get_partition_by_type_data(const disk_t* d, const void* da
     res->partition.close = disk_partition_close;
     res->partition.read = disk_partition_read;
     res->partition.write = disk_partition_write;
+    res->partition.writev = d->disk.writev?disk_partition_writev:NULL;
+    res->partition.readv = d->disk.readv?disk_partition_readv:NULL;
     res->partition.flush = disk_partition_flush;
     res->partition.get_heap = disk_partition_get_heap;
     res->partition.get_size = disk_partition_get_size;
@@ -668,6 +674,26 @@ int8_t disk_partition_read(const disk_or_partition_t* d, uint64_t lba, uint64_t
     return dctx->disk->disk.read((disk_or_partition_t*)dctx->disk, dctx->ctx->start_lba + lba, count, data);
 }
 
+int8_t disk_partition_writev(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count) {
+    if(!d) {
+        return 0;
+    }
+
+    disk_context_t* dctx = d->context;
+
+    return dctx->disk->disk.writev((disk_or_partition_t*)dctx->disk, dctx->ctx->start_lba + lba, iov, iov_count);
+}
+
+int8_t disk_partition_readv(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count) {
+    if(!d) {
+        return 0;
+    }
+
+    disk_context_t* dctx = d->context;
+
+    return dctx->disk->disk.readv((disk_or_partition_t*)dctx->disk, dctx->ctx->start_lba + lba, iov, iov_count);
+}
+
 
 int8_t disk_partition_flush(const disk_or_partition_t* d) {
     if(!d) {
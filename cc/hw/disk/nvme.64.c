@@ -21,7 +21,7 @@
 MODULE("turnstone.kernel.hw.drivers.nvme");
 
 hashmap_t* nvme_disks = NULL;
-hashmap_t* nvme_disk_isr_map = NULL;
+hashmap_t* nvme_io_queue_isr_map = NULL;
 
 int8_t    nvme_isr(interrupt_frame_ext_t* frame);
 int8_t    nvme_format(nvme_disk_t* nvme_disk);
@@ -52,55 +52,53 @@ int8_t nvme_isr(interrupt_frame_ext_t* frame) {
     uint8_t intnum = frame->interrupt_number;
     intnum -= 0x20;
 
-    nvme_disk_t* nvme_disk = (nvme_disk_t*)hashmap_get(nvme_disk_isr_map, (void*)(uint64_t)intnum);
+    nvme_io_queue_t* io_queue = (nvme_io_queue_t*)hashmap_get(nvme_io_queue_isr_map, (void*)(uint64_t)intnum);
 
-    if(nvme_disk == NULL) {
+    if(io_queue == NULL) {
         apic_eoi();
 
         return 0;
     }
 
-    // uint32_t status_code = nvme_disk->io_completion_queue[nvme_disk->io_c_queue_head].status_code;
-    // uint32_t status_type = nvme_disk->io_completion_queue[nvme_disk->io_c_queue_head].status_type;
-    // uint32_t sqhd = nvme_disk->io_completion_queue[nvme_disk->io_c_queue_head].sqhd;
-    // uint32_t sqid = nvme_disk->io_completion_queue[nvme_disk->io_c_queue_head].sqid;
-
-    while(nvme_disk->io_s_queue_tail != nvme_disk->io_c_queue_head) {
-        uint32_t cid = nvme_disk->io_completion_queue[nvme_disk->io_c_queue_head].cid;
-        uint32_t status_code = nvme_disk->io_completion_queue[nvme_disk->io_c_queue_head].status_code;
-        boolean_t phase = nvme_disk->io_completion_queue[nvme_disk->io_c_queue_head].p;
+    while(true) {
+        nvme_completion_queue_entry_t* cqe = &io_queue->completion_queue[io_queue->c_queue_head];
 
-        if(status_code != 0) {
-            // TODO: handle error
+        // entries with old phase are not posted by controller yet
+        if(cqe->p != io_queue->current_phase) {
             break;
         }
 
-        if(nvme_disk->current_phase != phase) {
-            // TODO: handle error phase
-            break;
-        } else {
-            lock_t* lock = (lock_t*)hashmap_get(nvme_disk->command_lock_map, (void*)(uint64_t)cid);
-            hashmap_delete(nvme_disk->command_lock_map, (void*)(uint64_t)cid);
+        uint16_t cid = cqe->cid;
 
-            if(lock == NULL) {
-                // TODO: handle error
-            }
+        if(cqe->status_code != 0 || cqe->status_type != 0) {
+            PRINTLOG(NVME, LOG_ERROR, "command %x at queue %i failed. status code: %x type: %x",
+                     cid, io_queue->queue_id, cqe->status_code, cqe->status_type);
+        }
 
-            lock_release(lock);
+        lock_t* lock = NULL;
 
-            nvme_disk->active_command_count--;
+        if(cid < io_queue->queue_size) {
+            lock = io_queue->command_locks[cid];
+            io_queue->command_locks[cid] = NULL;
+        }
 
-            nvme_disk->io_c_queue_head = (nvme_disk->io_c_queue_head + 1) % nvme_disk->io_queue_size;
+        if(lock == NULL) {
+            PRINTLOG(NVME, LOG_ERROR, "unknown command %x completed at queue %i", cid, io_queue->queue_id);
+        } else {
+            lock_release(lock);
+            __atomic_sub_fetch(&io_queue->active_command_count, 1, __ATOMIC_SEQ_CST);
+        }
 
-            *nvme_disk->io_completion_queue_head_doorbell = nvme_disk->io_c_queue_head;
+        io_queue->c_queue_head = (io_queue->c_queue_head + 1) % io_queue->queue_size;
 
-            if(nvme_disk->io_c_queue_head == 0) {
-                nvme_disk->current_phase = !nvme_disk->current_phase;
-            }
+        if(io_queue->c_queue_head == 0) {
+            io_queue->current_phase = !io_queue->current_phase;
         }
     }
 
-    pci_msix_clear_pending_bit(nvme_disk->pci_device, nvme_disk->msix_capability, 1);
+    *io_queue->completion_queue_head_doorbell = io_queue->c_queue_head;
+
+    pci_msix_clear_pending_bit(io_queue->nvme_disk->pci_device, io_queue->nvme_disk->msix_capability, io_queue->msix_vector);
     apic_eoi();
     return 0;
 }
@@ -185,15 +183,15 @@ static int8_t nvme_configure_bar_va(nvme_disk_t* nvme_disk) {
 static int8_t nvme_configure_queues_address(nvme_disk_t* nvme_disk, nvme_controller_registers_t* nvme_regs) {
     frame_t* queue_frames = NULL;
 
-    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), 4, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_RESERVED, &queue_frames, NULL) != 0) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot allocate frame for queues");
+    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), 2, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_RESERVED, &queue_frames, NULL) != 0) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot allocate frame for admin queues");
 
         return -1;
     }
 
     uint64_t queue_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(queue_frames->frame_address);
     memory_paging_add_va_for_frame(queue_va, queue_frames, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
-    memory_memclean((void*)queue_va, FRAME_SIZE * 4);
+    memory_memclean((void*)queue_va, FRAME_SIZE * 2);
 
     nvme_disk->queue_frames_address = queue_frames->frame_address;
 
@@ -202,8 +200,6 @@ static int8_t nvme_configure_queues_address(nvme_disk_t* nvme_disk, nvme_control
 
     nvme_disk->admin_submission_queue = (nvme_submission_queue_entry_t*)queue_va;
     nvme_disk->admin_completion_queue = (nvme_completion_queue_entry_t*)(queue_va + FRAME_SIZE);
-    nvme_disk->io_submission_queue = (nvme_submission_queue_entry_t*)(queue_va + FRAME_SIZE * 2);
-    nvme_disk->io_completion_queue = (nvme_completion_queue_entry_t*)(queue_va + FRAME_SIZE * 3);
 
     nvme_disk->timeout = nvme_caps.fields.timeout + 1;
     nvme_disk->nvme_registers = nvme_regs;
@@ -230,74 +226,170 @@ static int8_t nvme_configure_queues_address(nvme_disk_t* nvme_disk, nvme_control
 
 
     nvme_disk->admin_queue_size = 64;
-    nvme_disk->io_queue_size = 64;
+    nvme_disk->max_io_queue_size = MIN(nvme_caps.fields.mqes + 1ULL, NVME_IO_QUEUE_MAX_SIZE);
 
     PRINTLOG(NVME, LOG_TRACE, "nvme asq %llx acq %llx", queue_frames->frame_address, queue_frames->frame_address + FRAME_SIZE);
 
     return 0;
 }
 
-static int8_t nvme_configure_queues(nvme_disk_t* nvme_disk) {
-    pci_generic_device_t* pci_nvme = nvme_disk->pci_device;
+static nvme_io_queue_t* nvme_create_io_queue(nvme_disk_t* nvme_disk, uint16_t queue_id, uint32_t cpu_id) {
+    uint64_t queue_size = nvme_disk->max_io_queue_size;
+    uint64_t sq_frame_count = (queue_size * sizeof(nvme_submission_queue_entry_t) + FRAME_SIZE - 1) / FRAME_SIZE;
+    uint64_t cq_frame_count = (queue_size * sizeof(nvme_completion_queue_entry_t) + FRAME_SIZE - 1) / FRAME_SIZE;
+    uint64_t frame_count = sq_frame_count + cq_frame_count + queue_size; // one prp list frame for each command id
 
-    if(nvme_set_queue_count(nvme_disk, 1, 1) != 0) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot set queue count");
+    nvme_io_queue_t* io_queue = memory_malloc_ext(nvme_disk->heap, sizeof(nvme_io_queue_t), 0);
 
-        return -1;
+    if(io_queue == NULL) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot allocate memory for io queue %i", queue_id);
+
+        return NULL;
+    }
+
+    io_queue->command_locks = memory_malloc_ext(nvme_disk->heap, sizeof(lock_t*) * queue_size, 0);
+    io_queue->lock = lock_create_with_heap(nvme_disk->heap);
+
+    if(io_queue->command_locks == NULL || io_queue->lock == NULL) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot allocate memory for io queue %i command locks", queue_id);
+        lock_destroy(io_queue->lock);
+        memory_free_ext(nvme_disk->heap, io_queue->command_locks);
+        memory_free_ext(nvme_disk->heap, io_queue);
+
+        return NULL;
     }
 
-    PRINTLOG(NVME, LOG_TRACE, "creating io cq");
+    frame_t* queue_frames = NULL;
+
+    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), frame_count, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_RESERVED, &queue_frames, NULL) != 0) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot allocate frame for io queue %i", queue_id);
+        lock_destroy(io_queue->lock);
+        memory_free_ext(nvme_disk->heap, io_queue->command_locks);
+        memory_free_ext(nvme_disk->heap, io_queue);
+
+        return NULL;
+    }
+
+    uint64_t queue_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(queue_frames->frame_address);
+    memory_paging_add_va_for_frame(queue_va, queue_frames, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
+    memory_memclean((void*)queue_va, FRAME_SIZE * frame_count);
+
+    io_queue->nvme_disk = nvme_disk;
+    io_queue->queue_id = queue_id;
+    io_queue->msix_vector = queue_id; // vector 0 is left for admin queue
+    io_queue->cpu_id = cpu_id;
+    io_queue->queue_size = queue_size;
+    io_queue->queue_frames_fa = queue_frames->frame_address;
+    io_queue->submission_queue = (nvme_submission_queue_entry_t*)queue_va;
+    io_queue->completion_queue = (nvme_completion_queue_entry_t*)(queue_va + sq_frame_count * FRAME_SIZE);
+    io_queue->prp_frame_fa = queue_frames->frame_address + (sq_frame_count + cq_frame_count) * FRAME_SIZE;
+    io_queue->prp_frame_va = queue_va + (sq_frame_count + cq_frame_count) * FRAME_SIZE;
+    io_queue->current_phase = true; // new completion queue starts with phase 1
+    io_queue->submission_queue_tail_doorbell = (uint32_t*)(nvme_disk->bar_va + 0x1000 + (2 * queue_id) * (4 << nvme_disk->doorbell_stride));
+    io_queue->completion_queue_head_doorbell = (uint32_t*)(nvme_disk->bar_va + 0x1000 + (2 * queue_id + 1) * (4 << nvme_disk->doorbell_stride));
+
+    pci_generic_device_t* pci_nvme = nvme_disk->pci_device;
+
+    PRINTLOG(NVME, LOG_TRACE, "creating io cq %i for cpu %i", queue_id, cpu_id);
 
-    nvme_disk->io_queue_isr = pci_msix_set_isr(pci_nvme,  nvme_disk->msix_capability, 1, nvme_isr);
-    hashmap_put(nvme_disk_isr_map, (void*)nvme_disk->io_queue_isr, nvme_disk);
+    io_queue->isr = pci_msix_set_isr_for_apic_id(pci_nvme, nvme_disk->msix_capability, io_queue->msix_vector, nvme_isr, cpu_id);
+    hashmap_put(nvme_io_queue_isr_map, (void*)io_queue->isr, io_queue);
 
     if(nvme_send_admin_command(nvme_disk,
                                NVME_ADMIN_CMD_CREATE_CQ, // opcode
                                0x0, // fuse
                                0x0, // nsid
                                0x0, // mptr
-                               nvme_disk->queue_frames_address + 3 * FRAME_SIZE, // prp1
+                               io_queue->queue_frames_fa + sq_frame_count * FRAME_SIZE, // prp1
                                0x0, // prp2
-                               ((nvme_disk->io_queue_size - 1) << 16) | 1, // cdw10
-                               (1 << 16) | (1 << 1) | 1, // cdw11
+                               ((queue_size - 1) << 16) | queue_id, // cdw10
+                               (io_queue->msix_vector << 16) | (1 << 1) | 1, // cdw11
                                0x0, // cdw12
                                0x0, // cdw13
                                0x0, // cdw14
                                0x0, // cdw15
                                0x0 // sdw0
                                ) != 0) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot create io cq");
+        PRINTLOG(NVME, LOG_ERROR, "cannot create io cq %i", queue_id);
+        hashmap_delete(nvme_io_queue_isr_map, (void*)io_queue->isr);
 
-        return -1;
+        return NULL;
     }
 
-    pci_msix_clear_pending_bit(pci_nvme, nvme_disk->msix_capability, 1);
+    pci_msix_clear_pending_bit(pci_nvme, nvme_disk->msix_capability, io_queue->msix_vector);
 
-    PRINTLOG(NVME, LOG_TRACE, "io cq created");
+    PRINTLOG(NVME, LOG_TRACE, "io cq %i created", queue_id);
 
-    PRINTLOG(NVME, LOG_TRACE, "creating io sq");
+    PRINTLOG(NVME, LOG_TRACE, "creating io sq %i", queue_id);
 
     if(nvme_send_admin_command(nvme_disk,
                                NVME_ADMIN_CMD_CREATE_SQ, // opcode
                                0x0, // fuse
                                0x0, // nsid
                                0x0, // mptr
-                               nvme_disk->queue_frames_address + 2 * FRAME_SIZE, // prp1
+                               io_queue->queue_frames_fa, // prp1
                                0x0, // prp2
-                               ((nvme_disk->io_queue_size - 1) << 16) | 1, // cdw10
-                               (1 << 16) | 1, // cdw11
+                               ((queue_size - 1) << 16) | queue_id, // cdw10
+                               (queue_id << 16) | 1, // cdw11
                                0x0, // cdw12
                                0x0, // cdw13
                                0x0, // cdw14
                                0x0, // cdw15
                                0x0 // sdw0
                                ) != 0) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot create io sq");
+        PRINTLOG(NVME, LOG_ERROR, "cannot create io sq %i", queue_id);
+        hashmap_delete(nvme_io_queue_isr_map, (void*)io_queue->isr);
+
+        return NULL;
+    }
+
+    PRINTLOG(NVME, LOG_TRACE, "io sq %i created", queue_id);
+
+    return io_queue;
+}
+
+static int8_t nvme_configure_queues(nvme_disk_t* nvme_disk) {
+    uint64_t cpu_count = apic_get_ap_count() + 1;
+
+    if(nvme_set_queue_count(nvme_disk, cpu_count, cpu_count) != 0) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot set queue count");
+
+        return -1;
+    }
+
+    // msix vector 0 is for admin queue, other vectors are for io queues
+    uint64_t queue_count = MIN(cpu_count, MIN(nvme_disk->io_sq_count, nvme_disk->io_cq_count));
+    queue_count = MIN(queue_count, nvme_disk->msix_capability->table_size);
+
+    if(queue_count == 0) {
+        PRINTLOG(NVME, LOG_ERROR, "controller does not have any io queue");
+
+        return -1;
+    }
+
+    nvme_disk->io_queues = memory_malloc_ext(nvme_disk->heap, sizeof(nvme_io_queue_t*) * queue_count, 0);
+
+    if(nvme_disk->io_queues == NULL) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot allocate memory for io queues");
 
         return -1;
     }
 
-    PRINTLOG(NVME, LOG_TRACE, "io sq created");
+    for(uint64_t i = 0; i < queue_count; i++) {
+        nvme_io_queue_t* io_queue = nvme_create_io_queue(nvme_disk, i + 1, i);
+
+        if(io_queue == NULL) {
+            PRINTLOG(NVME, LOG_ERROR, "cannot create io queue pair %lli", i + 1);
+
+            return -1;
+        }
+
+        nvme_disk->io_queues[i] = io_queue;
+        nvme_disk->io_queue_count++;
+    }
+
+    PRINTLOG(NVME, LOG_DEBUG, "%lli io queue pairs with %lli entries created for %lli cpus",
+             nvme_disk->io_queue_count, nvme_disk->max_io_queue_size, cpu_count);
 
     return 0;
 }
@@ -440,34 +532,12 @@ static int8_t nvme_configure_queue_configs(nvme_disk_t* nvme_disk) {
     uint64_t dstrd = nvme_caps.fields.dstrd;
     uint64_t admin_sqtdb = nvme_disk->bar_va + 0x1000 + (2 * 0) * (4 << dstrd);
     uint64_t admin_cqhdb = nvme_disk->bar_va + 0x1000 + (2 * 0 + 1) * (4 << dstrd);
-    uint64_t io_sqtdb = nvme_disk->bar_va + 0x1000 + (2 * 1) * (4 << dstrd);
-    uint64_t io_cqhdb = nvme_disk->bar_va + 0x1000 + (2 * 1 + 1) * (4 << dstrd);
 
     PRINTLOG(NVME, LOG_TRACE, "nvme admin sqtdb %llx cqhdb %llx", admin_sqtdb, admin_cqhdb);
-    PRINTLOG(NVME, LOG_TRACE, "nvme io sqtdb %llx cqhdb %llx", io_sqtdb, io_cqhdb);
 
+    nvme_disk->doorbell_stride = dstrd;
     nvme_disk->admin_completion_queue_head_doorbell = (uint32_t*)admin_cqhdb;
     nvme_disk->admin_submission_queue_tail_doorbell = (uint32_t*)admin_sqtdb;
-    nvme_disk->io_completion_queue_head_doorbell = (uint32_t*)io_cqhdb;
-    nvme_disk->io_submission_queue_tail_doorbell = (uint32_t*)io_sqtdb;
-
-    return 0;
-}
-
-static int8_t nvme_configure_prp_frames(nvme_disk_t* nvme_disk) {
-    frame_t* prp_frames = NULL;
-
-    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), 64, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_RESERVED, &prp_frames, NULL) != 0) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot allocate frame for prp");
-
-        return -1;
-    }
-
-    nvme_disk->prp_frame_fa = prp_frames->frame_address;
-    nvme_disk->prp_frame_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(nvme_disk->prp_frame_fa);
-
-    memory_paging_add_va_for_frame(nvme_disk->prp_frame_va, prp_frames, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
-    memory_memclean((void*)nvme_disk->prp_frame_va, 64 * FRAME_SIZE);
 
     return 0;
 }
@@ -485,19 +555,9 @@ static int8_t nvme_init_disk(memory_heap_t* heap, uint64_t disk_id, const pci_de
         return -1;
     }
 
-    nvme_disk->command_lock_map = hashmap_integer(64);
-
-    if(nvme_disk->command_lock_map == NULL) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot allocate memory for nvme command lock map");
-        memory_free_ext(heap, nvme_disk);
-
-        return -1;
-    }
-
     nvme_disk->heap = heap;
     nvme_disk->disk_id = disk_id;
     nvme_disk->pci_device = pci_nvme;
-    nvme_disk->current_phase = true; // when nvme controller is reset, phase is 1
 
 
     if(nvme_find_msix(nvme_disk) != 0) {
@@ -563,13 +623,6 @@ static int8_t nvme_init_disk(memory_heap_t* heap, uint64_t disk_id, const pci_de
         return -1;
     }
 
-    if(nvme_configure_prp_frames(nvme_disk) != 0) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot configure prp frames");
-        memory_free_ext(heap, nvme_disk);
-
-        return -1;
-    }
-
     hashmap_put(nvme_disks, (void*)nvme_disk->disk_id, nvme_disk);
 
     return 0;
@@ -593,10 +646,10 @@ int8_t nvme_init(memory_heap_t* heap, list_t* nvme_pci_devices) {
         return -1;
     }
 
-    nvme_disk_isr_map = hashmap_integer(16);
+    nvme_io_queue_isr_map = hashmap_integer(16);
 
-    if(nvme_disk_isr_map == NULL) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot allocate memory for nvme disk isr map");
+    if(nvme_io_queue_isr_map == NULL) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot allocate memory for nvme io queue isr map");
 
         return -1;
     }
@@ -690,8 +743,9 @@ int8_t nvme_set_queue_count(nvme_disk_t* nvme_disk, uint16_t io_sq_count, uint16
                                          );
 
     if(res == 0) {
-        nvme_disk->io_sq_count = (result >> 16) & 0xFFFF;
-        nvme_disk->io_cq_count = result & 0xFFFF;
+        // controller returns zero based counts
+        nvme_disk->io_sq_count = (result & 0xFFFF) + 1;
+        nvme_disk->io_cq_count = ((result >> 16) & 0xFFFF) + 1;
     }
 
     return res;
@@ -727,196 +781,221 @@ future_t* nvme_write(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t* buf
     return nvme_read_write(disk_id, lba, size, buffer, true);
 }
 
-future_t* nvme_read_write(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t* buffer, boolean_t write) {
-    nvme_disk_t* nvme_disk = (nvme_disk_t*)hashmap_get(nvme_disks, (void*)disk_id);
+static nvme_io_queue_t* nvme_get_io_queue(nvme_disk_t* nvme_disk) {
+    return nvme_disk->io_queues[task_get_cpu_id() % nvme_disk->io_queue_count];
+}
 
-    if(nvme_disk == NULL) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot %s: disk not found", write?"write":"read");
+static uint64_t nvme_iovec_page_count(const disk_iovec_t* iov, uint64_t iov_count) {
+    uint64_t page_count = 0;
 
-        return NULL;
+    for(uint64_t i = 0; i < iov_count; i++) {
+        page_count += (iov[i].length + 0xFFF) / 0x1000;
     }
 
-    if(nvme_disk->active_command_count > nvme_disk->io_queue_size - 1) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot %s: too many active commands", write?"write":"read");
+    return page_count;
+}
 
-        return NULL;
-    }
+static future_t* nvme_submit_io_command(nvme_disk_t* nvme_disk, uint8_t opcode, uint32_t nsid,
+                                        const disk_iovec_t* iov, uint64_t iov_count, uint64_t lba, uint64_t fcnt) {
+    nvme_io_queue_t* io_queue = nvme_get_io_queue(nvme_disk);
 
-    if(size % nvme_disk->lba_size) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot %s: size not multiple of 0x%x", write?"write":"read", nvme_disk->lba_size);
+    uint64_t page_count = nvme_iovec_page_count(iov, iov_count);
 
-        return NULL;
-    }
-
-    uint64_t fcnt = size / nvme_disk->lba_size;
-    uint64_t fa_cnt = fcnt / (0x1000 / nvme_disk->lba_size);
+    lock_acquire(io_queue->lock);
 
-    if(fcnt > 512) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot %s: size too big", write?"write":"read");
+    if(io_queue->active_command_count >= (int64_t)io_queue->queue_size - 1) {
+        lock_release(io_queue->lock);
+        PRINTLOG(NVME, LOG_ERROR, "cannot send command %x: too many active commands at queue %i", opcode, io_queue->queue_id);
 
         return NULL;
     }
 
-    uint64_t buffer_va = (uint64_t)buffer;
+    uint64_t tid = task_get_id();
+    lock_t* lock = lock_create_with_heap_for_future(nvme_disk->heap, true, tid);
 
-    if(buffer_va % 0x1000) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot %s: buffer not aligned to 4k", write?"write":"read");
+    if(lock == NULL) {
+        lock_release(io_queue->lock);
+        PRINTLOG(NVME, LOG_ERROR, "cannot create lock for command %x", opcode);
 
         return NULL;
     }
 
-    uint64_t buffer_fa = 0;
+    future_t* fut = future_create_with_heap_and_data(nvme_disk->heap, lock, NULL);
 
-    if(memory_paging_get_physical_address(buffer_va, &buffer_fa) != 0) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot %s: buffer physical address not found", write?"write":"read");
+    if(fut == NULL) {
+        lock_release(io_queue->lock);
+        lock_destroy(lock);
+        PRINTLOG(NVME, LOG_ERROR, "cannot create future for command %x", opcode);
 
         return NULL;
     }
 
-    uint16_t cid = nvme_disk->next_cid++;
+    // find a free command id, completions free them at isr
+    uint16_t cid = io_queue->next_cid;
 
-    if(cid == 0) {
-        cid = nvme_disk->next_cid++;
+    while(io_queue->command_locks[cid] != NULL) {
+        cid = (cid + 1) % io_queue->queue_size;
     }
 
-    uint64_t iosqt = nvme_disk->io_s_queue_tail;
-
-    uint64_t prp1 = buffer_fa;
-
-    PRINTLOG(NVME, LOG_TRACE, "prp1: %llx va %llx", prp1, buffer_va);
+    io_queue->next_cid = (cid + 1) % io_queue->queue_size;
 
+    uint64_t prp1 = 0;
     uint64_t prp2 = 0;
 
-    if(fa_cnt == 2) {
-        prp2 = prp1 + 0x1000;
-    } else if(fa_cnt > 2) {
-        prp2 = nvme_disk->prp_frame_fa + iosqt * 0x1000;
-        uint64_t* prp2_list = (uint64_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(prp2);
+    if(page_count) {
+        prp1 = iov[0].frame_address;
+    }
+
+    if(page_count == 2) {
+        prp2 = iov[0].length > 0x1000 ? prp1 + 0x1000 : iov[1].frame_address;
+    } else if(page_count > 2) {
+        // first page is at prp1, other pages are listed at command's prp list frame
+        prp2 = io_queue->prp_frame_fa + cid * 0x1000;
+        uint64_t* prp2_list = (uint64_t*)(io_queue->prp_frame_va + cid * 0x1000);
         memory_memclean(prp2_list, 0x1000);
 
-        for(uint64_t i = 0; i < fa_cnt - 1; i++) {
-            prp2_list[i] = prp1 + (i + 1) * 0x1000;
-            PRINTLOG(NVME, LOG_TRACE, "prp2: %llx va %llx", prp2_list[i], buffer_va + (i + 1) * 0x1000);
+        uint64_t prp_idx = 0;
+
+        for(uint64_t i = 0; i < iov_count; i++) {
+            for(uint64_t offset = i == 0 ? 0x1000 : 0; offset < iov[i].length; offset += 0x1000) {
+                prp2_list[prp_idx++] = iov[i].frame_address + offset;
+            }
         }
     }
 
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].opc = write?NVME_CMD_WRITE:NVME_CMD_READ;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].fuse = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cid = cid;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].nsid = nvme_disk->ns_id;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].psdt = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].mptr = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].dptr.prplist.prp1 = prp1;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].dptr.prplist.prp2 = prp2;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw10 = lba & 0xFFFFFFFF;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw11 = (lba >> 32) & 0xFFFFFFFF;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw12 = (fcnt - 1);
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw13 = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw14 = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw15 = 0;
+    nvme_submission_queue_entry_t* sqe = &io_queue->submission_queue[io_queue->s_queue_tail];
 
-    uint64_t tid = task_get_id();
-    lock_t* lock = lock_create_with_heap_for_future(nvme_disk->heap, true, tid);
+    sqe->opc = opcode;
+    sqe->fuse = 0;
+    sqe->cid = cid;
+    sqe->nsid = nsid;
+    sqe->psdt = 0;
+    sqe->mptr = 0;
+    sqe->dptr.prplist.prp1 = prp1;
+    sqe->dptr.prplist.prp2 = prp2;
+    sqe->cdw10 = lba & 0xFFFFFFFF;
+    sqe->cdw11 = (lba >> 32) & 0xFFFFFFFF;
+    sqe->cdw12 = fcnt ? (fcnt - 1) : 0;
+    sqe->cdw13 = 0;
+    sqe->cdw14 = 0;
+    sqe->cdw15 = 0;
 
-    if(lock == NULL) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot create lock for %s", write?"write":"read");
+    io_queue->command_locks[cid] = lock;
+    __atomic_add_fetch(&io_queue->active_command_count, 1, __ATOMIC_SEQ_CST);
 
-        return NULL;
+    io_queue->s_queue_tail = (io_queue->s_queue_tail + 1) % io_queue->queue_size;
+    *io_queue->submission_queue_tail_doorbell = io_queue->s_queue_tail;
+
+    PRINTLOG(NVME, LOG_TRACE, "command %x sent with cid %x to queue %i and s tail %llx", opcode, cid, io_queue->queue_id, io_queue->s_queue_tail);
+
+    lock_release(io_queue->lock);
+
+    return fut;
+}
+
+uint64_t nvme_get_max_transfer_page_count(const nvme_disk_t* nvme_disk) {
+    // one prp list frame is used for each command, it can hold 512 entries after first page at prp1
+    uint64_t max_pages = NVME_MAX_PRP_LIST_ENTRIES + 1;
+
+    if(nvme_disk->identify->mdts) {
+        max_pages = MIN(max_pages, nvme_disk->max_prp_entries);
     }
 
-    hashmap_put(nvme_disk->command_lock_map, (void*)(uint64_t)cid, lock);
-    future_t* fut = future_create(lock);
+    return max_pages;
+}
+
+future_t* nvme_read_write_vectored(uint64_t disk_id, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count, boolean_t write) {
+    nvme_disk_t* nvme_disk = (nvme_disk_t*)hashmap_get(nvme_disks, (void*)disk_id);
 
-    if(fut == NULL) {
-        hashmap_delete(nvme_disk->command_lock_map, (void*)(uint64_t)cid);
-        lock_destroy(lock);
-        PRINTLOG(NVME, LOG_ERROR, "cannot create future for %s", write?"write":"read");
+    if(nvme_disk == NULL) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot %s: disk not found", write?"write":"read");
 
         return NULL;
     }
 
-    nvme_disk->io_s_queue_tail = (nvme_disk->io_s_queue_tail + 1) % 64;
-    *nvme_disk->io_submission_queue_tail_doorbell = nvme_disk->io_s_queue_tail;
+    if(iov == NULL || iov_count == 0) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot %s: empty io vector", write?"write":"read");
 
-    nvme_disk->active_command_count++;
+        return NULL;
+    }
 
-    PRINTLOG(NVME, LOG_TRACE, "%s command sent with cid %x and s tail %llx", write?"write":"read", cid, nvme_disk->io_s_queue_tail - 1);
+    uint64_t size = 0;
 
-    return fut;
-}
+    for(uint64_t i = 0; i < iov_count; i++) {
+        if(iov[i].frame_address % 0x1000 || iov[i].length == 0) {
+            PRINTLOG(NVME, LOG_ERROR, "cannot %s: io vector %lli not aligned to 4k", write?"write":"read", i);
 
-future_t* nvme_flush(uint64_t disk_id) {
-    PRINTLOG(NVME, LOG_TRACE, "flushing disk %llx", disk_id);
+            return NULL;
+        }
 
-    nvme_disk_t* nvme_disk = (nvme_disk_t*)hashmap_get(nvme_disks, (void*)disk_id);
+        if(i != iov_count - 1 && iov[i].length % 0x1000) {
+            PRINTLOG(NVME, LOG_ERROR, "cannot %s: io vector %lli length not multiple of 4k", write?"write":"read", i);
 
-    if(nvme_disk == NULL) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot flush: disk not found");
+            return NULL;
+        }
 
-        return NULL;
+        size += iov[i].length;
     }
 
-    if(nvme_disk->active_command_count > nvme_disk->io_queue_size - 1) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot flush: too many active commands");
+    if(size % nvme_disk->lba_size) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot %s: size not multiple of 0x%x", write?"write":"read", nvme_disk->lba_size);
 
         return NULL;
     }
 
-    if(!nvme_disk->flush_supported) {
-        PRINTLOG(NVME, LOG_TRACE, "cannot flush: flush not supported");
+    uint64_t fcnt = size / nvme_disk->lba_size;
+
+    if(fcnt > 0x10000 || nvme_iovec_page_count(iov, iov_count) > nvme_get_max_transfer_page_count(nvme_disk)) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot %s: size too big", write?"write":"read");
 
         return NULL;
     }
 
-    uint16_t cid = nvme_disk->next_cid++;
+    return nvme_submit_io_command(nvme_disk, write?NVME_CMD_WRITE:NVME_CMD_READ, nvme_disk->ns_id, iov, iov_count, lba, fcnt);
+}
 
-    if(cid == 0) {
-        cid = nvme_disk->next_cid++;
-    }
-
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].opc = NVME_CMD_FLUSH;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].fuse = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cid = cid;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].nsid = 0xFFFFFFFF;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].psdt = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].mptr = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].dptr.prplist.prp1 = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].dptr.prplist.prp2 = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw10 = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw11 = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw12 = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw13 = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw14 = 0;
-    nvme_disk->io_submission_queue[nvme_disk->io_s_queue_tail].cdw15 = 0;
+future_t* nvme_read_write(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t* buffer, boolean_t write) {
+    uint64_t buffer_va = (uint64_t)buffer;
 
-    uint64_t tid = task_get_id();
-    lock_t* lock = lock_create_with_heap_for_future(nvme_disk->heap, true, tid);
+    if(buffer_va % 0x1000) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot %s: buffer not aligned to 4k", write?"write":"read");
 
-    if(lock == NULL) {
-        PRINTLOG(NVME, LOG_ERROR, "cannot create lock for flush");
+        return NULL;
+    }
+
+    uint64_t buffer_fa = 0;
+
+    if(memory_paging_get_physical_address(buffer_va, &buffer_fa) != 0) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot %s: buffer physical address not found", write?"write":"read");
 
         return NULL;
     }
 
+    PRINTLOG(NVME, LOG_TRACE, "prp1: %llx va %llx", buffer_fa, buffer_va);
 
-    hashmap_put(nvme_disk->command_lock_map, (void*)(uint64_t)cid, lock);
-    future_t* fut = future_create_with_heap_and_data(nvme_disk->heap, lock, NULL);
+    disk_iovec_t iov = {.frame_address = buffer_fa, .length = size};
 
-    if(fut == NULL) {
-        lock_destroy(lock);
-        PRINTLOG(NVME, LOG_ERROR, "cannot create future for flush");
+    return nvme_read_write_vectored(disk_id, lba, &iov, 1, write);
+}
+
+future_t* nvme_flush(uint64_t disk_id) {
+    PRINTLOG(NVME, LOG_TRACE, "flushing disk %llx", disk_id);
+
+    nvme_disk_t* nvme_disk = (nvme_disk_t*)hashmap_get(nvme_disks, (void*)disk_id);
+
+    if(nvme_disk == NULL) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot flush: disk not found");
 
         return NULL;
     }
 
-    nvme_disk->io_s_queue_tail = (nvme_disk->io_s_queue_tail + 1) % nvme_disk->io_queue_size;
-    *nvme_disk->io_submission_queue_tail_doorbell = nvme_disk->io_s_queue_tail;
-
-    nvme_disk->active_command_count++;
+    if(!nvme_disk->flush_supported) {
+        PRINTLOG(NVME, LOG_TRACE, "cannot flush: flush not supported");
 
-    PRINTLOG(NVME, LOG_TRACE, "flush command sent with cid %x and s tail %llx", cid, nvme_disk->io_s_queue_tail - 1);
+        return NULL;
+    }
 
-    return fut;
+    return nvme_submit_io_command(nvme_disk, NVME_CMD_FLUSH, 0xFFFFFFFF, NULL, 0, 0, 0);
 }
 
 int8_t nvme_send_admin_command(nvme_disk_t* nvme_disk,
@@ -9,9 +9,14 @@
 #include <driver/nvme.h>
 #include <utils.h>
 #include <list.h>
+#include <logging.h>
+#include <cpu/task.h>
 
 MODULE("turnstone.kernel.hw.disk.nvme");
 
+/*! submit attempts of a vectored command while io queue is full */
+#define NVME_DISK_IMPL_SUBMIT_RETRY_COUNT 128
+
 typedef struct disk_context_t {
     nvme_disk_t* nvme_disk;
     uint64_t     block_size;
@@ -22,6 +27,8 @@ uint64_t       nvme_disk_impl_get_size(const disk_or_partition_t* d);
 uint64_t       nvme_disk_impl_get_block_size(const disk_or_partition_t* d);
 int8_t         nvme_disk_impl_write(const disk_or_partition_t* d, uint64_t lba, uint64_t count, uint8_t* data);
 int8_t         nvme_disk_impl_read(const disk_or_partition_t* d, uint64_t lba, uint64_t count, uint8_t** data);
+int8_t         nvme_disk_impl_writev(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count);
+int8_t         nvme_disk_impl_readv(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count);
 int8_t         nvme_disk_impl_flush(const disk_or_partition_t* d);
 int8_t         nvme_disk_impl_close(const disk_or_partition_t* d);
 
@@ -83,10 +90,6 @@ int8_t nvme_disk_impl_write(const disk_or_partition_t* d, uint64_t lba, uint64_t
         rem_lba -= iter_read_size;
     }
 
-    if(need_to_free) {
-        memory_free_ext(ctx->nvme_disk->heap, write_buf);
-    }
-
     iterator_t* iter = list_iterator_create(futs);
 
     while(iter->end_of_iterator(iter) != 0) {
@@ -97,8 +100,15 @@ int8_t nvme_disk_impl_write(const disk_or_partition_t* d, uint64_t lba, uint64_t
         iter = iter->next(iter);
     }
 
+    iter->destroy(iter);
+
     list_destroy(futs);
 
+    // bounce buffer should live until all writes are completed
+    if(need_to_free) {
+        memory_free_ext(ctx->nvme_disk->heap, write_buf);
+    }
+
     return 0;
 }
 
@@ -149,11 +159,131 @@ int8_t nvme_disk_impl_read(const disk_or_partition_t* d, uint64_t lba, uint64_t
         iter = iter->next(iter);
     }
 
+    iter->destroy(iter);
+
     list_destroy(futs);
 
     return 0;
 }
 
+static int8_t nvme_disk_impl_read_write_vectored(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count, boolean_t write) {
+    disk_context_t* ctx = (disk_context_t*)d->context;
+
+    if(iov == NULL || iov_count == 0) {
+        return -1;
+    }
+
+    uint64_t total_size = 0;
+
+    for(uint64_t i = 0; i < iov_count; i++) {
+        if(iov[i].frame_address % 0x1000 || iov[i].length == 0 || (i != iov_count - 1 && iov[i].length % 0x1000)) {
+            return -1;
+        }
+
+        total_size += iov[i].length;
+    }
+
+    if(total_size == 0 || total_size % ctx->block_size) {
+        return -1;
+    }
+
+    // commands are split at page boundaries, so each part is still a valid prp
+    uint64_t max_part_size = nvme_get_max_transfer_page_count(ctx->nvme_disk) * 0x1000;
+
+    if(max_part_size > 0x10000 * ctx->block_size) {
+        max_part_size = 0x10000 * ctx->block_size;
+    }
+
+    disk_iovec_t* part_iov = memory_malloc_ext(ctx->nvme_disk->heap, sizeof(disk_iovec_t) * iov_count, 0);
+
+    if(part_iov == NULL) {
+        return -1;
+    }
+
+    list_t* futs = list_create_list_with_heap(ctx->nvme_disk->heap);
+
+    if(futs == NULL) {
+        memory_free_ext(ctx->nvme_disk->heap, part_iov);
+
+        return -1;
+    }
+
+    uint64_t iov_idx = 0;
+    uint64_t iov_offset = 0;
+    int8_t res = 0;
+
+    while(iov_idx < iov_count) {
+        uint64_t part_count = 0;
+        uint64_t part_size = 0;
+
+        while(iov_idx < iov_count && part_size < max_part_size) {
+            uint64_t len = MIN(iov[iov_idx].length - iov_offset, max_part_size - part_size);
+
+            part_iov[part_count].frame_address = iov[iov_idx].frame_address + iov_offset;
+            part_iov[part_count].length = len;
+            part_count++;
+            part_size += len;
+            iov_offset += len;
+
+            if(iov_offset == iov[iov_idx].length) {
+                iov_idx++;
+                iov_offset = 0;
+            }
+        }
+
+        future_t* fut = NULL;
+
+        // io queue may be full, yield so completions can free slots
+        for(uint64_t retry = 0; retry < NVME_DISK_IMPL_SUBMIT_RETRY_COUNT; retry++) {
+            fut = nvme_read_write_vectored(ctx->nvme_disk->disk_id, lba, part_iov, part_count, write);
+
+            if(fut != NULL) {
+                break;
+            }
+
+            task_yield();
+        }
+
+        if(fut == NULL) {
+            PRINTLOG(NVME, LOG_ERROR, "cannot %s lba 0x%llx after %i attempts", write?"write":"read", lba, NVME_DISK_IMPL_SUBMIT_RETRY_COUNT);
+            res = -1;
+
+            break;
+        }
+
+        list_list_insert(futs, fut);
+
+        lba += part_size / ctx->block_size;
+    }
+
+    memory_free_ext(ctx->nvme_disk->heap, part_iov);
+
+    // submitted parts are waited even on error, caller buffers are in use until they complete
+    iterator_t* iter = list_iterator_create(futs);
+
+    while(iter->end_of_iterator(iter) != 0) {
+        future_t* fut = (future_t*)iter->get_item(iter);
+
+        future_get_data_and_destroy(fut);
+
+        iter = iter->next(iter);
+    }
+
+    iter->destroy(iter);
+
+    list_destroy(futs);
+
+    return res;
+}
+
+int8_t nvme_disk_impl_writev(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count) {
+    return nvme_disk_impl_read_write_vectored(d, lba, iov, iov_count, true);
+}
+
+int8_t nvme_disk_impl_readv(const disk_or_partition_t* d, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count) {
+    return nvme_disk_impl_read_write_vectored(d, lba, iov, iov_count, false);
+}
+
 int8_t nvme_disk_impl_flush(const disk_or_partition_t* d) {
     disk_context_t* ctx = (disk_context_t*)d->context;
 
@@ -207,6 +337,8 @@ disk_t* nvme_disk_impl_open(nvme_disk_t* nvme_disk) {
     d->disk.get_block_size = nvme_disk_impl_get_block_size;
     d->disk.write = nvme_disk_impl_write;
     d->disk.read = nvme_disk_impl_read;
+    d->disk.writev = nvme_disk_impl_writev;
+    d->disk.readv = nvme_disk_impl_readv;
     d->disk.flush = nvme_disk_impl_flush;
     d->disk.close = nvme_disk_impl_close;
 
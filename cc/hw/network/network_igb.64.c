@@ -65,112 +65,189 @@ static void network_igb_disable_interrupts(const network_igb_dev_t* dev) {
 }
 
 static void network_igb_enable_interrupts(const network_igb_dev_t* dev) {
-    pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, 0);
-    pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, 1);
-    pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, 2);
+    for(uint64_t vector = 0; vector <= dev->other_vector; vector++) {
+        pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, vector);
+    }
+
+    // throttle queue interrupts, rings are polled in batches after an interrupt
+    for(uint64_t q_idx = 0; q_idx < dev->queue_count; q_idx++) {
+        network_igb_write_mmio(dev, NETWORK_IGB_REG_EITR(q_idx), NETWORK_IGB_EITR_INTERVAL(NETWORK_IGB_EITR_INTERVAL_US));
+    }
 
+    uint32_t vectors = NETWORK_IGB_EICR_VECTOR(dev->other_vector + 1) - 1;
 
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_EIAC, 0x7); // dont use auto clear
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_EIMS, 0x7); // int 0, 1, 2
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_EIAC, vectors); // dont use auto clear
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_EIMS, vectors); // queue vectors and other vector
     network_igb_write_mmio(dev, NETWORK_IGB_REG_GPIE, 1 << 4); // enable multiple isr
     network_igb_write_mmio(dev, NETWORK_IGB_REG_IMS, 0xC00054);
     network_igb_read_mmio(dev, NETWORK_IGB_REG_ICR);
 }
 
+// well known toeplitz key, it spreads ipv4 flows evenly
+static const uint8_t network_igb_rss_key[NETWORK_IGB_RSSRK_SIZE] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+static void network_igb_rss_init(const network_igb_dev_t* dev) {
+    if(dev->queue_count < 2) {
+        // all packets go to queue 0
+        network_igb_write_mmio(dev, NETWORK_IGB_REG_MRQC, 0);
+
+        return;
+    }
 
-static int8_t network_igb_process_tx(void) {
+    for(uint32_t i = 0; i < NETWORK_IGB_RSSRK_SIZE / 4; i++) {
+        uint32_t key = network_igb_rss_key[i * 4] |
+                       (network_igb_rss_key[i * 4 + 1] << 8) |
+                       (network_igb_rss_key[i * 4 + 2] << 16) |
+                       ((uint32_t)network_igb_rss_key[i * 4 + 3] << 24);
 
-    for(uint64_t dev_idx = 0; dev_idx < list_size(igb_net_devs); dev_idx++) {
-        network_igb_dev_t* dev = (network_igb_dev_t*)list_get_data_at_position(igb_net_devs, dev_idx);
+        network_igb_write_mmio(dev, NETWORK_IGB_REG_RSSRK(i), key);
+    }
 
-        dev->return_queue = list_create_queue_with_heap(NULL);
-        task_add_message_queue(dev->return_queue);
+    // each redirection register has four one byte entries, low bits of hash select the entry
+    for(uint32_t i = 0; i < NETWORK_IGB_RETA_ENTRY_COUNT / 4; i++) {
+        uint32_t reta = 0;
 
-        void** args = memory_malloc(sizeof(void*) * 2);
+        for(uint32_t j = 0; j < 4; j++) {
+            reta |= ((i * 4 + j) % dev->queue_count) << (j * 8);
+        }
 
-        if(args == NULL) {
-            return -1;
+        network_igb_write_mmio(dev, NETWORK_IGB_REG_RETA(i), reta);
+    }
+
+    // hash is also written to rx descriptors
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_RXCSUM, network_igb_read_mmio(dev, NETWORK_IGB_REG_RXCSUM) | NETWORK_IGB_RXCSUM_PCSD);
+
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_MRQC, NETWORK_IGB_MRQC_ENABLE_RSS |
+                           NETWORK_IGB_MRQC_RSS_IPV4 | NETWORK_IGB_MRQC_RSS_IPV4_TCP | NETWORK_IGB_MRQC_RSS_IPV4_UDP);
+
+    PRINTLOG(IGB, LOG_TRACE, "rss enabled for 0x%llx queues", dev->queue_count);
+}
+
+static void network_igb_tx_reclaim(network_igb_queue_t* queue) {
+    while(queue->tx_clean != queue->tx_tail) {
+        if(!(queue->tx_desc[queue->tx_clean].status & NETWORK_IGB_TXD_STAT_DD)) {
+            break;
         }
 
-        args[0] = (void*)dev->mac;
-        args[1] = dev->return_queue;
+        network_netbuf_put(queue->tx_netbufs[queue->tx_clean]);
+        queue->tx_netbufs[queue->tx_clean] = NULL;
 
-        task_create_task(NULL, 1 << 20, 64 << 10, &network_dhcpv4_send_discover, 2, args, "dhcp");
+        queue->tx_clean = (queue->tx_clean + 1) % NETWORK_IGB_NUM_TX_DESCRIPTORS;
     }
+}
 
-    while(1) {
-        boolean_t packet_exists = 0;
-
-        for(uint64_t dev_idx = 0; dev_idx < list_size(igb_net_devs); dev_idx++) {
-            network_igb_dev_t* dev = (network_igb_dev_t*)list_get_data_at_position(igb_net_devs, dev_idx);
+static network_netbuf_t* network_igb_tx_netbuf(const network_transmit_packet_t* packet) {
+    if(packet->netbuf) {
+        // packet is embedded into netbuf, its reference moves to descriptor
+        return packet->netbuf;
+    }
 
-            while(list_size(dev->return_queue)) {
-                const network_transmit_packet_t* packet = list_queue_pop(dev->return_queue);
+    // heap backed packets are copied into a netbuf once
+    network_netbuf_t* netbuf = NULL;
 
-                if(packet) {
-                    PRINTLOG(NETWORK, LOG_TRACE, "network packet will be sended with length 0x%llx", packet->packet_len);
-                    packet_exists = 1;
+    if(packet->packet_len <= NETWORK_NETBUF_DATA_SIZE) {
+        netbuf = network_netbuf_alloc();
+    }
 
-                    uint8_t* buffer = (uint8_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(dev->tx_desc[dev->tx_tail].address);
+    if(netbuf) {
+        memory_memcopy(packet->packet_data, network_netbuf_append(netbuf, packet->packet_len), packet->packet_len);
+    }
 
-                    memory_memcopy(packet->packet_data, buffer, packet->packet_len);
+    memory_free(packet->packet_data);
+    memory_free((void*)packet);
 
-                    dev->tx_desc[dev->tx_tail].length = packet->packet_len;
-                    dev->tx_desc[dev->tx_tail].cmd = 3;
+    return netbuf;
+}
 
-                    memory_free(packet->packet_data);
-                    memory_free((void*)packet);
+static uint32_t network_igb_tx_poll(network_igb_queue_t* queue, uint32_t budget, boolean_t* ring_full) {
+    uint32_t queued = 0;
 
-                    // update the tail so the hardware knows it's ready
-                    dev->tx_tail = (dev->tx_tail + 1) % NETWORK_IGB_NUM_TX_DESCRIPTORS;
-                    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDT, dev->tx_tail);
+    while(queued < budget && list_size(queue->return_queue)) {
+        int32_t next_tail = (queue->tx_tail + 1) % NETWORK_IGB_NUM_TX_DESCRIPTORS;
 
-                    dev->tx_count++;
+        if(next_tail == queue->tx_clean) {
+            PRINTLOG(NETWORK, LOG_TRACE, "tx ring is full");
+            *ring_full = 1;
 
-                }
+            break;
+        }
 
-                PRINTLOG(NETWORK, LOG_TRACE, "tx queue size 0x%llx", list_size(dev->return_queue));
-            }
+        const network_transmit_packet_t* packet = list_queue_pop(queue->return_queue);
 
+        if(packet == NULL) {
+            continue;
         }
 
-        if(packet_exists == 0) {
-            task_set_message_waiting();
-            task_yield();
+        PRINTLOG(NETWORK, LOG_TRACE, "network packet will be sended with length 0x%llx", packet->packet_len);
+
+        network_netbuf_t* netbuf = network_igb_tx_netbuf(packet);
+
+        if(netbuf == NULL) {
+            PRINTLOG(NETWORK, LOG_ERROR, "cannot get netbuf for tx packet");
+            queue->tx_stats.dropped++;
+
+            continue;
         }
 
+        // descriptor points to netbuf, it is released when hardware reports done
+        queue->tx_netbufs[queue->tx_tail] = netbuf;
+        queue->tx_desc[queue->tx_tail].address = network_netbuf_data_fa(netbuf);
+        queue->tx_desc[queue->tx_tail].length = netbuf->len;
+        queue->tx_desc[queue->tx_tail].status = 0;
+        queue->tx_desc[queue->tx_tail].cmd = NETWORK_IGB_TXD_CMD_EOP | NETWORK_IGB_TXD_CMD_IFCS | NETWORK_IGB_TXD_CMD_RS;
+
+        queue->tx_tail = next_tail;
+
+        queue->tx_stats.packets++;
+        queue->tx_stats.bytes += netbuf->len;
+        queued++;
     }
 
-    return 0;
+    if(queued) {
+        // update the tail once for whole batch so the hardware knows they are ready
+        network_igb_write_mmio(queue->dev, NETWORK_IGB_REG_TDT(queue->index), queue->tx_tail);
+        queue->tx_stats.doorbells++;
+    }
+
+    queue->tx_stats.polls++;
+
+    PRINTLOG(NETWORK, LOG_TRACE, "0x%x packets queued, tx queue size 0x%llx", queued, list_size(queue->return_queue));
+
+    return queued;
 }
 
-static int8_t network_igb_rx_init(network_igb_dev_t* dev) {
-    PRINTLOG(IGB, LOG_TRACE, "try to initialize rx queue");
+static int8_t network_igb_rx_init(network_igb_queue_t* queue) {
+    PRINTLOG(IGB, LOG_TRACE, "try to initialize rx queue 0x%x", queue->index);
 
-    frame_allocator_t* fa = frame_get_allocator();
+    const network_igb_dev_t* dev = queue->dev;
+    uint8_t q_idx = queue->index;
 
-    // allocate a 10K buffer for the receive queue
-    uint64_t packet_buffer_size = NETWORK_IGB_RX_BUFFER_SIZE * NETWORK_IGB_NUM_RX_DESCRIPTORS;
-    uint64_t packet_buffer_frm_cnt = (packet_buffer_size + FRAME_SIZE - 1)  / FRAME_SIZE;
+    frame_allocator_t* fa = frame_get_allocator();
 
-    frame_t* rx_packet_buffer_frames;
+    // each descriptor owns a netbuf, received netbuf goes up to stack and descriptor gets a new one
+    queue->rx_netbufs = memory_malloc(sizeof(network_netbuf_t*) * NETWORK_IGB_NUM_RX_DESCRIPTORS);
 
-    if(fa->allocate_frame_by_count(fa, packet_buffer_frm_cnt, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_RESERVED, &rx_packet_buffer_frames, NULL) != 0) {
-        PRINTLOG(IGB, LOG_ERROR, "cannot allocate frames for rx packet buffer");
+    if(queue->rx_netbufs == NULL) {
+        PRINTLOG(IGB, LOG_ERROR, "cannot allocate rx netbuf list");
 
         return -1;
     }
 
-    rx_packet_buffer_frames->frame_attributes |= FRAME_ATTRIBUTE_RESERVED_PAGE_MAPPED;
-
-    uint64_t rx_packet_buffer_fa = rx_packet_buffer_frames->frame_address;
-    uint64_t rx_packet_buffer_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(rx_packet_buffer_fa);
-    memory_paging_add_va_for_frame(rx_packet_buffer_va, rx_packet_buffer_frames, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
+    for(int32_t i = 0; i < NETWORK_IGB_NUM_RX_DESCRIPTORS; i++ ) {
+        queue->rx_netbufs[i] = network_netbuf_alloc();
 
-    memory_memset((void*)rx_packet_buffer_va, 0, packet_buffer_size);
+        if(queue->rx_netbufs[i] == NULL) {
+            PRINTLOG(IGB, LOG_ERROR, "cannot allocate netbufs for rx queue");
 
-    dev->rx_packet_buffer_fa = rx_packet_buffer_fa;
-    dev->rx_packet_buffer_va = rx_packet_buffer_va;
+            return -1;
+        }
+    }
 
     // allocate a 256 byte buffer for the receive queue headers
     uint64_t header_buffer_size = NETWORK_IGB_RX_HEADER_SIZE * NETWORK_IGB_NUM_RX_DESCRIPTORS;
@@ -192,8 +269,8 @@ static int8_t network_igb_rx_init(network_igb_dev_t* dev) {
 
     memory_memset((void*)rx_header_buffer_va, 0, header_buffer_size);
 
-    dev->rx_header_buffer_fa = rx_header_buffer_fa;
-    dev->rx_header_buffer_va = rx_header_buffer_va;
+    queue->rx_header_buffer_fa = rx_header_buffer_fa;
+    queue->rx_header_buffer_va = rx_header_buffer_va;
 
     // allocate a 16 byte buffer for the receive queue meta data
     uint64_t queue_meta_frm_cnt = ((sizeof(network_igb_rx_desc_t) * NETWORK_IGB_NUM_RX_DESCRIPTORS)  + FRAME_SIZE - 1 ) / FRAME_SIZE;
@@ -216,383 +293,374 @@ static int8_t network_igb_rx_init(network_igb_dev_t* dev) {
     memory_memset((void*)queue_meta_va, 0, sizeof(network_igb_rx_desc_t) * NETWORK_IGB_NUM_RX_DESCRIPTORS);
 
     // this should be first
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_SRRCTL, 0x600040A); // 10K packet buffer, 256 byte header format, type 2
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_SRRCTL(q_idx), 0x6000400 | (NETWORK_IGB_RX_BUFFER_SIZE >> 10)); // netbuf sized packet buffer, 256 byte header format, type 2
 
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDBAL, queue_meta_fa & 0xFFFFFFFF);
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDBAH, (queue_meta_fa >> 32) & 0xFFFFFFFF);
-    dev->rx_desc = (network_igb_rx_desc_t*)queue_meta_va;
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDBAL(q_idx), queue_meta_fa & 0xFFFFFFFF);
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDBAH(q_idx), (queue_meta_fa >> 32) & 0xFFFFFFFF);
+    queue->rx_desc = (network_igb_rx_desc_t*)queue_meta_va;
 
     PRINTLOG(IGB, LOG_TRACE, "filling rx queue at 0x%llx", queue_meta_va);
 
     for(int32_t i = 0; i < NETWORK_IGB_NUM_RX_DESCRIPTORS; i++ ) {
-        dev->rx_desc[i].read.pkt_addr = (rx_packet_buffer_fa + i * NETWORK_IGB_RX_BUFFER_SIZE); // | 0x1; // set the LSB to 1
-        dev->rx_desc[i].read.hdr_addr = (rx_header_buffer_fa + i * NETWORK_IGB_RX_HEADER_SIZE); // | 0x1; // set the LSB to 1
+        queue->rx_desc[i].read.pkt_addr = network_netbuf_data_fa(queue->rx_netbufs[i]);
+        queue->rx_desc[i].read.hdr_addr = (rx_header_buffer_fa + i * NETWORK_IGB_RX_HEADER_SIZE); // | 0x1; // set the LSB to 1
     }
 
     // receive buffer length; NETWORK_IGB_NUM_RX_DESCRIPTORS 16-byte descriptors
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDLEN, (uint32_t)(NETWORK_IGB_NUM_RX_DESCRIPTORS * sizeof(network_igb_rx_desc_t)));
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDLEN(q_idx), (uint32_t)(NETWORK_IGB_NUM_RX_DESCRIPTORS * sizeof(network_igb_rx_desc_t)));
 
     // setup head and tail pointers
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDH, 0);
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDT, NETWORK_IGB_NUM_RX_DESCRIPTORS - 1);
-    dev->rx_tail = NETWORK_IGB_NUM_RX_DESCRIPTORS - 1;
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDH(q_idx), 0);
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_RDT(q_idx), NETWORK_IGB_NUM_RX_DESCRIPTORS - 1);
+    queue->rx_tail = NETWORK_IGB_NUM_RX_DESCRIPTORS - 1;
 
 
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_RXDCTL, network_igb_read_mmio(dev, NETWORK_IGB_REG_RXDCTL) |
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_RXDCTL(q_idx), network_igb_read_mmio(dev, NETWORK_IGB_REG_RXDCTL(q_idx)) |
                            NETWORK_IGB_RXDCTL_ENABLE);
 
-    // set the receieve control register (promisc ON, 8K pkt size)
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_RCTL, NETWORK_IGB_RCTL_LPE | NETWORK_IGB_RCTL_BAM);
-
-    PRINTLOG(IGB, LOG_TRACE, "rx queue initialized");
+    PRINTLOG(IGB, LOG_TRACE, "rx queue 0x%x initialized", q_idx);
 
     return 0;
 
 }
 
-static int8_t network_igb_tx_init(network_igb_dev_t* dev) {
-    uint64_t queue_size = (8192 + 16) * NETWORK_IGB_NUM_TX_DESCRIPTORS;
+static int8_t network_igb_tx_init(network_igb_queue_t* queue) {
+    const network_igb_dev_t* dev = queue->dev;
+    uint8_t q_idx = queue->index;
 
-    uint64_t queue_frm_cnt = (queue_size + FRAME_SIZE - 1)  / FRAME_SIZE;
-    uint64_t queue_meta_frm_cnt = ((sizeof(network_igb_rx_desc_t) * NETWORK_IGB_NUM_TX_DESCRIPTORS)  + FRAME_SIZE - 1 ) / FRAME_SIZE;
+    uint64_t queue_meta_frm_cnt = ((sizeof(network_igb_tx_desc_t) * NETWORK_IGB_NUM_TX_DESCRIPTORS)  + FRAME_SIZE - 1 ) / FRAME_SIZE;
 
-
-    frame_t* queue_frames;
     frame_t* queue_meta_frames;
 
-    PRINTLOG(IGB, LOG_TRACE, "tx queue size 0x%llx queue frm count 0x%llx meta frm count 0x%llx", queue_size, queue_frm_cnt, queue_meta_frm_cnt);
+    PRINTLOG(IGB, LOG_TRACE, "tx queue meta frm count 0x%llx", queue_meta_frm_cnt);
+
+    // packets are sent from their netbufs, so only descriptors are allocated
+    queue->tx_netbufs = memory_malloc(sizeof(network_netbuf_t*) * NETWORK_IGB_NUM_TX_DESCRIPTORS);
+
+    if(queue->tx_netbufs == NULL) {
+        PRINTLOG(IGB, LOG_ERROR, "cannot allocate tx netbuf list");
 
-    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), queue_frm_cnt, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_RESERVED, &queue_frames, NULL) != 0 ||
-       frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), queue_meta_frm_cnt, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_RESERVED, &queue_meta_frames, NULL) != 0) {
+        return -1;
+    }
+
+    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), queue_meta_frm_cnt, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_RESERVED, &queue_meta_frames, NULL) != 0) {
         PRINTLOG(IGB, LOG_ERROR, "cannot allocate frames for tx queue");
 
         return -1;
     }
 
-    queue_frames->frame_attributes |= FRAME_ATTRIBUTE_RESERVED_PAGE_MAPPED;
     queue_meta_frames->frame_attributes |= FRAME_ATTRIBUTE_RESERVED_PAGE_MAPPED;
 
-    uint64_t queue_fa = queue_frames->frame_address;
-    uint64_t queue_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(queue_frames->frame_address);
-    memory_paging_add_va_for_frame(queue_va, queue_frames, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
-
     uint64_t queue_meta_fa = queue_meta_frames->frame_address;
     uint64_t queue_meta_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(queue_meta_frames->frame_address);
     memory_paging_add_va_for_frame(queue_meta_va, queue_meta_frames, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
 
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDBAL, queue_meta_fa & 0xFFFFFFFF);
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDBAH, (queue_meta_fa >> 32) & 0xFFFFFFFF);
-    dev->tx_desc = (network_igb_tx_desc_t*)queue_meta_va;
-
-    PRINTLOG(IGB, LOG_TRACE, "filling tx queue at 0x%llx", queue_meta_va);
+    memory_memset((void*)queue_meta_va, 0, sizeof(network_igb_tx_desc_t) * NETWORK_IGB_NUM_TX_DESCRIPTORS);
 
-    for(int32_t i = 0; i < NETWORK_IGB_NUM_TX_DESCRIPTORS; i++ ) {
-        dev->tx_desc[i].address = queue_fa + i * (8192 + 16);
-        dev->tx_desc[i].cmd = 0;
-    }
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDBAL(q_idx), queue_meta_fa & 0xFFFFFFFF);
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDBAH(q_idx), (queue_meta_fa >> 32) & 0xFFFFFFFF);
+    queue->tx_desc = (network_igb_tx_desc_t*)queue_meta_va;
 
     // receive buffer length; NETWORK_IGB_NUM_RX_DESCRIPTORS 16-byte descriptors
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDLEN, (uint32_t)(NETWORK_IGB_NUM_TX_DESCRIPTORS * 16));
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDLEN(q_idx), (uint32_t)(NETWORK_IGB_NUM_TX_DESCRIPTORS * 16));
 
-    // setup head and tail pointers
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDH, 0);
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDT, NETWORK_IGB_NUM_TX_DESCRIPTORS - 1);
-    dev->tx_tail = 0;
+    // setup head and tail pointers, ring is empty
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDH(q_idx), 0);
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_TDT(q_idx), 0);
+    queue->tx_tail = 0;
+    queue->tx_clean = 0;
 
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_TXDCTL, network_igb_read_mmio(dev, NETWORK_IGB_REG_TXDCTL) |
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_TXDCTL(q_idx), network_igb_read_mmio(dev, NETWORK_IGB_REG_TXDCTL(q_idx)) |
                            NETWORK_IGB_TXDCTL_ENABLE);
 
-    // set the transmit control register (padshortpackets)
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_TCTL, NETWORK_IGB_TCTL_EN | NETWORK_IGB_TCTL_PSP);
-
-    PRINTLOG(IGB, LOG_TRACE, "tx queue initialized");
+    PRINTLOG(IGB, LOG_TRACE, "tx queue 0x%x initialized", q_idx);
 
     return 0;
 }
 
-extern uint64_t network_rx_task_id;
-
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
-// This can be used stand-alone or from an interrupt handler
-static int32_t network_igb_process_rx(uint64_t args_cnt, void** args) {
-    if(args_cnt != 1) {
-        PRINTLOG(IGB, LOG_ERROR, "invalid args count");
-        return -1;
-    }
-
-    network_igb_dev_t* dev = (network_igb_dev_t*)args[0];
-
-    if(!dev) {
-        PRINTLOG(IGB, LOG_ERROR, "invalid dev");
-        return -1;
-    }
-
+static boolean_t network_igb_rx_ready(const network_igb_queue_t* queue) {
+    int32_t next = (queue->rx_tail + 1) % NETWORK_IGB_NUM_RX_DESCRIPTORS;
 
-    cpu_cli();
-    pci_msix_update_lapic((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, 0);
-    pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, 0);
-    task_set_interruptible();
-    cpu_sti();
-
-    while(true) {
-        boolean_t notify_network_rx = true;
-
-        if(network_received_packets != NULL && dev->return_queue != NULL) {
-
-            while(true) {
-                // advance the tail pointer
-                ((network_igb_dev_t*)dev)->rx_tail = (dev->rx_tail + 1) % NETWORK_IGB_NUM_RX_DESCRIPTORS;
-                // check if the next descriptor is ready
-                uint32_t status_error = dev->rx_desc[dev->rx_tail].wb.upper.status_error;
-                // first 20bits are status, last 12 bits are error
-                uint32_t status = status_error & 0xFFFFF;
-                uint32_t error = status_error >> 20;
-
-                PRINTLOG(IGB, LOG_TRACE, "rx status 0x%x error 0x%x", status, error);
+    return (queue->rx_desc[next].wb.upper.status_error & 1) != 0;
+}
 
-                if( !(status & 1) ) { // descriptor is not ready
-                    ((network_igb_dev_t*)dev)->rx_tail = (dev->rx_tail - 1) % NETWORK_IGB_NUM_RX_DESCRIPTORS;
-                    PRINTLOG(IGB, LOG_TRACE, "rx descriptor is not ready");
-                    break;
-                }
+static uint32_t network_igb_rx_poll(network_igb_queue_t* queue, uint32_t budget) {
+    network_rx_queue_t* rx_queue = queue->network_rx_queue;
+    boolean_t notify_network_rx = true;
+    uint32_t processed = 0;
 
-                // we get packet address with calculated offset
-                uint8_t* pkt = (uint8_t*)(dev->rx_packet_buffer_va + dev->rx_tail * NETWORK_IGB_RX_BUFFER_SIZE);
-                uint16_t pktlen = dev->rx_desc[dev->rx_tail].wb.upper.length;
-                boolean_t dropflag = 0;
+    while(processed < budget) {
+        int32_t next = (queue->rx_tail + 1) % NETWORK_IGB_NUM_RX_DESCRIPTORS;
+        // check if the next descriptor is ready
+        uint32_t status_error = queue->rx_desc[next].wb.upper.status_error;
+        // first 20bits are status, last 12 bits are error
+        uint32_t status = status_error & 0xFFFFF;
+        uint32_t error = status_error >> 20;
 
-                if( pktlen < 60 ) {
-                    dropflag = 1;
-                }
+        PRINTLOG(IGB, LOG_TRACE, "rx status 0x%x error 0x%x", status, error);
 
-                if(error) {
-                    PRINTLOG(IGB, LOG_WARNING, "device has rx errors 0x%x", error);
+        if( !(status & 1) ) { // descriptor is not ready
+            PRINTLOG(IGB, LOG_TRACE, "rx descriptor is not ready");
+            break;
+        }
 
-                    dropflag = 1;
-                }
+        queue->rx_tail = next;
 
-                if( !dropflag ) {
-                    // send the packet to higher layers for parsing
-                    PRINTLOG(IGB, LOG_TRACE, "packet received with len 0x%x", pktlen);
+        network_netbuf_t* netbuf = queue->rx_netbufs[queue->rx_tail];
+        uint16_t pktlen = queue->rx_desc[queue->rx_tail].wb.upper.length;
+        boolean_t dropflag = 0;
 
-                    pkt = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(pkt);
+        if( pktlen < 60 ) {
+            dropflag = 1;
+        }
 
-                    network_received_packet_t* packet = memory_malloc_ext(list_get_heap(network_received_packets), sizeof(network_received_packet_t), 0);
+        if(error) {
+            PRINTLOG(IGB, LOG_WARNING, "device has rx errors 0x%x", error);
 
-                    if(packet == NULL) {
-                        PRINTLOG(IGB, LOG_ERROR, "failed to allocate packet");
-                        notify_network_rx = true;
+            dropflag = 1;
+        }
 
-                        task_yield();
+        network_netbuf_t* refill_netbuf = NULL;
 
-                        continue;
-                    }
+        if( !dropflag ) {
+            refill_netbuf = network_netbuf_alloc();
 
-                    packet->packet_len = pktlen;
-                    packet->return_queue = dev->return_queue;
-                    packet->network_info = (void*)dev->mac;
-                    packet->network_type = NETWORK_TYPE_ETHERNET;
+            if(refill_netbuf == NULL) {
+                PRINTLOG(IGB, LOG_WARNING, "netbuf pool is exhausted, packet dropped");
 
-                    packet->packet_data = memory_malloc_ext(list_get_heap(network_received_packets), pktlen, 0);
+                dropflag = 1;
+            }
+        }
 
-                    if(packet->packet_data == NULL) {
-                        PRINTLOG(IGB, LOG_ERROR, "failed to allocate packet");
-                        memory_free_ext(list_get_heap(network_received_packets), packet);
-                        notify_network_rx = true;
+        if( !dropflag ) {
+            // send the packet to higher layers for parsing
+            PRINTLOG(IGB, LOG_TRACE, "packet received with len 0x%x", pktlen);
 
-                        task_yield();
+            netbuf->len = pktlen;
 
-                        continue;
-                    }
+            network_received_packet_t* packet = &netbuf->rx_packet;
 
-                    memory_memcopy(pkt, packet->packet_data, pktlen);
+            packet->packet_len = pktlen;
+            packet->packet_data = netbuf->data;
+            // replies of a flow leave from the queue it arrived
+            packet->return_queue = queue->return_queue;
+            packet->network_info = (void*)queue->dev->mac;
+            packet->network_type = NETWORK_TYPE_ETHERNET;
+            packet->netbuf = netbuf;
 
-                    if(list_queue_push(network_received_packets, packet) == -1ULL) {
-                        PRINTLOG(IGB, LOG_ERROR, "failed to queue packet");
-                        memory_free_ext(list_get_heap(network_received_packets), packet->packet_data);
-                        memory_free_ext(list_get_heap(network_received_packets), packet);
-                    } else {
-                        PRINTLOG(IGB, LOG_TRACE, "packet queued");
+            queue->rx_netbufs[queue->rx_tail] = refill_netbuf;
 
-                        if(notify_network_rx && network_rx_task_id) {
-                            task_set_message_received(network_rx_task_id);
-                            PRINTLOG(IGB, LOG_TRACE, "cleared message waiting for rx task 0x%llx", network_rx_task_id);
-                            notify_network_rx = false;
-                        }
-                    }
+            if(list_queue_push(rx_queue->packets, packet) == -1ULL) {
+                PRINTLOG(IGB, LOG_ERROR, "failed to queue packet");
+                network_netbuf_put(netbuf);
+                queue->rx_stats.dropped++;
+            } else {
+                PRINTLOG(IGB, LOG_TRACE, "packet queued");
 
+                queue->rx_stats.packets++;
+                queue->rx_stats.bytes += pktlen;
 
+                if(notify_network_rx && rx_queue->task_id) {
+                    task_set_message_received(rx_queue->task_id);
+                    PRINTLOG(IGB, LOG_TRACE, "cleared message waiting for rx task 0x%llx", rx_queue->task_id);
+                    notify_network_rx = false;
                 }
-
-                // restore the descriptor's packet and header addresses
-                dev->rx_desc[dev->rx_tail].read.pkt_addr = dev->rx_packet_buffer_fa + dev->rx_tail * NETWORK_IGB_RX_BUFFER_SIZE;
-                dev->rx_desc[dev->rx_tail].read.hdr_addr = dev->rx_header_buffer_fa + dev->rx_tail * NETWORK_IGB_RX_HEADER_SIZE;
-
-                // update RX counts and the tail pointer
-                ((network_igb_dev_t*)dev)->rx_count++;
-
-                // write the tail to the device
-                network_igb_write_mmio(dev, NETWORK_IGB_REG_RDT, dev->rx_tail);
-                PRINTLOG(IGB, LOG_TRACE, "rx tail 0x%x", dev->rx_tail);
             }
 
-            PRINTLOG(IGB, LOG_TRACE, "rx queue size 0x%llx", list_size(network_received_packets));
-            pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, 0);
 
+        } else {
+            queue->rx_stats.dropped++;
         }
 
-        task_set_message_waiting();
-        task_yield();
+        // give the descriptor its packet and header addresses
+        queue->rx_desc[queue->rx_tail].read.pkt_addr = network_netbuf_data_fa(queue->rx_netbufs[queue->rx_tail]);
+        queue->rx_desc[queue->rx_tail].read.hdr_addr = queue->rx_header_buffer_fa + queue->rx_tail * NETWORK_IGB_RX_HEADER_SIZE;
+
+        processed++;
     }
 
-    return 0;
-}
-#pragma GCC diagnostic pop
+    if(processed) {
+        // write the tail to the device once for whole batch
+        network_igb_write_mmio(queue->dev, NETWORK_IGB_REG_RDT(queue->index), queue->rx_tail);
+        queue->rx_stats.doorbells++;
+        PRINTLOG(IGB, LOG_TRACE, "rx tail 0x%x", queue->rx_tail);
+    }
 
-void video_text_print(const char* str);
+    queue->rx_stats.polls++;
 
-static int8_t network_igb_other_isr(interrupt_frame_ext_t* frame)  {
-    UNUSED(frame);
-
-    const network_igb_dev_t* dev = list_get_data_at_position(igb_net_devs, 0);
+    return processed;
+}
 
-    if(!dev) {
-        video_text_print("no dev\n");
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+// queue isr masks the queue vector and wakes this task, it polls both rings with a budget until they are drained
+static int32_t network_igb_process_queue(uint64_t args_cnt, void** args) {
+    if(args_cnt != 1) {
+        PRINTLOG(IGB, LOG_ERROR, "invalid args count");
         return -1;
     }
 
-    uint32_t eicr = network_igb_read_mmio(dev, NETWORK_IGB_REG_EICR);
-    uint32_t isr = network_igb_read_mmio(dev, NETWORK_IGB_REG_ICR);
+    network_igb_queue_t* queue = (network_igb_queue_t*)args[0];
 
-    char_t buffer1[64] = {0};
-    char_t buffer2[64] = {0};
+    if(!queue) {
+        PRINTLOG(IGB, LOG_ERROR, "invalid queue");
+        return -1;
+    }
 
-    utoh_with_buffer(buffer1, eicr);
-    utoh_with_buffer(buffer2, isr);
+    network_igb_dev_t* dev = queue->dev;
+    pci_generic_device_t* pci_dev = (pci_generic_device_t*)dev->pci_netdev->pci_header;
 
-    video_text_print("other isr eicr 0x");
-    video_text_print(buffer1);
-    video_text_print(" isr 0x");
-    video_text_print(buffer2);
+    task_add_message_queue(queue->return_queue);
 
-    boolean_t is_other = eicr & (1 << 2);
+    // task is pinned, interrupt is delivered to its cpu
+    cpu_cli();
+    pci_msix_update_lapic(pci_dev, dev->msix_cap, queue->index);
+    pci_msix_clear_pending_bit(pci_dev, dev->msix_cap, queue->index);
+    task_set_interruptible();
+    cpu_sti();
 
-    if(!is_other) {
-        video_text_print(" not other");
-    }
+    queue->cpu_id = task_get_cpu_id();
 
-    video_text_print("\n");
+    PRINTLOG(IGB, LOG_INFO, "queue 0x%x is polled at cpu 0x%llx", queue->index, queue->cpu_id);
 
-    // clearing the pending interrupts
-    // never clear 0. and 7. bit set them 0 on isr
-    isr &= ~(1 << 0);
-    isr &= ~(1 << 7);
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_EICR, 1 << 2);
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_ICR, isr);
+    while(true) {
+        boolean_t ready = queue->network_rx_queue != NULL;
+        boolean_t need_poll = false;
 
+        network_igb_tx_reclaim(queue);
 
-    pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, 2);
+        if(ready) {
+            uint32_t processed = network_igb_rx_poll(queue, NETWORK_IGB_RX_POLL_BUDGET);
 
-    apic_eoi();
-    return 0;
-}
+            PRINTLOG(IGB, LOG_TRACE, "0x%x packets polled, rx queue size 0x%llx", processed, list_size(queue->network_rx_queue->packets));
 
-static int8_t network_igb_tx_isr(interrupt_frame_ext_t* frame)  {
-    UNUSED(frame);
+            if(processed == NETWORK_IGB_RX_POLL_BUDGET) {
+                // ring may have more packets
+                queue->rx_stats.budget_exhausted++;
+                need_poll = true;
+            }
+        }
 
-    const network_igb_dev_t* dev = list_get_data_at_position(igb_net_devs, 0);
+        boolean_t ring_full = false;
+        uint32_t queued = network_igb_tx_poll(queue, NETWORK_IGB_TX_POLL_BUDGET, &ring_full);
 
-    if(!dev) {
-        video_text_print("no dev\n");
-        return -1;
-    }
+        if(ring_full || queued == NETWORK_IGB_TX_POLL_BUDGET) {
+            queue->tx_stats.budget_exhausted++;
+            need_poll = true;
+        }
 
-    uint32_t eicr = network_igb_read_mmio(dev, NETWORK_IGB_REG_EICR);
-    uint32_t isr = network_igb_read_mmio(dev, NETWORK_IGB_REG_ICR);
+        if(need_poll) {
+            // stay in poll mode after others run
+            task_yield();
 
-    char_t buffer1[64] = {0};
-    char_t buffer2[64] = {0};
+            continue;
+        }
 
-    utoh_with_buffer(buffer1, eicr);
-    utoh_with_buffer(buffer2, isr);
+        // rings are drained, leave poll mode and wait for interrupt or tx packets.
+        // waiting is set before unmask, so an interrupt after it wakes the task instead of being overwritten.
+        // preemption should not park task before the recheck
+        boolean_t intflag = cpu_cli();
 
-    video_text_print("tx isr eicr 0x");
-    video_text_print(buffer1);
-    video_text_print(" isr 0x");
-    video_text_print(buffer2);
+        task_set_message_waiting();
 
-    boolean_t is_tx = eicr & (1 << 1);
+        pci_msix_clear_pending_bit(pci_dev, dev->msix_cap, queue->index);
+        network_igb_write_mmio(dev, NETWORK_IGB_REG_EIMS, NETWORK_IGB_EICR_VECTOR(queue->index));
 
-    if(!is_tx) {
-        video_text_print(" not tx");
-    }
+        // a packet may arrive before interrupt is unmasked
+        if(ready && network_igb_rx_ready(queue)) {
+            task_cancel_message_waiting();
 
-    video_text_print("\n");
+            if(intflag) {
+                cpu_sti();
+            }
 
-    // clearing the pending interrupts
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_EICR, 1 << 1);
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_ICR, 1 << 0); // clear tx isr
+            continue;
+        }
 
+        task_yield();
 
-    pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, 1);
+        if(intflag) {
+            cpu_sti();
+        }
+    }
 
-    apic_eoi();
     return 0;
 }
+#pragma GCC diagnostic pop
 
-static int8_t network_igb_rx_isr(interrupt_frame_ext_t* frame)  {
-    UNUSED(frame);
+static network_igb_queue_t* network_igb_find_queue_by_isr(uint8_t isr) {
+    for(uint64_t i = 0; i < list_size(igb_net_devs); i++) {
+        network_igb_dev_t* dev = (network_igb_dev_t*)list_get_data_at_position(igb_net_devs, i);
 
-    const network_igb_dev_t* dev = NULL;
+        for(uint64_t q_idx = 0; q_idx < dev->queue_count; q_idx++) {
+            if(dev->queues[q_idx].isr == isr) {
+                return &dev->queues[q_idx];
+            }
+        }
+    }
 
-    uint8_t rx_isr = frame->interrupt_number - INTERRUPT_IRQ_BASE;
+    return NULL;
+}
 
+static network_igb_dev_t* network_igb_find_dev_by_other_isr(uint8_t isr) {
     for(uint64_t i = 0; i < list_size(igb_net_devs); i++) {
-        dev = list_get_data_at_position(igb_net_devs, i);
+        network_igb_dev_t* dev = (network_igb_dev_t*)list_get_data_at_position(igb_net_devs, i);
 
-        if(dev->rx_isr == rx_isr) {
-            break;
+        if(dev->other_isr == isr) {
+            return dev;
         }
     }
 
+    return NULL;
+}
+
+static int8_t network_igb_other_isr(interrupt_frame_ext_t* frame)  {
+    network_igb_dev_t* dev = network_igb_find_dev_by_other_isr(frame->interrupt_number - INTERRUPT_IRQ_BASE);
+
     if(!dev) {
-        video_text_print("no dev\n");
         return -1;
     }
 
-    uint32_t eicr = network_igb_read_mmio(dev, NETWORK_IGB_REG_EICR);
     uint32_t isr = network_igb_read_mmio(dev, NETWORK_IGB_REG_ICR);
 
-    char_t buffer1[64] = {0};
-    char_t buffer2[64] = {0};
+    dev->other_interrupts++;
 
-    utoh_with_buffer(buffer1, eicr);
-    utoh_with_buffer(buffer2, isr);
+    // clearing the pending interrupts
+    // never clear 0. and 7. bit set them 0 on isr
+    isr &= ~(1 << 0);
+    isr &= ~(1 << 7);
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_EICR, NETWORK_IGB_EICR_VECTOR(dev->other_vector));
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_ICR, isr);
 
-    boolean_t is_rx = eicr & (1 << 0);
 
-    video_text_print("rx isr eicr 0x");
-    video_text_print(buffer1);
-    video_text_print(" isr 0x");
-    video_text_print(buffer2);
+    pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, dev->other_vector);
 
-    if(!is_rx) {
-        video_text_print(" not rx");
-    }
+    apic_eoi();
+    return 0;
+}
 
-    video_text_print("\n");
+static int8_t network_igb_queue_isr(interrupt_frame_ext_t* frame)  {
+    network_igb_queue_t* queue = network_igb_find_queue_by_isr(frame->interrupt_number - INTERRUPT_IRQ_BASE);
 
-    if(dev->rx_task_id) {
-        task_set_interrupt_received(dev->rx_task_id);
+    if(!queue) {
+        return -1;
     }
 
-    // clearing the pending interrupts
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_EICR, 1 << 0);
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_ICR, 1 << 7); // clear rx isr
+    network_igb_dev_t* dev = queue->dev;
+
+    // mask queue vector, queue task unmasks it when it leaves poll mode
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_EIMC, NETWORK_IGB_EICR_VECTOR(queue->index));
 
+    queue->interrupts++;
 
-    // pci_msix_clear_pending_bit((pci_generic_device_t*)dev->pci_netdev->pci_header, dev->msix_cap, 0);
+    // queue task receives packets and releases netbufs of completed tx descriptors
+    if(queue->task_id) {
+        task_set_interrupt_received(queue->task_id);
+    }
+
+    // clearing the pending interrupts
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_EICR, NETWORK_IGB_EICR_VECTOR(queue->index));
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_ICR, (1 << 0) | (1 << 7)); // clear tx and rx isr
 
     apic_eoi();
 
@@ -605,7 +673,9 @@ int8_t network_igb_init(const pci_dev_t* pci_netdev) {
     // logging_set_level(IGB, LOG_TRACE);
     pci_common_header_t* pci_header = pci_netdev->pci_header;
 
-    igb_net_devs = list_create_list_with_heap(NULL);
+    if(igb_net_devs == NULL) {
+        igb_net_devs = list_create_list_with_heap(NULL);
+    }
 
     if(igb_net_devs == NULL) {
         PRINTLOG(IGB, LOG_ERROR, "cannot create igb network devices list");
@@ -623,10 +693,6 @@ int8_t network_igb_init(const pci_dev_t* pci_netdev) {
 
     dev->pci_netdev = pci_netdev; // pci structure
 
-    dev->rx_count = 0;
-    dev->tx_count = 0;
-    dev->packets_dropped = 0;
-
     pci_generic_device_t* pci_dev = (pci_generic_device_t*)pci_header;
 
 
@@ -743,28 +809,77 @@ int8_t network_igb_init(const pci_dev_t* pci_netdev) {
         network_igb_write_mmio(dev, NETWORK_IGB_REG_MTA + i * 4, 0);
     }
 
-    // start the RX/TX processes
-    if(network_igb_rx_init(dev) != 0) {
-        PRINTLOG(IGB, LOG_ERROR, "cannot initialize rx queue");
-        memory_free(dev);
+    // one queue pair per network rx queue, each pair needs a vector and other causes need one more
+    uint64_t queue_count = MIN(NETWORK_IGB_MAX_QUEUES, network_rx_queue_count());
+    queue_count = MIN(queue_count, dev->msix_cap->table_size);
 
-        return -1;
+    if(queue_count == 0) {
+        queue_count = 1;
     }
 
-    if(network_igb_tx_init(dev) != 0) {
-        PRINTLOG(IGB, LOG_ERROR, "cannot initialize tx queue");
-        memory_free(dev);
+    dev->queue_count = queue_count;
+    dev->other_vector = queue_count;
 
-        return -1;
+    for(uint64_t q_idx = 0; q_idx < queue_count; q_idx++) {
+        network_igb_queue_t* queue = &dev->queues[q_idx];
+
+        queue->dev = dev;
+        queue->index = q_idx;
+        queue->network_rx_queue = network_rx_queue_get(q_idx);
+        queue->cpu_id = queue->network_rx_queue ? queue->network_rx_queue->cpu_id : task_get_cpu_id();
+
+        queue->return_queue = list_create_queue_with_heap(NULL);
+
+        if(queue->return_queue == NULL) {
+            PRINTLOG(IGB, LOG_ERROR, "cannot create return queue of queue 0x%llx", q_idx);
+            memory_free(dev);
+
+            return -1;
+        }
+
+        // rx descriptors own a netbuf each, same count is left for packets in flight
+        if(network_netbuf_pool_add(NETWORK_IGB_NUM_RX_DESCRIPTORS + NETWORK_IGB_NUM_TX_DESCRIPTORS) != 0) {
+            PRINTLOG(IGB, LOG_ERROR, "cannot create netbufs");
+            memory_free(dev);
+
+            return -1;
+        }
+
+        // start the RX/TX processes
+        if(network_igb_rx_init(queue) != 0) {
+            PRINTLOG(IGB, LOG_ERROR, "cannot initialize rx queue");
+            memory_free(dev);
+
+            return -1;
+        }
+
+        if(network_igb_tx_init(queue) != 0) {
+            PRINTLOG(IGB, LOG_ERROR, "cannot initialize tx queue");
+            memory_free(dev);
+
+            return -1;
+        }
+
+        // register the interrupt handler, vector is delivered to cpu of queue
+        queue->isr = pci_msix_set_isr_for_apic_id(pci_dev, dev->msix_cap, q_idx, &network_igb_queue_isr, queue->cpu_id);
+
+        uint32_t ivar_vector = NETWORK_IGB_IVAR_VALID | q_idx;
+        network_igb_write_mmio(dev, NETWORK_IGB_REG_IVAR(q_idx),
+                               (ivar_vector << NETWORK_IGB_IVAR_RX_SHIFT) | (ivar_vector << NETWORK_IGB_IVAR_TX_SHIFT));
     }
 
-    // register the interrupt handler
-    dev->rx_isr = pci_msix_set_isr(pci_dev, dev->msix_cap, 0, &network_igb_rx_isr);
-    dev->tx_isr = pci_msix_set_isr(pci_dev, dev->msix_cap, 1, &network_igb_tx_isr);
-    dev->other_isr = pci_msix_set_isr(pci_dev, dev->msix_cap, 2, &network_igb_other_isr);
+    dev->return_queue = dev->queues[0].return_queue;
+
+    dev->other_isr = pci_msix_set_isr(pci_dev, dev->msix_cap, dev->other_vector, &network_igb_other_isr);
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_IVAR_MISC, (NETWORK_IGB_IVAR_VALID | dev->other_vector) << NETWORK_IGB_IVAR_MISC_OTHER_SHIFT);
+
+    network_igb_rss_init(dev);
+
+    // set the receieve control register, long packets are off so a frame always fits into one netbuf
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_RCTL, NETWORK_IGB_RCTL_BAM);
 
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_IVAR, 0x8180);
-    network_igb_write_mmio(dev, NETWORK_IGB_REG_IVAR_MISC, 0x8200);
+    // set the transmit control register (padshortpackets)
+    network_igb_write_mmio(dev, NETWORK_IGB_REG_TCTL, NETWORK_IGB_TCTL_EN | NETWORK_IGB_TCTL_PSP);
 
     network_igb_write_mmio(dev, NETWORK_IGB_REG_VLAN_ETHER_TYPE, 0x8100);
 
@@ -775,30 +890,44 @@ int8_t network_igb_init(const pci_dev_t* pci_netdev) {
 
     network_igb_write_mmio(dev, NETWORK_IGB_REG_CTRL_EXT, network_igb_read_mmio(dev, NETWORK_IGB_REG_CTRL_EXT) | 0x10000000);
 
+    // isrs find device at this list
+    list_list_insert(igb_net_devs, dev);
+
     // enable all interrupts (and clear existing pending ones)
     network_igb_enable_interrupts(dev);
 
     network_igb_write_mmio(dev, NETWORK_IGB_REG_RCTL, network_igb_read_mmio(dev, NETWORK_IGB_REG_RCTL) | NETWORK_IGB_RCTL_EN);
 
-    void** rx_args = memory_malloc(sizeof(void*) * 1);
+    for(uint64_t q_idx = 0; q_idx < queue_count; q_idx++) {
+        network_igb_queue_t* queue = &dev->queues[q_idx];
 
-    if(rx_args == NULL) {
-        PRINTLOG(IGB, LOG_ERROR, "cannot allocate memory for rx task args");
+        void** queue_args = memory_malloc(sizeof(void*) * 1);
 
-        return -1;
+        if(queue_args == NULL) {
+            PRINTLOG(IGB, LOG_ERROR, "cannot allocate memory for queue task args");
+
+            return -1;
+        }
+
+        queue_args[0] = (void*)queue;
+
+        queue->task_id = task_create_task_on_cpu(NULL, 2 << 20, 64 << 10, &network_igb_process_queue, 1, queue_args, "igb queue", queue->cpu_id);
     }
 
-    rx_args[0] = (void*)dev;
+    void** dhcp_args = memory_malloc(sizeof(void*) * 2);
 
-    uint64_t rx_task_id = task_create_task(NULL, 2 << 20, 64 << 10, &network_igb_process_rx, 1, rx_args, "igb rx");
-    dev->rx_task_id = rx_task_id;
+    if(dhcp_args == NULL) {
+        PRINTLOG(IGB, LOG_ERROR, "cannot allocate memory for dhcp task args");
 
+        return -1;
+    }
 
-    task_create_task(NULL, 2 << 20, 64 << 10, &network_igb_process_tx, 0, NULL, "igb tx");
+    dhcp_args[0] = (void*)dev->mac;
+    dhcp_args[1] = dev->return_queue;
 
-    list_list_insert(igb_net_devs, dev);
+    task_create_task(NULL, 1 << 20, 64 << 10, &network_dhcpv4_send_discover, 2, dhcp_args, "dhcp");
 
-    PRINTLOG(IGB, LOG_INFO, "device initialized");
+    PRINTLOG(IGB, LOG_INFO, "device initialized with 0x%llx queues", queue_count);
 
     return 0;
 }
@@ -90,6 +90,10 @@ int8_t pci_msix_configure(pci_generic_device_t* pci_gen_dev, pci_capability_msix
 }
 
 uint8_t pci_msix_set_isr(pci_generic_device_t* pci_dev, pci_capability_msix_t* msix_cap, uint16_t msix_vector, interrupt_irq isr) {
+    return pci_msix_set_isr_for_apic_id(pci_dev, msix_cap, msix_vector, isr, apic_get_local_apic_id());
+}
+
+uint8_t pci_msix_set_isr_for_apic_id(pci_generic_device_t* pci_dev, pci_capability_msix_t* msix_cap, uint16_t msix_vector, interrupt_irq isr, uint32_t apic_id) {
     uint64_t msix_table_address = pci_get_bar_address(pci_dev, msix_cap->bir);
 
     msix_table_address += (msix_cap->table_offset << 3);
@@ -97,7 +101,6 @@ uint8_t pci_msix_set_isr(pci_generic_device_t* pci_dev, pci_capability_msix_t* m
     pci_capability_msix_table_t* msix_table = (pci_capability_msix_table_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(msix_table_address);
 
     uint32_t msg_addr = 0xFEE00000;
-    uint32_t apic_id = apic_get_local_apic_id();
     apic_id <<= 12;
     msg_addr |= apic_id;
 
@@ -31,7 +31,7 @@ static void hypervisor_ept_invept(uint64_t type) {
     }
 }
 
-static int8_t hypervisor_ept_add_ept_page(hypervisor_vm_t* vm, uint64_t host_physical, uint64_t guest_physical, boolean_t wb) {
+static uint64_t hypervisor_ept_get_pde_table(hypervisor_vm_t* vm, uint64_t guest_physical, boolean_t create) {
     uint64_t ept_base_fa = vm->ept_pml4_base;
     uint64_t ept_base_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(ept_base_fa);
 
@@ -42,12 +42,16 @@ static int8_t hypervisor_ept_add_ept_page(hypervisor_vm_t* vm, uint64_t host_phy
     uint64_t pdpte_va = 0;
 
     if(pml4e[pml4e_index].read_access == 0 && pml4e[pml4e_index].write_access == 0 && pml4e[pml4e_index].execute_access == 0) {
+        if(!create) {
+            return 0;
+        }
+
         frame_t* pdpte_frames = NULL;
         uint64_t pdpte_frames_va = hypervisor_allocate_region(&pdpte_frames, FRAME_SIZE);
 
         if(pdpte_frames_va == 0) {
             PRINTLOG(HYPERVISOR, LOG_ERROR, "Failed to allocate PDPT frames");
-            return -1;
+            return 0;
         }
 
         list_list_insert(vm->ept_frames, pdpte_frames);
@@ -75,12 +79,16 @@ static int8_t hypervisor_ept_add_ept_page(hypervisor_vm_t* vm, uint64_t host_phy
     uint64_t pde_va = 0;
 
     if(pdptes[pdpte_index].read_access == 0 && pdptes[pdpte_index].write_access == 0 && pdptes[pdpte_index].execute_access == 0) {
+        if(!create) {
+            return 0;
+        }
+
         frame_t* pde_frames = NULL;
         uint64_t pde_frames_va = hypervisor_allocate_region(&pde_frames, FRAME_SIZE);
 
         if(pde_frames_va == 0) {
             PRINTLOG(HYPERVISOR, LOG_ERROR, "Failed to allocate PDE frames");
-            return -1;
+            return 0;
         }
 
         list_list_insert(vm->ept_frames, pde_frames);
@@ -101,9 +109,67 @@ static int8_t hypervisor_ept_add_ept_page(hypervisor_vm_t* vm, uint64_t host_phy
         pde_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(pde_fa);
     }
 
+    return pde_va;
+}
+
+/**
+ * @brief splits a 2mib ept entry into 4k entries with same attributes
+ *
+ * caller should invalidate ept after changing the 4k entries.
+ * @param[in] vm vm of ept
+ * @param[in] pde_2mib 2mib entry which will be pointing to the new pte table
+ * @return 0 if succeed.
+ */
+static int8_t hypervisor_ept_split_2mib_page(hypervisor_vm_t* vm, hypervisor_ept_pde_2mib_t* pde_2mib) {
+    frame_t* pte_frames = NULL;
+    uint64_t pte_frames_va = hypervisor_allocate_region(&pte_frames, FRAME_SIZE);
+
+    if(pte_frames_va == 0) {
+        PRINTLOG(HYPERVISOR, LOG_ERROR, "Failed to allocate PTE frames for split");
+        return -1;
+    }
+
+    list_list_insert(vm->ept_frames, pte_frames);
+
+    hypervisor_ept_pte_t* ptes = (hypervisor_ept_pte_t*)pte_frames_va;
+
+    uint64_t host_physical = pde_2mib->address;
+    host_physical <<= 21;
+
+    for(uint64_t i = 0; i < 512; i++) {
+        ptes[i].read_access = pde_2mib->read_access;
+        ptes[i].write_access = pde_2mib->write_access;
+        ptes[i].execute_access = pde_2mib->execute_access;
+        ptes[i].user_mode_execute_access = pde_2mib->user_mode_execute_access;
+        ptes[i].ignore_pat = pde_2mib->ignore_pat;
+        ptes[i].memory_type = pde_2mib->memory_type;
+        ptes[i].address = (host_physical + i * FRAME_SIZE) >> 12;
+    }
+
+    hypervisor_ept_pde_t* pde = (hypervisor_ept_pde_t*)pde_2mib;
+
+    memory_memclean(pde, sizeof(hypervisor_ept_pde_t));
+
+    pde->read_access = 1;
+    pde->write_access = 1;
+    pde->execute_access = 1;
+    pde->user_mode_execute_access = 1;
+    pde->address = pte_frames->frame_address >> 12;
+
+    return 0;
+}
+
+static int8_t hypervisor_ept_add_ept_page(hypervisor_vm_t* vm, uint64_t host_physical, uint64_t guest_physical, boolean_t wb) {
+    uint64_t pde_va = hypervisor_ept_get_pde_table(vm, guest_physical, true);
+
+    if(pde_va == 0) {
+        return -1;
+    }
+
     uint64_t pde_index = (guest_physical >> 21) & 0x1FF;
 
     hypervisor_ept_pde_t* pdes = (hypervisor_ept_pde_t*)pde_va;
+    hypervisor_ept_pde_2mib_t* pdes_2mib = (hypervisor_ept_pde_2mib_t*)pde_va;
 
     uint64_t pte_va = 0;
 
@@ -129,6 +195,11 @@ static int8_t hypervisor_ept_add_ept_page(hypervisor_vm_t* vm, uint64_t host_phy
 
         pte_va = pte_frames_va;
     } else {
+        // a 4k page inside a 2mib page, split it and keep other 4k pages as is
+        if(pdes_2mib[pde_index].must_one && hypervisor_ept_split_2mib_page(vm, &pdes_2mib[pde_index]) != 0) {
+            return -1;
+        }
+
         uint64_t pte_fa = pdes[pde_index].address;
         pte_fa <<= 12;
         pte_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(pte_fa);
@@ -148,47 +219,87 @@ static int8_t hypervisor_ept_add_ept_page(hypervisor_vm_t* vm, uint64_t host_phy
 
     return 0;
 }
-static int8_t hypervisor_ept_del_ept_page(hypervisor_vm_t* vm, uint64_t host_physical, uint64_t guest_physical) {
-    uint64_t ept_base_fa = vm->ept_pml4_base;
-    uint64_t ept_base_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(ept_base_fa);
 
-    hypervisor_ept_pml4e_t* pml4e = (hypervisor_ept_pml4e_t*)ept_base_va;
+/**
+ * @brief maps a guest physical region to host physical region
+ *
+ * when both addresses are 2mib aligned and remaining size is enough, 2mib ept pages are used.
+ * hence guest ram allocated with 2mib multiples (buddy allocator aligns them) consumes less ept
+ * tables and tlb entries.
+ * @param[in] vm vm of ept
+ * @param[in] host_physical host physical start
+ * @param[in] guest_physical guest physical start
+ * @param[in] size size of region, multiple of 4k
+ * @param[in] wb write back memory or uncached
+ * @return 0 if succeed.
+ */
+static int8_t hypervisor_ept_add_ept_region(hypervisor_vm_t* vm, uint64_t host_physical, uint64_t guest_physical, uint64_t size, boolean_t wb) {
+    while(size) {
+        if(size >= MEMORY_PAGING_PAGE_LENGTH_2M &&
+           (host_physical % MEMORY_PAGING_PAGE_LENGTH_2M) == 0 &&
+           (guest_physical % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
+            uint64_t pde_va = hypervisor_ept_get_pde_table(vm, guest_physical, true);
+
+            if(pde_va == 0) {
+                return -1;
+            }
 
-    uint64_t pml4e_index = (guest_physical >> 39) & 0x1FF;
+            uint64_t pde_index = (guest_physical >> 21) & 0x1FF;
 
-    uint64_t pdpte_va = 0;
+            hypervisor_ept_pde_2mib_t* pdes_2mib = (hypervisor_ept_pde_2mib_t*)pde_va;
 
-    if(pml4e[pml4e_index].read_access == 0 && pml4e[pml4e_index].write_access == 0 && pml4e[pml4e_index].execute_access == 0) {
-        return 0;
-    } else {
-        uint64_t pdpte_fa = pml4e[pml4e_index].address;
-        pdpte_fa <<= 12;
-        pdpte_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(pdpte_fa);
-    }
+            // only empty slots are used as 2mib, otherwise existing pte table is filled
+            if(pdes_2mib[pde_index].read_access == 0 && pdes_2mib[pde_index].write_access == 0 && pdes_2mib[pde_index].execute_access == 0) {
+                pdes_2mib[pde_index].read_access = 1;
+                pdes_2mib[pde_index].write_access = 1;
+                pdes_2mib[pde_index].execute_access = 1;
+                pdes_2mib[pde_index].user_mode_execute_access = 1;
+                pdes_2mib[pde_index].must_one = 1;
+                pdes_2mib[pde_index].ignore_pat = 1;
+                pdes_2mib[pde_index].memory_type = wb?6:0;
+                pdes_2mib[pde_index].address = host_physical >> 21;
+
+                host_physical += MEMORY_PAGING_PAGE_LENGTH_2M;
+                guest_physical += MEMORY_PAGING_PAGE_LENGTH_2M;
+                size -= MEMORY_PAGING_PAGE_LENGTH_2M;
 
-    uint64_t pdpte_index = (guest_physical >> 30) & 0x1FF;
+                continue;
+            }
+        }
 
-    hypervisor_ept_pdpte_t* pdptes = (hypervisor_ept_pdpte_t*)pdpte_va;
+        if(hypervisor_ept_add_ept_page(vm, host_physical, guest_physical, wb) != 0) {
+            return -1;
+        }
 
-    uint64_t pde_va = 0;
+        host_physical += MEMORY_PAGING_PAGE_LENGTH_4K;
+        guest_physical += MEMORY_PAGING_PAGE_LENGTH_4K;
+        size -= MEMORY_PAGING_PAGE_LENGTH_4K;
+    }
 
-    if(pdptes[pdpte_index].read_access == 0 && pdptes[pdpte_index].write_access == 0 && pdptes[pdpte_index].execute_access == 0) {
+    return 0;
+}
+
+static int8_t hypervisor_ept_del_ept_page(hypervisor_vm_t* vm, uint64_t host_physical, uint64_t guest_physical) {
+    uint64_t pde_va = hypervisor_ept_get_pde_table(vm, guest_physical, false);
+
+    if(pde_va == 0) {
         return 0;
-    } else {
-        uint64_t pde_fa = pdptes[pdpte_index].address;
-        pde_fa <<= 12;
-        pde_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(pde_fa);
     }
 
     uint64_t pde_index = (guest_physical >> 21) & 0x1FF;
 
     hypervisor_ept_pde_t* pdes = (hypervisor_ept_pde_t*)pde_va;
+    hypervisor_ept_pde_2mib_t* pdes_2mib = (hypervisor_ept_pde_2mib_t*)pde_va;
 
     uint64_t pte_va = 0;
 
     if(pdes[pde_index].read_access == 0 && pdes[pde_index].write_access == 0 && pdes[pde_index].execute_access == 0) {
         return 0;
     } else {
+        if(pdes_2mib[pde_index].must_one && hypervisor_ept_split_2mib_page(vm, &pdes_2mib[pde_index]) != 0) {
+            return -1;
+        }
+
         uint64_t pte_fa = pdes[pde_index].address;
         pte_fa <<= 12;
         pte_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(pte_fa);
@@ -324,7 +435,8 @@ int8_t hypervisor_ept_dump_mapping(hypervisor_vm_t* vm) {
 
 uint64_t hypervisor_ept_setup(hypervisor_vm_t* vm) {
     uint64_t stack_page_count = vm->guest_stack_size / MEMORY_PAGING_PAGE_LENGTH_4K;
-    uint64_t heap_page_count = vm->guest_heap_size / MEMORY_PAGING_PAGE_LENGTH_4K;
+    // guest ram is rounded to 2m pages, so it is mapped with 2m ept pages
+    uint64_t heap_page_count = MEMORY_PAGING_HUGE_PAGE_FRAME_COUNT(vm->guest_heap_size / MEMORY_PAGING_PAGE_LENGTH_4K);
 
     frame_t* ept_frames = NULL;
     hypervisor_allocate_region(&ept_frames, FRAME_SIZE);
@@ -354,12 +466,9 @@ uint64_t hypervisor_ept_setup(hypervisor_vm_t* vm) {
 
     vm->guest_heap_physical_base = heap_frames->frame_address;
 
-    for(uint64_t i = 0; i < heap_page_count; i++) {
-        uint64_t heap_frame = heap_frames->frame_address + i * FRAME_SIZE;
-        if(hypervisor_ept_add_ept_page(vm, heap_frame, heap_frame, true) != 0) {
-            PRINTLOG(HYPERVISOR, LOG_ERROR, "Failed to add EPT page for heap");
-            return -1;
-        }
+    if(hypervisor_ept_add_ept_region(vm, heap_frames->frame_address, heap_frames->frame_address, heap_page_count * FRAME_SIZE, true) != 0) {
+        PRINTLOG(HYPERVISOR, LOG_ERROR, "Failed to add EPT page for heap");
+        return -1;
     }
 
     PRINTLOG(HYPERVISOR, LOG_TRACE, "heap pages added.");
@@ -371,12 +480,9 @@ uint64_t hypervisor_ept_setup(hypervisor_vm_t* vm) {
 
     vm->guest_stack_physical_base = stack_frames->frame_address;
 
-    for(uint64_t i = 0; i < stack_page_count; i++) {
-        uint64_t stack_frame = stack_frames->frame_address + i * FRAME_SIZE;
-        if(hypervisor_ept_add_ept_page(vm, stack_frame, stack_frame, true) != 0) {
-            PRINTLOG(HYPERVISOR, LOG_ERROR, "Failed to add EPT page for stack");
-            return -1;
-        }
+    if(hypervisor_ept_add_ept_region(vm, stack_frames->frame_address, stack_frames->frame_address, stack_page_count * FRAME_SIZE, true) != 0) {
+        PRINTLOG(HYPERVISOR, LOG_ERROR, "Failed to add EPT page for stack");
+        return -1;
     }
 
     PRINTLOG(HYPERVISOR, LOG_TRACE, "stack pages added.");
@@ -601,6 +707,29 @@ static int8_t hypervisor_ept_paging_add_page(hypervisor_vm_t* vm,
 
     uint64_t p1_fa = 0;
 
+    if(type & MEMORY_PAGING_PAGE_TYPE_2M) {
+        if(!p2->pages[p2_index].present) {
+            p2->pages[p2_index].present = 1;
+            p2->pages[p2_index].hugepage = 1;
+
+            if(type & MEMORY_PAGING_PAGE_TYPE_READONLY) {
+                p2->pages[p2_index].writable = 0;
+            } else {
+                p2->pages[p2_index].writable = 1;
+            }
+
+            if(type & MEMORY_PAGING_PAGE_TYPE_NOEXEC) {
+                p2->pages[p2_index].no_execute = 1;
+            }
+
+            uint64_t tmp_guest_fa = physical_address >> 12;
+
+            p2->pages[p2_index].physical_address = tmp_guest_fa;
+        }
+
+        return 0;
+    }
+
     if(!p2->pages[p2_index].present) {
         uint64_t guest_new_pt_fa = hypervisor_ept_paging_get_next_page_address(vm);
 
@@ -819,6 +948,11 @@ static uint64_t hypervisor_ept_paging_get_guest_physical(hypervisor_vm_t* vm, ui
 
     if(!p2->pages[p2_index].present) {
         return 0;
+    } else if(p2->pages[p2_index].hugepage) {
+        uint64_t pde_address = p2->pages[p2_index].physical_address;
+        pde_address <<= 12;
+
+        return pde_address | (virtual_address & (MEMORY_PAGING_PAGE_LENGTH_2M - 1));
     } else {
         uint64_t tmp_guest_fa = p2->pages[p2_index].physical_address;
         tmp_guest_fa <<= 12;
@@ -980,10 +1114,18 @@ int8_t hypervisor_ept_build_tables(hypervisor_vm_t* vm) {
     uint64_t heap_v_base = VMX_GUEST_HEAP_BASE_VALUE;
     uint64_t heap_p_base = vm->guest_heap_physical_base;
 
-    for(uint64_t i = 0; i < heap_page_count; i++) {
-        hypervisor_ept_paging_add_page(vm, heap_p_base, heap_v_base, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
-        heap_p_base += MEMORY_PAGING_PAGE_LENGTH_4K;
-        heap_v_base += MEMORY_PAGING_PAGE_LENGTH_4K;
+    for(uint64_t i = 0; i < heap_page_count;) {
+        if(heap_page_count - i >= MEMORY_PAGING_FRAME_COUNT_2M && (heap_p_base % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
+            hypervisor_ept_paging_add_page(vm, heap_p_base, heap_v_base, MEMORY_PAGING_PAGE_TYPE_NOEXEC | MEMORY_PAGING_PAGE_TYPE_2M);
+            heap_p_base += MEMORY_PAGING_PAGE_LENGTH_2M;
+            heap_v_base += MEMORY_PAGING_PAGE_LENGTH_2M;
+            i += MEMORY_PAGING_FRAME_COUNT_2M;
+        } else {
+            hypervisor_ept_paging_add_page(vm, heap_p_base, heap_v_base, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
+            heap_p_base += MEMORY_PAGING_PAGE_LENGTH_4K;
+            heap_v_base += MEMORY_PAGING_PAGE_LENGTH_4K;
+            i++;
+        }
     }
 
     PRINTLOG(HYPERVISOR, LOG_TRACE, "heap pages added to guest page table.");
@@ -1127,13 +1269,10 @@ int8_t hypervisor_ept_merge_module(hypervisor_vm_t* vm, hypervisor_vm_module_loa
     PRINTLOG(HYPERVISOR, LOG_TRACE, "module physical address: 0x%llx, module size: 0x%llx, module page count: 0x%llx",
              module_physical_address, module_size, module_page_count);
 
-    for(uint64_t i = 0; i < module_page_count; i++) {
-        if(hypervisor_ept_add_ept_page(vm, module_physical_address, module_physical_address, true) != 0) {
-            PRINTLOG(HYPERVISOR, LOG_ERROR, "Failed to add new module pages to ept");
-            return -1;
-        }
-
-        module_physical_address += MEMORY_PAGING_PAGE_LENGTH_4K;
+    if(hypervisor_ept_add_ept_region(vm, module_physical_address, module_physical_address,
+                                     module_page_count * MEMORY_PAGING_PAGE_LENGTH_4K, true) != 0) {
+        PRINTLOG(HYPERVISOR, LOG_ERROR, "Failed to add new module pages to ept");
+        return -1;
     }
 
     PRINTLOG(HYPERVISOR, LOG_TRACE, "module pages added to ept.");
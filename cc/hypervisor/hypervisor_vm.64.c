@@ -17,14 +17,24 @@
 #include <memory/paging.h>
 #include <logging.h>
 #include <time.h>
+#include <time/timer.h>
 #include <linker_utils.h>
 
 MODULE("turnstone.hypervisor");
 
 list_t* hypervisor_vm_list = NULL;
 
+time_timer_t hypervisor_vm_notify_timer = {0};
+
 extern volatile uint64_t time_timer_rdtsc_delta;
 
+static void hypervisor_vm_notify_timer_callback(time_timer_t* timer, void* data) {
+    UNUSED(timer);
+    UNUSED(data);
+
+    hypervisor_vm_notify_timers();
+}
+
 int8_t hypervisor_vm_init(void) {
     if (hypervisor_vm_list != NULL) {
         return 0;
@@ -36,6 +46,9 @@ int8_t hypervisor_vm_init(void) {
         return -1;
     }
 
+    // timer ticks only while there are vms, so idle cpus are not woken up
+    time_timer_init(&hypervisor_vm_notify_timer, &hypervisor_vm_notify_timer_callback, NULL);
+
     return 0;
 }
 
@@ -101,6 +114,11 @@ int8_t hypervisor_vm_create_and_attach_to_task(hypervisor_vm_t* vm) {
 
     list_list_insert(hypervisor_vm_list, vm);
 
+    if(list_size(hypervisor_vm_list) == 1 &&
+       time_timer_start(&hypervisor_vm_notify_timer, time_timer_get_tick_count() + 1, 1) != 0) {
+        PRINTLOG(HYPERVISOR, LOG_ERROR, "cannot start vm timer notifier");
+    }
+
     PRINTLOG(HYPERVISOR, LOG_DEBUG, "vmcs frame fa: 0x%llx", vm->vmcs_frame_fa);
     task_set_vmcs_physical_address(vm->vmcs_frame_fa);
     task_set_vm(vm);
@@ -115,6 +133,10 @@ void hypervisor_vm_destroy(hypervisor_vm_t* vm) {
 
     list_list_delete(hypervisor_vm_list, vm);
 
+    if(list_size(hypervisor_vm_list) == 0) {
+        time_timer_cancel(&hypervisor_vm_notify_timer);
+    }
+
     list_destroy(vm->ipc_queue);
     map_destroy(vm->msr_map);
     hashmap_destroy(vm->loaded_module_ids);
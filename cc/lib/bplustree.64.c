@@ -679,6 +679,9 @@ int8_t bplustree_toss_root(index_t* idx) {
 
                 if(root_key != NULL && left_child->childs != NULL) {
                     list_insert_at(left_child->keys, root_key, LIST_INSERT_AT_TAIL, 0);
+                } else if(root_key != NULL && tree->key_cloner && tree->key_destroyer) {
+                    // leaves keep their own clones, separator key is dropped
+                    tree->key_destroyer(idx->heap, (void*)root_key);
                 }
 
                 const void* tmp;
@@ -1275,6 +1278,11 @@ iterator_t* bplustree_search(index_t* idx, const void* key1, const void* key2, c
                             if(c_res == 0) {
                                 iter->end_of_iter = 1;
                                 break;
+                            } else if(c_res < 0 && criteria != INDEXER_KEY_COMPARATOR_CRITERIA_EQUAL &&
+                                      (criteria != INDEXER_KEY_COMPARATOR_CRITERIA_BETWEEN || iter->comparator(key_at_pos, key2) <= 0)) {
+                                // missing lower bound, range starts at next greater key
+                                iter->end_of_iter = 1;
+                                break;
                             } else if(c_res < 0)  {
                                 iter->current_node = NULL;
                                 iter->current_index = 0;
@@ -276,3 +276,37 @@ const void* cache_get(cache_t* cache, const void* key) {
 
     return NULL;
 }
+
+boolean_t cache_delete(cache_t* cache, const void* key) {
+    if(!cache) {
+        return false;
+    }
+
+    boolean_t mru = true;
+    cache_item_t* ci = (cache_item_t*)hashmap_get(cache->mru_map, key);
+
+    if(!ci) {
+        mru = false;
+        ci = (cache_item_t*)hashmap_get(cache->lru_map, key);
+    }
+
+    if(!ci) {
+        return false;
+    }
+
+    cache_delete_item(cache, mru, ci);
+
+    if(mru) {
+        hashmap_delete(cache->mru_map, ci->key);
+        cache->mru_size -= ci->size;
+    } else {
+        hashmap_delete(cache->lru_map, ci->key);
+        cache->lru_size -= ci->size;
+    }
+
+    cache->config.item_key_destroyer(ci->key, ci->item);
+
+    memory_free(ci);
+
+    return true;
+}
@@ -31,6 +31,8 @@ typedef struct list_t {
     list_data_comparator_f equality_comparator; ///< if the list is sorted, this is comparator function for data
     size_t                 item_count; ///< item count at the list, for fast access.
     indexer_t*             indexer; ///< if the list is indexed, this is the indexer
+    list_notifier_f        notifier; ///< called after each insert, used for waking up listeners
+    void*                  notifier_data; ///< notifier's data
 } list_t;
 
 /**
@@ -86,6 +88,17 @@ int8_t list_set_equality_comparator(list_t* list, list_data_comparator_f compara
     return 0;
 }
 
+int8_t list_set_notifier(list_t* list, list_notifier_f notifier, void* notifier_data){
+    if(list == NULL) {
+        return -1;
+    }
+
+    list->notifier_data = notifier_data;
+    list->notifier = notifier;
+
+    return 0;
+}
+
 size_t list_size(const list_t* list){
     if(list == NULL) {
         return 0;
@@ -174,14 +187,21 @@ size_t list_insert_at(list_t* list, const void* data, list_insert_delete_at_t wh
         return -1ULL;
     }
 
+    size_t res = -1ULL;
+
     if(list->type & LIST_TYPE_LINKED) {
-        return linkedlist_insert_at(list, data, where, position);
+        res = linkedlist_insert_at(list, data, where, position);
     } else if(list->type & LIST_TYPE_ARRAY) {
-        return arraylist_insert_at(list, data, where, position);
+        res = arraylist_insert_at(list, data, where, position);
+    } else { // default is linked list
+        res = linkedlist_insert_at(list, data, where, position);
     }
 
-    // default is linked list
-    return linkedlist_insert_at(list, data, where, position);
+    if(res != -1ULL && list->notifier) {
+        list->notifier(list, list->notifier_data);
+    }
+
+    return res;
 }
 
 const void* linkedlist_delete_at(list_t* list, const void* data, list_insert_delete_at_t where, size_t position);
@@ -27,6 +27,8 @@ typedef struct list_t {
     list_data_comparator_f equality_comparator; ///< if the list is sorted, this is comparator function for data
     size_t                 item_count; ///< item count at the list, for fast access.
     indexer_t*             indexer; ///< if the list is indexed, this is the indexer
+    list_notifier_f        notifier; ///< called after each insert, used for waking up listeners
+    void*                  notifier_data; ///< notifier's data
     size_t                 capacity; ///< the capacity of the list
     size_t                 head; ///< the head of the list
     size_t                 tail; ///< the tail of the list
@@ -9,6 +9,7 @@
 #include <network/network_protocols.h>
 #include <network/network_arp.h>
 #include <network/network_ipv4.h>
+#include <network/network_netbuf.h>
 #include <utils.h>
 #include <memory.h>
 #include <logging.h>
@@ -29,13 +30,92 @@ boolean_t network_ethernet_is_mac_address_eq(network_mac_address_t mac1, network
     return true;
 }
 
+static network_transmit_packet_t* network_ethernet_create_transmit_packet(network_mac_address_t dst, network_mac_address_t src, network_ethernet_type_t type, uint16_t data_len, uint8_t* data) {
+    network_transmit_packet_t* transmit_packet = network_netbuf_create_transmit_packet(sizeof(network_ethernet_t) + data_len);
+
+    if(transmit_packet == NULL) {
+        memory_free(data);
+
+        return NULL;
+    }
+
+    network_ethernet_t* eth_packet = (network_ethernet_t*)transmit_packet->packet_data;
+
+    eth_packet->type = BYTE_SWAP16(type);
+
+    memory_memcopy(dst, eth_packet->destination, sizeof(network_mac_address_t));
+    memory_memcopy(src, eth_packet->source, sizeof(network_mac_address_t));
+    memory_memcopy(data, transmit_packet->packet_data + sizeof(network_ethernet_t), data_len);
+
+    memory_free(data);
+
+    return transmit_packet;
+}
+
+network_transmit_packet_t* network_ethernet_prepend_header(network_transmit_packet_t* inner_packet, network_mac_address_t dst, network_mac_address_t src, network_ethernet_type_t type) {
+    if(inner_packet->netbuf == NULL) {
+        network_transmit_packet_t* transmit_packet = network_ethernet_create_transmit_packet(dst, src, type, inner_packet->packet_len, inner_packet->packet_data);
+
+        memory_free(inner_packet); // data deleted by network_ethernet_create_transmit_packet
+
+        return transmit_packet;
+    }
+
+    network_ethernet_t* eth_packet = (network_ethernet_t*)network_netbuf_push(inner_packet->netbuf, sizeof(network_ethernet_t));
+
+    if(eth_packet == NULL) {
+        network_netbuf_put(inner_packet->netbuf);
+
+        return NULL;
+    }
+
+    eth_packet->type = BYTE_SWAP16(type);
+
+    memory_memcopy(dst, eth_packet->destination, sizeof(network_mac_address_t));
+    memory_memcopy(src, eth_packet->source, sizeof(network_mac_address_t));
+
+    return network_netbuf_transmit_packet(inner_packet->netbuf);
+}
+
+void network_ethernet_route_from_netbuf(network_ethernet_route_t* route, const network_netbuf_t* netbuf, const void* network_info) {
+    const network_ethernet_t* eth = (const network_ethernet_t*)netbuf->rx_packet.packet_data;
+
+    route->return_queue = netbuf->rx_packet.return_queue;
+    memory_memcopy(network_info, route->local_mac, sizeof(network_mac_address_t));
+    memory_memcopy(eth->source, route->remote_mac, sizeof(network_mac_address_t));
+}
+
+int8_t network_ethernet_route_transmit(network_ethernet_route_t* route, network_netbuf_t* netbuf, network_ethernet_type_t type) {
+    if(route->return_queue == NULL) {
+        network_netbuf_put(netbuf);
+
+        return -1;
+    }
+
+    network_transmit_packet_t* packet = network_ethernet_prepend_header(network_netbuf_transmit_packet(netbuf), route->remote_mac, route->local_mac, type);
+
+    if(packet == NULL) {
+        return -1;
+    }
+
+    if(list_queue_push(route->return_queue, packet) == -1ULL) {
+        network_transmit_packet_destroyer(NULL, packet);
+
+        return -1;
+    }
+
+    return 0;
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
-list_t* network_ethernet_process_packet(network_ethernet_t* recv_eth_packet, void* network_info) {
-    if(recv_eth_packet == NULL) {
+list_t* network_ethernet_process_packet(network_netbuf_t* netbuf, void* network_info) {
+    if(netbuf == NULL || netbuf->len < sizeof(network_ethernet_t)) {
         return NULL;
     }
 
+    network_ethernet_t* recv_eth_packet = (network_ethernet_t*)netbuf->data;
+
     network_mac_address_t our_mac = {};
     memory_memcopy(network_info, our_mac, sizeof(network_mac_address_t));
 
@@ -51,8 +131,11 @@ list_t* network_ethernet_process_packet(network_ethernet_t* recv_eth_packet, voi
         return NULL;
     }
 
-    uint8_t* data = (uint8_t*)recv_eth_packet;
-    uint8_t* data_inner_packet = (data + sizeof(network_ethernet_t));
+    // replies may reuse the received buffer and overwrite this header, so keep the source
+    network_mac_address_t source_mac = {};
+    memory_memcopy(recv_eth_packet->source, source_mac, sizeof(network_mac_address_t));
+
+    uint8_t* data_inner_packet = network_netbuf_pull(netbuf, sizeof(network_ethernet_t));
 
 
 
@@ -67,36 +150,25 @@ list_t* network_ethernet_process_packet(network_ethernet_t* recv_eth_packet, voi
             return NULL;
         }
 
-        uint8_t* eth_packet = network_ethernet_create_packet(recv_eth_packet->source, our_mac, NETWORK_PROTOCOL_ARP, return_data_len, return_data);
+        network_transmit_packet_t* transmit_packet = network_ethernet_create_transmit_packet(source_mac, our_mac, NETWORK_PROTOCOL_ARP, return_data_len, return_data);
 
-        if(eth_packet == NULL) {
+        if(transmit_packet == NULL) {
             return NULL;
         }
 
         list_t* res = list_create_list();
 
         if(res == NULL) {
-            memory_free(eth_packet);
-            return NULL;
-        }
-
-        network_transmit_packet_t* transmit_packet = memory_malloc(sizeof(network_transmit_packet_t));
-
-        if(transmit_packet == NULL) {
-            memory_free(eth_packet);
-            list_destroy(res);
+            network_transmit_packet_destroyer(NULL, transmit_packet);
             return NULL;
         }
 
-        transmit_packet->packet_data = eth_packet;
-        transmit_packet->packet_len = sizeof(network_ethernet_t) + return_data_len;
-
         list_queue_push(res, transmit_packet);
 
         return res;
     } else if(packet_type == NETWORK_PROTOCOL_IPV4) {
         PRINTLOG(NETWORK, LOG_TRACE, "ipv4 packet received");
-        list_t* ip_pckts = network_ipv4_process_packet((network_ipv4_header_t*)data_inner_packet, network_info);
+        list_t* ip_pckts = network_ipv4_process_packet((network_ipv4_header_t*)data_inner_packet, network_info, netbuf);
 
         if(ip_pckts == NULL) {
             return NULL;
@@ -113,27 +185,13 @@ list_t* network_ethernet_process_packet(network_ethernet_t* recv_eth_packet, voi
             network_transmit_packet_t* ip_pckt = (network_transmit_packet_t*)list_queue_pop(ip_pckts);
 
             if(ip_pckt) {
-                uint8_t* eth_packet = network_ethernet_create_packet(recv_eth_packet->source, our_mac, NETWORK_PROTOCOL_IPV4, ip_pckt->packet_len, ip_pckt->packet_data);
-
-                if(eth_packet == NULL) {
-                    memory_free(ip_pckt); // data deleted by network_ethernet_create_packet
-                    break;
-                }
-
-                network_transmit_packet_t* transmit_packet = memory_malloc(sizeof(network_transmit_packet_t));
+                network_transmit_packet_t* transmit_packet = network_ethernet_prepend_header(ip_pckt, source_mac, our_mac, NETWORK_PROTOCOL_IPV4);
 
                 if(transmit_packet == NULL) {
-                    memory_free(ip_pckt); // data deleted by network_ethernet_create_packet
-                    memory_free(eth_packet);
                     break;
                 }
 
-                transmit_packet->packet_data = eth_packet;
-                transmit_packet->packet_len = sizeof(network_ethernet_t) + ip_pckt->packet_len;
-
                 list_queue_push(res, transmit_packet);
-
-                memory_free(ip_pckt); // data deleted by network_ethernet_create_packet
             }
         }
 
@@ -41,6 +41,38 @@ uint8_t* network_icmpv4_process_packet(network_icmpv4_header_t* recv_icmpv4_pack
     return NULL;
 }
 
+int8_t network_icmpv4_reply_in_place(network_icmpv4_header_t* recv_icmpv4_packet, uint16_t packet_len) {
+    if(packet_len < sizeof(network_icmpv4_header_t) || packet_len & 1) {
+        return -1;
+    }
+
+    if(recv_icmpv4_packet->type != NETWORK_ICMP_ECHO_REQUEST || recv_icmpv4_packet->code != NETWORK_ICMP_ECHO_CODE) {
+        return -1;
+    }
+
+    // echo reply differs only at type, so identifier, sequence and data stay where they are
+    recv_icmpv4_packet->type = NETWORK_ICMP_ECHO_REPLY;
+    recv_icmpv4_packet->checksum = 0;
+
+    uint8_t* data = (uint8_t*)recv_icmpv4_packet;
+    uint16_t* data_16 = (uint16_t*)data;
+
+    uint32_t csum = 0;
+
+    for(uint16_t i = 0; i < packet_len / 2; i++) {
+        csum += data_16[i];
+
+        uint32_t carry = csum >> 16;
+        csum &= 0xFFFF;
+        csum += carry;
+    }
+
+    int16_t res = csum;
+
+    recv_icmpv4_packet->checksum = ~res;
+
+    return 0;
+}
 
 network_icmpv4_ping_header_t* network_create_ping_packet(boolean_t is_reply, uint16_t identifier, uint16_t sequence, uint16_t data_len, uint8_t* data, uint16_t* packet_len) {
     uint16_t plen = 0;
@@ -12,6 +12,7 @@
 #include <network/network_tcpv4.h>
 #include <network/network_info.h>
 #include <network/network_ethernet.h>
+#include <network/network_netbuf.h>
 #include <utils.h>
 #include <memory.h>
 #include <logging.h>
@@ -55,6 +56,7 @@ uint16_t network_ipv4_header_checksum(network_ipv4_header_t* ipv4_hdr);
 int8_t   network_ipv4_header_checksum_verify(network_ipv4_header_t* ipv4_hdr);
 list_t*  network_ipv4_collect_fragments(network_ipv4_header_t* recv_ipv4_packet);
 uint8_t* network_ipv4_get_packet_data(network_ipv4_header_t* recv_ipv4_packet);
+list_t*  network_ipv4_reply_in_place(network_ipv4_header_t* recv_ipv4_packet, const network_ipv4_address_t sip, network_netbuf_t* netbuf);
 
 int8_t network_ipv4_fragment_comparator(const void* f1, const void* f2){
     const network_ipv4_fragment_t* tf1 = f1;
@@ -237,7 +239,7 @@ uint8_t* network_ipv4_get_packet_data(network_ipv4_header_t* recv_ipv4_packet) {
     return packet_data;
 }
 
-list_t* network_ipv4_process_packet(network_ipv4_header_t* recv_ipv4_packet, void* network_info) {
+list_t* network_ipv4_process_packet(network_ipv4_header_t* recv_ipv4_packet, void* network_info, network_netbuf_t* netbuf) {
     if(network_ipv4_packet_fragments == NULL) {
         network_ipv4_packet_fragments = map_integer();
     }
@@ -258,11 +260,16 @@ list_t* network_ipv4_process_packet(network_ipv4_header_t* recv_ipv4_packet, voi
     recv_ipv4_packet->flags_fragment_offset.bits = BYTE_SWAP16(recv_ipv4_packet->flags_fragment_offset.bits);
 
     uint8_t* packet_data = NULL;
+    boolean_t is_fragmented = recv_ipv4_packet->flags_fragment_offset.fields.fragment_offset != 0;
 
     if(recv_ipv4_packet->flags_fragment_offset.fields.flags & NETWORK_IPV4_FLAG_MORE_FRAGMENTS) {
         return network_ipv4_collect_fragments(recv_ipv4_packet);
-    } else {
+    } else if(is_fragmented) {
         packet_data = network_ipv4_get_packet_data(recv_ipv4_packet);
+    } else {
+        // unfragmented payload is used where it is received
+        packet_data = (uint8_t*)recv_ipv4_packet;
+        packet_data += recv_ipv4_packet->header_length * 4;
     }
 
     if(recv_ipv4_packet->protocol == NETWORK_IPV4_PROTOCOL_ICMPV4) {
@@ -270,13 +277,17 @@ list_t* network_ipv4_process_packet(network_ipv4_header_t* recv_ipv4_packet, voi
 
         if(!ni) {
             PRINTLOG(NETWORK, LOG_TRACE, "network info not found for mac address");
-            memory_free(packet_data);
+            if(is_fragmented) {
+                memory_free(packet_data);
+            }
             return NULL;
         }
 
         if(ni && !ni->is_ipv4_address_set) {
             PRINTLOG(NETWORK, LOG_TRACE, "ip address is not set, discarding packet");
-            memory_free(packet_data);
+            if(is_fragmented) {
+                memory_free(packet_data);
+            }
             return NULL;
         }
 
@@ -284,21 +295,33 @@ list_t* network_ipv4_process_packet(network_ipv4_header_t* recv_ipv4_packet, voi
         icmp_data += recv_ipv4_packet->header_length * 4;
         network_icmpv4_header_t* recv_icmp_hdr = (network_icmpv4_header_t*)icmp_data;
 
+        if(netbuf && !is_fragmented) {
+            uint16_t icmp_len = BYTE_SWAP16(recv_ipv4_packet->total_length) - (recv_ipv4_packet->header_length * 4);
+
+            if(network_icmpv4_reply_in_place(recv_icmp_hdr, icmp_len) == 0) {
+                return network_ipv4_reply_in_place(recv_ipv4_packet, ni->ipv4_address, netbuf);
+            }
+        }
+
         uint16_t pp_len = 0;
         uint16_t ping_data_len = BYTE_SWAP16(recv_ipv4_packet->total_length) - ((recv_ipv4_packet->header_length * 4) + sizeof(network_icmpv4_header_t));
 
         network_icmpv4_header_t* resp_icmp_hdr = (network_icmpv4_header_t*)network_icmpv4_process_packet(recv_icmp_hdr, &ping_data_len, &pp_len);
 
-        memory_free(packet_data);
+        if(is_fragmented) {
+            memory_free(packet_data);
+        }
 
         return network_ipv4_create_packet_from_icmp_packet(ni->ipv4_address, recv_ipv4_packet->source_ip, resp_icmp_hdr, pp_len);
 
     } else if(recv_ipv4_packet->protocol == NETWORK_IPV4_PROTOCOL_UDPV4) {
         network_udpv4_header_t* recv_udpv4_hdr = (network_udpv4_header_t*)packet_data;
 
-        network_udpv4_header_t* resp_udpv4_hdr = (network_udpv4_header_t*)network_udpv4_process_packet(recv_ipv4_packet->destination_ip, recv_ipv4_packet->source_ip, recv_udpv4_hdr, network_info, NULL);
+        network_udpv4_header_t* resp_udpv4_hdr = (network_udpv4_header_t*)network_udpv4_process_packet(recv_ipv4_packet->destination_ip, recv_ipv4_packet->source_ip, recv_udpv4_hdr, network_info, NULL, netbuf);
 
-        memory_free(packet_data);
+        if(is_fragmented) {
+            memory_free(packet_data);
+        }
 
         list_t* ip_pckts = network_ipv4_create_packet_from_udp_packet(recv_ipv4_packet->destination_ip, recv_ipv4_packet->source_ip, resp_udpv4_hdr);
 
@@ -313,28 +336,66 @@ list_t* network_ipv4_process_packet(network_ipv4_header_t* recv_ipv4_packet, voi
 
         uint16_t data_len = BYTE_SWAP16(recv_ipv4_packet->total_length) - (recv_ipv4_packet->header_length * 4);
 
-        uint16_t pp_len = 0;
+        // tcp sends its segments to nic queue of connection itself
+        network_tcpv4_process_packet(recv_ipv4_packet->destination_ip, recv_ipv4_packet->source_ip, recv_tcpv4_hdr, network_info, data_len, netbuf);
 
-        network_tcpv4_header_t* resp_tcpv4_hdr = (network_tcpv4_header_t*)network_tcpv4_process_packet(recv_ipv4_packet->destination_ip, recv_ipv4_packet->source_ip, recv_tcpv4_hdr, network_info, data_len, &pp_len);
-
-        memory_free(packet_data);
-
-        list_t* ip_pckts = network_ipv4_create_packet_from_tcp_packet(recv_ipv4_packet->destination_ip, recv_ipv4_packet->source_ip, resp_tcpv4_hdr, pp_len);
-
-        if(ip_pckts == NULL) {
-            PRINTLOG(NETWORK, LOG_TRACE, "ipv4 packet response discarded");
-            return NULL;
+        if(is_fragmented) {
+            memory_free(packet_data);
         }
 
-        return ip_pckts;
+        return NULL;
     } else {
-        memory_free(packet_data);
+        if(is_fragmented) {
+            memory_free(packet_data);
+        }
         PRINTLOG(NETWORK, LOG_TRACE, "unimplemented ipv4 protocol 0x%02x", recv_ipv4_packet->protocol);
     }
 
     return NULL;
 }
 
+static network_transmit_packet_t* network_ipv4_create_transmit_packet(uint16_t packet_len) {
+    network_transmit_packet_t* ipv4_pckt = network_netbuf_create_transmit_packet(packet_len);
+
+    if(ipv4_pckt == NULL) {
+        return NULL;
+    }
+
+    // netbufs are reused, header fields not set by callers should be zero
+    memory_memclean(ipv4_pckt->packet_data, sizeof(network_ipv4_header_t));
+
+    return ipv4_pckt;
+}
+
+list_t* network_ipv4_reply_in_place(network_ipv4_header_t* recv_ipv4_packet, const network_ipv4_address_t sip, network_netbuf_t* netbuf) {
+    uint16_t packet_len = BYTE_SWAP16(recv_ipv4_packet->total_length);
+
+    if(netbuf->data != (uint8_t*)recv_ipv4_packet || packet_len > netbuf->len) {
+        return NULL;
+    }
+
+    list_t* ipv4_packets = list_create_list();
+
+    if(ipv4_packets == NULL) {
+        return NULL;
+    }
+
+    recv_ipv4_packet->destination_ip = recv_ipv4_packet->source_ip;
+    recv_ipv4_packet->source_ip = sip;
+    recv_ipv4_packet->ttl = NETWORK_IPV4_TTL;
+    recv_ipv4_packet->flags_fragment_offset.bits = 0;
+    recv_ipv4_packet->header_checksum = 0;
+
+    network_ipv4_header_checksum(recv_ipv4_packet);
+
+    // netbuf starts at ipv4 header, drop ethernet padding after packet
+    netbuf->len = packet_len;
+
+    list_queue_push(ipv4_packets, network_netbuf_transmit_packet(network_netbuf_get(netbuf)));
+
+    return ipv4_packets;
+}
+
 list_t* network_ipv4_create_packet_from_icmp_packet(const network_ipv4_address_t sip, network_ipv4_address_t dip, network_icmpv4_header_t* icmp_hdr, uint16_t icmp_packet_len) {
     if(icmp_hdr == NULL) { // empty packet
         return NULL;
@@ -342,12 +403,16 @@ list_t* network_ipv4_create_packet_from_icmp_packet(const network_ipv4_address_t
 
     uint16_t packet_len = sizeof(network_ipv4_header_t) + icmp_packet_len;
 
-    network_ipv4_header_t* ipv4_packet = memory_malloc(packet_len);
+    network_transmit_packet_t* ipv4_pckt = network_ipv4_create_transmit_packet(packet_len);
+
+    if(ipv4_pckt == NULL) {
+        memory_free(icmp_hdr);
 
-    if(ipv4_packet == NULL) {
         return NULL;
     }
 
+    network_ipv4_header_t* ipv4_packet = (network_ipv4_header_t*)ipv4_pckt->packet_data;
+
     ipv4_packet->version = NETWORK_IPV4_VERSION;
     ipv4_packet->header_length = 5;
     ipv4_packet->total_length = BYTE_SWAP16(packet_len);
@@ -366,21 +431,10 @@ list_t* network_ipv4_create_packet_from_icmp_packet(const network_ipv4_address_t
 
     memory_free(icmp_hdr);
 
-    network_transmit_packet_t* ipv4_pckt = memory_malloc(sizeof(network_transmit_packet_t));
-
-    if(ipv4_pckt == NULL) {
-        memory_free(ipv4_packet);
-        return NULL;
-    }
-
-    ipv4_pckt->packet_data = (uint8_t*)ipv4_packet;
-    ipv4_pckt->packet_len = packet_len;
-
     list_t* ipv4_packets = list_create_list();
 
     if(ipv4_packets == NULL) {
-        memory_free(ipv4_packet);
-        memory_free(ipv4_pckt);
+        network_transmit_packet_destroyer(NULL, ipv4_pckt);
         return NULL;
     }
 
@@ -423,12 +477,17 @@ list_t* network_ipv4_create_packet_from_udp_packet(const network_ipv4_address_t
     while(packet_len > max_packet_len) {
         packet_len -= max_packet_len;
 
-        network_ipv4_header_t* ipv4_packet = memory_malloc(max_packet_len + sizeof(network_ipv4_header_t));
+        network_transmit_packet_t* ipv4_pckt = network_ipv4_create_transmit_packet(max_packet_len + sizeof(network_ipv4_header_t));
+
+        if(ipv4_pckt == NULL) {
+            memory_free(udp_hdr);
+            list_destroy_with_type(fragments, LIST_DESTROY_WITH_DATA, network_transmit_packet_destroyer);
 
-        if(ipv4_packet == NULL) {
             return NULL;
         }
 
+        network_ipv4_header_t* ipv4_packet = (network_ipv4_header_t*)ipv4_pckt->packet_data;
+
         ipv4_packet->version = NETWORK_IPV4_VERSION;
         ipv4_packet->header_length = 5;
         ipv4_packet->total_length = BYTE_SWAP16(max_packet_len + sizeof(network_ipv4_header_t));
@@ -464,27 +523,21 @@ list_t* network_ipv4_create_packet_from_udp_packet(const network_ipv4_address_t
         raw_udp_hdr += max_packet_len;
         offset += max_packet_len;
 
-        network_transmit_packet_t* ipv4_pckt = memory_malloc(sizeof(network_transmit_packet_t));
-
-        if(ipv4_pckt == NULL) {
-            memory_free(ipv4_packet);
-            list_destroy_with_type(fragments, LIST_DESTROY_WITH_DATA, network_transmit_packet_destroyer);
-            return NULL;
-        }
-
-        ipv4_pckt->packet_data = (uint8_t*)ipv4_packet;
-        ipv4_pckt->packet_len = max_packet_len + sizeof(network_ipv4_header_t);
-
         list_queue_push(fragments, ipv4_pckt);
     }
 
 
-    network_ipv4_header_t* ipv4_packet = memory_malloc(packet_len + sizeof(network_ipv4_header_t));
+    network_transmit_packet_t* ipv4_pckt = network_ipv4_create_transmit_packet(packet_len + sizeof(network_ipv4_header_t));
+
+    if(ipv4_pckt == NULL) {
+        memory_free(udp_hdr);
+        list_destroy_with_type(fragments, LIST_DESTROY_WITH_DATA, network_transmit_packet_destroyer);
 
-    if(ipv4_packet == NULL) {
         return NULL;
     }
 
+    network_ipv4_header_t* ipv4_packet = (network_ipv4_header_t*)ipv4_pckt->packet_data;
+
     ipv4_packet->version = NETWORK_IPV4_VERSION;
     ipv4_packet->header_length = 5;
     ipv4_packet->total_length = BYTE_SWAP16(packet_len + sizeof(network_ipv4_header_t));
@@ -519,123 +572,27 @@ list_t* network_ipv4_create_packet_from_udp_packet(const network_ipv4_address_t
 
     memory_free(udp_hdr);
 
-    network_transmit_packet_t* ipv4_pckt = memory_malloc(sizeof(network_transmit_packet_t));
-
-    if(ipv4_pckt == NULL) {
-        memory_free(ipv4_packet);
-        list_destroy_with_type(fragments, LIST_DESTROY_WITH_DATA, network_transmit_packet_destroyer);
-        return NULL;
-    }
-
-    ipv4_pckt->packet_data = (uint8_t*)ipv4_packet;
-    ipv4_pckt->packet_len = packet_len + sizeof(network_ipv4_header_t);
-
     list_queue_push(fragments, ipv4_pckt);
 
     return fragments;
 }
 
-list_t* network_ipv4_create_packet_from_tcp_packet(const network_ipv4_address_t sip, network_ipv4_address_t dip, network_tcpv4_header_t* tcp_hdr, uint16_t packet_len) {
-    if(tcp_hdr == NULL) {
-        return NULL;
-    }
-
-    list_t* fragments = list_create_list();
-
-    if(fragments == NULL) {
-        memory_free(tcp_hdr);
-
-        return NULL;
-    }
-
-    uint8_t* raw_tcp_hdr = (uint8_t*)tcp_hdr;
-
-    uint16_t max_packet_len = 1500 - sizeof(network_ipv4_header_t);
-
-    if(max_packet_len % 8) {
-        max_packet_len -= max_packet_len % 8;
-    }
-
-    uint16_t identification = 0;
-
-    if(packet_len > max_packet_len) {
-        identification = rand();
-    }
-
-    uint16_t offset = 0;
-
-    while(packet_len > max_packet_len) {
-        packet_len -= max_packet_len;
-
-        network_ipv4_header_t* ipv4_packet = memory_malloc(max_packet_len + sizeof(network_ipv4_header_t));
-
-        if(ipv4_packet == NULL) {
-            return NULL;
-        }
-
-        ipv4_packet->version = NETWORK_IPV4_VERSION;
-        ipv4_packet->header_length = 5;
-        ipv4_packet->total_length = BYTE_SWAP16(max_packet_len + sizeof(network_ipv4_header_t));
-        ipv4_packet->ttl = NETWORK_IPV4_TTL;
-        ipv4_packet->protocol = NETWORK_IPV4_PROTOCOL_TCPV4;
-        ipv4_packet->identification = BYTE_SWAP16(identification);
-        ipv4_packet->flags_fragment_offset.fields.fragment_offset = offset >> 3;
-        ipv4_packet->flags_fragment_offset.fields.flags = NETWORK_IPV4_FLAG_MORE_FRAGMENTS;
-        ipv4_packet->flags_fragment_offset.bits = BYTE_SWAP16(ipv4_packet->flags_fragment_offset.bits);
-
-        ipv4_packet->source_ip = sip;
-        ipv4_packet->destination_ip = dip;
-
-        network_ipv4_header_checksum(ipv4_packet);
-
-        uint32_t hcsum = tcp_hdr->checksum + sip.as_words[0] + sip.as_words[1] + dip.as_words[0] + dip.as_words[1];
-
-        while(hcsum >> 16) {
-            uint32_t carry = hcsum >> 16;
-            hcsum &= 0xFFFF;
-            hcsum += carry;
-        }
-
-        int16_t csum = hcsum;
-
-        tcp_hdr->checksum = ~csum;
-
-        uint8_t* buf = (uint8_t*)ipv4_packet;
-        buf += ipv4_packet->header_length * 4;
-
-        memory_memcopy(raw_tcp_hdr, buf, max_packet_len);
-
-        raw_tcp_hdr += max_packet_len;
-        offset += max_packet_len;
-
-        network_transmit_packet_t* ipv4_pckt = memory_malloc(sizeof(network_transmit_packet_t));
-
-        if(ipv4_pckt == NULL) {
-            memory_free(ipv4_packet);
-            list_destroy_with_type(fragments, LIST_DESTROY_WITH_DATA, network_transmit_packet_destroyer);
-            return NULL;
-        }
-
-        ipv4_pckt->packet_data = (uint8_t*)ipv4_packet;
-        ipv4_pckt->packet_len = max_packet_len + sizeof(network_ipv4_header_t);
-
-        list_queue_push(fragments, ipv4_pckt);
-    }
-
-
-    network_ipv4_header_t* ipv4_packet = memory_malloc(packet_len + sizeof(network_ipv4_header_t));
+network_ipv4_header_t* network_ipv4_prepend_header(network_netbuf_t* netbuf, const network_ipv4_address_t sip, network_ipv4_address_t dip, uint8_t protocol) {
+    network_ipv4_header_t* ipv4_packet = (network_ipv4_header_t*)network_netbuf_push(netbuf, sizeof(network_ipv4_header_t));
 
     if(ipv4_packet == NULL) {
         return NULL;
     }
 
+    // netbufs are reused, header fields not set here should be zero
+    memory_memclean(ipv4_packet, sizeof(network_ipv4_header_t));
+
     ipv4_packet->version = NETWORK_IPV4_VERSION;
     ipv4_packet->header_length = 5;
-    ipv4_packet->total_length = BYTE_SWAP16(packet_len + sizeof(network_ipv4_header_t));
+    ipv4_packet->total_length = BYTE_SWAP16(netbuf->len);
     ipv4_packet->ttl = NETWORK_IPV4_TTL;
-    ipv4_packet->protocol = NETWORK_IPV4_PROTOCOL_TCPV4;
-    ipv4_packet->identification = BYTE_SWAP16(identification);
-    ipv4_packet->flags_fragment_offset.fields.fragment_offset = offset >> 3;
+    ipv4_packet->protocol = protocol;
+    ipv4_packet->flags_fragment_offset.fields.flags = NETWORK_IPV4_FLAG_DONT_FRAGMENT;
     ipv4_packet->flags_fragment_offset.bits = BYTE_SWAP16(ipv4_packet->flags_fragment_offset.bits);
 
     ipv4_packet->source_ip = sip;
@@ -643,38 +600,6 @@ list_t* network_ipv4_create_packet_from_tcp_packet(const network_ipv4_address_t
 
     network_ipv4_header_checksum(ipv4_packet);
 
-    uint32_t hcsum = tcp_hdr->checksum + sip.as_words[0] + sip.as_words[1] + dip.as_words[0] + dip.as_words[1];
-
-    while(hcsum >> 16) {
-        uint32_t carry = hcsum >> 16;
-        hcsum &= 0xFFFF;
-        hcsum += carry;
-    }
-
-    int16_t csum = hcsum;
-
-    tcp_hdr->checksum = ~csum;
-
-    uint8_t* buf = (uint8_t*)ipv4_packet;
-    buf += ipv4_packet->header_length * 4;
-
-    memory_memcopy(raw_tcp_hdr, buf, packet_len);
-
-    memory_free(tcp_hdr);
-
-    network_transmit_packet_t* ipv4_pckt = memory_malloc(sizeof(network_transmit_packet_t));
-
-    if(ipv4_pckt == NULL) {
-        memory_free(ipv4_packet);
-        list_destroy_with_type(fragments, LIST_DESTROY_WITH_DATA, network_transmit_packet_destroyer);
-        return NULL;
-    }
-
-    ipv4_pckt->packet_data = (uint8_t*)ipv4_packet;
-    ipv4_pckt->packet_len = packet_len + sizeof(network_ipv4_header_t);
-
-    list_queue_push(fragments, ipv4_pckt);
-
-    return fragments;
+    return ipv4_packet;
 }
 #pragma GCC diagnostic pop
@@ -0,0 +1,198 @@
+/**
+ * @file network_netbuf.64.c
+ * @brief Network packet buffer pool implementation.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <network/network_netbuf.h>
+#include <memory.h>
+#include <memory/frame.h>
+#include <memory/paging.h>
+#include <cpu/sync.h>
+#include <logging.h>
+
+MODULE("turnstone.lib.network");
+
+lock_t*           network_netbuf_pool_lock = NULL;
+network_netbuf_t* network_netbuf_pool_free_list = NULL;
+uint64_t          network_netbuf_pool_free = 0;
+uint64_t          network_netbuf_pool_total = 0;
+
+int8_t network_netbuf_pool_add(uint64_t count) {
+    if(count == 0) {
+        return 0;
+    }
+
+    if(network_netbuf_pool_lock == NULL) {
+        network_netbuf_pool_lock = lock_create();
+
+        if(network_netbuf_pool_lock == NULL) {
+            PRINTLOG(NETWORK, LOG_ERROR, "cannot create netbuf pool lock");
+
+            return -1;
+        }
+    }
+
+    network_netbuf_t* netbufs = memory_malloc(sizeof(network_netbuf_t) * count);
+
+    if(netbufs == NULL) {
+        PRINTLOG(NETWORK, LOG_ERROR, "cannot allocate netbuf descriptors");
+
+        return -1;
+    }
+
+    frame_allocator_t* fa = frame_get_allocator();
+    frame_t* frames = NULL;
+
+    if(fa->allocate_frame_by_count(fa, count, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_RESERVED, &frames, NULL) != 0) {
+        PRINTLOG(NETWORK, LOG_ERROR, "cannot allocate frames for 0x%llx netbufs", count);
+        memory_free(netbufs);
+
+        return -1;
+    }
+
+    frames->frame_attributes |= FRAME_ATTRIBUTE_RESERVED_PAGE_MAPPED;
+
+    uint64_t frame_address = frames->frame_address;
+    uint64_t frame_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(frame_address);
+    memory_paging_add_va_for_frame(frame_va, frames, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
+
+    for(uint64_t i = 0; i < count; i++) {
+        netbufs[i].fa = frame_address + i * NETWORK_NETBUF_SIZE;
+        netbufs[i].head = (uint8_t*)(frame_va + i * NETWORK_NETBUF_SIZE);
+        netbufs[i].next = (i + 1 < count) ? &netbufs[i + 1] : NULL;
+    }
+
+    lock_acquire(network_netbuf_pool_lock);
+
+    netbufs[count - 1].next = network_netbuf_pool_free_list;
+    network_netbuf_pool_free_list = netbufs;
+    network_netbuf_pool_free += count;
+    network_netbuf_pool_total += count;
+
+    lock_release(network_netbuf_pool_lock);
+
+    PRINTLOG(NETWORK, LOG_DEBUG, "netbuf pool has 0x%llx buffers", network_netbuf_pool_total);
+
+    return 0;
+}
+
+uint64_t network_netbuf_pool_free_count(void) {
+    return __atomic_load_n(&network_netbuf_pool_free, __ATOMIC_RELAXED);
+}
+
+network_netbuf_t* network_netbuf_alloc(void) {
+    if(network_netbuf_pool_lock == NULL) {
+        return NULL;
+    }
+
+    lock_acquire(network_netbuf_pool_lock);
+
+    network_netbuf_t* netbuf = network_netbuf_pool_free_list;
+
+    if(netbuf) {
+        network_netbuf_pool_free_list = netbuf->next;
+        network_netbuf_pool_free--;
+    }
+
+    lock_release(network_netbuf_pool_lock);
+
+    if(netbuf == NULL) {
+        PRINTLOG(NETWORK, LOG_TRACE, "netbuf pool exhausted");
+
+        return NULL;
+    }
+
+    netbuf->next = NULL;
+    netbuf->refcount = 1;
+    netbuf->data = netbuf->head + NETWORK_NETBUF_HEADROOM;
+    netbuf->len = 0;
+
+    return netbuf;
+}
+
+network_netbuf_t* network_netbuf_get(network_netbuf_t* netbuf) {
+    __atomic_add_fetch(&netbuf->refcount, 1, __ATOMIC_RELAXED);
+
+    return netbuf;
+}
+
+void network_netbuf_put(network_netbuf_t* netbuf) {
+    if(netbuf == NULL) {
+        return;
+    }
+
+    if(__atomic_sub_fetch(&netbuf->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    lock_acquire(network_netbuf_pool_lock);
+
+    netbuf->next = network_netbuf_pool_free_list;
+    network_netbuf_pool_free_list = netbuf;
+    network_netbuf_pool_free++;
+
+    lock_release(network_netbuf_pool_lock);
+}
+
+uint8_t* network_netbuf_push(network_netbuf_t* netbuf, uint16_t len) {
+    if((uint64_t)(netbuf->data - netbuf->head) < len) {
+        return NULL;
+    }
+
+    netbuf->data -= len;
+    netbuf->len += len;
+
+    return netbuf->data;
+}
+
+uint8_t* network_netbuf_pull(network_netbuf_t* netbuf, uint16_t len) {
+    if(netbuf->len < len) {
+        return NULL;
+    }
+
+    netbuf->data += len;
+    netbuf->len -= len;
+
+    return netbuf->data;
+}
+
+uint8_t* network_netbuf_append(network_netbuf_t* netbuf, uint16_t len) {
+    uint64_t used = (netbuf->data - netbuf->head) + netbuf->len;
+
+    if(used + len > NETWORK_NETBUF_SIZE) {
+        return NULL;
+    }
+
+    uint8_t* tail = netbuf->data + netbuf->len;
+
+    netbuf->len += len;
+
+    return tail;
+}
+
+network_transmit_packet_t* network_netbuf_transmit_packet(network_netbuf_t* netbuf) {
+    netbuf->tx_packet.packet_data = netbuf->data;
+    netbuf->tx_packet.packet_len = netbuf->len;
+    netbuf->tx_packet.netbuf = netbuf;
+
+    return &netbuf->tx_packet;
+}
+
+network_transmit_packet_t* network_netbuf_create_transmit_packet(uint16_t len) {
+    network_netbuf_t* netbuf = network_netbuf_alloc();
+
+    if(netbuf == NULL) {
+        return NULL;
+    }
+
+    if(network_netbuf_append(netbuf, len) == NULL) {
+        network_netbuf_put(netbuf);
+
+        return NULL;
+    }
+
+    return network_netbuf_transmit_packet(netbuf);
+}
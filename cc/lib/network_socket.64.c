@@ -0,0 +1,650 @@
+/**
+ * @file network_socket.64.c
+ * @brief kernel socket implementation over tcp and udp with readiness polling
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <network/network_socket.h>
+#include <network/network_ipv4.h>
+#include <network/network_udpv4.h>
+#include <network/network_ethernet.h>
+#include <memory.h>
+#include <logging.h>
+#include <hashmap.h>
+#include <list.h>
+#include <utils.h>
+#include <cpu/sync.h>
+#include <cpu/task.h>
+#include <time/timer.h>
+
+MODULE("turnstone.lib.network");
+
+struct network_socket_poller_t {
+    list_t*  ready; ///< sockets notified since last wait, it is a message queue of owner task
+    list_t*  sockets; ///< member sockets
+    uint64_t task_id; ///< owner task
+};
+
+typedef struct network_socket_datagram_t {
+    network_ipv4_address_t ip;
+    uint16_t               port;
+    uint16_t               len;
+    uint8_t                data[];
+} network_socket_datagram_t;
+
+struct network_socket_t {
+    network_socket_type_t       type;
+    lock_t*                     lock; ///< guards poller and waiter links and udp peers
+    boolean_t                   nonblocking;
+    network_ipv4_address_t      local_ip;
+    uint16_t                    local_port;
+    network_tcpv4_connection_t* connection; ///< tcp connection
+    network_tcpv4_listener_t*   listener; ///< tcp listener
+    list_t*                     queue; ///< accept queue of listener or datagram queue of udp
+    hashmap_t*                  peers; ///< udp peer ip to route learned from its datagrams
+    network_socket_poller_t*    poller; ///< poller which socket is added
+    uint32_t                    interest; ///< interested events at poller
+    void*                       user_data; ///< poller user data
+    boolean_t                   queued; ///< socket is at ready list of poller
+    list_t*                     waiters; ///< wake lists of tasks blocked at socket
+};
+
+// called by rx task when readiness may be changed, it only queues wake ups
+static void network_socket_notify(void* data) {
+    network_socket_t* socket = data;
+
+    lock_acquire(socket->lock);
+
+    if(socket->poller && !socket->queued) {
+        socket->queued = true;
+        list_queue_push(socket->poller->ready, socket);
+    }
+
+    for(size_t i = 0; i < list_size(socket->waiters); i++) {
+        list_t* waiter = (list_t*)list_get_data_at_position(socket->waiters, i);
+
+        if(list_size(waiter) == 0) {
+            list_queue_push(waiter, socket);
+        }
+    }
+
+    lock_release(socket->lock);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+static network_socket_t* network_socket_create(network_socket_type_t type, network_ipv4_address_t ip, uint16_t port) {
+    network_socket_t* socket = memory_malloc(sizeof(network_socket_t));
+
+    if(socket == NULL) {
+        return NULL;
+    }
+
+    socket->lock = lock_create();
+    socket->waiters = list_create_list();
+
+    if(socket->lock == NULL || socket->waiters == NULL) {
+        if(socket->lock) {
+            lock_destroy(socket->lock);
+        }
+
+        list_destroy(socket->waiters);
+        memory_free(socket);
+
+        return NULL;
+    }
+
+    socket->type = type;
+    socket->local_ip = ip;
+    socket->local_port = port;
+
+    return socket;
+}
+#pragma GCC diagnostic pop
+
+static void network_socket_free(network_socket_t* socket) {
+    list_destroy(socket->waiters);
+    lock_destroy(socket->lock);
+    memory_free(socket);
+}
+
+uint32_t network_socket_poll(network_socket_t* socket) {
+    if(socket == NULL) {
+        return NETWORK_SOCKET_EVENT_HANGUP;
+    }
+
+    switch(socket->type) {
+    case NETWORK_SOCKET_TYPE_TCP:
+        return network_tcpv4_connection_poll(socket->connection);
+    case NETWORK_SOCKET_TYPE_TCP_LISTENER:
+        return list_size(socket->queue) ? NETWORK_SOCKET_EVENT_READABLE : 0;
+    case NETWORK_SOCKET_TYPE_UDP:
+        return NETWORK_SOCKET_EVENT_WRITABLE | (list_size(socket->queue) ? NETWORK_SOCKET_EVENT_READABLE : 0);
+    default:
+        break;
+    }
+
+    return NETWORK_SOCKET_EVENT_HANGUP;
+}
+
+/**
+ * blocks current task until socket has one of events or hangs up. task waits for messages at a private
+ * wake list, so a notification arriving between readiness check and sleep is not lost.
+ */
+static void network_socket_wait(network_socket_t* socket, uint32_t events) {
+    list_t* waiter = list_create_list();
+
+    if(waiter == NULL) {
+        task_yield();
+
+        return;
+    }
+
+    task_add_message_queue(waiter);
+
+    lock_acquire(socket->lock);
+    list_list_insert(socket->waiters, waiter);
+    lock_release(socket->lock);
+
+    while(!(network_socket_poll(socket) & (events | NETWORK_SOCKET_EVENT_HANGUP))) {
+        task_set_message_waiting();
+        task_yield();
+
+        while(list_size(waiter)) {
+            list_queue_pop(waiter);
+        }
+    }
+
+    lock_acquire(socket->lock);
+
+    size_t position = 0;
+
+    if(list_get_position(socket->waiters, waiter, &position) == 0) {
+        list_delete_at_position(socket->waiters, position);
+    }
+
+    lock_release(socket->lock);
+
+    task_remove_message_queue(waiter);
+    list_destroy(waiter);
+}
+
+network_socket_t* network_socket_listen(network_ipv4_address_t ip, uint16_t port) {
+    network_socket_t* socket = network_socket_create(NETWORK_SOCKET_TYPE_TCP_LISTENER, ip, port);
+
+    if(socket == NULL) {
+        return NULL;
+    }
+
+    socket->queue = list_create_queue();
+
+    if(socket->queue == NULL) {
+        network_socket_free(socket);
+
+        return NULL;
+    }
+
+    socket->listener = network_tcpv4_listener_open(ip, port, socket->queue, network_socket_notify, socket);
+
+    if(socket->listener == NULL) {
+        list_destroy(socket->queue);
+        network_socket_free(socket);
+
+        return NULL;
+    }
+
+    return socket;
+}
+
+network_socket_t* network_socket_accept(network_socket_t* listener) {
+    if(listener == NULL || listener->type != NETWORK_SOCKET_TYPE_TCP_LISTENER) {
+        return NULL;
+    }
+
+    network_tcpv4_connection_t* connection = NULL;
+
+    while((connection = (network_tcpv4_connection_t*)list_queue_pop(listener->queue)) == NULL) {
+        if(listener->nonblocking) {
+            return NULL;
+        }
+
+        network_socket_wait(listener, NETWORK_SOCKET_EVENT_READABLE);
+    }
+
+    network_socket_t* socket = network_socket_create(NETWORK_SOCKET_TYPE_TCP, connection->local_ip, connection->local_port);
+
+    if(socket == NULL) {
+        network_tcpv4_connection_release(connection);
+
+        return NULL;
+    }
+
+    socket->connection = connection;
+
+    network_tcpv4_connection_set_event_callback(connection, network_socket_notify, socket);
+
+    return socket;
+}
+
+static void network_socket_udp_receive(void* data, network_ipv4_address_t sip, uint16_t sport, const uint8_t* payload, uint16_t len, const network_ethernet_route_t* route) {
+    network_socket_t* socket = data;
+
+    if(list_size(socket->queue) >= NETWORK_SOCKET_UDP_QUEUE_MAX) {
+        PRINTLOG(NETWORK, LOG_TRACE, "udp port %i queue is full, datagram dropped", socket->local_port);
+
+        return;
+    }
+
+    network_socket_datagram_t* datagram = memory_malloc(sizeof(network_socket_datagram_t) + len);
+
+    if(datagram == NULL) {
+        return;
+    }
+
+    datagram->ip = sip;
+    datagram->port = sport;
+    datagram->len = len;
+    memory_memcopy(payload, datagram->data, len);
+
+    lock_acquire(socket->lock);
+
+    network_ethernet_route_t* peer_route = (network_ethernet_route_t*)hashmap_get(socket->peers, (void*)(uint64_t)sip.as_dword);
+
+    if(peer_route == NULL) {
+        peer_route = memory_malloc(sizeof(network_ethernet_route_t));
+
+        if(peer_route != NULL) {
+            hashmap_put(socket->peers, (void*)(uint64_t)sip.as_dword, peer_route);
+        }
+    }
+
+    if(peer_route != NULL) {
+        *peer_route = *route;
+    }
+
+    lock_release(socket->lock);
+
+    list_queue_push(socket->queue, datagram);
+
+    network_socket_notify(socket);
+}
+
+network_socket_t* network_socket_udp_bind(network_ipv4_address_t ip, uint16_t port) {
+    network_socket_t* socket = network_socket_create(NETWORK_SOCKET_TYPE_UDP, ip, port);
+
+    if(socket == NULL) {
+        return NULL;
+    }
+
+    socket->queue = list_create_queue();
+    socket->peers = hashmap_integer(16);
+
+    if(socket->queue == NULL || socket->peers == NULL ||
+       network_udpv4_bind(ip, port, network_socket_udp_receive, socket) != 0) {
+        list_destroy(socket->queue);
+
+        if(socket->peers) {
+            hashmap_destroy(socket->peers);
+        }
+
+        network_socket_free(socket);
+
+        return NULL;
+    }
+
+    return socket;
+}
+
+int64_t network_socket_send(network_socket_t* socket, const uint8_t* data, uint64_t len) {
+    if(socket == NULL || socket->type != NETWORK_SOCKET_TYPE_TCP || (data == NULL && len)) {
+        return -1;
+    }
+
+    uint64_t sent = 0;
+
+    while(sent < len) {
+        int64_t res = network_tcpv4_connection_send(socket->connection, data + sent, len - sent);
+
+        if(res < 0) {
+            return sent ? (int64_t)sent : -1;
+        }
+
+        sent += res;
+
+        if(sent == len) {
+            break;
+        }
+
+        if(socket->nonblocking) {
+            return sent ? (int64_t)sent : NETWORK_SOCKET_WOULD_BLOCK;
+        }
+
+        network_socket_wait(socket, NETWORK_SOCKET_EVENT_WRITABLE);
+    }
+
+    return sent;
+}
+
+int64_t network_socket_recv(network_socket_t* socket, uint8_t* buf, uint64_t len) {
+    if(socket == NULL || socket->type != NETWORK_SOCKET_TYPE_TCP || buf == NULL) {
+        return -1;
+    }
+
+    if(len == 0) {
+        return 0;
+    }
+
+    while(1) {
+        int64_t res = network_tcpv4_connection_recv(socket->connection, buf, len);
+
+        if(res > 0) {
+            return res;
+        }
+
+        if(res < 0) {
+            // peer closed and buffer is drained
+            return 0;
+        }
+
+        if(socket->nonblocking) {
+            return NETWORK_SOCKET_WOULD_BLOCK;
+        }
+
+        network_socket_wait(socket, NETWORK_SOCKET_EVENT_READABLE);
+    }
+}
+
+int64_t network_socket_sendto(network_socket_t* socket, network_ipv4_address_t ip, uint16_t port, const uint8_t* data, uint64_t len) {
+    if(socket == NULL || socket->type != NETWORK_SOCKET_TYPE_UDP || (data == NULL && len)) {
+        return -1;
+    }
+
+    // a datagram should fit into one ethernet frame as ipv4 sends with dont fragment
+    if(len > 1500 - sizeof(network_ipv4_header_t) - sizeof(network_udpv4_header_t)) {
+        return -1;
+    }
+
+    lock_acquire(socket->lock);
+
+    const network_ethernet_route_t* peer_route = (const network_ethernet_route_t*)hashmap_get(socket->peers, (void*)(uint64_t)ip.as_dword);
+    network_ethernet_route_t route = {0};
+
+    if(peer_route != NULL) {
+        route = *peer_route;
+    }
+
+    lock_release(socket->lock);
+
+    if(peer_route == NULL) {
+        PRINTLOG(NETWORK, LOG_DEBUG, "no route to udp peer %i.%i.%i.%i", ip.as_bytes[0], ip.as_bytes[1], ip.as_bytes[2], ip.as_bytes[3]);
+
+        return -1;
+    }
+
+    if(network_udpv4_send(&route, socket->local_ip, socket->local_port, ip, port, data, len) != 0) {
+        return -1;
+    }
+
+    return len;
+}
+
+int64_t network_socket_recvfrom(network_socket_t* socket, uint8_t* buf, uint64_t len, network_ipv4_address_t* ip, uint16_t* port) {
+    if(socket == NULL || socket->type != NETWORK_SOCKET_TYPE_UDP || (buf == NULL && len)) {
+        return -1;
+    }
+
+    network_socket_datagram_t* datagram = NULL;
+
+    while((datagram = (network_socket_datagram_t*)list_queue_pop(socket->queue)) == NULL) {
+        if(socket->nonblocking) {
+            return NETWORK_SOCKET_WOULD_BLOCK;
+        }
+
+        network_socket_wait(socket, NETWORK_SOCKET_EVENT_READABLE);
+    }
+
+    uint64_t read = MIN(len, (uint64_t)datagram->len);
+
+    memory_memcopy(datagram->data, buf, read);
+
+    if(ip) {
+        *ip = datagram->ip;
+    }
+
+    if(port) {
+        *port = datagram->port;
+    }
+
+    memory_free(datagram);
+
+    return read;
+}
+
+static void network_socket_peer_route_destroyer(const memory_heap_t* heap, const void* item) {
+    UNUSED(heap);
+
+    memory_free((void*)item);
+}
+
+void network_socket_close(network_socket_t* socket) {
+    if(socket == NULL) {
+        return;
+    }
+
+    if(socket->poller) {
+        network_socket_poller_del(socket->poller, socket);
+    }
+
+    // after hooks are unregistered no notification refers socket
+    if(socket->type == NETWORK_SOCKET_TYPE_TCP) {
+        network_tcpv4_connection_release(socket->connection);
+    } else if(socket->type == NETWORK_SOCKET_TYPE_TCP_LISTENER) {
+        network_tcpv4_listener_close(socket->listener);
+        list_destroy(socket->queue);
+    } else if(socket->type == NETWORK_SOCKET_TYPE_UDP) {
+        network_udpv4_unbind(socket->local_ip, socket->local_port);
+        list_destroy_with_data(socket->queue);
+        hashmap_destroy_with_item_destroyer(socket->peers, network_socket_peer_route_destroyer);
+    }
+
+    network_socket_free(socket);
+}
+
+int8_t network_socket_set_nonblocking(network_socket_t* socket, boolean_t nonblocking) {
+    if(socket == NULL) {
+        return -1;
+    }
+
+    socket->nonblocking = nonblocking;
+
+    return 0;
+}
+
+int8_t network_socket_set_tcp_option(network_socket_t* socket, network_tcpv4_option_t option, boolean_t enable) {
+    if(socket == NULL || socket->type != NETWORK_SOCKET_TYPE_TCP) {
+        return -1;
+    }
+
+    network_tcpv4_connection_set_option(socket->connection, option, enable);
+
+    return 0;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+network_socket_poller_t* network_socket_poller_create(void) {
+    network_socket_poller_t* poller = memory_malloc(sizeof(network_socket_poller_t));
+
+    if(poller == NULL) {
+        return NULL;
+    }
+
+    poller->ready = list_create_queue();
+    poller->sockets = list_create_list();
+
+    if(poller->ready == NULL || poller->sockets == NULL) {
+        list_destroy(poller->ready);
+        list_destroy(poller->sockets);
+        memory_free(poller);
+
+        return NULL;
+    }
+
+    poller->task_id = task_get_id();
+
+    // pushes to ready list wake owner, even if they arrive before it sleeps
+    task_add_message_queue(poller->ready);
+
+    return poller;
+}
+#pragma GCC diagnostic pop
+
+void network_socket_poller_destroy(network_socket_poller_t* poller) {
+    if(poller == NULL) {
+        return;
+    }
+
+    while(list_size(poller->sockets)) {
+        network_socket_t* socket = (network_socket_t*)list_get_data_at_position(poller->sockets, 0);
+
+        network_socket_poller_del(poller, socket);
+    }
+
+    task_remove_message_queue(poller->ready);
+
+    list_destroy(poller->ready);
+    list_destroy(poller->sockets);
+    memory_free(poller);
+}
+
+int8_t network_socket_poller_add(network_socket_poller_t* poller, network_socket_t* socket, uint32_t events, void* user_data) {
+    if(poller == NULL || socket == NULL) {
+        return -1;
+    }
+
+    lock_acquire(socket->lock);
+
+    if(socket->poller != NULL) {
+        lock_release(socket->lock);
+
+        return -1;
+    }
+
+    socket->poller = poller;
+    socket->interest = events;
+    socket->user_data = user_data;
+
+    // current readiness is checked at next wait
+    socket->queued = true;
+    list_queue_push(poller->ready, socket);
+
+    lock_release(socket->lock);
+
+    list_list_insert(poller->sockets, socket);
+
+    return 0;
+}
+
+int8_t network_socket_poller_del(network_socket_poller_t* poller, network_socket_t* socket) {
+    if(poller == NULL || socket == NULL) {
+        return -1;
+    }
+
+    lock_acquire(socket->lock);
+
+    if(socket->poller != poller) {
+        lock_release(socket->lock);
+
+        return -1;
+    }
+
+    socket->poller = NULL;
+
+    size_t position = 0;
+
+    if(socket->queued && list_get_position(poller->ready, socket, &position) == 0) {
+        list_delete_at_position(poller->ready, position);
+    }
+
+    socket->queued = false;
+
+    lock_release(socket->lock);
+
+    if(list_get_position(poller->sockets, socket, &position) == 0) {
+        list_delete_at_position(poller->sockets, position);
+    }
+
+    return 0;
+}
+
+static void network_socket_poller_timer_callback(time_timer_t* timer, void* data) {
+    UNUSED(timer);
+
+    task_set_message_received((uint64_t)data);
+}
+
+int64_t network_socket_poller_wait(network_socket_poller_t* poller, network_socket_poll_result_t* results, uint64_t max_results, uint64_t timeout_ms) {
+    if(poller == NULL || results == NULL || max_results == 0) {
+        return -1;
+    }
+
+    uint64_t deadline = 0;
+
+    if(timeout_ms && timeout_ms != NETWORK_SOCKET_WAIT_FOREVER) {
+        deadline = time_timer_get_tick_count() + timeout_ms;
+    }
+
+    time_timer_t timer = {0};
+    boolean_t timer_armed = false;
+    int64_t count = 0;
+
+    while(1) {
+        while((uint64_t)count < max_results && list_size(poller->ready)) {
+            network_socket_t* socket = (network_socket_t*)list_queue_pop(poller->ready);
+
+            if(socket == NULL) {
+                break;
+            }
+
+            lock_acquire(socket->lock);
+            socket->queued = false;
+            lock_release(socket->lock);
+
+            uint32_t events = network_socket_poll(socket) & (socket->interest | NETWORK_SOCKET_EVENT_HANGUP);
+
+            if(events) {
+                results[count].socket = socket;
+                results[count].events = events;
+                results[count].user_data = socket->user_data;
+                count++;
+            }
+        }
+
+        if(count || timeout_ms == 0) {
+            break;
+        }
+
+        if(deadline) {
+            if(time_timer_get_tick_count() >= deadline) {
+                break;
+            }
+
+            if(!timer_armed) {
+                time_timer_init(&timer, network_socket_poller_timer_callback, (void*)poller->task_id);
+                time_timer_start(&timer, deadline, 0);
+                timer_armed = true;
+            }
+        }
+
+        task_set_message_waiting();
+        task_yield();
+    }
+
+    if(timer_armed) {
+        time_timer_cancel(&timer);
+    }
+
+    return count;
+}
@@ -8,6 +8,8 @@
 
 #include <network/network_tcpv4.h>
 #include <network/network_ipv4.h>
+#include <network/network_ethernet.h>
+#include <network/network_netbuf.h>
 #include <utils.h>
 #include <memory.h>
 #include <logging.h>
@@ -16,10 +18,27 @@
 #include <hashmap.h>
 #include <random.h>
 #include <strings.h>
+#include <cpu/sync.h>
+#include <cpu/task.h>
+#include <time/timer.h>
 
 MODULE("turnstone.lib.network");
 
+#define NETWORK_TCPV4_FLAG_FIN 0x01
+#define NETWORK_TCPV4_FLAG_SYN 0x02
+#define NETWORK_TCPV4_FLAG_RST 0x04
+#define NETWORK_TCPV4_FLAG_PSH 0x08
+#define NETWORK_TCPV4_FLAG_ACK 0x10
+
+// sequence numbers wrap, they are compared by signed distance
+#define NETWORK_TCPV4_SEQ_LT(a, b)  ((int32_t)((a) - (b)) < 0)
+#define NETWORK_TCPV4_SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define NETWORK_TCPV4_SEQ_GT(a, b)  ((int32_t)((a) - (b)) > 0)
+#define NETWORK_TCPV4_SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+
 hashmap_t* network_tcpv4_listener_ip_map = NULL;
+lock_t*    network_tcpv4_listener_lock = NULL;
+list_t*    network_tcpv4_shard_connections[NETWORK_RX_QUEUE_MAX] = {0}; ///< connections of each rx queue for timers
 
 network_tcpv4_listener_t*   network_tcpv4_listener_get(network_ipv4_address_t ip, uint16_t port);
 void                        network_tcpv4_listener_add(network_ipv4_address_t ip, uint16_t port);
@@ -27,54 +46,95 @@ network_tcpv4_connection_t* network_tcpv4_connection_get(network_ipv4_address_t
 void                        network_tcpv4_connection_add(network_tcpv4_connection_t* connection);
 void                        network_tcpv4_connection_del(network_tcpv4_connection_t* connection);
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
-network_tcpv4_listener_t* network_tcpv4_listener_get(network_ipv4_address_t ip, uint16_t port) {
+int8_t network_tcpv4_init(void) {
+    if(network_tcpv4_listener_ip_map != NULL) {
+        return 0;
+    }
+
+    network_tcpv4_listener_lock = lock_create();
+
+    if(network_tcpv4_listener_lock == NULL) {
+        return -1;
+    }
+
+    network_tcpv4_listener_ip_map = hashmap_integer(128);
+
     if(network_tcpv4_listener_ip_map == NULL) {
-        network_tcpv4_listener_ip_map = hashmap_integer(128);
+        lock_destroy(network_tcpv4_listener_lock);
+        network_tcpv4_listener_lock = NULL;
+
+        return -1;
     }
 
+    for(uint64_t i = 0; i < NETWORK_RX_QUEUE_MAX; i++) {
+        network_tcpv4_shard_connections[i] = list_create_list();
+
+        if(network_tcpv4_shard_connections[i] == NULL) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+static network_tcpv4_listener_t* network_tcpv4_listener_create(network_ipv4_address_t ip, uint16_t port) {
     uint64_t key = ((uint64_t)ip.as_dword << 16) | port;
 
+    // rx queue tasks may create same listener at same time
+    lock_acquire(network_tcpv4_listener_lock);
+
     network_tcpv4_listener_t* listener = (network_tcpv4_listener_t*)hashmap_get(network_tcpv4_listener_ip_map, (void*)key);
 
-    if(listener == NULL && (port == 7 || port == 80)) { // create dummy listener for echo and http service
+    if(listener == NULL) {
         listener = memory_malloc(sizeof(network_tcpv4_listener_t));
 
-        if(listener == NULL) {
-            return NULL;
-        }
-
-        listener->local_ip = ip;
-        listener->local_port = port;
-        listener->connections = hashmap_integer(128);
+        if(listener != NULL) {
+            listener->local_ip = ip;
+            listener->local_port = port;
 
-        hashmap_put(network_tcpv4_listener_ip_map, (void*)key, listener);
+            for(uint64_t i = 0; i < NETWORK_RX_QUEUE_MAX; i++) {
+                listener->connections[i] = hashmap_integer(128);
+            }
 
-        return listener;
+            hashmap_put(network_tcpv4_listener_ip_map, (void*)key, listener);
+        }
     }
 
+    lock_release(network_tcpv4_listener_lock);
+
     return listener;
 }
 
-void network_tcpv4_listener_add(network_ipv4_address_t ip, uint16_t port) {
+network_tcpv4_listener_t* network_tcpv4_listener_get(network_ipv4_address_t ip, uint16_t port) {
     if(network_tcpv4_listener_ip_map == NULL) {
-        network_tcpv4_listener_ip_map = hashmap_integer(128);
+        return NULL;
     }
 
     uint64_t key = ((uint64_t)ip.as_dword << 16) | port;
 
-    network_tcpv4_listener_t* listener = memory_malloc(sizeof(network_tcpv4_listener_t));
+    network_tcpv4_listener_t* listener = (network_tcpv4_listener_t*)hashmap_get(network_tcpv4_listener_ip_map, (void*)key);
 
-    if(listener == NULL) {
+    if(listener == NULL && (port == 7 || port == 80)) { // create dummy listener for echo and http service
+        return network_tcpv4_listener_create(ip, port);
+    }
+
+    return listener;
+}
+
+void network_tcpv4_listener_add(network_ipv4_address_t ip, uint16_t port) {
+    if(network_tcpv4_listener_ip_map == NULL) {
         return;
     }
 
-    listener->local_ip = ip;
-    listener->local_port = port;
-    listener->connections = hashmap_integer(128);
+    network_tcpv4_listener_create(ip, port);
+}
+
 
-    hashmap_put(network_tcpv4_listener_ip_map, (void*)key, listener);
+// connections of a listener are sharded by rx queue, rss keeps all packets of a flow at one queue
+static hashmap_t* network_tcpv4_connections_of_current_queue(const network_tcpv4_listener_t* listener) {
+    return listener->connections[network_rx_queue_current() % NETWORK_RX_QUEUE_MAX];
 }
 
 network_tcpv4_connection_t* network_tcpv4_connection_get(network_ipv4_address_t local_ip, uint16_t local_port, network_ipv4_address_t remote_ip, uint16_t remote_port) {
@@ -86,7 +146,7 @@ network_tcpv4_connection_t* network_tcpv4_connection_get(network_ipv4_address_t
 
     uint64_t key = ((uint64_t)remote_ip.as_dword << 16) | remote_port;
 
-    network_tcpv4_connection_t* connection = (network_tcpv4_connection_t*)hashmap_get(listener->connections, (void*)key);
+    network_tcpv4_connection_t* connection = (network_tcpv4_connection_t*)hashmap_get(network_tcpv4_connections_of_current_queue(listener), (void*)key);
 
     return connection;
 }
@@ -100,141 +160,660 @@ void network_tcpv4_connection_add(network_tcpv4_connection_t* connection) {
 
     uint64_t key = ((uint64_t)connection->remote_ip.as_dword << 16) | connection->remote_port;
 
-    hashmap_put(listener->connections, (void*)key, connection);
+    hashmap_put(listener->connections[connection->queue], (void*)key, connection);
+    list_list_insert(network_tcpv4_shard_connections[connection->queue], connection);
+}
+
+static void network_tcpv4_connection_free(network_tcpv4_connection_t* connection) {
+    memory_free(connection->send_buffer.data);
+    memory_free(connection->receive_buffer.data);
+    lock_destroy(connection->lock);
+    memory_free(connection);
 }
 
 void network_tcpv4_connection_del(network_tcpv4_connection_t* connection) {
     network_tcpv4_listener_t* listener = network_tcpv4_listener_get(connection->local_ip, connection->local_port);
 
-    if(listener == NULL) {
+    if(listener != NULL) {
+        uint64_t key = ((uint64_t)connection->remote_ip.as_dword << 16) | connection->remote_port;
+
+        hashmap_delete(listener->connections[connection->queue], (void*)key);
+    }
+
+    size_t position = 0;
+
+    if(list_get_position(network_tcpv4_shard_connections[connection->queue], connection, &position) == 0) {
+        list_delete_at_position(network_tcpv4_shard_connections[connection->queue], position);
+    }
+
+    lock_acquire(connection->lock);
+
+    // owner still holds it, owner frees it at release
+    if(connection->owned) {
+        connection->detached = true;
+        lock_release(connection->lock);
+
         return;
     }
 
-    uint64_t key = ((uint64_t)connection->remote_ip.as_dword << 16) | connection->remote_port;
+    lock_release(connection->lock);
 
-    hashmap_delete(listener->connections, (void*)key);
+    network_tcpv4_connection_free(connection);
+}
 
-    memory_free(connection);
+static inline uint32_t network_tcpv4_ring_len(const network_tcpv4_ring_t* ring) {
+    return ring->tail - ring->head;
+}
+
+static inline uint32_t network_tcpv4_ring_free(const network_tcpv4_ring_t* ring) {
+    return ring->size - network_tcpv4_ring_len(ring);
+}
+
+static void network_tcpv4_ring_peek(const network_tcpv4_ring_t* ring, uint32_t offset, uint8_t* buf, uint32_t len) {
+    uint32_t start = (ring->head + offset) & (ring->size - 1);
+    uint32_t first = MIN(len, ring->size - start);
+
+    memory_memcopy(ring->data + start, buf, first);
+
+    if(len > first) {
+        memory_memcopy(ring->data, buf + first, len - first);
+    }
+}
+
+static uint32_t network_tcpv4_ring_read(network_tcpv4_ring_t* ring, uint8_t* buf, uint32_t len) {
+    len = MIN(len, network_tcpv4_ring_len(ring));
+
+    if(len) {
+        network_tcpv4_ring_peek(ring, 0, buf, len);
+        ring->head += len;
+    }
+
+    return len;
 }
 
-static uint16_t network_tcpv4_generate_checksum(network_tcpv4_header_t* tcpv4_packet, uint16_t packet_len) {
+static uint32_t network_tcpv4_ring_write(network_tcpv4_ring_t* ring, const uint8_t* data, uint32_t len) {
+    len = MIN(len, network_tcpv4_ring_free(ring));
+
+    if(len == 0) {
+        return 0;
+    }
+
+    uint32_t start = ring->tail & (ring->size - 1);
+    uint32_t first = MIN(len, ring->size - start);
+
+    memory_memcopy(data, ring->data + start, first);
+
+    if(len > first) {
+        memory_memcopy(data + first, ring->data, len - first);
+    }
+
+    ring->tail += len;
+
+    return len;
+}
+
+static uint16_t network_tcpv4_checksum(network_ipv4_address_t sip, network_ipv4_address_t dip, const uint8_t* segment, uint16_t segment_len) {
     uint32_t sum = 0;
 
+    // pseudo header
+    sum += sip.as_words[0] + sip.as_words[1] + dip.as_words[0] + dip.as_words[1];
     sum += BYTE_SWAP16(NETWORK_IPV4_PROTOCOL_TCPV4);
-    sum += BYTE_SWAP16(packet_len);
-
-    uint8_t* packet = (uint8_t*)tcpv4_packet;
+    sum += BYTE_SWAP16(segment_len);
 
-    boolean_t single_byte = packet_len & 1;
-    uint16_t tmp_len = packet_len - single_byte;
+    boolean_t single_byte = segment_len & 1;
+    uint16_t tmp_len = segment_len - single_byte;
 
     for(uint16_t i = 0; i < tmp_len; i += 2) {
-        sum += (packet[i + 1] << 8) | packet[i];
+        sum += (segment[i + 1] << 8) | segment[i];
     }
 
     if(single_byte) {
-        sum += packet[packet_len - 1];
+        sum += segment[segment_len - 1];
     }
 
     while(sum >> 16) {
         sum = (sum & 0xFFFF) + (sum >> 16);
     }
 
-    return sum;
+    return ~sum;
 }
 
+/**
+ * builds a segment inside a netbuf and pushes it to nic queue of route, payload is copied from ring
+ * without an intermediate buffer.
+ */
+static int8_t network_tcpv4_send_raw(network_ethernet_route_t*   route,
+                                     network_ipv4_address_t      sip,
+                                     network_ipv4_address_t      dip,
+                                     uint16_t                    source_port,
+                                     uint16_t                    dest_port,
+                                     uint32_t                    seq,
+                                     uint32_t                    ack,
+                                     uint8_t                     flags,
+                                     uint16_t                    window,
+                                     const uint8_t*              options,
+                                     uint8_t                     options_len,
+                                     const network_tcpv4_ring_t* payload,
+                                     uint32_t                    payload_offset,
+                                     uint16_t                    payload_len) {
+    if(route->return_queue == NULL) {
+        return -1;
+    }
+
+    network_netbuf_t* netbuf = network_netbuf_alloc();
 
-static network_tcpv4_header_t* network_tcpv4_create_reset_packet(uint16_t dest_port, uint16_t source_port, uint32_t sequence_number, uint32_t acknowledgement_number) {
-    network_tcpv4_header_t* res = memory_malloc(sizeof(network_tcpv4_header_t));
+    if(netbuf == NULL) {
+        PRINTLOG(NETWORK, LOG_TRACE, "no netbuf for tcp segment");
 
-    if(res == NULL) {
-        return NULL;
+        return -1;
     }
 
-    res->source_port = BYTE_SWAP16(source_port);
-    res->destination_port = BYTE_SWAP16(dest_port);
-    res->sequence_number = BYTE_SWAP32(sequence_number);
-    res->acknowledgement_number = BYTE_SWAP32(acknowledgement_number);
-    res->header_length = 5;
-    res->rst = 1;
-    res->ack = 1;
+    uint16_t header_len = sizeof(network_tcpv4_header_t) + options_len;
+    uint8_t* segment = network_netbuf_append(netbuf, header_len + payload_len);
 
-    res->checksum = network_tcpv4_generate_checksum(res, sizeof(network_tcpv4_header_t));
+    if(segment == NULL) {
+        network_netbuf_put(netbuf);
 
-    return res;
+        return -1;
+    }
+
+    network_tcpv4_header_t* hdr = (network_tcpv4_header_t*)segment;
+
+    memory_memclean(hdr, sizeof(network_tcpv4_header_t));
+
+    hdr->source_port = BYTE_SWAP16(source_port);
+    hdr->destination_port = BYTE_SWAP16(dest_port);
+    hdr->sequence_number = BYTE_SWAP32(seq);
+    hdr->acknowledgement_number = BYTE_SWAP32(ack);
+    hdr->header_length = header_len / 4;
+    hdr->fin = (flags & NETWORK_TCPV4_FLAG_FIN) != 0;
+    hdr->syn = (flags & NETWORK_TCPV4_FLAG_SYN) != 0;
+    hdr->rst = (flags & NETWORK_TCPV4_FLAG_RST) != 0;
+    hdr->psh = (flags & NETWORK_TCPV4_FLAG_PSH) != 0;
+    hdr->ack = (flags & NETWORK_TCPV4_FLAG_ACK) != 0;
+    hdr->window_size = BYTE_SWAP16(window);
+
+    if(options_len) {
+        memory_memcopy(options, segment + sizeof(network_tcpv4_header_t), options_len);
+    }
+
+    if(payload_len) {
+        network_tcpv4_ring_peek(payload, payload_offset, segment + header_len, payload_len);
+    }
+
+    hdr->checksum = network_tcpv4_checksum(sip, dip, segment, header_len + payload_len);
+
+    if(network_ipv4_prepend_header(netbuf, sip, dip, NETWORK_IPV4_PROTOCOL_TCPV4) == NULL) {
+        network_netbuf_put(netbuf);
+
+        return -1;
+    }
+
+    return network_ethernet_route_transmit(route, netbuf, NETWORK_ETHERNET_TYPE_IPV4);
 }
 
-static network_tcpv4_header_t* network_tcpv4_create_syn_ack_packet_from_connection(network_tcpv4_connection_t* connection) {
-    network_tcpv4_header_t* res = memory_malloc(sizeof(network_tcpv4_header_t));
+// window to advertise, rcv_adv follows right edge of it
+static uint16_t network_tcpv4_receive_window(network_tcpv4_connection_t* connection) {
+    uint32_t window = network_tcpv4_ring_free(&connection->receive_buffer) >> connection->rcv_wscale;
 
-    if(res == NULL) {
-        return NULL;
+    window = MIN(window, 0xFFFF);
+
+    uint32_t right_edge = connection->rcv_nxt + (window << connection->rcv_wscale);
+
+    // window should not shrink
+    if(NETWORK_TCPV4_SEQ_GT(right_edge, connection->rcv_adv)) {
+        connection->rcv_adv = right_edge;
     }
 
-    res->source_port = BYTE_SWAP16(connection->local_port);
-    res->destination_port = BYTE_SWAP16(connection->remote_port);
-    res->sequence_number = BYTE_SWAP32(connection->local_sequence_number);
-    res->acknowledgement_number = BYTE_SWAP32(connection->remote_sequence_number);
-    res->window_size = BYTE_SWAP16(connection->window_size);
-    res->header_length = 5;
-    res->syn = 1;
-    res->ack = 1;
+    return window;
+}
 
-    res->checksum = network_tcpv4_generate_checksum(res, sizeof(network_tcpv4_header_t));
+static int8_t network_tcpv4_send_segment(network_tcpv4_connection_t* connection, uint32_t seq, uint8_t flags, uint32_t payload_offset, uint16_t payload_len) {
+    uint16_t window = network_tcpv4_receive_window(connection);
+
+    int8_t res = network_tcpv4_send_raw(&connection->route,
+                                        connection->local_ip, connection->remote_ip,
+                                        connection->local_port, connection->remote_port,
+                                        seq, connection->rcv_nxt, flags | NETWORK_TCPV4_FLAG_ACK, window,
+                                        NULL, 0,
+                                        &connection->send_buffer, payload_offset, payload_len);
+
+    if(res == 0) {
+        // ack is piggybacked
+        connection->ack_deadline = 0;
+        connection->unacked_segments = 0;
+        connection->ack_now = false;
+    }
 
     return res;
 }
 
-static network_tcpv4_header_t* network_tcpv4_create_ack_packet_from_connection(network_tcpv4_connection_t* connection) {
-    network_tcpv4_header_t* res = memory_malloc(sizeof(network_tcpv4_header_t));
+static int8_t network_tcpv4_send_syn_ack(network_tcpv4_connection_t* connection) {
+    uint8_t options[8];
+    uint8_t options_len = 4;
+
+    options[0] = 2; // mss
+    options[1] = 4;
+    options[2] = NETWORK_TCPV4_MSS >> 8;
+    options[3] = NETWORK_TCPV4_MSS & 0xFF;
+
+    if(connection->rcv_wscale) {
+        options[4] = 1; // nop
+        options[5] = 3; // window scale
+        options[6] = 3;
+        options[7] = connection->rcv_wscale;
+        options_len = 8;
+    }
 
-    if(res == NULL) {
-        return NULL;
+    // window of syn segments is never scaled
+    uint16_t window = MIN(network_tcpv4_ring_free(&connection->receive_buffer), 0xFFFF);
+
+    connection->rcv_adv = connection->rcv_nxt + window;
+
+    return network_tcpv4_send_raw(&connection->route,
+                                  connection->local_ip, connection->remote_ip,
+                                  connection->local_port, connection->remote_port,
+                                  connection->iss, connection->rcv_nxt, NETWORK_TCPV4_FLAG_SYN | NETWORK_TCPV4_FLAG_ACK, window,
+                                  options, options_len,
+                                  NULL, 0, 0);
+}
+
+static void network_tcpv4_send_reset(network_tcpv4_connection_t* connection) {
+    network_tcpv4_send_raw(&connection->route,
+                           connection->local_ip, connection->remote_ip,
+                           connection->local_port, connection->remote_port,
+                           connection->snd_nxt, connection->rcv_nxt, NETWORK_TCPV4_FLAG_RST | NETWORK_TCPV4_FLAG_ACK, 0,
+                           NULL, 0,
+                           NULL, 0, 0);
+}
+
+static uint32_t network_tcpv4_unsent(const network_tcpv4_connection_t* connection) {
+    uint32_t buffered = network_tcpv4_ring_len(&connection->send_buffer);
+    uint32_t in_flight = connection->snd_nxt - connection->snd_una;
+
+    return buffered > in_flight ? buffered - in_flight : 0;
+}
+
+static boolean_t network_tcpv4_can_send_data(const network_tcpv4_connection_t* connection) {
+    return connection->state == NETWORK_TCP_CONNECTION_STATE_ESTABLISHED ||
+           connection->state == NETWORK_TCP_CONNECTION_STATE_CLOSE_WAIT;
+}
+
+// after close, queued and rolled back data still leaves until fin is acked
+static boolean_t network_tcpv4_can_output_data(const network_tcpv4_connection_t* connection) {
+    return network_tcpv4_can_send_data(connection) ||
+           connection->state == NETWORK_TCP_CONNECTION_STATE_FIN_WAIT_1 ||
+           connection->state == NETWORK_TCP_CONNECTION_STATE_CLOSING ||
+           connection->state == NETWORK_TCP_CONNECTION_STATE_LAST_ACK;
+}
+
+/**
+ * sends what min(peer window, congestion window) allows, then fin if it is queued and a pending ack
+ * if no segment carried it.
+ */
+static void network_tcpv4_output(network_tcpv4_connection_t* connection, uint64_t now) {
+    if(network_tcpv4_can_output_data(connection)) {
+        while(!connection->fin_sent) {
+            uint32_t unsent = network_tcpv4_unsent(connection);
+
+            if(unsent == 0) {
+                break;
+            }
+
+            uint32_t in_flight = connection->snd_nxt - connection->snd_una;
+            uint32_t window = MIN(connection->snd_wnd, connection->cwnd);
+            uint32_t usable = window > in_flight ? window - in_flight : 0;
+            uint32_t len = MIN(MIN(unsent, (uint32_t)connection->mss), usable);
+
+            if(len == 0) {
+                // peer window is closed, rto timer probes it
+                if(in_flight == 0 && connection->rto_deadline == 0) {
+                    connection->rto_deadline = now + connection->rto;
+                }
+
+                break;
+            }
+
+            // nagle, small segment waits while data is in flight
+            if(len < connection->mss && in_flight && !(connection->options & NETWORK_TCPV4_OPTION_NODELAY)) {
+                break;
+            }
+
+            uint8_t flags = len == unsent ? NETWORK_TCPV4_FLAG_PSH : 0;
+
+            if(network_tcpv4_send_segment(connection, connection->snd_nxt, flags, in_flight, len) != 0) {
+                break;
+            }
+
+            if(!connection->rtt_pending) {
+                connection->rtt_pending = true;
+                connection->rtt_seq = connection->snd_nxt;
+                connection->rtt_start = now;
+            }
+
+            connection->snd_nxt += len;
+
+            if(connection->rto_deadline == 0) {
+                connection->rto_deadline = now + connection->rto;
+            }
+        }
+
+        if(connection->fin_queued && !connection->fin_sent && network_tcpv4_unsent(connection) == 0) {
+            connection->fin_seq = connection->snd_nxt;
+
+            if(network_tcpv4_send_segment(connection, connection->snd_nxt, NETWORK_TCPV4_FLAG_FIN, 0, 0) == 0) {
+                connection->fin_sent = true;
+                connection->snd_nxt++;
+
+                if(connection->rto_deadline == 0) {
+                    connection->rto_deadline = now + connection->rto;
+                }
+
+                if(connection->state == NETWORK_TCP_CONNECTION_STATE_ESTABLISHED) {
+                    connection->state = NETWORK_TCP_CONNECTION_STATE_FIN_WAIT_1;
+                } else if(connection->state == NETWORK_TCP_CONNECTION_STATE_CLOSE_WAIT) {
+                    connection->state = NETWORK_TCP_CONNECTION_STATE_LAST_ACK;
+                }
+            }
+        }
+    }
+
+    if(connection->ack_now) {
+        network_tcpv4_send_segment(connection, connection->snd_nxt, 0, 0, 0);
     }
+}
 
-    res->source_port = BYTE_SWAP16(connection->local_port);
-    res->destination_port = BYTE_SWAP16(connection->remote_port);
-    res->sequence_number = BYTE_SWAP32(connection->local_sequence_number);
-    res->acknowledgement_number = BYTE_SWAP32(connection->remote_sequence_number);
-    res->window_size = BYTE_SWAP16(connection->window_size);
-    res->header_length = 5;
-    res->ack = 1;
+// sends first unacked segment again, timing is dropped by karn's rule
+static void network_tcpv4_retransmit_head(network_tcpv4_connection_t* connection, uint64_t now) {
+    connection->rtt_pending = false;
 
-    res->checksum = network_tcpv4_generate_checksum(res, sizeof(network_tcpv4_header_t));
+    uint32_t len = MIN(network_tcpv4_ring_len(&connection->send_buffer), (uint32_t)connection->mss);
 
-    return res;
+    if(len) {
+        network_tcpv4_send_segment(connection, connection->snd_una, 0, 0, len);
+    } else if(connection->fin_sent) {
+        network_tcpv4_send_segment(connection, connection->fin_seq, NETWORK_TCPV4_FLAG_FIN, 0, 0);
+    }
+
+    connection->rto_deadline = now + connection->rto;
 }
 
-static network_tcpv4_header_t* network_tcpv4_create_psh_ack_packet_from_connection(network_tcpv4_connection_t* connection, uint8_t* data, uint16_t data_len) {
-    network_tcpv4_header_t* res = memory_malloc(sizeof(network_tcpv4_header_t) + data_len);
+static void network_tcpv4_on_rto(network_tcpv4_connection_t* connection, uint64_t now) {
+    connection->rto_deadline = 0;
 
-    if(res == NULL) {
-        return NULL;
+    if(++connection->retransmits > NETWORK_TCPV4_MAX_RETRANSMITS) {
+        PRINTLOG(NETWORK, LOG_DEBUG, "tcp connection to port %i timed out", connection->remote_port);
+
+        network_tcpv4_send_reset(connection);
+        connection->state = NETWORK_TCP_CONNECTION_STATE_CLOSED;
+
+        return;
     }
 
-    res->source_port = BYTE_SWAP16(connection->local_port);
-    res->destination_port = BYTE_SWAP16(connection->remote_port);
-    res->sequence_number = BYTE_SWAP32(connection->local_sequence_number);
-    res->acknowledgement_number = BYTE_SWAP32(connection->remote_sequence_number);
-    res->window_size = BYTE_SWAP16(connection->window_size);
-    res->header_length = 5;
-    res->ack = 1;
-    res->psh = 1;
+    connection->rto = MIN(connection->rto * 2, NETWORK_TCPV4_RTO_MAX);
 
-    uint8_t* t_res = (uint8_t*)res;
-    t_res += sizeof(network_tcpv4_header_t);
+    if(connection->state == NETWORK_TCP_CONNECTION_STATE_SYN_RECEIVED) {
+        network_tcpv4_send_syn_ack(connection);
+        connection->rto_deadline = now + connection->rto;
 
-    memory_memcopy(data, t_res, data_len);
+        return;
+    }
 
-    res->checksum = network_tcpv4_generate_checksum(res, sizeof(network_tcpv4_header_t) + data_len);
+    uint32_t in_flight = connection->snd_nxt - connection->snd_una;
 
-    return res;
+    if(in_flight == 0) {
+        if(network_tcpv4_unsent(connection) && connection->snd_wnd == 0 && network_tcpv4_can_output_data(connection)) {
+            // zero window probe, one byte past the closed window
+            if(network_tcpv4_send_segment(connection, connection->snd_nxt, 0, 0, 1) == 0) {
+                connection->snd_nxt++;
+            }
+
+            connection->rto_deadline = now + connection->rto;
+        } else {
+            network_tcpv4_output(connection, now);
+        }
+
+        return;
+    }
+
+    connection->ssthresh = MAX(in_flight / 2, 2U * connection->mss);
+    connection->cwnd = connection->mss;
+    connection->dupacks = 0;
+    connection->in_recovery = false;
+    connection->rtt_pending = false;
+
+    // go back n, unacked data is sent again as cwnd grows
+    connection->snd_nxt = connection->snd_una;
+    connection->fin_sent = false;
+
+    network_tcpv4_output(connection, now);
+
+    if(connection->rto_deadline == 0) {
+        connection->rto_deadline = now + connection->rto;
+    }
+}
+
+static void network_tcpv4_update_rtt(network_tcpv4_connection_t* connection, uint32_t rtt) {
+    rtt = MAX(rtt, 1U);
+
+    if(connection->srtt == 0) {
+        connection->srtt = rtt;
+        connection->rttvar = rtt / 2;
+    } else {
+        uint32_t delta = connection->srtt > rtt ? connection->srtt - rtt : rtt - connection->srtt;
+
+        connection->rttvar = (3 * connection->rttvar + delta) / 4;
+        connection->srtt = (7 * connection->srtt + rtt) / 8;
+    }
+
+    uint32_t rto = connection->srtt + MAX(1U, 4 * connection->rttvar);
+
+    rto = MAX(rto, NETWORK_TCPV4_RTO_MIN);
+    rto = MIN(rto, NETWORK_TCPV4_RTO_MAX);
+
+    connection->rto = rto;
+}
+
+static void network_tcpv4_process_ack(network_tcpv4_connection_t* connection, uint32_t seq, uint32_t ack, uint32_t window, uint16_t data_len, uint64_t now) {
+    if(NETWORK_TCPV4_SEQ_GT(ack, connection->snd_nxt)) {
+        // acks data not sent yet
+        connection->ack_now = true;
+
+        return;
+    }
+
+    uint32_t in_flight = connection->snd_nxt - connection->snd_una;
+
+    if(NETWORK_TCPV4_SEQ_GT(ack, connection->snd_una)) {
+        uint32_t acked = ack - connection->snd_una;
+
+        connection->send_buffer.head += MIN(acked, network_tcpv4_ring_len(&connection->send_buffer));
+        connection->snd_una = ack;
+        connection->retransmits = 0;
+        connection->dupacks = 0;
+
+        if(connection->rtt_pending && NETWORK_TCPV4_SEQ_GT(ack, connection->rtt_seq)) {
+            network_tcpv4_update_rtt(connection, now - connection->rtt_start);
+            connection->rtt_pending = false;
+        }
+
+        if(connection->in_recovery) {
+            if(NETWORK_TCPV4_SEQ_GEQ(ack, connection->recover)) {
+                // full ack, leave fast recovery
+                connection->cwnd = MIN(connection->ssthresh, (connection->snd_nxt - connection->snd_una) + connection->mss);
+                connection->in_recovery = false;
+            } else {
+                // partial ack, next hole is lost too
+                network_tcpv4_retransmit_head(connection, now);
+                connection->cwnd = connection->cwnd > acked ? connection->cwnd - acked : 0;
+                connection->cwnd += connection->mss;
+            }
+        } else if(connection->cwnd < connection->ssthresh) {
+            connection->cwnd += MIN(acked, (uint32_t)connection->mss);
+        } else {
+            connection->cwnd += MAX((uint32_t)connection->mss * connection->mss / connection->cwnd, 1U);
+        }
+
+        connection->rto_deadline = connection->snd_una == connection->snd_nxt ? 0 : now + connection->rto;
+    } else if(ack == connection->snd_una && data_len == 0 && in_flight && window == connection->snd_wnd) {
+        connection->dupacks++;
+
+        if(connection->dupacks == NETWORK_TCPV4_DUPACK_THRESHOLD && !connection->in_recovery &&
+           NETWORK_TCPV4_SEQ_GEQ(ack, connection->recover)) {
+            connection->ssthresh = MAX(in_flight / 2, 2U * connection->mss);
+            connection->recover = connection->snd_nxt;
+            connection->in_recovery = true;
+
+            network_tcpv4_retransmit_head(connection, now);
+
+            connection->cwnd = connection->ssthresh + NETWORK_TCPV4_DUPACK_THRESHOLD * connection->mss;
+        } else if(connection->in_recovery) {
+            // each dup ack means a segment left the network
+            connection->cwnd += connection->mss;
+        }
+    }
+
+    if(NETWORK_TCPV4_SEQ_LT(connection->snd_wl1, seq) ||
+       (connection->snd_wl1 == seq && NETWORK_TCPV4_SEQ_LEQ(connection->snd_wl2, ack))) {
+        connection->snd_wnd = window;
+        connection->snd_wl1 = seq;
+        connection->snd_wl2 = ack;
+    }
+}
+
+static boolean_t network_tcpv4_is_builtin_service(uint16_t port) {
+    return port == 7 || port == 80;
+}
+
+// echo and http services of dummy listeners
+static void network_tcpv4_builtin_service_run(network_tcpv4_connection_t* connection) {
+    if(connection->local_port == 7) {
+        uint8_t buf[512];
+
+        while(network_tcpv4_ring_len(&connection->receive_buffer) && network_tcpv4_ring_free(&connection->send_buffer)) {
+            uint32_t len = MIN((uint32_t)sizeof(buf), network_tcpv4_ring_free(&connection->send_buffer));
+
+            len = network_tcpv4_ring_read(&connection->receive_buffer, buf, len);
+            network_tcpv4_ring_write(&connection->send_buffer, buf, len);
+        }
+    } else if(connection->local_port == 80) {
+        if(network_tcpv4_ring_len(&connection->receive_buffer)) {
+            const char* http_response = "HTTP/1.1 200 OK\r\n" \
+                                        "Content-Type: text/plain\r\n" \
+                                        "Content-Length: 13\r\n" \
+                                        "X-Operating-System: Turnstone OS\r\n" \
+                                        "\r\n" \
+                                        "Hello World!\n";
+
+            connection->receive_buffer.head = connection->receive_buffer.tail;
+
+            network_tcpv4_ring_write(&connection->send_buffer, (const uint8_t*)http_response, strlen(http_response));
+        }
+    }
+
+    if(connection->fin_received) {
+        connection->fin_queued = true;
+    }
+}
+
+// hands established connection to owner of its listener
+static void network_tcpv4_connection_established(network_tcpv4_connection_t* connection) {
+    network_tcpv4_listener_t* listener = connection->listener;
+
+    if(listener == NULL) {
+        return;
+    }
+
+    lock_acquire(network_tcpv4_listener_lock);
+
+    if(listener->accept_queue != NULL) {
+        connection->owned = true;
+
+        list_queue_push(listener->accept_queue, connection);
+
+        if(listener->event_callback) {
+            listener->event_callback(listener->event_data);
+        }
+    }
+
+    lock_release(network_tcpv4_listener_lock);
 }
 
-static int8_t network_tcpv4_dump_packet(network_ipv4_address_t        dip,
-                                        network_ipv4_address_t        sip,
-                                        const network_tcpv4_header_t* recv_tcpv4_packet,
-                                        uint16_t                      packet_len) {
+static uint32_t network_tcpv4_connection_poll_locked(const network_tcpv4_connection_t* connection) {
+    uint32_t events = 0;
+
+    boolean_t closed = connection->state == NETWORK_TCP_CONNECTION_STATE_CLOSED || connection->detached;
+
+    if(network_tcpv4_ring_len(&connection->receive_buffer) || connection->fin_received || closed) {
+        events |= NETWORK_TCPV4_POLL_READABLE;
+    }
+
+    if(network_tcpv4_can_send_data(connection) && !connection->fin_queued && network_tcpv4_ring_free(&connection->send_buffer)) {
+        events |= NETWORK_TCPV4_POLL_WRITABLE;
+    }
+
+    if(closed) {
+        events |= NETWORK_TCPV4_POLL_HANGUP;
+    }
+
+    return events;
+}
+
+// owner is told about new readiness and newly arrived data, other changes do not wake it
+static void network_tcpv4_connection_notify(network_tcpv4_connection_t* connection, uint32_t old_events, uint32_t old_receive_len) {
+    if(connection->event_callback == NULL) {
+        return;
+    }
+
+    uint32_t events = network_tcpv4_connection_poll_locked(connection);
+
+    if((events & ~old_events) || network_tcpv4_ring_len(&connection->receive_buffer) > old_receive_len) {
+        connection->event_callback(connection->event_data);
+    }
+}
+
+static void network_tcpv4_parse_options(const network_tcpv4_header_t* hdr, uint16_t* mss, int16_t* window_scale) {
+    uint16_t options_length = hdr->header_length * 4 - sizeof(network_tcpv4_header_t);
+    const uint8_t* options = (const uint8_t*)hdr + sizeof(network_tcpv4_header_t);
+    uint16_t i = 0;
+
+    while(i < options_length) {
+        uint8_t kind = options[i];
+
+        if(kind == 0) { // end of options
+            break;
+        }
+
+        if(kind == 1) { // nop
+            i++;
+
+            continue;
+        }
+
+        if(i + 1 >= options_length || options[i + 1] < 2 || i + options[i + 1] > options_length) {
+            PRINTLOG(NETWORK, LOG_TRACE, "malformed tcp option %i", kind);
+
+            break;
+        }
+
+        uint8_t len = options[i + 1];
+
+        if(kind == 2 && len == 4) {
+            *mss = (options[i + 2] << 8) | options[i + 3];
+        } else if(kind == 3 && len == 3) {
+            *window_scale = MIN(options[i + 2], NETWORK_TCPV4_MAX_WINDOW_SCALE);
+        }
+
+        // sack and timestamps are not used, they are skipped by their length
+
+        i += len;
+    }
+}
+
+static void network_tcpv4_dump_packet(network_ipv4_address_t        dip,
+                                      network_ipv4_address_t        sip,
+                                      const network_tcpv4_header_t* recv_tcpv4_packet,
+                                      uint16_t                      packet_len) {
     uint16_t header_length = recv_tcpv4_packet->header_length * 4;
     uint16_t data_length = packet_len - header_length;
 
@@ -263,370 +842,578 @@ static int8_t network_tcpv4_dump_packet(network_ipv4_address_t        dip,
     PRINTLOG(NETWORK, LOG_TRACE, "Sequence number: %i Acknowledgement number: %i", seq_num, ack_num);
     PRINTLOG(NETWORK, LOG_TRACE, "Window size: %i", window_size);
     PRINTLOG(NETWORK, LOG_TRACE, "Data length: %i", data_length);
+    PRINTLOG(NETWORK, LOG_TRACE, "Flags: %s%s%s%s%s",
+             recv_tcpv4_packet->syn ? "SYN " : "",
+             recv_tcpv4_packet->fin ? "FIN " : "",
+             recv_tcpv4_packet->ack ? "ACK " : "",
+             recv_tcpv4_packet->rst ? "RST " : "",
+             recv_tcpv4_packet->psh ? "PSH " : "");
+
+    if(header_length > sizeof(network_tcpv4_header_t)) {
+        uint16_t mss = 0;
+        int16_t window_scale = -1;
 
+        network_tcpv4_parse_options(recv_tcpv4_packet, &mss, &window_scale);
 
-    if(recv_tcpv4_packet->syn) {
-        PRINTLOG(NETWORK, LOG_TRACE, "SYN flag set");
+        PRINTLOG(NETWORK, LOG_TRACE, "Options MSS: %i Window scale: %i", mss, window_scale);
     }
+}
 
-    if(recv_tcpv4_packet->fin) {
-        PRINTLOG(NETWORK, LOG_TRACE, "FIN flag set");
-    }
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+static network_tcpv4_connection_t* network_tcpv4_connection_create(network_ipv4_address_t          dip,
+                                                                   network_ipv4_address_t          sip,
+                                                                   const network_tcpv4_header_t*   hdr,
+                                                                   network_tcpv4_listener_t*       listener,
+                                                                   const network_ethernet_route_t* route,
+                                                                   uint64_t                        now) {
+    network_tcpv4_connection_t* connection = memory_malloc(sizeof(network_tcpv4_connection_t));
 
-    if(recv_tcpv4_packet->ack) {
-        PRINTLOG(NETWORK, LOG_TRACE, "ACK flag set");
+    if(connection == NULL) {
+        return NULL;
     }
 
-    if(recv_tcpv4_packet->rst) {
-        PRINTLOG(NETWORK, LOG_TRACE, "RST flag set");
-    }
+    connection->send_buffer.data = memory_malloc(NETWORK_TCPV4_SEND_BUFFER_SIZE);
+    connection->receive_buffer.data = memory_malloc(NETWORK_TCPV4_RECEIVE_BUFFER_SIZE);
+    connection->lock = lock_create();
+
+    if(connection->send_buffer.data == NULL || connection->receive_buffer.data == NULL || connection->lock == NULL) {
+        memory_free(connection->send_buffer.data);
+        memory_free(connection->receive_buffer.data);
+
+        if(connection->lock) {
+            lock_destroy(connection->lock);
+        }
 
-    if(recv_tcpv4_packet->psh) {
-        PRINTLOG(NETWORK, LOG_TRACE, "PSH flag set");
+        memory_free(connection);
+
+        return NULL;
     }
 
-    if(header_length > sizeof(network_tcpv4_header_t)) {
-        PRINTLOG(NETWORK, LOG_TRACE, "Options present");
+    connection->send_buffer.size = NETWORK_TCPV4_SEND_BUFFER_SIZE;
+    connection->receive_buffer.size = NETWORK_TCPV4_RECEIVE_BUFFER_SIZE;
 
-        uint16_t options_length = header_length - sizeof(network_tcpv4_header_t);
+    connection->local_ip = dip;
+    connection->local_port = BYTE_SWAP16(hdr->destination_port);
+    connection->remote_ip = sip;
+    connection->remote_port = BYTE_SWAP16(hdr->source_port);
+    connection->state = NETWORK_TCP_CONNECTION_STATE_SYN_RECEIVED;
+    connection->route = *route;
+    connection->listener = listener;
+    connection->queue = network_rx_queue_current() % NETWORK_RX_QUEUE_MAX;
 
-        uint8_t* options = (uint8_t*)recv_tcpv4_packet;
-        options += sizeof(network_tcpv4_header_t);
+    uint16_t peer_mss = 0;
+    int16_t peer_window_scale = -1;
 
-        PRINTLOG(NETWORK, LOG_TRACE, "Options length: %i", options_length);
+    network_tcpv4_parse_options(hdr, &peer_mss, &peer_window_scale);
 
-        uint16_t i = 0;
+    connection->mss = MIN(peer_mss ? peer_mss : NETWORK_TCPV4_DEFAULT_MSS, NETWORK_TCPV4_MSS);
 
-        while(i < options_length) {
-            PRINTLOG(NETWORK, LOG_TRACE, "Option %i: %i", i, options[i]);
+    // window scaling is used only if both sides offer it
+    if(peer_window_scale >= 0) {
+        connection->snd_wscale = peer_window_scale;
+        connection->rcv_wscale = NETWORK_TCPV4_WINDOW_SCALE;
+    }
 
-            if(options[i] == 0) {
-                break;
-            } else if(options[i] == 1) {
-                PRINTLOG(NETWORK, LOG_TRACE, "NOP option");
-                i++;
-            } else if(options[i] == 2) {
-                PRINTLOG(NETWORK, LOG_TRACE, "MSS option");
-
-                if(options[i + 1] == 4) {
-                    uint16_t mss = (options[i + 2] << 8) | options[i + 3];
-                    PRINTLOG(NETWORK, LOG_TRACE, "MSS: %i", mss);
-                } else {
-                    PRINTLOG(NETWORK, LOG_TRACE, "Invalid MSS option length");
-
-                    return -1;
-                }
+    uint32_t seq = BYTE_SWAP32(hdr->sequence_number);
 
-                i += 4;
-            } else if(options[i] == 3) {
-                PRINTLOG(NETWORK, LOG_TRACE, "Window scale option");
+    connection->irs = seq;
+    connection->rcv_nxt = seq + 1;
 
-                if(options[i + 1] == 3) {
-                    uint8_t window_scale = options[i + 2];
-                    PRINTLOG(NETWORK, LOG_TRACE, "Window scale: %i", window_scale);
-                } else {
-                    PRINTLOG(NETWORK, LOG_TRACE, "Invalid window scale option length");
+    connection->iss = rand();
+    connection->snd_una = connection->iss;
+    connection->snd_nxt = connection->iss + 1;
+    connection->snd_wnd = BYTE_SWAP16(hdr->window_size);
+    connection->snd_wl1 = seq;
+    connection->snd_wl2 = connection->iss;
+    connection->recover = connection->iss;
 
-                    return NULL;
-                }
+    connection->rto = NETWORK_TCPV4_RTO_INITIAL;
+    connection->cwnd = NETWORK_TCPV4_INITIAL_CWND * connection->mss;
+    connection->ssthresh = 0xFFFFFFFF;
 
-                i += 3;
-            } else if(options[i] == 4) {
-                PRINTLOG(NETWORK, LOG_TRACE, "SACK permitted option");
+    network_tcpv4_connection_add(connection);
 
-                if(options[i + 1] == 2) {
-                    PRINTLOG(NETWORK, LOG_TRACE, "SACK permitted option length is valid");
-                } else {
-                    PRINTLOG(NETWORK, LOG_TRACE, "Invalid SACK permitted option length");
+    network_tcpv4_send_syn_ack(connection);
+    connection->rto_deadline = now + connection->rto;
 
-                    return -1;
-                }
+    return connection;
+}
+#pragma GCC diagnostic pop
 
-                i += 2;
-            } else if(options[i] == 5) {
-                PRINTLOG(NETWORK, LOG_TRACE, "SACK option");
+static void network_tcpv4_connection_input(network_tcpv4_connection_t*   connection,
+                                           const network_tcpv4_header_t* hdr,
+                                           const uint8_t*                data,
+                                           uint16_t                      data_len,
+                                           uint64_t                      now) {
+    uint32_t seq = BYTE_SWAP32(hdr->sequence_number);
+    uint32_t ack = BYTE_SWAP32(hdr->acknowledgement_number);
+    uint32_t window = BYTE_SWAP16(hdr->window_size);
 
-                if(options[i + 1] > 2) {
-                    uint8_t sack_length = options[i + 1];
-                    PRINTLOG(NETWORK, LOG_TRACE, "SACK length: %i", sack_length);
+    if(hdr->rst) {
+        if(NETWORK_TCPV4_SEQ_GEQ(seq, connection->rcv_nxt) && NETWORK_TCPV4_SEQ_LEQ(seq, connection->rcv_adv)) {
+            PRINTLOG(NETWORK, LOG_TRACE, "Connection reset");
 
-                    uint8_t* sack = &options[i + 2];
+            connection->state = NETWORK_TCP_CONNECTION_STATE_CLOSED;
+        }
 
-                    for(uint8_t j = 0; j < sack_length - 2; j += 8) {
-                        uint32_t left_edge = (sack[j] << 24) | (sack[j + 1] << 16) | (sack[j + 2] << 8) | sack[j + 3];
-                        uint32_t right_edge = (sack[j + 4] << 24) | (sack[j + 5] << 16) | (sack[j + 6] << 8) | sack[j + 7];
+        return;
+    }
 
-                        PRINTLOG(NETWORK, LOG_TRACE, "SACK block %i: %i-%i", j / 8, left_edge, right_edge);
-                    }
+    if(hdr->syn) {
+        if(connection->state == NETWORK_TCP_CONNECTION_STATE_SYN_RECEIVED && seq == connection->irs) {
+            // our syn ack is lost
+            network_tcpv4_send_syn_ack(connection);
+        } else {
+            connection->ack_now = true;
+            network_tcpv4_output(connection, now);
+        }
 
-                    i += sack_length;
-                } else {
-                    PRINTLOG(NETWORK, LOG_TRACE, "Invalid SACK option length");
+        return;
+    }
 
-                    return -1;
-                }
+    if(!hdr->ack) {
+        return;
+    }
 
-                i += options[i + 1];
-            } else if(options[i] == 8) {
-                PRINTLOG(NETWORK, LOG_TRACE, "Timestamp option");
+    if(connection->state == NETWORK_TCP_CONNECTION_STATE_SYN_RECEIVED) {
+        if(ack != connection->iss + 1) {
+            network_tcpv4_send_raw(&connection->route,
+                                   connection->local_ip, connection->remote_ip,
+                                   connection->local_port, connection->remote_port,
+                                   ack, 0, NETWORK_TCPV4_FLAG_RST, 0,
+                                   NULL, 0,
+                                   NULL, 0, 0);
+
+            return;
+        }
 
-                if(options[i + 1] == 10) {
-                    uint32_t timestamp = (options[i + 2] << 24) | (options[i + 3] << 16) | (options[i + 4] << 8) | options[i + 5];
-                    uint32_t echo_reply = (options[i + 6] << 24) | (options[i + 7] << 16) | (options[i + 8] << 8) | options[i + 9];
+        connection->state = NETWORK_TCP_CONNECTION_STATE_ESTABLISHED;
+        network_tcpv4_connection_established(connection);
+        connection->snd_una = ack;
+        connection->snd_wnd = window << connection->snd_wscale;
+        connection->snd_wl1 = seq;
+        connection->snd_wl2 = ack;
+        connection->rto_deadline = 0;
+        connection->retransmits = 0;
+    } else {
+        network_tcpv4_process_ack(connection, seq, ack, window << connection->snd_wscale, data_len, now);
+    }
 
-                    PRINTLOG(NETWORK, LOG_TRACE, "Timestamp: %i Echo reply: %i", timestamp, echo_reply);
-                } else {
-                    PRINTLOG(NETWORK, LOG_TRACE, "Invalid timestamp option length");
+    if(connection->fin_sent && NETWORK_TCPV4_SEQ_GT(connection->snd_una, connection->fin_seq)) {
+        // our fin is acked, time wait is not kept
+        if(connection->state == NETWORK_TCP_CONNECTION_STATE_FIN_WAIT_1) {
+            connection->state = NETWORK_TCP_CONNECTION_STATE_FIN_WAIT_2;
+        } else if(connection->state == NETWORK_TCP_CONNECTION_STATE_CLOSING ||
+                  connection->state == NETWORK_TCP_CONNECTION_STATE_LAST_ACK) {
+            connection->state = NETWORK_TCP_CONNECTION_STATE_CLOSED;
 
-                    return -1;
-                }
+            return;
+        }
+    }
 
-                i += 10;
-            } else {
-                PRINTLOG(NETWORK, LOG_TRACE, "Invalid/Unsupported option: %i", options[i]);
+    uint32_t fin_seq = seq + data_len;
+
+    boolean_t can_receive = connection->state == NETWORK_TCP_CONNECTION_STATE_ESTABLISHED ||
+                            connection->state == NETWORK_TCP_CONNECTION_STATE_FIN_WAIT_1 ||
+                            connection->state == NETWORK_TCP_CONNECTION_STATE_FIN_WAIT_2;
+
+    if(data_len && can_receive) {
+        // trim already received head of segment
+        if(NETWORK_TCPV4_SEQ_LT(seq, connection->rcv_nxt) && NETWORK_TCPV4_SEQ_GT(seq + data_len, connection->rcv_nxt)) {
+            uint32_t skip = connection->rcv_nxt - seq;
+
+            data += skip;
+            data_len -= skip;
+            seq = connection->rcv_nxt;
+        }
+
+        if(seq == connection->rcv_nxt) {
+            uint32_t copied = network_tcpv4_ring_write(&connection->receive_buffer, data, data_len);
 
-                return -1;
+            connection->rcv_nxt += copied;
+            connection->unacked_segments++;
+
+            if(copied < data_len || connection->unacked_segments >= 2 || (connection->options & NETWORK_TCPV4_OPTION_QUICKACK)) {
+                connection->ack_now = true;
+            } else if(connection->ack_deadline == 0) {
+                connection->ack_deadline = now + NETWORK_TCPV4_DELAYED_ACK;
             }
+        } else {
+            // out of order or duplicate, immediate ack lets peer detect loss
+            connection->ack_now = true;
         }
     }
 
-    return 0;
+    if(hdr->fin && !connection->fin_received && fin_seq == connection->rcv_nxt) {
+        connection->rcv_nxt++;
+        connection->fin_received = true;
+        connection->ack_now = true;
+
+        if(connection->state == NETWORK_TCP_CONNECTION_STATE_ESTABLISHED) {
+            connection->state = NETWORK_TCP_CONNECTION_STATE_CLOSE_WAIT;
+        } else if(connection->state == NETWORK_TCP_CONNECTION_STATE_FIN_WAIT_1) {
+            connection->state = NETWORK_TCP_CONNECTION_STATE_CLOSING;
+        } else if(connection->state == NETWORK_TCP_CONNECTION_STATE_FIN_WAIT_2) {
+            network_tcpv4_output(connection, now);
+            connection->state = NETWORK_TCP_CONNECTION_STATE_CLOSED;
+
+            return;
+        }
+    }
+
+    if(!connection->owned && network_tcpv4_is_builtin_service(connection->local_port)) {
+        network_tcpv4_builtin_service_run(connection);
+    }
+
+    network_tcpv4_output(connection, now);
 }
 
-static uint8_t* network_tcpv4_process_syn_packet(network_ipv4_address_t dip,
-                                                 network_ipv4_address_t sip,
-                                                 uint16_t               dest_port,
-                                                 uint16_t               source_port,
-                                                 uint32_t               ack_num,
-                                                 uint32_t               seq_num,
-                                                 uint16_t               window_size,
-                                                 uint16_t*              return_packet_len) {
+int8_t network_tcpv4_process_packet(network_ipv4_address_t dip, network_ipv4_address_t sip, network_tcpv4_header_t* recv_tcpv4_packet, void* network_info, uint16_t packet_len, network_netbuf_t* netbuf) {
+    if (recv_tcpv4_packet == NULL || netbuf == NULL) {
+        PRINTLOG(NETWORK, LOG_ERROR, "recv_tcpv4_packet/netbuf is NULL");
+        return -1;
+    }
 
-    network_tcpv4_listener_t* listener = network_tcpv4_listener_get(dip, dest_port);
+    uint16_t header_length = recv_tcpv4_packet->header_length * 4;
 
-    if(listener == NULL) {
-        return NULL;
+    if(packet_len < sizeof(network_tcpv4_header_t) || header_length < sizeof(network_tcpv4_header_t) || header_length > packet_len) {
+        PRINTLOG(NETWORK, LOG_TRACE, "malformed tcp segment");
+        return -1;
     }
 
-    network_tcpv4_header_t* res = NULL;
+    PRINTLOG(NETWORK, LOG_TRACE, "Processing TCPv4 packet");
+
+    network_tcpv4_dump_packet(dip, sip, recv_tcpv4_packet, packet_len);
 
-    network_tcpv4_connection_t* connection = network_tcpv4_connection_get(dip, dest_port, sip, source_port);
+    uint16_t data_length = packet_len - header_length;
+    const uint8_t* data = (const uint8_t*)recv_tcpv4_packet + header_length;
 
-    if(connection) {
-        // SYN received on an existing connection
-        // send RST
-        res = network_tcpv4_create_reset_packet(source_port, dest_port, 0, seq_num + 1);
+    uint16_t source_port = BYTE_SWAP16(recv_tcpv4_packet->source_port);
+    uint16_t dest_port = BYTE_SWAP16(recv_tcpv4_packet->destination_port);
 
-        if(res != NULL) {
-            *return_packet_len = sizeof(network_tcpv4_header_t);
-            PRINTLOG(NETWORK, LOG_TRACE, "return packet len: %i", *return_packet_len);
+    uint64_t now = time_timer_get_tick_count();
 
-            return (uint8_t*)res;
+    network_tcpv4_connection_t* connection = network_tcpv4_connection_get(dip, dest_port, sip, source_port);
+
+    if(connection == NULL) {
+        if(recv_tcpv4_packet->rst) {
+            return 0;
         }
 
-        return NULL;
-    }
+        network_ethernet_route_t route = {0};
 
-    // new connection
-    connection = memory_malloc(sizeof(network_tcpv4_connection_t));
+        network_ethernet_route_from_netbuf(&route, netbuf, network_info);
 
-    if(connection == NULL) {
-        return NULL;
-    }
+        network_tcpv4_listener_t* listener = network_tcpv4_listener_get(dip, dest_port);
 
-    connection->local_ip = dip;
-    connection->local_port = dest_port;
-    connection->remote_ip = sip;
-    connection->remote_port = source_port;
-    connection->state = NETWORK_TCP_CONNECTION_STATE_SYN_RECEIVED;
+        if(recv_tcpv4_packet->syn && !recv_tcpv4_packet->ack && listener != NULL) {
+            if(network_tcpv4_connection_create(dip, sip, recv_tcpv4_packet, listener, &route, now) != NULL) {
+                return 0;
+            }
+        }
 
-    connection->local_sequence_number = rand();
-    connection->remote_sequence_number = seq_num + 1;
+        uint32_t seq_num = BYTE_SWAP32(recv_tcpv4_packet->sequence_number);
+        uint32_t ack_num = BYTE_SWAP32(recv_tcpv4_packet->acknowledgement_number);
+
+        // no connection, send RST
+        if(recv_tcpv4_packet->ack) {
+            network_tcpv4_send_raw(&route, dip, sip, dest_port, source_port,
+                                   ack_num, 0, NETWORK_TCPV4_FLAG_RST, 0,
+                                   NULL, 0, NULL, 0, 0);
+        } else {
+            network_tcpv4_send_raw(&route, dip, sip, dest_port, source_port,
+                                   0, seq_num + data_length + recv_tcpv4_packet->syn + recv_tcpv4_packet->fin,
+                                   NETWORK_TCPV4_FLAG_RST | NETWORK_TCPV4_FLAG_ACK, 0,
+                                   NULL, 0, NULL, 0, 0);
+        }
 
-    connection->local_acknowledgement_number = ack_num;
-    connection->remote_acknowledgement_number = 0;
+        return 0;
+    }
 
-    connection->window_size = window_size;
+    lock_acquire(connection->lock);
 
-    network_tcpv4_connection_add(connection);
+    uint32_t old_events = network_tcpv4_connection_poll_locked(connection);
+    uint32_t old_receive_len = network_tcpv4_ring_len(&connection->receive_buffer);
+
+    network_tcpv4_connection_input(connection, recv_tcpv4_packet, data, data_length, now);
+    network_tcpv4_connection_notify(connection, old_events, old_receive_len);
 
-    res = network_tcpv4_create_syn_ack_packet_from_connection(connection);
+    boolean_t closed = connection->state == NETWORK_TCP_CONNECTION_STATE_CLOSED;
 
-    if(res != NULL) {
-        *return_packet_len = sizeof(network_tcpv4_header_t);
-        PRINTLOG(NETWORK, LOG_TRACE, "return packet len: %i", *return_packet_len);
+    lock_release(connection->lock);
 
-        return (uint8_t*)res;
+    if(closed) {
+        network_tcpv4_connection_del(connection);
     }
 
-    return NULL;
+    return 0;
 }
 
-static uint8_t* network_tcpv4_process_fin_packet(network_tcpv4_connection_t* connection, uint32_t seq_num, uint16_t* return_packet_len) {
-    // connection closed
-    PRINTLOG(NETWORK, LOG_TRACE, "Connection closed");
+uint64_t network_tcpv4_timers_run(uint64_t now) {
+    list_t* connections = network_tcpv4_shard_connections[network_rx_queue_current() % NETWORK_RX_QUEUE_MAX];
+
+    if(connections == NULL) {
+        return 0;
+    }
+
+    uint64_t next_deadline = 0;
+    size_t i = 0;
+
+    while(i < list_size(connections)) {
+        network_tcpv4_connection_t* connection = (network_tcpv4_connection_t*)list_get_data_at_position(connections, i);
+
+        lock_acquire(connection->lock);
+
+        if(connection->rto_deadline && now >= connection->rto_deadline) {
+            uint32_t old_events = network_tcpv4_connection_poll_locked(connection);
 
-    if(connection->state == NETWORK_TCP_CONNECTION_STATE_ESTABLISHED) {
-        connection->local_sequence_number = connection->remote_acknowledgement_number;
-        connection->remote_sequence_number = seq_num + 1;
+            network_tcpv4_on_rto(connection, now);
+            network_tcpv4_connection_notify(connection, old_events, network_tcpv4_ring_len(&connection->receive_buffer));
+        }
 
-        connection->state = NETWORK_TCP_CONNECTION_STATE_CLOSE_WAIT;
+        if(connection->ack_deadline && now >= connection->ack_deadline) {
+            connection->ack_now = true;
+            network_tcpv4_output(connection, now);
+        }
 
-        network_tcpv4_header_t* res = NULL;
+        boolean_t closed = connection->state == NETWORK_TCP_CONNECTION_STATE_CLOSED;
 
-        res = network_tcpv4_create_ack_packet_from_connection(connection);
+        if(!closed) {
+            uint64_t deadlines[2] = {connection->rto_deadline, connection->ack_deadline};
 
-        if(res != NULL) {
-            *return_packet_len = sizeof(network_tcpv4_header_t);
-            PRINTLOG(NETWORK, LOG_TRACE, "return packet len: %i", *return_packet_len);
+            for(uint64_t j = 0; j < 2; j++) {
+                if(deadlines[j] && (next_deadline == 0 || deadlines[j] < next_deadline)) {
+                    next_deadline = deadlines[j];
+                }
+            }
+        }
+
+        lock_release(connection->lock);
 
-            return (uint8_t*)res;
+        if(closed) {
+            network_tcpv4_connection_del(connection);
+        } else {
+            i++;
         }
     }
 
-    return NULL;
+    return next_deadline;
+}
+
+// wakes rx task of connection to rearm its timer after a user call armed a deadline
+static void network_tcpv4_kick_timers(const network_tcpv4_connection_t* connection) {
+    const network_rx_queue_t* queue = network_rx_queue_get(connection->queue);
 
+    if(queue != NULL && queue->task_id) {
+        task_set_message_received(queue->task_id);
+    }
 }
 
-uint8_t* network_tcpv4_process_packet(network_ipv4_address_t dip, network_ipv4_address_t sip, network_tcpv4_header_t* recv_tcpv4_packet, void* network_info, uint16_t packet_len, uint16_t* return_packet_len) {
-    UNUSED(network_info);
-    UNUSED(return_packet_len);
+int64_t network_tcpv4_connection_send(network_tcpv4_connection_t* connection, const uint8_t* data, uint64_t len) {
+    if(connection == NULL || data == NULL) {
+        return -1;
+    }
 
-    if (recv_tcpv4_packet == NULL || return_packet_len == NULL) {
-        PRINTLOG(NETWORK, LOG_ERROR, "recv_tcpv4_packet/return_packet_len is NULL");
-        return NULL;
+    lock_acquire(connection->lock);
+
+    if(!network_tcpv4_can_send_data(connection) || connection->fin_queued) {
+        lock_release(connection->lock);
+
+        return -1;
     }
 
-    PRINTLOG(NETWORK, LOG_TRACE, "Processing TCPv4 packet");
+    uint32_t queued = network_tcpv4_ring_write(&connection->send_buffer, data, MIN(len, 0xFFFFFFFFULL));
 
-    if(network_tcpv4_dump_packet(dip, sip, recv_tcpv4_packet, packet_len) < 0) {
-        return NULL;
+    network_tcpv4_output(connection, time_timer_get_tick_count());
+
+    lock_release(connection->lock);
+
+    network_tcpv4_kick_timers(connection);
+
+    return queued;
+}
+
+int64_t network_tcpv4_connection_recv(network_tcpv4_connection_t* connection, uint8_t* buf, uint64_t len) {
+    if(connection == NULL || buf == NULL) {
+        return -1;
     }
 
-    uint16_t header_length = recv_tcpv4_packet->header_length * 4;
-    uint16_t data_length = packet_len - header_length;
+    lock_acquire(connection->lock);
 
-    uint16_t source_port = recv_tcpv4_packet->source_port;
-    source_port = BYTE_SWAP16(source_port);
+    uint32_t read = network_tcpv4_ring_read(&connection->receive_buffer, buf, MIN(len, 0xFFFFFFFFULL));
 
-    uint16_t dest_port = recv_tcpv4_packet->destination_port;
-    dest_port = BYTE_SWAP16(dest_port);
+    if(read == 0) {
+        boolean_t eof = connection->fin_received || connection->state == NETWORK_TCP_CONNECTION_STATE_CLOSED;
 
-    uint32_t seq_num = recv_tcpv4_packet->sequence_number;
-    seq_num = BYTE_SWAP32(seq_num);
+        lock_release(connection->lock);
 
+        return eof ? -1 : 0;
+    }
 
-    uint32_t ack_num = recv_tcpv4_packet->acknowledgement_number;
-    ack_num = BYTE_SWAP32(ack_num);
+    // advertise opened window if it grows at least two segments
+    uint32_t window = MIN(network_tcpv4_ring_free(&connection->receive_buffer) >> connection->rcv_wscale, 0xFFFFU);
+    uint32_t right_edge = connection->rcv_nxt + (window << connection->rcv_wscale);
 
-    uint16_t window_size = recv_tcpv4_packet->window_size;
-    window_size = BYTE_SWAP16(window_size);
+    if(NETWORK_TCPV4_SEQ_GEQ(right_edge, connection->rcv_adv + 2 * connection->mss) && connection->state != NETWORK_TCP_CONNECTION_STATE_SYN_RECEIVED) {
+        connection->ack_now = true;
+        network_tcpv4_output(connection, time_timer_get_tick_count());
+    }
+
+    lock_release(connection->lock);
 
+    return read;
+}
 
-    if(recv_tcpv4_packet->syn) {
-        return network_tcpv4_process_syn_packet(dip, sip, dest_port, source_port, ack_num, seq_num, window_size, return_packet_len);
+void network_tcpv4_connection_close(network_tcpv4_connection_t* connection) {
+    if(connection == NULL) {
+        return;
     }
 
-    network_tcpv4_header_t* res = NULL;
+    lock_acquire(connection->lock);
 
-    network_tcpv4_connection_t* connection = network_tcpv4_connection_get(dip, dest_port, sip, source_port);
+    connection->fin_queued = true;
+    network_tcpv4_output(connection, time_timer_get_tick_count());
 
-    if(!connection) {
-        // send RST
-        res = network_tcpv4_create_reset_packet(source_port, dest_port, 0, seq_num + 1);
+    lock_release(connection->lock);
 
-        if(res != NULL) {
-            *return_packet_len = sizeof(network_tcpv4_header_t);
-            PRINTLOG(NETWORK, LOG_TRACE, "return packet len: %i", *return_packet_len);
+    network_tcpv4_kick_timers(connection);
+}
 
-            return (uint8_t*)res;
-        }
+void network_tcpv4_connection_set_option(network_tcpv4_connection_t* connection, network_tcpv4_option_t option, boolean_t enable) {
+    if(connection == NULL) {
+        return;
+    }
 
-        return NULL;
+    lock_acquire(connection->lock);
+
+    if(enable) {
+        connection->options |= option;
+    } else {
+        connection->options &= ~option;
     }
 
-    if(recv_tcpv4_packet->rst) {
-        // connection reset
-        PRINTLOG(NETWORK, LOG_TRACE, "Connection reset");
+    // nagle may hold data which can leave now
+    if(enable && option == NETWORK_TCPV4_OPTION_NODELAY) {
+        network_tcpv4_output(connection, time_timer_get_tick_count());
+    }
 
-        network_tcpv4_connection_del(connection);
+    lock_release(connection->lock);
+}
 
+network_tcpv4_listener_t* network_tcpv4_listener_open(network_ipv4_address_t ip, uint16_t port, list_t* accept_queue, network_tcpv4_event_callback_f event_callback, void* event_data) {
+    if(network_tcpv4_listener_ip_map == NULL || accept_queue == NULL) {
         return NULL;
     }
 
-    if(recv_tcpv4_packet->fin) {
-        return network_tcpv4_process_fin_packet(connection, seq_num, return_packet_len);
+    network_tcpv4_listener_t* listener = network_tcpv4_listener_create(ip, port);
+
+    if(listener == NULL) {
+        return NULL;
     }
 
-    if(connection->state == NETWORK_TCP_CONNECTION_STATE_CLOSE_WAIT) {
-        network_tcpv4_connection_del(connection);
+    lock_acquire(network_tcpv4_listener_lock);
+
+    if(listener->accept_queue != NULL) {
+        lock_release(network_tcpv4_listener_lock);
+
+        PRINTLOG(NETWORK, LOG_DEBUG, "tcp port %i is already opened", port);
 
         return NULL;
     }
 
-    if(connection->state == NETWORK_TCP_CONNECTION_STATE_SYN_RECEIVED) {
-        if(ack_num != connection->local_sequence_number + 1) {
-            // send RST
-            res = network_tcpv4_create_reset_packet(source_port, dest_port, 0, seq_num + 1);
+    listener->event_callback = event_callback;
+    listener->event_data = event_data;
+    listener->accept_queue = accept_queue;
 
-            if(res != NULL) {
-                *return_packet_len = sizeof(network_tcpv4_header_t);
-                PRINTLOG(NETWORK, LOG_TRACE, "return packet len: %i", *return_packet_len);
+    lock_release(network_tcpv4_listener_lock);
 
-                return (uint8_t*)res;
-            }
+    return listener;
+}
+
+void network_tcpv4_listener_close(network_tcpv4_listener_t* listener) {
+    if(listener == NULL) {
+        return;
+    }
+
+    lock_acquire(network_tcpv4_listener_lock);
+
+    list_t* accept_queue = listener->accept_queue;
+
+    listener->accept_queue = NULL;
+    listener->event_callback = NULL;
+    listener->event_data = NULL;
 
-            return NULL;
+    lock_release(network_tcpv4_listener_lock);
+
+    // connections are released outside of listener lock, release takes connection lock
+    while(accept_queue && list_size(accept_queue)) {
+        network_tcpv4_connection_t* connection = (network_tcpv4_connection_t*)list_queue_pop(accept_queue);
+
+        if(connection) {
+            network_tcpv4_connection_release(connection);
         }
+    }
+}
 
-        connection->state = NETWORK_TCP_CONNECTION_STATE_ESTABLISHED;
+void network_tcpv4_connection_set_event_callback(network_tcpv4_connection_t* connection, network_tcpv4_event_callback_f event_callback, void* event_data) {
+    if(connection == NULL) {
+        return;
     }
 
-    connection->remote_sequence_number = seq_num;
-    connection->remote_acknowledgement_number = ack_num;
+    lock_acquire(connection->lock);
 
-    if(!recv_tcpv4_packet->psh) {
-        return NULL;
+    connection->event_callback = event_callback;
+    connection->event_data = event_data;
+
+    lock_release(connection->lock);
+}
+
+uint32_t network_tcpv4_connection_poll(network_tcpv4_connection_t* connection) {
+    if(connection == NULL) {
+        return NETWORK_TCPV4_POLL_HANGUP;
     }
 
-    // data received
-    PRINTLOG(NETWORK, LOG_TRACE, "Data received");
+    lock_acquire(connection->lock);
 
-    uint8_t* data = (uint8_t*)recv_tcpv4_packet;
-    data += header_length;
+    uint32_t events = network_tcpv4_connection_poll_locked(connection);
 
-    PRINTLOG(NETWORK, LOG_INFO, "Data(%i): %s", data_length, data);
+    lock_release(connection->lock);
 
-    // send ACK
+    return events;
+}
 
-    connection->local_sequence_number = connection->remote_acknowledgement_number;
-    connection->remote_sequence_number = connection->remote_sequence_number + data_length;
+void network_tcpv4_connection_release(network_tcpv4_connection_t* connection) {
+    if(connection == NULL) {
+        return;
+    }
 
-    uint16_t extra_data_length = 0;
+    lock_acquire(connection->lock);
 
-    if(dest_port == 7) {
-        res = network_tcpv4_create_psh_ack_packet_from_connection(connection, data, data_length);
-        extra_data_length = data_length;
-    } else if(dest_port == 80) {
-        const char* http_response = "HTTP/1.1 200 OK\r\n" \
-                                    "Content-Type: text/plain\r\n" \
-                                    "Content-Length: 13\r\n" \
-                                    "X-Operating-System: Turnstone OS\r\n" \
-                                    "\r\n" \
-                                    "Hello World!\n";
-        extra_data_length = strlen(http_response);
-        res = network_tcpv4_create_psh_ack_packet_from_connection(connection, (uint8_t*)http_response, strlen(http_response));
-    } else {
-        res = network_tcpv4_create_ack_packet_from_connection(connection);
+    connection->owned = false;
+    connection->event_callback = NULL;
+    connection->event_data = NULL;
+
+    boolean_t detached = connection->detached;
+    uint64_t queue = connection->queue;
+
+    if(!detached && network_tcpv4_can_send_data(connection)) {
+        connection->fin_queued = true;
+        network_tcpv4_output(connection, time_timer_get_tick_count());
     }
 
-    if(res != NULL) {
-        *return_packet_len = sizeof(network_tcpv4_header_t) + extra_data_length;
-        PRINTLOG(NETWORK, LOG_TRACE, "return packet len: %i", *return_packet_len);
+    lock_release(connection->lock);
 
-        return (uint8_t*)res;
+    if(detached) {
+        network_tcpv4_connection_free(connection);
+
+        return;
     }
 
-    return NULL;
+    // connection may be freed by its rx task from now on
+    const network_rx_queue_t* rx_queue = network_rx_queue_get(queue);
+
+    if(rx_queue != NULL && rx_queue->task_id) {
+        task_set_message_received(rx_queue->task_id);
+    }
 }
-#pragma GCC diagnostic pop
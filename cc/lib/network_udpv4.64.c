@@ -9,19 +9,172 @@
 #include <network/network_udpv4.h>
 #include <network/network_ipv4.h>
 #include <network/network_dhcpv4.h>
+#include <network/network_netbuf.h>
 #include <utils.h>
 #include <memory.h>
 #include <logging.h>
 #include <time.h>
 #include <logging.h>
+#include <hashmap.h>
+#include <cpu/sync.h>
 
 MODULE("turnstone.lib.network");
 
-uint8_t* network_udpv4_process_packet(network_ipv4_address_t dip, network_ipv4_address_t sip, network_udpv4_header_t* recv_udpv4_packet, void* network_info, uint16_t* return_packet_len) {
-    UNUSED(network_info);
+typedef struct network_udpv4_binding_t {
+    network_udpv4_receive_callback_f callback;
+    void*                            data;
+} network_udpv4_binding_t;
+
+hashmap_t* network_udpv4_bindings = NULL;
+lock_t*    network_udpv4_bindings_lock = NULL;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+int8_t network_udpv4_bind(network_ipv4_address_t ip, uint16_t port, network_udpv4_receive_callback_f callback, void* data) {
+    if(callback == NULL) {
+        return -1;
+    }
+
+    if(network_udpv4_bindings_lock == NULL) {
+        lock_t* lock = lock_create();
+
+        if(lock == NULL) {
+            return -1;
+        }
+
+        lock_t* expected = NULL;
+
+        if(!__atomic_compare_exchange_n(&network_udpv4_bindings_lock, &expected, lock, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            lock_destroy(lock);
+        }
+    }
+
+    lock_acquire(network_udpv4_bindings_lock);
+
+    if(network_udpv4_bindings == NULL) {
+        network_udpv4_bindings = hashmap_integer(128);
+
+        if(network_udpv4_bindings == NULL) {
+            lock_release(network_udpv4_bindings_lock);
+
+            return -1;
+        }
+    }
+
+    uint64_t key = ((uint64_t)ip.as_dword << 16) | port;
+
+    if(hashmap_get(network_udpv4_bindings, (void*)key) != NULL) {
+        lock_release(network_udpv4_bindings_lock);
+
+        return -1;
+    }
+
+    network_udpv4_binding_t* binding = memory_malloc(sizeof(network_udpv4_binding_t));
+
+    if(binding == NULL) {
+        lock_release(network_udpv4_bindings_lock);
+
+        return -1;
+    }
+
+    binding->callback = callback;
+    binding->data = data;
+
+    hashmap_put(network_udpv4_bindings, (void*)key, binding);
+
+    lock_release(network_udpv4_bindings_lock);
+
+    return 0;
+}
+#pragma GCC diagnostic pop
+
+void network_udpv4_unbind(network_ipv4_address_t ip, uint16_t port) {
+    if(network_udpv4_bindings_lock == NULL) {
+        return;
+    }
+
+    uint64_t key = ((uint64_t)ip.as_dword << 16) | port;
+
+    lock_acquire(network_udpv4_bindings_lock);
+
+    network_udpv4_binding_t* binding = (network_udpv4_binding_t*)hashmap_get(network_udpv4_bindings, (void*)key);
+
+    if(binding) {
+        hashmap_delete(network_udpv4_bindings, (void*)key);
+        memory_free(binding);
+    }
+
+    lock_release(network_udpv4_bindings_lock);
+}
+
+// returns true if a bound port consumed datagram
+static boolean_t network_udpv4_deliver(network_ipv4_address_t dip, uint16_t dport, network_ipv4_address_t sip, uint16_t sport,
+                                       const uint8_t* data, uint16_t data_len, network_netbuf_t* netbuf, void* network_info) {
+    if(network_udpv4_bindings == NULL || netbuf == NULL) {
+        return false;
+    }
+
+    uint64_t key = ((uint64_t)dip.as_dword << 16) | dport;
+
+    // hook runs with bindings locked, so unbind waits it
+    lock_acquire(network_udpv4_bindings_lock);
+
+    const network_udpv4_binding_t* binding = (const network_udpv4_binding_t*)hashmap_get(network_udpv4_bindings, (void*)key);
+
+    if(binding) {
+        network_ethernet_route_t route = {0};
+
+        network_ethernet_route_from_netbuf(&route, netbuf, network_info);
+
+        binding->callback(binding->data, sip, sport, data, data_len, &route);
+    }
+
+    lock_release(network_udpv4_bindings_lock);
+
+    return binding != NULL;
+}
+
+int8_t network_udpv4_send(network_ethernet_route_t* route, network_ipv4_address_t sip, uint16_t sport, network_ipv4_address_t dip, uint16_t dport, const uint8_t* data, uint16_t len) {
+    if(route == NULL || (data == NULL && len)) {
+        return -1;
+    }
+
+    network_netbuf_t* netbuf = network_netbuf_alloc();
+
+    if(netbuf == NULL) {
+        return -1;
+    }
+
+    uint16_t packet_len = sizeof(network_udpv4_header_t) + len;
+
+    network_udpv4_header_t* hdr = (network_udpv4_header_t*)network_netbuf_append(netbuf, packet_len);
+
+    if(hdr == NULL) {
+        network_netbuf_put(netbuf);
+
+        return -1;
+    }
+
+    hdr->source_port = BYTE_SWAP16(sport);
+    hdr->destination_port = BYTE_SWAP16(dport);
+    hdr->length = BYTE_SWAP16(packet_len);
+    hdr->checksum = 0; // optional for ipv4
+
+    if(len) {
+        memory_memcopy(data, (uint8_t*)hdr + sizeof(network_udpv4_header_t), len);
+    }
+
+    if(network_ipv4_prepend_header(netbuf, sip, dip, NETWORK_IPV4_PROTOCOL_UDPV4) == NULL) {
+        network_netbuf_put(netbuf);
+
+        return -1;
+    }
+
+    return network_ethernet_route_transmit(route, netbuf, NETWORK_ETHERNET_TYPE_IPV4);
+}
+
+uint8_t* network_udpv4_process_packet(network_ipv4_address_t dip, network_ipv4_address_t sip, network_udpv4_header_t* recv_udpv4_packet, void* network_info, uint16_t* return_packet_len, network_netbuf_t* netbuf) {
     UNUSED(return_packet_len);
-    UNUSED(sip);
-    UNUSED(dip);
 
     if(recv_udpv4_packet == NULL) {
         return NULL;
@@ -37,6 +190,9 @@ uint8_t* network_udpv4_process_packet(network_ipv4_address_t dip, network_ipv4_a
 
     PRINTLOG(NETWORK, LOG_TRACE, "udpv4 packet dest port %i data len %i", dport, data_len);
 
+    if(network_udpv4_deliver(dip, dport, sip, sport, data, data_len, netbuf, network_info)) {
+        return NULL;
+    }
 
     if(dport == NETWORK_APPLICATION_PORT_ECHO_SERVER) {
         return (uint8_t*)network_udpv4_create_packet_from_data(dport, sport, data_len, data);
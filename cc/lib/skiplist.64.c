@@ -0,0 +1,553 @@
+/**
+ * @file skiplist.64.c
+ * @brief arena backed skiplist index implementation.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <skiplist.h>
+#include <utils.h>
+
+MODULE("turnstone.lib");
+
+/*! maximum node height, enough for 4^16 keys */
+#define SKIPLIST_MAX_HEIGHT 16
+
+/*! arena allocation alignment */
+#define SKIPLIST_ARENA_ALIGN 16
+
+typedef struct skiplist_node_t skiplist_node_t;
+
+struct skiplist_node_t {
+    const void*      key;
+    const void*      data;
+    uint64_t         height;
+    skiplist_node_t* next[];
+};
+
+typedef struct skiplist_arena_chunk_t skiplist_arena_chunk_t;
+
+struct skiplist_arena_chunk_t {
+    skiplist_arena_chunk_t* next;
+    uint64_t                size;
+    uint64_t                used;
+    uint64_t                reserved;
+    uint8_t                 data[];
+};
+
+typedef struct skiplist_t {
+    memory_heap_t*          heap;
+    index_key_comparator_f  unique_subpart_comparator;
+    boolean_t               unique;
+    uint64_t                arena_chunk_size;
+    uint64_t                arena_size;
+    skiplist_arena_chunk_t* chunks;
+    uint64_t                random_state;
+    uint64_t                size;
+    skiplist_node_t*        head;
+} skiplist_t;
+
+typedef struct skiplist_iterator_t {
+    memory_heap_t*              heap;
+    index_key_comparator_f      comparator;
+    index_key_search_criteria_t criteria;
+    const void*                 key1;
+    const void*                 key2;
+    const skiplist_node_t*      current;
+} skiplist_iterator_t;
+
+static inline skiplist_node_t* skiplist_node_next(const skiplist_node_t* node, uint64_t level) {
+    return __atomic_load_n(&node->next[level], __ATOMIC_ACQUIRE);
+}
+
+static void* skiplist_arena_alloc(skiplist_t* sl, uint64_t size) {
+    size = (size + SKIPLIST_ARENA_ALIGN - 1) & ~(SKIPLIST_ARENA_ALIGN - 1ULL);
+
+    skiplist_arena_chunk_t* chunk = sl->chunks;
+
+    if(!chunk || chunk->used + size > chunk->size) {
+        uint64_t chunk_size = MAX(sl->arena_chunk_size, size);
+
+        chunk = memory_malloc_ext(sl->heap, sizeof(skiplist_arena_chunk_t) + chunk_size, SKIPLIST_ARENA_ALIGN);
+
+        if(!chunk) {
+            return NULL;
+        }
+
+        chunk->size = chunk_size;
+
+        // an oversized chunk is used only once, so keep filling current chunk
+        if(sl->chunks && chunk_size > sl->arena_chunk_size) {
+            chunk->next = sl->chunks->next;
+            sl->chunks->next = chunk;
+        } else {
+            chunk->next = sl->chunks;
+            sl->chunks = chunk;
+        }
+
+        sl->arena_size += chunk_size;
+    }
+
+    void* res = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return res;
+}
+
+static uint64_t skiplist_random_height(skiplist_t* sl) {
+    uint64_t x = sl->random_state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    sl->random_state = x;
+
+    uint64_t height = 1;
+
+    // each level is a quarter of lower one
+    while(height < SKIPLIST_MAX_HEIGHT && (x & 3) == 0) {
+        height++;
+        x >>= 2;
+    }
+
+    return height;
+}
+
+static int8_t skiplist_compare(const index_t* idx, const skiplist_t* sl, const void* key1, const void* key2) {
+    int8_t res = idx->comparator(key1, key2);
+
+    if(res == 0 && !sl->unique && sl->unique_subpart_comparator) {
+        res = sl->unique_subpart_comparator(key1, key2);
+    }
+
+    return res;
+}
+
+/**
+ * @brief finds predecessors of key at each level
+ * @param[in] idx index
+ * @param[in] key key to search
+ * @param[out] preds predecessors
+ * @param[in] after_equals if true predecessors are after nodes equal to key
+ * @return node after predecessors or null
+ */
+static skiplist_node_t* skiplist_find_node(const index_t* idx, const void* key, skiplist_node_t** preds, boolean_t after_equals) {
+    skiplist_t* sl = idx->metadata;
+    skiplist_node_t* node = sl->head;
+
+    for(int64_t level = SKIPLIST_MAX_HEIGHT - 1; level >= 0; level--) {
+        skiplist_node_t* next = skiplist_node_next(node, level);
+
+        while(next) {
+            int8_t c_res = skiplist_compare(idx, sl, next->key, key);
+
+            if(c_res > 0 || (c_res == 0 && !after_equals)) {
+                break;
+            }
+
+            node = next;
+            next = skiplist_node_next(node, level);
+        }
+
+        preds[level] = node;
+    }
+
+    return skiplist_node_next(node, 0);
+}
+
+/**
+ * @brief finds first node whose key is greater than or equal to key by index comparator
+ * @param[in] idx index
+ * @param[in] key key to search
+ * @param[in] strict if true finds first greater one
+ * @return node or null
+ */
+static const skiplist_node_t* skiplist_lower_bound(const index_t* idx, const void* key, boolean_t strict) {
+    skiplist_t* sl = idx->metadata;
+    const skiplist_node_t* node = sl->head;
+
+    for(int64_t level = SKIPLIST_MAX_HEIGHT - 1; level >= 0; level--) {
+        const skiplist_node_t* next = skiplist_node_next(node, level);
+
+        while(next) {
+            int8_t c_res = idx->comparator(next->key, key);
+
+            if(c_res > 0 || (c_res == 0 && !strict)) {
+                break;
+            }
+
+            node = next;
+            next = skiplist_node_next(node, level);
+        }
+    }
+
+    return skiplist_node_next(node, 0);
+}
+
+static int8_t skiplist_insert(index_t* idx, const void* key, const void* data, void** removed_data) {
+    if(!idx || !idx->metadata) {
+        return -1;
+    }
+
+    skiplist_t* sl = idx->metadata;
+    skiplist_node_t* preds[SKIPLIST_MAX_HEIGHT];
+
+    boolean_t replace = sl->unique || sl->unique_subpart_comparator;
+
+    // duplicates of a non unique index without subpart comparator are appended after equal ones
+    skiplist_node_t* fn = skiplist_find_node(idx, key, preds, !replace);
+
+    if(replace && fn && skiplist_compare(idx, sl, fn->key, key) == 0) {
+        if(removed_data) {
+            *removed_data = (void*)fn->data;
+        }
+
+        // readers may see old key with new data or vice versa, both are equal by comparator
+        __atomic_store_n(&fn->data, data, __ATOMIC_RELEASE);
+        __atomic_store_n(&fn->key, key, __ATOMIC_RELEASE);
+
+        return 0;
+    }
+
+    if(removed_data) {
+        *removed_data = NULL;
+    }
+
+    uint64_t height = skiplist_random_height(sl);
+
+    skiplist_node_t* node = skiplist_arena_alloc(sl, sizeof(skiplist_node_t) + sizeof(skiplist_node_t*) * height);
+
+    if(!node) {
+        return -1;
+    }
+
+    node->key = key;
+    node->data = data;
+    node->height = height;
+
+    for(uint64_t level = 0; level < height; level++) {
+        node->next[level] = preds[level]->next[level];
+    }
+
+    // publish bottom up, a reader finding node at upper level can always continue at lower levels
+    for(uint64_t level = 0; level < height; level++) {
+        __atomic_store_n(&preds[level]->next[level], node, __ATOMIC_RELEASE);
+    }
+
+    __atomic_add_fetch(&sl->size, 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static int8_t skiplist_delete(index_t* idx, const void* key, void** deleted_data) {
+    if(!idx || !idx->metadata) {
+        return -1;
+    }
+
+    skiplist_t* sl = idx->metadata;
+    skiplist_node_t* preds[SKIPLIST_MAX_HEIGHT];
+
+    if(deleted_data) {
+        *deleted_data = NULL;
+    }
+
+    skiplist_node_t* fn = skiplist_find_node(idx, key, preds, false);
+
+    if(!fn || skiplist_compare(idx, sl, fn->key, key) != 0) {
+        return 0;
+    }
+
+    if(deleted_data) {
+        *deleted_data = (void*)fn->data;
+    }
+
+    // unlink top down, node memory stays at arena for readers still walking it
+    for(int64_t level = fn->height - 1; level >= 0; level--) {
+        if(preds[level]->next[level] == fn) {
+            __atomic_store_n(&preds[level]->next[level], fn->next[level], __ATOMIC_RELEASE);
+        }
+    }
+
+    __atomic_sub_fetch(&sl->size, 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static boolean_t skiplist_contains(index_t* idx, const void* key) {
+    if(!idx || !idx->metadata) {
+        return false;
+    }
+
+    const skiplist_node_t* node = skiplist_lower_bound(idx, key, false);
+
+    return node && idx->comparator(node->key, key) == 0;
+}
+
+static const void* skiplist_find(index_t* idx, const void* key) {
+    if(!idx || !idx->metadata) {
+        return NULL;
+    }
+
+    const skiplist_node_t* node = skiplist_lower_bound(idx, key, false);
+
+    if(node && idx->comparator(node->key, key) == 0) {
+        return __atomic_load_n(&node->data, __ATOMIC_ACQUIRE);
+    }
+
+    return NULL;
+}
+
+static uint64_t skiplist_size(index_t* idx) {
+    if(!idx || !idx->metadata) {
+        return 0;
+    }
+
+    skiplist_t* sl = idx->metadata;
+
+    return __atomic_load_n(&sl->size, __ATOMIC_RELAXED);
+}
+
+static boolean_t skiplist_iterator_is_in_range(const skiplist_iterator_t* iter, const skiplist_node_t* node) {
+    if(!node) {
+        return false;
+    }
+
+    switch(iter->criteria) {
+    case INDEXER_KEY_COMPARATOR_CRITERIA_LESS:
+        return iter->comparator(node->key, iter->key1) < 0;
+    case INDEXER_KEY_COMPARATOR_CRITERIA_LESSOREQUAL:
+    case INDEXER_KEY_COMPARATOR_CRITERIA_EQUAL:
+        return iter->comparator(node->key, iter->key1) <= 0;
+    case INDEXER_KEY_COMPARATOR_CRITERIA_BETWEEN:
+        return iter->comparator(node->key, iter->key2) <= 0;
+    default:
+        break;
+    }
+
+    return true;
+}
+
+static int8_t skiplist_iterator_destroy(iterator_t* iterator) {
+    skiplist_iterator_t* iter = (skiplist_iterator_t*)iterator->metadata;
+    memory_heap_t* heap = iter->heap;
+
+    memory_free_ext(heap, iter);
+    memory_free_ext(heap, iterator);
+
+    return 0;
+}
+
+static int8_t skiplist_iterator_end_of_index(iterator_t* iterator) {
+    skiplist_iterator_t* iter = (skiplist_iterator_t*)iterator->metadata;
+
+    return iter->current ? 1 : 0;
+}
+
+static iterator_t* skiplist_iterator_next(iterator_t* iterator) {
+    skiplist_iterator_t* iter = (skiplist_iterator_t*)iterator->metadata;
+
+    if(iter->current) {
+        iter->current = skiplist_node_next(iter->current, 0);
+
+        if(!skiplist_iterator_is_in_range(iter, iter->current)) {
+            iter->current = NULL;
+        }
+    }
+
+    return iterator;
+}
+
+static const void* skiplist_iterator_get_key(iterator_t* iterator) {
+    skiplist_iterator_t* iter = (skiplist_iterator_t*)iterator->metadata;
+
+    if(!iter->current) {
+        return NULL;
+    }
+
+    return __atomic_load_n(&iter->current->key, __ATOMIC_ACQUIRE);
+}
+
+static const void* skiplist_iterator_get_data(iterator_t* iterator) {
+    skiplist_iterator_t* iter = (skiplist_iterator_t*)iterator->metadata;
+
+    if(!iter->current) {
+        return NULL;
+    }
+
+    return __atomic_load_n(&iter->current->data, __ATOMIC_ACQUIRE);
+}
+
+static iterator_t* skiplist_search(index_t* idx, const void* key1, const void* key2, const index_key_search_criteria_t criteria) {
+    if(!idx || !idx->metadata) {
+        return NULL;
+    }
+
+    skiplist_t* sl = idx->metadata;
+
+    skiplist_iterator_t* iter = memory_malloc_ext(idx->heap, sizeof(skiplist_iterator_t), 0x0);
+
+    if(!iter) {
+        return NULL;
+    }
+
+    iter->heap = idx->heap;
+    iter->comparator = idx->comparator;
+    iter->criteria = criteria;
+    iter->key1 = key1;
+    iter->key2 = key2;
+
+    switch(criteria) {
+    case INDEXER_KEY_COMPARATOR_CRITERIA_EQUAL:
+    case INDEXER_KEY_COMPARATOR_CRITERIA_EQUALORGREATER:
+    case INDEXER_KEY_COMPARATOR_CRITERIA_BETWEEN:
+        iter->current = skiplist_lower_bound(idx, key1, false);
+        break;
+    case INDEXER_KEY_COMPARATOR_CRITERIA_GREATER:
+        iter->current = skiplist_lower_bound(idx, key1, true);
+        break;
+    default:
+        iter->current = skiplist_node_next(sl->head, 0);
+        break;
+    }
+
+    if(!skiplist_iterator_is_in_range(iter, iter->current)) {
+        iter->current = NULL;
+    }
+
+    iterator_t* iterator = memory_malloc_ext(idx->heap, sizeof(iterator_t), 0x0);
+
+    if(!iterator) {
+        memory_free_ext(idx->heap, iter);
+
+        return NULL;
+    }
+
+    iterator->metadata = iter;
+    iterator->destroy = &skiplist_iterator_destroy;
+    iterator->next = &skiplist_iterator_next;
+    iterator->end_of_iterator = &skiplist_iterator_end_of_index;
+    iterator->get_item = &skiplist_iterator_get_data;
+    iterator->delete_item = NULL;
+    iterator->get_extra_data = &skiplist_iterator_get_key;
+
+    return iterator;
+}
+
+static iterator_t* skiplist_create_iterator(index_t* idx) {
+    return skiplist_search(idx, NULL, NULL, INDEXER_KEY_COMPARATOR_CRITERIA_NULL);
+}
+
+index_t* skiplist_create_index_with_heap_and_unique(memory_heap_t* heap, uint64_t arena_chunk_size,
+                                                    index_key_comparator_f comparator, boolean_t unique) {
+    if(!comparator) {
+        return NULL;
+    }
+
+    heap = memory_get_heap(heap);
+
+    skiplist_t* sl = memory_malloc_ext(heap, sizeof(skiplist_t), 0);
+
+    if(!sl) {
+        return NULL;
+    }
+
+    index_t* idx = memory_malloc_ext(heap, sizeof(index_t), 0);
+
+    if(!idx) {
+        memory_free_ext(heap, sl);
+
+        return NULL;
+    }
+
+    sl->heap = heap;
+    sl->unique = unique;
+    sl->arena_chunk_size = arena_chunk_size ? arena_chunk_size : SKIPLIST_ARENA_CHUNK_SIZE;
+    sl->random_state = ((uint64_t)sl) | 1;
+
+    sl->head = skiplist_arena_alloc(sl, sizeof(skiplist_node_t) + sizeof(skiplist_node_t*) * SKIPLIST_MAX_HEIGHT);
+
+    if(!sl->head) {
+        memory_free_ext(heap, sl);
+        memory_free_ext(heap, idx);
+
+        return NULL;
+    }
+
+    sl->head->height = SKIPLIST_MAX_HEIGHT;
+
+    idx->comparator = comparator;
+    idx->heap = heap;
+    idx->metadata = sl;
+    idx->size = skiplist_size;
+    idx->insert = skiplist_insert;
+    idx->delete = skiplist_delete;
+    idx->find = skiplist_find;
+    idx->search = skiplist_search;
+    idx->create_iterator = skiplist_create_iterator;
+    idx->contains = skiplist_contains;
+
+    return idx;
+}
+
+int8_t skiplist_destroy_index(index_t* idx) {
+    if(!idx) {
+        return 0;
+    }
+
+    skiplist_t* sl = idx->metadata;
+
+    if(!sl) {
+        return -1;
+    }
+
+    skiplist_arena_chunk_t* chunk = sl->chunks;
+
+    while(chunk) {
+        skiplist_arena_chunk_t* next = chunk->next;
+
+        memory_free_ext(sl->heap, chunk);
+
+        chunk = next;
+    }
+
+    memory_free_ext(idx->heap, sl);
+    memory_free_ext(idx->heap, idx);
+
+    return 0;
+}
+
+int8_t skiplist_set_comparator_for_unique_subpart_for_non_unique_index(index_t* idx, index_key_comparator_f comparator) {
+    if(!idx || !idx->metadata) {
+        return -1;
+    }
+
+    skiplist_t* sl = idx->metadata;
+
+    if(sl->unique || skiplist_size(idx)) {
+        return -1;
+    }
+
+    sl->unique_subpart_comparator = comparator;
+
+    return 0;
+}
+
+void* skiplist_arena_malloc(index_t* idx, uint64_t size) {
+    if(!idx || !idx->metadata) {
+        return NULL;
+    }
+
+    return skiplist_arena_alloc(idx->metadata, size);
+}
+
+uint64_t skiplist_arena_size(index_t* idx) {
+    if(!idx || !idx->metadata) {
+        return 0;
+    }
+
+    skiplist_t* sl = idx->metadata;
+
+    return sl->arena_size;
+}
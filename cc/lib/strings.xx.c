@@ -14,37 +14,94 @@
 MODULE("turnstone.lib.strings");
 
 
+/*! vector type for 16 byte string blocks */
+typedef char strings_v16_t __attribute__((vector_size(16), may_alias));
+/*! unaligned vector type for 16 byte string blocks */
+typedef char strings_uv16_t __attribute__((vector_size(16), aligned(1), may_alias));
+
+/*! string blocks are not read across this boundary for not touching unmapped pages */
+#define STRINGS_PAGE_SIZE 0x1000
+
 size_t strlen(const char_t* string) {
     if(string == NULL) {
         return 0;
     }
 
-    size_t ret = 0;
+    // aligned 16 byte loads never cross a page, so reading bytes before string is safe
+    const strings_v16_t zero = {0};
+    const char_t* block = (const char_t*)((uint64_t)string & ~0xFULL);
+    uint32_t skip = (uint64_t)string & 0xF;
 
-    while(string[ret]) {
-        ret++;
+    uint32_t mask = (uint32_t)__builtin_ia32_pmovmskb128(*(const strings_v16_t*)block == zero);
+    mask >>= skip;
+
+    if(mask) {
+        return __builtin_ctz(mask);
     }
 
-    return ret;
+    while(true) {
+        block += 16;
+
+        mask = (uint32_t)__builtin_ia32_pmovmskb128(*(const strings_v16_t*)block == zero);
+
+        if(mask) {
+            return (size_t)(block - string) + __builtin_ctz(mask);
+        }
+    }
 }
 
 int8_t strcmp(const char_t* string1, const char_t* string2) {
-    size_t len1 = strlen(string1);
-    size_t len2 = strlen(string2);
+    // null strings are empty strings
+    if(string1 == NULL) {
+        string1 = "";
+    }
 
-    size_t minlen = MIN(len1, len2);
+    if(string2 == NULL) {
+        string2 = "";
+    }
 
-    int8_t res = memory_memcompare(string1, string2, minlen);
+    const uint8_t* s1 = (const uint8_t*)string1;
+    const uint8_t* s2 = (const uint8_t*)string2;
+    const strings_v16_t zero = {0};
 
-    if(res) {
-        return res;
-    }
+    while(true) {
+        // block compare only when both blocks are inside their pages
+        if(((uint64_t)s1 & (STRINGS_PAGE_SIZE - 1)) <= STRINGS_PAGE_SIZE - 16 &&
+           ((uint64_t)s2 & (STRINGS_PAGE_SIZE - 1)) <= STRINGS_PAGE_SIZE - 16) {
+            strings_v16_t a = *(const strings_uv16_t*)s1;
+            strings_v16_t b = *(const strings_uv16_t*)s2;
 
-    if(len1 == len2) {
-        return 0;
-    }
+            uint32_t diff = (uint32_t)__builtin_ia32_pmovmskb128(a != b);
+            uint32_t end = (uint32_t)__builtin_ia32_pmovmskb128(a == zero);
+            uint32_t stop = diff | end;
+
+            if(stop) {
+                uint32_t idx = __builtin_ctz(stop);
+
+                if(s1[idx] == s2[idx]) {
+                    return 0;
+                }
+
+                return s1[idx] < s2[idx] ? -1 : 1;
+            }
+
+            s1 += 16;
+            s2 += 16;
 
-    return (minlen == len1) ? -1 : 1;
+            continue;
+        }
+
+        if(*s1 != *s2) {
+            return *s1 < *s2 ? -1 : 1;
+        }
+
+        if(*s1 == 0) {
+            return 0;
+        }
+
+        s1++;
+        s2++;
+    }
 }
 
 int8_t strcopy(const char_t* source, char_t* destination){
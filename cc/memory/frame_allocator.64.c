@@ -17,20 +17,83 @@
 #include <memory/paging.h>
 #include <stdbufs.h>
 #include <logging.h>
+#include <apic.h>
+#include <utils.h>
 
 MODULE("turnstone.kernel.memory.frame");
 
+/*! largest buddy order, order 18 blocks are 1G */
+#define FRAME_ALLOCATOR_MAX_ORDER         18
+/*! level count limit of hierarchical free block bitmaps, enough for 2^48 bits */
+#define FRAME_ALLOCATOR_BITMAP_MAX_LEVEL  8
+/*! zone of frames under 4G */
+#define FRAME_ALLOCATOR_ZONE_DMA32        0
+/*! zone of frames above 4G */
+#define FRAME_ALLOCATOR_ZONE_NORMAL       1
+/*! zone count */
+#define FRAME_ALLOCATOR_ZONE_COUNT        2
+/*! end of dma32 zone */
+#define FRAME_ALLOCATOR_DMA32_END         0x100000000ULL
+/*! cpu count which has hot frame caches, other cpus use zones directly */
+#define FRAME_ALLOCATOR_PCP_MAX_CPU_COUNT 64
+/*! hot frame cache size per cpu */
+#define FRAME_ALLOCATOR_PCP_SIZE          64
+/*! frame count moved between zones and hot frame caches at once */
+#define FRAME_ALLOCATOR_PCP_BATCH         32
+/*! virtual address of window which released frames are cleaned through */
+#define FRAME_ALLOCATOR_CLEAN_WINDOW_VA     0x1000
+/*! frame count of cleaning window, window ends before smp trampoline at 0x8000 */
+#define FRAME_ALLOCATOR_CLEAN_WINDOW_FRAMES 7
+
+/**
+ * @struct frame_allocator_bitmap_t
+ * @brief hierarchical bitmap, each upper level bit marks a non zero lower level word
+ */
+typedef struct frame_allocator_bitmap_t {
+    uint64_t* levels[FRAME_ALLOCATOR_BITMAP_MAX_LEVEL]; ///< bitmap levels, level 0 is the real bitmap
+    uint8_t   level_count; ///< used level count, last level is one word
+} frame_allocator_bitmap_t;
+
+/**
+ * @struct frame_allocator_zone_t
+ * @brief buddy allocator of a physical address range
+ *
+ * free frames are not mapped, so free lists of each order are kept outside of frames as hierarchical bitmaps
+ * which give lowest free block of an order with a few word reads.
+ */
+typedef struct frame_allocator_zone_t {
+    lock_t*                  lock; ///< zone lock
+    uint64_t                 base; ///< zone start address, 1G aligned
+    uint64_t                 frame_count; ///< zone span as frame count, multiple of largest block
+    uint64_t                 free_frame_count; ///< free frame count inside zone
+    uint64_t*                used; ///< bitmap of frames not inside free blocks, holes are always set
+    uint64_t*                cached; ///< bitmap of frames inside hot frame caches, updated atomically
+    frame_allocator_bitmap_t free_blocks[FRAME_ALLOCATOR_MAX_ORDER + 1]; ///< free block heads of each order
+    uint64_t                 free_block_counts[FRAME_ALLOCATOR_MAX_ORDER + 1]; ///< free block counts of each order
+} frame_allocator_zone_t;
+
+/**
+ * @struct frame_allocator_pcp_t
+ * @brief per cpu hot frame cache for single frame allocations
+ */
+typedef struct frame_allocator_pcp_t {
+    uint64_t count; ///< cached frame count
+    uint64_t frames[FRAME_ALLOCATOR_PCP_SIZE]; ///< cached frame addresses
+} frame_allocator_pcp_t;
+
 typedef struct frame_allocator_context_t {
-    memory_heap_t* heap;
-    list_t*        free_frames_sorted_by_size;
-    list_t*        acpi_frames;
-    index_t*       free_frames_by_address;
-    index_t*       allocated_frames_by_address;
-    index_t*       reserved_frames_by_address;
-    lock_t*        lock;
-    uint64_t       total_frame_count;
-    uint64_t       free_frame_count;
-    uint64_t       allocated_frame_count;
+    memory_heap_t*          heap;
+    list_t*                 acpi_frames;
+    index_t*                reserved_frames_by_address;
+    lock_t*                 lock;
+    lock_t*                 clean_lock;
+    frame_allocator_zone_t* zones[FRAME_ALLOCATOR_ZONE_COUNT];
+    frame_allocator_pcp_t*  pcps;
+    frame_t*                usable_ranges;
+    uint64_t                usable_range_count;
+    uint64_t                total_frame_count;
+    uint64_t                free_frame_count;
+    uint64_t                allocated_frame_count;
 } frame_allocator_context_t;
 
 
@@ -82,619 +145,987 @@ int8_t frame_allocator_cmp_by_address(const void* data1, const void* data2){
     return 0;
 }
 
-uint64_t fa_get_total_frame_count(frame_allocator_t* self) {
-    if(self == NULL) {
-        return 0;
-    }
+static int8_t frame_allocator_bitmap_init(memory_heap_t* heap, frame_allocator_bitmap_t* bm, uint64_t bit_count) {
+    uint64_t bits = bit_count;
 
-    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+    bm->level_count = 0;
 
-    return ctx->total_frame_count;
+    do {
+        uint64_t words = (bits + 63) / 64;
+
+        if(bm->level_count == FRAME_ALLOCATOR_BITMAP_MAX_LEVEL) {
+            return -1;
+        }
+
+        bm->levels[bm->level_count] = memory_malloc_ext(heap, words * sizeof(uint64_t), 0);
+
+        if(bm->levels[bm->level_count] == NULL) {
+            return -1;
+        }
+
+        bm->level_count++;
+        bits = words;
+    } while(bits > 1);
+
+    return 0;
 }
 
-uint64_t fa_get_free_frame_count(frame_allocator_t* self) {
-    if(self == NULL) {
-        return 0;
-    }
+static inline boolean_t frame_allocator_bitmap_test(const frame_allocator_bitmap_t* bm, uint64_t idx) {
+    return (bm->levels[0][idx >> 6] >> (idx & 63)) & 1;
+}
 
-    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+static inline void frame_allocator_bitmap_set(frame_allocator_bitmap_t* bm, uint64_t idx) {
+    for(uint8_t l = 0; l < bm->level_count; l++) {
+        uint64_t w = idx >> 6;
+        uint64_t old = bm->levels[l][w];
 
-    return ctx->free_frame_count;
+        bm->levels[l][w] = old | (1ULL << (idx & 63));
+
+        // upper levels already know this word is not empty
+        if(old) {
+            break;
+        }
+
+        idx = w;
+    }
 }
 
-uint64_t fa_get_allocated_frame_count(frame_allocator_t* self) {
-    if(self == NULL) {
-        return 0;
+static inline void frame_allocator_bitmap_clear(frame_allocator_bitmap_t* bm, uint64_t idx) {
+    for(uint8_t l = 0; l < bm->level_count; l++) {
+        uint64_t w = idx >> 6;
+        uint64_t new = bm->levels[l][w] & ~(1ULL << (idx & 63));
+
+        bm->levels[l][w] = new;
+
+        if(new) {
+            break;
+        }
+
+        idx = w;
     }
+}
 
-    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+static inline int64_t frame_allocator_bitmap_find_first(const frame_allocator_bitmap_t* bm) {
+    uint64_t idx = 0;
 
-    return ctx->allocated_frame_count;
+    for(int16_t l = bm->level_count - 1; l >= 0; l--) {
+        uint64_t word = bm->levels[l][idx];
+
+        if(!word) {
+            return -1;
+        }
+
+        idx = idx * 64 + __builtin_ctzll(word);
+    }
+
+    return idx;
 }
 
-int8_t fa_reserve_system_frames(frame_allocator_t* self, frame_t* f){
-    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+static void frame_allocator_used_mark(uint64_t* used, uint64_t idx, uint64_t count, boolean_t set) {
+    while(count && (idx & 63)) {
+        if(set) {
+            used[idx >> 6] |= 1ULL << (idx & 63);
+        } else {
+            used[idx >> 6] &= ~(1ULL << (idx & 63));
+        }
 
-    lock_acquire(ctx->lock);
+        idx++;
+        count--;
+    }
 
-    uint64_t rem_frm_cnt = f->frame_count;
-    uint64_t rem_frm_start = f->frame_address;
+    while(count >= 64) {
+        used[idx >> 6] = set ? -1ULL : 0;
+        idx += 64;
+        count -= 64;
+    }
+
+    while(count) {
+        if(set) {
+            used[idx >> 6] |= 1ULL << (idx & 63);
+        } else {
+            used[idx >> 6] &= ~(1ULL << (idx & 63));
+        }
 
+        idx++;
+        count--;
+    }
+}
 
+static uint64_t frame_allocator_used_run(const uint64_t* used, uint64_t idx, uint64_t max_count, boolean_t set) {
+    uint64_t run = 0;
 
-    while(rem_frm_cnt) {
+    while(run < max_count) {
+        uint64_t word = used[idx >> 6];
 
-        frame_t search_frm = {rem_frm_start, 1, 0, 0};
+        if(!set) {
+            word = ~word;
+        }
 
-        frame_t* frm = (frame_t*)ctx->reserved_frames_by_address->find(ctx->reserved_frames_by_address, &search_frm);
+        word >>= idx & 63;
 
-        if(frm == NULL) {
-            break;
+        uint64_t avail = 64 - (idx & 63);
+        uint64_t ones = (~word == 0) ? 64 : __builtin_ctzll(~word);
+
+        if(ones > avail) {
+            ones = avail;
         }
 
-        if(frm->frame_address <= rem_frm_start && rem_frm_cnt <= frm->frame_count) {
-            lock_release(ctx->lock);
-            PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "frame inside reserved area");
+        run += ones;
+        idx += ones;
 
-            return 0;
+        if(ones < avail) {
+            break;
         }
+    }
 
-        uint64_t frm_alloc_cnt = (rem_frm_start - frm->frame_address) / FRAME_SIZE;
-        frm_alloc_cnt = frm->frame_count - frm_alloc_cnt;
+    return run < max_count ? run : max_count;
+}
 
-        rem_frm_start += frm_alloc_cnt * FRAME_SIZE;
-        rem_frm_cnt -= frm_alloc_cnt;
+static boolean_t frame_allocator_cached_mark(frame_allocator_zone_t* zone, uint64_t idx, boolean_t set) {
+    uint64_t mask = 1ULL << (idx & 63);
+    uint64_t old;
+
+    // hot frame caches change it without zone lock
+    if(set) {
+        old = __atomic_fetch_or(&zone->cached[idx >> 6], mask, __ATOMIC_ACQ_REL);
+    } else {
+        old = __atomic_fetch_and(&zone->cached[idx >> 6], ~mask, __ATOMIC_ACQ_REL);
     }
 
+    return (old & mask) != 0;
+}
 
-    while(rem_frm_cnt) {
-        PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "remaining frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
+static frame_allocator_zone_t* frame_allocator_zone_create(memory_heap_t* heap, uint64_t base, uint64_t end) {
+    uint64_t block_size = (1ULL << FRAME_ALLOCATOR_MAX_ORDER) * FRAME_SIZE;
+    uint64_t frame_count = ((end - base + block_size - 1) / block_size) * (block_size / FRAME_SIZE);
 
-        frame_t search_frm = {rem_frm_start, 1, 0, 0};
+    frame_allocator_zone_t* zone = memory_malloc_ext(heap, sizeof(frame_allocator_zone_t), 0);
 
-        frame_t* frm = (frame_t*)ctx->free_frames_by_address->find(ctx->free_frames_by_address, &search_frm);
+    if(zone == NULL) {
+        return NULL;
+    }
 
-        if(frm == NULL) {
-            frame_t* new_r_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    zone->base = base;
+    zone->frame_count = frame_count;
+    zone->lock = lock_create_with_heap(heap);
+    zone->used = memory_malloc_ext(heap, (frame_count / 64) * sizeof(uint64_t), 0);
+    zone->cached = memory_malloc_ext(heap, (frame_count / 64) * sizeof(uint64_t), 0);
 
-            if(new_r_frm == NULL) {
-                PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
-                cpu_hlt();
-            }
+    if(zone->lock == NULL || zone->used == NULL || zone->cached == NULL) {
+        return NULL;
+    }
 
-            new_r_frm->frame_address = rem_frm_start;
-            new_r_frm->frame_count = rem_frm_cnt;
-            new_r_frm->type = FRAME_TYPE_RESERVED;
-            ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_r_frm, new_r_frm, NULL);
+    // frames become free only when memory map says so
+    memory_memset(zone->used, 0xFF, (frame_count / 64) * sizeof(uint64_t));
+    memory_memclean(zone->cached, (frame_count / 64) * sizeof(uint64_t));
 
-            PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "no used frame found, inserted into reserveds, frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
+    for(uint8_t o = 0; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+        if(frame_allocator_bitmap_init(heap, &zone->free_blocks[o], frame_count >> o) != 0) {
+            return NULL;
+        }
+    }
 
+    return zone;
+}
+
+static void frame_allocator_zone_free_block(frame_allocator_zone_t* zone, uint64_t idx, uint8_t order) {
+    while(order < FRAME_ALLOCATOR_MAX_ORDER) {
+        uint64_t buddy = idx ^ (1ULL << order);
+
+        if(!frame_allocator_bitmap_test(&zone->free_blocks[order], buddy >> order)) {
             break;
         }
 
-        PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "area inside free frames, frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
+        frame_allocator_bitmap_clear(&zone->free_blocks[order], buddy >> order);
+        zone->free_block_counts[order]--;
 
-        uint64_t frm_alloc_cnt = (rem_frm_start - frm->frame_address) / FRAME_SIZE;
-        frm_alloc_cnt = frm->frame_count - frm_alloc_cnt;
+        idx &= ~(1ULL << order);
+        order++;
+    }
 
-        frame_t new_frm = {rem_frm_start, 0, FRAME_TYPE_RESERVED, 0};
+    frame_allocator_bitmap_set(&zone->free_blocks[order], idx >> order);
+    zone->free_block_counts[order]++;
+}
 
-        if(frm_alloc_cnt < rem_frm_cnt) {
-            new_frm.frame_count = frm_alloc_cnt;
-            rem_frm_cnt -= frm_alloc_cnt;
-            rem_frm_start += frm_alloc_cnt * FRAME_SIZE;
-        } else {
-            new_frm.frame_count = rem_frm_cnt;
-            rem_frm_cnt = 0;
+static void frame_allocator_zone_free_frames(frame_allocator_zone_t* zone, uint64_t idx, uint64_t count) {
+    zone->free_frame_count += count;
+
+    while(count) {
+        uint8_t order = idx ? __builtin_ctzll(idx) : FRAME_ALLOCATOR_MAX_ORDER;
+
+        if(order > FRAME_ALLOCATOR_MAX_ORDER) {
+            order = FRAME_ALLOCATOR_MAX_ORDER;
+        }
+
+        while((1ULL << order) > count) {
+            order--;
         }
 
-        self->allocate_frame(self, &new_frm);
+        frame_allocator_zone_free_block(zone, idx, order);
+
+        idx += 1ULL << order;
+        count -= 1ULL << order;
     }
+}
 
-    lock_release(ctx->lock);
+static int64_t frame_allocator_zone_alloc_block(frame_allocator_zone_t* zone, uint8_t order) {
+    for(uint8_t o = order; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+        int64_t block = frame_allocator_bitmap_find_first(&zone->free_blocks[o]);
 
+        if(block < 0) {
+            continue;
+        }
 
-    return 0;
-}
+        frame_allocator_bitmap_clear(&zone->free_blocks[o], block);
+        zone->free_block_counts[o]--;
 
+        uint64_t idx = (uint64_t)block << o;
 
-int8_t fa_allocate_frame_by_count(frame_allocator_t* self, uint64_t count, frame_allocation_type_t fa_type, frame_t** fs, uint64_t* alloc_list_size) {
-    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+        // put upper halves back while splitting down to requested order
+        while(o > order) {
+            o--;
+            frame_allocator_bitmap_set(&zone->free_blocks[o], (idx + (1ULL << o)) >> o);
+            zone->free_block_counts[o]++;
+        }
 
+        zone->free_frame_count -= 1ULL << order;
 
-    lock_acquire(ctx->lock);
+        return idx;
+    }
 
-    if(fa_type & FRAME_ALLOCATION_TYPE_RELAX) {
+    return -1;
+}
 
-    } else if(fa_type & FRAME_ALLOCATION_TYPE_BLOCK) {
-        iterator_t* iter = list_iterator_create(ctx->free_frames_sorted_by_size);
+static int64_t frame_allocator_zone_alloc_frames(frame_allocator_zone_t* zone, uint64_t count) {
+    int64_t idx = -1;
+    uint64_t size = 0;
 
-        if(iter == NULL) {
-            lock_release(ctx->lock);
-            PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot list free frames");
+    if(count <= (1ULL << FRAME_ALLOCATOR_MAX_ORDER)) {
+        uint8_t order = 0;
 
-            return -1;
+        while((1ULL << order) < count) {
+            order++;
         }
 
-        frame_t* tmp_frm = NULL;
+        idx = frame_allocator_zone_alloc_block(zone, order);
+        size = 1ULL << order;
+    } else {
+        // bigger than largest block, look for adjacent free largest blocks
+        frame_allocator_bitmap_t* bm = &zone->free_blocks[FRAME_ALLOCATOR_MAX_ORDER];
+        uint64_t block_count = (count + (1ULL << FRAME_ALLOCATOR_MAX_ORDER) - 1) >> FRAME_ALLOCATOR_MAX_ORDER;
+        uint64_t bit_count = zone->frame_count >> FRAME_ALLOCATOR_MAX_ORDER;
+        uint64_t run = 0;
 
-        while(iter->end_of_iterator(iter) != 0) {
-            frame_t* item = (frame_t*)iter->get_item(iter);
+        for(uint64_t i = 0; i < bit_count; i++) {
+            run = frame_allocator_bitmap_test(bm, i) ? run + 1 : 0;
 
-            if(item->frame_count >= count) {
-                if(fa_type & FRAME_ALLOCATION_TYPE_UNDER_4G) {
-                    if(item->frame_address + count * FRAME_SIZE >= 0x100000000) {
-                        iter->next(iter);
+            if(run == block_count) {
+                uint64_t first = i + 1 - block_count;
 
-                        continue;
-                    }
+                for(uint64_t b = first; b <= i; b++) {
+                    frame_allocator_bitmap_clear(bm, b);
+                    zone->free_block_counts[FRAME_ALLOCATOR_MAX_ORDER]--;
                 }
 
-                if(count % 0x200 == 0) {
-                    if(item->frame_address % MEMORY_PAGING_PAGE_LENGTH_2M == 0) { // fast hit
-                        iter->delete_item(iter);
-                        ctx->free_frames_by_address->delete(ctx->free_frames_by_address, item, NULL);
-                        tmp_frm = item;
+                idx = first << FRAME_ALLOCATOR_MAX_ORDER;
+                size = block_count << FRAME_ALLOCATOR_MAX_ORDER;
+                zone->free_frame_count -= size;
 
-                        break;
-                    } else {
-                        // we need check fit with alignment
-                        uint64_t begin_rem = item->frame_address % MEMORY_PAGING_PAGE_LENGTH_2M;
-                        uint64_t begin_rem_f_cnt = begin_rem / FRAME_SIZE;
+                break;
+            }
+        }
+    }
 
-                        if(item->frame_count >= count + begin_rem_f_cnt) {
-                            iter->delete_item(iter);
-                            ctx->free_frames_by_address->delete(ctx->free_frames_by_address, item, NULL);
+    if(idx < 0) {
+        return -1;
+    }
 
-                            // we found, but we need to re-insert begining to free frames
-                            frame_t* new_begin_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    if(size > count) {
+        frame_allocator_zone_free_frames(zone, idx + count, size - count);
+    }
 
-                            if(new_begin_frm == NULL) {
-                                PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
-                                cpu_hlt();
-                            }
+    frame_allocator_used_mark(zone->used, idx, count, true);
 
-                            new_begin_frm->frame_address = item->frame_address;
-                            new_begin_frm->frame_count = begin_rem_f_cnt;
+    return idx;
+}
 
-                            list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_begin_frm);
-                            ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_begin_frm, new_begin_frm, NULL);
+static int8_t frame_allocator_zone_claim_frames(frame_allocator_zone_t* zone, uint64_t idx, uint64_t count) {
+    if(frame_allocator_used_run(zone->used, idx, count, false) != count) {
+        return -1;
+    }
 
-                            item->frame_address += begin_rem_f_cnt * FRAME_SIZE;
-                            item->frame_count -= begin_rem_f_cnt;
+    uint64_t end = idx + count;
+    uint64_t pos = idx;
 
-                            tmp_frm = item;
+    while(pos < end) {
+        uint8_t o;
 
-                            break;
-                        }
+        for(o = 0; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+            if(frame_allocator_bitmap_test(&zone->free_blocks[o], pos >> o)) {
+                break;
+            }
+        }
 
+        if(o > FRAME_ALLOCATOR_MAX_ORDER) {
+            PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "free frame 0x%llx is not inside a free block", zone->base + pos * FRAME_SIZE);
 
-                    }
+            return -1;
+        }
 
-                } else {
-                    iter->delete_item(iter);
-                    ctx->free_frames_by_address->delete(ctx->free_frames_by_address, item, NULL);
-                    tmp_frm = item;
+        uint64_t block_start = (pos >> o) << o;
+        uint64_t block_end = block_start + (1ULL << o);
 
-                    break;
-                }
-            }
+        frame_allocator_bitmap_clear(&zone->free_blocks[o], pos >> o);
+        zone->free_block_counts[o]--;
+        zone->free_frame_count -= 1ULL << o;
 
-            iter = iter->next(iter);
+        // give back parts of the block outside of the range
+        if(block_start < pos) {
+            frame_allocator_zone_free_frames(zone, block_start, pos - block_start);
         }
 
-        iter->destroy(iter);
+        if(block_end > end) {
+            frame_allocator_zone_free_frames(zone, end, block_end - end);
+        }
 
-        if(tmp_frm == NULL) {
-            lock_release(ctx->lock);
-            PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot find free frames with count 0x%llx", count);
+        pos = block_end < end ? block_end : end;
+    }
 
-            return -1;
-        }
+    frame_allocator_used_mark(zone->used, idx, count, true);
 
-        if(alloc_list_size) {
-            *alloc_list_size = 1;
+    return 0;
+}
+
+static frame_allocator_zone_t* frame_allocator_zone_of(frame_allocator_context_t* ctx, uint64_t address, uint64_t count) {
+    for(uint8_t z = 0; z < FRAME_ALLOCATOR_ZONE_COUNT; z++) {
+        frame_allocator_zone_t* zone = ctx->zones[z];
+
+        if(zone == NULL || address < zone->base) {
+            continue;
         }
 
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+        uint64_t idx = (address - zone->base) / FRAME_SIZE;
 
-        if(new_frm == NULL) {
-            PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
-            cpu_hlt();
+        if(idx + count <= zone->frame_count) {
+            return zone;
         }
+    }
+
+    return NULL;
+}
 
-        uint64_t rem_frms = tmp_frm->frame_count - count;
+static boolean_t frame_allocator_is_usable(frame_allocator_context_t* ctx, uint64_t address, uint64_t count) {
+    for(uint64_t i = 0; i < ctx->usable_range_count; i++) {
+        frame_t* r = &ctx->usable_ranges[i];
+
+        if(r->frame_address <= address && address + count * FRAME_SIZE <= r->frame_address + r->frame_count * FRAME_SIZE) {
+            return true;
+        }
+    }
 
-        new_frm->frame_address = tmp_frm->frame_address;
-        new_frm->frame_count = count;
-        new_frm->frame_attributes = tmp_frm->frame_attributes;
+    return false;
+}
 
-        ctx->allocated_frame_count += count;
-        ctx->free_frame_count -= count;
+static int8_t frame_allocator_alloc_from_zones(frame_allocator_context_t* ctx, uint64_t count, boolean_t under_4g, uint64_t* address) {
+    // keep dma32 zone for devices as long as possible
+    for(int32_t z = FRAME_ALLOCATOR_ZONE_COUNT - 1; z >= 0; z--) {
+        frame_allocator_zone_t* zone = ctx->zones[z];
 
-        if(fa_type & FRAME_ALLOCATION_TYPE_OLD_RESERVED) {
-            new_frm->frame_attributes |= FRAME_ATTRIBUTE_OLD_RESERVED;
+        if(zone == NULL || (under_4g && z != FRAME_ALLOCATOR_ZONE_DMA32)) {
+            continue;
         }
 
-        *fs = new_frm;
+        lock_acquire(zone->lock);
+        int64_t idx = frame_allocator_zone_alloc_frames(zone, count);
+        lock_release(zone->lock);
 
-        if(fa_type & FRAME_ALLOCATION_TYPE_RESERVED) {
-            new_frm->type = FRAME_TYPE_RESERVED;
-            ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_frm, new_frm, NULL);
-        } else {
-            new_frm->type = FRAME_TYPE_USED;
-            ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, new_frm, new_frm, NULL);
+        if(idx >= 0) {
+            *address = zone->base + idx * FRAME_SIZE;
+
+            return 0;
         }
+    }
 
+    return -1;
+}
 
-        if(rem_frms) {
-            frame_t* free_rem_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+static int8_t frame_allocator_free_to_zones(frame_allocator_context_t* ctx, uint64_t address, uint64_t count) {
+    frame_allocator_zone_t* zone = frame_allocator_zone_of(ctx, address, count);
 
-            if(free_rem_frm == NULL) {
-                PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
-                cpu_hlt();
+    if(zone == NULL) {
+        return -1;
+    }
+
+    uint64_t idx = (address - zone->base) / FRAME_SIZE;
+
+    lock_acquire(zone->lock);
+
+    if(frame_allocator_used_run(zone->used, idx, count, true) != count) {
+        lock_release(zone->lock);
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "frames are not allocated 0x%llx 0x%llx", address, count);
+
+        return -1;
+    }
+
+    frame_allocator_used_mark(zone->used, idx, count, false);
+    frame_allocator_zone_free_frames(zone, idx, count);
+
+    lock_release(zone->lock);
+
+    return 0;
+}
+
+static void frame_allocator_free_frames_to_zones(frame_allocator_context_t* ctx, const uint64_t* frames, uint64_t count) {
+    for(uint8_t z = 0; z < FRAME_ALLOCATOR_ZONE_COUNT; z++) {
+        frame_allocator_zone_t* zone = ctx->zones[z];
+
+        if(zone == NULL) {
+            continue;
+        }
+
+        lock_acquire(zone->lock);
+
+        for(uint64_t i = 0; i < count; i++) {
+            if(frames[i] < zone->base || frames[i] >= zone->base + zone->frame_count * FRAME_SIZE) {
+                continue;
             }
 
-            free_rem_frm->frame_address = tmp_frm->frame_address + count * FRAME_SIZE;
-            free_rem_frm->frame_count = rem_frms;
-            free_rem_frm->type = FRAME_TYPE_FREE;
-            free_rem_frm->frame_attributes = tmp_frm->frame_attributes;
+            uint64_t idx = (frames[i] - zone->base) / FRAME_SIZE;
 
-            ctx->free_frames_by_address->insert(ctx->free_frames_by_address, free_rem_frm, free_rem_frm, NULL);
-            list_sortedlist_insert(ctx->free_frames_sorted_by_size, free_rem_frm);
+            frame_allocator_used_mark(zone->used, idx, 1, false);
+            frame_allocator_cached_mark(zone, idx, false);
+            frame_allocator_zone_free_frames(zone, idx, 1);
         }
 
-        memory_free_ext(ctx->heap, tmp_frm);
+        lock_release(zone->lock);
+    }
+}
 
-        lock_release(ctx->lock);
+static int8_t frame_allocator_pcp_alloc(frame_allocator_context_t* ctx, uint64_t* address) {
+    boolean_t intflag = cpu_cli();
+    uint64_t cpu_id = apic_get_local_apic_id();
 
-        return 0;
-    } else {
-        lock_release(ctx->lock);
-        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "unknown alloctation type for frames 0x%x", fa_type);
+    if(cpu_id >= FRAME_ALLOCATOR_PCP_MAX_CPU_COUNT) {
+        if(intflag) {
+            cpu_sti();
+        }
 
-        return -1;
+        return frame_allocator_alloc_from_zones(ctx, 1, false, address);
     }
 
-    lock_release(ctx->lock);
+    frame_allocator_pcp_t* pcp = &ctx->pcps[cpu_id];
 
-    PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "Should never hit");
+    if(pcp->count) {
+        *address = pcp->frames[--pcp->count];
 
-    return -1;
-}
+        frame_allocator_zone_t* zone = frame_allocator_zone_of(ctx, *address, 1);
 
-int8_t fa_allocate_frame(frame_allocator_t* self, frame_t* f) {
-    if(self == NULL) {
-        return -1;
+        frame_allocator_cached_mark(zone, (*address - zone->base) / FRAME_SIZE, false);
+
+        if(intflag) {
+            cpu_sti();
+        }
+
+        return 0;
     }
 
-    frame_allocator_context_t* ctx = self->context;
+    if(intflag) {
+        cpu_sti();
+    }
 
-    lock_acquire(ctx->lock);
+    // refill without interrupts disabled, zone locks may park the task
+    uint64_t batch[FRAME_ALLOCATOR_PCP_BATCH];
+    uint64_t batch_count = 0;
 
-    frame_t* frm = (frame_t*)ctx->free_frames_by_address->find(ctx->free_frames_by_address, f);
+    for(int32_t z = FRAME_ALLOCATOR_ZONE_COUNT - 1; z >= 0 && batch_count < FRAME_ALLOCATOR_PCP_BATCH; z--) {
+        frame_allocator_zone_t* zone = ctx->zones[z];
 
-    if(frm == NULL) {
-        lock_release(ctx->lock);
-        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "frame not found 0x%llx 0x%llx", f->frame_address, f->frame_count);
+        if(zone == NULL) {
+            continue;
+        }
+
+        lock_acquire(zone->lock);
+
+        while(batch_count < FRAME_ALLOCATOR_PCP_BATCH) {
+            int64_t idx = frame_allocator_zone_alloc_block(zone, 0);
 
+            if(idx < 0) {
+                break;
+            }
+
+            frame_allocator_used_mark(zone->used, idx, 1, true);
+            batch[batch_count++] = zone->base + idx * FRAME_SIZE;
+        }
+
+        lock_release(zone->lock);
+    }
+
+    if(batch_count == 0) {
         return -1;
     }
 
-    uint64_t rem_frms = frm->frame_count;
+    *address = batch[0];
 
-    list_sortedlist_delete(ctx->free_frames_sorted_by_size, frm);
-    ctx->free_frames_by_address->delete(ctx->free_frames_by_address, frm, NULL);
+    intflag = cpu_cli();
+    // task may be moved to another cpu while refilling
+    cpu_id = apic_get_local_apic_id();
 
-    if(frm->frame_address < f->frame_address) {
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    uint64_t i = 1;
 
-        if(new_frm == NULL) {
-            lock_release(ctx->lock);
-            return -1;
+    if(cpu_id < FRAME_ALLOCATOR_PCP_MAX_CPU_COUNT) {
+        pcp = &ctx->pcps[cpu_id];
+
+        while(i < batch_count && pcp->count < FRAME_ALLOCATOR_PCP_SIZE) {
+            frame_allocator_zone_t* zone = frame_allocator_zone_of(ctx, batch[i], 1);
+
+            frame_allocator_cached_mark(zone, (batch[i] - zone->base) / FRAME_SIZE, true);
+            pcp->frames[pcp->count++] = batch[i++];
         }
+    }
+
+    if(intflag) {
+        cpu_sti();
+    }
 
-        new_frm->frame_address = frm->frame_address;
-        new_frm->frame_count = (f->frame_address - frm->frame_address) / FRAME_SIZE;
-        new_frm->type = FRAME_TYPE_FREE;
-        new_frm->frame_attributes = frm->frame_attributes;
+    if(i < batch_count) {
+        frame_allocator_free_frames_to_zones(ctx, batch + i, batch_count - i);
+    }
 
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_frm);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_frm, new_frm, NULL);
+    return 0;
+}
 
-        rem_frms -= new_frm->frame_count;
+static boolean_t frame_allocator_pcp_free(frame_allocator_context_t* ctx, uint64_t address) {
+    boolean_t intflag = cpu_cli();
+    uint64_t cpu_id = apic_get_local_apic_id();
+
+    if(cpu_id >= FRAME_ALLOCATOR_PCP_MAX_CPU_COUNT || frame_allocator_zone_of(ctx, address, 1) == NULL) {
+        if(intflag) {
+            cpu_sti();
+        }
+
+        return false;
     }
 
-    rem_frms -= f->frame_count;
+    frame_allocator_pcp_t* pcp = &ctx->pcps[cpu_id];
 
-    if(rem_frms) {
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    if(pcp->count < FRAME_ALLOCATOR_PCP_SIZE) {
+        pcp->frames[pcp->count++] = address;
 
-        if(new_frm == NULL) {
-            lock_release(ctx->lock);
-            return -1;
+        if(intflag) {
+            cpu_sti();
         }
 
-        new_frm->frame_address = f->frame_address + f->frame_count * FRAME_SIZE;
-        new_frm->frame_count = rem_frms;
-        new_frm->type = FRAME_TYPE_FREE;
-        new_frm->frame_attributes = frm->frame_attributes;
+        return true;
+    }
+
+    // cache is full, oldest frames go back to zones for merging
+    uint64_t batch[FRAME_ALLOCATOR_PCP_BATCH];
+
+    memory_memcopy(pcp->frames, batch, sizeof(batch));
+    memory_memcopy(pcp->frames + FRAME_ALLOCATOR_PCP_BATCH, pcp->frames, (FRAME_ALLOCATOR_PCP_SIZE - FRAME_ALLOCATOR_PCP_BATCH) * sizeof(uint64_t));
+    pcp->count -= FRAME_ALLOCATOR_PCP_BATCH;
+    pcp->frames[pcp->count++] = address;
 
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_frm);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_frm, new_frm, NULL);
+    if(intflag) {
+        cpu_sti();
     }
 
+    frame_allocator_free_frames_to_zones(ctx, batch, FRAME_ALLOCATOR_PCP_BATCH);
 
-    frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    return true;
+}
 
-    if(new_frm == NULL) {
-        lock_release(ctx->lock);
+static void frame_allocator_clean_frames(frame_allocator_context_t* ctx, uint64_t address, uint64_t count) {
+    // cleaning window is shared
+    lock_acquire(ctx->clean_lock);
+
+#if ___KERNELBUILD == 1
+    while(count) {
+        frame_t window = {.frame_address = address, .frame_count = MIN(count, (uint64_t)FRAME_ALLOCATOR_CLEAN_WINDOW_FRAMES)};
+
+        // whole window is unmapped with one tlb shootdown
+        memory_paging_add_va_for_frame(FRAME_ALLOCATOR_CLEAN_WINDOW_VA, &window, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
+        memory_memclean((void*)FRAME_ALLOCATOR_CLEAN_WINDOW_VA, window.frame_count * FRAME_SIZE);
+        memory_paging_delete_va_for_frame(FRAME_ALLOCATOR_CLEAN_WINDOW_VA, &window);
+
+        address += window.frame_count * FRAME_SIZE;
+        count -= window.frame_count;
+    }
+#else
+    // frames of local builds are process memory
+    memory_memclean((void*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(address), count * FRAME_SIZE);
+#endif
+
+    lock_release(ctx->clean_lock);
+}
+
+static int8_t frame_allocator_insert_reserved(frame_allocator_context_t* ctx, uint64_t address, uint64_t count, frame_type_t type, uint64_t attributes) {
+    frame_t* r_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+
+    if(r_frm == NULL) {
         return -1;
     }
 
-    new_frm->frame_address = f->frame_address;
-    new_frm->frame_count = f->frame_count;
-    new_frm->type = f->type != FRAME_TYPE_FREE?f->type:FRAME_TYPE_USED;
-    new_frm->frame_attributes = f->frame_attributes?f->frame_attributes:frm->frame_attributes;
+    r_frm->frame_address = address;
+    r_frm->frame_count = count;
+    r_frm->type = type;
+    r_frm->frame_attributes = attributes;
 
-    ctx->allocated_frame_count += new_frm->frame_count;
-    ctx->free_frame_count -= new_frm->frame_count;
+    return ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, r_frm, r_frm, NULL);
+}
 
-    if(new_frm->type == FRAME_TYPE_USED) {
-        ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, new_frm, new_frm, NULL);
-    } else {
-        ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_frm, new_frm, NULL);
+uint64_t fa_get_total_frame_count(frame_allocator_t* self) {
+    if(self == NULL) {
+        return 0;
     }
 
-    memory_free_ext(ctx->heap, frm);
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+
+    return ctx->total_frame_count;
+}
 
-    lock_release(ctx->lock);
+uint64_t fa_get_free_frame_count(frame_allocator_t* self) {
+    if(self == NULL) {
+        return 0;
+    }
 
-    return 0;
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+
+    return ctx->free_frame_count;
 }
 
-int8_t fa_release_frame(frame_allocator_t* self, frame_t* f) {
+uint64_t fa_get_allocated_frame_count(frame_allocator_t* self) {
     if(self == NULL) {
-        return -1;
+        return 0;
     }
 
-    frame_allocator_context_t* ctx = self->context;
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+
+    return ctx->allocated_frame_count;
+}
+
+int8_t fa_reserve_system_frames(frame_allocator_t* self, frame_t* f){
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
 
     lock_acquire(ctx->lock);
 
-    const frame_t* tmp_frame = ctx->allocated_frames_by_address->find(ctx->allocated_frames_by_address, f);
+    uint64_t rem_frm_cnt = f->frame_count;
+    uint64_t rem_frm_start = f->frame_address;
 
-    if(tmp_frame) {
 
-        ctx->allocated_frames_by_address->delete(ctx->allocated_frames_by_address, tmp_frame, NULL);
 
-        uint64_t rem_frms = tmp_frame->frame_count - f->frame_count;
+    while(rem_frm_cnt) {
 
-        if(tmp_frame->frame_address < f->frame_address) {
-            uint64_t prev_frm_count = (f->frame_address - tmp_frame->frame_address) / FRAME_SIZE;
+        frame_t search_frm = {rem_frm_start, 1, 0, 0};
 
-            frame_t* prev_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+        frame_t* frm = (frame_t*)ctx->reserved_frames_by_address->find(ctx->reserved_frames_by_address, &search_frm);
 
-            if(prev_frm == NULL) {
-                lock_release(ctx->lock);
-                return -1;
-            }
-            prev_frm->frame_address = tmp_frame->frame_address;
-            prev_frm->frame_count = prev_frm_count;
-            prev_frm->type = FRAME_TYPE_USED;
-            prev_frm->frame_attributes = tmp_frame->frame_attributes;
+        if(frm == NULL) {
+            break;
+        }
 
-            ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, prev_frm, prev_frm, NULL);
+        if(frm->frame_address <= rem_frm_start && rem_frm_cnt <= frm->frame_count) {
+            lock_release(ctx->lock);
+            PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "frame inside reserved area");
 
-            rem_frms -= prev_frm_count;
+            return 0;
         }
 
-        if(rem_frms) {
-            frame_t* next_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+        uint64_t frm_alloc_cnt = (rem_frm_start - frm->frame_address) / FRAME_SIZE;
+        frm_alloc_cnt = frm->frame_count - frm_alloc_cnt;
+
+        rem_frm_start += frm_alloc_cnt * FRAME_SIZE;
+        rem_frm_cnt -= frm_alloc_cnt;
+    }
 
-            if(next_frm == NULL) {
-                lock_release(ctx->lock);
-                return -1;
+
+    while(rem_frm_cnt) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "remaining frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
+
+        frame_allocator_zone_t* zone = frame_allocator_zone_of(ctx, rem_frm_start, 1);
+        uint64_t free_cnt = 0;
+
+        if(zone) {
+            uint64_t idx = (rem_frm_start - zone->base) / FRAME_SIZE;
+            uint64_t max_cnt = zone->frame_count - idx;
+
+            if(max_cnt > rem_frm_cnt) {
+                max_cnt = rem_frm_cnt;
+            }
+
+            lock_acquire(zone->lock);
+
+            free_cnt = frame_allocator_used_run(zone->used, idx, max_cnt, false);
+
+            if(free_cnt && frame_allocator_zone_claim_frames(zone, idx, free_cnt) != 0) {
+                free_cnt = 0;
             }
-            next_frm->frame_address = f->frame_address + f->frame_count * FRAME_SIZE;
-            next_frm->frame_count = rem_frms;
-            next_frm->type = FRAME_TYPE_USED;
-            next_frm->frame_attributes = tmp_frame->frame_attributes;
 
-            ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, next_frm, next_frm, NULL);
+            lock_release(zone->lock);
         }
 
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+        if(free_cnt == 0) {
+            if(frame_allocator_insert_reserved(ctx, rem_frm_start, rem_frm_cnt, FRAME_TYPE_RESERVED, 0) != 0) {
+                PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
+                cpu_hlt();
+            }
 
-        if(new_frm == NULL) {
-            lock_release(ctx->lock);
-            return -1;
+            PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "no used frame found, inserted into reserveds, frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
+
+            break;
         }
 
-        new_frm->frame_address = f->frame_address;
-        new_frm->frame_count = f->frame_count;
-        new_frm->type = FRAME_TYPE_FREE;
-        new_frm->frame_attributes = tmp_frame->frame_attributes;
+        PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "area inside free frames, frame start 0x%llx count 0x%llx", rem_frm_start, free_cnt);
+
+        __atomic_sub_fetch(&ctx->free_frame_count, free_cnt, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&ctx->allocated_frame_count, free_cnt, __ATOMIC_RELAXED);
+
+        if(frame_allocator_insert_reserved(ctx, rem_frm_start, free_cnt, FRAME_TYPE_RESERVED, 0) != 0) {
+            PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
+            cpu_hlt();
+        }
+
+        rem_frm_start += free_cnt * FRAME_SIZE;
+        rem_frm_cnt -= free_cnt;
+    }
+
+    lock_release(ctx->lock);
+
+
+    return 0;
+}
+
+
+int8_t fa_allocate_frame_by_count(frame_allocator_t* self, uint64_t count, frame_allocation_type_t fa_type, frame_t** fs, uint64_t* alloc_list_size) {
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+
+    if((fa_type & FRAME_ALLOCATION_TYPE_RELAX) || !(fa_type & FRAME_ALLOCATION_TYPE_BLOCK)) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "unknown alloctation type for frames 0x%x", fa_type);
+
+        return -1;
+    }
 
-        ctx->allocated_frame_count -= new_frm->frame_count;
-        ctx->free_frame_count += new_frm->frame_count;
+    if(count == 0) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot allocate zero frames");
 
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
-        }
+        return -1;
+    }
 
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_frm, new_frm, NULL);
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_frm);
+    frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
 
-        memory_free_ext(ctx->heap, (void*)tmp_frame);
+    if(new_frm == NULL) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
+        cpu_hlt();
+    }
 
-        lock_release(ctx->lock);
+    boolean_t under_4g = (fa_type & FRAME_ALLOCATION_TYPE_UNDER_4G) == FRAME_ALLOCATION_TYPE_UNDER_4G;
+    uint64_t address = 0;
+    int8_t res;
 
-        return 0;
+    // single frames are the most common request, hot frame caches serve them without zone locks
+    if(count == 1 && !under_4g) {
+        res = frame_allocator_pcp_alloc(ctx, &address);
+    } else {
+        res = frame_allocator_alloc_from_zones(ctx, count, under_4g, &address);
     }
 
-    tmp_frame = ctx->reserved_frames_by_address->find(ctx->reserved_frames_by_address, f);
+    if(res != 0) {
+        memory_free_ext(ctx->heap, new_frm);
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot find free frames with count 0x%llx", count);
 
-    if(tmp_frame) {
-        ctx->reserved_frames_by_address->delete(ctx->reserved_frames_by_address, tmp_frame, NULL);
+        return -1;
+    }
 
-        uint64_t rem_frms = tmp_frame->frame_count - f->frame_count;
+    __atomic_sub_fetch(&ctx->free_frame_count, count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->allocated_frame_count, count, __ATOMIC_RELAXED);
 
-        if(tmp_frame->frame_address < f->frame_address) {
-            uint64_t prev_frm_count = (f->frame_address - tmp_frame->frame_address) / FRAME_SIZE;
+    new_frm->frame_address = address;
+    new_frm->frame_count = count;
 
-            frame_t* prev_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    if(fa_type & FRAME_ALLOCATION_TYPE_RESERVED) {
+        new_frm->type = FRAME_TYPE_RESERVED;
+    } else {
+        new_frm->type = FRAME_TYPE_USED;
+    }
 
-            if(prev_frm == NULL) {
-                lock_release(ctx->lock);
-                return -1;
-            }
+    if(fa_type & FRAME_ALLOCATION_TYPE_OLD_RESERVED) {
+        new_frm->frame_attributes |= FRAME_ATTRIBUTE_OLD_RESERVED;
 
-            prev_frm->frame_address = tmp_frame->frame_address;
-            prev_frm->frame_count = prev_frm_count;
-            prev_frm->type = FRAME_TYPE_USED;
-            prev_frm->frame_attributes = tmp_frame->frame_attributes;
+        // cleanup finds old reserved frames at reserved index
+        lock_acquire(ctx->lock);
+        ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_frm, new_frm, NULL);
+        lock_release(ctx->lock);
+    }
 
-            ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, prev_frm, prev_frm, NULL);
+    if(alloc_list_size) {
+        *alloc_list_size = 1;
+    }
 
-            rem_frms -= prev_frm_count;
-        }
+    *fs = new_frm;
 
-        if(rem_frms) {
-            frame_t* next_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    return 0;
+}
 
-            if(next_frm == NULL) {
-                lock_release(ctx->lock);
-                return -1;
-            }
+int8_t fa_allocate_frame(frame_allocator_t* self, frame_t* f) {
+    if(self == NULL) {
+        return -1;
+    }
 
-            next_frm->frame_address = f->frame_address + f->frame_count * FRAME_SIZE;
-            next_frm->frame_count = rem_frms;
-            next_frm->type = FRAME_TYPE_USED;
-            next_frm->frame_attributes = tmp_frame->frame_attributes;
+    frame_allocator_context_t* ctx = self->context;
 
-            ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, next_frm, next_frm, NULL);
-        }
+    frame_allocator_zone_t* zone = frame_allocator_zone_of(ctx, f->frame_address, f->frame_count);
+    int8_t res = -1;
 
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    if(zone) {
+        uint64_t idx = (f->frame_address - zone->base) / FRAME_SIZE;
 
-        if(new_frm == NULL) {
-            lock_release(ctx->lock);
-            return -1;
-        }
+        lock_acquire(zone->lock);
+        res = frame_allocator_zone_claim_frames(zone, idx, f->frame_count);
+        lock_release(zone->lock);
+    }
 
-        new_frm->frame_address = f->frame_address;
-        new_frm->frame_count = f->frame_count;
-        new_frm->type = FRAME_TYPE_FREE;
-        new_frm->frame_attributes = tmp_frame->frame_attributes;
+    if(res != 0) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "frame not found 0x%llx 0x%llx", f->frame_address, f->frame_count);
 
-        ctx->allocated_frame_count -= new_frm->frame_count;
-        ctx->free_frame_count += new_frm->frame_count;
+        return -1;
+    }
 
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
-        }
+    __atomic_sub_fetch(&ctx->free_frame_count, f->frame_count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->allocated_frame_count, f->frame_count, __ATOMIC_RELAXED);
 
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_frm, new_frm, NULL);
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_frm);
+    frame_type_t type = f->type != FRAME_TYPE_FREE?f->type:FRAME_TYPE_USED;
 
-        memory_free_ext(ctx->heap, (void*)tmp_frame);
-    }
+    if(type != FRAME_TYPE_USED) {
+        lock_acquire(ctx->lock);
+        res = frame_allocator_insert_reserved(ctx, f->frame_address, f->frame_count, type, f->frame_attributes);
+        lock_release(ctx->lock);
 
-    lock_release(ctx->lock);
+        if(res != 0) {
+            PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot insert reserved frames 0x%llx 0x%llx", f->frame_address, f->frame_count);
 
+            return -1;
+        }
+    }
 
     return 0;
 }
 
-int8_t fa_release_acpi_reclaim_memory(frame_allocator_t* self) {
+int8_t fa_release_frame(frame_allocator_t* self, frame_t* f) {
     if(self == NULL) {
         return -1;
     }
 
     frame_allocator_context_t* ctx = self->context;
 
+    boolean_t reserved = false;
+
     lock_acquire(ctx->lock);
 
-    iterator_t* iter;
-    list_t* frms;
+    const frame_t* tmp_frame = ctx->reserved_frames_by_address->find(ctx->reserved_frames_by_address, f);
 
+    if(tmp_frame) {
+        reserved = true;
 
-    frms = list_create_sortedlist_with_heap(ctx->heap, frame_allocator_cmp_by_size);
+        ctx->reserved_frames_by_address->delete(ctx->reserved_frames_by_address, tmp_frame, NULL);
 
-    iter = ctx->reserved_frames_by_address->create_iterator(ctx->reserved_frames_by_address);
+        uint64_t tmp_frame_end = tmp_frame->frame_address + tmp_frame->frame_count * FRAME_SIZE;
+        uint64_t f_end = f->frame_address + f->frame_count * FRAME_SIZE;
 
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
+        if(tmp_frame->frame_address < f->frame_address) {
+            uint64_t prev_frm_count = (f->frame_address - tmp_frame->frame_address) / FRAME_SIZE;
 
-        if((f->frame_attributes & FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY) && !(f->frame_attributes & FRAME_ATTRIBUTE_RESERVED_PAGE_MAPPED)) {
-            list_sortedlist_insert(frms, f);
+            if(frame_allocator_insert_reserved(ctx, tmp_frame->frame_address, prev_frm_count, tmp_frame->type, tmp_frame->frame_attributes) != 0) {
+                lock_release(ctx->lock);
+                return -1;
+            }
         }
 
-        iter = iter->next(iter);
-    }
+        if(tmp_frame_end > f_end) {
+            uint64_t next_frm_count = (tmp_frame_end - f_end) / FRAME_SIZE;
 
-    iter->destroy(iter);
+            if(frame_allocator_insert_reserved(ctx, f_end, next_frm_count, tmp_frame->type, tmp_frame->frame_attributes) != 0) {
+                lock_release(ctx->lock);
+                return -1;
+            }
+        }
 
-    iter = list_iterator_create(frms);
+        memory_free_ext(ctx->heap, (void*)tmp_frame);
+    }
 
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
+    lock_release(ctx->lock);
 
-        ctx->reserved_frames_by_address->delete(ctx->reserved_frames_by_address, f, NULL);
+    // reserved system frames such as mmio areas are not memory
+    if(reserved && !frame_allocator_is_usable(ctx, f->frame_address, f->frame_count)) {
+        return 0;
+    }
 
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
-        }
+    frame_allocator_zone_t* zone = frame_allocator_zone_of(ctx, f->frame_address, f->frame_count);
 
-        f->frame_attributes &= ~FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY;
-        f->type = FRAME_TYPE_FREE;
+    if(zone == NULL) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "frames are not inside any zone 0x%llx 0x%llx", f->frame_address, f->frame_count);
 
-        ctx->allocated_frame_count -= f->frame_count;
-        ctx->free_frame_count += f->frame_count;
+        return -1;
+    }
 
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, f);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, f, f, NULL);
+    uint64_t idx = (f->frame_address - zone->base) / FRAME_SIZE;
 
-        iter = iter->next(iter);
+    // claim frames before touching their contents, so only one of racing releases cleans them
+    lock_acquire(zone->lock);
+    boolean_t allocated = frame_allocator_used_run(zone->used, idx, f->frame_count, true) == f->frame_count;
+
+    if(allocated && f->frame_count == 1) {
+        // cached frames keep their used bits, claim cache slot while zone lock blocks frames leaving caches to zone
+        allocated = !frame_allocator_cached_mark(zone, idx, true);
+    } else if(allocated) {
+        // frames are neither used nor free until they are cleaned
+        frame_allocator_used_mark(zone->used, idx, f->frame_count, false);
     }
 
-    iter->destroy(iter);
+    lock_release(zone->lock);
 
-    list_destroy(frms);
+    if(!allocated) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "frames are not allocated 0x%llx 0x%llx", f->frame_address, f->frame_count);
 
-    lock_release(ctx->lock);
+        return -1;
+    }
 
-    return 0;
-}
+    frame_allocator_clean_frames(ctx, f->frame_address, f->frame_count);
 
-int8_t fa_cleanup(frame_allocator_t* self) {
-    if(self == NULL) {
-        return -1;
+    if(f->frame_count != 1) {
+        lock_acquire(zone->lock);
+        frame_allocator_zone_free_frames(zone, idx, f->frame_count);
+        lock_release(zone->lock);
+    } else if(!frame_allocator_pcp_free(ctx, f->frame_address)) {
+        // used and cached bits are cleared together, a racing release cannot claim frame between them
+        frame_allocator_free_frames_to_zones(ctx, &f->frame_address, 1);
     }
 
-    frame_allocator_context_t* ctx = self->context;
+    __atomic_sub_fetch(&ctx->allocated_frame_count, f->frame_count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->free_frame_count, f->frame_count, __ATOMIC_RELAXED);
 
-    lock_acquire(ctx->lock);
+    return 0;
+}
 
+static int8_t frame_allocator_release_reserved_with_attribute(frame_allocator_context_t* ctx, uint64_t attribute, uint64_t skip_attribute) {
     iterator_t* iter;
     list_t* frms;
 
+    lock_acquire(ctx->lock);
 
     frms = list_create_sortedlist_with_heap(ctx->heap, frame_allocator_cmp_by_size);
 
+    if(frms == NULL) {
+        lock_release(ctx->lock);
+
+        return -1;
+    }
+
     iter = ctx->reserved_frames_by_address->create_iterator(ctx->reserved_frames_by_address);
 
     while(iter->end_of_iterator(iter) != 0) {
         frame_t* f = (frame_t*)iter->get_item(iter);
 
-        if(f->frame_attributes & FRAME_ATTRIBUTE_OLD_RESERVED) {
+        if((f->frame_attributes & attribute) && !(f->frame_attributes & skip_attribute)) {
             list_sortedlist_insert(frms, f);
         }
 
@@ -710,66 +1141,28 @@ int8_t fa_cleanup(frame_allocator_t* self) {
 
         ctx->reserved_frames_by_address->delete(ctx->reserved_frames_by_address, f, NULL);
 
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
-        }
-
-        f->frame_attributes &= ~FRAME_ATTRIBUTE_OLD_RESERVED;
-        f->type = FRAME_TYPE_FREE;
-
-        ctx->allocated_frame_count -= f->frame_count;
-        ctx->free_frame_count += f->frame_count;
-
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, f);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, f, f, NULL);
-
         iter = iter->next(iter);
     }
 
     iter->destroy(iter);
 
-    list_destroy(frms);
-
-
-    frms = list_create_sortedlist_with_heap(ctx->heap, frame_allocator_cmp_by_size);
-
-    iter = ctx->allocated_frames_by_address->create_iterator(ctx->allocated_frames_by_address);
-
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
-
-        if(f->frame_attributes & FRAME_ATTRIBUTE_OLD_RESERVED) {
-            list_sortedlist_insert(frms, f);
-        }
-
-        iter = iter->next(iter);
-    }
-
-    iter->destroy(iter);
+    lock_release(ctx->lock);
 
     iter = list_iterator_create(frms);
 
     while(iter->end_of_iterator(iter) != 0) {
         frame_t* f = (frame_t*)iter->get_item(iter);
 
-        ctx->allocated_frames_by_address->delete(ctx->allocated_frames_by_address, f, NULL);
+        if(frame_allocator_is_usable(ctx, f->frame_address, f->frame_count)) {
+            frame_allocator_clean_frames(ctx, f->frame_address, f->frame_count);
 
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
+            if(frame_allocator_free_to_zones(ctx, f->frame_address, f->frame_count) == 0) {
+                __atomic_sub_fetch(&ctx->allocated_frame_count, f->frame_count, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&ctx->free_frame_count, f->frame_count, __ATOMIC_RELAXED);
+            }
         }
 
-        f->frame_attributes &= ~FRAME_ATTRIBUTE_OLD_RESERVED;
-        f->type = FRAME_TYPE_FREE;
-
-        ctx->allocated_frame_count -= f->frame_count;
-        ctx->free_frame_count += f->frame_count;
-
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, f);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, f, f, NULL);
+        memory_free_ext(ctx->heap, f);
 
         iter = iter->next(iter);
     }
@@ -778,11 +1171,25 @@ int8_t fa_cleanup(frame_allocator_t* self) {
 
     list_destroy(frms);
 
-    lock_release(ctx->lock);
-
     return 0;
 }
 
+int8_t fa_release_acpi_reclaim_memory(frame_allocator_t* self) {
+    if(self == NULL) {
+        return -1;
+    }
+
+    return frame_allocator_release_reserved_with_attribute(self->context, FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY, FRAME_ATTRIBUTE_RESERVED_PAGE_MAPPED);
+}
+
+int8_t fa_cleanup(frame_allocator_t* self) {
+    if(self == NULL) {
+        return -1;
+    }
+
+    return frame_allocator_release_reserved_with_attribute(self->context, FRAME_ATTRIBUTE_OLD_RESERVED, 0);
+}
+
 
 frame_t* fa_get_reserved_frames_of_address(frame_allocator_t* self, void* address){
     if(self == NULL) {
@@ -844,6 +1251,61 @@ static int8_t frame_allocator_destroy_key(memory_heap_t* heap, void* key) {
     return 0;
 }
 
+static boolean_t frame_allocator_next_region(uint64_t* index, frame_t* region) {
+    uint64_t mmap_ent_cnt = SYSTEM_INFO->mmap_size / SYSTEM_INFO->mmap_descriptor_size;
+
+    if(*index >= mmap_ent_cnt) {
+        return false;
+    }
+
+    efi_memory_descriptor_t* mem_desc = (efi_memory_descriptor_t*)(SYSTEM_INFO->mmap_data + (*index * SYSTEM_INFO->mmap_descriptor_size));
+
+    region->frame_address = mem_desc->physical_start;
+    region->frame_count = mem_desc->page_count;
+    region->type = fa_get_fa_type(mem_desc->type);
+    region->frame_attributes = mem_desc->attribute;
+
+    // merge adjacent descriptors of same kind
+    for((*index)++; *index < mmap_ent_cnt; (*index)++) {
+        mem_desc = (efi_memory_descriptor_t*)(SYSTEM_INFO->mmap_data + (*index * SYSTEM_INFO->mmap_descriptor_size));
+
+        if(region->type != fa_get_fa_type(mem_desc->type) ||
+           (region->frame_address + region->frame_count * FRAME_SIZE) != mem_desc->physical_start ||
+           region->frame_attributes != mem_desc->attribute) {
+            break;
+        }
+
+        region->frame_count += mem_desc->page_count;
+    }
+
+    if((region->frame_address + region->frame_count * FRAME_SIZE) <= (1 << 20)) {
+        region->type = FRAME_TYPE_RESERVED;
+    }
+
+    return true;
+}
+
+static void frame_allocator_add_free_region(frame_allocator_context_t* ctx, uint64_t address, uint64_t count) {
+    while(count) {
+        frame_allocator_zone_t* zone = ctx->zones[address < FRAME_ALLOCATOR_DMA32_END ? FRAME_ALLOCATOR_ZONE_DMA32 : FRAME_ALLOCATOR_ZONE_NORMAL];
+        uint64_t zone_end = zone->base + zone->frame_count * FRAME_SIZE;
+        uint64_t part = count;
+
+        // regions crossing 4G are split between zones
+        if(address + part * FRAME_SIZE > zone_end) {
+            part = (zone_end - address) / FRAME_SIZE;
+        }
+
+        uint64_t idx = (address - zone->base) / FRAME_SIZE;
+
+        frame_allocator_used_mark(zone->used, idx, part, false);
+        frame_allocator_zone_free_frames(zone, idx, part);
+
+        address += part * FRAME_SIZE;
+        count -= part;
+    }
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
 frame_allocator_t* frame_allocator_new_ext(memory_heap_t* heap) {
@@ -861,97 +1323,129 @@ frame_allocator_t* frame_allocator_new_ext(memory_heap_t* heap) {
     }
 
     ctx->heap = heap;
-    ctx->free_frames_sorted_by_size = list_create_sortedlist_with_heap(heap, frame_allocator_cmp_by_size);
-    list_set_equality_comparator(ctx->free_frames_sorted_by_size, frame_allocator_cmp_by_address);
 
     ctx->acpi_frames = list_create_sortedlist_with_heap(heap, frame_allocator_cmp_by_address);
 
-    ctx->free_frames_by_address = bplustree_create_index_with_heap_and_unique(heap, 64, frame_allocator_cmp_by_address, true);
-    bplustree_set_key_cloner(ctx->free_frames_by_address, frame_allocator_clone_key);
-    bplustree_set_key_destroyer(ctx->free_frames_by_address, frame_allocator_destroy_key);
-
-    ctx->allocated_frames_by_address = bplustree_create_index_with_heap_and_unique(heap, 64, frame_allocator_cmp_by_address, true);
-    bplustree_set_key_cloner(ctx->allocated_frames_by_address, frame_allocator_clone_key);
-    bplustree_set_key_destroyer(ctx->allocated_frames_by_address, frame_allocator_destroy_key);
-
     ctx->reserved_frames_by_address = bplustree_create_index_with_heap_and_unique(heap, 64, frame_allocator_cmp_by_address, true);
     bplustree_set_key_cloner(ctx->reserved_frames_by_address, frame_allocator_clone_key);
     bplustree_set_key_destroyer(ctx->reserved_frames_by_address, frame_allocator_destroy_key);
 
     ctx->lock = lock_create_with_heap(heap);
+    ctx->clean_lock = lock_create_with_heap(heap);
+    ctx->pcps = memory_malloc_ext(heap, sizeof(frame_allocator_pcp_t) * FRAME_ALLOCATOR_PCP_MAX_CPU_COUNT, 0);
 
-    efi_memory_descriptor_t* mem_desc;
-
-    mem_desc = (efi_memory_descriptor_t*)(SYSTEM_INFO->mmap_data);
+    if(ctx->acpi_frames == NULL || ctx->reserved_frames_by_address == NULL ||
+       ctx->lock == NULL || ctx->clean_lock == NULL || ctx->pcps == NULL) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot create frame allocator internals");
 
-    uint64_t frame_start = mem_desc->physical_start;
-    uint64_t frame_count = mem_desc->page_count;
-    frame_type_t type = fa_get_fa_type(mem_desc->type);
-    uint64_t frame_attr = mem_desc->attribute;
+        return NULL;
+    }
 
-    uint64_t mmap_ent_cnt = SYSTEM_INFO->mmap_size / SYSTEM_INFO->mmap_descriptor_size;
-    for(size_t i = 1; i < mmap_ent_cnt; i++) {
-        mem_desc = (efi_memory_descriptor_t*)(SYSTEM_INFO->mmap_data + (i * SYSTEM_INFO->mmap_descriptor_size));
+    uint64_t region_index = 0;
+    frame_t region;
+    uint64_t dma32_end = 0;
+    uint64_t normal_end = 0;
 
-        if(type == fa_get_fa_type(mem_desc->type) && (frame_start + frame_count * FRAME_SIZE) == mem_desc->physical_start && frame_attr == mem_desc->attribute) {
-            frame_count += mem_desc->page_count;
-        } else {
+    // first pass finds zone limits
+    while(frame_allocator_next_region(&region_index, &region)) {
+        if(region.type != FRAME_TYPE_FREE && region.type != FRAME_TYPE_ACPI_RECLAIM_MEMORY) {
+            continue;
+        }
 
+        ctx->usable_range_count++;
 
-            frame_t* f = memory_malloc_ext(heap, sizeof(frame_t), 0);
+        uint64_t region_end = region.frame_address + region.frame_count * FRAME_SIZE;
 
-            if(f == NULL) {
-                memory_free_ext(ctx->heap, fa);
-                memory_free_ext(ctx->heap, ctx);
+        if(region.frame_address < FRAME_ALLOCATOR_DMA32_END) {
+            uint64_t end = region_end < FRAME_ALLOCATOR_DMA32_END ? region_end : FRAME_ALLOCATOR_DMA32_END;
 
-                return NULL;
+            if(end > dma32_end) {
+                dma32_end = end;
             }
+        }
+
+        if(region_end > FRAME_ALLOCATOR_DMA32_END && region_end > normal_end) {
+            normal_end = region_end;
+        }
+    }
+
+    ctx->usable_ranges = memory_malloc_ext(heap, sizeof(frame_t) * (ctx->usable_range_count + 1), 0);
 
+    if(ctx->usable_ranges == NULL) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot create usable memory ranges");
 
-            f->frame_address = frame_start;
-            f->frame_count = frame_count;
-            f->type = type;
-            f->frame_attributes = mem_desc->attribute;
+        return NULL;
+    }
+
+    if(dma32_end) {
+        ctx->zones[FRAME_ALLOCATOR_ZONE_DMA32] = frame_allocator_zone_create(heap, 0, dma32_end);
+
+        if(ctx->zones[FRAME_ALLOCATOR_ZONE_DMA32] == NULL) {
+            PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot create dma32 zone");
+
+            return NULL;
+        }
+    }
+
+    if(normal_end) {
+        ctx->zones[FRAME_ALLOCATOR_ZONE_NORMAL] = frame_allocator_zone_create(heap, FRAME_ALLOCATOR_DMA32_END, normal_end);
 
-            if((frame_start + frame_count * FRAME_SIZE) <= (1 << 20)) {
-                type = FRAME_TYPE_RESERVED;
-                f->type = type;
+        if(ctx->zones[FRAME_ALLOCATOR_ZONE_NORMAL] == NULL) {
+            PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot create normal zone");
+
+            return NULL;
+        }
+    }
+
+    // second pass fills zones and reserved index
+    region_index = 0;
+    ctx->usable_range_count = 0;
+
+    while(frame_allocator_next_region(&region_index, &region)) {
+        ctx->total_frame_count += region.frame_count;
+
+        frame_t* f = NULL;
+
+        switch (region.type) {
+        case FRAME_TYPE_FREE:
+            ctx->usable_ranges[ctx->usable_range_count++] = region;
+            frame_allocator_add_free_region(ctx, region.frame_address, region.frame_count);
+            ctx->free_frame_count += region.frame_count;
+            break;
+        case FRAME_TYPE_USED:
+            ctx->allocated_frame_count += region.frame_count;
+            break;
+        case FRAME_TYPE_RESERVED:
+            if(frame_allocator_insert_reserved(ctx, region.frame_address, region.frame_count, region.type, region.frame_attributes) != 0) {
+                return NULL;
             }
 
-            ctx->total_frame_count += frame_count;
+            ctx->allocated_frame_count += region.frame_count;
+            break;
+        case FRAME_TYPE_ACPI_RECLAIM_MEMORY:
+            ctx->usable_ranges[ctx->usable_range_count++] = region;
 
-            switch (type) {
-            case FRAME_TYPE_FREE:
-                ctx->free_frames_by_address->insert(ctx->free_frames_by_address, f, f, NULL);
-                list_sortedlist_insert(ctx->free_frames_sorted_by_size, f);
-                ctx->free_frame_count += frame_count;
-                break;
-            case FRAME_TYPE_USED:
-                ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, f, f, NULL);
-                ctx->allocated_frame_count += frame_count;
-                break;
-            case FRAME_TYPE_RESERVED:
-                ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, f, f, NULL);
-                ctx->allocated_frame_count += frame_count;
-                break;
-            case FRAME_TYPE_ACPI_RECLAIM_MEMORY:
-                f->frame_attributes |= FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY;
-                ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, f, f, NULL);
-                ctx->allocated_frame_count += frame_count;
-                break;
-            case FRAME_TYPE_ACPI_CODE:
-            case FRAME_TYPE_ACPI_DATA:
-                f->frame_attributes |= FRAME_ATTRIBUTE_ACPI;
-                list_sortedlist_insert(ctx->acpi_frames, f);
-                ctx->allocated_frame_count += frame_count;
+            if(frame_allocator_insert_reserved(ctx, region.frame_address, region.frame_count, region.type,
+                                               region.frame_attributes | FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY) != 0) {
+                return NULL;
             }
 
+            ctx->allocated_frame_count += region.frame_count;
+            break;
+        case FRAME_TYPE_ACPI_CODE:
+        case FRAME_TYPE_ACPI_DATA:
+            f = memory_malloc_ext(heap, sizeof(frame_t), 0);
 
-            frame_start = mem_desc->physical_start;
-            frame_count = mem_desc->page_count;
-            type = fa_get_fa_type(mem_desc->type);
-        }
+            if(f == NULL) {
+                return NULL;
+            }
 
+            memory_memcopy(&region, f, sizeof(frame_t));
+            f->frame_attributes |= FRAME_ATTRIBUTE_ACPI;
+            list_sortedlist_insert(ctx->acpi_frames, f);
+            ctx->allocated_frame_count += region.frame_count;
+            break;
+        }
     }
 
     fa->context = ctx;
@@ -980,48 +1474,24 @@ void frame_allocator_print(frame_allocator_t* fa) {
 
     iterator_t* iter;
 
-    iter = ctx->free_frames_by_address->create_iterator(ctx->free_frames_by_address);
-
-    printf("free frames by address\n");
+    printf("frames total 0x%llx free 0x%llx allocated 0x%llx\n", ctx->total_frame_count, ctx->free_frame_count, ctx->allocated_frame_count);
 
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
-
-        printf("0x%016llx \t 0x%016llx \t 0x%016llx\n", f->frame_address, f->frame_count, f->frame_attributes);
-
-        iter = iter->next(iter);
-    }
-
-    iter->destroy(iter);
-
-    iter = list_iterator_create(ctx->free_frames_sorted_by_size);
-
-    printf("free frames by size\n");
-
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
-
-        printf("0x%016llx \t 0x%016llx \t 0x%016llx\n", f->frame_address, f->frame_count, f->frame_attributes);
+    for(uint8_t z = 0; z < FRAME_ALLOCATOR_ZONE_COUNT; z++) {
+        frame_allocator_zone_t* zone = ctx->zones[z];
 
-        iter = iter->next(iter);
-    }
-
-    iter->destroy(iter);
-
-    iter = ctx->allocated_frames_by_address->create_iterator(ctx->allocated_frames_by_address);
-
-    printf("used frames by address\n");
-
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
+        if(zone == NULL) {
+            continue;
+        }
 
-        printf("0x%016llx \t 0x%016llx \t 0x%016llx\n", f->frame_address, f->frame_count, f->frame_attributes);
+        printf("zone %i base 0x%016llx frame count 0x%llx free frame count 0x%llx\n", z, zone->base, zone->frame_count, zone->free_frame_count);
 
-        iter = iter->next(iter);
+        for(uint8_t o = 0; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+            if(zone->free_block_counts[o]) {
+                printf("\torder %2i free block count 0x%llx\n", o, zone->free_block_counts[o]);
+            }
+        }
     }
 
-    iter->destroy(iter);
-
     iter = ctx->reserved_frames_by_address->create_iterator(ctx->reserved_frames_by_address);
 
     printf("reserved frames by address\n");
@@ -38,6 +38,14 @@ _Static_assert(sizeof(memory_heap_hash_block_t) == 16, "memory_heap_hash_block_t
 #define MEMORY_HEAP_HASH_FAST_CLASSES_COUNT 1025
 #define MEMORY_HEAP_HASH_MAX_POOLS            16
 
+#define MEMORY_HEAP_HASH_MAGAZINE_CLASS_COUNT   64
+#define MEMORY_HEAP_HASH_MAGAZINE_SIZE          32
+#define MEMORY_HEAP_HASH_MAGAZINE_BATCH_SIZE    16
+#define MEMORY_HEAP_HASH_MAGAZINE_MAX_CPU_COUNT 256
+
+typedef uint64_t (*memory_current_cpu_id_getter_f)(void);
+extern memory_current_cpu_id_getter_f memory_current_cpu_id_getter;
+
 typedef struct memory_heap_hash_fast_class_t {
     uint32_t head;
     uint32_t tail;
@@ -68,8 +76,23 @@ typedef struct memory_heap_hash_metadata_t {
     uint64_t free_size;
     uint64_t fast_hit;
     uint64_t header_count;
+    uint64_t magazines[MEMORY_HEAP_HASH_MAGAZINE_MAX_CPU_COUNT];
 }__attribute__((packed)) memory_heap_hash_metadata_t;
 
+/**
+ * @brief per-cpu cache of free blocks for the first fast classes.
+ * only owner cpu touches it with interrupts disabled, hence it does not need heap lock.
+ */
+typedef struct memory_heap_hash_magazine_t {
+    uint64_t malloc_count;
+    uint64_t free_count;
+    uint64_t refill_count;
+    uint64_t flush_count;
+    uint64_t cached_count;
+    uint8_t  counts[MEMORY_HEAP_HASH_MAGAZINE_CLASS_COUNT];
+    uint64_t slots[MEMORY_HEAP_HASH_MAGAZINE_CLASS_COUNT][MEMORY_HEAP_HASH_MAGAZINE_SIZE];
+} memory_heap_hash_magazine_t;
+
 static inline memory_heap_hash_pool_t* memory_heap_hash_pool_get(memory_heap_hash_metadata_t* metadata, uint16_t pool_id) {
     if(!metadata) {
         return NULL;
@@ -286,6 +309,8 @@ static inline memory_heap_hash_block_t* memory_heap_hash_pool_search_hash_block(
 void*  memory_heap_hash_malloc_ext(memory_heap_t* heap, uint64_t size, uint64_t alignment);
 int8_t memory_heap_hash_free(memory_heap_t* heap, void* ptr);
 void   memory_heap_hash_stat(memory_heap_t* heap, memory_heap_stat_t* stat);
+void*  memory_heap_hash_cached_malloc(memory_heap_t* heap, uint64_t size, uint64_t alignment);
+int8_t memory_heap_hash_cached_free(memory_heap_t* heap, void* ptr);
 
 
 static inline void memory_heap_hash_pool_insert_sorted_at_free_list(memory_heap_hash_pool_t* pool, memory_heap_hash_block_t* hash_block) {
@@ -604,6 +629,273 @@ int8_t memory_heap_hash_free(memory_heap_t* heap, void* ptr) {
     return 0;
 }
 
+static inline boolean_t memory_heap_hash_magazine_enter(void) {
+#if ___KERNELBUILD == 1
+    return cpu_cli();
+#else
+    return false;
+#endif
+}
+
+static inline void memory_heap_hash_magazine_leave(boolean_t interrupts_were_enabled) {
+#if ___KERNELBUILD == 1
+    if(interrupts_were_enabled) {
+        cpu_sti();
+    }
+#else
+    UNUSED(interrupts_were_enabled);
+#endif
+}
+
+static inline memory_heap_hash_magazine_t* memory_heap_hash_magazine_get(memory_heap_hash_metadata_t* metadata) {
+    uint64_t cpu_id = memory_current_cpu_id_getter();
+
+    if(cpu_id >= MEMORY_HEAP_HASH_MAGAZINE_MAX_CPU_COUNT) {
+        return NULL;
+    }
+
+    return (memory_heap_hash_magazine_t*)metadata->magazines[cpu_id];
+}
+
+static boolean_t memory_heap_hash_magazine_create(memory_heap_t* heap) {
+    memory_heap_hash_metadata_t* metadata = heap->metadata;
+
+    lock_acquire(heap->lock);
+
+    // cpu may change after lock, it is not important which cpu's magazine is created
+    uint64_t cpu_id = memory_current_cpu_id_getter();
+
+    if(cpu_id >= MEMORY_HEAP_HASH_MAGAZINE_MAX_CPU_COUNT) {
+        lock_release(heap->lock);
+
+        return false;
+    }
+
+    if(!metadata->magazines[cpu_id]) {
+        metadata->magazines[cpu_id] = (uint64_t)memory_heap_hash_malloc_ext(heap, sizeof(memory_heap_hash_magazine_t), 16);
+    }
+
+    boolean_t res = metadata->magazines[cpu_id] != 0;
+
+    lock_release(heap->lock);
+
+    return res;
+}
+
+static void memory_heap_hash_magazine_release_blocks(memory_heap_t* heap, uint64_t* blocks, uint64_t count) {
+    if(!count) {
+        return;
+    }
+
+    memory_heap_hash_metadata_t* metadata = heap->metadata;
+
+    lock_acquire(heap->lock);
+
+    for(uint64_t i = 0; i < count; i++) {
+        memory_heap_hash_pool_t* pool = memory_heap_hash_find_pool_by_address(metadata, blocks[i]);
+
+        if(!pool) {
+            continue;
+        }
+
+        memory_heap_hash_block_t* hash_block = memory_heap_hash_pool_search_hash_block(metadata, pool, (uint32_t)(blocks[i] - pool->pool_base));
+
+        if(!hash_block) {
+            continue;
+        }
+
+        // cached blocks are marked as free, unmark for real free
+        hash_block->is_free = false;
+
+        if(memory_heap_hash_free(heap, (void*)blocks[i]) == 0) {
+            // cached blocks are not user allocations, do not count them
+            metadata->free_count--;
+        }
+    }
+
+    lock_release(heap->lock);
+}
+
+void* memory_heap_hash_cached_malloc(memory_heap_t* heap, uint64_t size, uint64_t alignment) {
+    if(!heap || !size || alignment > 16 || !memory_current_cpu_id_getter) {
+        return NULL;
+    }
+
+    memory_heap_hash_metadata_t* metadata = heap->metadata;
+
+    uint64_t block_size = size + 16 - (size % 16) - 1;
+    uint64_t magazine_class = block_size >> 4;
+
+    if(magazine_class >= MEMORY_HEAP_HASH_MAGAZINE_CLASS_COUNT) {
+        return NULL;
+    }
+
+    boolean_t intr = memory_heap_hash_magazine_enter();
+
+    memory_heap_hash_magazine_t* magazine = memory_heap_hash_magazine_get(metadata);
+
+    if(!magazine) {
+        memory_heap_hash_magazine_leave(intr);
+
+        if(!memory_heap_hash_magazine_create(heap)) {
+            return NULL;
+        }
+
+        intr = memory_heap_hash_magazine_enter();
+
+        magazine = memory_heap_hash_magazine_get(metadata);
+
+        if(!magazine) {
+            memory_heap_hash_magazine_leave(intr);
+
+            return NULL;
+        }
+    }
+
+    if(magazine->counts[magazine_class]) {
+        uint64_t res = magazine->slots[magazine_class][--magazine->counts[magazine_class]];
+
+        magazine->cached_count--;
+        magazine->malloc_count++;
+
+        memory_heap_hash_magazine_leave(intr);
+
+        memory_heap_hash_pool_t* pool = memory_heap_hash_find_pool_by_address(metadata, res);
+        memory_heap_hash_block_t* hash_block = memory_heap_hash_pool_search_hash_block(metadata, pool, (uint32_t)(res - pool->pool_base));
+        hash_block->is_free = false;
+
+        return (void*)res;
+    }
+
+    memory_heap_hash_magazine_leave(intr);
+
+    // magazine is empty, refill it with a batch from shared pools
+    uint64_t blocks[MEMORY_HEAP_HASH_MAGAZINE_BATCH_SIZE] = {0};
+    uint64_t block_count = 0;
+
+    lock_acquire(heap->lock);
+
+    for(; block_count < MEMORY_HEAP_HASH_MAGAZINE_BATCH_SIZE; block_count++) {
+        blocks[block_count] = (uint64_t)memory_heap_hash_malloc_ext(heap, size, 16);
+
+        if(!blocks[block_count]) {
+            break;
+        }
+
+        // cached blocks are not user allocations, do not count them
+        metadata->malloc_count--;
+    }
+
+    lock_release(heap->lock);
+
+    if(!block_count) {
+        return NULL;
+    }
+
+    // first block is returned to the caller, the remaining ones go into the magazine
+    uint64_t res = blocks[0];
+    uint64_t idx = 1;
+
+    intr = memory_heap_hash_magazine_enter();
+
+    // task may be migrated while refilling, hence magazine is taken again
+    magazine = memory_heap_hash_magazine_get(metadata);
+
+    if(magazine) {
+        while(idx < block_count && magazine->counts[magazine_class] < MEMORY_HEAP_HASH_MAGAZINE_SIZE) {
+            memory_heap_hash_pool_t* pool = memory_heap_hash_find_pool_by_address(metadata, blocks[idx]);
+            memory_heap_hash_block_t* hash_block = memory_heap_hash_pool_search_hash_block(metadata, pool, (uint32_t)(blocks[idx] - pool->pool_base));
+            hash_block->is_free = true;
+
+            magazine->slots[magazine_class][magazine->counts[magazine_class]++] = blocks[idx++];
+            magazine->cached_count++;
+        }
+
+        magazine->refill_count++;
+        magazine->malloc_count++;
+    }
+
+    memory_heap_hash_magazine_leave(intr);
+
+    memory_heap_hash_magazine_release_blocks(heap, &blocks[idx], block_count - idx);
+
+    if(!magazine) {
+        // no magazine to count at, give block back and let locked path serve
+        memory_heap_hash_magazine_release_blocks(heap, &res, 1);
+
+        return NULL;
+    }
+
+    return (void*)res;
+}
+
+int8_t memory_heap_hash_cached_free(memory_heap_t* heap, void* ptr) {
+    if(!heap || !ptr || !memory_current_cpu_id_getter) {
+        return -1;
+    }
+
+    memory_heap_hash_metadata_t* metadata = heap->metadata;
+
+    uint64_t address = (uint64_t)ptr;
+
+    memory_heap_hash_pool_t* pool = memory_heap_hash_find_pool_by_address(metadata, address);
+
+    if(!pool) {
+        return -1;
+    }
+
+    memory_heap_hash_block_t* hash_block = memory_heap_hash_pool_search_hash_block(metadata, pool, (uint32_t)(address - pool->pool_base));
+
+    // unknown or double freed blocks are reported by locked path
+    if(!hash_block || hash_block->is_free) {
+        return -1;
+    }
+
+    // only blocks with exact malloc size are cached, split remainders may be smaller than their class
+    if((hash_block->size % 16) != 15 || (hash_block->size >> 4) >= MEMORY_HEAP_HASH_MAGAZINE_CLASS_COUNT) {
+        return -1;
+    }
+
+    uint64_t magazine_class = hash_block->size >> 4;
+
+    memory_memclean(ptr, hash_block->size);
+
+    boolean_t intr = memory_heap_hash_magazine_enter();
+
+    memory_heap_hash_magazine_t* magazine = memory_heap_hash_magazine_get(metadata);
+
+    if(!magazine) {
+        memory_heap_hash_magazine_leave(intr);
+
+        return -1;
+    }
+
+    hash_block->is_free = true;
+
+    uint64_t blocks[MEMORY_HEAP_HASH_MAGAZINE_BATCH_SIZE] = {0};
+    uint64_t block_count = 0;
+
+    if(magazine->counts[magazine_class] == MEMORY_HEAP_HASH_MAGAZINE_SIZE) {
+        // magazine is full, flush a batch to shared pools
+        for(; block_count < MEMORY_HEAP_HASH_MAGAZINE_BATCH_SIZE; block_count++) {
+            blocks[block_count] = magazine->slots[magazine_class][--magazine->counts[magazine_class]];
+        }
+
+        magazine->cached_count -= block_count;
+        magazine->flush_count++;
+    }
+
+    magazine->slots[magazine_class][magazine->counts[magazine_class]++] = address;
+    magazine->cached_count++;
+    magazine->free_count++;
+
+    memory_heap_hash_magazine_leave(intr);
+
+    memory_heap_hash_magazine_release_blocks(heap, blocks, block_count);
+
+    return 0;
+}
+
 void memory_heap_hash_stat(memory_heap_t* heap, memory_heap_stat_t* stat) {
     if(!heap || !stat) {
         return;
@@ -617,6 +909,25 @@ void memory_heap_hash_stat(memory_heap_t* heap, memory_heap_stat_t* stat) {
     stat->free_size = metadata->free_size;
     stat->fast_hit = metadata->fast_hit;
     stat->header_count = metadata->header_count;
+    stat->cache_hit = 0;
+    stat->cache_refill_count = 0;
+    stat->cache_flush_count = 0;
+    stat->cached_count = 0;
+
+    for(uint64_t i = 0; i < MEMORY_HEAP_HASH_MAGAZINE_MAX_CPU_COUNT; i++) {
+        memory_heap_hash_magazine_t* magazine = (memory_heap_hash_magazine_t*)metadata->magazines[i];
+
+        if(!magazine) {
+            continue;
+        }
+
+        stat->malloc_count += magazine->malloc_count;
+        stat->free_count += magazine->free_count;
+        stat->cache_hit += magazine->malloc_count + magazine->free_count - magazine->refill_count;
+        stat->cache_refill_count += magazine->refill_count;
+        stat->cache_flush_count += magazine->flush_count;
+        stat->cached_count += magazine->cached_count;
+    }
 }
 
 memory_heap_t* memory_create_heap_hash(uint64_t start, uint64_t end) {
@@ -710,6 +1021,8 @@ memory_heap_t* memory_create_heap_hash(uint64_t start, uint64_t end) {
     heap->malloc = memory_heap_hash_malloc_ext;
     heap->free = memory_heap_hash_free;
     heap->stat = memory_heap_hash_stat;
+    heap->cached_malloc = memory_heap_hash_cached_malloc;
+    heap->cached_free = memory_heap_hash_cached_free;
 
     return heap;
 }
@@ -0,0 +1,501 @@
+/**
+ * @file memory_simd.xx.c
+ * @brief memory copy, set and compare functions with cpu feature dispatch.
+ *
+ * implementations are selected at first call with cpuid. small sizes are handled with overlapping head and tail
+ * moves, medium sizes with sse2 or avx2 loops, large copies with rep movsb when erms exists, and copies bigger
+ * than cache with non-temporal stores.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+#include <types.h>
+#include <memory.h>
+
+MODULE("turnstone.lib.memory");
+
+/*! copies at least this size use rep movsb when cpu has enhanced rep movsb */
+#define MEMORY_SIMD_REP_MOVSB_THRESHOLD   2048
+/*! copies and sets at least this size use non-temporal stores, they would evict whole cache otherwise */
+#define MEMORY_SIMD_NONTEMPORAL_THRESHOLD (4ULL << 20)
+
+// unaligned and aliasing-safe views of any buffer
+typedef char      memory_simd_v16_t __attribute__((vector_size(16), aligned(1), may_alias));
+typedef char      memory_simd_v32_t __attribute__((vector_size(32), aligned(1), may_alias));
+typedef char      memory_simd_mask16_t __attribute__((vector_size(16)));
+typedef char      memory_simd_mask32_t __attribute__((vector_size(32)));
+typedef long long memory_simd_v2di_t __attribute__((vector_size(16), may_alias));
+typedef uint64_t  memory_simd_u64_t __attribute__((aligned(1), may_alias));
+typedef uint32_t  memory_simd_u32_t __attribute__((aligned(1), may_alias));
+typedef uint16_t  memory_simd_u16_t __attribute__((aligned(1), may_alias));
+
+typedef void (*memory_simd_copy_f)(const uint8_t* src, uint8_t* dst, size_t size);
+typedef void (*memory_simd_set_f)(uint8_t* dst, uint8_t value, size_t size);
+typedef int8_t (*memory_simd_compare_f)(const uint8_t* mem1, const uint8_t* mem2, size_t size);
+
+boolean_t memory_simd_avx2_enabled = false;
+boolean_t memory_simd_erms_enabled = false;
+memory_simd_copy_f memory_simd_copy = NULL;
+memory_simd_set_f memory_simd_set = NULL;
+memory_simd_compare_f memory_simd_compare = NULL;
+
+static inline void memory_simd_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    asm volatile ("cpuid"
+                  : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                  : "a" (leaf), "c" (subleaf));
+}
+
+/**
+ * @brief copies up to 16 bytes with two overlapping moves, both are loaded before stores
+ */
+static inline void memory_simd_copy_small(const uint8_t* src, uint8_t* dst, size_t size) {
+    if(size >= 8) {
+        uint64_t head = *(const memory_simd_u64_t*)src;
+        uint64_t tail = *(const memory_simd_u64_t*)(src + size - 8);
+        *(memory_simd_u64_t*)dst = head;
+        *(memory_simd_u64_t*)(dst + size - 8) = tail;
+    } else if(size >= 4) {
+        uint32_t head = *(const memory_simd_u32_t*)src;
+        uint32_t tail = *(const memory_simd_u32_t*)(src + size - 4);
+        *(memory_simd_u32_t*)dst = head;
+        *(memory_simd_u32_t*)(dst + size - 4) = tail;
+    } else if(size >= 2) {
+        uint16_t head = *(const memory_simd_u16_t*)src;
+        uint16_t tail = *(const memory_simd_u16_t*)(src + size - 2);
+        *(memory_simd_u16_t*)dst = head;
+        *(memory_simd_u16_t*)(dst + size - 2) = tail;
+    } else if(size) {
+        *dst = *src;
+    }
+}
+
+static void memory_simd_copy_nontemporal(const uint8_t* src, uint8_t* dst, size_t size) {
+    // align destination, streaming stores need aligned addresses
+    size_t head = (16 - ((uint64_t)dst & 15)) & 15;
+
+    if(head) {
+        *(memory_simd_v16_t*)dst = *(const memory_simd_v16_t*)src;
+        src += head;
+        dst += head;
+        size -= head;
+    }
+
+    memory_simd_v16_t tail = *(const memory_simd_v16_t*)(src + size - 16);
+    uint8_t* tail_dst = dst + size - 16;
+
+    while(size >= 64) {
+        memory_simd_v16_t v0 = *(const memory_simd_v16_t*)(src);
+        memory_simd_v16_t v1 = *(const memory_simd_v16_t*)(src + 16);
+        memory_simd_v16_t v2 = *(const memory_simd_v16_t*)(src + 32);
+        memory_simd_v16_t v3 = *(const memory_simd_v16_t*)(src + 48);
+        __builtin_ia32_movntdq((memory_simd_v2di_t*)(dst), (memory_simd_v2di_t)v0);
+        __builtin_ia32_movntdq((memory_simd_v2di_t*)(dst + 16), (memory_simd_v2di_t)v1);
+        __builtin_ia32_movntdq((memory_simd_v2di_t*)(dst + 32), (memory_simd_v2di_t)v2);
+        __builtin_ia32_movntdq((memory_simd_v2di_t*)(dst + 48), (memory_simd_v2di_t)v3);
+        src += 64;
+        dst += 64;
+        size -= 64;
+    }
+
+    while(size >= 16) {
+        __builtin_ia32_movntdq((memory_simd_v2di_t*)dst, (memory_simd_v2di_t)*(const memory_simd_v16_t*)src);
+        src += 16;
+        dst += 16;
+        size -= 16;
+    }
+
+    // streaming stores are weakly ordered
+    asm volatile ("sfence" ::: "memory");
+
+    if(size) {
+        *(memory_simd_v16_t*)tail_dst = tail;
+    }
+}
+
+static inline void memory_simd_rep_movsb(const uint8_t* src, uint8_t* dst, size_t size) {
+    asm volatile ("rep movsb"
+                  : "+S" (src), "+D" (dst), "+c" (size)
+                  :
+                  : "memory");
+}
+
+static void memory_simd_copy_sse2(const uint8_t* src, uint8_t* dst, size_t size) {
+    if(size <= 16) {
+        memory_simd_copy_small(src, dst, size);
+
+        return;
+    }
+
+    if(size <= 32) {
+        memory_simd_v16_t head = *(const memory_simd_v16_t*)src;
+        memory_simd_v16_t tail = *(const memory_simd_v16_t*)(src + size - 16);
+        *(memory_simd_v16_t*)dst = head;
+        *(memory_simd_v16_t*)(dst + size - 16) = tail;
+
+        return;
+    }
+
+    if(size >= MEMORY_SIMD_NONTEMPORAL_THRESHOLD) {
+        memory_simd_copy_nontemporal(src, dst, size);
+
+        return;
+    }
+
+    if(memory_simd_erms_enabled && size >= MEMORY_SIMD_REP_MOVSB_THRESHOLD) {
+        memory_simd_rep_movsb(src, dst, size);
+
+        return;
+    }
+
+    memory_simd_v16_t tail = *(const memory_simd_v16_t*)(src + size - 16);
+    uint8_t* tail_dst = dst + size - 16;
+
+    while(size > 64) {
+        memory_simd_v16_t v0 = *(const memory_simd_v16_t*)(src);
+        memory_simd_v16_t v1 = *(const memory_simd_v16_t*)(src + 16);
+        memory_simd_v16_t v2 = *(const memory_simd_v16_t*)(src + 32);
+        memory_simd_v16_t v3 = *(const memory_simd_v16_t*)(src + 48);
+        *(memory_simd_v16_t*)(dst) = v0;
+        *(memory_simd_v16_t*)(dst + 16) = v1;
+        *(memory_simd_v16_t*)(dst + 32) = v2;
+        *(memory_simd_v16_t*)(dst + 48) = v3;
+        src += 64;
+        dst += 64;
+        size -= 64;
+    }
+
+    while(size > 16) {
+        *(memory_simd_v16_t*)dst = *(const memory_simd_v16_t*)src;
+        src += 16;
+        dst += 16;
+        size -= 16;
+    }
+
+    *(memory_simd_v16_t*)tail_dst = tail;
+}
+
+__attribute__((target("avx2"))) static void memory_simd_copy_avx2(const uint8_t* src, uint8_t* dst, size_t size) {
+    if(size <= 32) {
+        memory_simd_copy_sse2(src, dst, size);
+
+        return;
+    }
+
+    if(size <= 64) {
+        memory_simd_v32_t head = *(const memory_simd_v32_t*)src;
+        memory_simd_v32_t tail = *(const memory_simd_v32_t*)(src + size - 32);
+        *(memory_simd_v32_t*)dst = head;
+        *(memory_simd_v32_t*)(dst + size - 32) = tail;
+
+        return;
+    }
+
+    if(size >= MEMORY_SIMD_NONTEMPORAL_THRESHOLD) {
+        memory_simd_copy_nontemporal(src, dst, size);
+
+        return;
+    }
+
+    if(memory_simd_erms_enabled && size >= MEMORY_SIMD_REP_MOVSB_THRESHOLD) {
+        memory_simd_rep_movsb(src, dst, size);
+
+        return;
+    }
+
+    memory_simd_v32_t tail = *(const memory_simd_v32_t*)(src + size - 32);
+    uint8_t* tail_dst = dst + size - 32;
+
+    while(size > 128) {
+        memory_simd_v32_t v0 = *(const memory_simd_v32_t*)(src);
+        memory_simd_v32_t v1 = *(const memory_simd_v32_t*)(src + 32);
+        memory_simd_v32_t v2 = *(const memory_simd_v32_t*)(src + 64);
+        memory_simd_v32_t v3 = *(const memory_simd_v32_t*)(src + 96);
+        *(memory_simd_v32_t*)(dst) = v0;
+        *(memory_simd_v32_t*)(dst + 32) = v1;
+        *(memory_simd_v32_t*)(dst + 64) = v2;
+        *(memory_simd_v32_t*)(dst + 96) = v3;
+        src += 128;
+        dst += 128;
+        size -= 128;
+    }
+
+    while(size > 32) {
+        *(memory_simd_v32_t*)dst = *(const memory_simd_v32_t*)src;
+        src += 32;
+        dst += 32;
+        size -= 32;
+    }
+
+    *(memory_simd_v32_t*)tail_dst = tail;
+}
+
+static void memory_simd_set_sse2(uint8_t* dst, uint8_t value, size_t size) {
+    if(size < 16) {
+        uint64_t v = 0x0101010101010101ULL * value;
+
+        if(size >= 8) {
+            *(memory_simd_u64_t*)dst = v;
+            *(memory_simd_u64_t*)(dst + size - 8) = v;
+        } else if(size >= 4) {
+            *(memory_simd_u32_t*)dst = (uint32_t)v;
+            *(memory_simd_u32_t*)(dst + size - 4) = (uint32_t)v;
+        } else {
+            for(size_t i = 0; i < size; i++) {
+                dst[i] = value;
+            }
+        }
+
+        return;
+    }
+
+    memory_simd_v16_t v = {0};
+    v += (char)value;
+
+    if(size >= MEMORY_SIMD_NONTEMPORAL_THRESHOLD) {
+        *(memory_simd_v16_t*)dst = v;
+        *(memory_simd_v16_t*)(dst + size - 16) = v;
+
+        size_t head = (16 - ((uint64_t)dst & 15)) & 15;
+        dst += head;
+        size -= head;
+
+        while(size >= 16) {
+            __builtin_ia32_movntdq((memory_simd_v2di_t*)dst, (memory_simd_v2di_t)v);
+            dst += 16;
+            size -= 16;
+        }
+
+        asm volatile ("sfence" ::: "memory");
+
+        return;
+    }
+
+    if(memory_simd_erms_enabled && size >= MEMORY_SIMD_REP_MOVSB_THRESHOLD) {
+        asm volatile ("rep stosb"
+                      : "+D" (dst), "+c" (size)
+                      : "a" (value)
+                      : "memory");
+
+        return;
+    }
+
+    *(memory_simd_v16_t*)(dst + size - 16) = v;
+
+    // last block is covered by tail store
+    while(size > 16) {
+        *(memory_simd_v16_t*)dst = v;
+        dst += 16;
+        size -= 16;
+    }
+}
+
+__attribute__((target("avx2"))) static void memory_simd_set_avx2(uint8_t* dst, uint8_t value, size_t size) {
+    if(size < 32 || size >= MEMORY_SIMD_NONTEMPORAL_THRESHOLD || (memory_simd_erms_enabled && size >= MEMORY_SIMD_REP_MOVSB_THRESHOLD)) {
+        memory_simd_set_sse2(dst, value, size);
+
+        return;
+    }
+
+    memory_simd_v32_t v = {0};
+    v += (char)value;
+
+    *(memory_simd_v32_t*)(dst + size - 32) = v;
+
+    // last block is covered by tail store
+    while(size > 32) {
+        *(memory_simd_v32_t*)dst = v;
+        dst += 32;
+        size -= 32;
+    }
+}
+
+static inline int8_t memory_simd_compare_bytes(const uint8_t* mem1, const uint8_t* mem2, uint64_t mask) {
+    // mask has set bits for equal bytes
+    uint64_t idx = __builtin_ctzll(~mask);
+
+    return mem1[idx] < mem2[idx] ? -1 : 1;
+}
+
+static int8_t memory_simd_compare_sse2(const uint8_t* mem1, const uint8_t* mem2, size_t size) {
+    while(size >= 16) {
+        memory_simd_v16_t a = *(const memory_simd_v16_t*)mem1;
+        memory_simd_v16_t b = *(const memory_simd_v16_t*)mem2;
+        uint32_t mask = (uint32_t)__builtin_ia32_pmovmskb128((memory_simd_mask16_t)(a == b));
+
+        if(mask != 0xFFFF) {
+            return memory_simd_compare_bytes(mem1, mem2, mask);
+        }
+
+        mem1 += 16;
+        mem2 += 16;
+        size -= 16;
+    }
+
+    while(size >= 8) {
+        uint64_t a = *(const memory_simd_u64_t*)mem1;
+        uint64_t b = *(const memory_simd_u64_t*)mem2;
+
+        if(a != b) {
+            // first different byte is lowest set byte of xor at little endian
+            uint64_t idx = __builtin_ctzll(a ^ b) / 8;
+
+            return mem1[idx] < mem2[idx] ? -1 : 1;
+        }
+
+        mem1 += 8;
+        mem2 += 8;
+        size -= 8;
+    }
+
+    for(size_t i = 0; i < size; i++) {
+        if(mem1[i] != mem2[i]) {
+            return mem1[i] < mem2[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+__attribute__((target("avx2"))) static int8_t memory_simd_compare_avx2(const uint8_t* mem1, const uint8_t* mem2, size_t size) {
+    while(size >= 32) {
+        memory_simd_v32_t a = *(const memory_simd_v32_t*)mem1;
+        memory_simd_v32_t b = *(const memory_simd_v32_t*)mem2;
+        uint32_t mask = (uint32_t)__builtin_ia32_pmovmskb256((memory_simd_mask32_t)(a == b));
+
+        if(mask != 0xFFFFFFFF) {
+            return memory_simd_compare_bytes(mem1, mem2, mask | 0xFFFFFFFF00000000ULL);
+        }
+
+        mem1 += 32;
+        mem2 += 32;
+        size -= 32;
+    }
+
+    return memory_simd_compare_sse2(mem1, mem2, size);
+}
+
+static void memory_simd_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    memory_simd_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+
+    uint32_t max_leaf = eax;
+
+    memory_simd_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+    boolean_t osxsave = (ecx >> 27) & 1;
+    boolean_t avx = (ecx >> 28) & 1;
+    boolean_t avx2 = false;
+
+    if(max_leaf >= 7) {
+        uint32_t l7_ebx;
+
+        memory_simd_cpuid(7, 0, &eax, &l7_ebx, &ecx, &edx);
+
+        avx2 = (l7_ebx >> 5) & 1;
+        memory_simd_erms_enabled = (l7_ebx >> 9) & 1;
+    }
+
+    if(osxsave && avx && avx2) {
+        uint32_t xcr0_lo, xcr0_hi;
+
+        asm volatile ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+
+        // os should save sse and avx states
+        memory_simd_avx2_enabled = (xcr0_lo & 0x6) == 0x6;
+    }
+
+    if(memory_simd_avx2_enabled) {
+        memory_simd_set = &memory_simd_set_avx2;
+        memory_simd_compare = &memory_simd_compare_avx2;
+        memory_simd_copy = &memory_simd_copy_avx2;
+    } else {
+        memory_simd_set = &memory_simd_set_sse2;
+        memory_simd_compare = &memory_simd_compare_sse2;
+        memory_simd_copy = &memory_simd_copy_sse2;
+    }
+}
+
+int8_t memory_memset(void* address, uint8_t value, size_t size) {
+    if(address == NULL) {
+        return -1;
+    }
+
+    if(!size) {
+        return 0;
+    }
+
+    if(!memory_simd_set) {
+        memory_simd_init();
+    }
+
+    memory_simd_set(address, value, size);
+
+    return 0;
+}
+
+int8_t memory_memclean(void* address, size_t size) {
+    if(!address || !size) {
+        return 0;
+    }
+
+    return memory_memset(address, 0, size);
+}
+
+int8_t memory_memcopy(const void* source, void* destination, size_t size) {
+    if((!source && !destination) || !size) {
+        return 0;
+    }
+
+    if(source == NULL || destination == NULL) {
+        return -1;
+    }
+
+    const uint8_t* s_addr = source;
+    uint8_t* t_addr = destination;
+
+    // overlapping callers rely on forward byte copy, vector moves load tails before heads are written
+    if(s_addr < t_addr + size && t_addr < s_addr + size) {
+        for(size_t i = 0; i < size; i++) {
+            t_addr[i] = s_addr[i];
+        }
+
+        return 0;
+    }
+
+    if(!memory_simd_copy) {
+        memory_simd_init();
+    }
+
+    memory_simd_copy(s_addr, t_addr, size);
+
+    return 0;
+}
+
+int8_t memory_memcompare(const void* mem1, const void* mem2, size_t size) {
+    if(!size && ((!mem1 && !mem2) || (mem1 && mem2))) {
+        return 0;
+    }
+
+    if(!mem1 && mem2) {
+        return -1;
+    }
+
+    if(mem1 && !mem2) {
+        return 1;
+    }
+
+    if(size && !mem1 && !mem2) {
+        return 0;
+    }
+
+    if(mem1 == mem2) {
+        return 0;
+    }
+
+    if(!memory_simd_compare) {
+        memory_simd_init();
+    }
+
+    return memory_simd_compare(mem1, mem2, size);
+}
@@ -780,6 +780,10 @@ void memory_simple_stat(memory_heap_t* heap, memory_heap_stat_t* stat) {
         stat->free_size = simple_heap->free_size;
         stat->fast_hit = simple_heap->fast_hit;
         stat->header_count = simple_heap->header_count;
+        stat->cache_hit = 0;
+        stat->cache_refill_count = 0;
+        stat->cache_flush_count = 0;
+        stat->cached_count = 0;
 
     }
 }
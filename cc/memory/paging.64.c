@@ -10,6 +10,7 @@
 #include <memory.h>
 #include <memory/frame.h>
 #include <memory/paging.h>
+#include <memory/tlb.h>
 #include <cpu.h>
 #include <cpu/crx.h>
 #include <systeminfo.h>
@@ -118,8 +119,10 @@ memory_page_table_context_t* memory_paging_switch_table(const memory_page_table_
     __asm__ __volatile__ ("mov %%cr3, %0\n"
                           : "=r" (old_table));
 
+    old_table &= ~(MEMORY_PAGING_PAGE_SIZE - 1); // drop pcid bits
+
     if(new_table != NULL) {
-        __asm__ __volatile__ ("mov %0, %%cr3\n" : : "r" (MEMORY_PAGING_GET_FA_FOR_RESERVED_VA(new_table->page_table)));
+        __asm__ __volatile__ ("mov %0, %%cr3\n" : : "r" (memory_tlb_get_cr3((memory_page_table_context_t*)new_table)) : "memory");
     }
 
     if(!memory_paging_page_tables) {
@@ -163,6 +166,76 @@ memory_page_table_context_t* memory_paging_switch_table(const memory_page_table_
     return old_table_context;
 }
 
+static int8_t memory_paging_1g_pages_supported = -1;
+
+static boolean_t memory_paging_has_1g_pages(void) {
+    if(memory_paging_1g_pages_supported == -1) {
+        cpu_cpuid_regs_t query = {0x80000001, 0, 0, 0};
+        cpu_cpuid_regs_t answer = {0, 0, 0, 0};
+
+        if(cpu_cpuid(query, &answer) == 0 && (answer.edx & (1 << 26))) {
+            memory_paging_1g_pages_supported = 1;
+        } else {
+            memory_paging_1g_pages_supported = 0;
+        }
+    }
+
+    return memory_paging_1g_pages_supported == 1;
+}
+
+/**
+ * @brief splits a huge page entry into a table of smaller pages with same attributes
+ *
+ * 1g pages are splitted into 2m pages, 2m pages are splitted into 4k pages. entry is replaced
+ * with the new table and old translation is invalidated. at hugepage entries pat bit is the bit 12,
+ * at 4k entries it is bit 7, hence it is moved while splitting 2m page.
+ * @param[in] table_context page table context
+ * @param[in] entry huge page entry at p3 or p2
+ * @param[in] virtual_address any address inside huge page
+ * @param[in] page_length length of huge page
+ * @return 0 if succeed.
+ */
+static int8_t memory_paging_split_huge_page(memory_page_table_context_t* table_context, memory_page_entry_t* entry,
+                                            uint64_t virtual_address, uint64_t page_length) {
+    uint64_t table_fa = memory_paging_get_internal_frame(table_context);
+
+    if(table_fa == 0) {
+        return -1;
+    }
+
+    memory_page_table_t* table = (memory_page_table_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(table_fa);
+
+    uint64_t child_frame_count = (page_length / MEMORY_PAGING_INDEX_COUNT) / FRAME_SIZE;
+    uint64_t pat = entry->physical_address & 1;
+    uint64_t base = entry->physical_address & ~((page_length / FRAME_SIZE) - 1);
+
+    memory_page_entry_t child = *entry;
+
+    if(page_length == MEMORY_PAGING_PAGE_LENGTH_2M) {
+        child.hugepage = pat;
+        pat = 0;
+    }
+
+    for(size_t i = 0; i < MEMORY_PAGING_INDEX_COUNT; i++) {
+        child.physical_address = (base + i * child_frame_count) | pat;
+        table->pages[i] = child;
+    }
+
+    memory_page_entry_t parent = {0};
+    parent.present = 1;
+    parent.writable = 1;
+    parent.user_accessible = entry->user_accessible;
+    parent.physical_address = table_fa >> 12;
+
+    *entry = parent;
+
+    memory_tlb_invalidate(table_context, virtual_address & ~(page_length - 1ULL), 1, page_length);
+
+    PRINTLOG(PAGING, LOG_TRACE, "huge page of va 0x%llx with length 0x%llx splitted", virtual_address, page_length);
+
+    return 0;
+}
+
 int8_t memory_paging_add_page_ext(memory_page_table_context_t* table_context,
                                   uint64_t virtual_address, uint64_t frame_address,
                                   memory_paging_page_type_t type) {
@@ -278,6 +351,12 @@ int8_t memory_paging_add_page_ext(memory_page_table_context_t* table_context,
             return 0;
         }
 
+        // smaller page inside a 1g page, split it so the rest of the 1g page keeps its mapping
+        if(t_p3->pages[p3idx].hugepage == 1 &&
+           memory_paging_split_huge_page(table_context, &t_p3->pages[p3idx], virtual_address, MEMORY_PAGING_PAGE_LENGTH_1G) != 0) {
+            return -1;
+        }
+
         uint64_t tmp_pa = t_p3->pages[p3idx].physical_address;
         t_p2 = (memory_page_table_t*)(tmp_pa << 12);
         t_p2 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p2);
@@ -354,6 +433,11 @@ int8_t memory_paging_add_page_ext(memory_page_table_context_t* table_context,
             return 0;
         }
 
+        if(t_p2->pages[p2idx].hugepage == 1 &&
+           memory_paging_split_huge_page(table_context, &t_p2->pages[p2idx], virtual_address, MEMORY_PAGING_PAGE_LENGTH_2M) != 0) {
+            return -1;
+        }
+
         uint64_t tmp_pa = t_p2->pages[p2idx].physical_address;
         t_p1 = (memory_page_table_t*)(tmp_pa << 12);
         t_p1 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p1);
@@ -634,7 +718,7 @@ int8_t memory_paging_clear_page_ext(memory_page_table_context_t* table_context,
                 t_p3->pages[p3_idx].accessed = 0;
             }
 
-            cpu_tlb_invalidate(t_p3);
+            memory_tlb_invalidate(table_context, virtual_address & ~(MEMORY_PAGING_PAGE_LENGTH_1G - 1ULL), 1, MEMORY_PAGING_PAGE_LENGTH_1G);
 
         } else {
             t_p2 = (memory_page_table_t*)((uint64_t)(t_p3->pages[p3_idx].physical_address << 12));
@@ -660,7 +744,7 @@ int8_t memory_paging_clear_page_ext(memory_page_table_context_t* table_context,
                     t_p2->pages[p2_idx].accessed = 0;
                 }
 
-                cpu_tlb_invalidate(t_p2);
+                memory_tlb_invalidate(table_context, virtual_address & ~(MEMORY_PAGING_PAGE_LENGTH_2M - 1ULL), 1, MEMORY_PAGING_PAGE_LENGTH_2M);
 
 
             } else {
@@ -685,7 +769,7 @@ int8_t memory_paging_clear_page_ext(memory_page_table_context_t* table_context,
                     t_p1->pages[p1_idx].accessed = 0;
                 }
 
-                cpu_tlb_invalidate(t_p1);
+                memory_tlb_invalidate(table_context, virtual_address & ~(MEMORY_PAGING_PAGE_LENGTH_4K - 1ULL), 1, MEMORY_PAGING_PAGE_LENGTH_4K);
 
 
             }
@@ -730,134 +814,79 @@ int8_t memory_paging_toggle_attributes_ext(memory_page_table_context_t* table_co
 
     if(t_p3->pages[p3_idx].present == 0) {
         return -1;
-    } else {
-        if(t_p3->pages[p3_idx].hugepage == 1) {
-
-            if(type & MEMORY_PAGING_PAGE_TYPE_READONLY) {
-                t_p3->pages[p3_idx].writable = ~t_p3->pages[p3_idx].writable;
-            }
-
-            if(type & MEMORY_PAGING_PAGE_TYPE_NOEXEC) {
-                t_p3->pages[p3_idx].no_execute = ~t_p3->pages[p3_idx].no_execute;
-            }
-
-            if(type & MEMORY_PAGING_PAGE_TYPE_USER_ACCESSIBLE) {
-                t_p3->pages[p3_idx].user_accessible = ~t_p3->pages[p3_idx].user_accessible;
-            }
-
-            if(type & MEMORY_PAGING_PAGE_TYPE_WRITE_THROUGH) {
-                t_p3->pages[p3_idx].write_through_caching = ~t_p3->pages[p3_idx].write_through_caching;
-            }
-
-            if(type & MEMORY_PAGING_PAGE_TYPE_DISABLE_CACHE) {
-                t_p3->pages[p3_idx].disable_cache = ~t_p3->pages[p3_idx].disable_cache;
-            }
-
-            if(type & MEMORY_PAGING_PAGE_TYPE_GLOBAL) {
-                t_p3->pages[p3_idx].global = ~t_p3->pages[p3_idx].global;
-            }
-
-            cpu_tlb_invalidate(t_p3);
-            cpu_tlb_invalidate((void*)virtual_address);
-
-        } else {
-            if(type & MEMORY_PAGING_PAGE_TYPE_USER_ACCESSIBLE) {
-                t_p3->pages[p3_idx].user_accessible = ~t_p3->pages[p3_idx].user_accessible;
-            }
-
-            t_p2 = (memory_page_table_t*)((uint64_t)(t_p3->pages[p3_idx].physical_address << 12));
-            t_p2 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p2);
-
-            size_t p2_idx = MEMORY_PT_GET_P2_INDEX(virtual_address);
-
-            if(p2_idx >= MEMORY_PAGING_INDEX_COUNT) {
-                return -1;
-            }
-
-            if(t_p2->pages[p2_idx].present == 0) {
-                return -1;
-            }
-
-            if(t_p2->pages[p2_idx].hugepage == 1) {
-
-                if(type & MEMORY_PAGING_PAGE_TYPE_READONLY) {
-                    t_p2->pages[p2_idx].writable = ~t_p2->pages[p2_idx].writable;
-                }
-
-                if(type & MEMORY_PAGING_PAGE_TYPE_NOEXEC) {
-                    t_p2->pages[p2_idx].no_execute = ~t_p2->pages[p2_idx].no_execute;
-                }
-
-                if(type & MEMORY_PAGING_PAGE_TYPE_USER_ACCESSIBLE) {
-                    t_p2->pages[p2_idx].user_accessible = ~t_p2->pages[p2_idx].user_accessible;
-                }
-
-                if(type & MEMORY_PAGING_PAGE_TYPE_WRITE_THROUGH) {
-                    t_p2->pages[p2_idx].write_through_caching = ~t_p2->pages[p2_idx].write_through_caching;
-                }
+    }
 
-                if(type & MEMORY_PAGING_PAGE_TYPE_DISABLE_CACHE) {
-                    t_p2->pages[p2_idx].disable_cache = ~t_p2->pages[p2_idx].disable_cache;
-                }
+    // attributes are changed only for the 4k page of the address, so huge pages are splitted
+    if(t_p3->pages[p3_idx].hugepage == 1 &&
+       memory_paging_split_huge_page(table_context, &t_p3->pages[p3_idx], virtual_address, MEMORY_PAGING_PAGE_LENGTH_1G) != 0) {
+        return -1;
+    }
 
-                if(type & MEMORY_PAGING_PAGE_TYPE_GLOBAL) {
-                    t_p2->pages[p2_idx].global = ~t_p2->pages[p2_idx].global;
-                }
+    if(type & MEMORY_PAGING_PAGE_TYPE_USER_ACCESSIBLE) {
+        t_p3->pages[p3_idx].user_accessible = ~t_p3->pages[p3_idx].user_accessible;
+    }
 
-                cpu_tlb_invalidate(t_p2);
-                cpu_tlb_invalidate((void*)virtual_address);
+    t_p2 = (memory_page_table_t*)((uint64_t)(t_p3->pages[p3_idx].physical_address << 12));
+    t_p2 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p2);
 
+    size_t p2_idx = MEMORY_PT_GET_P2_INDEX(virtual_address);
 
-            } else {
-                if(type & MEMORY_PAGING_PAGE_TYPE_USER_ACCESSIBLE) {
-                    t_p2->pages[p2_idx].user_accessible = ~t_p2->pages[p2_idx].user_accessible;
-                }
+    if(p2_idx >= MEMORY_PAGING_INDEX_COUNT) {
+        return -1;
+    }
 
-                t_p1 = (memory_page_table_t*)((uint64_t)(t_p2->pages[p2_idx].physical_address << 12));
-                t_p1 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p1);
+    if(t_p2->pages[p2_idx].present == 0) {
+        return -1;
+    }
 
-                size_t p1_idx = MEMORY_PT_GET_P1_INDEX(virtual_address);
+    if(t_p2->pages[p2_idx].hugepage == 1 &&
+       memory_paging_split_huge_page(table_context, &t_p2->pages[p2_idx], virtual_address, MEMORY_PAGING_PAGE_LENGTH_2M) != 0) {
+        return -1;
+    }
 
-                if(p1_idx >= MEMORY_PAGING_INDEX_COUNT) {
-                    return -1;
-                }
+    if(type & MEMORY_PAGING_PAGE_TYPE_USER_ACCESSIBLE) {
+        t_p2->pages[p2_idx].user_accessible = ~t_p2->pages[p2_idx].user_accessible;
+    }
 
-                if(t_p1->pages[p1_idx].present == 0) {
-                    return -1;
-                }
+    t_p1 = (memory_page_table_t*)((uint64_t)(t_p2->pages[p2_idx].physical_address << 12));
+    t_p1 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p1);
 
-                if(type & MEMORY_PAGING_PAGE_TYPE_READONLY) {
-                    t_p1->pages[p1_idx].writable = ~t_p1->pages[p1_idx].writable;
-                }
+    size_t p1_idx = MEMORY_PT_GET_P1_INDEX(virtual_address);
 
-                if(type & MEMORY_PAGING_PAGE_TYPE_NOEXEC) {
-                    t_p1->pages[p1_idx].no_execute = ~t_p1->pages[p1_idx].no_execute;
-                }
+    if(p1_idx >= MEMORY_PAGING_INDEX_COUNT) {
+        return -1;
+    }
 
-                if(type & MEMORY_PAGING_PAGE_TYPE_USER_ACCESSIBLE) {
-                    t_p1->pages[p1_idx].user_accessible = ~t_p1->pages[p1_idx].user_accessible;
-                }
+    if(t_p1->pages[p1_idx].present == 0) {
+        return -1;
+    }
 
-                if(type & MEMORY_PAGING_PAGE_TYPE_WRITE_THROUGH) {
-                    t_p1->pages[p1_idx].write_through_caching = ~t_p1->pages[p1_idx].write_through_caching;
-                }
+    if(type & MEMORY_PAGING_PAGE_TYPE_READONLY) {
+        t_p1->pages[p1_idx].writable = ~t_p1->pages[p1_idx].writable;
+    }
 
-                if(type & MEMORY_PAGING_PAGE_TYPE_DISABLE_CACHE) {
-                    t_p1->pages[p1_idx].disable_cache = ~t_p1->pages[p1_idx].disable_cache;
-                }
+    if(type & MEMORY_PAGING_PAGE_TYPE_NOEXEC) {
+        t_p1->pages[p1_idx].no_execute = ~t_p1->pages[p1_idx].no_execute;
+    }
 
-                if(type & MEMORY_PAGING_PAGE_TYPE_GLOBAL) {
-                    t_p1->pages[p1_idx].global = ~t_p1->pages[p1_idx].global;
-                }
+    if(type & MEMORY_PAGING_PAGE_TYPE_USER_ACCESSIBLE) {
+        t_p1->pages[p1_idx].user_accessible = ~t_p1->pages[p1_idx].user_accessible;
+    }
 
-                cpu_tlb_invalidate(t_p1);
-                cpu_tlb_invalidate((void*)virtual_address);
+    if(type & MEMORY_PAGING_PAGE_TYPE_WRITE_THROUGH) {
+        t_p1->pages[p1_idx].write_through_caching = ~t_p1->pages[p1_idx].write_through_caching;
+    }
 
+    if(type & MEMORY_PAGING_PAGE_TYPE_DISABLE_CACHE) {
+        t_p1->pages[p1_idx].disable_cache = ~t_p1->pages[p1_idx].disable_cache;
+    }
 
-            }
-        }
+    if(type & MEMORY_PAGING_PAGE_TYPE_GLOBAL) {
+        t_p1->pages[p1_idx].global = ~t_p1->pages[p1_idx].global;
     }
 
+    memory_tlb_invalidate(table_context, virtual_address & ~(MEMORY_PAGING_PAGE_LENGTH_4K - 1ULL), 1, MEMORY_PAGING_PAGE_LENGTH_4K);
+
     return 0;
 }
 
@@ -895,69 +924,72 @@ int8_t memory_paging_set_user_accessible_ext(memory_page_table_context_t* table_
 
     if(t_p3->pages[p3_idx].present == 0) {
         return -1;
-    } else {
-        if(t_p3->pages[p3_idx].hugepage == 1) {
-            t_p3->pages[p3_idx].user_accessible = 1;
-
-            cpu_tlb_invalidate(t_p3);
-
-        } else {
-            t_p3->pages[p3_idx].user_accessible = 1;
-
-            t_p2 = (memory_page_table_t*)((uint64_t)(t_p3->pages[p3_idx].physical_address << 12));
-            t_p2 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p2);
-
-            size_t p2_idx = MEMORY_PT_GET_P2_INDEX(virtual_address);
+    }
 
-            if(p2_idx >= MEMORY_PAGING_INDEX_COUNT) {
-                return -1;
-            }
+    // only the 4k page of the address becomes user accessible, so huge pages are splitted
+    if(t_p3->pages[p3_idx].hugepage == 1 &&
+       memory_paging_split_huge_page(table_context, &t_p3->pages[p3_idx], virtual_address, MEMORY_PAGING_PAGE_LENGTH_1G) != 0) {
+        return -1;
+    }
 
-            if(t_p2->pages[p2_idx].present == 0) {
-                return -1;
-            }
+    t_p3->pages[p3_idx].user_accessible = 1;
 
-            if(t_p2->pages[p2_idx].hugepage == 1) {
-                t_p2->pages[p2_idx].user_accessible = 1;
+    t_p2 = (memory_page_table_t*)((uint64_t)(t_p3->pages[p3_idx].physical_address << 12));
+    t_p2 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p2);
 
-                cpu_tlb_invalidate(t_p2);
+    size_t p2_idx = MEMORY_PT_GET_P2_INDEX(virtual_address);
 
-            } else {
-                t_p2->pages[p2_idx].user_accessible = 1;
+    if(p2_idx >= MEMORY_PAGING_INDEX_COUNT) {
+        return -1;
+    }
 
-                t_p1 = (memory_page_table_t*)((uint64_t)(t_p2->pages[p2_idx].physical_address << 12));
-                t_p1 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p1);
+    if(t_p2->pages[p2_idx].present == 0) {
+        return -1;
+    }
 
-                size_t p1_idx = MEMORY_PT_GET_P1_INDEX(virtual_address);
+    if(t_p2->pages[p2_idx].hugepage == 1 &&
+       memory_paging_split_huge_page(table_context, &t_p2->pages[p2_idx], virtual_address, MEMORY_PAGING_PAGE_LENGTH_2M) != 0) {
+        return -1;
+    }
 
-                if(p1_idx >= MEMORY_PAGING_INDEX_COUNT) {
-                    return -1;
-                }
+    t_p2->pages[p2_idx].user_accessible = 1;
 
-                if(t_p1->pages[p1_idx].present == 0) {
-                    return -1;
-                }
+    t_p1 = (memory_page_table_t*)((uint64_t)(t_p2->pages[p2_idx].physical_address << 12));
+    t_p1 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p1);
 
-                t_p1->pages[p1_idx].user_accessible = 1;
+    size_t p1_idx = MEMORY_PT_GET_P1_INDEX(virtual_address);
 
+    if(p1_idx >= MEMORY_PAGING_INDEX_COUNT) {
+        return -1;
+    }
 
-                cpu_tlb_invalidate(t_p1);
+    if(t_p1->pages[p1_idx].present == 0) {
+        return -1;
+    }
 
+    t_p1->pages[p1_idx].user_accessible = 1;
 
-            }
-        }
-    }
+    memory_tlb_invalidate(table_context, virtual_address & ~(MEMORY_PAGING_PAGE_LENGTH_4K - 1ULL), 1, MEMORY_PAGING_PAGE_LENGTH_4K);
 
     return 0;
 }
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
-int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* table_context, uint64_t virtual_address, uint64_t* frame_address){
-
-    if(table_context == NULL) {
-        table_context = memory_paging_switch_table(NULL);
-    }
+/**
+ * @brief deletes page at virtual address, huge pages are deleted as whole if they fit into max length
+ *
+ * if huge page is not aligned to virtual address or it is longer than max length, it is splitted first.
+ * @param[in] table_context page table context
+ * @param[in] virtual_address address of page
+ * @param[in] max_length maximum length that can be unmapped starting from virtual address
+ * @param[out] frame_address frame address of deleted page
+ * @param[out] deleted_length length of deleted page
+ * @param[in] batch tlb batch for invalidation
+ * @return 0 if succeed.
+ */
+static int8_t memory_paging_delete_page_batched(memory_page_table_context_t* table_context, uint64_t virtual_address, uint64_t max_length,
+                                                uint64_t* frame_address, uint64_t* deleted_length, memory_tlb_batch_t* batch){
 
     memory_page_table_t* p4 = table_context->page_table;
 
@@ -989,12 +1021,20 @@ int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* tabl
     if(t_p3->pages[p3_idx].present == 0) {
         return -1;
     } else {
+        if(t_p3->pages[p3_idx].hugepage == 1 &&
+           (max_length < MEMORY_PAGING_PAGE_LENGTH_1G || (virtual_address % MEMORY_PAGING_PAGE_LENGTH_1G)) &&
+           memory_paging_split_huge_page(table_context, &t_p3->pages[p3_idx], virtual_address, MEMORY_PAGING_PAGE_LENGTH_1G) != 0) {
+            return -1;
+        }
+
         if(t_p3->pages[p3_idx].hugepage == 1) {
             if(frame_address) {
                 *frame_address = t_p3->pages[p3_idx].physical_address << 12;
             }
 
             memory_memclean(&t_p3->pages[p3_idx], sizeof(memory_page_entry_t));
+            memory_tlb_batch_add(batch, virtual_address & ~(MEMORY_PAGING_PAGE_LENGTH_1G - 1ULL), 1, MEMORY_PAGING_PAGE_LENGTH_1G);
+            *deleted_length = MEMORY_PAGING_PAGE_LENGTH_1G;
         } else {
             t_p2 = (memory_page_table_t*)((uint64_t)(t_p3->pages[p3_idx].physical_address << 12));
             t_p2 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p2);
@@ -1009,12 +1049,20 @@ int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* tabl
                 return -1;
             }
 
+            if(t_p2->pages[p2_idx].hugepage == 1 &&
+               (max_length < MEMORY_PAGING_PAGE_LENGTH_2M || (virtual_address % MEMORY_PAGING_PAGE_LENGTH_2M)) &&
+               memory_paging_split_huge_page(table_context, &t_p2->pages[p2_idx], virtual_address, MEMORY_PAGING_PAGE_LENGTH_2M) != 0) {
+                return -1;
+            }
+
             if(t_p2->pages[p2_idx].hugepage == 1) {
                 if(frame_address) {
                     *frame_address = t_p2->pages[p2_idx].physical_address << 12;
                 }
 
                 memory_memclean(&t_p2->pages[p2_idx], sizeof(memory_page_entry_t));
+                memory_tlb_batch_add(batch, virtual_address & ~(MEMORY_PAGING_PAGE_LENGTH_2M - 1ULL), 1, MEMORY_PAGING_PAGE_LENGTH_2M);
+                *deleted_length = MEMORY_PAGING_PAGE_LENGTH_2M;
             } else {
                 t_p1 = (memory_page_table_t*)((uint64_t)(t_p2->pages[p2_idx].physical_address << 12));
                 t_p1 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p1);
@@ -1034,6 +1082,8 @@ int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* tabl
                 }
 
                 memory_memclean(&t_p1->pages[p1_idx], sizeof(memory_page_entry_t));
+                memory_tlb_batch_add(batch, virtual_address & ~(MEMORY_PAGING_PAGE_LENGTH_4K - 1ULL), 1, MEMORY_PAGING_PAGE_LENGTH_4K);
+                *deleted_length = MEMORY_PAGING_PAGE_LENGTH_4K;
 
                 for(size_t i = 0; i < MEMORY_PAGING_INDEX_COUNT; i++) {
                     if(t_p1->pages[i].present == 1) {
@@ -1088,6 +1138,23 @@ int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* tabl
 }
 #pragma GCC diagnostic pop
 
+int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* table_context, uint64_t virtual_address, uint64_t* frame_address){
+    if(table_context == NULL) {
+        table_context = memory_paging_switch_table(NULL);
+    }
+
+    memory_tlb_batch_t batch;
+    memory_tlb_batch_init(&batch, table_context);
+
+    uint64_t deleted_length = 0;
+
+    int8_t res = memory_paging_delete_page_batched(table_context, virtual_address, MEMORY_PAGING_PAGE_LENGTH_4K, frame_address, &deleted_length, &batch);
+
+    memory_tlb_batch_flush(&batch);
+
+    return res;
+}
+
 int8_t memory_paging_get_physical_address_ext(memory_page_table_context_t* table_context, uint64_t virtual_address, uint64_t* physical_address){
     if(table_context == NULL) {
         table_context = memory_paging_switch_table(NULL);
@@ -1176,8 +1243,19 @@ int8_t memory_paging_add_va_for_frame_ext(memory_page_table_context_t* table_con
     uint64_t frm_addr = frm->frame_address;
     uint64_t frm_cnt = frm->frame_count;
 
+    // use biggest page which both addresses are aligned to and fits into remaining frames
+    boolean_t use_1g = memory_paging_has_1g_pages();
+
     while(frm_cnt) {
-        if(frm_cnt >= 0x200 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_2M) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
+        if(use_1g && frm_cnt >= 0x40000 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_1G) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_1G) == 0) {
+            if(memory_paging_add_page_with_p4(table_context, va_start, frm_addr, type | MEMORY_PAGING_PAGE_TYPE_1G) != 0) {
+                return -1;
+            }
+
+            frm_cnt -= 0x40000;
+            frm_addr += MEMORY_PAGING_PAGE_LENGTH_1G;
+            va_start += MEMORY_PAGING_PAGE_LENGTH_1G;
+        } else if(frm_cnt >= 0x200 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_2M) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
             if(memory_paging_add_page_with_p4(table_context, va_start, frm_addr, type | MEMORY_PAGING_PAGE_TYPE_2M) != 0) {
                 return -1;
             }
@@ -1204,28 +1282,33 @@ int8_t memory_paging_delete_va_for_frame_ext(memory_page_table_context_t* table_
         return -1;
     }
 
-    uint64_t frm_addr = frm->frame_address;
+    if(table_context == NULL) {
+        table_context = memory_paging_switch_table(NULL);
+    }
+
+    // all pages are invalidated together after loop, one ipi per cpu instead of one per page
+    memory_tlb_batch_t batch;
+    memory_tlb_batch_init(&batch, table_context);
+
+    int8_t res = 0;
+
     uint64_t frm_cnt = frm->frame_count;
 
+    // step with the length of page actually mapped, huge pages partially covered by frames are splitted
     while(frm_cnt) {
-        if(frm_cnt >= 0x200 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_2M) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
-            if(memory_paging_delete_page_ext(table_context, va_start, NULL) != 0) {
-                return -1;
-            }
+        uint64_t deleted_length = 0;
 
-            frm_cnt -= 0x200;
-            frm_addr += MEMORY_PAGING_PAGE_LENGTH_2M;
-            va_start += MEMORY_PAGING_PAGE_LENGTH_2M;
-        } else {
-            if(memory_paging_delete_page_ext(table_context, va_start, NULL) != 0) {
-                return -1;
-            }
+        if(memory_paging_delete_page_batched(table_context, va_start, frm_cnt * FRAME_SIZE, NULL, &deleted_length, &batch) != 0) {
+            res = -1;
 
-            frm_cnt--;
-            frm_addr += MEMORY_PAGING_PAGE_LENGTH_4K;
-            va_start += MEMORY_PAGING_PAGE_LENGTH_4K;
+            break;
         }
+
+        frm_cnt -= deleted_length / FRAME_SIZE;
+        va_start += deleted_length;
     }
 
-    return 0;
+    memory_tlb_batch_flush(&batch);
+
+    return res;
 }
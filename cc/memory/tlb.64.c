@@ -0,0 +1,367 @@
+/**
+ * @file tlb.64.c
+ * @brief tlb invalidation and cross cpu shootdown.
+ *
+ * page table changes are collected into batches. a batch is applied at local cpu and sent with one ipi to
+ * other cpus which loaded the table. when pcid is supported each page table has its own pcid, so cr3 loads
+ * keep tlb entries. invalidations of a table which is not loaded at a cpu mark its pcid stale at that cpu,
+ * and the table is loaded with a flush there next time.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <memory/tlb.h>
+#include <memory.h>
+#include <cpu.h>
+#include <cpu/crx.h>
+#include <cpu/interrupt.h>
+#include <apic.h>
+#include <logging.h>
+
+MODULE("turnstone.kernel.memory.tlb");
+
+/*! physical address bits of cr3 */
+#define MEMORY_TLB_CR3_ADDRESS_MASK 0x000FFFFFFFFFF000ULL
+/*! pcid bits of cr3 */
+#define MEMORY_TLB_CR3_PCID_MASK    0xFFFULL
+/*! cr3 bit which prevents flushing entries of loaded pcid */
+#define MEMORY_TLB_CR3_NOFLUSH      (1ULL << 63)
+
+/**
+ * @struct memory_tlb_cpu_state_t
+ * @brief per-cpu tlb state
+ */
+typedef struct memory_tlb_cpu_state_t {
+    uint64_t stale_pcids[(MEMORY_TLB_MAX_PCID + 1) / 64]; ///< pcids invalidated while they are not loaded
+    uint64_t shootdown_count; ///< received shootdown count
+} memory_tlb_cpu_state_t;
+
+/**
+ * @struct memory_tlb_shootdown_t
+ * @brief shootdown request, only one sender at a time
+ */
+typedef struct memory_tlb_shootdown_t {
+    volatile uint64_t         lock; ///< sender lock
+    volatile uint64_t         pending_mask; ///< cpus which have not applied request yet
+    const memory_tlb_batch_t* batch; ///< sender's batch, sender waits until all cpus apply it
+    uint64_t                  table_address; ///< physical address of batch's table
+    uint64_t                  pcid; ///< pcid of batch's table
+} memory_tlb_shootdown_t;
+
+boolean_t memory_tlb_initialized = false;
+boolean_t memory_tlb_pcid_enabled = false;
+uint64_t memory_tlb_cpu_count = 0;
+memory_tlb_cpu_state_t* memory_tlb_cpu_states = NULL;
+memory_tlb_shootdown_t memory_tlb_shootdown = {0};
+volatile uint64_t memory_tlb_next_pcid = 1;
+volatile uint64_t memory_tlb_online_mask = 0;
+
+int8_t memory_tlb_shootdown_isr(interrupt_frame_ext_t* frame);
+
+static inline uint64_t memory_tlb_cpu_bit(uint64_t cpu_id) {
+    return cpu_id < MEMORY_TLB_MAX_CPU_COUNT ? (1ULL << cpu_id) : 0;
+}
+
+static uint64_t memory_tlb_get_pcid(memory_page_table_context_t* table_context) {
+    uint64_t pcid = __atomic_load_n(&table_context->pcid, __ATOMIC_ACQUIRE);
+
+    if(pcid || !memory_tlb_pcid_enabled) {
+        return pcid;
+    }
+
+    uint64_t new_pcid = __atomic_fetch_add(&memory_tlb_next_pcid, 1, __ATOMIC_ACQ_REL);
+
+    // pcids are exhausted, table stays untagged and it is flushed at each load
+    if(new_pcid > MEMORY_TLB_MAX_PCID) {
+        return 0;
+    }
+
+    if(!__atomic_compare_exchange_n(&table_context->pcid, &pcid, new_pcid, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return pcid;
+    }
+
+    return new_pcid;
+}
+
+static void memory_tlb_mark_loaded(memory_page_table_context_t* table_context, uint64_t cpu_id) {
+    uint64_t bit = memory_tlb_cpu_bit(cpu_id);
+
+    if(bit && !(__atomic_load_n(&table_context->cpu_mask, __ATOMIC_ACQUIRE) & bit)) {
+        __atomic_or_fetch(&table_context->cpu_mask, bit, __ATOMIC_ACQ_REL);
+    }
+}
+
+int8_t memory_tlb_init(void) {
+    uint64_t cpu_id = apic_get_local_apic_id();
+
+    if(!memory_tlb_initialized) {
+        memory_tlb_cpu_count = apic_get_ap_count() + 1;
+
+        if(memory_tlb_cpu_count > MEMORY_TLB_MAX_CPU_COUNT) {
+            PRINTLOG(PAGING, LOG_WARNING, "tlb shootdown tracks only first 0x%x cpus", MEMORY_TLB_MAX_CPU_COUNT);
+        }
+
+        memory_tlb_cpu_states = memory_malloc(sizeof(memory_tlb_cpu_state_t) * memory_tlb_cpu_count);
+
+        if(memory_tlb_cpu_states == NULL) {
+            PRINTLOG(PAGING, LOG_ERROR, "cannot allocate tlb cpu states");
+
+            return -1;
+        }
+
+        if(interrupt_irq_set_handler(MEMORY_TLB_SHOOTDOWN_VECTOR - INTERRUPT_IRQ_BASE, &memory_tlb_shootdown_isr) != 0) {
+            PRINTLOG(PAGING, LOG_ERROR, "cannot set tlb shootdown irq");
+
+            return -1;
+        }
+
+        cpu_cpuid_regs_t query = {0};
+        cpu_cpuid_regs_t result;
+
+        query.eax = 0x1;
+
+        cpu_cpuid(query, &result);
+
+        memory_tlb_pcid_enabled = (result.ecx >> 17) & 0x1;
+
+        PRINTLOG(PAGING, LOG_INFO, "pcid supported %i", memory_tlb_pcid_enabled);
+
+        memory_tlb_initialized = true;
+    }
+
+    if(memory_tlb_pcid_enabled) {
+        // pcide can be set only when current pcid is zero, boot tables are loaded without pcid
+        if(cpu_read_cr3() & MEMORY_TLB_CR3_PCID_MASK) {
+            PRINTLOG(PAGING, LOG_ERROR, "cannot enable pcid, cr3 is already tagged");
+
+            return -1;
+        }
+
+        cpu_reg_cr4_t cr4 = cpu_read_cr4();
+        cr4.fields.process_context_identifier_enable = 1;
+        cpu_write_cr4(cr4);
+    }
+
+    // boot table is loaded without memory_tlb_get_cr3
+    memory_tlb_mark_loaded(memory_paging_get_table(), cpu_id);
+
+    __atomic_or_fetch(&memory_tlb_online_mask, memory_tlb_cpu_bit(cpu_id), __ATOMIC_ACQ_REL);
+
+    return 0;
+}
+
+uint64_t memory_tlb_get_cr3(memory_page_table_context_t* table_context) {
+    uint64_t table_address = MEMORY_PAGING_GET_FA_FOR_RESERVED_VA((uint64_t)table_context->page_table);
+
+    if(!memory_tlb_initialized) {
+        return table_address;
+    }
+
+    uint64_t cpu_id = apic_get_local_apic_id();
+
+    memory_tlb_mark_loaded(table_context, cpu_id);
+
+    if(!memory_tlb_pcid_enabled) {
+        return table_address;
+    }
+
+    uint64_t pcid = memory_tlb_get_pcid(table_context);
+
+    if(pcid == 0 || cpu_id >= memory_tlb_cpu_count) {
+        return table_address | pcid;
+    }
+
+    memory_tlb_cpu_state_t* cpu_state = &memory_tlb_cpu_states[cpu_id];
+
+    uint64_t stale_bit = 1ULL << (pcid % 64);
+
+    if(__atomic_load_n(&cpu_state->stale_pcids[pcid / 64], __ATOMIC_ACQUIRE) & stale_bit) {
+        __atomic_and_fetch(&cpu_state->stale_pcids[pcid / 64], ~stale_bit, __ATOMIC_ACQ_REL);
+
+        return table_address | pcid;
+    }
+
+    return table_address | pcid | MEMORY_TLB_CR3_NOFLUSH;
+}
+
+void memory_tlb_batch_init(memory_tlb_batch_t* batch, memory_page_table_context_t* table_context) {
+    if(batch == NULL) {
+        return;
+    }
+
+    if(table_context == NULL) {
+        table_context = memory_paging_get_table();
+    }
+
+    batch->table_context = table_context;
+    batch->range_count = 0;
+    batch->page_count = 0;
+    batch->full_flush = false;
+}
+
+void memory_tlb_batch_add(memory_tlb_batch_t* batch, uint64_t virtual_address, uint64_t page_count, uint64_t page_size) {
+    if(batch == NULL || batch->full_flush || page_count == 0) {
+        return;
+    }
+
+    batch->page_count += page_count;
+
+    if(batch->page_count > MEMORY_TLB_FULL_FLUSH_PAGE_COUNT) {
+        batch->full_flush = true;
+
+        return;
+    }
+
+    if(batch->range_count) {
+        memory_tlb_range_t* last = &batch->ranges[batch->range_count - 1];
+
+        if(last->page_size == page_size && last->start + last->page_count * page_size == virtual_address) {
+            last->page_count += page_count;
+
+            return;
+        }
+    }
+
+    if(batch->range_count == MEMORY_TLB_BATCH_MAX_RANGES) {
+        batch->full_flush = true;
+
+        return;
+    }
+
+    memory_tlb_range_t* range = &batch->ranges[batch->range_count++];
+
+    range->start = virtual_address;
+    range->page_count = page_count;
+    range->page_size = page_size;
+}
+
+static void memory_tlb_apply(const memory_tlb_batch_t* batch, uint64_t table_address, uint64_t pcid, uint64_t cpu_id) {
+    uint64_t cr3 = cpu_read_cr3();
+
+    boolean_t loaded = (cr3 & MEMORY_TLB_CR3_ADDRESS_MASK) == table_address;
+
+    if(memory_tlb_pcid_enabled) {
+        loaded = loaded && (cr3 & MEMORY_TLB_CR3_PCID_MASK) == pcid;
+    }
+
+    if(!loaded) {
+        // entries of untagged tables are dropped at each load, tagged ones are dropped at next load
+        if(memory_tlb_pcid_enabled && pcid && cpu_id < memory_tlb_cpu_count) {
+            __atomic_or_fetch(&memory_tlb_cpu_states[cpu_id].stale_pcids[pcid / 64], 1ULL << (pcid % 64), __ATOMIC_ACQ_REL);
+        }
+
+        return;
+    }
+
+    if(batch->full_flush) {
+        // reloading cr3 without noflush bit drops entries of current pcid
+        cpu_tlb_flush();
+
+        return;
+    }
+
+    for(uint64_t i = 0; i < batch->range_count; i++) {
+        const memory_tlb_range_t* range = &batch->ranges[i];
+        uint64_t va = range->start;
+
+        for(uint64_t j = 0; j < range->page_count; j++) {
+            cpu_tlb_invalidate((void*)va);
+            va += range->page_size;
+        }
+    }
+}
+
+static void memory_tlb_shootdown_handle(uint64_t cpu_id) {
+    uint64_t bit = memory_tlb_cpu_bit(cpu_id);
+
+    if(!bit || !(__atomic_load_n(&memory_tlb_shootdown.pending_mask, __ATOMIC_ACQUIRE) & bit)) {
+        return;
+    }
+
+    memory_tlb_apply(memory_tlb_shootdown.batch, memory_tlb_shootdown.table_address, memory_tlb_shootdown.pcid, cpu_id);
+
+    if(cpu_id < memory_tlb_cpu_count) {
+        memory_tlb_cpu_states[cpu_id].shootdown_count++;
+    }
+
+    __atomic_and_fetch(&memory_tlb_shootdown.pending_mask, ~bit, __ATOMIC_ACQ_REL);
+}
+
+int8_t memory_tlb_shootdown_isr(interrupt_frame_ext_t* frame) {
+    UNUSED(frame);
+
+    memory_tlb_shootdown_handle(apic_get_local_apic_id());
+
+    apic_eoi();
+
+    return 0;
+}
+
+void memory_tlb_batch_flush(memory_tlb_batch_t* batch) {
+    if(batch == NULL || (batch->range_count == 0 && !batch->full_flush)) {
+        return;
+    }
+
+    memory_page_table_context_t* table_context = batch->table_context;
+
+    if(table_context == NULL) {
+        table_context = memory_paging_get_table();
+        batch->table_context = table_context;
+    }
+
+    uint64_t table_address = MEMORY_PAGING_GET_FA_FOR_RESERVED_VA((uint64_t)table_context->page_table);
+
+    boolean_t intflag = cpu_cli();
+
+    uint64_t cpu_id = memory_tlb_initialized ? apic_get_local_apic_id() : 0;
+    uint64_t pcid = memory_tlb_pcid_enabled ? __atomic_load_n(&table_context->pcid, __ATOMIC_ACQUIRE) : 0;
+
+    memory_tlb_apply(batch, table_address, pcid, cpu_id);
+
+    uint64_t targets = __atomic_load_n(&table_context->cpu_mask, __ATOMIC_ACQUIRE) &
+                       __atomic_load_n(&memory_tlb_online_mask, __ATOMIC_ACQUIRE) &
+                       ~memory_tlb_cpu_bit(cpu_id);
+
+    if(memory_tlb_initialized && targets) {
+        // other senders wait their targets, we should answer them while waiting for lock
+        while(__atomic_exchange_n(&memory_tlb_shootdown.lock, 1, __ATOMIC_ACQUIRE)) {
+            memory_tlb_shootdown_handle(cpu_id);
+            asm volatile ("pause" ::: "memory");
+        }
+
+        memory_tlb_shootdown.batch = batch;
+        memory_tlb_shootdown.table_address = table_address;
+        memory_tlb_shootdown.pcid = pcid;
+
+        __atomic_store_n(&memory_tlb_shootdown.pending_mask, targets, __ATOMIC_RELEASE);
+
+        for(uint64_t i = 0; i < MEMORY_TLB_MAX_CPU_COUNT; i++) {
+            if(targets & (1ULL << i)) {
+                apic_send_ipi(i, MEMORY_TLB_SHOOTDOWN_VECTOR, false);
+            }
+        }
+
+        while(__atomic_load_n(&memory_tlb_shootdown.pending_mask, __ATOMIC_ACQUIRE)) {
+            asm volatile ("pause" ::: "memory");
+        }
+
+        __atomic_store_n(&memory_tlb_shootdown.lock, 0, __ATOMIC_RELEASE);
+    }
+
+    if(intflag) {
+        cpu_sti();
+    }
+
+    batch->range_count = 0;
+    batch->page_count = 0;
+    batch->full_flush = false;
+}
+
+void memory_tlb_invalidate(memory_page_table_context_t* table_context, uint64_t virtual_address, uint64_t page_count, uint64_t page_size) {
+    memory_tlb_batch_t batch;
+
+    memory_tlb_batch_init(&batch, table_context);
+    memory_tlb_batch_add(&batch, virtual_address, page_count, page_size);
+    memory_tlb_batch_flush(&batch);
+}
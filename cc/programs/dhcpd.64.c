@@ -112,55 +112,22 @@ int32_t network_dhcpv4_send_discover(uint64_t args_cnt, void** args) {
 
         network_transmit_packet_t* t_ip = (network_transmit_packet_t*)list_queue_pop(l_ip);
 
+        list_destroy(l_ip);
+
         if(t_ip == NULL) {
             PRINTLOG(NETWORK, LOG_ERROR, "ip packet is null, re trying...");
 
             continue;
         }
 
-        network_ipv4_header_t* ip = (network_ipv4_header_t*)t_ip->packet_data;
-
-        memory_free(t_ip);
-
-        uint16_t tl = BYTE_SWAP16(ip->total_length);
-
-        uint8_t* eth = (uint8_t*)network_ethernet_create_packet(BROADCAST_MAC, mac, NETWORK_PROTOCOL_IPV4, tl, (uint8_t*)ip);
-
-        if(eth == NULL) {
-            PRINTLOG(NETWORK, LOG_ERROR, "eth packet is null, re trying...");
-
-            continue;
-        }
-
-        network_transmit_packet_t* res = memory_malloc_ext(list_get_heap(ni->return_queue), sizeof(network_transmit_packet_t), 0);
+        network_transmit_packet_t* res = network_ethernet_prepend_header(t_ip, BROADCAST_MAC, mac, NETWORK_PROTOCOL_IPV4);
 
         if(res == NULL) {
-            PRINTLOG(NETWORK, LOG_ERROR, "network transmit packet is null, re trying...");
-
-            memory_free(eth);
-
-            continue;
-        }
-
-        res->packet_len = sizeof(network_ethernet_t) + tl;
-
-        uint8_t* packet_data = memory_malloc_ext(list_get_heap(ni->return_queue), res->packet_len, 0);
-
-        if(packet_data == NULL) {
-            PRINTLOG(NETWORK, LOG_ERROR, "packet data allocation failed, re trying...");
-
-            memory_free(eth);
-            memory_free_ext(list_get_heap(ni->return_queue), res);
+            PRINTLOG(NETWORK, LOG_ERROR, "eth packet is null, re trying...");
 
             continue;
         }
 
-        memory_memcopy(eth, packet_data, res->packet_len);
-
-        memory_free(eth);
-
-        res->packet_data = packet_data;
-
         ni->is_ipv4_address_requested = true;
 
         PRINTLOG(NETWORK, LOG_TRACE, "dhcp packet sending...");
@@ -11,6 +11,7 @@
 #include <logging.h>
 #include <memory.h>
 #include <memory/paging.h>
+#include <memory/tlb.h>
 #include <systeminfo.h>
 #include <strings.h>
 #include <cpu/interrupt.h>
@@ -334,6 +335,16 @@ int8_t kmain64(size_t entry_point) {
         cpu_hlt();
     }
 
+    if(time_timer_wheel_init() != 0) {
+        PRINTLOG(KERNEL, LOG_FATAL, "cannot init timer wheels. Halting...");
+        cpu_hlt();
+    }
+
+    if(memory_tlb_init() != 0) {
+        PRINTLOG(KERNEL, LOG_FATAL, "cannot init tlb shootdown. Halting...");
+        cpu_hlt();
+    }
+
     if(acpi_setup_events() != 0) {
         PRINTLOG(KERNEL, LOG_FATAL, "cannot setup acpi events");
         cpu_hlt();
@@ -17,13 +17,17 @@
 #include <time/timer.h>
 #include <network/network_protocols.h>
 #include <network/network_info.h>
+#include <network/network_netbuf.h>
+#include <network/network_tcpv4.h>
+#include <utils.h>
 
 MODULE("turnstone.user.programs.network");
 
-int8_t   network_process_rx(void);
+int32_t  network_process_rx(uint64_t args_cnt, void** args);
 uint64_t network_info_mke(const void* key);
 
-list_t* network_received_packets = NULL;
+network_rx_queue_t network_rx_queues[NETWORK_RX_QUEUE_MAX];
+uint64_t           network_rx_queues_count = 0;
 
 map_t* network_info_map = NULL;
 
@@ -39,6 +43,13 @@ int8_t network_transmit_packet_destroyer(memory_heap_t* heap, void* data) {
 
     network_transmit_packet_t* t_pckt = data;
 
+    if(t_pckt->netbuf) {
+        // packet is embedded into netbuf
+        network_netbuf_put(t_pckt->netbuf);
+
+        return 0;
+    }
+
     memory_free(t_pckt->packet_data);
     memory_free(t_pckt);
 
@@ -69,6 +80,21 @@ static int8_t network_set_return_queue(const network_mac_address_t* mac, list_t*
 }
 
 static int8_t network_send_packet_to_nic(network_transmit_packet_t* orginal_packet, list_t* return_queue) {
+    if(orginal_packet->netbuf) {
+        // netbuf travels to nic as is, driver releases it after transmit
+        if(list_queue_push(return_queue, orginal_packet) == -1ULL) {
+            network_transmit_packet_destroyer(NULL, orginal_packet);
+
+            task_yield();
+
+            return -1;
+        }
+
+        PRINTLOG(NETWORK, LOG_TRACE, "packet pushed to return queue");
+
+        return 0;
+    }
+
     network_transmit_packet_t* tx_packet = memory_malloc_ext(list_get_heap(return_queue), sizeof(network_transmit_packet_t), 0);
 
     if(tx_packet == NULL) {
@@ -112,12 +138,57 @@ static int8_t network_send_packet_to_nic(network_transmit_packet_t* orginal_pack
 }
 #pragma GCC diagnostic pop
 
-int8_t network_process_rx(void){
-    network_received_packets = list_create_queue_with_heap(NULL);
+uint64_t network_rx_queue_count(void) {
+    return network_rx_queues_count;
+}
+
+network_rx_queue_t* network_rx_queue_get(uint64_t queue_idx) {
+    if(network_rx_queues_count == 0) {
+        return NULL;
+    }
+
+    return &network_rx_queues[queue_idx % network_rx_queues_count];
+}
+
+uint64_t network_rx_queue_current(void) {
+    if(network_rx_queues_count == 0) {
+        return 0;
+    }
+
+    // queue i is pinned to cpu i
+    return task_get_cpu_id() % network_rx_queues_count;
+}
+
+// each rx queue is processed by its own task pinned to queue's cpu, a flow always stays at same queue
+static void network_rx_tcp_timer_callback(time_timer_t* timer, void* data) {
+    UNUSED(timer);
+
+    task_set_message_received((uint64_t)data);
+}
+
+int32_t network_process_rx(uint64_t args_cnt, void** args){
+    if(args_cnt != 1) {
+        PRINTLOG(NETWORK, LOG_ERROR, "invalid args count");
+
+        return -1;
+    }
+
+    network_rx_queue_t* rx_queue = (network_rx_queue_t*)args[0];
+    list_t* network_received_packets = rx_queue->packets;
 
     task_add_message_queue(network_received_packets);
 
+    // tcp retransmission and delayed ack deadlines of this queue's connections wake the task
+    time_timer_t tcp_timer = {0};
+    time_timer_init(&tcp_timer, network_rx_tcp_timer_callback, (void*)task_get_id());
+
     while(1) {
+        uint64_t tcp_deadline = network_tcpv4_timers_run(time_timer_get_tick_count());
+
+        if(tcp_deadline) {
+            time_timer_start(&tcp_timer, tcp_deadline, 0);
+        }
+
         if(list_size(network_received_packets) == 0) {
             PRINTLOG(NETWORK, LOG_TRACE, "no packet received, changing task");
             task_set_message_waiting();
@@ -136,13 +207,13 @@ int8_t network_process_rx(void){
 
                     network_set_return_queue(packet->network_info, packet->return_queue);
 
-                    return_list = network_ethernet_process_packet((network_ethernet_t*)packet->packet_data, packet->network_info);
+                    return_list = network_ethernet_process_packet(packet->netbuf, packet->network_info);
                 }
 
                 list_t* return_queue = packet->return_queue;
 
-                memory_free(packet->packet_data);
-                memory_free((void*)packet);
+                // packet is embedded into netbuf, replies built in place keep their own reference
+                network_netbuf_put(packet->netbuf);
 
                 if(return_list) {
                     if(return_queue) {
@@ -185,7 +256,47 @@ int8_t network_process_rx(void){
     return 0;
 }
 
-uint64_t network_rx_task_id = 0;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+static int8_t network_rx_queues_init(void) {
+    uint64_t cpu_count = task_get_cpu_count();
+
+    if(cpu_count == 0) {
+        cpu_count = 1;
+    }
+
+    uint64_t queue_count = MIN(cpu_count, NETWORK_RX_QUEUE_MAX);
+
+    for(uint64_t i = 0; i < queue_count; i++) {
+        network_rx_queue_t* rx_queue = &network_rx_queues[i];
+
+        rx_queue->packets = list_create_queue_with_heap(NULL);
+
+        if(rx_queue->packets == NULL) {
+            PRINTLOG(NETWORK, LOG_ERROR, "cannot create rx queue 0x%llx", i);
+
+            return -1;
+        }
+
+        void** args = memory_malloc(sizeof(void*));
+
+        if(args == NULL) {
+            return -1;
+        }
+
+        args[0] = rx_queue;
+
+        rx_queue->cpu_id = i;
+        rx_queue->task_id = task_create_task_on_cpu(NULL, 2 << 20, 64 << 10, &network_process_rx, 1, args, "network rx task", i);
+
+        network_rx_queues_count++;
+    }
+
+    PRINTLOG(NETWORK, LOG_INFO, "0x%llx rx queues started", network_rx_queues_count);
+
+    return 0;
+}
+#pragma GCC diagnostic pop
 
 int8_t network_init(void) {
     PRINTLOG(NETWORK, LOG_INFO, "network devices starting");
@@ -193,6 +304,19 @@ int8_t network_init(void) {
 
     network_info_map = map_new(&network_info_mke);
 
+    if(network_tcpv4_init() != 0) {
+        PRINTLOG(NETWORK, LOG_ERROR, "cannot initialize tcpv4");
+
+        return -1;
+    }
+
+    // nic drivers bind their queues to rx queues, so they are created first
+    if(network_rx_queues_init() != 0) {
+        PRINTLOG(NETWORK, LOG_ERROR, "cannot create rx queues");
+
+        return -1;
+    }
+
     iterator_t* iter = list_iterator_create(pci_get_context()->network_controllers);
 
     while(iter->end_of_iterator(iter) != 0) {
@@ -212,8 +336,6 @@ int8_t network_init(void) {
 
     iter->destroy(iter);
 
-    network_rx_task_id = task_create_task(NULL, 2 << 20, 64 << 10, &network_process_rx, 0, NULL, "network rx task");
-
     PRINTLOG(NETWORK, LOG_INFO, "network devices started");
 
     return errors;
@@ -11,6 +11,7 @@
 #include <driver/ahci.h>
 #include <driver/nvme.h>
 #include <disk.h>
+#include <disk_cache.h>
 #include <efi.h>
 #include <logging.h>
 #include <cpu/task.h>
@@ -527,7 +528,14 @@ int32_t tosdb_manager_main(int32_t argc, char_t** argv) {
     PRINTLOG(TOSDB, LOG_DEBUG, "TOSDB partition found");
     PRINTLOG(TOSDB, LOG_DEBUG, "TOSDB backend creating");
 
-    tosdb_backend_t* tosdb_backend = tosdb_backend_disk_new(tosdb_part);
+    disk_or_partition_t* tosdb_cached_part = disk_cache_new(tosdb_part, NULL);
+
+    if (tosdb_cached_part == NULL) {
+        PRINTLOG(TOSDB, LOG_ERROR, "Failed to create TOSDB partition cache");
+        return -1;
+    }
+
+    tosdb_backend_t* tosdb_backend = tosdb_backend_disk_new(tosdb_cached_part);
 
     if (tosdb_backend == NULL) {
         PRINTLOG(TOSDB, LOG_ERROR, "Failed to create TOSDB backend");
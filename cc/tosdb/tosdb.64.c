@@ -10,6 +10,7 @@
 #include <tosdb/tosdb_internal.h>
 #include <tosdb/tosdb_backend.h>
 #include <tosdb/tosdb_cache.h>
+#include <tosdb/wal.h>
 #include <buffer.h>
 #include <cpu/sync.h>
 #include <logging.h>
@@ -123,6 +124,15 @@ tosdb_t* tosdb_new(tosdb_backend_t* backend, compression_type_t compression_type
         }
     }
 
+    // sstable index data layout changed at minor version 2, there is no migration of older databases
+    if(main_sb->header.version_major != TOSDB_VERSION_MAJOR || main_sb->header.version_minor != TOSDB_VERSION_MINOR) {
+        PRINTLOG(TOSDB, LOG_ERROR, "unsupported database version %i.%i, expected %i.%i",
+                 main_sb->header.version_major, main_sb->header.version_minor, TOSDB_VERSION_MAJOR, TOSDB_VERSION_MINOR);
+        memory_free(main_sb);
+
+        return NULL;
+    }
+
     tosdb_t* res = memory_malloc(sizeof(tosdb_t));
 
     if(!res) {
@@ -132,6 +142,7 @@ tosdb_t* tosdb_new(tosdb_backend_t* backend, compression_type_t compression_type
         return NULL;
     }
 
+    res->heap = memory_get_heap(NULL);
     res->backend = backend;
     res->superblock = main_sb;
 
@@ -166,6 +177,27 @@ tosdb_t* tosdb_new(tosdb_backend_t* backend, compression_type_t compression_type
     }
 
     res->lock = lock_create();
+    res->block_lock = lock_create();
+
+    // before wal replay, replayed upserts also hand full memtables to flush task
+    tosdb_memtable_flush_start(res);
+    tosdb_compaction_start(res);
+
+    res->wal = tosdb_wal_new(res);
+
+    if(!res->wal) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create wal");
+        tosdb_free(res);
+
+        return NULL;
+    }
+
+    if(!tosdb_wal_replay(res->wal)) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot replay wal");
+        tosdb_free(res);
+
+        return NULL;
+    }
 
     return res;
 }
@@ -269,6 +301,9 @@ boolean_t tosdb_close(tosdb_t* tdb) {
 
     boolean_t error = false;
 
+    // running compaction finishes before tables are closed
+    tosdb_compaction_stop(tdb);
+
     iterator_t* iter = hashmap_iterator_create(tdb->databases);
 
     while (iter->end_of_iterator(iter) != 0) {
@@ -284,6 +319,9 @@ boolean_t tosdb_close(tosdb_t* tdb) {
 
     iter->destroy(iter);
 
+    // tables are persisted, flush queue is already empty
+    tosdb_memtable_flush_stop(tdb);
+
     if (tdb->is_dirty) {
         if (!tosdb_persist(tdb)) {
             PRINTLOG(TOSDB, LOG_ERROR, "cannot persist tosdb metadata");
@@ -316,6 +354,8 @@ boolean_t tosdb_free(tosdb_t * tdb) {
 
     PRINTLOG(TOSDB, LOG_DEBUG, "tosdb will be freed");
 
+    tosdb_compaction_stop(tdb);
+
     boolean_t error = false;
 
     iterator_t* iter = hashmap_iterator_create(tdb->databases);
@@ -333,8 +373,11 @@ boolean_t tosdb_free(tosdb_t * tdb) {
 
     iter->destroy(iter);
 
+    tosdb_memtable_flush_stop(tdb);
+    tosdb_wal_free(tdb->wal);
     memory_free(tdb->superblock);
     lock_destroy(tdb->lock);
+    lock_destroy(tdb->block_lock);
     hashmap_destroy(tdb->databases);
     hashmap_destroy(tdb->database_new);
     tosdb_cache_close(tdb->cache);
@@ -394,6 +437,70 @@ tosdb_block_header_t* tosdb_block_read(tosdb_t* tdb, uint64_t location, uint64_t
     return block;
 }
 
+uint64_t tosdb_block_allocate(tosdb_t* tdb, uint64_t min_size, uint64_t max_size, uint64_t* allocated_size) {
+    if(!tdb || !min_size || max_size < min_size) {
+        PRINTLOG(TOSDB, LOG_ERROR, "invalid block allocation request");
+
+        return 0;
+    }
+
+    tosdb_superblock_t* sb = tdb->superblock;
+
+    // flush task, wal rotation and table persists allocate concurrently, free location is advanced under lock
+    lock_acquire(tdb->block_lock);
+
+    uint64_t available = tdb->backend->capacity - sizeof(tosdb_superblock_t);
+
+    if(available <= sb->free_next_location) {
+        available = 0;
+    } else {
+        available -= sb->free_next_location;
+    }
+
+    uint64_t size = max_size;
+
+    if(size > available) {
+        size = available - (available % TOSDB_PAGE_SIZE);
+    }
+
+    if(size < min_size) {
+        lock_release(tdb->block_lock);
+
+        PRINTLOG(TOSDB, LOG_ERROR, "no space for block size 0x%llx", min_size);
+
+        return 0;
+    }
+
+    uint64_t location = sb->free_next_location;
+
+    sb->free_next_location += size;
+
+    lock_release(tdb->block_lock);
+
+    if(allocated_size) {
+        *allocated_size = size;
+    }
+
+    return location;
+}
+
+boolean_t tosdb_superblock_write(tosdb_t* tdb) {
+    if(!tdb) {
+        PRINTLOG(TOSDB, LOG_ERROR, "tosdb is null");
+
+        return false;
+    }
+
+    // superblock is not written while an allocation changes free location
+    lock_acquire(tdb->block_lock);
+
+    boolean_t res = tosdb_write_and_flush_superblock(tdb->backend, tdb->superblock);
+
+    lock_release(tdb->block_lock);
+
+    return res;
+}
+
 uint64_t tosdb_block_write(tosdb_t* tdb, tosdb_block_header_t* block) {
     if(!tdb || !block) {
         PRINTLOG(TOSDB, LOG_ERROR, "tosdb or block is null");
@@ -409,22 +516,37 @@ uint64_t tosdb_block_write(tosdb_t* tdb, tosdb_block_header_t* block) {
 
     block->checksum = csum;
 
-    uint64_t w_cnt = tdb->backend->write(tdb->backend, tdb->superblock->free_next_location, block->block_size, (uint8_t*)block);
+    uint64_t res = tosdb_block_allocate(tdb, block->block_size, block->block_size, NULL);
+
+    if(res == 0) {
+        return 0;
+    }
+
+    // allocated range is private to this writer
+    uint64_t w_cnt = tdb->backend->write(tdb->backend, res, block->block_size, (uint8_t*)block);
 
     if(w_cnt != block->block_size) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot write block");
 
-        return false;
+        return 0;
     }
 
-    uint64_t res = tdb->superblock->free_next_location;
-
-    tdb->superblock->free_next_location += block->block_size;
+    __atomic_add_fetch(&tdb->compaction_stats.written_bytes, block->block_size, __ATOMIC_RELAXED);
 
     return res;
 }
 
 
+boolean_t tosdb_commit(tosdb_t* tdb) {
+    if(!tdb || !tdb->wal) {
+        PRINTLOG(TOSDB, LOG_ERROR, "tosdb or wal is null");
+
+        return false;
+    }
+
+    return tosdb_wal_commit(tdb->wal, -1ULL);
+}
+
 boolean_t tosdb_persist(tosdb_t* tdb) {
     if(!tdb) {
         PRINTLOG(TOSDB, LOG_ERROR, "tosdb struct is null");
@@ -522,7 +644,14 @@ boolean_t tosdb_persist(tosdb_t* tdb) {
     hashmap_destroy(tdb->database_new);
     tdb->database_new = NULL;
 
-    if(!tosdb_write_and_flush_superblock(tdb->backend, tdb->superblock)) {
+    // all memtables are persisted, wal entries are not needed anymore
+    if(tdb->wal && !tosdb_wal_checkpoint(tdb->wal)) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot checkpoint wal");
+
+        return false;
+    }
+
+    if(!tosdb_superblock_write(tdb)) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot write and flush super block");
 
         return false;
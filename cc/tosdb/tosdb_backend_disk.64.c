@@ -11,9 +11,13 @@
 #include <tosdb/tosdb_backend.h>
 #include <logging.h>
 #include <logging.h>
+#include <memory/paging.h>
 
 MODULE("turnstone.kernel.db");
 
+/*! minimum write size which bypasses disk cache with vectored write */
+#define TOSDB_BACKEND_DISK_WRITEV_MIN_SIZE (64ULL << 10)
+
 
 typedef struct tosdb_backend_disk_ctx_t {
     disk_or_partition_t* dp;
@@ -82,6 +86,43 @@ uint8_t*  tosdb_backend_disk_read(tosdb_backend_t* backend, uint64_t position, u
     return read_res == 0?res:NULL;
 }
 
+static boolean_t tosdb_backend_disk_writev(tosdb_backend_disk_ctx_t* d_ctx, uint64_t lba, uint64_t size, uint8_t* data) {
+    uint64_t page_count = size / FRAME_SIZE;
+
+    disk_iovec_t* iov = memory_malloc(sizeof(disk_iovec_t) * page_count);
+
+    if(!iov) {
+        return false;
+    }
+
+    uint64_t iov_count = 0;
+
+    // physically contiguous pages are merged into one segment
+    for(uint64_t i = 0; i < page_count; i++) {
+        uint64_t fa = 0;
+
+        if(memory_paging_get_physical_address((uint64_t)data + i * FRAME_SIZE, &fa) != 0) {
+            memory_free(iov);
+
+            return false;
+        }
+
+        if(iov_count && iov[iov_count - 1].frame_address + iov[iov_count - 1].length == fa) {
+            iov[iov_count - 1].length += FRAME_SIZE;
+        } else {
+            iov[iov_count].frame_address = fa;
+            iov[iov_count].length = FRAME_SIZE;
+            iov_count++;
+        }
+    }
+
+    int8_t res = d_ctx->dp->writev(d_ctx->dp, lba, iov, iov_count);
+
+    memory_free(iov);
+
+    return res == 0;
+}
+
 uint64_t  tosdb_backend_disk_write(tosdb_backend_t* backend, uint64_t position, uint64_t size, uint8_t* data) {
     if(!backend) {
         return NULL;
@@ -93,6 +134,13 @@ uint64_t  tosdb_backend_disk_write(tosdb_backend_t* backend, uint64_t position,
     PRINTLOG(TOSDB, LOG_TRACE, "write to disk position 0x%llx (0x%llx) size 0x%llx (0x%llx)",
              position, position / bs, size, size / bs);
 
+    // large aligned blocks are written from their frames without bounce buffer, small ones stay at disk cache
+    if(d_ctx->dp->writev && size >= TOSDB_BACKEND_DISK_WRITEV_MIN_SIZE &&
+       ((uint64_t)data % FRAME_SIZE) == 0 && (size % FRAME_SIZE) == 0 &&
+       tosdb_backend_disk_writev(d_ctx, position / bs, size, data)) {
+        return size;
+    }
+
     uint64_t res = d_ctx->dp->write(d_ctx->dp, position / bs, size / bs, data);
 
     return res == 0?size:0;
@@ -62,6 +62,7 @@ uint64_t tosdb_cache_key_generator(const void* item) {
     xxhash64_update(hctx, &key->index_id, 8);
     xxhash64_update(hctx, &key->level, 8);
     xxhash64_update(hctx, &key->sstable_id, 8);
+    xxhash64_update(hctx, &key->chunk_id, 8);
 
     return xxhash64_final(hctx);
 }
@@ -110,6 +111,14 @@ int8_t tosdb_cache_key_comparator(const void* item1, const void* item2) {
         return 1;
     }
 
+    if(key1->chunk_id < key2->chunk_id) {
+        return -1;
+    }
+
+    if(key1->chunk_id > key2->chunk_id) {
+        return 1;
+    }
+
     return 0;
 }
 
@@ -131,6 +140,7 @@ boolean_t tosdb_cache_item_key_destroyer(const void* key, const void* item) {
 
         memory_free(c_id->index_items[0]);
         memory_free(c_id->index_items);
+        memory_free(c_id->valuelog_chunks);
         memory_free(c_id);
     } else if(ckey->type == TOSDB_CACHE_ITEM_TYPE_VALUELOG) {
         tosdb_cached_valuelog_t* c_vl = (tosdb_cached_valuelog_t*)item;
@@ -11,9 +11,44 @@
 #include <tosdb/tosdb_cache.h>
 #include <logging.h>
 #include <stdbufs.h>
+#include <bloomfilter.h>
+#include <compression.h>
+#include <skiplist.h>
+#include <cpu/task.h>
+#include <time.h>
+#include <time/timer.h>
 
 MODULE("turnstone.kernel.db");
 
+/*! sstable count of a level which triggers compaction */
+#define TOSDB_COMPACTION_LEVEL_MAX_SSTABLES 4
+/*! size limit of level one, limits of deeper levels grow with fanout */
+#define TOSDB_COMPACTION_LEVEL1_MAX_BYTES (16ULL << 20)
+/*! size ratio of consecutive levels */
+#define TOSDB_COMPACTION_LEVEL_FANOUT 10
+/*! deepest level, it is compacted into itself */
+#define TOSDB_COMPACTION_MAX_LEVEL 7
+/*! scheduler period in milliseconds */
+#define TOSDB_COMPACTION_PERIOD_MS 1000
+/*! compaction input rate in bytes per second */
+#define TOSDB_COMPACTION_RATE_LIMIT (32ULL << 20)
+/*! rate limiter bucket size, larger compactions wait for a full bucket */
+#define TOSDB_COMPACTION_RATE_BURST (128ULL << 20)
+
+/**
+ * @struct tosdb_compaction_candidate_t
+ * @brief most urgent level found by scheduler
+ */
+typedef struct tosdb_compaction_candidate_t {
+    tosdb_table_t* tbl; ///< table
+    uint64_t       level; ///< level to compact
+    uint64_t       score; ///< max of count and size ratios to limits, as percent
+    uint64_t       bytes; ///< input bytes of compaction, next level included for major
+    boolean_t      major; ///< merge with next level too
+} tosdb_compaction_candidate_t;
+
+static boolean_t tosdb_compaction_level_compact(tosdb_table_t* tbl, uint64_t level, boolean_t major);
+
 boolean_t tosdb_compact(tosdb_t* tdb, tosdb_compaction_type_t type) {
     if(!tdb) {
         return false;
@@ -241,8 +276,9 @@ static boolean_t tosdb_sstable_compact(const tosdb_table_t* tbl, const tosdb_ind
     }
 
     void** st_idx_items = NULL;
-    uint64_t valuelog_location = 0;
-    uint64_t valuelog_size = 0;
+    const tosdb_block_valuelog_chunk_t* vl_chunks = NULL;
+    tosdb_block_valuelog_chunk_t* vl_chunks_not_from_cache = NULL;
+    uint64_t vl_chunk_count = 0;
     uint64_t record_count = 0;
     uint8_t* idx_data = NULL;
     uint8_t* org_idx_data = NULL;
@@ -270,12 +306,10 @@ static boolean_t tosdb_sstable_compact(const tosdb_table_t* tbl, const tosdb_ind
         }
 
         record_count = c_id->record_count;
-        valuelog_location = c_id->valuelog_location;
-        valuelog_size = c_id->valuelog_size;
+        vl_chunks = c_id->valuelog_chunks;
+        vl_chunk_count = c_id->valuelog_chunk_count;
     } else {
         idx_not_from_cache = true;
-        valuelog_location = item->valuelog_location;
-        valuelog_size = item->valuelog_size;
 
         tosdb_block_sstable_index_data_t* b_sid = (tosdb_block_sstable_index_data_t*)tosdb_block_read(tbl->db->tdb, index_data_location, index_data_size);
 
@@ -287,6 +321,16 @@ static boolean_t tosdb_sstable_compact(const tosdb_table_t* tbl, const tosdb_ind
         }
 
         record_count = b_sid->record_count;
+        vl_chunk_count = b_sid->valuelog_chunk_count;
+        vl_chunks_not_from_cache = tosdb_valuelog_chunks_from_index_data(b_sid);
+        vl_chunks = vl_chunks_not_from_cache;
+
+        if(vl_chunk_count && !vl_chunks) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog chunk table");
+            memory_free(b_sid);
+
+            return false;
+        }
 
         buffer_t* buf_idx_in = buffer_encapsulate(b_sid->data, b_sid->index_data_size);
         buffer_t* buf_idx_out = buffer_new_with_capacity(NULL, b_sid->index_data_unpacked_size);
@@ -304,6 +348,7 @@ static boolean_t tosdb_sstable_compact(const tosdb_table_t* tbl, const tosdb_ind
         if(zc_res != 0 || zc != index_data_unpacked_size) {
             PRINTLOG(TOSDB, LOG_ERROR, "cannot unpack idx");
             buffer_destroy(buf_idx_out);
+            memory_free(vl_chunks_not_from_cache);
 
             return false;
         }
@@ -320,6 +365,7 @@ static boolean_t tosdb_sstable_compact(const tosdb_table_t* tbl, const tosdb_ind
         } else {
             PRINTLOG(TOSDB, LOG_ERROR, "cannot find index type");
             memory_free(idx_data);
+            memory_free(vl_chunks_not_from_cache);
 
             return false;
         }
@@ -329,6 +375,7 @@ static boolean_t tosdb_sstable_compact(const tosdb_table_t* tbl, const tosdb_ind
         if(!st_idx_items) {
             memory_free(idx_data);
             PRINTLOG(TOSDB, LOG_ERROR, "cannot create index item array");
+            memory_free(vl_chunks_not_from_cache);
 
             return false;
         }
@@ -351,79 +398,19 @@ static boolean_t tosdb_sstable_compact(const tosdb_table_t* tbl, const tosdb_ind
 
     }
 
-    buffer_t* buf_vl_out = NULL;
-    tosdb_cached_valuelog_t* c_vl = NULL;
-    boolean_t vl_not_from_cache = false;
-
-    cache_key.type = TOSDB_CACHE_ITEM_TYPE_VALUELOG;
-
-    if(tdb_cache) {
-        c_vl = (tosdb_cached_valuelog_t*)tosdb_cache_get(tdb_cache, &cache_key);
-    }
-
-    if(c_vl) {
-        buf_vl_out = c_vl->values;
-    } else {
-        vl_not_from_cache = true;
-        tosdb_block_valuelog_t* b_vl = (tosdb_block_valuelog_t*)tosdb_block_read(tbl->db->tdb, valuelog_location, valuelog_size);
-
-        if(!b_vl) {
-            PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog block");
-
-            if(idx_not_from_cache || !tdb_cache) {
-                memory_free(st_idx_items);
-                memory_free(org_idx_data);
-            }
-
-            return false;
-        }
+    buffer_t* buf_vl_out = tosdb_valuelog_read_all(tbl, vl_chunks, vl_chunk_count);
 
-        buffer_t* buf_vl_in = buffer_encapsulate(b_vl->data, b_vl->data_size);
+    memory_free(vl_chunks_not_from_cache);
 
-        if(!buf_vl_in) {
-            PRINTLOG(TOSDB, LOG_ERROR, "cannot encapsulate valuelog");
-
-            if(idx_not_from_cache || !tdb_cache) {
-                memory_free(st_idx_items);
-                memory_free(org_idx_data);
-            }
+    if(!buf_vl_out) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog");
 
-            return false;
+        if(idx_not_from_cache || !tdb_cache) {
+            memory_free(st_idx_items);
+            memory_free(org_idx_data);
         }
 
-        buf_vl_out = buffer_new_with_capacity(NULL, b_vl->valuelog_unpacked_size);
-
-        if(!buf_vl_out) {
-            PRINTLOG(TOSDB, LOG_ERROR, "cannot create valuelog buffer for decompress");
-
-            if(idx_not_from_cache || !tdb_cache) {
-                memory_free(st_idx_items);
-                memory_free(org_idx_data);
-            }
-
-            return false;
-        }
-
-        uint64_t buf_vl_unpacked_size = b_vl->valuelog_unpacked_size;
-
-        int8_t zc_res = compression->unpack(buf_vl_in, buf_vl_out);
-
-        uint64_t zc = buffer_get_length(buf_vl_out);
-
-        memory_free(b_vl);
-        buffer_destroy(buf_vl_in);
-
-        if(zc_res != 0 || zc != buf_vl_unpacked_size) {
-            PRINTLOG(TOSDB, LOG_ERROR, "cannotunpack valuelog");
-            buffer_destroy(buf_vl_out);
-
-            if(idx_not_from_cache || !tdb_cache) {
-                memory_free(st_idx_items);
-                memory_free(org_idx_data);
-            }
-
-            return false;
-        }
+        return false;
     }
 
     set_t* hole_set = set_create(tosdb_record_key_comparator);
@@ -514,9 +501,7 @@ exit:
         memory_free(org_idx_data);
     }
 
-    if(vl_not_from_cache || !tdb_cache) {
-        buffer_destroy(buf_vl_out);
-    }
+    buffer_destroy(buf_vl_out);
 
     return !error;
 }
@@ -645,29 +630,903 @@ boolean_t tosdb_table_compact(const tosdb_table_t* tbl, tosdb_compaction_type_t
 
     hashmap_destroy(level_holes);
 
-    UNUSED(type);
-/*
-    for(uint64_t i = 1; i <= tbl->sstable_max_level; i++) {
+    uint64_t max_level = tbl->sstable_max_level;
+
+    for(uint64_t i = 1; i <= max_level; i++) {
         if(type == TOSDB_COMPACTION_TYPE_MINOR) {
-            error = !tosdb_sstable_level_minor_compact(tbl, i);
+            error |= !tosdb_sstable_level_minor_compact((tosdb_table_t*)tbl, i);
         } else {
-            error = !tosdb_sstable_level_major_compact(tbl, i);
+            error |= !tosdb_sstable_level_major_compact((tosdb_table_t*)tbl, i);
         }
     }
- */
+
     return !error;
 }
 
-boolean_t tosdb_sstable_level_minor_compact(const tosdb_table_t* tbl, uint64_t level) {
-    UNUSED(tbl);
-    UNUSED(level);
-    NOTIMPLEMENTEDLOG(TOSDB);
-    return false;
+boolean_t tosdb_sstable_level_minor_compact(tosdb_table_t* tbl, uint64_t level) {
+    return tosdb_compaction_level_compact(tbl, level, false);
+}
+
+boolean_t tosdb_sstable_level_major_compact(tosdb_table_t* tbl, uint64_t level) {
+    return tosdb_compaction_level_compact(tbl, level, true);
+}
+
+static uint8_t* tosdb_compaction_index_data_read(const tosdb_table_t* tbl, const tosdb_block_sstable_list_item_t* stli, uint64_t index_id,
+                                                 uint64_t* record_count, tosdb_block_valuelog_chunk_t** chunks, uint64_t* chunk_count) {
+    uint64_t idx_loc = 0;
+    uint64_t idx_size = 0;
+
+    for(uint64_t i = 0; i < stli->index_count; i++) {
+        if(stli->indexes[i].index_id == index_id) {
+            idx_loc = stli->indexes[i].index_location;
+            idx_size = stli->indexes[i].index_size;
+
+            break;
+        }
+    }
+
+    if(!idx_loc || !idx_size) {
+        return NULL;
+    }
+
+    tosdb_block_sstable_index_t* st_idx = (tosdb_block_sstable_index_t*)tosdb_block_read(tbl->db->tdb, idx_loc, idx_size);
+
+    if(!st_idx) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot read sstable index from backend");
+
+        return NULL;
+    }
+
+    uint64_t index_data_location = st_idx->index_data_location;
+    uint64_t index_data_size = st_idx->index_data_size;
+
+    memory_free(st_idx);
+
+    tosdb_block_sstable_index_data_t* b_sid = (tosdb_block_sstable_index_data_t*)tosdb_block_read(tbl->db->tdb, index_data_location, index_data_size);
+
+    if(!b_sid) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot read index data");
+
+        return NULL;
+    }
+
+    if(chunks) {
+        *chunk_count = b_sid->valuelog_chunk_count;
+        *chunks = tosdb_valuelog_chunks_from_index_data(b_sid);
+
+        if(*chunk_count && !*chunks) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog chunk table");
+            memory_free(b_sid);
+
+            return NULL;
+        }
+    }
+
+    *record_count = b_sid->record_count;
+
+    uint64_t index_data_unpacked_size = b_sid->index_data_unpacked_size;
+
+    buffer_t* buf_idx_in = buffer_encapsulate(b_sid->data, b_sid->index_data_size);
+    buffer_t* buf_idx_out = buffer_new_with_capacity(NULL, index_data_unpacked_size);
+
+    int8_t zc_res = -1;
+
+    if(buf_idx_in && buf_idx_out) {
+        zc_res = tbl->db->tdb->compression->unpack(buf_idx_in, buf_idx_out);
+    }
+
+    buffer_destroy(buf_idx_in);
+    memory_free(b_sid);
+
+    if(zc_res != 0 || buffer_get_length(buf_idx_out) != index_data_unpacked_size) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot unpack index data");
+        buffer_destroy(buf_idx_out);
+
+        if(chunks) {
+            memory_free(*chunks);
+            *chunks = NULL;
+        }
+
+        return NULL;
+    }
+
+    return buffer_get_all_bytes_and_destroy(buf_idx_out, NULL);
+}
+
+static boolean_t tosdb_compaction_index_merge(tosdb_memtable_t* mt, tosdb_memtable_index_t* mt_idx, const uint8_t* idx_data, uint64_t record_count, uint64_t base_offset) {
+    boolean_t secondary = mt_idx->ti->type == TOSDB_INDEX_SECONDARY;
+
+    for(uint64_t i = 0; i < record_count; i++) {
+        uint64_t item_size = 0;
+
+        if(secondary) {
+            const tosdb_memtable_secondary_index_item_t* s_item = (const tosdb_memtable_secondary_index_item_t*)idx_data;
+            item_size = sizeof(tosdb_memtable_secondary_index_item_t) + s_item->secondary_key_length + s_item->primary_key_length;
+        } else {
+            const tosdb_memtable_index_item_t* p_item = (const tosdb_memtable_index_item_t*)idx_data;
+            item_size = sizeof(tosdb_memtable_index_item_t) + p_item->key_length;
+        }
+
+        void* item = skiplist_arena_malloc(mt_idx->index, item_size);
+
+        if(!item) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot allocate index item");
+
+            return false;
+        }
+
+        memory_memcopy(idx_data, item, item_size);
+        idx_data += item_size;
+
+        // values stay at adopted valuelog chunks, only their offsets move
+        if(secondary) {
+            tosdb_memtable_secondary_index_item_t* s_item = (tosdb_memtable_secondary_index_item_t*)item;
+            s_item->offset += base_offset;
+            s_item->level = mt->level;
+            s_item->sstable_id = mt->id;
+        } else {
+            tosdb_memtable_index_item_t* p_item = (tosdb_memtable_index_item_t*)item;
+            p_item->offset += base_offset;
+            p_item->level = mt->level;
+            p_item->sstable_id = mt->id;
+        }
+
+        // sources are merged from oldest to newest, newer item replaces older one
+        if(mt_idx->index->insert(mt_idx->index, item, item, NULL) != 0) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot insert index item");
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static boolean_t tosdb_compaction_index_finalize(tosdb_memtable_index_t* mt_idx, boolean_t drop_deleted) {
+    boolean_t secondary = mt_idx->ti->type == TOSDB_INDEX_SECONDARY;
+
+    if(drop_deleted) {
+        iterator_t* iter = mt_idx->index->create_iterator(mt_idx->index);
+
+        if(!iter) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot create index iterator");
+
+            return false;
+        }
+
+        // skiplist iterator can continue from an unlinked node, so deleted items are removed while iterating
+        while(iter->end_of_iterator(iter) != 0) {
+            const void* item = iter->get_item(iter);
+
+            if(secondary ? ((const tosdb_memtable_secondary_index_item_t*)item)->is_primary_key_deleted : ((const tosdb_memtable_index_item_t*)item)->is_deleted) {
+                mt_idx->index->delete(mt_idx->index, item, NULL);
+            }
+
+            iter = iter->next(iter);
+        }
+
+        iter->destroy(iter);
+    }
+
+    // memtable bloomfilter is sized for a memtable, merged sstable needs one for its real record count
+    bloomfilter_destroy(mt_idx->bloomfilter);
+    mt_idx->bloomfilter = bloomfilter_new(MAX(mt_idx->index->size(mt_idx->index), 1ULL), 0.1);
+
+    if(!mt_idx->bloomfilter) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create bloomfilter");
+
+        return false;
+    }
+
+    iterator_t* iter = mt_idx->index->create_iterator(mt_idx->index);
+
+    if(!iter) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create index iterator");
+
+        return false;
+    }
+
+    boolean_t error = false;
+
+    while(iter->end_of_iterator(iter) != 0) {
+        data_t d_key = {0};
+        d_key.type = DATA_TYPE_INT8_ARRAY;
+
+        if(secondary) {
+            tosdb_memtable_secondary_index_item_t* s_item = (tosdb_memtable_secondary_index_item_t*)iter->get_item(iter);
+            d_key.length = s_item->secondary_key_length;
+            d_key.value = s_item->data;
+
+            if(!d_key.length) {
+                d_key.length = sizeof(uint64_t);
+                d_key.value = &s_item->secondary_key_hash;
+            }
+        } else {
+            tosdb_memtable_index_item_t* p_item = (tosdb_memtable_index_item_t*)iter->get_item(iter);
+            d_key.length = p_item->key_length;
+            d_key.value = p_item->key;
+
+            if(!d_key.length) {
+                d_key.length = sizeof(uint64_t);
+                d_key.value = &p_item->key_hash;
+            }
+        }
+
+        if(!bloomfilter_add(mt_idx->bloomfilter, &d_key)) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot add key to bloomfilter");
+            error = true;
+
+            break;
+        }
+
+        iter = iter->next(iter);
+    }
+
+    iter->destroy(iter);
+
+    return !error;
 }
 
-boolean_t tosdb_sstable_level_major_compact(const tosdb_table_t* tbl, uint64_t level) {
-    UNUSED(tbl);
-    UNUSED(level);
-    NOTIMPLEMENTEDLOG(TOSDB);
+static tosdb_block_sstable_list_item_t* tosdb_compaction_merge(tosdb_table_t* tbl, const list_t* sources, uint64_t sstable_id, uint64_t target_level, boolean_t drop_deleted, boolean_t* error) {
+    *error = false;
+
+    tosdb_memtable_t* mt = tosdb_memtable_new_internal(tbl);
+
+    if(!mt) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create compaction memtable for table %s", tbl->name);
+        *error = true;
+
+        return NULL;
+    }
+
+    mt->tbl = tbl;
+    mt->id = sstable_id;
+    mt->level = target_level;
+    mt->is_full = true;
+    mt->is_readonly = true;
+
+    uint64_t base_offset = 0;
+
+    // sources are newest first, merge starts from oldest one
+    for(uint64_t s = list_size(sources); s > 0 && !*error; s--) {
+        const tosdb_block_sstable_list_item_t* src = list_get_data_at_position((list_t*)sources, s - 1);
+
+        tosdb_block_valuelog_chunk_t* chunks = NULL;
+        uint64_t chunk_count = 0;
+        boolean_t chunks_read = false;
+
+        iterator_t* iter = hashmap_iterator_create(mt->indexes);
+
+        if(!iter) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable index iterator");
+            *error = true;
+
+            break;
+        }
+
+        while(iter->end_of_iterator(iter) != 0) {
+            tosdb_memtable_index_t* mt_idx = (tosdb_memtable_index_t*)iter->get_item(iter);
+
+            uint64_t record_count = 0;
+            uint8_t* idx_data = tosdb_compaction_index_data_read(tbl, src, mt_idx->ti->id, &record_count,
+                                                                 chunks_read ? NULL : &chunks, &chunk_count);
+
+            if(!idx_data) {
+                // index is created after sstable, or it cannot be read
+                PRINTLOG(TOSDB, LOG_DEBUG, "index %lli of sstable %lli at level %lli is skipped", mt_idx->ti->id, src->sstable_id, src->level);
+                iter = iter->next(iter);
+
+                continue;
+            }
+
+            chunks_read = true;
+
+            if(!tosdb_compaction_index_merge(mt, mt_idx, idx_data, record_count, base_offset)) {
+                *error = true;
+            }
+
+            memory_free(idx_data);
+
+            if(*error) {
+                break;
+            }
+
+            iter = iter->next(iter);
+        }
+
+        iter->destroy(iter);
+
+        for(uint64_t i = 0; i < chunk_count && !*error; i++) {
+            tosdb_block_valuelog_chunk_t chunk = chunks[i];
+
+            chunk.unpacked_offset += base_offset;
+
+            if(!buffer_append_bytes(mt->valuelog_chunks, (uint8_t*)&chunk, sizeof(tosdb_block_valuelog_chunk_t))) {
+                PRINTLOG(TOSDB, LOG_ERROR, "cannot append valuelog chunk");
+                *error = true;
+            }
+        }
+
+        if(chunk_count) {
+            base_offset += chunks[chunk_count - 1].unpacked_offset + chunks[chunk_count - 1].unpacked_size;
+        }
+
+        memory_free(chunks);
+    }
+
+    if(!*error) {
+        iterator_t* iter = hashmap_iterator_create(mt->indexes);
+
+        if(!iter) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable index iterator");
+            *error = true;
+        } else {
+            while(iter->end_of_iterator(iter) != 0) {
+                tosdb_memtable_index_t* mt_idx = (tosdb_memtable_index_t*)iter->get_item(iter);
+
+                if(!tosdb_compaction_index_finalize(mt_idx, drop_deleted)) {
+                    *error = true;
+
+                    break;
+                }
+
+                if(mt_idx->ti->id == tbl->primary_index_id) {
+                    mt->record_count = mt_idx->index->size(mt_idx->index);
+                }
+
+                iter = iter->next(iter);
+            }
+
+            iter->destroy(iter);
+        }
+    }
+
+    tosdb_block_sstable_list_item_t* stli = NULL;
+
+    // all records may be deleted ones, then there is no output sstable
+    if(!*error && mt->record_count) {
+        if(tosdb_memtable_persist(mt)) {
+            stli = mt->stli;
+            mt->stli = NULL;
+        } else {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot persist merged sstable %lli of table %s", sstable_id, tbl->name);
+            *error = true;
+        }
+    }
+
+    tosdb_memtable_free(mt);
+
+    return stli;
+}
+
+static boolean_t tosdb_compaction_is_source(list_t* sources, const void* stli) {
+    // default list comparator compares contents, sources are matched by address
+    for(uint64_t i = 0; i < list_size(sources); i++) {
+        if(list_get_data_at_position(sources, i) == stli) {
+            return true;
+        }
+    }
+
     return false;
 }
+
+static list_t* tosdb_compaction_list_without(memory_heap_t* heap, list_t* st_list, list_t* sources, const tosdb_block_sstable_list_item_t* head) {
+    list_t* res = list_create_queue_with_heap(heap);
+
+    if(!res) {
+        return NULL;
+    }
+
+    if(head) {
+        list_queue_push(res, head);
+    }
+
+    for(uint64_t i = 0; i < list_size(st_list); i++) {
+        const void* stli = list_get_data_at_position(st_list, i);
+
+        if(!tosdb_compaction_is_source(sources, stli)) {
+            list_queue_push(res, stli);
+        }
+    }
+
+    return res;
+}
+
+static boolean_t tosdb_compaction_sstable_list_persist(tosdb_table_t* tbl) {
+    buffer_t* buf_stli = buffer_new_with_capacity(NULL, TOSDB_PAGE_SIZE);
+
+    if(!buf_stli) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable list buffer");
+
+        return false;
+    }
+
+    uint64_t stli_cnt = 0;
+
+    for(uint64_t level = 1; level <= tbl->sstable_max_level; level++) {
+        list_t* st_list = (list_t*)hashmap_get(tbl->sstable_levels, (void*)level);
+
+        for(uint64_t i = 0; i < list_size(st_list); i++) {
+            const tosdb_block_sstable_list_item_t* stli = list_get_data_at_position(st_list, i);
+
+            uint64_t size = sizeof(tosdb_block_sstable_list_item_t) + sizeof(tosdb_block_sstable_list_item_index_pair_t) * stli->index_count;
+
+            buffer_append_bytes(buf_stli, (uint8_t*)stli, size);
+            stli_cnt++;
+        }
+    }
+
+    uint64_t block_size = sizeof(tosdb_block_sstable_list_t) + buffer_get_length(buf_stli);
+
+    if(block_size % TOSDB_PAGE_SIZE) {
+        block_size += TOSDB_PAGE_SIZE - (block_size % TOSDB_PAGE_SIZE);
+    }
+
+    tosdb_block_sstable_list_t* block = memory_malloc(block_size);
+
+    if(!block) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable list block");
+        buffer_destroy(buf_stli);
+
+        return false;
+    }
+
+    // whole list of persisted sstables, older list blocks hold compacted ones
+    block->header.block_size = block_size;
+    block->header.block_type = TOSDB_BLOCK_TYPE_SSTABLE_LIST;
+    block->header.previous_block_location = tbl->sstable_list_location;
+    block->header.previous_block_size = tbl->sstable_list_size;
+    block->header.previous_block_invalid = true;
+    block->database_id = tbl->db->id;
+    block->table_id = tbl->id;
+    block->sstable_count = stli_cnt;
+
+    buffer_write_all_into(buf_stli, (uint8_t*)&block->sstables[0]);
+    buffer_destroy(buf_stli);
+
+    uint64_t block_loc = tosdb_block_write(tbl->db->tdb, (tosdb_block_header_t*)block);
+
+    memory_free(block);
+
+    if(!block_loc) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot write sstable list");
+
+        return false;
+    }
+
+    tbl->sstable_list_location = block_loc;
+    tbl->sstable_list_size = block_size;
+    tbl->is_dirty = true;
+
+    return true;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+static boolean_t tosdb_compaction_level_compact(tosdb_table_t* tbl, uint64_t level, boolean_t major) {
+    if(!tbl || !level) {
+        PRINTLOG(TOSDB, LOG_ERROR, "table is null or level is zero");
+
+        return false;
+    }
+
+    tosdb_t* tdb = tbl->db->tdb;
+    uint64_t target_level = level < TOSDB_COMPACTION_MAX_LEVEL ? level + 1 : level;
+
+    list_t* sources = list_create_list();
+
+    if(!sources) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create compaction source list");
+
+        return false;
+    }
+
+    rwlock_write_acquire(tbl->lock);
+
+    if(!tbl->is_open || tbl->compaction_disabled || tbl->compaction_running) {
+        rwlock_write_release(tbl->lock);
+        list_destroy(sources);
+
+        return true;
+    }
+
+    // newest first: unpersisted level one items, level items, then target level items for major
+    if(level == 1) {
+        for(uint64_t i = 0; i < list_size(tbl->sstable_list_items); i++) {
+            list_list_insert(sources, list_get_data_at_position(tbl->sstable_list_items, i));
+        }
+    }
+
+    list_t* level_list = tbl->sstable_levels ? (list_t*)hashmap_get(tbl->sstable_levels, (void*)level) : NULL;
+    list_t* target_list = tbl->sstable_levels ? (list_t*)hashmap_get(tbl->sstable_levels, (void*)target_level) : NULL;
+
+    for(uint64_t i = 0; i < list_size(level_list); i++) {
+        list_list_insert(sources, list_get_data_at_position(level_list, i));
+    }
+
+    if(major && target_level != level) {
+        for(uint64_t i = 0; i < list_size(target_list); i++) {
+            list_list_insert(sources, list_get_data_at_position(target_list, i));
+        }
+    }
+
+    if(!list_size(sources)) {
+        rwlock_write_release(tbl->lock);
+        list_destroy(sources);
+
+        return true;
+    }
+
+    // deleted records are dropped only if merged sstable holds every older version of them
+    boolean_t drop_deleted = major || target_level == level || !list_size(target_list);
+
+    for(uint64_t i = target_level + 1; i <= tbl->sstable_max_level && drop_deleted; i++) {
+        if(list_size((list_t*)hashmap_get(tbl->sstable_levels, (void*)i))) {
+            drop_deleted = false;
+        }
+    }
+
+    uint64_t sstable_id = tbl->memtable_next_id++;
+    tbl->is_dirty = true;
+    tbl->compaction_running = true;
+
+    rwlock_write_release(tbl->lock);
+
+    uint64_t read_bytes = 0;
+
+    for(uint64_t i = 0; i < list_size(sources); i++) {
+        read_bytes += tosdb_sstable_list_item_size(list_get_data_at_position(sources, i));
+    }
+
+    PRINTLOG(TOSDB, LOG_DEBUG, "table %s %s compaction of level %lli into %lli with %lli sstables of 0x%llx bytes",
+             tbl->name, major ? "major" : "minor", level, target_level, list_size(sources), read_bytes);
+
+    // sources are immutable, merge runs without table lock
+    boolean_t error = false;
+    tosdb_block_sstable_list_item_t* merged = tosdb_compaction_merge(tbl, sources, sstable_id, target_level, drop_deleted, &error);
+    boolean_t merged_owned = false;
+
+    rwlock_write_acquire(tbl->lock);
+
+    if(!error) {
+        // flushes may replace lists while merging, so new lists are built from current ones
+        list_t* cur_level_list = (list_t*)hashmap_get(tbl->sstable_levels, (void*)level);
+        list_t* cur_target_list = (list_t*)hashmap_get(tbl->sstable_levels, (void*)target_level);
+
+        // merged data is newer than target level, so it is the head of target level
+        list_t* new_level_list = tosdb_compaction_list_without(tdb->heap, cur_level_list, sources, target_level == level ? merged : NULL);
+        list_t* new_target_list = NULL;
+        list_t* new_stlis = NULL;
+
+        if(target_level != level) {
+            new_target_list = tosdb_compaction_list_without(tdb->heap, cur_target_list, sources, merged);
+        }
+
+        if(level == 1 && tbl->sstable_list_items) {
+            new_stlis = list_create_stack_with_heap(tdb->heap);
+
+            for(uint64_t i = list_size(tbl->sstable_list_items); new_stlis && i > 0; i--) {
+                const void* stli = list_get_data_at_position(tbl->sstable_list_items, i - 1);
+
+                if(!tosdb_compaction_is_source(sources, stli)) {
+                    list_stack_push(new_stlis, stli);
+                }
+            }
+        }
+
+        if(!tbl->sstable_retired_items) {
+            tbl->sstable_retired_items = list_create_list_with_heap(tdb->heap);
+        }
+
+        if(!tbl->sstable_retired_lists) {
+            tbl->sstable_retired_lists = list_create_list_with_heap(tdb->heap);
+        }
+
+        if(!new_level_list || (target_level != level && !new_target_list) || (level == 1 && tbl->sstable_list_items && !new_stlis) ||
+           !tbl->sstable_retired_items || !tbl->sstable_retired_lists) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot create new sstable lists for table %s", tbl->name);
+            list_destroy(new_level_list);
+            list_destroy(new_target_list);
+            list_destroy(new_stlis);
+            error = true;
+        } else {
+            if(new_stlis) {
+                // readers may still walk old stack, it is retired as level lists
+                list_list_insert(tbl->sstable_retired_lists, tbl->sstable_list_items);
+                tbl->sstable_list_items = new_stlis;
+            }
+
+            error |= !tosdb_table_sstable_level_replace(tbl, level, new_level_list);
+
+            if(new_target_list) {
+                error |= !tosdb_table_sstable_level_replace(tbl, target_level, new_target_list);
+            }
+
+            for(uint64_t i = 0; i < list_size(sources); i++) {
+                list_list_insert(tbl->sstable_retired_items, list_get_data_at_position(sources, i));
+            }
+
+            tosdb_table_sstable_reclaim(tbl);
+
+            // merged item is owned by level list now
+            if(!tosdb_compaction_sstable_list_persist(tbl)) {
+                PRINTLOG(TOSDB, LOG_ERROR, "cannot persist sstable list of table %s after compaction", tbl->name);
+                error = true;
+            }
+
+            merged_owned = true;
+        }
+    }
+
+    if(!merged_owned) {
+        memory_free_ext(tdb->heap, merged);
+    }
+
+    tbl->compaction_running = false;
+
+    rwlock_write_release(tbl->lock);
+
+    list_destroy(sources);
+
+    if(error) {
+        __atomic_add_fetch(&tdb->compaction_stats.failed_compaction_count, 1, __ATOMIC_RELAXED);
+        PRINTLOG(TOSDB, LOG_ERROR, "compaction of level %lli of table %s failed", level, tbl->name);
+
+        return false;
+    }
+
+    uint64_t written_bytes = merged ? tosdb_sstable_list_item_size(merged) - merged->valuelog_size : 0;
+
+    __atomic_add_fetch(&tdb->compaction_stats.compaction_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tdb->compaction_stats.compaction_read_bytes, read_bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tdb->compaction_stats.compaction_written_bytes, written_bytes, __ATOMIC_RELAXED);
+
+    PRINTLOG(TOSDB, LOG_INFO, "table %s level %lli compacted into level %lli, 0x%llx bytes read 0x%llx bytes written",
+             tbl->name, level, target_level, read_bytes, written_bytes);
+
+    return true;
+}
+#pragma GCC diagnostic pop
+
+static uint64_t tosdb_compaction_level_max_bytes(uint64_t level) {
+    uint64_t max_bytes = TOSDB_COMPACTION_LEVEL1_MAX_BYTES;
+
+    for(uint64_t i = 1; i < level; i++) {
+        max_bytes *= TOSDB_COMPACTION_LEVEL_FANOUT;
+    }
+
+    return max_bytes;
+}
+
+static void tosdb_compaction_table_score(tosdb_table_t* tbl, tosdb_compaction_candidate_t* best, uint64_t* pending_bytes) {
+    rwlock_read_acquire(tbl->lock);
+
+    if(!tbl->is_open || tbl->compaction_disabled || !tbl->sstable_levels) {
+        rwlock_read_release(tbl->lock);
+
+        return;
+    }
+
+    for(uint64_t level = 1; level <= tbl->sstable_max_level; level++) {
+        list_t* st_list = (list_t*)hashmap_get(tbl->sstable_levels, (void*)level);
+        uint64_t count = list_size(st_list);
+        uint64_t bytes = 0;
+
+        for(uint64_t i = 0; i < count; i++) {
+            bytes += tosdb_sstable_list_item_size(list_get_data_at_position(st_list, i));
+        }
+
+        if(level == 1) {
+            count += list_size(tbl->sstable_list_items);
+
+            for(uint64_t i = 0; i < list_size(tbl->sstable_list_items); i++) {
+                bytes += tosdb_sstable_list_item_size(list_get_data_at_position(tbl->sstable_list_items, i));
+            }
+        }
+
+        // a single sstable at deepest level is already compacted
+        if(level >= TOSDB_COMPACTION_MAX_LEVEL && count < 2) {
+            continue;
+        }
+
+        uint64_t count_score = count * 100 / TOSDB_COMPACTION_LEVEL_MAX_SSTABLES;
+        uint64_t bytes_score = bytes * 100 / tosdb_compaction_level_max_bytes(level);
+        uint64_t score = MAX(count_score, bytes_score);
+
+        if(score < 100) {
+            continue;
+        }
+
+        *pending_bytes += bytes;
+
+        if(score > best->score) {
+            best->tbl = tbl;
+            best->level = level;
+            best->score = score;
+            best->bytes = bytes;
+            // too many sstables are merged into one, too large level is pushed down together with next level
+            best->major = bytes_score > count_score;
+
+            if(best->major) {
+                list_t* next_list = (list_t*)hashmap_get(tbl->sstable_levels, (void*)(level + 1));
+
+                for(uint64_t i = 0; i < list_size(next_list); i++) {
+                    best->bytes += tosdb_sstable_list_item_size(list_get_data_at_position(next_list, i));
+                }
+            }
+        }
+    }
+
+    rwlock_read_release(tbl->lock);
+}
+
+static void tosdb_compaction_find_candidate(tosdb_t* tdb, tosdb_compaction_candidate_t* best, uint64_t* pending_bytes) {
+    lock_acquire(tdb->lock);
+
+    iterator_t* db_iter = hashmap_iterator_create(tdb->databases);
+
+    while(db_iter && db_iter->end_of_iterator(db_iter) != 0) {
+        tosdb_database_t* db = (tosdb_database_t*)db_iter->get_item(db_iter);
+
+        if(db->is_open && db->tables) {
+            lock_acquire(db->lock);
+
+            iterator_t* tbl_iter = hashmap_iterator_create(db->tables);
+
+            while(tbl_iter && tbl_iter->end_of_iterator(tbl_iter) != 0) {
+                tosdb_table_t* tbl = (tosdb_table_t*)tbl_iter->get_item(tbl_iter);
+
+                tosdb_compaction_table_score(tbl, best, pending_bytes);
+
+                tbl_iter = tbl_iter->next(tbl_iter);
+            }
+
+            if(tbl_iter) {
+                tbl_iter->destroy(tbl_iter);
+            }
+
+            lock_release(db->lock);
+        }
+
+        db_iter = db_iter->next(db_iter);
+    }
+
+    if(db_iter) {
+        db_iter->destroy(db_iter);
+    }
+
+    lock_release(tdb->lock);
+}
+
+static int32_t tosdb_compaction_task(int32_t argc, char_t** argv) {
+    if(argc != 1) {
+        return -1;
+    }
+
+    tosdb_t* tdb = (tosdb_t*)argv[0];
+
+    int64_t tokens = TOSDB_COMPACTION_RATE_BURST;
+    time_t last_refill = time_ns(NULL);
+
+    while(!tdb->compaction_is_closing) {
+        time_timer_msleep(TOSDB_COMPACTION_PERIOD_MS);
+
+        if(tdb->compaction_is_closing) {
+            break;
+        }
+
+        time_t now = time_ns(NULL);
+
+        tokens += (int64_t)((now - last_refill) * (TOSDB_COMPACTION_RATE_LIMIT >> 10) / (1000000000ULL >> 10));
+        tokens = MIN(tokens, (int64_t)TOSDB_COMPACTION_RATE_BURST);
+        last_refill = now;
+
+        tosdb_compaction_candidate_t best = {0};
+        uint64_t pending_bytes = 0;
+
+        tosdb_compaction_find_candidate(tdb, &best, &pending_bytes);
+
+        __atomic_store_n(&tdb->compaction_stats.pending_compaction_bytes, pending_bytes, __ATOMIC_RELAXED);
+
+        if(!best.tbl) {
+            continue;
+        }
+
+        uint64_t input_bytes = best.bytes;
+
+        // large compactions wait for a full bucket, then bucket goes negative and next ones wait longer
+        if(tokens < (int64_t)input_bytes && tokens < (int64_t)TOSDB_COMPACTION_RATE_BURST) {
+            PRINTLOG(TOSDB, LOG_TRACE, "compaction of table %s level %lli is throttled", best.tbl->name, best.level);
+
+            continue;
+        }
+
+        tokens -= input_bytes;
+
+        tosdb_compaction_level_compact(best.tbl, best.level, best.major);
+    }
+
+    tdb->compaction_task_exited = true;
+
+    return 0;
+}
+
+boolean_t tosdb_compaction_start(tosdb_t* tdb) {
+    if(!tdb) {
+        PRINTLOG(TOSDB, LOG_ERROR, "tosdb is null");
+
+        return false;
+    }
+
+    tdb->compaction_task_args = memory_malloc(sizeof(void*));
+
+    if(tdb->compaction_task_args) {
+        tdb->compaction_task_args[0] = tdb;
+
+        tdb->compaction_task_id = task_create_task(NULL, 2 << 20, 64 << 10, tosdb_compaction_task, 1, (void**)tdb->compaction_task_args, "tosdb compaction");
+
+        if(tdb->compaction_task_id == -1ULL) {
+            tdb->compaction_task_id = 0;
+        }
+    }
+
+    if(!tdb->compaction_task_id) {
+        PRINTLOG(TOSDB, LOG_WARNING, "cannot create compaction task, sstables are compacted only on request");
+
+        return false;
+    }
+
+    return true;
+}
+
+void tosdb_compaction_stop(tosdb_t* tdb) {
+    if(!tdb) {
+        return;
+    }
+
+    if(tdb->compaction_task_id) {
+        tdb->compaction_is_closing = true;
+
+        while(!tdb->compaction_task_exited) {
+            task_yield();
+        }
+
+        tdb->compaction_task_id = 0;
+    }
+
+    memory_free(tdb->compaction_task_args);
+    tdb->compaction_task_args = NULL;
+}
+
+void tosdb_compaction_table_disable(tosdb_table_t* tbl) {
+    if(!tbl || !tbl->lock) {
+        return;
+    }
+
+    rwlock_write_acquire(tbl->lock);
+    tbl->compaction_disabled = true;
+    rwlock_write_release(tbl->lock);
+
+    while(tbl->compaction_running) {
+        task_yield();
+    }
+}
+
+boolean_t tosdb_compaction_stats_get(tosdb_t* tdb, tosdb_compaction_stats_t* stats) {
+    if(!tdb || !stats) {
+        PRINTLOG(TOSDB, LOG_ERROR, "tosdb or stats is null");
+
+        return false;
+    }
+
+    stats->compaction_count = __atomic_load_n(&tdb->compaction_stats.compaction_count, __ATOMIC_RELAXED);
+    stats->failed_compaction_count = __atomic_load_n(&tdb->compaction_stats.failed_compaction_count, __ATOMIC_RELAXED);
+    stats->compaction_read_bytes = __atomic_load_n(&tdb->compaction_stats.compaction_read_bytes, __ATOMIC_RELAXED);
+    stats->compaction_written_bytes = __atomic_load_n(&tdb->compaction_stats.compaction_written_bytes, __ATOMIC_RELAXED);
+    stats->flushed_bytes = __atomic_load_n(&tdb->compaction_stats.flushed_bytes, __ATOMIC_RELAXED);
+    stats->written_bytes = __atomic_load_n(&tdb->compaction_stats.written_bytes, __ATOMIC_RELAXED);
+    stats->pending_compaction_bytes = __atomic_load_n(&tdb->compaction_stats.pending_compaction_bytes, __ATOMIC_RELAXED);
+    stats->write_amplification = stats->flushed_bytes ? stats->written_bytes * 100 / stats->flushed_bytes : 0;
+
+    return true;
+}
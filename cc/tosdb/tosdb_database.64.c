@@ -66,6 +66,16 @@ boolean_t tosdb_database_load_tables(tosdb_database_t* db) {
             tbl->db = db;
             tbl->id = tbl_list->tables[i].id;
             tbl->name = strdup(name_buf);
+            tbl->lock = rwlock_create();
+
+            if(!tbl->lock) {
+                PRINTLOG(TOSDB, LOG_ERROR, "cannot create table lock");
+                memory_free(tbl->name);
+                memory_free(tbl);
+                memory_free(tbl_list);
+
+                return false;
+            }
             tbl->is_deleted = tbl_list->tables[i].deleted;
             tbl->metadata_location = tbl_list->tables[i].metadata_location;
             tbl->metadata_size = tbl_list->tables[i].metadata_size;
@@ -271,6 +281,7 @@ boolean_t tosdb_database_close(tosdb_database_t* db) {
             }
 
             hashmap_destroy(db->sequences);
+            db->sequences = NULL;
         } else {
             PRINTLOG(TOSDB, LOG_TRACE, "database %s has no sequences", db->name);
         }
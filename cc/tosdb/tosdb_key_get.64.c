@@ -209,6 +209,20 @@ static boolean_t tosdb_key_sstable_get_on_index(const tosdb_table_t* tbl, tosdb_
 
         uint64_t index_data_unpacked_size = b_sid->index_data_unpacked_size;
 
+        tosdb_block_valuelog_chunk_t* vl_chunks = NULL;
+        uint64_t vl_chunk_count = b_sid->valuelog_chunk_count;
+
+        if(tdb_cache && vl_chunk_count) {
+            vl_chunks = tosdb_valuelog_chunks_from_index_data(b_sid);
+
+            if(!vl_chunks) {
+                PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog chunk table");
+                memory_free(b_sid);
+
+                return false;
+            }
+        }
+
         memory_free(b_sid);
 
         buffer_destroy(buf_idx_in);
@@ -216,6 +230,7 @@ static boolean_t tosdb_key_sstable_get_on_index(const tosdb_table_t* tbl, tosdb_
         if(zc_res != 0 || zc != index_data_unpacked_size) {
             PRINTLOG(TOSDB, LOG_ERROR, "cannot zunpack idx");
             buffer_destroy(buf_idx_out);
+            memory_free(vl_chunks);
 
             return false;
         }
@@ -235,6 +250,7 @@ static boolean_t tosdb_key_sstable_get_on_index(const tosdb_table_t* tbl, tosdb_
         if(!st_idx_items) {
             memory_free(idx_data);
             PRINTLOG(TOSDB, LOG_ERROR, "cannot create index item array");
+            memory_free(vl_chunks);
 
             return false;
         }
@@ -264,6 +280,7 @@ static boolean_t tosdb_key_sstable_get_on_index(const tosdb_table_t* tbl, tosdb_
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot allocate cached index data");
                 memory_free(st_idx_items);
                 memory_free(idx_data);
+                memory_free(vl_chunks);
 
                 return false;
             }
@@ -279,7 +296,10 @@ static boolean_t tosdb_key_sstable_get_on_index(const tosdb_table_t* tbl, tosdb_
             c_id->record_count = record_count;
             c_id->valuelog_location = sli->valuelog_location;
             c_id->valuelog_size = sli->valuelog_size;
-            c_id->cache_key.data_size = sizeof(tosdb_cached_index_data_t) + index_data_unpacked_size + st_idx_items_len;
+            c_id->valuelog_chunks = vl_chunks;
+            c_id->valuelog_chunk_count = vl_chunk_count;
+            c_id->cache_key.data_size = sizeof(tosdb_cached_index_data_t) + index_data_unpacked_size + st_idx_items_len +
+                                        sizeof(tosdb_block_valuelog_chunk_t) * vl_chunk_count;
 
             tosdb_cache_put(tdb_cache, (tosdb_cache_key_t*)c_id);
         }
@@ -402,6 +422,9 @@ boolean_t tosdb_table_get_keys_internal(const tosdb_table_t* tbl, uint64_t key_i
         }
     }
 
+    // sstable lists are walked without table lock, reader keeps retired lists and items alive
+    tosdb_table_sstable_reader_enter((tosdb_table_t*)tbl);
+
     if(!error && tbl->sstable_list_items) {
         error = !tosdb_key_sstable_get_on_list(tbl, tbl->sstable_list_items, key_index, keys, old_keys);
     }
@@ -421,5 +444,7 @@ boolean_t tosdb_table_get_keys_internal(const tosdb_table_t* tbl, uint64_t key_i
         }
     }
 
+    tosdb_table_sstable_reader_leave((tosdb_table_t*)tbl);
+
     return !error;
 }
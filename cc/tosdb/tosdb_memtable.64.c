@@ -9,10 +9,12 @@
 
 #include <tosdb/tosdb.h>
 #include <tosdb/tosdb_internal.h>
+#include <tosdb/wal.h>
 #include <logging.h>
-#include <bplustree.h>
+#include <skiplist.h>
 #include <compression.h>
 #include <strings.h>
+#include <cpu/task.h>
 
 MODULE("turnstone.kernel.db");
 
@@ -66,31 +68,6 @@ int8_t tosdb_memtable_record_id_comparator(const void* i1, const void* i2) {
     return 0;
 }
 
-static int8_t tosdb_memtable_index_key_destroyer(memory_heap_t* heap, void* key) {
-    memory_free_ext(heap, key);
-    return 0;
-}
-
-static int8_t tosdb_memtable_index_key_cloner(memory_heap_t* heap, const void* key, void** cloned_key) {
-    if(!key || !cloned_key) {
-        return -1;
-    }
-
-    tosdb_memtable_index_item_t* src = (tosdb_memtable_index_item_t*)key;
-
-    uint64_t key_size = sizeof(tosdb_memtable_index_item_t) + src->key_length;
-
-    *cloned_key = memory_malloc_ext(heap, key_size, 0);
-
-    if(!*cloned_key) {
-        return -1;
-    }
-
-    memory_memcopy(key, *cloned_key, key_size);
-
-    return 0;
-}
-
 int8_t tosdb_memtable_secondary_index_comparator(const void* i1, const void* i2) {
     const tosdb_memtable_secondary_index_item_t* ti1 = (tosdb_memtable_secondary_index_item_t*)i1;
     const tosdb_memtable_secondary_index_item_t* ti2 = (tosdb_memtable_secondary_index_item_t*)i2;
@@ -141,31 +118,6 @@ int8_t tosdb_memtable_secondary_index_record_id_comparator(const void* i1, const
     return 0;
 }
 
-static int8_t tosdb_memtable_secondary_index_key_destroyer(memory_heap_t* heap, void* key) {
-    memory_free_ext(heap, key);
-    return 0;
-}
-
-static int8_t tosdb_memtable_secondary_index_key_cloner(memory_heap_t* heap, const void* key, void** cloned_key) {
-    if(!key || !cloned_key) {
-        return -1;
-    }
-
-    tosdb_memtable_secondary_index_item_t* src = (tosdb_memtable_secondary_index_item_t*)key;
-
-    uint64_t key_size = sizeof(tosdb_memtable_secondary_index_item_t) + src->secondary_key_length + src->primary_key_length;
-
-    *cloned_key = memory_malloc_ext(heap, key_size, 0);
-
-    if(!*cloned_key) {
-        return -1;
-    }
-
-    memory_memcopy(key, *cloned_key, key_size);
-
-    return 0;
-}
-
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
 tosdb_memtable_t* tosdb_memtable_new_internal(tosdb_table_t * tbl) {
@@ -187,10 +139,21 @@ tosdb_memtable_t* tosdb_memtable_new_internal(tosdb_table_t * tbl) {
         return NULL;
     }
 
+    mt->valuelog_chunks = buffer_new_with_capacity(NULL, sizeof(tosdb_block_valuelog_chunk_t) * 8);
+
+    if(!mt->valuelog_chunks) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create valuelog chunk table for table %s at memory", tbl->name);
+        buffer_destroy(mt->values);
+        memory_free(mt);
+
+        return NULL;
+    }
+
     mt->indexes = hashmap_integer(128);
 
     if(!mt->indexes) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable indexes for table %s at memory", tbl->name);
+        buffer_destroy(mt->valuelog_chunks);
         buffer_destroy(mt->values);
         memory_free(mt);
 
@@ -221,19 +184,14 @@ tosdb_memtable_t* tosdb_memtable_new_internal(tosdb_table_t * tbl) {
 
         boolean_t idx_unique = true;
         index_key_comparator_f cmp = tosdb_memtable_index_comparator;
-        bplustree_key_destroyer_f key_destroyer = tosdb_memtable_index_key_destroyer;
-        bplustree_key_cloner_f key_cloner = tosdb_memtable_index_key_cloner;
 
         if(index->type == TOSDB_INDEX_SECONDARY) {
             idx_unique = false;
             cmp = tosdb_memtable_secondary_index_comparator;
-            key_destroyer = tosdb_memtable_secondary_index_key_destroyer;
-            key_cloner = tosdb_memtable_secondary_index_key_cloner;
         }
 
-        mt_idx->index = bplustree_create_index_with_unique(32, cmp, idx_unique);
-        bplustree_set_key_destroyer(mt_idx->index, key_destroyer);
-        bplustree_set_key_cloner(mt_idx->index, key_cloner);
+        // index items are allocated from index arena, so memtable is released with its indexes
+        mt_idx->index = skiplist_create_index_with_heap_and_unique(NULL, TOSDB_MEMTABLE_ARENA_CHUNK_SIZE, cmp, idx_unique);
 
         if(!mt_idx->index) {
             error = true;
@@ -241,7 +199,7 @@ tosdb_memtable_t* tosdb_memtable_new_internal(tosdb_table_t * tbl) {
         }
 
         if(index->type == TOSDB_INDEX_SECONDARY) {
-            bplustree_set_comparator_for_unique_subpart_for_non_unique_index(mt_idx->index, tosdb_memtable_secondary_index_record_id_comparator);
+            skiplist_set_comparator_for_unique_subpart_for_non_unique_index(mt_idx->index, tosdb_memtable_secondary_index_record_id_comparator);
         }
 
         hashmap_put(mt->indexes, (void*)index->id, (void*)mt_idx);
@@ -253,6 +211,7 @@ tosdb_memtable_t* tosdb_memtable_new_internal(tosdb_table_t * tbl) {
     if(error) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot build memory index map for table %s", tbl->name);
         buffer_destroy(mt->values);
+        buffer_destroy(mt->valuelog_chunks);
 
         iterator_t* mt_idx_iter = hashmap_iterator_create(mt->indexes);
 
@@ -271,7 +230,7 @@ tosdb_memtable_t* tosdb_memtable_new_internal(tosdb_table_t * tbl) {
             bloomfilter_destroy(mt_idx->bloomfilter);
 
             if(mt_idx->index) {
-                bplustree_destroy_index(mt_idx->index);
+                skiplist_destroy_index(mt_idx->index);
             }
 
             memory_free(mt_idx);
@@ -290,6 +249,9 @@ tosdb_memtable_t* tosdb_memtable_new_internal(tosdb_table_t * tbl) {
     return mt;
 }
 
+static boolean_t tosdb_memtable_evict(tosdb_table_t* tbl);
+static int32_t   tosdb_memtable_flush_task(int32_t argc, char_t** argv);
+
 boolean_t tosdb_memtable_new(tosdb_table_t * tbl) {
     if(!tbl) {
         PRINTLOG(TOSDB, LOG_ERROR, "table is null");
@@ -315,8 +277,6 @@ boolean_t tosdb_memtable_new(tosdb_table_t * tbl) {
         return false;
     }
 
-    boolean_t error = false;
-
     mt->tbl = tbl;
     mt->id = tbl->memtable_next_id;
     tbl->memtable_next_id++;
@@ -330,14 +290,49 @@ boolean_t tosdb_memtable_new(tosdb_table_t * tbl) {
         mt->level = 1;
     }
 
-    if(tbl->current_memtable && !tosdb_memtable_persist(tbl->current_memtable)) {
-        return false;
+    if(tbl->current_memtable) {
+        tosdb_t* tdb = tbl->db->tdb;
+
+        if(tdb->flush_task_id) {
+            // frozen memtable stays at memtable list and serves reads until flush task persists it
+            tbl->current_memtable->is_flush_pending = true;
+
+            lock_acquire(tdb->flush_lock);
+            list_queue_push(tdb->flush_queue, tbl->current_memtable);
+            tbl->flush_pending_count++;
+            condvar_broadcast(tdb->flush_cond);
+            lock_release(tdb->flush_lock);
+        } else if(!tosdb_memtable_persist(tbl->current_memtable)) {
+            return false;
+        }
     }
 
     tbl->current_memtable = mt;
     list_stack_push(tbl->memtables, mt);
 
+    return tosdb_memtable_evict(tbl);
+}
+#pragma GCC diagnostic pop
+
+static boolean_t tosdb_memtable_evict(tosdb_table_t* tbl) {
+    boolean_t error = false;
+
     while(list_size(tbl->memtables) > tbl->max_memtable_count)  {
+        tosdb_memtable_t* tail_mt = (tosdb_memtable_t*)list_get_data_at_position(tbl->memtables, list_size(tbl->memtables) - 1);
+
+        // oldest memtable is not persisted yet, flush task evicts it later
+        if(tail_mt->is_flush_pending) {
+            break;
+        }
+
+        // background flush of it was failed, persist inline before dropping its records
+        if(tail_mt->is_dirty && !tosdb_memtable_persist(tail_mt)) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot persist memtable %lli of table %s before eviction", tail_mt->id, tbl->name);
+            error = true;
+
+            break;
+        }
+
         tosdb_memtable_t* r_mt = (tosdb_memtable_t*)list_delete_at_tail(tbl->memtables);
 
         if(!tosdb_memtable_free(r_mt)) {
@@ -347,7 +342,136 @@ boolean_t tosdb_memtable_new(tosdb_table_t * tbl) {
 
     return !error;
 }
-#pragma GCC diagnostic pop
+
+static int32_t tosdb_memtable_flush_task(int32_t argc, char_t** argv) {
+    if(argc != 1) {
+        return -1;
+    }
+
+    tosdb_t* tdb = (tosdb_t*)argv[0];
+
+    lock_acquire(tdb->flush_lock);
+
+    while(true) {
+        while(!list_size(tdb->flush_queue) && !tdb->flush_is_closing) {
+            condvar_wait(tdb->flush_cond, tdb->flush_lock);
+        }
+
+        if(!list_size(tdb->flush_queue)) {
+            break;
+        }
+
+        tosdb_memtable_t* mt = (tosdb_memtable_t*)list_queue_pop(tdb->flush_queue);
+        tosdb_table_t* tbl = mt->tbl;
+
+        lock_release(tdb->flush_lock);
+
+        // memtable is immutable, readers search it without waiting while its sstable is built
+        boolean_t res = tosdb_memtable_persist(mt);
+
+        if(!res) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot flush memtable %lli of table %s, it will be persisted inline at eviction", mt->id, tbl->name);
+        }
+
+        rwlock_write_acquire(tbl->lock);
+
+        // a failed memtable stays dirty, eviction retries it instead of waiting for this task forever.
+        // memtables are allocated from heaps of writers, so they are evicted by next memtable creation
+        mt->is_flush_pending = false;
+
+        rwlock_write_release(tbl->lock);
+
+        lock_acquire(tdb->flush_lock);
+        tbl->flush_pending_count--;
+        condvar_broadcast(tdb->flush_cond);
+    }
+
+    tdb->flush_task_exited = true;
+
+    lock_release(tdb->flush_lock);
+
+    return 0;
+}
+
+boolean_t tosdb_memtable_flush_start(tosdb_t* tdb) {
+    if(!tdb) {
+        PRINTLOG(TOSDB, LOG_ERROR, "tosdb is null");
+
+        return false;
+    }
+
+    tdb->flush_lock = lock_create();
+    tdb->flush_cond = condvar_create();
+    tdb->flush_queue = list_create_queue();
+    tdb->flush_task_args = memory_malloc(sizeof(void*));
+
+    if(tdb->flush_lock && tdb->flush_cond && tdb->flush_queue && tdb->flush_task_args) {
+        tdb->flush_task_args[0] = tdb;
+
+        tdb->flush_task_id = task_create_task(NULL, 2 << 20, 64 << 10, tosdb_memtable_flush_task, 1, (void**)tdb->flush_task_args, "tosdb flush");
+
+        if(tdb->flush_task_id == -1ULL) {
+            tdb->flush_task_id = 0;
+        }
+    }
+
+    if(!tdb->flush_task_id) {
+        PRINTLOG(TOSDB, LOG_WARNING, "cannot create memtable flush task, memtables are flushed inline");
+
+        return false;
+    }
+
+    return true;
+}
+
+void tosdb_memtable_flush_stop(tosdb_t* tdb) {
+    if(!tdb) {
+        return;
+    }
+
+    if(tdb->flush_task_id) {
+        lock_acquire(tdb->flush_lock);
+        tdb->flush_is_closing = true;
+        condvar_broadcast(tdb->flush_cond);
+        lock_release(tdb->flush_lock);
+
+        while(!tdb->flush_task_exited) {
+            task_yield();
+        }
+
+        tdb->flush_task_id = 0;
+    }
+
+    list_destroy(tdb->flush_queue);
+    condvar_destroy(tdb->flush_cond);
+    lock_destroy(tdb->flush_lock);
+    memory_free(tdb->flush_task_args);
+
+    tdb->flush_queue = NULL;
+    tdb->flush_cond = NULL;
+    tdb->flush_lock = NULL;
+    tdb->flush_task_args = NULL;
+}
+
+void tosdb_memtable_flush_wait(tosdb_table_t* tbl, uint64_t max_pending) {
+    tosdb_t* tdb = tbl->db->tdb;
+
+    if(!tdb->flush_task_id) {
+        return;
+    }
+
+    if(!max_pending) {
+        max_pending = 1;
+    }
+
+    lock_acquire(tdb->flush_lock);
+
+    while(tbl->flush_pending_count >= max_pending) {
+        condvar_wait(tdb->flush_cond, tdb->flush_lock);
+    }
+
+    lock_release(tdb->flush_lock);
+}
 
 boolean_t tosdb_memtable_free(tosdb_memtable_t* mt) {
     if(!mt) {
@@ -363,7 +487,7 @@ boolean_t tosdb_memtable_free(tosdb_memtable_t* mt) {
         PRINTLOG(TOSDB, LOG_DEBUG, "push sstable list item %p for table %s, stlis size %lli", mt->stli, mt->tbl->name, list_size(mt->tbl->sstable_list_items));
     } else {
         if(mt->stli) {
-            memory_free(mt->stli);
+            memory_free_ext(mt->tbl->db->tdb->heap, mt->stli);
         }
     }
 
@@ -375,6 +499,7 @@ boolean_t tosdb_memtable_free(tosdb_memtable_t* mt) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable index iterator for cleanup for table %s", mt->tbl->name);
         hashmap_destroy(mt->indexes);
         buffer_destroy(mt->values);
+        buffer_destroy(mt->valuelog_chunks);
         memory_free(mt);
 
         return false;
@@ -386,25 +511,7 @@ boolean_t tosdb_memtable_free(tosdb_memtable_t* mt) {
         bloomfilter_destroy(mt_idx->bloomfilter);
 
         if(mt_idx->index) {
-            iterator_t* iter = mt_idx->index->create_iterator(mt_idx->index);
-
-            if(!iter) {
-                PRINTLOG(TOSDB, LOG_ERROR, "cannot create index iterator");
-                error = true;
-            } else {
-                while(iter->end_of_iterator(iter) != 0) {
-                    void* item = (void*)iter->get_item(iter);
-
-                    memory_free(item);
-
-                    iter = iter->next(iter);
-                }
-
-                iter->destroy(iter);
-
-            }
-
-            bplustree_destroy_index(mt_idx->index);
+            skiplist_destroy_index(mt_idx->index);
         }
 
         memory_free(mt_idx);
@@ -417,6 +524,7 @@ boolean_t tosdb_memtable_free(tosdb_memtable_t* mt) {
     hashmap_destroy(mt->indexes);
 
     buffer_destroy(mt->values);
+    buffer_destroy(mt->valuelog_chunks);
     memory_free(mt);
 
     return !error;
@@ -501,6 +609,12 @@ boolean_t tosdb_memtable_upsert_internal(tosdb_memtable_t* mt, tosdb_record_t *
 
         memory_free(sd->value);
         memory_free(sd);
+
+        if(!tosdb_valuelog_chunk_append(mt, offset, length)) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot update valuelog chunk table for table %s", tbl->name);
+
+            return false;
+        }
     }
 
     boolean_t need_rc_inc = true;
@@ -533,7 +647,7 @@ boolean_t tosdb_memtable_upsert_internal(tosdb_memtable_t* mt, tosdb_record_t *
         if(index->type != TOSDB_INDEX_SECONDARY) {
             pri_uniq_idx_count++;
 
-            tosdb_memtable_index_item_t* idx_item = memory_malloc(sizeof(tosdb_memtable_index_item_t) + r_key->key_length);
+            tosdb_memtable_index_item_t* idx_item = skiplist_arena_malloc(mt_idx->index, sizeof(tosdb_memtable_index_item_t) + r_key->key_length);
 
             if(!idx_item) {
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable index item for table %s", tbl->name);
@@ -565,7 +679,6 @@ boolean_t tosdb_memtable_upsert_internal(tosdb_memtable_t* mt, tosdb_record_t *
             d_key.value = u8_key;
 
             if(!bloomfilter_add(mt_idx->bloomfilter, &d_key)) {
-                memory_free(idx_item);
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot add primary/unique index to bloomfilter for table %s", tbl->name);
 
                 return false;
@@ -587,15 +700,13 @@ boolean_t tosdb_memtable_upsert_internal(tosdb_memtable_t* mt, tosdb_record_t *
                     PRINTLOG(TOSDB, LOG_ERROR, "pri/uniq %lli new deleted: %s old deleted: %s", index->id, idx_item->is_deleted ? "true" : "false", old_item->is_deleted ? "true" : "false");
                     PRINTLOG(TOSDB, LOG_ERROR, "pri/uniq %lli new offset: %llx old offset: %llx", index->id, idx_item->offset, old_item->offset);
                 }
-
-                memory_free(old_item);
             }
 
         } else {
             const tosdb_record_key_t* pri_r_key = hashmap_get(r_ctx->keys, (void*)tbl->primary_index_id);
             uint64_t sec_idx_item_len = sizeof(tosdb_memtable_secondary_index_item_t) + r_key->key_length + pri_r_key->key_length;
 
-            tosdb_memtable_secondary_index_item_t* sec_idx_item = memory_malloc(sec_idx_item_len);
+            tosdb_memtable_secondary_index_item_t* sec_idx_item = skiplist_arena_malloc(mt_idx->index, sec_idx_item_len);
 
             if(!sec_idx_item) {
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable secondary index item for table %s", tbl->name);
@@ -631,7 +742,6 @@ boolean_t tosdb_memtable_upsert_internal(tosdb_memtable_t* mt, tosdb_record_t *
             d_key.value = u8_key;
 
             if(!bloomfilter_add(mt_idx->bloomfilter, &d_key)) {
-                memory_free(sec_idx_item);
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot add secondary index to bloomfilter for table %s", tbl->name);
 
                 return false;
@@ -649,8 +759,6 @@ boolean_t tosdb_memtable_upsert_internal(tosdb_memtable_t* mt, tosdb_record_t *
                     PRINTLOG(TOSDB, LOG_ERROR, "secidx %lli new key hash: %llx old key hash: %llx", index->id, (uint64_t)sec_idx_item->secondary_key_hash,  (uint64_t)old_item->secondary_key_hash);
                     PRINTLOG(TOSDB, LOG_ERROR, "secidx %lli new deleted: %s old deleted: %s", index->id, sec_idx_item->is_primary_key_deleted ? "true" : "false", old_item->is_primary_key_deleted ? "true" : "false");
                 }
-
-                memory_free(old_item);
             }
         }
 
@@ -671,6 +779,10 @@ boolean_t tosdb_memtable_upsert_internal(tosdb_memtable_t* mt, tosdb_record_t *
 }
 
 boolean_t tosdb_memtable_upsert(tosdb_record_t * record, boolean_t del) {
+    return tosdb_memtable_upsert_ext(record, del, true);
+}
+
+boolean_t tosdb_memtable_upsert_ext(tosdb_record_t * record, boolean_t del, boolean_t log_to_wal) {
     if(!record || !record->context) {
         PRINTLOG(TOSDB, LOG_ERROR, "record is null");
 
@@ -686,11 +798,14 @@ boolean_t tosdb_memtable_upsert(tosdb_record_t * record, boolean_t del) {
         return false;
     }
 
-    lock_acquire(tbl->lock);
+    // backpressure, writers wait only when flush task falls behind by max memtable count
+    tosdb_memtable_flush_wait(tbl, tbl->max_memtable_count);
+
+    rwlock_write_acquire(tbl->lock);
 
     if(!tbl->current_memtable || tbl->current_memtable->is_readonly) {
         if(!tosdb_memtable_new(tbl)) {
-            lock_release(tbl->lock);
+            rwlock_write_release(tbl->lock);
             PRINTLOG(TOSDB, LOG_ERROR, "cannot create a new memtable for table %s", tbl->name);
 
             return false;
@@ -699,7 +814,18 @@ boolean_t tosdb_memtable_upsert(tosdb_record_t * record, boolean_t del) {
 
     boolean_t res = tosdb_memtable_upsert_internal(tbl->current_memtable, record, del, NULL);
 
-    lock_release(tbl->lock);
+    tosdb_wal_t* wal = tbl->db->tdb->wal;
+
+    // append while holding table lock, so wal order is same with memtable order
+    if(res && log_to_wal && wal) {
+        res = tosdb_wal_append(wal, record, del, NULL);
+    }
+
+    rwlock_write_release(tbl->lock);
+
+    if(res && log_to_wal && wal) {
+        res = tosdb_wal_commit_if_needed(wal);
+    }
 
     return res;
 }
@@ -723,71 +849,20 @@ boolean_t tosdb_memtable_persist(tosdb_memtable_t* mt) {
 
     boolean_t error = false;
 
-    uint64_t valuelog_unpacked_size = buffer_get_length(mt->values);
-    buffer_t* valuelog_out = buffer_new_with_capacity(NULL, valuelog_unpacked_size);
-
-    buffer_seek(mt->values, 0, BUFFER_SEEK_DIRECTION_START);
-
-    const compression_t* compression = mt->tbl->db->tdb->compression;
-
-    if(compression->pack(mt->values, valuelog_out) != 0) {
-        PRINTLOG(TOSDB, LOG_ERROR, "cannot pack valuelog");
-        buffer_destroy(valuelog_out);
-
-        return false;
-    }
-
-    uint64_t len = buffer_get_length(valuelog_out);
+    uint64_t b_vl_loc = 0;
+    uint64_t b_vl_size = 0;
 
-    if(valuelog_unpacked_size && !len) {
-        PRINTLOG(TOSDB, LOG_ERROR, "cannot pack valuelog");
-        buffer_destroy(valuelog_out);
-
-        return false;
-    }
-
-    uint64_t ol = 0;
-    uint8_t* b_vl_data = buffer_get_all_bytes_and_destroy(valuelog_out, &ol);
-
-    uint64_t b_vl_size = sizeof(tosdb_block_valuelog_t) + ol;
-
-    if(b_vl_size % TOSDB_PAGE_SIZE) {
-        b_vl_size += TOSDB_PAGE_SIZE - (b_vl_size % TOSDB_PAGE_SIZE);
-    }
-
-    tosdb_block_valuelog_t * b_vl = memory_malloc(b_vl_size);
-
-    if(!b_vl) {
-        PRINTLOG(TOSDB, LOG_ERROR, "cannot create valuelog block");
-        memory_free(b_vl_data);
-
-        return false;
-    }
-
-    b_vl->header.block_size = b_vl_size;
-    b_vl->header.block_type = TOSDB_BLOCK_TYPE_VALUELOG;
-    b_vl->database_id = mt->tbl->db->id;
-    b_vl->table_id = mt->tbl->id;
-    b_vl->sstable_id = mt->id;
-    b_vl->data_size = ol;
-    b_vl->valuelog_unpacked_size = valuelog_unpacked_size;
-    memory_memcopy(b_vl_data, b_vl->data, ol);
-    memory_free(b_vl_data);
-
-    uint64_t b_vl_loc = tosdb_block_write(mt->tbl->db->tdb, (tosdb_block_header_t*)b_vl);
-
-    memory_free(b_vl);
-
-    if(!b_vl_loc) {
+    if(!tosdb_valuelog_persist(mt, &b_vl_loc, &b_vl_size)) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot persist valuelog for memtable %lli of table %s", mt->id, mt->tbl->name);
 
         return false;
     }
 
-    PRINTLOG(TOSDB, LOG_DEBUG, "valuelog for memtable %lli of table %s persisted at 0x%llx(0x%llx)", mt->id, mt->tbl->name, b_vl_loc, b_vl_size);
+    // sstable list item outlives background tasks, it is allocated from heap of tosdb opener
+    memory_heap_t* heap = mt->tbl->db->tdb->heap;
 
     uint64_t stli_size = sizeof(tosdb_block_sstable_list_item_t) + sizeof(tosdb_block_sstable_list_item_index_pair_t) * hashmap_size(mt->indexes);
-    tosdb_block_sstable_list_item_t* stli = memory_malloc(stli_size);
+    tosdb_block_sstable_list_item_t* stli = memory_malloc_ext(heap, stli_size, 0);
 
     if(!stli) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable list item");
@@ -810,7 +885,7 @@ boolean_t tosdb_memtable_persist(tosdb_memtable_t* mt) {
 
     if(!iter) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable index iterator");
-        memory_free(stli);
+        memory_free_ext(heap, stli);
 
         return false;
     }
@@ -829,28 +904,22 @@ boolean_t tosdb_memtable_persist(tosdb_memtable_t* mt) {
 
     if(error) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot build memtable index list");
-        memory_free(stli);
+        memory_free_ext(heap, stli);
 
         return false;
     }
 
-    if(!mt->tbl->sstable_list_items) {
-        mt->tbl->sstable_list_items = list_create_stack();
-
-        if(!mt->tbl->sstable_list_items) {
-            PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable list items stack");
-            memory_free(stli);
-
-            return false;
-        }
-    }
-
     mt->stli = stli;
 
     if(!error) {
         mt->is_dirty = false;
     }
 
+    // compaction outputs are at deeper levels, only memtable flushes are counted for write amplification
+    if(mt->level == 1) {
+        __atomic_add_fetch(&mt->tbl->db->tdb->compaction_stats.flushed_bytes, tosdb_sstable_list_item_size(stli), __ATOMIC_RELAXED);
+    }
+
     return !error;
 }
 #pragma GCC diagnostic pop
@@ -1009,7 +1078,8 @@ boolean_t tosdb_memtable_index_persist(tosdb_memtable_t* mt, tosdb_block_sstable
         return false;
     }
 
-    uint64_t idx_data_block_size = sizeof(tosdb_block_sstable_index_data_t) + index_size;
+    uint64_t vl_ct_size = buffer_get_length(mt->valuelog_chunks);
+    uint64_t idx_data_block_size = sizeof(tosdb_block_sstable_index_data_t) + index_size + vl_ct_size;
 
     if(idx_data_block_size % TOSDB_PAGE_SIZE) {
         idx_data_block_size += TOSDB_PAGE_SIZE - (idx_data_block_size % TOSDB_PAGE_SIZE);
@@ -1035,10 +1105,15 @@ boolean_t tosdb_memtable_index_persist(tosdb_memtable_t* mt, tosdb_block_sstable
     b_sid->index_data_size = index_size;
     b_sid->index_data_unpacked_size = index_data_unpacked_size;
     b_sid->record_count = record_count;
+    b_sid->valuelog_chunk_count = vl_ct_size / sizeof(tosdb_block_valuelog_chunk_t);
 
     memory_memcopy(index_data, b_sid->data, index_size);
     memory_free(index_data);
 
+    if(vl_ct_size) {
+        buffer_write_all_into(mt->valuelog_chunks, b_sid->data + index_size);
+    }
+
     uint64_t idx_data_block_loc = tosdb_block_write(mt->tbl->db->tdb, (tosdb_block_header_t*)b_sid);
 
     memory_free(b_sid);
@@ -1203,12 +1278,12 @@ static boolean_t tosdb_memtable_get_from_known_offset(tosdb_record_t* record, co
     // TODO: we need to find real record id. it is stored at index
     tosdb_record_context_t* ctx = record->context;
 
-    lock_acquire(mt->tbl->lock);
+    rwlock_write_acquire(mt->tbl->lock);
     uint64_t old_pos = buffer_get_position(mt->values);
     buffer_seek(mt->values, ctx->offset, BUFFER_SEEK_DIRECTION_START);
     uint8_t* f_d = buffer_get_bytes(mt->values, ctx->length);
     buffer_seek(mt->values, old_pos, BUFFER_SEEK_DIRECTION_START);
-    lock_release(mt->tbl->lock);
+    rwlock_write_release(mt->tbl->lock);
 
     data_t s_d = {0};
     s_d.length = ctx->length;
@@ -1245,11 +1320,7 @@ static boolean_t tosdb_memtable_get_from_known_offset(tosdb_record_t* record, co
 }
 #endif
 
-boolean_t tosdb_memtable_get(tosdb_record_t* record) {
-    if(!record || !record->context) {
-        return false;
-    }
-
+static boolean_t tosdb_memtable_get_internal(tosdb_record_t* record) {
     tosdb_record_context_t* ctx = record->context;
 
     const tosdb_memtable_t* mt = NULL;
@@ -1391,12 +1462,21 @@ boolean_t tosdb_memtable_get(tosdb_record_t* record) {
         return true;
     }
 
-    lock_acquire(mt->tbl->lock);
-    uint64_t old_pos = buffer_get_position(mt->values);
-    buffer_seek(mt->values, found_item->offset, BUFFER_SEEK_DIRECTION_START);
-    uint8_t* f_d = buffer_get_bytes(mt->values, found_item->length);
-    buffer_seek(mt->values, old_pos, BUFFER_SEEK_DIRECTION_START);
-    lock_release(mt->tbl->lock);
+    // copy without moving buffer position, so readers can share table lock
+    uint8_t* f_d = memory_malloc(found_item->length);
+
+    if(!f_d) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot allocate record data");
+
+        return false;
+    }
+
+    if(!buffer_write_slice_into(mt->values, found_item->offset, found_item->length, f_d)) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot read record data from memtable");
+        memory_free(f_d);
+
+        return false;
+    }
 
     data_t s_d = {0};
     s_d.length = found_item->length;
@@ -1438,6 +1518,21 @@ boolean_t tosdb_memtable_get(tosdb_record_t* record) {
     return found;
 }
 
+boolean_t tosdb_memtable_get(tosdb_record_t* record) {
+    if(!record || !record->context) {
+        return false;
+    }
+
+    tosdb_table_t* tbl = ((tosdb_record_context_t*)record->context)->table;
+
+    // eviction frees memtables under write lock, so whole lookup and copy are done under read lock
+    rwlock_read_acquire(tbl->lock);
+    boolean_t res = tosdb_memtable_get_internal(record);
+    rwlock_read_release(tbl->lock);
+
+    return res;
+}
+
 boolean_t tosdb_memtable_search(tosdb_record_t* record, set_t* results) {
     if(!record || !record->context) {
         return false;
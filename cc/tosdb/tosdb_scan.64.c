@@ -0,0 +1,763 @@
+/**
+ * @file tosdb_scan.64.c
+ * @brief tosdb table range scan implementation
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <tosdb/tosdb.h>
+#include <tosdb/tosdb_internal.h>
+#include <tosdb/tosdb_cache.h>
+#include <logging.h>
+#include <strings.h>
+#include <compression.h>
+#include <cpu/sync.h>
+
+MODULE("turnstone.kernel.db");
+
+/**
+ * @struct tosdb_scan_source_t
+ * @brief one sorted run of a scan, a memtable or an sstable
+ */
+typedef struct tosdb_scan_source_t {
+    tosdb_memtable_index_item_t** items; ///< items in range sorted by index order
+    uint64_t                      item_count; ///< item count in range
+    uint64_t                      position; ///< consumed item count
+    tosdb_memtable_index_item_t** items_base; ///< allocated item array
+    uint8_t*                      items_data; ///< owned item data
+    buffer_t*                     values; ///< copied values of memtable items
+    uint64_t                      level; ///< sstable level
+    uint64_t                      sstable_id; ///< sstable id
+    tosdb_block_valuelog_chunk_t* vl_chunks; ///< valuelog chunk table of sstable
+    uint64_t                      vl_chunk_count; ///< valuelog chunk count of sstable
+} tosdb_scan_source_t;
+
+/**
+ * @struct tosdb_scan_t
+ * @brief tosdb scan iterator metadata
+ */
+typedef struct tosdb_scan_t {
+    tosdb_table_t*               tbl; ///< scanned table
+    const tosdb_index_t*         idx; ///< scanned index
+    tosdb_scan_direction_t       direction; ///< scan direction
+    tosdb_memtable_index_item_t* lo; ///< lower bound, NULL means unbounded
+    tosdb_memtable_index_item_t* hi; ///< upper bound, NULL means unbounded
+    list_t*                      sources; ///< sources, newer sources are first
+    tosdb_memtable_index_item_t* current_item; ///< current merged item
+    tosdb_scan_source_t*         current_source; ///< source of current item
+    tosdb_record_t*              current_record; ///< lazily fetched record of current item
+    boolean_t                    end_of_scan; ///< scan is ended
+} tosdb_scan_t;
+
+static boolean_t tosdb_scan_item_in_range(const tosdb_scan_t* scan, const tosdb_memtable_index_item_t* item) {
+    if(scan->lo && tosdb_memtable_index_comparator(item, scan->lo) < 0) {
+        return false;
+    }
+
+    if(scan->hi && tosdb_memtable_index_comparator(item, scan->hi) > 0) {
+        return false;
+    }
+
+    return true;
+}
+
+static tosdb_memtable_index_item_t* tosdb_scan_bound_create(const tosdb_index_t* idx, tosdb_record_t* record) {
+    if(!record) {
+        return NULL;
+    }
+
+    tosdb_record_context_t* ctx = record->context;
+
+    const tosdb_record_key_t* r_key = hashmap_get(ctx->keys, (void*)idx->id);
+
+    if(!r_key) {
+        return NULL;
+    }
+
+    tosdb_memtable_index_item_t* item = memory_malloc(sizeof(tosdb_memtable_index_item_t) + r_key->key_length);
+
+    if(!item) {
+        return NULL;
+    }
+
+    item->key_hash = r_key->key_hash;
+    item->key_length = r_key->key_length;
+    memory_memcopy(r_key->key, item->key, item->key_length);
+
+    return item;
+}
+
+static void tosdb_scan_source_free(tosdb_scan_source_t* src) {
+    if(!src) {
+        return;
+    }
+
+    memory_free(src->items_base);
+    memory_free(src->items_data);
+    buffer_destroy(src->values);
+    memory_free(src->vl_chunks);
+    memory_free(src);
+}
+
+static boolean_t tosdb_scan_source_add_memtable(tosdb_scan_t* scan, const tosdb_memtable_t* mt) {
+    const tosdb_memtable_index_t* mt_idx = hashmap_get(mt->indexes, (void*)scan->idx->id);
+
+    if(!mt_idx) {
+        return true;
+    }
+
+    iterator_t* iter = NULL;
+
+    if(scan->lo && scan->hi) {
+        iter = mt_idx->index->search(mt_idx->index, scan->lo, scan->hi, INDEXER_KEY_COMPARATOR_CRITERIA_BETWEEN);
+    } else if(scan->lo) {
+        iter = mt_idx->index->search(mt_idx->index, scan->lo, NULL, INDEXER_KEY_COMPARATOR_CRITERIA_EQUALORGREATER);
+    } else {
+        iter = mt_idx->index->create_iterator(mt_idx->index);
+    }
+
+    if(!iter) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable index iterator");
+
+        return false;
+    }
+
+    tosdb_scan_source_t* src = memory_malloc(sizeof(tosdb_scan_source_t));
+    buffer_t* items_buf = buffer_new();
+
+    if(!src || !items_buf) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable scan source");
+        memory_free(src);
+        buffer_destroy(items_buf);
+        iter->destroy(iter);
+
+        return false;
+    }
+
+    src->values = buffer_new();
+
+    if(!src->values) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create memtable scan source");
+        memory_free(src);
+        buffer_destroy(items_buf);
+        iter->destroy(iter);
+
+        return false;
+    }
+
+    boolean_t error = false;
+
+    // items and values are copied, memtable can be persisted and freed while scanning
+    while(iter->end_of_iterator(iter) != 0) {
+        const tosdb_memtable_index_item_t* ii = iter->get_item(iter);
+
+        if(scan->hi && tosdb_memtable_index_comparator(ii, scan->hi) > 0) {
+            break;
+        }
+
+        if(tosdb_scan_item_in_range(scan, ii)) {
+            uint64_t item_size = sizeof(tosdb_memtable_index_item_t) + ii->key_length;
+            uint64_t value_offset = buffer_get_length(src->values);
+
+            if(!buffer_append_bytes(items_buf, (uint8_t*)ii, item_size)) {
+                error = true;
+
+                break;
+            }
+
+            tosdb_memtable_index_item_t* copy = (tosdb_memtable_index_item_t*)buffer_get_view_at_position(items_buf,
+                                                                                                          buffer_get_length(items_buf) - item_size,
+                                                                                                          item_size);
+
+            if(!ii->is_deleted && ii->length) {
+                uint8_t* value = buffer_get_view_at_position(mt->values, ii->offset, ii->length);
+
+                if(!value || !buffer_append_bytes(src->values, value, ii->length)) {
+                    error = true;
+
+                    break;
+                }
+            }
+
+            copy->offset = value_offset;
+            src->item_count++;
+        }
+
+        iter = iter->next(iter);
+    }
+
+    iter->destroy(iter);
+
+    if(!error && src->item_count) {
+        src->items_data = buffer_get_all_bytes_and_destroy(items_buf, NULL);
+        items_buf = NULL;
+        src->items_base = memory_malloc(sizeof(tosdb_memtable_index_item_t*) * src->item_count);
+
+        if(!src->items_data || !src->items_base) {
+            error = true;
+        } else {
+            uint8_t* data = src->items_data;
+
+            for(uint64_t i = 0; i < src->item_count; i++) {
+                src->items_base[i] = (tosdb_memtable_index_item_t*)data;
+                data += sizeof(tosdb_memtable_index_item_t) + src->items_base[i]->key_length;
+            }
+
+            src->items = src->items_base;
+        }
+    }
+
+    buffer_destroy(items_buf);
+
+    if(error) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot copy memtable %lli items for scan", mt->id);
+        tosdb_scan_source_free(src);
+
+        return false;
+    }
+
+    if(!src->item_count) {
+        tosdb_scan_source_free(src);
+
+        return true;
+    }
+
+    src->level = mt->level;
+    src->sstable_id = mt->id;
+
+    list_queue_push(scan->sources, src);
+
+    return true;
+}
+
+static boolean_t tosdb_scan_sstable_index_data_location(tosdb_scan_t* scan, const tosdb_block_sstable_list_item_t* sli,
+                                                        uint64_t* location, uint64_t* size) {
+    *location = 0;
+    *size = 0;
+
+    uint64_t idx_loc = 0;
+    uint64_t idx_size = 0;
+
+    for(uint64_t i = 0; i < sli->index_count; i++) {
+        if(scan->idx->id == sli->indexes[i].index_id) {
+            idx_loc = sli->indexes[i].index_location;
+            idx_size = sli->indexes[i].index_size;
+
+            break;
+        }
+    }
+
+    if(!idx_loc || !idx_size) {
+        return true;
+    }
+
+    tosdb_cache_t* tdb_cache = scan->tbl->db->tdb->cache;
+    tosdb_cached_bloomfilter_t* c_bf = NULL;
+
+    if(tdb_cache) {
+        tosdb_cache_key_t cache_key = {0};
+        cache_key.type = TOSDB_CACHE_ITEM_TYPE_BLOOMFILTER;
+        cache_key.database_id = scan->tbl->db->id;
+        cache_key.table_id = scan->tbl->id;
+        cache_key.index_id = scan->idx->id;
+        cache_key.level = sli->level;
+        cache_key.sstable_id = sli->sstable_id;
+
+        c_bf = (tosdb_cached_bloomfilter_t*)tosdb_cache_get(tdb_cache, &cache_key);
+    }
+
+    const tosdb_memtable_index_item_t* first = NULL;
+    const tosdb_memtable_index_item_t* last = NULL;
+    tosdb_block_sstable_index_t* st_idx = NULL;
+
+    if(c_bf) {
+        first = c_bf->first_key;
+        last = c_bf->last_key;
+        *location = c_bf->index_data_location;
+        *size = c_bf->index_data_size;
+    } else {
+        st_idx = (tosdb_block_sstable_index_t*)tosdb_block_read(scan->tbl->db->tdb, idx_loc, idx_size);
+
+        if(!st_idx) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot read sstable index from backend");
+
+            return false;
+        }
+
+        first = (tosdb_memtable_index_item_t*)&st_idx->data[0];
+        last = (tosdb_memtable_index_item_t*)(&st_idx->data[0] + sizeof(tosdb_memtable_index_item_t) + first->key_length);
+        *location = st_idx->index_data_location;
+        *size = st_idx->index_data_size;
+    }
+
+    // skip sstables whose key range does not overlap with scan range
+    if((scan->lo && tosdb_memtable_index_comparator(last, scan->lo) < 0) ||
+       (scan->hi && tosdb_memtable_index_comparator(first, scan->hi) > 0)) {
+        *location = 0;
+        *size = 0;
+    }
+
+    memory_free(st_idx);
+
+    return true;
+}
+
+static boolean_t tosdb_scan_source_add_sstable(tosdb_scan_t* scan, const tosdb_block_sstable_list_item_t* sli) {
+    uint64_t index_data_location = 0;
+    uint64_t index_data_size = 0;
+
+    if(!tosdb_scan_sstable_index_data_location(scan, sli, &index_data_location, &index_data_size)) {
+        return false;
+    }
+
+    if(!index_data_location) {
+        return true;
+    }
+
+    tosdb_block_sstable_index_data_t* b_sid = (tosdb_block_sstable_index_data_t*)tosdb_block_read(scan->tbl->db->tdb, index_data_location, index_data_size);
+
+    if(!b_sid) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot read index data");
+
+        return false;
+    }
+
+    tosdb_scan_source_t* src = memory_malloc(sizeof(tosdb_scan_source_t));
+
+    if(!src) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable scan source");
+        memory_free(b_sid);
+
+        return false;
+    }
+
+    src->level = sli->level;
+    src->sstable_id = sli->sstable_id;
+    src->vl_chunk_count = b_sid->valuelog_chunk_count;
+    src->vl_chunks = tosdb_valuelog_chunks_from_index_data(b_sid);
+
+    if(src->vl_chunk_count && !src->vl_chunks) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog chunk table");
+        memory_free(b_sid);
+        tosdb_scan_source_free(src);
+
+        return false;
+    }
+
+    uint64_t record_count = b_sid->record_count;
+    uint64_t index_data_unpacked_size = b_sid->index_data_unpacked_size;
+
+    const compression_t* compression = scan->tbl->db->tdb->compression;
+
+    buffer_t* buf_idx_in = buffer_encapsulate(b_sid->data, b_sid->index_data_size);
+    buffer_t* buf_idx_out = buffer_new_with_capacity(NULL, index_data_unpacked_size);
+
+    int8_t zc_res = compression->unpack(buf_idx_in, buf_idx_out);
+
+    uint64_t zc = buffer_get_length(buf_idx_out);
+
+    buffer_destroy(buf_idx_in);
+    memory_free(b_sid);
+
+    if(zc_res != 0 || zc != index_data_unpacked_size) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot unpack idx");
+        buffer_destroy(buf_idx_out);
+        tosdb_scan_source_free(src);
+
+        return false;
+    }
+
+    src->items_data = buffer_get_all_bytes_and_destroy(buf_idx_out, NULL);
+    src->items_base = memory_malloc(sizeof(tosdb_memtable_index_item_t*) * record_count);
+
+    if(!src->items_data || !src->items_base) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create index item array");
+        tosdb_scan_source_free(src);
+
+        return false;
+    }
+
+    uint8_t* idx_data = src->items_data;
+
+    for(uint64_t i = 0; i < record_count; i++) {
+        src->items_base[i] = (tosdb_memtable_index_item_t*)idx_data;
+        idx_data += sizeof(tosdb_memtable_index_item_t) + src->items_base[i]->key_length;
+    }
+
+    // narrow items to scan range with binary search, items are sorted with index comparator
+    uint64_t start = 0;
+    uint64_t end = record_count;
+
+    if(scan->lo) {
+        uint64_t l = 0, h = record_count;
+
+        while(l < h) {
+            uint64_t m = l + (h - l) / 2;
+
+            if(tosdb_memtable_index_comparator(src->items_base[m], scan->lo) < 0) {
+                l = m + 1;
+            } else {
+                h = m;
+            }
+        }
+
+        start = l;
+    }
+
+    if(scan->hi) {
+        uint64_t l = start, h = record_count;
+
+        while(l < h) {
+            uint64_t m = l + (h - l) / 2;
+
+            if(tosdb_memtable_index_comparator(src->items_base[m], scan->hi) <= 0) {
+                l = m + 1;
+            } else {
+                h = m;
+            }
+        }
+
+        end = l;
+    }
+
+    if(start >= end) {
+        tosdb_scan_source_free(src);
+
+        return true;
+    }
+
+    src->items = src->items_base + start;
+    src->item_count = end - start;
+
+    list_queue_push(scan->sources, src);
+
+    return true;
+}
+
+static boolean_t tosdb_scan_source_add_sstable_list(tosdb_scan_t* scan, list_t* st_list) {
+    for(uint64_t i = 0; i < list_size(st_list); i++) {
+        const tosdb_block_sstable_list_item_t* sli = list_get_data_at_position(st_list, i);
+
+        if(!tosdb_scan_source_add_sstable(scan, sli)) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot add sstable %lli at level %lli to scan", sli->sstable_id, sli->level);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static tosdb_memtable_index_item_t* tosdb_scan_source_head(const tosdb_scan_t* scan, const tosdb_scan_source_t* src) {
+    if(src->position >= src->item_count) {
+        return NULL;
+    }
+
+    if(scan->direction == TOSDB_SCAN_DIRECTION_BACKWARD) {
+        return src->items[src->item_count - 1 - src->position];
+    }
+
+    return src->items[src->position];
+}
+
+static void tosdb_scan_advance(tosdb_scan_t* scan) {
+    if(scan->current_record) {
+        scan->current_record->destroy(scan->current_record);
+        scan->current_record = NULL;
+    }
+
+    scan->current_item = NULL;
+    scan->current_source = NULL;
+
+    int8_t dir = scan->direction == TOSDB_SCAN_DIRECTION_BACKWARD ? -1 : 1;
+
+    while(true) {
+        tosdb_memtable_index_item_t* best = NULL;
+        tosdb_scan_source_t* best_src = NULL;
+
+        // sources are ordered from newer to older, so on ties first source wins
+        for(uint64_t i = 0; i < list_size(scan->sources); i++) {
+            tosdb_scan_source_t* src = (tosdb_scan_source_t*)list_get_data_at_position(scan->sources, i);
+            tosdb_memtable_index_item_t* head = tosdb_scan_source_head(scan, src);
+
+            if(!head) {
+                continue;
+            }
+
+            if(!best || tosdb_memtable_index_comparator(head, best) * dir < 0) {
+                best = head;
+                best_src = src;
+            }
+        }
+
+        if(!best) {
+            scan->end_of_scan = true;
+
+            return;
+        }
+
+        // older versions of the key are shadowed
+        for(uint64_t i = 0; i < list_size(scan->sources); i++) {
+            tosdb_scan_source_t* src = (tosdb_scan_source_t*)list_get_data_at_position(scan->sources, i);
+            tosdb_memtable_index_item_t* head = tosdb_scan_source_head(scan, src);
+
+            while(head && tosdb_memtable_index_comparator(head, best) == 0) {
+                src->position++;
+                head = tosdb_scan_source_head(scan, src);
+            }
+        }
+
+        if(best->is_deleted) {
+            continue;
+        }
+
+        scan->current_item = best;
+        scan->current_source = best_src;
+
+        return;
+    }
+}
+
+static tosdb_record_t* tosdb_scan_fetch_record(tosdb_scan_t* scan) {
+    tosdb_memtable_index_item_t* item = scan->current_item;
+    tosdb_scan_source_t* src = scan->current_source;
+
+    uint8_t* value_data = NULL;
+
+    if(src->values) {
+        value_data = memory_malloc(item->length);
+
+        if(value_data && !buffer_write_slice_into(src->values, item->offset, item->length, value_data)) {
+            memory_free(value_data);
+            value_data = NULL;
+        }
+    } else {
+        value_data = tosdb_valuelog_read(scan->tbl, src->level, src->sstable_id, src->vl_chunks, src->vl_chunk_count, item->offset, item->length);
+    }
+
+    if(!value_data) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot read value of scanned record");
+
+        return NULL;
+    }
+
+    data_t s_d = {0};
+    s_d.length = item->length;
+    s_d.type = DATA_TYPE_INT8_ARRAY;
+    s_d.value = value_data;
+
+    data_t* r_d = data_bson_deserialize(&s_d);
+
+    memory_free(value_data);
+
+    if(!r_d) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot deserialize data");
+
+        return NULL;
+    }
+
+    tosdb_record_t* record = tosdb_table_create_record(scan->tbl);
+
+    if(!record) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create record");
+        data_free(r_d);
+
+        return NULL;
+    }
+
+    data_t* tmp = r_d->value;
+
+    for(uint64_t i = 0; i < r_d->length; i++) {
+        uint64_t tmp_col_id = (uint64_t)tmp[i].name->value;
+
+        if(!tosdb_record_set_data_with_colid(record, tmp_col_id, tmp[i].type, tmp[i].length, tmp[i].value)) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot populate record");
+        }
+    }
+
+    data_free(r_d);
+
+    tosdb_record_context_t* ctx = record->context;
+    ctx->record_id = item->record_id;
+    ctx->level = src->level;
+    ctx->sstable_id = src->sstable_id;
+
+    return record;
+}
+
+static int8_t tosdb_scan_iterator_destroy(iterator_t* iter) {
+    tosdb_scan_t* scan = iter->metadata;
+
+    if(scan) {
+        if(scan->current_record) {
+            scan->current_record->destroy(scan->current_record);
+        }
+
+        if(scan->sources) {
+            while(list_size(scan->sources)) {
+                tosdb_scan_source_free((tosdb_scan_source_t*)list_queue_pop(scan->sources));
+            }
+
+            list_destroy(scan->sources);
+        }
+
+        memory_free(scan->lo);
+        memory_free(scan->hi);
+        memory_free(scan);
+    }
+
+    memory_free(iter);
+
+    return 0;
+}
+
+static iterator_t* tosdb_scan_iterator_next(iterator_t* iter) {
+    tosdb_scan_t* scan = iter->metadata;
+
+    if(!scan->end_of_scan) {
+        tosdb_scan_advance(scan);
+    }
+
+    return iter;
+}
+
+static int8_t tosdb_scan_iterator_end_of_iterator(iterator_t* iter) {
+    tosdb_scan_t* scan = iter->metadata;
+
+    return scan->end_of_scan ? 0 : 1;
+}
+
+static const void* tosdb_scan_iterator_get_item(iterator_t* iter) {
+    tosdb_scan_t* scan = iter->metadata;
+
+    if(scan->end_of_scan || !scan->current_item) {
+        return NULL;
+    }
+
+    if(!scan->current_record) {
+        scan->current_record = tosdb_scan_fetch_record(scan);
+    }
+
+    return scan->current_record;
+}
+
+static const void* tosdb_scan_iterator_get_extra_data(iterator_t* iter) {
+    tosdb_scan_t* scan = iter->metadata;
+
+    return scan->current_item;
+}
+
+iterator_t* tosdb_table_scan(tosdb_table_t* tbl, const char_t* colname, tosdb_record_t* lo, tosdb_record_t* hi, tosdb_scan_direction_t direction) {
+    if(!tbl || !colname) {
+        PRINTLOG(TOSDB, LOG_ERROR, "table or column name is null");
+
+        return NULL;
+    }
+
+    if(!tbl->is_open || tbl->is_deleted) {
+        PRINTLOG(TOSDB, LOG_ERROR, "table is closed or deleted");
+
+        return NULL;
+    }
+
+    const tosdb_column_t* col = hashmap_get(tbl->columns, colname);
+
+    if(!col) {
+        PRINTLOG(TOSDB, LOG_ERROR, "column %s is not at table %s", colname, tbl->name);
+
+        return NULL;
+    }
+
+    const tosdb_index_t* idx = tosdb_table_get_index_by_column_id(tbl, col->id);
+
+    if(!idx) {
+        PRINTLOG(TOSDB, LOG_ERROR, "index for column %s not found", colname);
+
+        return NULL;
+    }
+
+    if(idx->type != TOSDB_INDEX_PRIMARY && idx->type != TOSDB_INDEX_UNIQUE) {
+        PRINTLOG(TOSDB, LOG_ERROR, "scan supports only primary and unique indexes");
+
+        return NULL;
+    }
+
+    tosdb_scan_t* scan = memory_malloc(sizeof(tosdb_scan_t));
+
+    if(!scan) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create scan");
+
+        return NULL;
+    }
+
+    iterator_t* iter = memory_malloc(sizeof(iterator_t));
+
+    if(!iter) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create scan iterator");
+        memory_free(scan);
+
+        return NULL;
+    }
+
+    iter->metadata = scan;
+    iter->destroy = tosdb_scan_iterator_destroy;
+    iter->next = tosdb_scan_iterator_next;
+    iter->end_of_iterator = tosdb_scan_iterator_end_of_iterator;
+    iter->get_item = tosdb_scan_iterator_get_item;
+    iter->get_extra_data = tosdb_scan_iterator_get_extra_data;
+
+    scan->tbl = tbl;
+    scan->idx = idx;
+    scan->direction = direction;
+    scan->lo = tosdb_scan_bound_create(idx, lo);
+    scan->hi = tosdb_scan_bound_create(idx, hi);
+    scan->sources = list_create_queue();
+
+    if((lo && !scan->lo) || (hi && !scan->hi) || !scan->sources) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create scan bounds, bounds should have key of column %s", colname);
+        tosdb_scan_iterator_destroy(iter);
+
+        return NULL;
+    }
+
+    boolean_t error = false;
+
+    rwlock_read_acquire(tbl->lock);
+
+    // same order with record get: memtables, level one sstables, then deeper levels
+    if(tbl->memtables) {
+        for(uint64_t i = 0; i < list_size(tbl->memtables) && !error; i++) {
+            const tosdb_memtable_t* mt = list_get_data_at_position(tbl->memtables, i);
+
+            error = !tosdb_scan_source_add_memtable(scan, mt);
+        }
+    }
+
+    if(!error && tbl->sstable_list_items) {
+        error = !tosdb_scan_source_add_sstable_list(scan, tbl->sstable_list_items);
+    }
+
+    if(!error && tbl->sstable_levels) {
+        for(uint64_t i = 1; i <= tbl->sstable_max_level && !error; i++) {
+            list_t* st_lvl_l = (list_t*)hashmap_get(tbl->sstable_levels, (void*)i);
+
+            if(st_lvl_l) {
+                error = !tosdb_scan_source_add_sstable_list(scan, st_lvl_l);
+            }
+        }
+    }
+
+    rwlock_read_release(tbl->lock);
+
+    if(error) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create scan sources for table %s", tbl->name);
+        tosdb_scan_iterator_destroy(iter);
+
+        return NULL;
+    }
+
+    tosdb_scan_advance(scan);
+
+    return iter;
+}
@@ -288,6 +288,8 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
     uint64_t valuelog_size = 0;
     uint8_t* idx_data = NULL;
     uint8_t* org_idx_data = NULL;
+    tosdb_block_valuelog_chunk_t* vl_chunks = NULL;
+    uint64_t vl_chunk_count = 0;
 
     tosdb_cached_index_data_t* c_id = NULL;
 
@@ -304,6 +306,8 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
         record_count = c_id->record_count;
         valuelog_location = c_id->valuelog_location;
         valuelog_size = c_id->valuelog_size;
+        vl_chunks = c_id->valuelog_chunks;
+        vl_chunk_count = c_id->valuelog_chunk_count;
     } else {
         PRINTLOG(TOSDB, LOG_TRACE, "index data read from backend");
         valuelog_location = sli->valuelog_location;
@@ -319,6 +323,15 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
         }
 
         record_count = b_sid->record_count;
+        vl_chunk_count = b_sid->valuelog_chunk_count;
+        vl_chunks = tosdb_valuelog_chunks_from_index_data(b_sid);
+
+        if(vl_chunk_count && !vl_chunks) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog chunk table");
+            memory_free(b_sid);
+
+            return false;
+        }
 
         buffer_t* buf_idx_in = buffer_encapsulate(b_sid->data, b_sid->index_data_size);
         buffer_t* buf_idx_out = buffer_new_with_capacity(NULL, b_sid->index_data_unpacked_size);
@@ -336,6 +349,7 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
         if(zc_res != 0 || zc != index_data_unpacked_size) {
             PRINTLOG(TOSDB, LOG_ERROR, "cannot unpack idx");
             buffer_destroy(buf_idx_out);
+            memory_free(vl_chunks);
 
             return false;
         }
@@ -347,6 +361,7 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
 
         if(!st_idx_items) {
             memory_free(idx_data);
+            memory_free(vl_chunks);
             PRINTLOG(TOSDB, LOG_ERROR, "cannot create index item array");
 
             return false;
@@ -358,6 +373,7 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
             if(!st_idx_items[i]) {
                 memory_free(st_idx_items);
                 memory_free(idx_data);
+                memory_free(vl_chunks);
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot create index item 0x%llx", i);
 
                 return false;
@@ -372,7 +388,8 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
             if(!c_id) {
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot allocate cached index data");
                 memory_free(st_idx_items);
-                memory_free(idx_data);
+                memory_free(org_idx_data);
+                memory_free(vl_chunks);
 
                 return false;
             }
@@ -382,7 +399,10 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
             c_id->record_count = record_count;
             c_id->valuelog_location = valuelog_location;
             c_id->valuelog_size = valuelog_size;
-            c_id->cache_key.data_size = sizeof(tosdb_cached_index_data_t) + index_data_unpacked_size + sizeof(tosdb_memtable_index_item_t*) * record_count;
+            c_id->valuelog_chunks = vl_chunks;
+            c_id->valuelog_chunk_count = vl_chunk_count;
+            c_id->cache_key.data_size = sizeof(tosdb_cached_index_data_t) + index_data_unpacked_size + sizeof(tosdb_memtable_index_item_t*) * record_count +
+                                        sizeof(tosdb_block_valuelog_chunk_t) * vl_chunk_count;
 
             tosdb_cache_put(tdb_cache, (tosdb_cache_key_t*)c_id);
         }
@@ -401,6 +421,7 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
         if(!tdb_cache) {
             memory_free(st_idx_items);
             memory_free(org_idx_data);
+            memory_free(vl_chunks);
         }
 
         return false;
@@ -412,6 +433,7 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
         if(!tdb_cache) {
             memory_free(st_idx_items);
             memory_free(org_idx_data);
+            memory_free(vl_chunks);
         }
 
         return false;
@@ -423,12 +445,12 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
         if(!tdb_cache) {
             memory_free(st_idx_items);
             memory_free(org_idx_data);
+            memory_free(vl_chunks);
         }
 
         ctx->is_deleted = true;
         ctx->level = sli->level;
         ctx->sstable_id = sli->sstable_id;
-        ctx->record_id = found_item->record_id;
         ctx->offset = -1ULL;
         ctx->length = 0;
 
@@ -438,87 +460,17 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
 
     uint64_t offset = found_item->offset;
     uint64_t length = found_item->length;
+    uint128_t record_id = found_item->record_id;
 
     if(!tdb_cache) {
         memory_free(st_idx_items);
         memory_free(org_idx_data);
     }
 
-    buffer_t* buf_vl_out = NULL;
-    tosdb_cached_valuelog_t* c_vl = NULL;
-
-    cache_key.type = TOSDB_CACHE_ITEM_TYPE_VALUELOG;
-
-    if(tdb_cache) {
-        c_vl = (tosdb_cached_valuelog_t*)tosdb_cache_get(tdb_cache, &cache_key);
-    }
-
-    if(c_vl) {
-        buf_vl_out = c_vl->values;
-    } else {
-        tosdb_block_valuelog_t* b_vl = (tosdb_block_valuelog_t*)tosdb_block_read(ctx->table->db->tdb, valuelog_location, valuelog_size);
-
-        if(!b_vl) {
-            PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog block");
-
-            return false;
-        }
-
-        buffer_t* buf_vl_in = buffer_encapsulate(b_vl->data, b_vl->data_size);
-
-        if(!buf_vl_in) {
-            PRINTLOG(TOSDB, LOG_ERROR, "cannot encapsulate valuelog");
-
-            return false;
-        }
-
-        buf_vl_out = buffer_new_with_capacity(NULL, b_vl->valuelog_unpacked_size);
-
-        if(!buf_vl_out) {
-            PRINTLOG(TOSDB, LOG_ERROR, "cannot create valuelog buffer for decompress");
-
-            return false;
-        }
-
-        uint64_t buf_vl_unpacked_size = b_vl->valuelog_unpacked_size;
-
-        int8_t zc_res = compression->unpack(buf_vl_in, buf_vl_out);
-
-        uint64_t zc = buffer_get_length(buf_vl_out);
-
-        memory_free(b_vl);
-        buffer_destroy(buf_vl_in);
-
-        if(zc_res != 0 || zc != buf_vl_unpacked_size) {
-            PRINTLOG(TOSDB, LOG_ERROR, "cannotunpack valuelog");
-            buffer_destroy(buf_vl_out);
-
-            return false;
-        }
-
-        if(tdb_cache) {
-            c_vl = memory_malloc(sizeof(tosdb_cached_valuelog_t));
-
-            if(!c_vl) {
-                PRINTLOG(TOSDB, LOG_ERROR, "cannot allocate cached valuelog");
-                buffer_destroy(buf_vl_out);
-
-                return false;
-            }
-
-            memory_memcopy(&cache_key, c_vl, sizeof(tosdb_cache_key_t));
-            c_vl->values = buf_vl_out;
-            c_vl->cache_key.data_size = sizeof(tosdb_cached_valuelog_t) + buffer_get_length(c_vl->values);
-
-            tosdb_cache_put(tdb_cache, (tosdb_cache_key_t*)c_vl);
-        }
-    }
-
-    buffer_seek(buf_vl_out, offset, BUFFER_SEEK_DIRECTION_START);
-    uint8_t* value_data = buffer_get_bytes(buf_vl_out, length);
+    uint8_t* value_data = tosdb_valuelog_read(ctx->table, sli->level, sli->sstable_id, vl_chunks, vl_chunk_count, offset, length);
 
     if(!tdb_cache) {
-        buffer_destroy(buf_vl_out);
+        memory_free(vl_chunks);
     }
 
     if(!value_data) {
@@ -560,9 +512,9 @@ boolean_t tosdb_sstable_get_on_index(tosdb_record_t * record, tosdb_block_sstabl
 
     ctx->level = sli->level;
     ctx->sstable_id = sli->sstable_id;
-    ctx->offset = found_item->offset;
-    ctx->length = found_item->length;
-    ctx->record_id = found_item->record_id;
+    ctx->offset = offset;
+    ctx->length = length;
+    ctx->record_id = record_id;
 
     data_free(r_d);
 
@@ -626,11 +578,7 @@ boolean_t tosdb_sstable_get_on_list(tosdb_record_t * record, list_t* st_list, to
     return found;
 }
 
-boolean_t tosdb_sstable_get(tosdb_record_t* record) {
-    if(!record || !record->context) {
-        return false;
-    }
-
+static boolean_t tosdb_sstable_get_internal(tosdb_record_t* record) {
     tosdb_record_context_t* ctx = record->context;
 
     uint64_t cached_level = ctx->level;
@@ -724,3 +672,18 @@ boolean_t tosdb_sstable_get(tosdb_record_t* record) {
     return false;
 }
 
+boolean_t tosdb_sstable_get(tosdb_record_t* record) {
+    if(!record || !record->context) {
+        return false;
+    }
+
+    tosdb_table_t* tbl = ((tosdb_record_context_t*)record->context)->table;
+
+    // sstable lists are walked without table lock, reader keeps retired lists and items alive
+    tosdb_table_sstable_reader_enter(tbl);
+    boolean_t res = tosdb_sstable_get_internal(record);
+    tosdb_table_sstable_reader_leave(tbl);
+
+    return res;
+}
+
@@ -318,6 +318,20 @@ boolean_t tosdb_sstable_search_on_index(tosdb_record_t * record, set_t* results,
 
         uint64_t index_data_unpacked_size = b_sid->index_data_unpacked_size;
 
+        tosdb_block_valuelog_chunk_t* vl_chunks = NULL;
+        uint64_t vl_chunk_count = b_sid->valuelog_chunk_count;
+
+        if(tdb_cache && vl_chunk_count) {
+            vl_chunks = tosdb_valuelog_chunks_from_index_data(b_sid);
+
+            if(!vl_chunks) {
+                PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog chunk table");
+                memory_free(b_sid);
+
+                return false;
+            }
+        }
+
         memory_free(b_sid);
 
         buffer_destroy(buf_idx_in);
@@ -326,6 +340,7 @@ boolean_t tosdb_sstable_search_on_index(tosdb_record_t * record, set_t* results,
             PRINTLOG(TOSDB, LOG_ERROR, "table %s, stli id %lli, index id %lli", ctx->table->name, sli->sstable_id, index_id);
             PRINTLOG(TOSDB, LOG_ERROR, "cannot unpack idx data, zc_res: %d, zc: %llu, index_data_unpacked_size: %llu", zc_res, zc, index_data_unpacked_size);
             buffer_destroy(buf_idx_out);
+            memory_free(vl_chunks);
 
             return false;
         }
@@ -338,6 +353,7 @@ boolean_t tosdb_sstable_search_on_index(tosdb_record_t * record, set_t* results,
         if(!st_idx_items) {
             memory_free(idx_data);
             PRINTLOG(TOSDB, LOG_ERROR, "cannot create index item array");
+            memory_free(vl_chunks);
 
             return false;
         }
@@ -350,6 +366,7 @@ boolean_t tosdb_sstable_search_on_index(tosdb_record_t * record, set_t* results,
                 memory_free(idx_data);
 
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot create index item 0x%llx", i);
+                memory_free(vl_chunks);
 
                 return false;
             }
@@ -364,6 +381,7 @@ boolean_t tosdb_sstable_search_on_index(tosdb_record_t * record, set_t* results,
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot allocate cached secondary index data");
                 memory_free(st_idx_items);
                 memory_free(idx_data);
+                memory_free(vl_chunks);
 
                 return false;
             }
@@ -373,7 +391,10 @@ boolean_t tosdb_sstable_search_on_index(tosdb_record_t * record, set_t* results,
             c_id->record_count = record_count;
             c_id->valuelog_location = sli->valuelog_location;
             c_id->valuelog_size = sli->valuelog_size;
-            c_id->cache_key.data_size = sizeof(tosdb_cached_index_data_t) + index_data_unpacked_size + sizeof(tosdb_memtable_secondary_index_item_t*) * record_count;
+            c_id->valuelog_chunks = vl_chunks;
+            c_id->valuelog_chunk_count = vl_chunk_count;
+            c_id->cache_key.data_size = sizeof(tosdb_cached_index_data_t) + index_data_unpacked_size + sizeof(tosdb_memtable_secondary_index_item_t*) * record_count +
+                                        sizeof(tosdb_block_valuelog_chunk_t) * vl_chunk_count;
 
             tosdb_cache_put(tdb_cache, (tosdb_cache_key_t*)c_id);
         }
@@ -500,11 +521,7 @@ boolean_t tosdb_sstable_search_on_list(tosdb_record_t * record, set_t* results,
     return !error;
 }
 
-boolean_t tosdb_sstable_search(tosdb_record_t* record, set_t* results) {
-    if(!record || !record->context) {
-        return false;
-    }
-
+static boolean_t tosdb_sstable_search_internal(tosdb_record_t* record, set_t* results) {
     tosdb_record_context_t* ctx = record->context;
 
     if(hashmap_size(ctx->keys) != 1) {
@@ -563,3 +580,18 @@ boolean_t tosdb_sstable_search(tosdb_record_t* record, set_t* results) {
     return true;
 }
 
+boolean_t tosdb_sstable_search(tosdb_record_t* record, set_t* results) {
+    if(!record || !record->context) {
+        return false;
+    }
+
+    tosdb_table_t* tbl = ((tosdb_record_context_t*)record->context)->table;
+
+    // sstable lists are walked without table lock, reader keeps retired lists and items alive
+    tosdb_table_sstable_reader_enter(tbl);
+    boolean_t res = tosdb_sstable_search_internal(record, results);
+    tosdb_table_sstable_reader_leave(tbl);
+
+    return res;
+}
+
@@ -13,6 +13,8 @@
 
 MODULE("turnstone.kernel.db");
 
+static void tosdb_table_free_retired_sstables(tosdb_table_t* tbl);
+
 
 const tosdb_column_t* tosdb_table_get_column_by_index_id(const tosdb_table_t* tbl, uint64_t id) {
     if(!tbl || !tbl->columns || !tbl->indexes) {
@@ -356,6 +358,15 @@ tosdb_table_t* tosdb_table_load_table(tosdb_table_t* tbl) {
 
     memory_free(tbl_block);
 
+    // background flush and compaction only fill or replace it under table lock
+    tbl->sstable_list_items = list_create_stack_with_heap(tbl->db->tdb->heap);
+
+    if(!tbl->sstable_list_items) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable list items stack for table %s", tbl->name);
+
+        return NULL;
+    }
+
     tbl->is_open = true;
 
     PRINTLOG(TOSDB, LOG_DEBUG, "table %s loaded", tbl->name);
@@ -424,6 +435,29 @@ tosdb_table_t* tosdb_table_create_or_open(tosdb_database_t* db, const char_t* na
         return NULL;
     }
 
+    tbl->lock = rwlock_create();
+
+    if(!tbl->lock) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create table lock");
+        memory_free(tbl);
+
+        lock_release(db->lock);
+
+        return NULL;
+    }
+
+    // background flush and compaction only fill or replace it under table lock
+    tbl->sstable_list_items = list_create_stack_with_heap(db->tdb->heap);
+
+    if(!tbl->sstable_list_items) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable list items stack");
+        rwlock_destroy(tbl->lock);
+        memory_free(tbl);
+
+        lock_release(db->lock);
+
+        return NULL;
+    }
 
     tbl->id = db->table_next_id;
 
@@ -475,6 +509,8 @@ boolean_t tosdb_table_close(tosdb_table_t* tbl) {
     if(tbl->is_open) {
         PRINTLOG(TOSDB, LOG_DEBUG, "table %s will be closed", tbl->name);
 
+        tosdb_compaction_table_disable(tbl);
+
         if(tbl->is_dirty) {
             if(!tosdb_table_persist(tbl)) {
                 PRINTLOG(TOSDB, LOG_ERROR, "cannot persist table %s", tbl->name);
@@ -484,6 +520,9 @@ boolean_t tosdb_table_close(tosdb_table_t* tbl) {
             }
         }
 
+        // memtables are freed below, flush task should not hold any of them
+        tosdb_memtable_flush_wait(tbl, 1);
+
         iterator_t* iter = hashmap_iterator_create(tbl->columns);
 
         if(!iter) {
@@ -587,6 +626,12 @@ boolean_t tosdb_table_close(tosdb_table_t* tbl) {
             PRINTLOG(TOSDB, LOG_TRACE, "sstable levels of table %s destroyed", tbl->name);
         }
 
+        // created again when table is opened
+        list_destroy_with_data(tbl->sstable_list_items);
+        tbl->sstable_list_items = NULL;
+
+        tosdb_table_free_retired_sstables(tbl);
+
         tbl->is_open = false;
     }
 
@@ -606,6 +651,9 @@ boolean_t tosdb_table_free(tosdb_table_t* tbl) {
 
     PRINTLOG(TOSDB, LOG_DEBUG, "table %s will be freed", tbl->name);
 
+    tosdb_compaction_table_disable(tbl);
+    tosdb_memtable_flush_wait(tbl, 1);
+
     if(tbl->columns) {
         iterator_t* iter = hashmap_iterator_create(tbl->columns);
 
@@ -708,8 +756,10 @@ boolean_t tosdb_table_free(tosdb_table_t* tbl) {
         tbl->sstable_levels = NULL;
     }
 
+    tosdb_table_free_retired_sstables(tbl);
+
     memory_free(tbl->name);
-    lock_destroy(tbl->lock);
+    rwlock_destroy(tbl->lock);
     memory_free(tbl);
     PRINTLOG(TOSDB, LOG_DEBUG, "table freed");
 
@@ -1123,7 +1173,18 @@ boolean_t tosdb_table_memtable_persist(tosdb_table_t* tbl) {
 
     boolean_t error = false;
 
-    lock_acquire(tbl->lock);
+    // drain background flushes, new ones are only queued under table lock
+    while(true) {
+        tosdb_memtable_flush_wait(tbl, 1);
+
+        rwlock_write_acquire(tbl->lock);
+
+        if(!tbl->flush_pending_count) {
+            break;
+        }
+
+        rwlock_write_release(tbl->lock);
+    }
 
     uint64_t idx = list_size(tbl->memtables);
 
@@ -1143,6 +1204,8 @@ boolean_t tosdb_table_memtable_persist(tosdb_table_t* tbl) {
 
         if(!tosdb_memtable_persist(mt)) {
             error = true;
+        } else {
+            mt->is_flush_pending = false; // background flush of it was failed
         }
 
         if(mt->stli) {
@@ -1153,7 +1216,9 @@ boolean_t tosdb_table_memtable_persist(tosdb_table_t* tbl) {
     } while(idx > 0);
 
     if(!list_size(tbl->sstable_list_items)) {
-        return true;
+        rwlock_write_release(tbl->lock);
+
+        return !error;
     }
 
     PRINTLOG(TOSDB, LOG_DEBUG, "sstable list items count %lli", list_size(tbl->sstable_list_items));
@@ -1165,7 +1230,7 @@ boolean_t tosdb_table_memtable_persist(tosdb_table_t* tbl) {
 
     if(!buf_stli) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable list buffer");
-        lock_release(tbl->lock);
+        rwlock_write_release(tbl->lock);
 
         return false;
     }
@@ -1174,13 +1239,25 @@ boolean_t tosdb_table_memtable_persist(tosdb_table_t* tbl) {
 
     if(!iter) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable iter");
-        lock_release(tbl->lock);
+        rwlock_write_release(tbl->lock);
 
         return false;
     }
 
     uint64_t stli_cnt = list_size(tbl->sstable_list_items);
 
+    // persisted items join level one, newest first, so they are still found and compaction sees them
+    list_t* st_l1 = list_create_queue();
+
+    if(!st_l1) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create level one sstable list");
+        iter->destroy(iter);
+        buffer_destroy(buf_stli);
+        rwlock_write_release(tbl->lock);
+
+        return false;
+    }
+
     while(iter->end_of_iterator(iter) != 0) {
         tosdb_block_sstable_list_item_t* stli = (tosdb_block_sstable_list_item_t*)iter->delete_item(iter);
 
@@ -1188,13 +1265,44 @@ boolean_t tosdb_table_memtable_persist(tosdb_table_t* tbl) {
 
         buffer_append_bytes(buf_stli, (uint8_t*)stli, size);
 
-        memory_free(stli);
+        list_queue_push(st_l1, stli);
 
         iter = iter->next(iter);
     }
 
     iter->destroy(iter);
 
+    list_t* old_st_l1 = tbl->sstable_levels ? (list_t*)hashmap_get(tbl->sstable_levels, (void*)1) : NULL;
+    boolean_t st_l1_error = false;
+
+    if(old_st_l1) {
+        iter = list_iterator_create(old_st_l1);
+
+        if(!iter) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot create level one sstable list iterator");
+            st_l1_error = true;
+        } else {
+            while(iter->end_of_iterator(iter) != 0) {
+                list_queue_push(st_l1, iter->get_item(iter));
+
+                iter = iter->next(iter);
+            }
+
+            iter->destroy(iter);
+        }
+    }
+
+    if(st_l1_error) {
+        list_destroy_with_data(st_l1);
+        error = true;
+    } else if(!tosdb_table_sstable_level_replace(tbl, 1, st_l1)) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot update level one sstable list of table %s", tbl->name);
+        list_destroy(st_l1);
+        error = true;
+    } else {
+        tosdb_table_sstable_reclaim(tbl);
+    }
+
     block_size = buffer_get_length(buf_stli);
 
     if(block_size % TOSDB_PAGE_SIZE) {
@@ -1205,6 +1313,7 @@ boolean_t tosdb_table_memtable_persist(tosdb_table_t* tbl) {
 
     if(!block) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable list block");
+        rwlock_write_release(tbl->lock);
 
         return false;
     }
@@ -1229,6 +1338,7 @@ boolean_t tosdb_table_memtable_persist(tosdb_table_t* tbl) {
 
     if(!block_loc) {
         PRINTLOG(TOSDB, LOG_ERROR, "cannot write sstable list");
+        rwlock_write_release(tbl->lock);
 
         return false;
     }
@@ -1241,11 +1351,112 @@ boolean_t tosdb_table_memtable_persist(tosdb_table_t* tbl) {
 
     tbl->current_memtable = NULL;
 
-    lock_release(tbl->lock);
+    rwlock_write_release(tbl->lock);
 
     return !error;
 }
 
+boolean_t tosdb_table_sstable_level_replace(tosdb_table_t* tbl, uint64_t level, list_t* st_list) {
+    if(!tbl || !st_list) {
+        PRINTLOG(TOSDB, LOG_ERROR, "table or sstable list is null");
+
+        return false;
+    }
+
+    // compaction task replaces levels, table lists are allocated from heap of tosdb opener
+    memory_heap_t* heap = tbl->db->tdb->heap;
+
+    if(!tbl->sstable_levels) {
+        tbl->sstable_levels = hashmap_integer_with_heap(heap, 128);
+
+        if(!tbl->sstable_levels) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot create sstable levels map");
+
+            return false;
+        }
+    }
+
+    if(!tbl->sstable_retired_lists) {
+        tbl->sstable_retired_lists = list_create_list_with_heap(heap);
+
+        if(!tbl->sstable_retired_lists) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot create retired sstable lists");
+
+            return false;
+        }
+    }
+
+    list_t* old_list = (list_t*)hashmap_get(tbl->sstable_levels, (void*)level);
+
+    hashmap_put(tbl->sstable_levels, (void*)level, st_list);
+
+    if(old_list) {
+        list_list_insert(tbl->sstable_retired_lists, old_list);
+    }
+
+    tbl->sstable_max_level = MAX(tbl->sstable_max_level, level);
+
+    return true;
+}
+
+void tosdb_table_sstable_reader_enter(tosdb_table_t* tbl) {
+    // full barrier, lists are loaded after reclaimer can see the reader
+    __atomic_add_fetch(&tbl->sstable_reader_count, 1, __ATOMIC_SEQ_CST);
+}
+
+void tosdb_table_sstable_reader_leave(tosdb_table_t* tbl) {
+    __atomic_sub_fetch(&tbl->sstable_reader_count, 1, __ATOMIC_SEQ_CST);
+}
+
+void tosdb_table_sstable_reclaim(tosdb_table_t* tbl) {
+    if(!tbl->sstable_retired_lists && !tbl->sstable_retired_items) {
+        return;
+    }
+
+    // pairs with reader enter: either reader is counted or it loads lists published before
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(&tbl->sstable_reader_count, __ATOMIC_SEQ_CST)) {
+        // a later compaction or flush retries
+        return;
+    }
+
+    tosdb_table_free_retired_sstables(tbl);
+}
+
+static void tosdb_table_free_retired_sstables(tosdb_table_t* tbl) {
+    if(tbl->sstable_retired_lists) {
+        // items of retired lists are owned by current lists or retired items
+        while(list_size(tbl->sstable_retired_lists)) {
+            list_t* st_list = (list_t*)list_delete_at_tail(tbl->sstable_retired_lists);
+
+            list_destroy(st_list);
+        }
+
+        list_destroy(tbl->sstable_retired_lists);
+        tbl->sstable_retired_lists = NULL;
+    }
+
+    if(tbl->sstable_retired_items) {
+        list_destroy_with_data(tbl->sstable_retired_items);
+        tbl->sstable_retired_items = NULL;
+    }
+}
+
+uint64_t tosdb_sstable_list_item_size(const tosdb_block_sstable_list_item_t* stli) {
+    if(!stli) {
+        return 0;
+    }
+
+    uint64_t size = stli->valuelog_size;
+
+    for(uint64_t i = 0; i < stli->index_count; i++) {
+        size += stli->indexes[i].index_size;
+    }
+
+    return size;
+}
+
 boolean_t tosdb_table_set_compaction_index_id_hint(tosdb_table_t* tbl, uint64_t index_id) {
     if(!tbl) {
         PRINTLOG(TOSDB, LOG_ERROR, "table is null");
@@ -0,0 +1,404 @@
+/**
+ * @file tosdb_valuelog.64.c
+ * @brief tosdb valuelog chunk interface implementation
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <tosdb/tosdb.h>
+#include <tosdb/tosdb_internal.h>
+#include <tosdb/tosdb_cache.h>
+#include <logging.h>
+#include <compression.h>
+
+MODULE("turnstone.kernel.db");
+
+boolean_t tosdb_valuelog_chunk_append(tosdb_memtable_t* mt, uint64_t offset, uint64_t length) {
+    if(!mt || !mt->valuelog_chunks) {
+        PRINTLOG(TOSDB, LOG_ERROR, "memtable or chunk table is null");
+
+        return false;
+    }
+
+    uint64_t ct_len = buffer_get_length(mt->valuelog_chunks);
+    tosdb_block_valuelog_chunk_t* chunk = NULL;
+
+    if(ct_len) {
+        chunk = (tosdb_block_valuelog_chunk_t*)buffer_get_view_at_position(mt->valuelog_chunks,
+                                                                           ct_len - sizeof(tosdb_block_valuelog_chunk_t),
+                                                                           sizeof(tosdb_block_valuelog_chunk_t));
+    }
+
+    if(!chunk || (chunk->unpacked_size && chunk->unpacked_size + length > TOSDB_VALUELOG_CHUNK_SIZE)) {
+        tosdb_block_valuelog_chunk_t new_chunk = {0};
+        new_chunk.unpacked_offset = offset;
+
+        if(!buffer_append_bytes(mt->valuelog_chunks, (uint8_t*)&new_chunk, sizeof(tosdb_block_valuelog_chunk_t))) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot append valuelog chunk");
+
+            return false;
+        }
+
+        ct_len += sizeof(tosdb_block_valuelog_chunk_t);
+
+        chunk = (tosdb_block_valuelog_chunk_t*)buffer_get_view_at_position(mt->valuelog_chunks,
+                                                                           ct_len - sizeof(tosdb_block_valuelog_chunk_t),
+                                                                           sizeof(tosdb_block_valuelog_chunk_t));
+    }
+
+    if(!chunk) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot get valuelog chunk");
+
+        return false;
+    }
+
+    chunk->unpacked_size += length;
+
+    return true;
+}
+
+boolean_t tosdb_valuelog_persist(tosdb_memtable_t* mt, uint64_t* location, uint64_t* size) {
+    if(!mt || !location || !size) {
+        PRINTLOG(TOSDB, LOG_ERROR, "required params are null");
+
+        return false;
+    }
+
+    *location = 0;
+    *size = 0;
+
+    const compression_t* compression = mt->tbl->db->tdb->compression;
+
+    uint64_t chunk_count = buffer_get_length(mt->valuelog_chunks) / sizeof(tosdb_block_valuelog_chunk_t);
+    tosdb_block_valuelog_chunk_t* chunks = (tosdb_block_valuelog_chunk_t*)buffer_get_view_at_position(mt->valuelog_chunks, 0,
+                                                                                                       buffer_get_length(mt->valuelog_chunks));
+
+    for(uint64_t i = 0; i < chunk_count; i++) {
+        tosdb_block_valuelog_chunk_t* chunk = &chunks[i];
+
+        // chunk adopted from a compacted sstable, it is already at backend
+        if(chunk->location) {
+            if(!*location) {
+                *location = chunk->location;
+            }
+
+            *size += chunk->size;
+
+            continue;
+        }
+
+        uint8_t* chunk_data = buffer_get_view_at_position(mt->values, chunk->unpacked_offset, chunk->unpacked_size);
+
+        if(!chunk_data) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot get valuelog chunk 0x%llx data", i);
+
+            return false;
+        }
+
+        buffer_t* buf_in = buffer_encapsulate(chunk_data, chunk->unpacked_size);
+        buffer_t* buf_out = buffer_new_with_capacity(NULL, chunk->unpacked_size);
+
+        if(!buf_in || !buf_out) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot create buffers for valuelog chunk 0x%llx", i);
+            buffer_destroy(buf_in);
+            buffer_destroy(buf_out);
+
+            return false;
+        }
+
+        int8_t zc_res = compression->pack(buf_in, buf_out);
+
+        buffer_destroy(buf_in);
+
+        uint64_t ol = buffer_get_length(buf_out);
+
+        if(zc_res != 0 || !ol) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot pack valuelog chunk 0x%llx", i);
+            buffer_destroy(buf_out);
+
+            return false;
+        }
+
+        uint64_t b_vl_size = sizeof(tosdb_block_valuelog_t) + ol;
+
+        if(b_vl_size % TOSDB_PAGE_SIZE) {
+            b_vl_size += TOSDB_PAGE_SIZE - (b_vl_size % TOSDB_PAGE_SIZE);
+        }
+
+        tosdb_block_valuelog_t * b_vl = memory_malloc(b_vl_size);
+
+        if(!b_vl) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot create valuelog block");
+            buffer_destroy(buf_out);
+
+            return false;
+        }
+
+        b_vl->header.block_size = b_vl_size;
+        b_vl->header.block_type = TOSDB_BLOCK_TYPE_VALUELOG;
+        b_vl->database_id = mt->tbl->db->id;
+        b_vl->table_id = mt->tbl->id;
+        b_vl->sstable_id = mt->id;
+        b_vl->chunk_id = i;
+        b_vl->chunk_offset = chunk->unpacked_offset;
+        b_vl->data_size = ol;
+        b_vl->valuelog_unpacked_size = chunk->unpacked_size;
+        buffer_write_all_into(buf_out, b_vl->data);
+        buffer_destroy(buf_out);
+
+        uint64_t b_vl_loc = tosdb_block_write(mt->tbl->db->tdb, (tosdb_block_header_t*)b_vl);
+
+        memory_free(b_vl);
+
+        if(!b_vl_loc) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot persist valuelog chunk 0x%llx for memtable %lli of table %s", i, mt->id, mt->tbl->name);
+
+            return false;
+        }
+
+        chunk->location = b_vl_loc;
+        chunk->size = b_vl_size;
+
+        if(!*location) {
+            *location = b_vl_loc;
+        }
+
+        *size += b_vl_size;
+    }
+
+    PRINTLOG(TOSDB, LOG_DEBUG, "valuelog for memtable %lli of table %s persisted with 0x%llx chunks at 0x%llx(0x%llx)",
+             mt->id, mt->tbl->name, chunk_count, *location, *size);
+
+    return true;
+}
+
+tosdb_block_valuelog_chunk_t* tosdb_valuelog_chunks_from_index_data(const tosdb_block_sstable_index_data_t* b_sid) {
+    if(!b_sid || !b_sid->valuelog_chunk_count) {
+        return NULL;
+    }
+
+    uint64_t ct_size = sizeof(tosdb_block_valuelog_chunk_t) * b_sid->valuelog_chunk_count;
+
+    if(sizeof(tosdb_block_sstable_index_data_t) + b_sid->index_data_size + ct_size > b_sid->header.block_size) {
+        PRINTLOG(TOSDB, LOG_ERROR, "valuelog chunk table overflows index data block");
+
+        return NULL;
+    }
+
+    tosdb_block_valuelog_chunk_t* chunks = memory_malloc(ct_size);
+
+    if(!chunks) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot allocate valuelog chunk table");
+
+        return NULL;
+    }
+
+    memory_memcopy(b_sid->data + b_sid->index_data_size, chunks, ct_size);
+
+    return chunks;
+}
+
+static const tosdb_block_valuelog_chunk_t* tosdb_valuelog_chunk_find(const tosdb_block_valuelog_chunk_t* chunks, uint64_t chunk_count, uint64_t offset) {
+    uint64_t first = 0;
+    uint64_t last = chunk_count;
+
+    while(first < last) {
+        uint64_t middle = first + (last - first) / 2;
+        const tosdb_block_valuelog_chunk_t* chunk = &chunks[middle];
+
+        if(offset < chunk->unpacked_offset) {
+            last = middle;
+        } else if(offset >= chunk->unpacked_offset + chunk->unpacked_size) {
+            first = middle + 1;
+        } else {
+            return chunk;
+        }
+    }
+
+    return NULL;
+}
+
+static buffer_t* tosdb_valuelog_chunk_unpack(const tosdb_table_t* tbl, const tosdb_block_valuelog_chunk_t* chunk) {
+    const compression_t* compression = tbl->db->tdb->compression;
+
+    tosdb_block_valuelog_t* b_vl = (tosdb_block_valuelog_t*)tosdb_block_read(tbl->db->tdb, chunk->location, chunk->size);
+
+    if(!b_vl) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot read valuelog block");
+
+        return NULL;
+    }
+
+    // chunk offset at block is the offset at valuelog which wrote it, compaction adopts chunks at shifted offsets
+    if(b_vl->valuelog_unpacked_size != chunk->unpacked_size) {
+        PRINTLOG(TOSDB, LOG_ERROR, "valuelog chunk mismatch at 0x%llx", chunk->location);
+        memory_free(b_vl);
+
+        return NULL;
+    }
+
+    buffer_t* buf_vl_in = buffer_encapsulate(b_vl->data, b_vl->data_size);
+
+    if(!buf_vl_in) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot encapsulate valuelog");
+        memory_free(b_vl);
+
+        return NULL;
+    }
+
+    buffer_t* buf_vl_out = buffer_new_with_capacity(NULL, chunk->unpacked_size);
+
+    if(!buf_vl_out) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create valuelog buffer for decompress");
+        buffer_destroy(buf_vl_in);
+        memory_free(b_vl);
+
+        return NULL;
+    }
+
+    int8_t zc_res = compression->unpack(buf_vl_in, buf_vl_out);
+
+    uint64_t zc = buffer_get_length(buf_vl_out);
+
+    buffer_destroy(buf_vl_in);
+    memory_free(b_vl);
+
+    if(zc_res != 0 || zc != chunk->unpacked_size) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot unpack valuelog chunk");
+        buffer_destroy(buf_vl_out);
+
+        return NULL;
+    }
+
+    return buf_vl_out;
+}
+
+uint8_t* tosdb_valuelog_read(const tosdb_table_t* tbl, uint64_t level, uint64_t sstable_id,
+                             const tosdb_block_valuelog_chunk_t* chunks, uint64_t chunk_count,
+                             uint64_t offset, uint64_t length) {
+    if(!tbl || !chunks || !chunk_count) {
+        PRINTLOG(TOSDB, LOG_ERROR, "table or valuelog chunk table is null");
+
+        return NULL;
+    }
+
+    const tosdb_block_valuelog_chunk_t* chunk = tosdb_valuelog_chunk_find(chunks, chunk_count, offset);
+
+    if(!chunk || offset + length > chunk->unpacked_offset + chunk->unpacked_size) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot find valuelog chunk of value at 0x%llx(0x%llx)", offset, length);
+
+        return NULL;
+    }
+
+    uint64_t chunk_id = chunk - chunks;
+
+    tosdb_cache_t* tdb_cache = tbl->db->tdb->cache;
+    tosdb_cached_valuelog_t* c_vl = NULL;
+
+    tosdb_cache_key_t cache_key = {0};
+    cache_key.type = TOSDB_CACHE_ITEM_TYPE_VALUELOG;
+    cache_key.database_id = tbl->db->id;
+    cache_key.table_id = tbl->id;
+    cache_key.level = level;
+    cache_key.sstable_id = sstable_id;
+    cache_key.chunk_id = chunk_id;
+
+    if(tdb_cache) {
+        c_vl = (tosdb_cached_valuelog_t*)tosdb_cache_get(tdb_cache, &cache_key);
+    }
+
+    buffer_t* buf_vl_out = NULL;
+
+    if(c_vl) {
+        buf_vl_out = c_vl->values;
+    } else {
+        buf_vl_out = tosdb_valuelog_chunk_unpack(tbl, chunk);
+
+        if(!buf_vl_out) {
+            return NULL;
+        }
+    }
+
+    uint8_t* value_data = memory_malloc(length);
+
+    if(value_data && !buffer_write_slice_into(buf_vl_out, offset - chunk->unpacked_offset, length, value_data)) {
+        memory_free(value_data);
+        value_data = NULL;
+    }
+
+    if(!value_data) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot read value data from valuelog");
+    }
+
+    if(!c_vl) {
+        if(tdb_cache) {
+            c_vl = memory_malloc(sizeof(tosdb_cached_valuelog_t));
+
+            if(!c_vl) {
+                PRINTLOG(TOSDB, LOG_ERROR, "cannot allocate cached valuelog");
+                buffer_destroy(buf_vl_out);
+
+                return value_data;
+            }
+
+            memory_memcopy(&cache_key, c_vl, sizeof(tosdb_cache_key_t));
+            c_vl->chunk_offset = chunk->unpacked_offset;
+            c_vl->values = buf_vl_out;
+            c_vl->cache_key.data_size = sizeof(tosdb_cached_valuelog_t) + buffer_get_length(c_vl->values);
+
+            tosdb_cache_put(tdb_cache, (tosdb_cache_key_t*)c_vl);
+        } else {
+            buffer_destroy(buf_vl_out);
+        }
+    }
+
+    return value_data;
+}
+
+buffer_t* tosdb_valuelog_read_all(const tosdb_table_t* tbl, const tosdb_block_valuelog_chunk_t* chunks, uint64_t chunk_count) {
+    if(!tbl) {
+        PRINTLOG(TOSDB, LOG_ERROR, "table is null");
+
+        return NULL;
+    }
+
+    uint64_t unpacked_size = 0;
+
+    if(chunk_count) {
+        unpacked_size = chunks[chunk_count - 1].unpacked_offset + chunks[chunk_count - 1].unpacked_size;
+    }
+
+    buffer_t* buf_vl_out = buffer_new_with_capacity(NULL, unpacked_size);
+
+    if(!buf_vl_out) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create valuelog buffer for decompress");
+
+        return NULL;
+    }
+
+    for(uint64_t i = 0; i < chunk_count; i++) {
+        buffer_t* buf_chunk = tosdb_valuelog_chunk_unpack(tbl, &chunks[i]);
+
+        if(!buf_chunk) {
+            buffer_destroy(buf_vl_out);
+
+            return NULL;
+        }
+
+        uint64_t chunk_len = 0;
+        uint8_t* chunk_data = buffer_get_all_bytes_and_destroy(buf_chunk, &chunk_len);
+
+        if(!chunk_data || !buffer_append_bytes(buf_vl_out, chunk_data, chunk_len)) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot append valuelog chunk 0x%llx", i);
+            memory_free(chunk_data);
+            buffer_destroy(buf_vl_out);
+
+            return NULL;
+        }
+
+        memory_free(chunk_data);
+    }
+
+    return buf_vl_out;
+}
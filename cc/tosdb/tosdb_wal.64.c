@@ -7,5 +7,688 @@
  */
 
 #include <tosdb/wal.h>
+#include <tosdb/tosdb_backend.h>
+#include <buffer.h>
+#include <cpu/sync.h>
+#include <crc.h>
+#include <logging.h>
+#include <strings.h>
 
 MODULE("turnstone.kernel.db");
+
+/**
+ * @struct tosdb_wal_t
+ * @brief tosdb wal
+ */
+struct tosdb_wal_t {
+    tosdb_t*       tdb; ///< owner tosdb
+    lock_t*        lock; ///< lock for pending entries
+    lock_t*        commit_lock; ///< lock for backend writes
+    buffer_t*      pending; ///< pending entries
+    uint64_t       pending_count; ///< pending entry count
+    uint64_t       last_ticket; ///< ticket of last appended entry
+    uint64_t       durable_ticket; ///< ticket of last committed entry
+    uint64_t       region_location; ///< current region location
+    uint64_t       region_size; ///< current region size
+    uint64_t       region_used; ///< used bytes of current region
+    uint64_t       previous_region_location; ///< previous region location of current region
+    uint64_t       previous_region_size; ///< previous region size of current region
+    uint64_t       next_sequence; ///< sequence of next block
+    tosdb_table_t* replay_table; ///< last table used while replaying
+};
+
+/**
+ * @struct tosdb_wal_region_t
+ * @brief wal region info used while replaying
+ */
+typedef struct tosdb_wal_region_t {
+    uint64_t location; ///< region location
+    uint64_t size; ///< region size
+    uint64_t previous_location; ///< previous region location
+    uint64_t previous_size; ///< previous region size
+} tosdb_wal_region_t;
+
+tosdb_wal_t* tosdb_wal_new(tosdb_t* tdb) {
+    if(!tdb) {
+        PRINTLOG(TOSDB, LOG_ERROR, "tosdb is null");
+
+        return NULL;
+    }
+
+    tosdb_wal_t* wal = memory_malloc(sizeof(tosdb_wal_t));
+
+    if(!wal) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create wal");
+
+        return NULL;
+    }
+
+    wal->tdb = tdb;
+    wal->lock = lock_create();
+    wal->commit_lock = lock_create();
+    wal->pending = buffer_new_with_capacity(NULL, TOSDB_WAL_GROUP_COMMIT_SIZE);
+
+    if(!wal->lock || !wal->commit_lock || !wal->pending) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create wal internals");
+        lock_destroy(wal->lock);
+        lock_destroy(wal->commit_lock);
+        buffer_destroy(wal->pending);
+        memory_free(wal);
+
+        return NULL;
+    }
+
+    wal->next_sequence = 1;
+
+    return wal;
+}
+
+boolean_t tosdb_wal_free(tosdb_wal_t* wal) {
+    if(!wal) {
+        return true;
+    }
+
+    if(wal->pending_count) {
+        PRINTLOG(TOSDB, LOG_WARNING, "wal has 0x%llx uncommitted entries, they will be discarded", wal->pending_count);
+    }
+
+    buffer_destroy(wal->pending);
+    lock_destroy(wal->commit_lock);
+    lock_destroy(wal->lock);
+    memory_free(wal);
+
+    return true;
+}
+
+boolean_t tosdb_wal_append(tosdb_wal_t* wal, tosdb_record_t* record, boolean_t del, uint64_t* ticket) {
+    if(!wal || !record || !record->context) {
+        PRINTLOG(TOSDB, LOG_ERROR, "wal or record is null");
+
+        return false;
+    }
+
+    tosdb_record_context_t* ctx = record->context;
+    tosdb_table_t* tbl = ctx->table;
+
+    data_t* sd = tosdb_record_serialize(record);
+
+    if(!sd) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot serialize record");
+
+        return false;
+    }
+
+    uint64_t entry_size = sizeof(tosdb_wal_entry_t) + sd->length;
+
+    if(entry_size % 8) {
+        entry_size += 8 - (entry_size % 8);
+    }
+
+    tosdb_wal_entry_t* entry = memory_malloc(entry_size);
+
+    if(!entry) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create wal entry");
+        memory_free(sd->value);
+        memory_free(sd);
+
+        return false;
+    }
+
+    entry->entry_size = entry_size;
+    entry->database_id = tbl->db->id;
+    entry->table_id = tbl->id;
+    entry->max_record_count = tbl->max_record_count;
+    entry->max_valuelog_size = tbl->max_valuelog_size;
+    entry->max_memtable_count = tbl->max_memtable_count;
+    entry->record_id = ctx->record_id;
+    entry->is_deleted = del;
+    entry->data_length = sd->length;
+    memory_memcopy(sd->value, entry->data, sd->length);
+
+    memory_free(sd->value);
+    memory_free(sd);
+
+    lock_acquire(wal->lock);
+
+    boolean_t res = buffer_append_bytes(wal->pending, (uint8_t*)entry, entry_size) != NULL;
+
+    if(res) {
+        wal->pending_count++;
+        wal->last_ticket++;
+
+        if(ticket) {
+            *ticket = wal->last_ticket;
+        }
+    }
+
+    lock_release(wal->lock);
+
+    memory_free(entry);
+
+    if(!res) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot append wal entry");
+    }
+
+    return res;
+}
+
+static boolean_t tosdb_wal_region_new(tosdb_wal_t* wal, uint64_t min_size) {
+    uint64_t region_size = 0;
+    uint64_t region_location = tosdb_block_allocate(wal->tdb, min_size, MAX(TOSDB_WAL_REGION_SIZE, min_size), &region_size);
+
+    if(region_location == 0) {
+        PRINTLOG(TOSDB, LOG_ERROR, "no space for wal region size 0x%llx", min_size);
+
+        return false;
+    }
+
+    wal->previous_region_location = wal->region_location;
+    wal->previous_region_size = wal->region_size;
+    wal->region_location = region_location;
+    wal->region_size = region_size;
+    wal->region_used = 0;
+
+    PRINTLOG(TOSDB, LOG_DEBUG, "new wal region at 0x%llx(0x%llx)", wal->region_location, wal->region_size);
+
+    return true;
+}
+
+static boolean_t tosdb_wal_write_batch(tosdb_wal_t* wal, buffer_t* batch, uint64_t entry_count) {
+    tosdb_superblock_t* sb = wal->tdb->superblock;
+    tosdb_backend_t* backend = wal->tdb->backend;
+
+    uint64_t data_size = buffer_get_length(batch);
+    uint64_t block_size = sizeof(tosdb_block_wal_t) + data_size;
+
+    if(block_size % TOSDB_PAGE_SIZE) {
+        block_size += TOSDB_PAGE_SIZE - (block_size % TOSDB_PAGE_SIZE);
+    }
+
+    if(!wal->region_location || wal->region_used + block_size > wal->region_size) {
+        if(!tosdb_wal_region_new(wal, block_size)) {
+            return false;
+        }
+    }
+
+    tosdb_block_wal_t* block = memory_malloc(block_size);
+
+    if(!block) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create wal block");
+
+        return false;
+    }
+
+    strcopy(TOSDB_SUPERBLOCK_SIGNATURE, block->header.signature);
+    block->header.block_type = TOSDB_BLOCK_TYPE_WAL;
+    block->header.block_size = block_size;
+    block->header.version_major = TOSDB_VERSION_MAJOR;
+    block->header.version_minor = TOSDB_VERSION_MINOR;
+    block->generation = sb->wal_generation;
+    block->sequence = wal->next_sequence;
+    block->region_location = wal->region_location;
+    block->previous_region_location = wal->previous_region_location;
+    block->previous_region_size = wal->previous_region_size;
+    block->entry_count = entry_count;
+    block->data_size = data_size;
+
+    buffer_write_all_into(batch, block->data);
+
+    block->crc32c = crc32c_sum(block, block_size, CRC32_SEED);
+
+    uint64_t w_cnt = backend->write(backend, wal->region_location + wal->region_used, block_size, (uint8_t*)block);
+
+    memory_free(block);
+
+    if(w_cnt != block_size) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot write wal block");
+
+        return false;
+    }
+
+    if(!backend->flush(backend)) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot flush wal block");
+
+        return false;
+    }
+
+    boolean_t region_is_new = wal->region_used == 0;
+
+    wal->region_used += block_size;
+    wal->next_sequence++;
+
+    // superblock is updated after first block is at disk, hence replay always finds previous region link
+    if(region_is_new) {
+        wal->tdb->is_dirty = true;
+        sb->wal_location = wal->region_location;
+        sb->wal_size = wal->region_size;
+
+        if(!tosdb_superblock_write(wal->tdb)) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot write superblock for wal region");
+
+            return false;
+        }
+    }
+
+    PRINTLOG(TOSDB, LOG_TRACE, "wal block 0x%llx with 0x%llx entries committed", wal->next_sequence - 1, entry_count);
+
+    return true;
+}
+
+boolean_t tosdb_wal_commit(tosdb_wal_t* wal, uint64_t ticket) {
+    if(!wal) {
+        PRINTLOG(TOSDB, LOG_ERROR, "wal is null");
+
+        return false;
+    }
+
+    lock_acquire(wal->commit_lock);
+
+    if(ticket == -1ULL) {
+        lock_acquire(wal->lock);
+        ticket = wal->last_ticket;
+        lock_release(wal->lock);
+    }
+
+    if(wal->durable_ticket >= ticket) {
+        lock_release(wal->commit_lock);
+
+        return true;
+    }
+
+    buffer_t* new_pending = buffer_new_with_capacity(NULL, TOSDB_WAL_GROUP_COMMIT_SIZE);
+
+    if(!new_pending) {
+        lock_release(wal->commit_lock);
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create wal pending buffer");
+
+        return false;
+    }
+
+    // swap pending entries, other tasks can append while batch is written
+    lock_acquire(wal->lock);
+    buffer_t* batch = wal->pending;
+    uint64_t batch_count = wal->pending_count;
+    uint64_t batch_ticket = wal->last_ticket;
+    wal->pending = new_pending;
+    wal->pending_count = 0;
+    lock_release(wal->lock);
+
+    boolean_t res = tosdb_wal_write_batch(wal, batch, batch_count);
+
+    buffer_destroy(batch);
+
+    if(res) {
+        wal->durable_ticket = batch_ticket;
+    } else {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot commit 0x%llx wal entries", batch_count);
+    }
+
+    lock_release(wal->commit_lock);
+
+    return res;
+}
+
+boolean_t tosdb_wal_commit_if_needed(tosdb_wal_t* wal) {
+    if(!wal) {
+        return false;
+    }
+
+    lock_acquire(wal->lock);
+    uint64_t pending_size = buffer_get_length(wal->pending);
+    lock_release(wal->lock);
+
+    if(pending_size < TOSDB_WAL_GROUP_COMMIT_SIZE) {
+        return true;
+    }
+
+    return tosdb_wal_commit(wal, -1ULL);
+}
+
+boolean_t tosdb_wal_checkpoint(tosdb_wal_t* wal) {
+    if(!wal) {
+        return false;
+    }
+
+    lock_acquire(wal->commit_lock);
+    lock_acquire(wal->lock);
+
+    buffer_reset(wal->pending);
+    wal->pending_count = 0;
+    wal->durable_ticket = wal->last_ticket;
+    wal->region_location = 0;
+    wal->region_size = 0;
+    wal->region_used = 0;
+    wal->previous_region_location = 0;
+    wal->previous_region_size = 0;
+    wal->next_sequence = 1;
+
+    tosdb_superblock_t* sb = wal->tdb->superblock;
+
+    sb->wal_location = 0;
+    sb->wal_size = 0;
+    sb->wal_generation++;
+
+    lock_release(wal->lock);
+    lock_release(wal->commit_lock);
+
+    PRINTLOG(TOSDB, LOG_DEBUG, "wal checkpointed, new generation 0x%llx", sb->wal_generation);
+
+    return true;
+}
+
+static tosdb_block_wal_t* tosdb_wal_block_read(tosdb_wal_t* wal, uint64_t location, uint64_t region_end) {
+    tosdb_backend_t* backend = wal->tdb->backend;
+    tosdb_superblock_t* sb = wal->tdb->superblock;
+
+    if(location + TOSDB_PAGE_SIZE > region_end) {
+        return NULL;
+    }
+
+    tosdb_block_wal_t* block = (tosdb_block_wal_t*)backend->read(backend, location, TOSDB_PAGE_SIZE);
+
+    if(!block) {
+        return NULL;
+    }
+
+    if(strcmp(TOSDB_SUPERBLOCK_SIGNATURE, block->header.signature) != 0 ||
+       block->header.block_type != TOSDB_BLOCK_TYPE_WAL ||
+       block->generation != sb->wal_generation ||
+       block->header.block_size < TOSDB_PAGE_SIZE ||
+       (block->header.block_size % TOSDB_PAGE_SIZE) ||
+       location + block->header.block_size > region_end) {
+        memory_free(block);
+
+        return NULL;
+    }
+
+    uint64_t block_size = block->header.block_size;
+
+    if(block_size > TOSDB_PAGE_SIZE) {
+        memory_free(block);
+
+        block = (tosdb_block_wal_t*)backend->read(backend, location, block_size);
+
+        if(!block) {
+            return NULL;
+        }
+    }
+
+    uint32_t crc_bak = block->crc32c;
+    block->crc32c = 0;
+    uint32_t crc = crc32c_sum(block, block_size, CRC32_SEED);
+    block->crc32c = crc_bak;
+
+    if(crc != crc_bak || block->data_size > block_size - sizeof(tosdb_block_wal_t)) {
+        PRINTLOG(TOSDB, LOG_WARNING, "wal block at 0x%llx is corrupted", location);
+        memory_free(block);
+
+        return NULL;
+    }
+
+    return block;
+}
+
+static tosdb_table_t* tosdb_wal_table_get(tosdb_wal_t* wal, const tosdb_wal_entry_t* entry) {
+    tosdb_table_t* tbl = wal->replay_table;
+
+    if(tbl && tbl->id == entry->table_id && tbl->db->id == entry->database_id) {
+        return tbl;
+    }
+
+    tosdb_database_t* db = NULL;
+
+    iterator_t* iter = hashmap_iterator_create(wal->tdb->databases);
+
+    if(!iter) {
+        return NULL;
+    }
+
+    while(iter->end_of_iterator(iter) != 0) {
+        tosdb_database_t* t_db = (tosdb_database_t*)iter->get_item(iter);
+
+        if(t_db->id == entry->database_id) {
+            db = t_db;
+
+            break;
+        }
+
+        iter = iter->next(iter);
+    }
+
+    iter->destroy(iter);
+
+    if(!db || db->is_deleted || !tosdb_database_load_database(db)) {
+        return NULL;
+    }
+
+    tbl = NULL;
+
+    iter = hashmap_iterator_create(db->tables);
+
+    if(!iter) {
+        return NULL;
+    }
+
+    while(iter->end_of_iterator(iter) != 0) {
+        tosdb_table_t* t_tbl = (tosdb_table_t*)iter->get_item(iter);
+
+        if(t_tbl->id == entry->table_id) {
+            tbl = t_tbl;
+
+            break;
+        }
+
+        iter = iter->next(iter);
+    }
+
+    iter->destroy(iter);
+
+    if(!tbl || tbl->is_deleted) {
+        return NULL;
+    }
+
+    if(!tbl->is_open) {
+        tbl->max_record_count = entry->max_record_count;
+        tbl->max_valuelog_size = entry->max_valuelog_size;
+        tbl->max_memtable_count = entry->max_memtable_count;
+
+        if(!tosdb_table_load_table(tbl)) {
+            return NULL;
+        }
+    }
+
+    wal->replay_table = tbl;
+
+    return tbl;
+}
+
+static boolean_t tosdb_wal_entry_apply(tosdb_wal_t* wal, const tosdb_wal_entry_t* entry) {
+    tosdb_table_t* tbl = tosdb_wal_table_get(wal, entry);
+
+    if(!tbl) {
+        PRINTLOG(TOSDB, LOG_WARNING, "table %lli of db %lli not found, wal entry dropped", entry->table_id, entry->database_id);
+
+        return true;
+    }
+
+    tosdb_record_t* record = tosdb_table_create_record(tbl);
+
+    if(!record) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create record for table %s", tbl->name);
+
+        return false;
+    }
+
+    tosdb_record_context_t* ctx = record->context;
+    ctx->record_id = entry->record_id;
+
+    data_t s_d = {0};
+    s_d.length = entry->data_length;
+    s_d.type = DATA_TYPE_INT8_ARRAY;
+    s_d.value = (void*)entry->data;
+
+    data_t* r_d = data_bson_deserialize(&s_d);
+
+    if(!r_d) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot deserialize wal entry");
+        record->destroy(record);
+
+        return false;
+    }
+
+    data_t* tmp = r_d->value;
+
+    for(uint64_t i = 0; i < r_d->length; i++) {
+        uint64_t tmp_col_id = (uint64_t)tmp[i].name->value;
+
+        if(!tosdb_record_set_data_with_colid(record, tmp_col_id, tmp[i].type, tmp[i].length, tmp[i].value)) {
+            PRINTLOG(TOSDB, LOG_ERROR, "cannot populate record");
+        }
+    }
+
+    data_free(r_d);
+
+    boolean_t res = tosdb_memtable_upsert_ext(record, entry->is_deleted, false);
+
+    record->destroy(record);
+
+    return res;
+}
+
+static boolean_t tosdb_wal_block_apply(tosdb_wal_t* wal, const tosdb_block_wal_t* block) {
+    const uint8_t* data = block->data;
+    const uint8_t* data_end = block->data + block->data_size;
+
+    for(uint64_t i = 0; i < block->entry_count; i++) {
+        const tosdb_wal_entry_t* entry = (const tosdb_wal_entry_t*)data;
+
+        if(data + sizeof(tosdb_wal_entry_t) > data_end ||
+           entry->entry_size < sizeof(tosdb_wal_entry_t) + entry->data_length ||
+           data + entry->entry_size > data_end) {
+            PRINTLOG(TOSDB, LOG_ERROR, "wal entry 0x%llx of block 0x%llx is malformed", i, block->sequence);
+
+            return false;
+        }
+
+        if(!tosdb_wal_entry_apply(wal, entry)) {
+            return false;
+        }
+
+        data += entry->entry_size;
+    }
+
+    return true;
+}
+
+boolean_t tosdb_wal_replay(tosdb_wal_t* wal) {
+    if(!wal) {
+        PRINTLOG(TOSDB, LOG_ERROR, "wal is null");
+
+        return false;
+    }
+
+    tosdb_superblock_t* sb = wal->tdb->superblock;
+
+    if(!sb->wal_location) {
+        return true;
+    }
+
+    list_t* regions = list_create_stack();
+
+    if(!regions) {
+        PRINTLOG(TOSDB, LOG_ERROR, "cannot create wal region list");
+
+        return false;
+    }
+
+    boolean_t error = false;
+    uint64_t region_loc = sb->wal_location;
+    uint64_t region_size = sb->wal_size;
+
+    // regions are linked from newest to oldest, stack reverses the order
+    while(region_loc) {
+        tosdb_block_wal_t* first = tosdb_wal_block_read(wal, region_loc, region_loc + region_size);
+
+        if(!first || first->region_location != region_loc) {
+            PRINTLOG(TOSDB, LOG_WARNING, "wal region at 0x%llx has no valid block", region_loc);
+            memory_free(first);
+
+            break;
+        }
+
+        tosdb_wal_region_t* region = memory_malloc(sizeof(tosdb_wal_region_t));
+
+        if(!region) {
+            memory_free(first);
+            error = true;
+
+            break;
+        }
+
+        region->location = region_loc;
+        region->size = region_size;
+        region->previous_location = first->previous_region_location;
+        region->previous_size = first->previous_region_size;
+
+        list_stack_push(regions, region);
+
+        region_loc = first->previous_region_location;
+        region_size = first->previous_region_size;
+
+        memory_free(first);
+    }
+
+    uint64_t expected_sequence = 1;
+    uint64_t entry_count = 0;
+
+    while(!error && list_size(regions)) {
+        tosdb_wal_region_t* region = (tosdb_wal_region_t*)list_stack_pop(regions);
+
+        uint64_t loc = region->location;
+        uint64_t region_end = region->location + region->size;
+
+        while(true) {
+            tosdb_block_wal_t* block = tosdb_wal_block_read(wal, loc, region_end);
+
+            if(!block) {
+                break;
+            }
+
+            if(block->sequence != expected_sequence || block->region_location != region->location) {
+                memory_free(block);
+
+                break;
+            }
+
+            if(!tosdb_wal_block_apply(wal, block)) {
+                memory_free(block);
+                error = true;
+
+                break;
+            }
+
+            entry_count += block->entry_count;
+            expected_sequence++;
+            loc += block->header.block_size;
+
+            memory_free(block);
+        }
+
+        wal->region_location = region->location;
+        wal->region_size = region->size;
+        wal->region_used = loc - region->location;
+        wal->previous_region_location = region->previous_location;
+        wal->previous_region_size = region->previous_size;
+
+        memory_free(region);
+    }
+
+    list_destroy_with_data(regions);
+
+    wal->next_sequence = expected_sequence;
+    wal->replay_table = NULL;
+
+    PRINTLOG(TOSDB, LOG_INFO, "wal replayed with 0x%llx blocks and 0x%llx entries", expected_sequence - 1, entry_count);
+
+    return !error;
+}
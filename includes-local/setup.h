@@ -18,6 +18,7 @@
 #include <random.h>
 #include <xxhash.h>
 #include <cpu.h>
+#include <systeminfo.h>
 
 #ifndef RAMSIZE
 #define RAMSIZE 0x100000
@@ -204,6 +205,26 @@ int8_t    lock_destroy(lock_t* lock);
 void      lock_acquire(lock_t* lock);
 void      lock_release(lock_t* lock);
 lock_t*   lock_create_with_heap_for_future(memory_heap_t* heap, boolean_t for_future, uint64_t task_id);
+
+typedef struct rwlock_t rwlock_t;
+
+rwlock_t* rwlock_create_with_heap(memory_heap_t* heap);
+int8_t    rwlock_destroy(rwlock_t* rwlock);
+void      rwlock_read_acquire(rwlock_t* rwlock);
+void      rwlock_read_release(rwlock_t* rwlock);
+void      rwlock_write_acquire(rwlock_t* rwlock);
+void      rwlock_write_release(rwlock_t* rwlock);
+
+typedef struct condvar_t condvar_t;
+
+condvar_t* condvar_create_with_heap(memory_heap_t* heap);
+int8_t     condvar_destroy(condvar_t* condvar);
+int8_t     condvar_wait(condvar_t* condvar, lock_t* lock);
+void       condvar_signal(condvar_t* condvar);
+void       condvar_broadcast(condvar_t* condvar);
+uint64_t   task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name);
+void       task_yield(void);
+void       time_timer_msleep(uint64_t msecs);
 void      dump_ram(char_t* fname);
 void      apic_eoi(void);
 void      task_current_task_sleep(uint64_t when_tick);
@@ -220,7 +241,7 @@ struct timespec {
 
 struct timespec clock_gettime(int, struct timespec* ts);
 
-void* SYSTEM_INFO;
+system_info_t* SYSTEM_INFO = NULL;
 void* KERNEL_FRAME_ALLOCATOR = NULL;
 uint64_t __kheap_bottom = 0;
 
@@ -280,6 +301,75 @@ void lock_release(lock_t* lock){
     UNUSED(lock);
 }
 
+rwlock_t* rwlock_create_with_heap(memory_heap_t* heap){
+    UNUSED(heap);
+    return (rwlock_t*)0xdeadbeaf;
+}
+
+int8_t rwlock_destroy(rwlock_t* rwlock){
+    UNUSED(rwlock);
+    return 0;
+}
+
+void rwlock_read_acquire(rwlock_t* rwlock){
+    UNUSED(rwlock);
+}
+
+void rwlock_read_release(rwlock_t* rwlock){
+    UNUSED(rwlock);
+}
+
+void rwlock_write_acquire(rwlock_t* rwlock){
+    UNUSED(rwlock);
+}
+
+void rwlock_write_release(rwlock_t* rwlock){
+    UNUSED(rwlock);
+}
+
+condvar_t* condvar_create_with_heap(memory_heap_t* heap){
+    UNUSED(heap);
+    return (condvar_t*)0xdeadbeaf;
+}
+
+int8_t condvar_destroy(condvar_t* condvar){
+    UNUSED(condvar);
+    return 0;
+}
+
+int8_t condvar_wait(condvar_t* condvar, lock_t* lock){
+    UNUSED(condvar);
+    UNUSED(lock);
+    return 0;
+}
+
+void condvar_signal(condvar_t* condvar){
+    UNUSED(condvar);
+}
+
+void condvar_broadcast(condvar_t* condvar){
+    UNUSED(condvar);
+}
+
+// there is no tasking at host, callers fall back to inline work
+uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name){
+    UNUSED(heap);
+    UNUSED(heap_size);
+    UNUSED(stack_size);
+    UNUSED(entry_point);
+    UNUSED(args_cnt);
+    UNUSED(args);
+    UNUSED(task_name);
+    return -1ULL;
+}
+
+void task_yield(void){
+}
+
+void time_timer_msleep(uint64_t msecs){
+    UNUSED(msecs);
+}
+
 future_t* future_create_with_heap_and_data(memory_heap_t* heap, lock_t* lock, void* data) {
     UNUSED(heap);
     UNUSED(lock);
@@ -155,6 +155,8 @@ extern "C" {
 #define APIC_TIMER_PERIODIC         (1 << 17)
 #define APIC_TIMER_TSC_DEADLINE     (2 << 17)
 
+#define APIC_MSR_IA32_TSC_DEADLINE  0x6E0
+
 
 #define APIC_IOAPIC_MAX_REDIRECTION_ENTRY(r)  (((r >> 16) & 0xFF) + 1)
 
@@ -206,6 +208,19 @@ uint64_t apic_get_ap_count(void);
 
 boolean_t apic_is_waiting_timer(void);
 
+/**
+ * @brief switches current cpu's timer to tsc deadline mode, or one shot mode if tsc deadline is not supported.
+ * timer does not fire until a deadline is set.
+ * @return 0 on success
+ */
+int8_t apic_timer_enable_oneshot(void);
+
+/**
+ * @brief programs current cpu's one shot timer
+ * @param[in] tsc_deadline tsc value when timer fires, zero disarms timer
+ */
+void apic_timer_set_deadline(uint64_t tsc_deadline);
+
 int32_t apic_get_first_irr_interrupt(void);
 int32_t apic_get_isr_interrupt(void);
 
@@ -31,6 +31,10 @@ void cpu_idle(void);
  * This command disables interrupts with cli assembly command.
  */
 static inline boolean_t cpu_cli(void) {
+#if ___TESTMODE == 1 && ___KERNELBUILD == 0
+    // host tests run at user mode and cannot mask interrupts
+    return false;
+#else
     // read rflags and checks already interrupts are disabled and returns old value
     boolean_t old_value;
     __asm__ __volatile__ ("pushf\n"
@@ -42,6 +46,7 @@ static inline boolean_t cpu_cli(void) {
                           :
                           : "rax");
     return old_value; // if 0 interrupts are enabled
+#endif
 }
 
 /**
@@ -50,7 +55,9 @@ static inline boolean_t cpu_cli(void) {
  * This command enables interrupts with sti assembly command.
  */
 static inline void cpu_sti(void) {
+#if ___TESTMODE != 1 || ___KERNELBUILD != 0
     __asm__ __volatile__ ("sti");
+#endif
 }
 
 /**
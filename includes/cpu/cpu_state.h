@@ -19,15 +19,14 @@ extern "C" {
 #endif
 
 typedef struct cpu_state_t {
-    uint64_t  local_apic_id; ///< local apic id
-    task_t*   current_task; ///< current task
-    task_t*   idle_task; ///< idle task
-    boolean_t tasking_enabled; ///< tasking enabled
-    boolean_t task_switch_paramters_need_eoi; ///< task switch parameters need eoi
-    list_t*   task_queue; ///< task list
-    list_t*   task_sleep_queue; ///< task sleep list
-    list_t*   task_wait_queue; ///< task wait list
-    list_t*   task_cleanup_queue; ///< task cleanup list
+    uint64_t          local_apic_id; ///< local apic id
+    task_t*           current_task; ///< current task
+    task_t*           idle_task; ///< idle task
+    boolean_t         tasking_enabled; ///< tasking enabled
+    boolean_t         task_switch_paramters_need_eoi; ///< task switch parameters need eoi
+    task_run_queue_t* task_queue; ///< run queue
+    list_t*           task_wait_queue; ///< task wait list
+    list_t*           task_cleanup_queue; ///< task cleanup list
 } cpu_state_t;
 
 #ifdef __cplusplus
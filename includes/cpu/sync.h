@@ -17,7 +17,7 @@ extern "C" {
 #endif
 
 /*! memory size for lock*/
-#define SYNC_LOCK_SIZE 0x28
+#define SYNC_LOCK_SIZE 0x40
 
 /*! lock type */
 typedef struct lock_t lock_t;
@@ -54,7 +54,8 @@ int8_t lock_destroy(lock_t* lock);
 #define lock_create_for_future(tid) lock_create_with_heap_for_future(NULL, true, tid)
 
 /**
- * @brief acquires lock
+ * @brief acquires lock. contended lock spins shortly while owner is at another cpu, then parks task until
+ * releaser hands lock off. tasks with disabled interrupts are never parked, they spin.
  * @param[in] lock lock to acquire
  */
 void lock_acquire(lock_t* lock);
@@ -116,6 +117,95 @@ int8_t semaphore_release_with_count(semaphore_t* semaphore, uint64_t count);
  */
 #define semaphore_release(s) semaphore_release_with_count(s, 1)
 
+/*! reader-writer lock type */
+typedef struct rwlock_t rwlock_t;
+
+/**
+ * @brief creates reader-writer lock
+ * @param[in] heap heap for lock
+ * @return rwlock
+ */
+rwlock_t* rwlock_create_with_heap(memory_heap_t* heap);
+
+/**
+ * @brief macro for creating reader-writer lock with default heap
+ */
+#define rwlock_create() rwlock_create_with_heap(NULL)
+
+/**
+ * @brief destroys reader-writer lock
+ * @param[in] rwlock lock to destroy
+ * @return 0 if succeed
+ */
+int8_t rwlock_destroy(rwlock_t* rwlock);
+
+/**
+ * @brief acquires lock as reader, readers share lock. new readers wait while a writer is queued.
+ * @param[in] rwlock lock to acquire
+ */
+void rwlock_read_acquire(rwlock_t* rwlock);
+
+/**
+ * @brief releases reader lock
+ * @param[in] rwlock lock to release
+ */
+void rwlock_read_release(rwlock_t* rwlock);
+
+/**
+ * @brief acquires lock as writer. writer can acquire lock again or as reader, each acquire needs a release.
+ * @param[in] rwlock lock to acquire
+ */
+void rwlock_write_acquire(rwlock_t* rwlock);
+
+/**
+ * @brief releases writer lock
+ * @param[in] rwlock lock to release
+ */
+void rwlock_write_release(rwlock_t* rwlock);
+
+/*! condition variable type */
+typedef struct condvar_t condvar_t;
+
+/**
+ * @brief creates condition variable
+ * @param[in] heap heap for condition variable
+ * @return condition variable
+ */
+condvar_t* condvar_create_with_heap(memory_heap_t* heap);
+
+/**
+ * @brief macro for creating condition variable with default heap
+ */
+#define condvar_create() condvar_create_with_heap(NULL)
+
+/**
+ * @brief destroys condition variable
+ * @param[in] condvar condition variable to destroy
+ * @return 0 if succeed
+ */
+int8_t condvar_destroy(condvar_t* condvar);
+
+/**
+ * @brief releases lock and waits for a signal, lock is acquired again before return.
+ * wake ups can be spurious, caller should check its condition in a loop.
+ * @param[in] condvar condition variable to wait
+ * @param[in] lock lock held by caller
+ * @return 0 if succeed
+ */
+int8_t condvar_wait(condvar_t* condvar, lock_t* lock);
+
+/**
+ * @brief wakes up first waiter
+ * @param[in] condvar condition variable to signal
+ */
+void condvar_signal(condvar_t* condvar);
+
+/**
+ * @brief wakes up all waiters
+ * @param[in] condvar condition variable to broadcast
+ */
+void condvar_broadcast(condvar_t* condvar);
+
 #ifdef __cplusplus
 }
 #endif
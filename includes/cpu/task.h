@@ -114,6 +114,7 @@ typedef enum task_state_t {
 typedef enum task_attribute_t {
     TASK_ATTRIBUTE_NONE = 0x0, ///< no attribute
     TASK_ATTRIBUTE_INTERRUPTIBLE = 0x1, ///< task is interruptible
+    TASK_ATTRIBUTE_PINNED = 0x2, ///< task is pinned to its cpu, other cpus cannot steal it
 } task_attribute_t; ///< short hand for enum
 
 typedef struct task_registers_t {
@@ -137,6 +138,7 @@ typedef struct task_registers_t {
     uint64_t cr3; ///< register
     uint32_t xsave_mask_lo; ///< xsave mask low
     uint32_t xsave_mask_hi; ///< xsave mask high
+    uint32_t xsave_optimized; ///< save with xsaveopt which skips unmodified and initial components
     uint8_t  avx512f[0x2000] __attribute__((aligned(0x40))); ///< register
 } task_registers_t;
 
@@ -159,7 +161,7 @@ typedef struct task_t {
     void*                        stack; ///< stack pointer
     uint64_t                     stack_size; ///< stack size of task
     list_t*                      message_queues; ///< task's listining queues.
-    uint64_t                     wake_tick; ///< tick value when task wakes up
+    struct time_timer_t*         sleep_timer; ///< armed timer while task is sleeping
     const char*                  task_name; ///< task name
     memory_page_table_context_t* page_table; ///< page table
     buffer_t*                    input_buffer; ///< input buffer
@@ -168,11 +170,48 @@ typedef struct task_t {
     uint64_t                     vmcs_physical_address; ///< vmcs physical address
     void*                        vm; ///< vm
     int32_t                      exit_code; ///< task exit code
+    volatile boolean_t           handover; ///< task is created for another cpu and waits at its wake queue
     task_registers_t*            registers; ///< task registers
 } task_t; ///< short hand for struct
 
 _Static_assert(sizeof(task_t) == 0xc0, "task_t size must be 0xb8"); // why this assert? where we hardcoded task_t size?
 
+/*! per-cpu run queue slot count, should be power of two */
+#define TASK_RUN_QUEUE_SIZE 1024
+/*! per-cpu wake up ring slot count, should be power of two */
+#define TASK_RUN_QUEUE_WAKE_SIZE 256
+
+/**
+ * @struct task_run_queue_t
+ * @brief per-cpu lock-free run queue.
+ *
+ * only owner cpu pushes tasks with interrupts disabled. owner cpu and idle cpus (thieves) take tasks
+ * from head with compare and swap, hence queue works as fifo for owner.
+ *
+ * any cpu can push a woken up task into wake ring, owner moves them from its wait queue to run queue at task switch.
+ */
+typedef struct task_run_queue_t {
+    volatile uint64_t head; ///< index of oldest task, advanced by owner and thieves
+    uint8_t           padding0[56]; ///< keeps head and tail at different cache lines
+    volatile uint64_t tail; ///< index of next empty slot, only advanced by owner
+    task_t*           pending_task; ///< switched out task whose stack may be in use, published at next task switch
+    list_t*           overflow_queue; ///< owner only queue when slots are full, thieves do not look at it
+    uint64_t          push_count; ///< pushed task count
+    uint64_t          steal_count; ///< tasks stolen by owner cpu from other cpus
+    volatile uint64_t stolen_count; ///< tasks stolen from this queue by other cpus
+    uint64_t          wake_count; ///< tasks moved from wait queue to run queue by wake ups
+    volatile uint64_t wake_head; ///< index of oldest wake up, only advanced by owner
+    volatile uint64_t wake_tail; ///< index of next empty wake up slot, advanced by wakers
+    volatile uint64_t wake_overflow; ///< set when wake ring is full, owner scans whole wait queue
+    volatile uint64_t idle; ///< owner cpu runs idle task, at tickless mode it should be kicked by an ipi for new work
+    uint8_t           padding1[40]; ///< aligns slots to cache line
+    task_t* volatile  tasks[TASK_RUN_QUEUE_SIZE]; ///< task slots
+    task_t* volatile  wakes[TASK_RUN_QUEUE_WAKE_SIZE]; ///< woken up task slots
+} task_run_queue_t; ///< short hand for struct
+
+_Static_assert((offsetof_field(task_run_queue_t, tasks) % 0x40) == 0x0, "task_run_queue_t slots must be aligned 0x40");
+_Static_assert((offsetof_field(task_run_queue_t, wake_tail) % 0x40) == 0x0, "task_run_queue_t wake tail must be aligned 0x40");
+
 /**
  * @brief inits kernel tasking, configures tss and kernel task
  * @param[in] heap the heap of kernel task and tasking related variables.
@@ -215,6 +254,12 @@ uint64_t task_get_id(void);
  */
 uint64_t task_get_cpu_id(void);
 
+/**
+ * @brief returns cpu count which has a run queue
+ * @return cpu count
+ */
+uint64_t task_get_cpu_count(void);
+
 /**
  * @brief returns current task
  * @return current task
@@ -226,6 +271,14 @@ task_t* task_get_current_task(void);
  */
 void task_set_message_waiting(void);
 
+/**
+ * @brief returns current task to running state if no wake up arrived after @ref task_set_message_waiting
+ *
+ * a task sets waiting flag before its last check for work, and cancels it when work is found, so a wake up
+ * between the check and @ref task_yield is not lost.
+ */
+void task_cancel_message_waiting(void);
+
 /**
  * @brief clears current task's message waiting flag
  * @param[in] task_id task id
@@ -247,11 +300,24 @@ void task_set_interrupt_received(uint64_t task_id);
 void task_set_message_received(uint64_t tid);
 
 /**
- * @brief adds a queue to task
+ * @brief queues a wake up for a task at task's cpu, sends ipi if task's cpu is another cpu.
+ * task is moved from wait queue to run queue at next task switch of its cpu if its wait is ended.
+ * @param[in] task task to wake up
+ */
+void task_wakeup(task_t* task);
+
+/**
+ * @brief adds a queue to task, pushing into queue wakes up the task if it is waiting for messages
  * @param[in] queue queue which task will have. tasks consumes these queues
  */
 void task_add_message_queue(list_t* queue);
 
+/**
+ * @brief removes a queue added by @ref task_add_message_queue from current task, pushes do not wake up task after return
+ * @param[in] queue queue to remove
+ */
+void task_remove_message_queue(list_t* queue);
+
 list_t* task_get_message_queue(uint64_t task_id, uint64_t queue_number);
 #define task_get_current_task_message_queue(queue_number) task_get_message_queue(task_get_id(), queue_number)
 
@@ -267,13 +333,27 @@ list_t* task_get_message_queue(uint64_t task_id, uint64_t queue_number);
  */
 uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name);
 
+/**
+ * @brief creates a task pinned to given cpu, task is handed over to cpu's wake queue
+ * @param[in] heap creator heap
+ * @param[in] heap_size task's heap size, heap allocated with frame allocator
+ * @param[in] stack_size task's stack size, stack allocated with frame allocator
+ * @param[in] entry_point task's entry point
+ * @param[in] args_cnt argument count
+ * @param[in] args argument list
+ * @param[in] task_name task's name
+ * @param[in] cpu_id cpu (local apic id) which task runs, invalid ids falls back to current cpu
+ * @return task id
+ */
+uint64_t task_create_task_on_cpu(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name, uint64_t cpu_id);
+
 /**
  * @brief idle task checks if there is any task neeeds to run. it speeds up task running
  */
 boolean_t task_idle_check_need_yield(void);
 
 /**
- * @brief sleep for current task for ticks
+ * @brief sleep for current task until tick count, task waits at wait queue until its timer expires
  * @param[in] wake_tick tick count for sleep
  */
 void task_current_task_sleep(uint64_t wake_tick);
@@ -25,6 +25,17 @@ typedef struct disk_partition_context_t {
     uint64_t end_lba;
 }disk_partition_context_t;
 
+/**
+ * @struct disk_iovec_t
+ * @brief physical memory segment for vectored disk io
+ *
+ * frame address should be 4k aligned. all segments except the last one should have 4k multiple length.
+ */
+typedef struct disk_iovec_t {
+    uint64_t frame_address; ///< physical address of segment
+    uint64_t length; ///< length of segment in bytes
+} disk_iovec_t;
+
 typedef struct disk_t              disk_t;
 typedef struct disk_partition_t    disk_partition_t;
 typedef struct disk_or_partition_t disk_or_partition_t;
@@ -34,6 +45,8 @@ typedef uint64_t      (*disk_or_partition_get_size_f)(const disk_or_partition_t*
 typedef uint64_t      (*disk_or_partition_get_block_size_f)(const disk_or_partition_t* dp);
 typedef int8_t        (*disk_or_partition_write_f)(const disk_or_partition_t* dp, uint64_t lba, uint64_t count, uint8_t* data);
 typedef int8_t        (*disk_or_partition_read_f)(const disk_or_partition_t* dp, uint64_t lba, uint64_t count, uint8_t** data);
+typedef int8_t        (*disk_or_partition_writev_f)(const disk_or_partition_t* dp, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count);
+typedef int8_t        (*disk_or_partition_readv_f)(const disk_or_partition_t* dp, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count);
 typedef int8_t        (*disk_or_partition_flush_f)(const disk_or_partition_t* dp);
 typedef int8_t        (*disk_or_partition_close_f)(const disk_or_partition_t* dp);
 
@@ -44,6 +57,8 @@ struct disk_or_partition_t {
     disk_or_partition_get_block_size_f get_block_size;
     disk_or_partition_write_f          write;
     disk_or_partition_read_f           read;
+    disk_or_partition_writev_f         writev; ///< optional zero copy write from physical frames, NULL if not supported
+    disk_or_partition_readv_f          readv; ///< optional zero copy read into physical frames, NULL if not supported
     disk_or_partition_flush_f          flush;
     disk_or_partition_close_f          close;
 };
@@ -0,0 +1,53 @@
+/**
+ * @file disk_cache.h
+ * @brief shared block cache for disks and partitions.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#ifndef ___DISK_CACHE_H
+/*! prevent duplicate header error macro */
+#define ___DISK_CACHE_H 0
+
+#include <types.h>
+#include <disk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! default cached page count of a disk cache */
+#define DISK_CACHE_DEFAULT_PAGE_COUNT       4096
+/*! default shard count of a disk cache */
+#define DISK_CACHE_DEFAULT_SHARD_COUNT      16
+/*! default read-ahead page count for sequential reads */
+#define DISK_CACHE_DEFAULT_READAHEAD_COUNT  32
+/*! default dirty page write-back interval in milliseconds */
+#define DISK_CACHE_DEFAULT_WRITEBACK_PERIOD 1000
+
+/**
+ * @struct disk_cache_config_t
+ * @brief disk cache configuration, zero fields take default values
+ */
+typedef struct disk_cache_config_t {
+    uint64_t page_count; ///< maximum cached page count, a page is 4k or one block if block is bigger
+    uint64_t shard_count; ///< lock and hash bucket shard count
+    uint64_t readahead_count; ///< page count to read ahead when reads are sequential
+    uint64_t writeback_period; ///< write-back period of dirty pages in milliseconds
+} disk_cache_config_t;
+
+/**
+ * @brief wraps a disk or partition with a write-back block cache
+ * returned object owns the underlying disk or partition and closes it when it is closed.
+ * @param[in] dp underlying disk or partition
+ * @param[in] config cache configuration, NULL for defaults
+ * @return cached disk or partition, NULL on error
+ */
+disk_or_partition_t* disk_cache_new(disk_or_partition_t* dp, const disk_cache_config_t* config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,6 +13,7 @@
 #include <pci.h>
 #include <network/network_protocols.h>
 #include <network/network_ethernet.h>
+#include <network/network_netbuf.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,29 +44,37 @@ extern "C" {
 #define NETWORK_IGB_REG_EIMC      0x1528
 #define NETWORK_IGB_REG_EIAC      0x152C
 #define NETWORK_IGB_REG_EICR      0x1580
-#define NETWORK_IGB_REG_IVAR      0x1700
+#define NETWORK_IGB_REG_EITR(n)   (0x1680 + ((n) * 4))
+#define NETWORK_IGB_REG_IVAR(q)   (0x1700 + (((q) & 0x7) * 4))
 #define NETWORK_IGB_REG_IVAR_MISC 0x1740
 
-#define NETWORK_IGB_REG_RDBAL     0xC000
-#define NETWORK_IGB_REG_RDBAH     0xC004
-#define NETWORK_IGB_REG_RDLEN     0xC008
-#define NETWORK_IGB_REG_SRRCTL    0xC00C
-#define NETWORK_IGB_REG_RDH       0xC010
-#define NETWORK_IGB_REG_RDT       0xC018
-#define NETWORK_IGB_REG_RXDCTL    0xC028
-
-#define NETWORK_IGB_REG_TDBAL     0xE000
-#define NETWORK_IGB_REG_TDBAH     0xE004
-#define NETWORK_IGB_REG_TDLEN     0xE008
-#define NETWORK_IGB_REG_TDH       0xE010
-#define NETWORK_IGB_REG_TDT       0xE018
-#define NETWORK_IGB_REG_TXDCTL    0xE028
+// per queue registers, each queue has 0x40 bytes register block
+#define NETWORK_IGB_REG_RDBAL(q)  (0xC000 + ((q) * 0x40))
+#define NETWORK_IGB_REG_RDBAH(q)  (0xC004 + ((q) * 0x40))
+#define NETWORK_IGB_REG_RDLEN(q)  (0xC008 + ((q) * 0x40))
+#define NETWORK_IGB_REG_SRRCTL(q) (0xC00C + ((q) * 0x40))
+#define NETWORK_IGB_REG_RDH(q)    (0xC010 + ((q) * 0x40))
+#define NETWORK_IGB_REG_RDT(q)    (0xC018 + ((q) * 0x40))
+#define NETWORK_IGB_REG_RXDCTL(q) (0xC028 + ((q) * 0x40))
+
+#define NETWORK_IGB_REG_TDBAL(q)  (0xE000 + ((q) * 0x40))
+#define NETWORK_IGB_REG_TDBAH(q)  (0xE004 + ((q) * 0x40))
+#define NETWORK_IGB_REG_TDLEN(q)  (0xE008 + ((q) * 0x40))
+#define NETWORK_IGB_REG_TDH(q)    (0xE010 + ((q) * 0x40))
+#define NETWORK_IGB_REG_TDT(q)    (0xE018 + ((q) * 0x40))
+#define NETWORK_IGB_REG_TXDCTL(q) (0xE028 + ((q) * 0x40))
+
+#define NETWORK_IGB_REG_RXCSUM    0x5000
 
 #define NETWORK_IGB_REG_MTA       0x5200
 
 #define NETWORK_IGB_REG_RAL       0x5400
 #define NETWORK_IGB_REG_RAH       0x5404
 
+#define NETWORK_IGB_REG_MRQC      0x5818
+#define NETWORK_IGB_REG_RETA(n)   (0x5C00 + ((n) * 4))
+#define NETWORK_IGB_REG_RSSRK(n)  (0x5C80 + ((n) * 4))
+
 #define NETWORK_IGB_REG_SWSM          0x5B50
 #define NETWORK_IGB_REG_FWSM          0x5B54
 #define NETWORK_IGB_REG_SWFWSYNC      0x5B5C
@@ -80,7 +89,35 @@ extern "C" {
 #define NETWORK_IGB_NUM_RX_DESCRIPTORS  1024
 #define NETWORK_IGB_NUM_TX_DESCRIPTORS  1024
 
-#define NETWORK_IGB_RX_BUFFER_SIZE (10 * 1024)
+// max descriptors handled before a poll cycle yields
+#define NETWORK_IGB_RX_POLL_BUDGET 64
+#define NETWORK_IGB_TX_POLL_BUDGET 64
+
+// minimum interval between two queue interrupts, interval field starts at bit 2 with 1us unit
+#define NETWORK_IGB_EITR_INTERVAL_US  50
+#define NETWORK_IGB_EITR_INTERVAL(us) (((us) << 2) & 0x7FFC)
+
+// each rx/tx queue pair has one msix vector, other causes use the vector after queues
+#define NETWORK_IGB_MAX_QUEUES    4
+#define NETWORK_IGB_EICR_VECTOR(v) (1 << (v))
+
+// ivar entries, rx and tx queue n are at ivar n, queues n + 8 are at upper half
+#define NETWORK_IGB_IVAR_VALID    0x80
+#define NETWORK_IGB_IVAR_RX_SHIFT 0
+#define NETWORK_IGB_IVAR_TX_SHIFT 8
+#define NETWORK_IGB_IVAR_MISC_OTHER_SHIFT 8
+
+// rss, toeplitz hash of ipv4 addresses and tcp/udp ports selects a queue from redirection table
+#define NETWORK_IGB_MRQC_ENABLE_RSS      0x2
+#define NETWORK_IGB_MRQC_RSS_IPV4_TCP    (1 << 16)
+#define NETWORK_IGB_MRQC_RSS_IPV4        (1 << 17)
+#define NETWORK_IGB_MRQC_RSS_IPV4_UDP    (1 << 22)
+#define NETWORK_IGB_RETA_ENTRY_COUNT     128
+#define NETWORK_IGB_RSSRK_SIZE           40
+#define NETWORK_IGB_RXCSUM_PCSD          (1 << 13)
+
+// rx buffers are netbufs, size is given to srrctl in 1K units
+#define NETWORK_IGB_RX_BUFFER_SIZE (NETWORK_NETBUF_DATA_SIZE & ~0x3FF)
 #define NETWORK_IGB_RX_HEADER_SIZE 256
 
 #define NETWORK_IGB_CTRL_FD       (1 << 0)
@@ -113,6 +150,11 @@ extern "C" {
 #define NETWORK_IGB_TCTL_PSP      (1 << 3)
 #define NETWORK_IGB_TXDCTL_ENABLE (1 << 25)
 
+#define NETWORK_IGB_TXD_CMD_EOP  (1 << 0)
+#define NETWORK_IGB_TXD_CMD_IFCS (1 << 1)
+#define NETWORK_IGB_TXD_CMD_RS   (1 << 3)
+#define NETWORK_IGB_TXD_STAT_DD  (1 << 0)
+
 typedef union network_igb_rx_desc_t {
     struct {
         uint64_t pkt_addr; /* Packet buffer address */
@@ -152,34 +194,61 @@ typedef struct network_igb_tx_desc_t {
     volatile uint16_t vlan;
 } __attribute__((packed)) network_igb_tx_desc_t;
 
-typedef struct {
-    const pci_dev_t*       pci_netdev;
-    pci_capability_msix_t* msix_cap;
-    network_mac_address_t  mac;
-    list_t*                return_queue;
-    uint8_t                rx_isr;
-    uint8_t                tx_isr;
-    uint8_t                other_isr;
-
-    uint64_t rx_task_id;
+typedef struct network_igb_queue_stats_t {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t dropped;
+    uint64_t polls; ///< poll cycles
+    uint64_t budget_exhausted; ///< poll cycles ended with budget exhausted
+    uint64_t doorbells; ///< tail register writes
+} network_igb_queue_stats_t;
 
-    uint64_t rx_count;
-    uint64_t tx_count;
-    uint64_t packets_dropped;
+struct network_igb_dev_t;
 
-    uint64_t mmio_va;
+/**
+ * @struct network_igb_queue_t
+ * @brief rx/tx ring pair with its msix vector and polling task, task and vector are bound to same cpu
+ */
+typedef struct network_igb_queue_t {
+    struct network_igb_dev_t* dev; ///< owner device
+    uint8_t                   index; ///< queue index, also msix vector and eicr bit
+    uint8_t                   isr; ///< irq of msix vector
+    uint64_t                  cpu_id; ///< cpu which task runs and interrupt is delivered
+    uint64_t                  task_id; ///< polling task of queue
+    uint64_t                  interrupts; ///< interrupt count of queue vector
+    list_t*                   return_queue; ///< packets waiting for tx ring
+    network_rx_queue_t*       network_rx_queue; ///< network stack queue which received packets go
+
+    network_igb_queue_stats_t rx_stats;
+    network_igb_queue_stats_t tx_stats;
 
-    uint64_t rx_packet_buffer_fa;
-    uint64_t rx_packet_buffer_va;
     uint64_t rx_header_buffer_fa;
     uint64_t rx_header_buffer_va;
 
-
     volatile network_igb_rx_desc_t* rx_desc; // receive descriptor buffer
     volatile int32_t                rx_tail;
+    network_netbuf_t**              rx_netbufs; // netbufs owned by rx descriptors
 
     volatile network_igb_tx_desc_t* tx_desc; // transmit descriptor buffer
     volatile int32_t                tx_tail;
+    volatile int32_t                tx_clean; // oldest descriptor whose netbuf is not released yet
+    network_netbuf_t**              tx_netbufs; // netbufs in flight at tx descriptors
+} network_igb_queue_t;
+
+typedef struct network_igb_dev_t {
+    const pci_dev_t*       pci_netdev;
+    pci_capability_msix_t* msix_cap;
+    network_mac_address_t  mac;
+    list_t*                return_queue; ///< return queue of first queue, used by locally created packets
+    uint8_t                other_isr;
+    uint8_t                other_vector;
+
+    uint64_t other_interrupts;
+
+    uint64_t mmio_va;
+
+    uint64_t            queue_count;
+    network_igb_queue_t queues[NETWORK_IGB_MAX_QUEUES];
 }network_igb_dev_t;
 
 int8_t network_igb_init(const pci_dev_t* pci_netdev);
@@ -17,6 +17,7 @@
 #include <future.h>
 #include <hashmap.h>
 #include <disk.h>
+#include <cpu/sync.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -512,6 +513,39 @@ typedef enum nvme_cmd_status_t {
 
 
 
+/*! prp list entry count of one command, each command has one prp list frame */
+#define NVME_MAX_PRP_LIST_ENTRIES (0x1000 / sizeof(uint64_t))
+
+/*! maximum io queue entry count, controller's mqes can lower it */
+#define NVME_IO_QUEUE_MAX_SIZE 256
+
+/**
+ * @struct nvme_io_queue_t
+ * @brief nvme io submission and completion queue pair, each cpu has one pair
+ */
+typedef struct nvme_io_queue_t {
+    struct nvme_disk_t*            nvme_disk; ///< owner nvme disk
+    uint16_t                       queue_id; ///< queue id, same for submission and completion queue
+    uint16_t                       msix_vector; ///< msix vector of completion queue
+    uint32_t                       cpu_id; ///< cpu which receives completion interrupts
+    uint64_t                       isr; ///< isr number of completion queue
+    uint64_t                       queue_size; ///< entry count of queues
+    uint64_t                       queue_frames_fa; ///< frame address of queues and prp lists
+    uint64_t                       s_queue_tail; ///< submission queue tail
+    uint64_t                       c_queue_head; ///< completion queue head
+    uint32_t*                      submission_queue_tail_doorbell; ///< submission queue tail doorbell
+    uint32_t*                      completion_queue_head_doorbell; ///< completion queue head doorbell
+    nvme_submission_queue_entry_t* submission_queue; ///< submission queue
+    nvme_completion_queue_entry_t* completion_queue; ///< completion queue
+    uint64_t                       prp_frame_fa; ///< prp list frames, one frame for each command id
+    uint64_t                       prp_frame_va; ///< virtual address of prp list frames
+    lock_t**                       command_locks; ///< future locks indexed by command id
+    uint16_t                       next_cid; ///< next command id to try
+    int64_t                        active_command_count; ///< active command count
+    boolean_t                      current_phase; ///< current phase of completion queue
+    lock_t*                        lock; ///< submission lock
+} nvme_io_queue_t; ///< shorthand for struct
+
 typedef struct nvme_disk_t {
     memory_heap_t*                 heap; ///< heap to allocate memory from
     uint64_t                       disk_id; ///< disk id
@@ -519,7 +553,8 @@ typedef struct nvme_disk_t {
     nvme_controller_registers_t*   nvme_registers; ///< nvme registers
     pci_capability_msix_t*         msix_capability; ///< msix capability
     uint64_t                       bar_va; ///< bar virtual address
-    uint64_t                       queue_frames_address; ///< queue frames address
+    uint64_t                       doorbell_stride; ///< doorbell stride
+    uint64_t                       queue_frames_address; ///< admin queue frames address
     uint64_t                       admin_queue_size; ///< admin queue size
     uint64_t                       admin_s_queue_tail; ///< admin submission queue tail
     uint64_t                       admin_c_queue_head; ///< admin completion queue head
@@ -527,13 +562,9 @@ typedef struct nvme_disk_t {
     uint32_t*                      admin_completion_queue_head_doorbell; ///< admin completion queue head doorbell
     nvme_submission_queue_entry_t* admin_submission_queue; ///< admin submission queue
     nvme_completion_queue_entry_t* admin_completion_queue; ///< admin completion queue
-    int64_t                        io_queue_size; ///< io queue size
-    uint64_t                       io_s_queue_tail; ///< io queue tail
-    uint64_t                       io_c_queue_head; ///< io completion queue head
-    uint32_t*                      io_submission_queue_tail_doorbell; ///< io submission queue tail doorbell
-    uint32_t*                      io_completion_queue_head_doorbell; ///< io completion queue head doorbell
-    nvme_submission_queue_entry_t* io_submission_queue; ///< io submission queue
-    nvme_completion_queue_entry_t* io_completion_queue; ///< io completion queue
+    uint64_t                       max_io_queue_size; ///< io queue size limit reported by controller
+    uint64_t                       io_queue_count; ///< created io queue pair count
+    nvme_io_queue_t**              io_queues; ///< io queue pairs
     nvme_identify_t*               identify; ///< identify
     nvme_ns_identify_t*            ns_identify; ///< namespace identify
     uint32_t*                      active_ns_list; ///< active namespace list
@@ -541,23 +572,19 @@ typedef struct nvme_disk_t {
     uint32_t                       ns_id; ///< namespace id
     uint64_t                       lba_count; ///< lba count
     uint32_t                       lba_size; ///< lba size
-    uint16_t                       next_cid; ///< next command id
+    uint16_t                       next_cid; ///< next admin command id
     boolean_t                      flush_supported; ///< flush supported
-    uint16_t                       io_sq_count; ///< io submission queue count
-    uint16_t                       io_cq_count; ///< io completion queue count
-    uint64_t                       io_queue_isr; ///< io queue isr
-    hashmap_t*                     command_lock_map; ///< command lock map
-    uint64_t                       prp_frame_fa; ///< prp frame fa
-    uint64_t                       prp_frame_va; ///< prp frame va
+    uint16_t                       io_sq_count; ///< io submission queue count allocated by controller
+    uint16_t                       io_cq_count; ///< io completion queue count allocated by controller
     uint64_t                       max_prp_entries; ///< max prp entries
-    int64_t                        active_command_count; ///< active command count
-    boolean_t                      current_phase; ///< current phase
 } nvme_disk_t; ///< shorthand for struct
 
 
 future_t*          nvme_read(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t* buffer);
 future_t*          nvme_write(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t* buffer);
 future_t*          nvme_flush(uint64_t disk_id);
+future_t*          nvme_read_write_vectored(uint64_t disk_id, uint64_t lba, const disk_iovec_t* iov, uint64_t iov_count, boolean_t write);
+uint64_t           nvme_get_max_transfer_page_count(const nvme_disk_t* nvme_disk);
 disk_t*            nvme_disk_impl_open(nvme_disk_t* nvme_disk);
 const nvme_disk_t* nvme_get_disk_by_id(uint64_t disk_id);
 
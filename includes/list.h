@@ -83,6 +83,15 @@ typedef struct list_item_t list_item_t;
  */
 typedef int8_t (* list_data_comparator_f)(const void* data1, const void* data2);
 
+/**
+ * @brief list insert notifier
+ * @param[in] list list which an item is inserted into
+ * @param[in] notifier_data data given while setting notifier
+ *
+ * notifier is called after list's lock is released, hence it can access the list.
+ */
+typedef void (* list_notifier_f)(list_t* list, void* notifier_data);
+
 int8_t list_default_data_comparator(const void* data1, const void* data2);
 #define list_integer_comparator list_default_data_comparator
 int8_t list_string_comprator(const void* data1, const void* data2);
@@ -339,6 +348,15 @@ iterator_t* list_iterator_create(list_t* list);
  **/
 int8_t list_set_equality_comparator(list_t* list, list_data_comparator_f comparator);
 
+/**
+ * @brief sets insert notifier of list
+ * @param[in]  list source list
+ * @param[in]  notifier notifier function, NULL for removing notifier
+ * @param[in]  notifier_data data passed to notifier
+ * @return      0 on success
+ **/
+int8_t list_set_notifier(list_t* list, list_notifier_f notifier, void* notifier_data);
+
 /**
  * @brief merge given list into self list
  * @param[in]  self source list
@@ -57,6 +57,7 @@ typedef enum logging_modules_t {
     HYPERVISOR_IOMMU,
     WINDOWMANAGER,
     PNG,
+    DISK,
 } logging_modules_t; ///< type short hand for enum @ref logging_modules_e
 
 /**
@@ -253,6 +254,11 @@ extern logging_level_t logging_module_levels[];
 #define LOG_LEVEL_PNG LOG_INFO
 #endif
 
+#ifndef LOG_LEVEL_DISK
+/*! default log level for disk module */
+#define LOG_LEVEL_DISK LOG_INFO
+#endif
+
 #ifndef LOG_LOCATION
 /*! file and line no will be logged? */
 #define LOG_LOCATION 1
@@ -29,6 +29,10 @@ typedef struct memory_heap_stat_t {
     uint64_t free_size; ///< free size
     uint64_t fast_hit; ///< heap has a hit map, this field gives hit count
     uint64_t header_count; ///< header count of allocated blocks
+    uint64_t cache_hit; ///< mallocs and frees served by per-cpu caches without heap lock
+    uint64_t cache_refill_count; ///< batched refills of per-cpu caches from heap
+    uint64_t cache_flush_count; ///< batched flushes of per-cpu caches to heap
+    uint64_t cached_count; ///< free blocks parked at per-cpu caches
 }memory_heap_stat_t; ///< short hand for struct
 
 /**
@@ -43,6 +47,8 @@ typedef struct memory_heap_t {
     void (* stat)(struct memory_heap_t*, memory_heap_stat_t*); ///< return heap stats
     lock_t*  lock; ///< heap's lock
     uint64_t task_id; ///< task id of heap
+    void* (* cached_malloc)(struct memory_heap_t*, size_t, size_t); ///< optional per-cpu malloc called without lock, returns NULL if it cannot serve
+    int8_t (* cached_free)(struct memory_heap_t*, void*); ///< optional per-cpu free called without lock, returns -1 if it cannot serve
 } memory_heap_t; ///< short hand for struct
 
 /**
@@ -71,6 +71,10 @@ struct frame_allocator_t;
 
 /**
  * @brief allocate frame with count
+ *
+ * frames come from a buddy allocator, so block start is aligned to count rounded up to power of two
+ * (up to 1G). hence counts multiple of 0x200 are 2M aligned and counts multiple of 0x40000 are 1G aligned
+ * which are suitable for huge pages.
  * @param[in] self frame allocator
  * @param[in] count frame count for allocation
  * @param[in] fa_type frame allocation types can be or'ed values
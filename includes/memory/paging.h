@@ -83,6 +83,8 @@ typedef struct memory_page_table_context_t {
     uint64_t                                  internal_frames_2_start; ///< internal frames type 2
     uint64_t                                  internal_frames_2_count; ///< internal frames type 2 count
     uint64_t                                  internal_frames_helper_frame; ///< internal frames helper frame
+    volatile uint64_t                         cpu_mask; ///< cpus which loaded this table, they may have its tlb entries
+    volatile uint64_t                         pcid; ///< process context identifier, zero if table is not tagged
 } memory_page_table_context_t; ///< short hand for struct
 
 
@@ -115,6 +117,17 @@ typedef enum memory_paging_page_type_e {
 /*! page length for 1G */
 #define MEMORY_PAGING_PAGE_LENGTH_1G (1 << 30)
 
+/*! frame count of a 2M page */
+#define MEMORY_PAGING_FRAME_COUNT_2M (MEMORY_PAGING_PAGE_LENGTH_2M / MEMORY_PAGING_PAGE_LENGTH_4K)
+
+/**
+ * rounds frame count of a region up to multiple of 2M pages when region is at least one 2M page.
+ * frame allocator aligns such blocks to 2M, hence whole region is mapped with huge pages.
+ */
+#define MEMORY_PAGING_HUGE_PAGE_FRAME_COUNT(cnt) \
+        (((cnt) >= MEMORY_PAGING_FRAME_COUNT_2M) ? \
+         (((cnt) + MEMORY_PAGING_FRAME_COUNT_2M - 1) & ~(MEMORY_PAGING_FRAME_COUNT_2M - 1ULL)) : (cnt))
+
 /**
  * @brief switches p4 page table
  * @param[in]  new_table new p4 table
@@ -203,7 +216,7 @@ int8_t memory_paging_add_va_for_frame_ext(memory_page_table_context_t* table_con
 #define memory_paging_add_va_for_frame(vas, f, t) memory_paging_add_va_for_frame_ext(NULL, vas, f, t)
 
 int8_t memory_paging_delete_va_for_frame_ext(memory_page_table_context_t* table_context, uint64_t va_start, frame_t* frm);
-#define memory_paging_delete_va_for_frame(vas, f) memory_paging_add_va_for_frame_ext(NULL, vas, f)
+#define memory_paging_delete_va_for_frame(vas, f) memory_paging_delete_va_for_frame_ext(NULL, vas, f)
 
 memory_page_table_context_t* memory_paging_build_empty_table(uint64_t internal_frame_address);
 int8_t                       memory_paging_reserve_current_page_table_frames(void);
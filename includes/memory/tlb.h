@@ -0,0 +1,102 @@
+/**
+ * @file tlb.h
+ * @brief tlb invalidation and cross cpu shootdown interface
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+#ifndef ___MEMORY_TLB_H
+/*! prevent duplicate header error macro */
+#define ___MEMORY_TLB_H 0
+
+#include <types.h>
+#include <memory/paging.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! maximum range count of a batch, more ranges turn batch into full flush */
+#define MEMORY_TLB_BATCH_MAX_RANGES      16
+/*! invlpg count limit of a batch, more pages turn batch into full flush */
+#define MEMORY_TLB_FULL_FLUSH_PAGE_COUNT 64
+/*! interrupt vector of tlb shootdown ipi */
+#define MEMORY_TLB_SHOOTDOWN_VECTOR      0xFD
+/*! maximum cpu count which shootdown tracks with cpu masks */
+#define MEMORY_TLB_MAX_CPU_COUNT         64
+/*! maximum process context identifier */
+#define MEMORY_TLB_MAX_PCID              0xFFF
+
+/**
+ * @struct memory_tlb_range_t
+ * @brief pages with same size to invalidate
+ */
+typedef struct memory_tlb_range_t {
+    uint64_t start; ///< virtual address of first page
+    uint64_t page_count; ///< page count
+    uint64_t page_size; ///< page size, one invlpg per page
+} memory_tlb_range_t; ///< short hand for struct
+
+/**
+ * @struct memory_tlb_batch_t
+ * @brief collects invalidations of a page table, they are flushed with one ipi per cpu
+ */
+typedef struct memory_tlb_batch_t {
+    memory_page_table_context_t* table_context; ///< modified page table
+    uint64_t                     range_count; ///< used range count
+    uint64_t                     page_count; ///< total invlpg count
+    boolean_t                    full_flush; ///< whole tlb of table will be flushed
+    memory_tlb_range_t           ranges[MEMORY_TLB_BATCH_MAX_RANGES]; ///< ranges
+} memory_tlb_batch_t; ///< short hand for struct
+
+/**
+ * @brief inits tlb management of current cpu. first call detects pcid support and installs shootdown handler.
+ * each cpu should call it after its local apic is configured.
+ * @return 0 on success
+ */
+int8_t memory_tlb_init(void);
+
+/**
+ * @brief inits an empty batch
+ * @param[in] batch batch
+ * @param[in] table_context modified page table, NULL for current table
+ */
+void memory_tlb_batch_init(memory_tlb_batch_t* batch, memory_page_table_context_t* table_context);
+
+/**
+ * @brief adds pages to batch, adjacent pages are merged
+ * @param[in] batch batch
+ * @param[in] virtual_address start address
+ * @param[in] page_count page count
+ * @param[in] page_size page size
+ */
+void memory_tlb_batch_add(memory_tlb_batch_t* batch, uint64_t virtual_address, uint64_t page_count, uint64_t page_size);
+
+/**
+ * @brief invalidates batch at current cpu and other cpus which may have table's entries, then empties batch
+ * @param[in] batch batch
+ */
+void memory_tlb_batch_flush(memory_tlb_batch_t* batch);
+
+/**
+ * @brief invalidates pages of a page table at all cpus
+ * @param[in] table_context modified page table, NULL for current table
+ * @param[in] virtual_address start address
+ * @param[in] page_count page count
+ * @param[in] page_size page size
+ */
+void memory_tlb_invalidate(memory_page_table_context_t* table_context, uint64_t virtual_address, uint64_t page_count, uint64_t page_size);
+
+/**
+ * @brief returns cr3 value to load table at current cpu. with pcid, entries of table are kept unless they are
+ * invalidated while table is not loaded at current cpu.
+ * @param[in] table_context table to load
+ * @return cr3 value
+ */
+uint64_t memory_tlb_get_cr3(memory_page_table_context_t* table_context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
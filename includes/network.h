@@ -27,20 +27,54 @@ typedef enum network_type_t {
     NETWORK_TYPE_ETHERNET=0
 } network_type_t;
 
+struct network_netbuf_t;
+
 typedef struct network_received_packet_t {
-    uint64_t       packet_len;
-    uint8_t*       packet_data;
-    list_t*        return_queue;
-    network_type_t network_type;
-    void*          network_info;
+    uint64_t                 packet_len;
+    uint8_t*                 packet_data;
+    list_t*                  return_queue;
+    network_type_t           network_type;
+    void*                    network_info;
+    struct network_netbuf_t* netbuf; ///< owner netbuf, packet is embedded into it
 } network_received_packet_t;
 
 typedef struct network_transmit_packet_t {
-    uint64_t packet_len;
-    uint8_t* packet_data;
+    uint64_t                 packet_len;
+    uint8_t*                 packet_data;
+    struct network_netbuf_t* netbuf; ///< owner netbuf if packet is embedded into one, else packet and data are heap allocated
 } network_transmit_packet_t;
 
-extern list_t* network_received_packets;
+/*! max count of rx queues, each queue has its own packet queue and processing task pinned to a cpu */
+#define NETWORK_RX_QUEUE_MAX 8
+
+/**
+ * @struct network_rx_queue_t
+ * @brief received packet queue of network stack, nic queues push packets of their flows into same queue
+ */
+typedef struct network_rx_queue_t {
+    list_t*  packets; ///< received packets
+    uint64_t task_id; ///< processing task
+    uint64_t cpu_id; ///< cpu which processing task is pinned
+} network_rx_queue_t;
+
+/**
+ * @brief returns rx queue count, one queue per cpu up to @ref NETWORK_RX_QUEUE_MAX
+ * @return rx queue count
+ */
+uint64_t network_rx_queue_count(void);
+
+/**
+ * @brief returns rx queue
+ * @param[in] queue_idx queue index, it is wrapped with queue count
+ * @return rx queue or null if network is not initialized
+ */
+network_rx_queue_t* network_rx_queue_get(uint64_t queue_idx);
+
+/**
+ * @brief returns index of rx queue processed at current cpu, protocol layers use it to keep per queue state
+ * @return rx queue index
+ */
+uint64_t network_rx_queue_current(void);
 
 int8_t network_transmit_packet_destroyer(memory_heap_t* heap, void* data);
 
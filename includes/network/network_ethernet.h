@@ -30,11 +30,50 @@ typedef struct network_ethernet_t {
 
 extern network_mac_address_t BROADCAST_MAC;
 
+/**
+ * @struct network_ethernet_route_t
+ * @brief where frames to a peer leave, learned from a received frame of the peer
+ */
+typedef struct network_ethernet_route_t {
+    list_t*               return_queue; ///< tx queue of nic queue which peer's frames arrive
+    network_mac_address_t local_mac; ///< our mac
+    network_mac_address_t remote_mac; ///< next hop mac
+} network_ethernet_route_t;
+
 boolean_t network_ethernet_is_mac_address_eq(network_mac_address_t mac1, network_mac_address_t mac2);
-list_t*   network_ethernet_process_packet(network_ethernet_t* recv_eth_packet, void* network_info);
+list_t*   network_ethernet_process_packet(struct network_netbuf_t* netbuf, void* network_info);
 
 uint8_t* network_ethernet_create_packet(network_mac_address_t dest, network_mac_address_t src, network_ethernet_type_t type, uint16_t data_len, uint8_t* data);
 
+/**
+ * @brief prepends ethernet header to a packet
+ *
+ * netbuf backed packets get the header in their headroom, heap backed packets are copied into a netbuf.
+ * @param[in] inner_packet packet to be wrapped, consumed by call
+ * @param[in] dest destination mac
+ * @param[in] src source mac
+ * @param[in] type ethernet type of inner packet
+ * @return netbuf backed ethernet packet or null
+ */
+network_transmit_packet_t* network_ethernet_prepend_header(network_transmit_packet_t* inner_packet, network_mac_address_t dest, network_mac_address_t src, network_ethernet_type_t type);
+
+/**
+ * @brief fills route back to sender of a received netbuf
+ * @param[out] route route
+ * @param[in] netbuf received netbuf
+ * @param[in] network_info mac of receiving nic
+ */
+void network_ethernet_route_from_netbuf(network_ethernet_route_t* route, const struct network_netbuf_t* netbuf, const void* network_info);
+
+/**
+ * @brief prepends ethernet header and pushes netbuf to nic queue of route
+ * @param[in] route route
+ * @param[in] netbuf packet, consumed by call
+ * @param[in] type ethernet type of packet
+ * @return 0 on success
+ */
+int8_t network_ethernet_route_transmit(network_ethernet_route_t* route, struct network_netbuf_t* netbuf, network_ethernet_type_t type);
+
 #ifdef __cplusplus
 }
 #endif
@@ -41,6 +41,7 @@ typedef struct network_icmpv4_ping_header_t {
 }__attribute__((packed)) network_icmpv4_ping_header_t;
 
 uint8_t* network_icmpv4_process_packet(network_icmpv4_header_t* recv_icmpv4_packet, void* network_info, uint16_t* return_packet_len);
+int8_t   network_icmpv4_reply_in_place(network_icmpv4_header_t* recv_icmpv4_packet, uint16_t packet_len);
 
 #ifdef __cplusplus
 }
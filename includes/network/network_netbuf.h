@@ -0,0 +1,129 @@
+/**
+ * @file network_netbuf.h
+ * @brief Network packet buffer pool header.
+ *
+ * netbufs are refcounted frame backed packet buffers. each netbuf is one frame with a headroom before packet data,
+ * so nic drivers can give its frame address to dma and protocol layers can prepend headers in place. a received
+ * netbuf can be turned into a reply and sent without copying its data.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#ifndef ___NETWORK_NETBUF_H
+#define ___NETWORK_NETBUF_H 0
+
+#include <types.h>
+#include <network.h>
+#include <memory/frame.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! size of a netbuf buffer, one frame */
+#define NETWORK_NETBUF_SIZE      FRAME_SIZE
+/*! reserved space before packet data for prepending headers */
+#define NETWORK_NETBUF_HEADROOM  128
+/*! usable packet size after headroom */
+#define NETWORK_NETBUF_DATA_SIZE (NETWORK_NETBUF_SIZE - NETWORK_NETBUF_HEADROOM)
+
+/**
+ * @struct network_netbuf_t
+ * @brief packet buffer descriptor
+ */
+typedef struct network_netbuf_t {
+    struct network_netbuf_t*  next; ///< free list link
+    volatile uint32_t         refcount; ///< owner count, buffer returns to pool when it drops to zero
+    uint16_t                  len; ///< packet length at data
+    uint64_t                  fa; ///< frame address of buffer
+    uint8_t*                  head; ///< virtual address of buffer
+    uint8_t*                  data; ///< packet start, between head + headroom
+    network_received_packet_t rx_packet; ///< embedded received packet for rx queue
+    network_transmit_packet_t tx_packet; ///< embedded transmit packet for tx queues
+} network_netbuf_t;
+
+/**
+ * @brief adds new buffers to the pool
+ * @param[in] count buffer count, each buffer is one frame
+ * @return 0 on success
+ */
+int8_t network_netbuf_pool_add(uint64_t count);
+
+/**
+ * @brief returns free buffer count of the pool
+ * @return free buffer count
+ */
+uint64_t network_netbuf_pool_free_count(void);
+
+/**
+ * @brief allocates an empty netbuf with full headroom and one reference
+ * @return netbuf or null if pool is exhausted
+ */
+network_netbuf_t* network_netbuf_alloc(void);
+
+/**
+ * @brief takes a new reference of netbuf
+ * @param[in] netbuf netbuf
+ * @return netbuf
+ */
+network_netbuf_t* network_netbuf_get(network_netbuf_t* netbuf);
+
+/**
+ * @brief drops a reference of netbuf, last reference returns it to pool
+ * @param[in] netbuf netbuf
+ */
+void network_netbuf_put(network_netbuf_t* netbuf);
+
+/**
+ * @brief prepends space before packet data
+ * @param[in] netbuf netbuf
+ * @param[in] len prepended length
+ * @return new packet start or null if headroom is not enough
+ */
+uint8_t* network_netbuf_push(network_netbuf_t* netbuf, uint16_t len);
+
+/**
+ * @brief removes bytes from packet start, generally a parsed header
+ * @param[in] netbuf netbuf
+ * @param[in] len removed length
+ * @return new packet start or null if packet is shorter
+ */
+uint8_t* network_netbuf_pull(network_netbuf_t* netbuf, uint16_t len);
+
+/**
+ * @brief appends space after packet data
+ * @param[in] netbuf netbuf
+ * @param[in] len appended length
+ * @return start of appended space or null if buffer is full
+ */
+uint8_t* network_netbuf_append(network_netbuf_t* netbuf, uint16_t len);
+
+/**
+ * @brief returns frame address of packet start for dma
+ * @param[in] netbuf netbuf
+ * @return frame address
+ */
+static inline uint64_t network_netbuf_data_fa(const network_netbuf_t* netbuf) {
+    return netbuf->fa + (netbuf->data - netbuf->head);
+}
+
+/**
+ * @brief fills embedded transmit packet with current packet start and length
+ * @param[in] netbuf netbuf
+ * @return embedded transmit packet, destroying it drops the reference of netbuf
+ */
+network_transmit_packet_t* network_netbuf_transmit_packet(network_netbuf_t* netbuf);
+
+/**
+ * @brief allocates a netbuf backed transmit packet with given length
+ * @param[in] len packet length
+ * @return transmit packet or null if pool is exhausted
+ */
+network_transmit_packet_t* network_netbuf_create_transmit_packet(uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
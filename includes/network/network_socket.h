@@ -0,0 +1,202 @@
+/**
+ * @file network_socket.h
+ * @brief kernel socket interface over tcp and udp with readiness polling
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#ifndef ___NETWORK_SOCKET_H
+#define ___NETWORK_SOCKET_H 0
+
+#include <types.h>
+#include <network/network_protocols.h>
+#include <network/network_tcpv4.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! return value of non-blocking calls which cannot progress now */
+#define NETWORK_SOCKET_WOULD_BLOCK (-2)
+
+/*! timeout of @ref network_socket_poller_wait which never expires */
+#define NETWORK_SOCKET_WAIT_FOREVER ((uint64_t)-1)
+
+/*! max queued datagram count of an udp socket, newer datagrams are dropped */
+#define NETWORK_SOCKET_UDP_QUEUE_MAX 256
+
+/**
+ * @enum network_socket_type_t
+ * @brief socket kinds
+ */
+typedef enum network_socket_type_t {
+    NETWORK_SOCKET_TYPE_TCP_LISTENER, ///< accepts tcp connections
+    NETWORK_SOCKET_TYPE_TCP, ///< tcp connection
+    NETWORK_SOCKET_TYPE_UDP, ///< bound udp port
+} network_socket_type_t;
+
+/**
+ * @enum network_socket_event_t
+ * @brief readiness flags
+ */
+typedef enum network_socket_event_t {
+    NETWORK_SOCKET_EVENT_READABLE = NETWORK_TCPV4_POLL_READABLE, ///< recv, recvfrom or accept can progress
+    NETWORK_SOCKET_EVENT_WRITABLE = NETWORK_TCPV4_POLL_WRITABLE, ///< send can progress
+    NETWORK_SOCKET_EVENT_HANGUP = NETWORK_TCPV4_POLL_HANGUP, ///< connection is closed, always reported
+} network_socket_event_t;
+
+typedef struct network_socket_t        network_socket_t; ///< short hand for struct
+typedef struct network_socket_poller_t network_socket_poller_t; ///< short hand for struct
+
+/**
+ * @struct network_socket_poll_result_t
+ * @brief one ready socket returned by @ref network_socket_poller_wait
+ */
+typedef struct network_socket_poll_result_t {
+    network_socket_t* socket; ///< ready socket
+    uint32_t          events; ///< @ref network_socket_event_t flags
+    void*             user_data; ///< data given at @ref network_socket_poller_add
+} network_socket_poll_result_t;
+
+/**
+ * @brief opens a tcp listener
+ * @param[in] ip local ip
+ * @param[in] port local port
+ * @return socket, null if port is used by another socket
+ */
+network_socket_t* network_socket_listen(network_ipv4_address_t ip, uint16_t port);
+
+/**
+ * @brief accepts an established connection, waits for one if socket is blocking
+ * @param[in] listener listener socket
+ * @return connection socket, null if there is none at non-blocking mode or on error
+ */
+network_socket_t* network_socket_accept(network_socket_t* listener);
+
+/**
+ * @brief binds an udp port
+ * @param[in] ip local ip
+ * @param[in] port local port
+ * @return socket, null if port is bound
+ */
+network_socket_t* network_socket_udp_bind(network_ipv4_address_t ip, uint16_t port);
+
+/**
+ * @brief sends data over tcp connection, blocking sockets wait until all data is queued
+ * @param[in] socket connection socket
+ * @param[in] data data
+ * @param[in] len data length
+ * @return queued byte count, @ref NETWORK_SOCKET_WOULD_BLOCK if nothing is queued at non-blocking mode, -1 on error
+ */
+int64_t network_socket_send(network_socket_t* socket, const uint8_t* data, uint64_t len);
+
+/**
+ * @brief receives data from tcp connection, blocking sockets wait for data
+ * @param[in] socket connection socket
+ * @param[out] buf buffer
+ * @param[in] len buffer length
+ * @return read byte count, 0 if peer closed, @ref NETWORK_SOCKET_WOULD_BLOCK if there is no data at non-blocking mode, -1 on error
+ */
+int64_t network_socket_recv(network_socket_t* socket, uint8_t* buf, uint64_t len);
+
+/**
+ * @brief sends a datagram, peer should have sent a datagram to socket before as there is no neighbour table
+ * @param[in] socket udp socket
+ * @param[in] ip peer ip
+ * @param[in] port peer port
+ * @param[in] data payload
+ * @param[in] len payload length
+ * @return sent byte count or -1
+ */
+int64_t network_socket_sendto(network_socket_t* socket, network_ipv4_address_t ip, uint16_t port, const uint8_t* data, uint64_t len);
+
+/**
+ * @brief receives a datagram, blocking sockets wait for one, excess payload is dropped
+ * @param[in] socket udp socket
+ * @param[out] buf buffer
+ * @param[in] len buffer length
+ * @param[out] ip peer ip, may be null
+ * @param[out] port peer port, may be null
+ * @return read byte count, @ref NETWORK_SOCKET_WOULD_BLOCK if there is no datagram at non-blocking mode, -1 on error
+ */
+int64_t network_socket_recvfrom(network_socket_t* socket, uint8_t* buf, uint64_t len, network_ipv4_address_t* ip, uint16_t* port);
+
+/**
+ * @brief closes socket, it is removed from its poller. tcp connections are closed gracefully
+ * @param[in] socket socket
+ */
+void network_socket_close(network_socket_t* socket);
+
+/**
+ * @brief sets non-blocking mode
+ * @param[in] socket socket
+ * @param[in] nonblocking true for non-blocking mode
+ * @return 0 on success
+ */
+int8_t network_socket_set_nonblocking(network_socket_t* socket, boolean_t nonblocking);
+
+/**
+ * @brief sets tcp options of a connection socket
+ * @param[in] socket connection socket
+ * @param[in] option @ref network_tcpv4_option_t
+ * @param[in] enable set or clear
+ * @return 0 on success
+ */
+int8_t network_socket_set_tcp_option(network_socket_t* socket, network_tcpv4_option_t option, boolean_t enable);
+
+/**
+ * @brief returns current readiness of socket
+ * @param[in] socket socket
+ * @return @ref network_socket_event_t flags
+ */
+uint32_t network_socket_poll(network_socket_t* socket);
+
+/**
+ * @brief creates a poller owned by current task, only owner should wait on it
+ *
+ * readiness is edge triggered: a socket is reported when it becomes ready, so owner should consume it until
+ * @ref NETWORK_SOCKET_WOULD_BLOCK before waiting again.
+ * @return poller or null
+ */
+network_socket_poller_t* network_socket_poller_create(void);
+
+/**
+ * @brief destroys poller, its sockets are removed but not closed. it should be called by owner task
+ * @param[in] poller poller
+ */
+void network_socket_poller_destroy(network_socket_poller_t* poller);
+
+/**
+ * @brief adds socket to poller, a socket may be at one poller. current readiness is reported at next wait
+ * @param[in] poller poller
+ * @param[in] socket socket
+ * @param[in] events interested @ref network_socket_event_t flags
+ * @param[in] user_data returned with events of socket
+ * @return 0 on success
+ */
+int8_t network_socket_poller_add(network_socket_poller_t* poller, network_socket_t* socket, uint32_t events, void* user_data);
+
+/**
+ * @brief removes socket from poller
+ * @param[in] poller poller
+ * @param[in] socket socket
+ * @return 0 on success
+ */
+int8_t network_socket_poller_del(network_socket_poller_t* poller, network_socket_t* socket);
+
+/**
+ * @brief waits until sockets become ready or timeout expires, task sleeps while waiting
+ * @param[in] poller poller
+ * @param[out] results ready sockets
+ * @param[in] max_results capacity of results
+ * @param[in] timeout_ms timeout in ms, 0 returns immediately, @ref NETWORK_SOCKET_WAIT_FOREVER never expires
+ * @return ready socket count, -1 on error
+ */
+int64_t network_socket_poller_wait(network_socket_poller_t* poller, network_socket_poll_result_t* results, uint64_t max_results, uint64_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
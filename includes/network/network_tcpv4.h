@@ -12,7 +12,9 @@
 #include <types.h>
 #include <network.h>
 #include <network/network_protocols.h>
+#include <network/network_ethernet.h>
 #include <hashmap.h>
+#include <cpu/sync.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -54,26 +56,244 @@ typedef enum network_tcp_connection_state_t {
     NETWORK_TCP_CONNECTION_STATE_TIME_WAIT
 } network_tcp_connection_state_t;
 
+/*! maximum segment size of our side, ethernet mtu without ipv4 and tcp headers */
+#define NETWORK_TCPV4_MSS                1460
+/*! segment size assumed when peer does not send mss option */
+#define NETWORK_TCPV4_DEFAULT_MSS        536
+/*! send buffer size of a connection, should be power of two */
+#define NETWORK_TCPV4_SEND_BUFFER_SIZE    (128 << 10)
+/*! receive buffer size of a connection, should be power of two */
+#define NETWORK_TCPV4_RECEIVE_BUFFER_SIZE (128 << 10)
+/*! our window scale shift, receive buffer should fit into 16 bit window after scaling */
+#define NETWORK_TCPV4_WINDOW_SCALE       2
+/*! max window scale shift accepted from peer */
+#define NETWORK_TCPV4_MAX_WINDOW_SCALE   14
+/*! initial congestion window in segments */
+#define NETWORK_TCPV4_INITIAL_CWND       10
+/*! initial retransmission timeout in ms */
+#define NETWORK_TCPV4_RTO_INITIAL        1000
+/*! lower bound of retransmission timeout in ms */
+#define NETWORK_TCPV4_RTO_MIN            200
+/*! upper bound of retransmission timeout in ms */
+#define NETWORK_TCPV4_RTO_MAX            60000
+/*! retransmission count before connection is reset */
+#define NETWORK_TCPV4_MAX_RETRANSMITS    8
+/*! delayed ack timeout in ms */
+#define NETWORK_TCPV4_DELAYED_ACK        40
+/*! duplicate ack count which triggers fast retransmit */
+#define NETWORK_TCPV4_DUPACK_THRESHOLD   3
+
+/**
+ * @struct network_tcpv4_ring_t
+ * @brief byte ring of a connection, head and tail are free running offsets
+ */
+typedef struct network_tcpv4_ring_t {
+    uint8_t* data; ///< ring memory
+    uint32_t size; ///< ring size, power of two
+    uint32_t head; ///< offset of first byte
+    uint32_t tail; ///< offset after last byte
+} network_tcpv4_ring_t;
+
+/**
+ * @enum network_tcpv4_option_t
+ * @brief per connection toggles
+ */
+typedef enum network_tcpv4_option_t {
+    NETWORK_TCPV4_OPTION_NODELAY = 1 << 0, ///< disables nagle, small segments are sent while data is in flight
+    NETWORK_TCPV4_OPTION_QUICKACK = 1 << 1, ///< disables delayed acks
+} network_tcpv4_option_t;
+
+/**
+ * @enum network_tcpv4_poll_t
+ * @brief readiness flags of a connection
+ */
+typedef enum network_tcpv4_poll_t {
+    NETWORK_TCPV4_POLL_READABLE = 1 << 0, ///< data or eof can be read
+    NETWORK_TCPV4_POLL_WRITABLE = 1 << 1, ///< send buffer has space
+    NETWORK_TCPV4_POLL_HANGUP = 1 << 2, ///< connection is closed or reset
+} network_tcpv4_poll_t;
+
+/**
+ * @brief readiness change hook of connection and listener owners
+ *
+ * it is called by rx task with connection or listener locked, it should only queue a notification.
+ */
+typedef void (*network_tcpv4_event_callback_f)(void* event_data);
+
+struct network_tcpv4_listener_t;
+
 typedef struct network_tcpv4_connection_t {
-    network_ipv4_address_t         local_ip;
-    network_ipv4_address_t         remote_ip;
-    uint16_t                       local_port;
-    uint16_t                       remote_port;
-    uint32_t                       local_sequence_number;
-    uint32_t                       remote_sequence_number;
-    uint32_t                       local_acknowledgement_number;
-    uint32_t                       remote_acknowledgement_number;
-    uint16_t                       window_size;
-    network_tcp_connection_state_t state;
+    network_ipv4_address_t           local_ip;
+    network_ipv4_address_t           remote_ip;
+    uint16_t                         local_port;
+    uint16_t                         remote_port;
+    network_tcp_connection_state_t   state;
+    network_ethernet_route_t         route; ///< segments are pushed to nic queue of flow directly
+    lock_t*                          lock; ///< serializes rx task, timers and users of connection
+    uint64_t                         queue; ///< rx queue shard of connection
+    uint32_t                         options; ///< @ref network_tcpv4_option_t flags
+    struct network_tcpv4_listener_t* listener; ///< listener which connection is accepted from
+    network_tcpv4_event_callback_f   event_callback; ///< readiness hook of owner
+    void*                            event_data; ///< readiness hook data
+    boolean_t                        owned; ///< an owner holds connection, engine only unlinks it at close
+    boolean_t                        detached; ///< engine unlinked connection, owner frees it at release
+
+    // send sequence space
+    uint32_t iss; ///< initial send sequence
+    uint32_t snd_una; ///< oldest unacknowledged sequence
+    uint32_t snd_nxt; ///< next sequence to send
+    uint32_t snd_wnd; ///< peer window in bytes, scaled
+    uint32_t snd_wl1; ///< segment sequence used for last window update
+    uint32_t snd_wl2; ///< segment ack used for last window update
+    uint8_t  snd_wscale; ///< peer window scale shift
+    uint16_t mss; ///< segment size for sending
+
+    // receive sequence space
+    uint32_t irs; ///< initial receive sequence
+    uint32_t rcv_nxt; ///< next expected sequence
+    uint32_t rcv_adv; ///< right edge of last advertised window
+    uint8_t  rcv_wscale; ///< our window scale shift, zero if peer does not scale
+
+    network_tcpv4_ring_t send_buffer; ///< data from snd_una, both unacked and unsent
+    network_tcpv4_ring_t receive_buffer; ///< in order data not read yet
+
+    // rfc 6298 rtt estimation, all in ms
+    uint32_t  srtt;
+    uint32_t  rttvar;
+    uint32_t  rto;
+    boolean_t rtt_pending; ///< a segment is timed
+    uint32_t  rtt_seq; ///< timed segment sequence
+    uint64_t  rtt_start; ///< tick count when timed segment is sent
+    uint64_t  rto_deadline; ///< retransmission timer, zero if stopped
+    uint32_t  retransmits; ///< consecutive timeouts
+
+    // newreno congestion control
+    uint32_t  cwnd;
+    uint32_t  ssthresh;
+    uint32_t  dupacks;
+    uint32_t  recover; ///< snd_nxt when fast recovery started
+    boolean_t in_recovery;
+
+    // delayed ack
+    uint64_t  ack_deadline; ///< delayed ack timer, zero if no ack is pending
+    uint32_t  unacked_segments; ///< received segments not acked yet
+    boolean_t ack_now;
+
+    boolean_t fin_queued; ///< user closed send side
+    boolean_t fin_sent;
+    boolean_t fin_received;
+    uint32_t  fin_seq; ///< sequence of our fin
 } network_tcpv4_connection_t;
 
+/**
+ * @struct network_tcpv4_listener_t
+ * @brief listener with its connections sharded by rx queue
+ *
+ * nic steers all packets of a flow to one rx queue, so a connection is only used by the task of its queue.
+ */
 typedef struct network_tcpv4_listener_t {
-    network_ipv4_address_t local_ip;
-    uint16_t               local_port;
-    hashmap_t*             connections;
+    network_ipv4_address_t         local_ip;
+    uint16_t                       local_port;
+    hashmap_t*                     connections[NETWORK_RX_QUEUE_MAX]; ///< connections of each rx queue
+    list_t*                        accept_queue; ///< established connections waiting for owner, null if listener is not opened
+    network_tcpv4_event_callback_f event_callback; ///< called when a connection is queued to accept queue
+    void*                          event_data; ///< event callback data
 } network_tcpv4_listener_t;
 
-uint8_t* network_tcpv4_process_packet(network_ipv4_address_t dip, network_ipv4_address_t sip, network_tcpv4_header_t* recv_tcpv4_packet, void* network_info, uint16_t packet_len, uint16_t* return_packet_len);
+/**
+ * @brief creates listener map, it should be called before rx queues start
+ * @return 0 on success
+ */
+int8_t network_tcpv4_init(void);
+
+/**
+ * @brief processes a received segment, replies are pushed to nic queue of packet directly
+ * @param[in] dip destination ip of segment
+ * @param[in] sip source ip of segment
+ * @param[in] recv_tcpv4_packet segment
+ * @param[in] network_info mac of receiving nic
+ * @param[in] packet_len segment length
+ * @param[in] netbuf received netbuf, its ethernet header and return queue give route of replies
+ * @return 0 if segment is consumed
+ */
+int8_t network_tcpv4_process_packet(network_ipv4_address_t dip, network_ipv4_address_t sip, network_tcpv4_header_t* recv_tcpv4_packet, void* network_info, uint16_t packet_len, struct network_netbuf_t* netbuf);
+
+/**
+ * @brief runs retransmission and delayed ack timers of connections at current rx queue
+ * @param[in] now current tick count
+ * @return earliest pending deadline or zero
+ */
+uint64_t network_tcpv4_timers_run(uint64_t now);
+
+/**
+ * @brief queues data to send buffer and sends what windows allow
+ * @param[in] connection connection
+ * @param[in] data data
+ * @param[in] len data length
+ * @return queued byte count, it may be less than len if buffer is full, -1 if connection cannot send
+ */
+int64_t network_tcpv4_connection_send(network_tcpv4_connection_t* connection, const uint8_t* data, uint64_t len);
+
+/**
+ * @brief reads in order data from receive buffer, opened window is advertised
+ * @param[in] connection connection
+ * @param[out] buf buffer
+ * @param[in] len buffer length
+ * @return read byte count, 0 if no data, -1 if peer closed and buffer is empty
+ */
+int64_t network_tcpv4_connection_recv(network_tcpv4_connection_t* connection, uint8_t* buf, uint64_t len);
+
+/**
+ * @brief closes send side, fin is sent after queued data
+ * @param[in] connection connection
+ */
+void network_tcpv4_connection_close(network_tcpv4_connection_t* connection);
+
+/**
+ * @brief sets or clears connection options
+ * @param[in] connection connection
+ * @param[in] option @ref network_tcpv4_option_t
+ * @param[in] enable set or clear
+ */
+void network_tcpv4_connection_set_option(network_tcpv4_connection_t* connection, network_tcpv4_option_t option, boolean_t enable);
+
+/**
+ * @brief opens listener for an owner, established connections are pushed to accept queue
+ * @param[in] ip local ip
+ * @param[in] port local port
+ * @param[in] accept_queue accept queue of owner
+ * @param[in] event_callback called when a connection is queued
+ * @param[in] event_data event callback data
+ * @return listener, null if it is already opened
+ */
+network_tcpv4_listener_t* network_tcpv4_listener_open(network_ipv4_address_t ip, uint16_t port, list_t* accept_queue, network_tcpv4_event_callback_f event_callback, void* event_data);
+
+/**
+ * @brief closes listener of an owner, queued connections are released
+ * @param[in] listener listener
+ */
+void network_tcpv4_listener_close(network_tcpv4_listener_t* listener);
+
+/**
+ * @brief sets readiness hook of an owned connection
+ * @param[in] connection connection
+ * @param[in] event_callback hook, null to clear
+ * @param[in] event_data hook data
+ */
+void network_tcpv4_connection_set_event_callback(network_tcpv4_connection_t* connection, network_tcpv4_event_callback_f event_callback, void* event_data);
+
+/**
+ * @brief returns readiness of connection
+ * @param[in] connection connection
+ * @return @ref network_tcpv4_poll_t flags
+ */
+uint32_t network_tcpv4_connection_poll(network_tcpv4_connection_t* connection);
+
+/**
+ * @brief owner drops connection, it is closed gracefully and freed by engine or freed now if engine already dropped it
+ * @param[in] connection connection
+ */
+void network_tcpv4_connection_release(network_tcpv4_connection_t* connection);
 
 #ifdef __cplusplus
 }
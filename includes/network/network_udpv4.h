@@ -12,6 +12,7 @@
 #include <types.h>
 #include <network.h>
 #include <network/network_protocols.h>
+#include <network/network_ethernet.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -27,10 +28,50 @@ typedef struct network_udpv4_header_t {
     uint16_t checksum;
 }__attribute__((packed)) network_udpv4_header_t;
 
+/**
+ * @brief receive hook of a bound port, it is called by rx task and should only queue datagram
+ * @param[in] data hook data
+ * @param[in] sip source ip
+ * @param[in] sport source port
+ * @param[in] payload datagram payload, valid only during call
+ * @param[in] len payload length
+ * @param[in] route route back to sender
+ */
+typedef void (*network_udpv4_receive_callback_f)(void* data, network_ipv4_address_t sip, uint16_t sport, const uint8_t* payload, uint16_t len, const network_ethernet_route_t* route);
 
-uint8_t*                network_udpv4_process_packet(network_ipv4_address_t dip, network_ipv4_address_t sip, network_udpv4_header_t* recv_udpv4_packet, void* network_info, uint16_t* return_packet_len);
+uint8_t*                network_udpv4_process_packet(network_ipv4_address_t dip, network_ipv4_address_t sip, network_udpv4_header_t* recv_udpv4_packet, void* network_info, uint16_t* return_packet_len, struct network_netbuf_t* netbuf);
 network_udpv4_header_t* network_udpv4_create_packet_from_data(uint16_t sp, uint16_t dp, uint16_t len, uint8_t* data);
 
+/**
+ * @brief binds a port, datagrams to it are given to callback instead of built-in services
+ * @param[in] ip local ip
+ * @param[in] port local port
+ * @param[in] callback receive hook
+ * @param[in] data hook data
+ * @return 0 on success, -1 if port is bound
+ */
+int8_t network_udpv4_bind(network_ipv4_address_t ip, uint16_t port, network_udpv4_receive_callback_f callback, void* data);
+
+/**
+ * @brief unbinds a port, hook is not called after return
+ * @param[in] ip local ip
+ * @param[in] port local port
+ */
+void network_udpv4_unbind(network_ipv4_address_t ip, uint16_t port);
+
+/**
+ * @brief builds a datagram in a netbuf and pushes it to nic queue of route
+ * @param[in] route route to peer
+ * @param[in] sip source ip
+ * @param[in] sport source port
+ * @param[in] dip destination ip
+ * @param[in] dport destination port
+ * @param[in] data payload
+ * @param[in] len payload length, it should fit into one frame
+ * @return 0 on success
+ */
+int8_t network_udpv4_send(network_ethernet_route_t* route, network_ipv4_address_t sip, uint16_t sport, network_ipv4_address_t dip, uint16_t dport, const uint8_t* data, uint16_t len);
+
 #ifdef __cplusplus
 }
 #endif
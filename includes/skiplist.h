@@ -0,0 +1,85 @@
+/**
+ * @file skiplist.h
+ * @brief arena backed skiplist index interface
+ *
+ * nodes, and optionally keys and datas, are allocated from an arena which is released at once when index is
+ * destroyed. writers should be serialized by caller, readers can search and iterate without any lock while a
+ * writer inserts or deletes. deleted nodes and replaced datas are not freed until index is destroyed.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#ifndef ___SKIPLIST_H
+/*! prevent duplicate header error macro */
+#define ___SKIPLIST_H 0
+
+#include <types.h>
+#include <memory.h>
+#include <indexer.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! default arena chunk size of skiplist */
+#define SKIPLIST_ARENA_CHUNK_SIZE (64 << 10)
+
+/**
+ * @brief creates skiplist index implementation
+ * @param[in]  heap             heap to use for arena chunks, index and iterators
+ * @param[in]  arena_chunk_size size of each arena chunk, larger allocations get their own chunk
+ * @param[in]  comparator       key comparator
+ * @param[in]  unique           if unique flag set insert replaces data of equal key
+ * @return     index interface
+ */
+index_t* skiplist_create_index_with_heap_and_unique(memory_heap_t* heap, uint64_t arena_chunk_size,
+                                                    index_key_comparator_f comparator, boolean_t unique);
+
+/**
+ * @brief creates skiplist index with default heap and arena chunk size
+ * @param[in]  c   comparator
+ * @param[in]  u   unique flag
+ * @return     skiplist index
+ */
+#define skiplist_create_index_with_unique(c, u) skiplist_create_index_with_heap_and_unique(NULL, SKIPLIST_ARENA_CHUNK_SIZE, c, u)
+
+/**
+ * @brief destroys index and releases its arena
+ * @param[in]  idx index to be destroyed
+ * @return     0 if successed.
+ * datas allocated with @ref skiplist_arena_malloc are released too, other datas should be freed by caller.
+ */
+int8_t skiplist_destroy_index(index_t* idx);
+
+/**
+ * @brief sets a comparator for unique subpart for non unique index
+ *
+ * keys equal by index comparator are ordered with this comparator and insert replaces data of key equal by both.
+ * @param[in]  idx        index
+ * @param[in]  comparator comparator
+ * @return     0 if successed.
+ */
+int8_t skiplist_set_comparator_for_unique_subpart_for_non_unique_index(index_t* idx, index_key_comparator_f comparator);
+
+/**
+ * @brief allocates memory from arena of index, memory lives until index is destroyed
+ * @param[in]  idx  index
+ * @param[in]  size allocation size
+ * @return     zeroed memory or null
+ * arena is not locked, so allocations should be serialized with writers.
+ */
+void* skiplist_arena_malloc(index_t* idx, uint64_t size);
+
+/**
+ * @brief returns total size of arena chunks of index
+ * @param[in]  idx index
+ * @return     arena size in bytes
+ */
+uint64_t skiplist_arena_size(index_t* idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,6 +18,104 @@ extern "C" {
 
 #define TIME_TIMER_PIT_HZ_FOR_1MS   1000
 
+/*! timer wheel level count */
+#define TIME_TIMER_WHEEL_LEVEL_COUNT 4
+/*! bit count of slot index at each timer wheel level */
+#define TIME_TIMER_WHEEL_SLOT_BITS   8
+/*! slot count at each timer wheel level */
+#define TIME_TIMER_WHEEL_SLOT_COUNT  (1ULL << TIME_TIMER_WHEEL_SLOT_BITS)
+
+/**
+ * @enum time_timer_state_t
+ * @brief timer states
+ */
+typedef enum time_timer_state_t {
+    TIME_TIMER_STATE_IDLE, ///< timer is not armed
+    TIME_TIMER_STATE_PENDING, ///< timer is at a wheel slot
+    TIME_TIMER_STATE_RUNNING, ///< timer's callback is running
+} time_timer_state_t; ///< short hand for enum
+
+typedef struct time_timer_t time_timer_t; ///< short hand for struct
+
+/**
+ * @brief timer callback, called at timer interrupt with interrupts disabled
+ * @param[in] timer expired timer
+ * @param[in] data timer's user data
+ */
+typedef void (*time_timer_callback_f)(time_timer_t* timer, void* data);
+
+/**
+ * @struct time_timer_t
+ * @brief intrusive timer entry of per-cpu timer wheels, owner keeps its memory until it is cancelled
+ */
+struct time_timer_t {
+    time_timer_t*               next; ///< next timer at same slot
+    time_timer_t**              pprev; ///< previous timer's next field or slot head
+    uint64_t                    expires; ///< tick count when timer expires
+    uint64_t                    period; ///< re-arm period in ticks, zero for one shot timers
+    time_timer_callback_f       callback; ///< expire callback
+    void*                       data; ///< callback data
+    volatile uint64_t           cpu_id; ///< cpu id of the wheel which timer armed at
+    volatile time_timer_state_t state; ///< timer state
+    boolean_t                   allocated; ///< timer is created by time_timer_add
+};
+
+/**
+ * @brief creates per-cpu timer wheels, should be called after apic setup
+ * @return 0 on success
+ */
+int8_t time_timer_wheel_init(void);
+
+/**
+ * @brief initializes a timer entry
+ * @param[in] timer timer entry
+ * @param[in] callback expire callback
+ * @param[in] data callback data
+ */
+void time_timer_init(time_timer_t* timer, time_timer_callback_f callback, void* data);
+
+/**
+ * @brief arms timer at current cpu's wheel, an armed timer is re-armed
+ * @param[in] timer timer entry
+ * @param[in] deadline tick count when timer expires
+ * @param[in] period re-arm period in ticks, zero for one shot
+ * @return 0 on success
+ */
+int8_t time_timer_start(time_timer_t* timer, uint64_t deadline, uint64_t period);
+
+/**
+ * @brief cancels timer, waits its callback if it is running at other cpu
+ * @param[in] timer timer entry
+ * @return true if timer was pending
+ */
+boolean_t time_timer_cancel(time_timer_t* timer);
+
+/**
+ * @brief allocates and arms an one shot timer at current cpu's wheel
+ * @param[in] deadline tick count when timer expires
+ * @param[in] callback expire callback
+ * @param[in] data callback data
+ * @return timer, should be released with time_timer_free, NULL on error
+ */
+time_timer_t* time_timer_add(uint64_t deadline, time_timer_callback_f callback, void* data);
+
+/**
+ * @brief cancels and frees a timer created by time_timer_add
+ * @param[in] timer timer entry
+ */
+void time_timer_free(time_timer_t* timer);
+
+/**
+ * @brief runs expired timers of current cpu's wheel, called by apic timer interrupt
+ */
+void time_timer_wheel_run(void);
+
+/**
+ * @brief programs current cpu's one shot timer for earliest of next wheel event and given deadline at tickless mode
+ * @param[in] tsc_deadline extra deadline such as end of time slice in tsc, zero for none
+ */
+void time_timer_wheel_program(uint64_t tsc_deadline);
+
 void time_timer_reset_tick_count(void);
 
 int8_t time_timer_pit_isr(interrupt_frame_ext_t* frame);
@@ -28,6 +126,26 @@ void   time_timer_pit_sleep(uint64_t usecs);
 
 int8_t time_timer_apic_isr(interrupt_frame_ext_t* frame);
 
+/**
+ * @brief switches apic timers to one shot mode if tsc is invariant. ticks are derived from tsc
+ * and each cpu's timer is programmed for its next timer wheel or time slice deadline.
+ * @return 0 on success
+ */
+int8_t time_timer_enable_tickless(void);
+
+/**
+ * @brief checks tickless mode
+ * @return true if apic timers are one shot
+ */
+boolean_t time_timer_is_tickless(void);
+
+/**
+ * @brief converts tick count to tsc value at tickless mode
+ * @param[in] tick tick count
+ * @return tsc value
+ */
+uint64_t time_timer_tick_to_tsc(uint64_t tick);
+
 uint64_t time_timer_get_tick_count(void);
 
 void time_timer_configure_spinsleep(void);
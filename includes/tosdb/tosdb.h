@@ -16,6 +16,7 @@
 #include <disk.h>
 #include <set.h>
 #include <compression.h>
+#include <iterator.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -83,6 +84,14 @@ boolean_t tosdb_close(tosdb_t* tdb);
  */
 boolean_t tosdb_free(tosdb_t* tdb);
 
+/**
+ * @brief commits all pending record changes to write ahead log
+ * @details record changes are grouped and written to wal with one flush, this call makes them durable.
+ * @param[in] tdb tosdb
+ * @return true if succeed.
+ */
+boolean_t tosdb_commit(tosdb_t* tdb);
+
 /**
  * @struct tosdb_cache_config_t
  * @brief tosdb cache config
@@ -113,6 +122,29 @@ typedef enum tosdb_compaction_type_t {
 
 boolean_t tosdb_compact(tosdb_t* tdb, tosdb_compaction_type_t type);
 
+/**
+ * @struct tosdb_compaction_stats_t
+ * @brief tosdb background compaction statistics
+ */
+typedef struct tosdb_compaction_stats_t {
+    uint64_t compaction_count; ///< finished compactions
+    uint64_t failed_compaction_count; ///< failed compactions
+    uint64_t compaction_read_bytes; ///< sstable bytes merged by compactions
+    uint64_t compaction_written_bytes; ///< sstable bytes written by compactions
+    uint64_t flushed_bytes; ///< sstable bytes written by memtable flushes
+    uint64_t written_bytes; ///< all block bytes written to backend
+    uint64_t pending_compaction_bytes; ///< bytes of levels over their limits at last scan
+    uint64_t write_amplification; ///< written bytes per flushed byte, multiplied by 100
+} tosdb_compaction_stats_t; ///< shorthand for struct
+
+/**
+ * @brief gets background compaction statistics
+ * @param[in] tdb tosdb instance
+ * @param[out] stats statistics
+ * @return true if succeed
+ */
+boolean_t tosdb_compaction_stats_get(tosdb_t* tdb, tosdb_compaction_stats_t* stats);
+
 /*! tosdb database struct type */
 typedef struct tosdb_database_t tosdb_database_t;
 
@@ -599,6 +631,29 @@ struct tosdb_record_t {
  */
 tosdb_record_t* tosdb_table_create_record(tosdb_table_t* tbl);
 
+/**
+ * @enum tosdb_scan_direction_t
+ * @brief table scan directions
+ */
+typedef enum tosdb_scan_direction_t {
+    TOSDB_SCAN_DIRECTION_FORWARD, ///< scan from lower keys to higher keys
+    TOSDB_SCAN_DIRECTION_BACKWARD, ///< scan from higher keys to lower keys
+} tosdb_scan_direction_t;
+
+/**
+ * @brief creates an ordered range scan over a primary or unique index of table
+ * memtables and sstables are merged, newest version of each key wins and deleted keys are skipped.
+ * integer keys are ordered by value, other keys are ordered by key hash.
+ * iterator items are records owned by iterator, they are valid until next or destroy call.
+ * @param[in] tbl table
+ * @param[in] colname indexed column name
+ * @param[in] lo record with indexed column as inclusive lower bound, NULL for unbounded
+ * @param[in] hi record with indexed column as inclusive upper bound, NULL for unbounded
+ * @param[in] direction scan direction
+ * @return iterator of records, NULL on error
+ */
+iterator_t* tosdb_table_scan(tosdb_table_t* tbl, const char_t* colname, tosdb_record_t* lo, tosdb_record_t* hi, tosdb_scan_direction_t direction);
+
 #ifdef __cplusplus
 }
 #endif
@@ -41,6 +41,12 @@ typedef struct tosdb_memtable_index_item_t tosdb_memtable_index_item_t;
  */
 typedef struct tosdb_memtable_secondary_index_item_t tosdb_memtable_secondary_index_item_t;
 
+/**
+ * @typedef tosdb_block_valuelog_chunk_t
+ * @brief opaque tosdb valuelog chunk table item
+ */
+typedef struct tosdb_block_valuelog_chunk_t tosdb_block_valuelog_chunk_t;
+
 /**
  * @struct tosdb_cache_key_t
  * @brief tosdb cache key
@@ -52,6 +58,7 @@ typedef struct tosdb_cache_key_t {
     uint64_t                index_id; ///< index id
     uint64_t                sstable_id; ///< sstable id
     uint64_t                level; ///< level
+    uint64_t                chunk_id; ///< valuelog chunk id, zero for other types
     uint64_t                data_size; ///< data size
 } tosdb_cache_key_t; ///< tosdb cache key
 
@@ -81,17 +88,19 @@ typedef struct tosdb_cached_index_data_t {
         tosdb_memtable_index_item_t**           index_items; ///< index items
         tosdb_memtable_secondary_index_item_t** secondary_index_items; ///< secondary index items
     };
-    uint64_t valuelog_location; ///< valuelog location index data belongs to
-    uint64_t valuelog_size; ///< valuelog size index data belongs to
+    uint64_t                      valuelog_location; ///< valuelog location index data belongs to
+    uint64_t                      valuelog_size; ///< valuelog size index data belongs to
+    uint64_t                      valuelog_chunk_count; ///< valuelog chunk count
+    tosdb_block_valuelog_chunk_t* valuelog_chunks; ///< valuelog chunk table
 } tosdb_cached_index_data_t; ///< tosdb index data cache item
 
 /**
  * @struct tosdb_cached_valuelog_t
- * @brief tosdb valuelog cache item
+ * @brief tosdb valuelog cache item, holds one unpacked chunk of a valuelog
  */
 typedef struct tosdb_cached_valuelog_t {
     tosdb_cache_key_t cache_key; ///< cache key
-    uint64_t          record_count; ///< record count at valuelog
+    uint64_t          chunk_offset; ///< offset of chunk at unpacked valuelog
     buffer_t*         values; ///< values
 } tosdb_cached_valuelog_t; ///< tosdb valuelog cache item
 
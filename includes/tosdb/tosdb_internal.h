@@ -28,7 +28,7 @@ extern "C" {
 #define TOSDB_PAGE_SIZE 4096
 #define TOSDB_SUPERBLOCK_SIGNATURE "TURNSTONE OS DB\0"
 #define TOSDB_VERSION_MAJOR 0
-#define TOSDB_VERSION_MINOR 1
+#define TOSDB_VERSION_MINOR 2
 
 #define TOSDB_NAME_MAX_LEN 256
 
@@ -46,6 +46,7 @@ typedef enum tosdb_block_type_t {
     TOSDB_BLOCK_TYPE_SSTABLE_INDEX,
     TOSDB_BLOCK_TYPE_SSTABLE_INDEX_DATA,
     TOSDB_BLOCK_TYPE_VALUELOG,
+    TOSDB_BLOCK_TYPE_WAL,
 } tosdb_block_type_t;
 
 /**
@@ -80,6 +81,9 @@ typedef struct tosdb_superblock_t {
     uint64_t             database_list_size; ///< size of database list
     uint64_t             database_next_id; ///< next database id
     compression_type_t   compression_type; ///< compression type of block data
+    uint64_t             wal_location; ///< location of current wal region, zero if wal is empty
+    uint64_t             wal_size; ///< size of current wal region
+    uint64_t             wal_generation; ///< wal generation, increased at each checkpoint
     uint8_t              reservedN[2048] __attribute__((aligned(2048))); ///< padding
 }__attribute__((packed, aligned(8))) tosdb_superblock_t; ///< tosdb super block
 
@@ -223,21 +227,39 @@ typedef struct tosdb_block_index_list_t {
     tosdb_block_index_list_item_t indexes[]; ///< index list
 }__attribute__((packed, aligned(8))) tosdb_block_index_list_t; ///< tosdb index list
 
+/*! target unpacked size of a valuelog chunk, a record is never split between chunks */
+#define TOSDB_VALUELOG_CHUNK_SIZE (32ULL << 10)
+
 /**
  * @struct tosdb_block_valuelog_t
- * @brief tosdb valuelog
- * @details value log is serialized from row data
+ * @brief tosdb valuelog chunk
+ * @details value log is serialized from row data. it is split into chunks which are compressed independently,
+ * each chunk is a block. chunks are located with chunk table at sstable index data.
  */
 typedef struct tosdb_block_valuelog_t {
     tosdb_block_header_t header; ///< block header
     uint64_t             database_id; ///< database id of this value log
     uint64_t             table_id; ///< table id of this value log
     uint64_t             sstable_id; ///< sstable id of this value log
+    uint64_t             chunk_id; ///< chunk id of this block inside value log
+    uint64_t             chunk_offset; ///< offset of chunk at unpacked value log
     uint64_t             data_size; ///< size of data packed size (compressed size)
-    uint64_t             valuelog_unpacked_size; ///< size of unpacked data
+    uint64_t             valuelog_unpacked_size; ///< size of unpacked chunk data
     uint8_t              data[]; ///< compressed data
 }__attribute__((packed, aligned(8))) tosdb_block_valuelog_t; ///< tosdb value log
 
+/**
+ * @struct tosdb_block_valuelog_chunk_t
+ * @brief tosdb valuelog chunk table item
+ * @details chunk table is stored after compressed index data of each sstable index data block
+ */
+typedef struct tosdb_block_valuelog_chunk_t {
+    uint64_t location; ///< location of chunk block
+    uint64_t size; ///< size of chunk block
+    uint64_t unpacked_offset; ///< offset of chunk at unpacked value log
+    uint64_t unpacked_size; ///< unpacked size of chunk
+}__attribute__((packed, aligned(8))) tosdb_block_valuelog_chunk_t; ///< tosdb valuelog chunk table item
+
 /**
  * @struct tosdb_block_sstable_list_item_index_pair_t
  * @brief tosdb sstable list item index pair
@@ -311,7 +333,8 @@ typedef struct tosdb_block_sstable_index_data_t {
     uint64_t             record_count; ///< number of records in this sstable index data
     uint64_t             index_data_size; ///< size of index data packed size (compressed size)
     uint64_t             index_data_unpacked_size; ///< size of unpacked index data
-    uint8_t              data[]; ///< compressed data of index data
+    uint64_t             valuelog_chunk_count; ///< number of valuelog chunks @see tosdb_block_valuelog_chunk_t
+    uint8_t              data[]; ///< compressed data of index data, followed by valuelog chunk table
 }__attribute__((packed, aligned(8))) tosdb_block_sstable_index_data_t; ///< tosdb sstable index data
 
 /**
@@ -320,6 +343,12 @@ typedef struct tosdb_block_sstable_index_data_t {
  */
 typedef struct tosdb_cache_t tosdb_cache_t; ///< tosdb cache
 
+/**
+ * @typedef tosdb_wal_t
+ * @brief opaque tosdb wal
+ */
+typedef struct tosdb_wal_t tosdb_wal_t; ///< tosdb wal
+
 /**
  * @struct tosdb_t
  * @brief tosdb instance
@@ -333,10 +362,40 @@ struct tosdb_t {
     lock_t*              lock; ///< lock
     tosdb_cache_t*       cache; ///< cache
     const compression_t* compression; ///< compression
+    tosdb_wal_t*         wal; ///< write ahead log
+    memory_heap_t*       heap; ///< heap of the opener, background tasks allocate long lived objects from it
+    lock_t*              block_lock; ///< serializes block writes
+    lock_t*              flush_lock; ///< protects flush queue and pending flush counts of tables
+    condvar_t*           flush_cond; ///< signalled when a memtable is queued or flushed
+    list_t*              flush_queue; ///< immutable memtables waiting for background flush
+    uint64_t             flush_task_id; ///< background flush task id, zero if memtables are flushed inline
+    void**               flush_task_args; ///< background flush task arguments
+    volatile boolean_t   flush_is_closing; ///< flush task should exit after draining the queue
+    volatile boolean_t   flush_task_exited; ///< flush task exited
+    uint64_t             compaction_task_id; ///< background compaction task id, zero if there is no automatic compaction
+    void**               compaction_task_args; ///< background compaction task arguments
+    volatile boolean_t   compaction_is_closing; ///< compaction task should exit
+    volatile boolean_t   compaction_task_exited; ///< compaction task exited
+    tosdb_compaction_stats_t compaction_stats; ///< compaction statistics, byte counters are updated atomically
 };
 
 boolean_t             tosdb_write_and_flush_superblock(tosdb_backend_t* backend, tosdb_superblock_t* sb);
 uint64_t              tosdb_block_write(tosdb_t* tdb, tosdb_block_header_t* block);
+/**
+ * @brief reserves space at database file/partition, all block and wal region allocations go through it
+ * @param[in] tdb database
+ * @param[in] min_size required size
+ * @param[in] max_size wanted size, it is shrunk to page aligned free space if there is not enough space
+ * @param[out] allocated_size reserved size, may be null
+ * @return location of reserved space or zero if there is no space
+ */
+uint64_t              tosdb_block_allocate(tosdb_t* tdb, uint64_t min_size, uint64_t max_size, uint64_t* allocated_size);
+/**
+ * @brief writes superblock serialized with block allocations, so free location is never torn
+ * @param[in] tdb database
+ * @return true on success
+ */
+boolean_t             tosdb_superblock_write(tosdb_t* tdb);
 tosdb_block_header_t* tosdb_block_read(tosdb_t* tdb, uint64_t location, uint64_t size);
 boolean_t             tosdb_persist(tosdb_t* tdb);
 boolean_t             tosdb_load_databases(tosdb_t* tdb);
@@ -371,7 +430,7 @@ struct tosdb_table_t {
     boolean_t         is_dirty;
     uint64_t          id;
     char_t*           name;
-    lock_t*           lock;
+    rwlock_t*         lock; ///< writers change memtables and sstable lists, readers collect them
     hashmap_t*        columns;
     hashmap_t*        indexes;
     hashmap_t*        index_column_map;
@@ -404,10 +463,53 @@ struct tosdb_table_t {
     uint64_t          sstable_max_level;
     uint64_t          compaction_index_id_hint;
     boolean_t         compaction_index_id_hint_is_set;
+    volatile uint64_t flush_pending_count; ///< immutable memtables queued for background flush
+    volatile boolean_t compaction_running; ///< background compaction is merging sstables of table
+    boolean_t         compaction_disabled; ///< table is closing, compaction should not start
+    list_t*           sstable_retired_lists; ///< replaced level lists, readers may still walk them
+    list_t*           sstable_retired_items; ///< compacted sstable list items, freed with retired lists
+    volatile uint64_t sstable_reader_count; ///< readers walking sstable lists without table lock
 };
 
 boolean_t      tosdb_table_persist(tosdb_table_t* tbl);
 tosdb_table_t* tosdb_table_load_table(tosdb_table_t* tbl);
+
+/**
+ * @brief replaces sstable list of a level, should be called under table write lock.
+ * @details readers walk level lists without table lock, so lists are never changed in place.
+ * replaced list is retired, caller frees it with @ref tosdb_table_sstable_reclaim after all new lists are published.
+ * @param[in] tbl table
+ * @param[in] level sstable level
+ * @param[in] st_list new sstable list of level
+ * @return true if succeed
+ */
+boolean_t tosdb_table_sstable_level_replace(tosdb_table_t* tbl, uint64_t level, list_t* st_list);
+
+/**
+ * @brief marks start of a read which walks sstable lists without table lock
+ * @param[in] tbl table
+ */
+void tosdb_table_sstable_reader_enter(tosdb_table_t* tbl);
+
+/**
+ * @brief marks end of a read started by @ref tosdb_table_sstable_reader_enter
+ * @param[in] tbl table
+ */
+void tosdb_table_sstable_reader_leave(tosdb_table_t* tbl);
+
+/**
+ * @brief frees retired sstable lists and items if there is no reader, should be called under table write lock.
+ * @details new lists should be published before, readers entering later cannot reach retired ones.
+ * @param[in] tbl table
+ */
+void tosdb_table_sstable_reclaim(tosdb_table_t* tbl);
+
+/**
+ * @brief returns on disk size of sstable, valuelog and index blocks
+ * @param[in] stli sstable list item
+ * @return size in bytes
+ */
+uint64_t tosdb_sstable_list_item_size(const tosdb_block_sstable_list_item_t* stli);
 boolean_t      tosdb_table_load_columns(tosdb_table_t* tbl);
 boolean_t      tosdb_table_load_indexes(tosdb_table_t* tbl);
 boolean_t      tosdb_table_load_sstables(tosdb_table_t* tbl);
@@ -465,10 +567,13 @@ int8_t tosdb_memtable_record_id_comparator(const void* i1, const void* i2);
 int8_t tosdb_memtable_secondary_index_comparator(const void* i1, const void* i2);
 int8_t tosdb_memtable_secondary_index_record_id_comparator(const void* i1, const void* i2);
 
+/*! arena chunk size of memtable indexes, index items are allocated from arena */
+#define TOSDB_MEMTABLE_ARENA_CHUNK_SIZE (64ULL << 10)
+
 typedef struct tosdb_memtable_index_t {
     tosdb_index_t* ti;
     bloomfilter_t* bloomfilter;
-    index_t*       index;
+    index_t*       index; ///< skiplist index, items live at its arena and are released with it
 } tosdb_memtable_index_t;
 
 struct tosdb_memtable_t {
@@ -478,8 +583,10 @@ struct tosdb_memtable_t {
     boolean_t                        is_readonly;
     boolean_t                        is_full;
     boolean_t                        is_dirty;
+    boolean_t                        is_flush_pending; ///< queued for background flush, cannot be evicted
     hashmap_t*                       indexes;
     buffer_t*                        values;
+    buffer_t*                        valuelog_chunks;
     uint64_t                         record_count;
     tosdb_block_sstable_list_item_t* stli;
 };
@@ -489,10 +596,81 @@ boolean_t         tosdb_memtable_new(tosdb_table_t * tbl);
 boolean_t         tosdb_memtable_free(tosdb_memtable_t* mt);
 boolean_t         tosdb_memtable_upsert_internal(tosdb_memtable_t* mt, tosdb_record_t * record, boolean_t del, tosdb_memtable_t** mt_out);
 boolean_t         tosdb_memtable_upsert(tosdb_record_t * record, boolean_t del);
+boolean_t         tosdb_memtable_upsert_ext(tosdb_record_t * record, boolean_t del, boolean_t log_to_wal);
 boolean_t         tosdb_memtable_persist(tosdb_memtable_t* mt);
 boolean_t         tosdb_memtable_index_persist(tosdb_memtable_t* mt, tosdb_block_sstable_list_item_t* stli, uint64_t idx, tosdb_memtable_index_t* mt_idx);
 boolean_t         tosdb_memtable_is_deleted(tosdb_record_t* record);
 
+/**
+ * @brief starts background memtable flush task of tosdb, memtables are flushed inline if task cannot be created.
+ * @param[in] tdb tosdb
+ * @return true if flush task is started
+ */
+boolean_t tosdb_memtable_flush_start(tosdb_t* tdb);
+
+/**
+ * @brief stops background memtable flush task after queued memtables are flushed.
+ * @param[in] tdb tosdb
+ */
+void tosdb_memtable_flush_stop(tosdb_t* tdb);
+
+/**
+ * @brief waits until pending background flushes of table drops below the limit.
+ * @param[in] tbl table
+ * @param[in] max_pending pending flush limit
+ */
+void tosdb_memtable_flush_wait(tosdb_table_t* tbl, uint64_t max_pending);
+
+/**
+ * @brief appends a value to memtable's valuelog chunk table, starts a new chunk if current one is full.
+ * @param[in] mt memtable
+ * @param[in] offset offset of value at valuelog
+ * @param[in] length length of value
+ * @return true if succeed
+ */
+boolean_t tosdb_valuelog_chunk_append(tosdb_memtable_t* mt, uint64_t offset, uint64_t length);
+
+/**
+ * @brief compresses and writes valuelog chunks of memtable, chunk table is updated with block locations.
+ * @param[in] mt memtable
+ * @param[out] location location of first chunk
+ * @param[out] size total size of chunk blocks
+ * @return true if succeed
+ */
+boolean_t tosdb_valuelog_persist(tosdb_memtable_t* mt, uint64_t* location, uint64_t* size);
+
+/**
+ * @brief copies valuelog chunk table from sstable index data block.
+ * @param[in] b_sid sstable index data block
+ * @return chunk table, caller should free it. NULL if there is no chunk.
+ */
+tosdb_block_valuelog_chunk_t* tosdb_valuelog_chunks_from_index_data(const tosdb_block_sstable_index_data_t* b_sid);
+
+/**
+ * @brief reads a value from valuelog, only the chunk holding value is read and decompressed.
+ * @details chunk is read from cache if exists, otherwise it is put into cache.
+ * @param[in] tbl table
+ * @param[in] level sstable level
+ * @param[in] sstable_id sstable id
+ * @param[in] chunks chunk table
+ * @param[in] chunk_count chunk count
+ * @param[in] offset offset of value at unpacked valuelog
+ * @param[in] length length of value
+ * @return copy of value, caller should free it.
+ */
+uint8_t* tosdb_valuelog_read(const tosdb_table_t* tbl, uint64_t level, uint64_t sstable_id,
+                             const tosdb_block_valuelog_chunk_t* chunks, uint64_t chunk_count,
+                             uint64_t offset, uint64_t length);
+
+/**
+ * @brief reads and decompresses all chunks of valuelog into one buffer.
+ * @param[in] tbl table
+ * @param[in] chunks chunk table
+ * @param[in] chunk_count chunk count
+ * @return whole unpacked valuelog
+ */
+buffer_t* tosdb_valuelog_read_all(const tosdb_table_t* tbl, const tosdb_block_valuelog_chunk_t* chunks, uint64_t chunk_count);
+
 typedef struct tosdb_record_key_t {
     uint64_t column_id;
     uint64_t index_id;
@@ -542,8 +720,27 @@ boolean_t tosdb_record_search_set_destroy_cb(void * item);
 
 boolean_t tosdb_database_compact(const tosdb_database_t* db, tosdb_compaction_type_t type);
 boolean_t tosdb_table_compact(const tosdb_table_t* tbl, tosdb_compaction_type_t type);
-boolean_t tosdb_sstable_level_minor_compact(const tosdb_table_t* tbl, uint64_t level);
-boolean_t tosdb_sstable_level_major_compact(const tosdb_table_t* tbl, uint64_t level);
+
+/**
+ * @brief starts background compaction task which schedules level compactions by their scores
+ * @param[in] tdb tosdb
+ * @return true if task is started
+ */
+boolean_t tosdb_compaction_start(tosdb_t* tdb);
+
+/**
+ * @brief stops background compaction task, running compaction is finished first
+ * @param[in] tdb tosdb
+ */
+void tosdb_compaction_stop(tosdb_t* tdb);
+
+/**
+ * @brief disables background compaction of table and waits running one
+ * @param[in] tbl table
+ */
+void tosdb_compaction_table_disable(tosdb_table_t* tbl);
+boolean_t tosdb_sstable_level_minor_compact(tosdb_table_t* tbl, uint64_t level);
+boolean_t tosdb_sstable_level_major_compact(tosdb_table_t* tbl, uint64_t level);
 int8_t    tosdb_record_key_comparator(const void* item1, const void* item2);
 boolean_t tosdb_table_get_keys_internal(const tosdb_table_t* tbl, uint64_t key_index, set_t* keys, list_t* old_keys);
 
@@ -10,11 +10,119 @@
 #define ___TOSDB_WAL_H 0
 
 #include <types.h>
+#include <tosdb/tosdb.h>
+#include <tosdb/tosdb_internal.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*! default size of a wal region allocated from backend */
+#define TOSDB_WAL_REGION_SIZE (4ULL << 20)
+/*! pending wal size which triggers a group commit without explicit tosdb_commit call */
+#define TOSDB_WAL_GROUP_COMMIT_SIZE (64ULL << 10)
+
+/**
+ * @struct tosdb_block_wal_t
+ * @brief tosdb wal block
+ * @details wal blocks are appended into a wal region one after another. each block is one group commit.
+ * block header checksum is not used, whole block is protected with crc32c.
+ */
+typedef struct tosdb_block_wal_t {
+    tosdb_block_header_t header; ///< block header
+    uint64_t             generation; ///< wal generation, should be equal to superblock's wal generation
+    uint64_t             sequence; ///< sequence of block inside generation, starts from 1
+    uint64_t             region_location; ///< location of the region where this block resides
+    uint64_t             previous_region_location; ///< location of previous region of same generation
+    uint64_t             previous_region_size; ///< size of previous region of same generation
+    uint64_t             entry_count; ///< number of entries at this block @see tosdb_wal_entry_t
+    uint64_t             data_size; ///< size of entries
+    uint32_t             crc32c; ///< crc32c of whole block while this field is zero
+    uint32_t             reserved; ///< padding
+    uint8_t              data[]; ///< entries
+}__attribute__((packed, aligned(8))) tosdb_block_wal_t; ///< tosdb wal block
+
+_Static_assert(((sizeof(tosdb_block_wal_t) % 8) == 0), "wal block header size is not aligned");
+
+/**
+ * @struct tosdb_wal_entry_t
+ * @brief tosdb wal entry
+ * @details an entry is a serialized record (bson) with its table info. table limits are stored for opening
+ * lazy loaded tables while replaying.
+ */
+typedef struct tosdb_wal_entry_t {
+    uint64_t  entry_size; ///< size of entry with data, multiple of 8
+    uint64_t  database_id; ///< database id of record
+    uint64_t  table_id; ///< table id of record
+    uint64_t  max_record_count; ///< table max record count at memtable
+    uint64_t  max_valuelog_size; ///< table max valuelog size at memtable
+    uint64_t  max_memtable_count; ///< table max memtable count at memory
+    uint128_t record_id; ///< record id
+    boolean_t is_deleted; ///< record is deleted
+    uint8_t   reserved[7]; ///< padding
+    uint64_t  data_length; ///< length of serialized record
+    uint8_t   data[]; ///< serialized record
+}__attribute__((packed, aligned(8))) tosdb_wal_entry_t; ///< tosdb wal entry
+
+_Static_assert(((sizeof(tosdb_wal_entry_t) % 8) == 0), "wal entry size is not aligned");
+
+/**
+ * @brief creates wal of tosdb, wal region is not allocated until first commit.
+ * @param[in] tdb tosdb
+ * @return wal
+ */
+tosdb_wal_t* tosdb_wal_new(tosdb_t* tdb);
+
+/**
+ * @brief frees wal, pending entries are discarded.
+ * @param[in] wal wal to free
+ * @return true if succeed
+ */
+boolean_t tosdb_wal_free(tosdb_wal_t* wal);
+
+/**
+ * @brief reads wal regions of current generation and replays entries into memtables.
+ * @details databases and tables of entries are opened if they are lazy loaded. entries of tables which are not
+ * persisted before crash are dropped.
+ * @param[in] wal wal to replay
+ * @return true if succeed
+ */
+boolean_t tosdb_wal_replay(tosdb_wal_t* wal);
+
+/**
+ * @brief appends record to pending wal entries.
+ * @param[in] wal wal
+ * @param[in] record record to append
+ * @param[in] del is record deleted
+ * @param[out] ticket ticket of entry for tosdb_wal_commit
+ * @return true if succeed
+ */
+boolean_t tosdb_wal_append(tosdb_wal_t* wal, tosdb_record_t* record, boolean_t del, uint64_t* ticket);
+
+/**
+ * @brief commits pending entries until ticket with one backend write and flush.
+ * @details if another task has already committed the ticket, returns without any io (group commit).
+ * @param[in] wal wal
+ * @param[in] ticket ticket to wait, -1ULL means all appended entries
+ * @return true if succeed
+ */
+boolean_t tosdb_wal_commit(tosdb_wal_t* wal, uint64_t ticket);
+
+/**
+ * @brief commits pending entries if their size exceeds TOSDB_WAL_GROUP_COMMIT_SIZE
+ * @param[in] wal wal
+ * @return true if succeed
+ */
+boolean_t tosdb_wal_commit_if_needed(tosdb_wal_t* wal);
+
+/**
+ * @brief ends current wal generation, all memtables should be persisted before.
+ * @details superblock wal fields are updated at memory, caller should write superblock.
+ * @param[in] wal wal
+ * @return true if succeed
+ */
+boolean_t tosdb_wal_checkpoint(tosdb_wal_t* wal);
+
 #ifdef __cplusplus
 }
 #endif
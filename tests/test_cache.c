@@ -83,6 +83,27 @@ int32_t main(uint32_t argc, char_t** argv) {
         return -1;
     }
 
+    if(!cache_delete(cache, (void*)3)) {
+        print_error("key 3 not deleted");
+        cache_destroy(cache);
+
+        return -1;
+    }
+
+    if(cache_get(cache, (void*)3) != NULL) {
+        print_error("key 3 found after delete");
+        cache_destroy(cache);
+
+        return -1;
+    }
+
+    if(cache_delete(cache, (void*)3)) {
+        print_error("key 3 deleted twice");
+        cache_destroy(cache);
+
+        return -1;
+    }
+
     cache_destroy(cache);
 
     print_success("TESTS PASSED");
@@ -25,12 +25,31 @@
 #include <cache.h>
 #include <rbtree.h>
 #include <quicksort.h>
+#include <skiplist.h>
+#include <crc.h>
 
 int32_t main(uint32_t argc, char_t** argv);
 int32_t test_step1(uint32_t argc, char_t** argv);
 int32_t test_step2(uint32_t argc, char_t** argv);
 int32_t test_step3(uint32_t argc, char_t** argv);
 int32_t test_step4(uint32_t argc, char_t** argv);
+int32_t test_step5(void);
+int32_t test_step6(void);
+int32_t test_step7(void);
+int32_t test_step8(void);
+tosdb_t* test_tosdb_open(tosdb_backend_t* backend);
+boolean_t test_tosdb_close(tosdb_t* tosdb);
+tosdb_backend_t* test_backend_copy(tosdb_backend_t* backend);
+tosdb_table_t* test_kv_table_open(tosdb_t* tosdb, const char_t* name, uint64_t max_record_count, uint64_t max_valuelog_size, uint64_t max_memtable_count, boolean_t create);
+char_t* test_kv_value(const char_t* prefix, int64_t id);
+boolean_t test_kv_upsert(tosdb_table_t* tbl, int64_t id, const char_t* value);
+boolean_t test_kv_delete(tosdb_table_t* tbl, int64_t id);
+char_t* test_kv_get(tosdb_table_t* tbl, int64_t id);
+int64_t test_kv_scan(tosdb_table_t* tbl, const int64_t* lo, const int64_t* hi, tosdb_scan_direction_t direction, int64_t* ids, int64_t max_ids);
+boolean_t test_kv_compaction_check(tosdb_table_t* tbl);
+char_t* test_kv_long_value(int64_t id, uint64_t len);
+boolean_t test_kv_long_value_check(tosdb_table_t* tbl, int64_t id, uint64_t len);
+boolean_t test_kv_scan_check(tosdb_table_t* tbl, const int64_t* lo, const int64_t* hi, tosdb_scan_direction_t direction, const int64_t* expected, int64_t expected_count);
 
 
 #define TOSDB_CAP (32 << 20)
@@ -65,7 +84,6 @@ int32_t test_step1(uint32_t argc, char_t** argv) {
     tosdb_cache_config_t cc = {0};
     cc.bloomfilter_size = 2 << 20;
     cc.index_data_size = 4 << 20;
-    cc.secondary_index_data_size = 4 << 20;
     cc.valuelog_size = 16 << 20;
 
     if(!tosdb_cache_config_set(tosdb, &cc)) {
@@ -354,7 +372,6 @@ int32_t test_step2(uint32_t argc, char_t** argv) {
     tosdb_cache_config_t cc = {0};
     cc.bloomfilter_size = 2 << 20;
     cc.index_data_size = 4 << 20;
-    cc.secondary_index_data_size = 4 << 20;
     cc.valuelog_size = 16 << 20;
 
     if(!tosdb_cache_config_set(tosdb, &cc)) {
@@ -679,7 +696,6 @@ int32_t test_step3(uint32_t argc, char_t** argv) {
     tosdb_cache_config_t cc = {0};
     cc.bloomfilter_size = 2 << 20;
     cc.index_data_size = 4 << 20;
-    cc.secondary_index_data_size = 4 << 20;
     cc.valuelog_size = 16 << 20;
 
     if(!tosdb_cache_config_set(tosdb, &cc)) {
@@ -1119,7 +1135,6 @@ int32_t test_step4(uint32_t argc, char_t** argv) {
     tosdb_cache_config_t cc = {0};
     cc.bloomfilter_size = 2 << 20;
     cc.index_data_size = 4 << 20;
-    cc.secondary_index_data_size = 4 << 20;
     cc.valuelog_size = 16 << 20;
 
     if(!tosdb_cache_config_set(tosdb, &cc)) {
@@ -1287,6 +1302,931 @@ backend_failed:
     return pass?0:-1;
 }
 
+tosdb_t* test_tosdb_open(tosdb_backend_t* backend) {
+    tosdb_t* tosdb = tosdb_new(backend, COMPRESSION_TYPE_DEFLATE);
+
+    if(!tosdb) {
+        print_error("cannot create tosdb");
+
+        return NULL;
+    }
+
+    tosdb_cache_config_t cc = {0};
+    cc.bloomfilter_size = 2 << 20;
+    cc.index_data_size = 4 << 20;
+    cc.valuelog_size = 16 << 20;
+
+    if(!tosdb_cache_config_set(tosdb, &cc)) {
+        print_error("cannot set tosdb cache config");
+        test_tosdb_close(tosdb);
+
+        return NULL;
+    }
+
+    return tosdb;
+}
+
+boolean_t test_tosdb_close(tosdb_t* tosdb) {
+    boolean_t pass = true;
+
+    if(!tosdb_close(tosdb)) {
+        print_error("cannot close tosdb");
+        pass = false;
+    }
+
+    if(!tosdb_free(tosdb)) {
+        print_error("cannot free tosdb");
+        pass = false;
+    }
+
+    return pass;
+}
+
+tosdb_backend_t* test_backend_copy(tosdb_backend_t* backend) {
+    uint8_t* data = tosdb_backend_memory_get_contents(backend);
+
+    if(!data) {
+        print_error("cannot get backend data");
+
+        return NULL;
+    }
+
+    buffer_t* db_buffer = buffer_new_with_capacity(NULL, TOSDB_CAP);
+
+    if(!db_buffer) {
+        print_error("cannot create db buffer");
+        memory_free(data);
+
+        return NULL;
+    }
+
+    buffer_append_bytes(db_buffer, data, TOSDB_CAP);
+    memory_free(data);
+
+    tosdb_backend_t* res = tosdb_backend_memory_from_buffer(db_buffer);
+
+    if(!res) {
+        print_error("cannot create backend from buffer");
+        buffer_destroy(db_buffer);
+    }
+
+    return res;
+}
+
+tosdb_table_t* test_kv_table_open(tosdb_t* tosdb, const char_t* name, uint64_t max_record_count, uint64_t max_valuelog_size, uint64_t max_memtable_count, boolean_t create) {
+    tosdb_database_t* kvdb = tosdb_database_create_or_open(tosdb, "kvdb");
+
+    if(!kvdb) {
+        print_error("cannot create/open kvdb");
+
+        return NULL;
+    }
+
+    tosdb_table_t* tbl = tosdb_table_create_or_open(kvdb, name, max_record_count, max_valuelog_size, max_memtable_count);
+
+    if(!tbl) {
+        print_error("cannot create/open kv table");
+
+        return NULL;
+    }
+
+    if(!create) {
+        return tbl;
+    }
+
+    if(!tosdb_table_column_add(tbl, "id", DATA_TYPE_INT64)) {
+        print_error("cannot add id column to kv table");
+
+        return NULL;
+    }
+
+    if(!tosdb_table_column_add(tbl, "value", DATA_TYPE_STRING)) {
+        print_error("cannot add value column to kv table");
+
+        return NULL;
+    }
+
+    if(!tosdb_table_index_create(tbl, "id", TOSDB_INDEX_PRIMARY)) {
+        print_error("cannot add index for id to kv table");
+
+        return NULL;
+    }
+
+    return tbl;
+}
+
+char_t* test_kv_value(const char_t* prefix, int64_t id) {
+    char_t* id_str = itoa(id);
+
+    if(!id_str) {
+        return NULL;
+    }
+
+    char_t* res = strcat(prefix, id_str);
+
+    memory_free(id_str);
+
+    return res;
+}
+
+boolean_t test_kv_upsert(tosdb_table_t* tbl, int64_t id, const char_t* value) {
+    tosdb_record_t* rec = tosdb_table_create_record(tbl);
+
+    if(!rec) {
+        print_error("cannot create kv record");
+
+        return false;
+    }
+
+    boolean_t res = rec->set_int64(rec, "id", id) &&
+                    rec->set_string(rec, "value", value) &&
+                    rec->upsert_record(rec);
+
+    rec->destroy(rec);
+
+    if(!res) {
+        print_error("cannot upsert kv record");
+    }
+
+    return res;
+}
+
+boolean_t test_kv_delete(tosdb_table_t* tbl, int64_t id) {
+    tosdb_record_t* rec = tosdb_table_create_record(tbl);
+
+    if(!rec) {
+        print_error("cannot create kv record");
+
+        return false;
+    }
+
+    boolean_t res = rec->set_int64(rec, "id", id) && rec->delete_record(rec);
+
+    rec->destroy(rec);
+
+    if(!res) {
+        print_error("cannot delete kv record");
+    }
+
+    return res;
+}
+
+char_t* test_kv_get(tosdb_table_t* tbl, int64_t id) {
+    tosdb_record_t* rec = tosdb_table_create_record(tbl);
+
+    if(!rec) {
+        print_error("cannot create kv record");
+
+        return NULL;
+    }
+
+    char_t* value = NULL;
+
+    if(rec->set_int64(rec, "id", id) && rec->get_record(rec)) {
+        if(!rec->get_string(rec, "value", &value)) {
+            value = NULL;
+        }
+    }
+
+    rec->destroy(rec);
+
+    return value;
+}
+
+#define TEST_WAL_RECORD_COUNT 100
+
+int32_t test_step5(void) {
+    boolean_t pass = true;
+
+    tosdb_backend_t* backend = tosdb_backend_memory_new(TOSDB_CAP);
+
+    if(!backend) {
+        print_error("cannot create backend");
+
+        return -1;
+    }
+
+    tosdb_backend_t* crash_backend = NULL;
+
+    tosdb_t* tosdb = test_tosdb_open(backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    // table metadata is persisted by close, records of next open stay only at wal
+    if(!test_kv_table_open(tosdb, "waltable", 1 << 10, 128 << 10, 8, true)) {
+        pass = false;
+    }
+
+    if(!test_tosdb_close(tosdb) || !pass) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tosdb = test_tosdb_open(backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tosdb_table_t* tbl = test_kv_table_open(tosdb, "waltable", 1 << 10, 128 << 10, 8, false);
+
+    if(!tbl) {
+        pass = false;
+
+        goto tdb_close;
+    }
+
+    for(int64_t i = 1; i <= TEST_WAL_RECORD_COUNT && pass; i++) {
+        char_t* value = test_kv_value("value-", i);
+
+        pass = value && test_kv_upsert(tbl, i, value);
+
+        memory_free(value);
+    }
+
+    // replay should apply entries in order, so last version and deletion win
+    pass = pass && test_kv_upsert(tbl, 3, "updated-3") && test_kv_delete(tbl, 7);
+
+    if(!pass) {
+        goto tdb_close;
+    }
+
+    if(!tosdb_commit(tosdb)) {
+        print_error("cannot commit wal");
+        pass = false;
+
+        goto tdb_close;
+    }
+
+    // image taken before close is same as a crash after commit, memtables are not persisted
+    crash_backend = test_backend_copy(backend);
+
+    if(!crash_backend) {
+        pass = false;
+    }
+
+tdb_close:
+    if(!test_tosdb_close(tosdb)) {
+        pass = false;
+    }
+
+    if(!pass) {
+        goto backend_close;
+    }
+
+    tosdb = test_tosdb_open(crash_backend);
+
+    if(!tosdb) {
+        print_error("cannot open tosdb with wal replay");
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tbl = test_kv_table_open(tosdb, "waltable", 1 << 10, 128 << 10, 8, false);
+
+    if(!tbl) {
+        pass = false;
+    }
+
+    for(int64_t i = 1; i <= TEST_WAL_RECORD_COUNT && pass; i++) {
+        char_t* res = test_kv_get(tbl, i);
+
+        if(i == 7) {
+            if(res) {
+                print_error("deleted record is replayed");
+                pass = false;
+            }
+        } else {
+            char_t* value = test_kv_value(i == 3 ? "updated-" : "value-", i);
+
+            if(!res || !value || strcmp(res, value) != 0) {
+                print_error("record is not replayed from wal");
+                printf("id: %lli value: %s\n", i, res);
+                pass = false;
+            }
+
+            memory_free(value);
+        }
+
+        memory_free(res);
+    }
+
+    if(!test_tosdb_close(tosdb)) {
+        pass = false;
+    }
+
+backend_close:
+    if(crash_backend && !tosdb_backend_close(crash_backend)) {
+        pass = false;
+    }
+
+    if(!tosdb_backend_close(backend)) {
+        pass = false;
+    }
+
+    if(pass) {
+        print_success("WAL REPLAY TESTS PASSED");
+    } else {
+        print_error("WAL REPLAY TESTS FAILED");
+    }
+
+    return pass?0:-1;
+}
+
+int64_t test_kv_scan(tosdb_table_t* tbl, const int64_t* lo, const int64_t* hi, tosdb_scan_direction_t direction, int64_t* ids, int64_t max_ids) {
+    tosdb_record_t* lo_rec = NULL;
+    tosdb_record_t* hi_rec = NULL;
+    int64_t count = -1;
+
+    if(lo) {
+        lo_rec = tosdb_table_create_record(tbl);
+
+        if(!lo_rec || !lo_rec->set_int64(lo_rec, "id", *lo)) {
+            print_error("cannot create scan lower bound");
+
+            goto bounds_destroy;
+        }
+    }
+
+    if(hi) {
+        hi_rec = tosdb_table_create_record(tbl);
+
+        if(!hi_rec || !hi_rec->set_int64(hi_rec, "id", *hi)) {
+            print_error("cannot create scan upper bound");
+
+            goto bounds_destroy;
+        }
+    }
+
+    iterator_t* iter = tosdb_table_scan(tbl, "id", lo_rec, hi_rec, direction);
+
+    if(!iter) {
+        print_error("cannot create scan iterator");
+
+        goto bounds_destroy;
+    }
+
+    count = 0;
+
+    while(iter->end_of_iterator(iter) != 0) {
+        tosdb_record_t* rec = (tosdb_record_t*)iter->get_item(iter);
+        int64_t id = 0;
+
+        if(!rec || !rec->get_int64(rec, "id", &id) || count == max_ids) {
+            print_error("cannot get scan item");
+            count = -1;
+
+            break;
+        }
+
+        ids[count++] = id;
+
+        iter = iter->next(iter);
+    }
+
+    iter->destroy(iter);
+
+bounds_destroy:
+    if(lo_rec) {
+        lo_rec->destroy(lo_rec);
+    }
+
+    if(hi_rec) {
+        hi_rec->destroy(hi_rec);
+    }
+
+    return count;
+}
+
+boolean_t test_kv_scan_check(tosdb_table_t* tbl, const int64_t* lo, const int64_t* hi, tosdb_scan_direction_t direction, const int64_t* expected, int64_t expected_count) {
+    int64_t ids[128] = {0};
+
+    int64_t count = test_kv_scan(tbl, lo, hi, direction, ids, 128);
+
+    if(count != expected_count) {
+        print_error("scan item count mismatch");
+        printf("expected: %lli found: %lli\n", expected_count, count);
+
+        return false;
+    }
+
+    for(int64_t i = 0; i < count; i++) {
+        if(ids[i] != expected[i]) {
+            print_error("scan item order mismatch");
+            printf("position: %lli expected: %lli found: %lli\n", i, expected[i], ids[i]);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#define TEST_SCAN_RECORD_COUNT 50
+
+int32_t test_step6(void) {
+    boolean_t pass = true;
+
+    tosdb_backend_t* backend = tosdb_backend_memory_new(TOSDB_CAP);
+
+    if(!backend) {
+        print_error("cannot create backend");
+
+        return -1;
+    }
+
+    tosdb_t* tosdb = test_tosdb_open(backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    // small memtables spread keys over sstables and memtables, so scan merges all of them
+    tosdb_table_t* tbl = test_kv_table_open(tosdb, "scantable", 8, 128 << 10, 2, true);
+
+    if(!tbl) {
+        pass = false;
+
+        goto tdb_close;
+    }
+
+    // even ids from 0 to 98, inserted in reverse to check ordering is not insertion order
+    for(int64_t i = TEST_SCAN_RECORD_COUNT - 1; i >= 0 && pass; i--) {
+        char_t* value = test_kv_value("value-", i * 2);
+
+        pass = value && test_kv_upsert(tbl, i * 2, value);
+
+        memory_free(value);
+    }
+
+    pass = pass && test_kv_upsert(tbl, 20, "updated-20") && test_kv_delete(tbl, 40);
+
+    if(!pass) {
+        goto tdb_close;
+    }
+
+    tosdb_compaction_stats_t stats = {0};
+
+    if(!tosdb_compaction_stats_get(tosdb, &stats) || !stats.flushed_bytes) {
+        print_error("scan table should have flushed sstables");
+        pass = false;
+
+        goto tdb_close;
+    }
+
+    int64_t expected[TEST_SCAN_RECORD_COUNT] = {0};
+    int64_t expected_count = 0;
+
+    // bounds are inclusive
+    int64_t lo = 10;
+    int64_t hi = 30;
+
+    for(int64_t id = lo; id <= hi; id += 2) {
+        expected[expected_count++] = id;
+    }
+
+    if(!test_kv_scan_check(tbl, &lo, &hi, TOSDB_SCAN_DIRECTION_FORWARD, expected, expected_count)) {
+        print_error("forward scan of [10, 30] failed");
+        pass = false;
+    }
+
+    // missing bounds and deleted key are skipped, backward scan returns keys descending
+    lo = 31;
+    hi = 61;
+    expected_count = 0;
+
+    for(int64_t id = 60; id >= 32; id -= 2) {
+        if(id != 40) {
+            expected[expected_count++] = id;
+        }
+    }
+
+    if(!test_kv_scan_check(tbl, &lo, &hi, TOSDB_SCAN_DIRECTION_BACKWARD, expected, expected_count)) {
+        print_error("backward scan of [31, 61] failed");
+        pass = false;
+    }
+
+    expected_count = 0;
+
+    for(int64_t id = 0; id < TEST_SCAN_RECORD_COUNT * 2; id += 2) {
+        if(id != 40) {
+            expected[expected_count++] = id;
+        }
+    }
+
+    if(!test_kv_scan_check(tbl, NULL, NULL, TOSDB_SCAN_DIRECTION_FORWARD, expected, expected_count)) {
+        print_error("unbounded forward scan failed");
+        pass = false;
+    }
+
+    lo = 41;
+    hi = 41;
+
+    if(!test_kv_scan_check(tbl, &lo, &hi, TOSDB_SCAN_DIRECTION_FORWARD, expected, 0)) {
+        print_error("scan of empty range failed");
+        pass = false;
+    }
+
+    // scan should return newest version of an updated key
+    lo = 20;
+    hi = 20;
+
+    if(!test_kv_scan_check(tbl, &lo, &hi, TOSDB_SCAN_DIRECTION_FORWARD, &lo, 1)) {
+        print_error("scan of single key failed");
+        pass = false;
+    }
+
+    char_t* res = test_kv_get(tbl, 20);
+
+    if(!res || strcmp(res, "updated-20") != 0) {
+        print_error("updated record is not found");
+        pass = false;
+    }
+
+    memory_free(res);
+
+tdb_close:
+    if(!test_tosdb_close(tosdb)) {
+        pass = false;
+    }
+
+backend_close:
+    if(!tosdb_backend_close(backend)) {
+        pass = false;
+    }
+
+    if(pass) {
+        print_success("RANGE SCAN TESTS PASSED");
+    } else {
+        print_error("RANGE SCAN TESTS FAILED");
+    }
+
+    return pass?0:-1;
+}
+
+#define TEST_COMPACTION_RECORD_COUNT 64
+
+boolean_t test_kv_compaction_check(tosdb_table_t* tbl) {
+    boolean_t pass = true;
+
+    for(int64_t i = 1; i <= TEST_COMPACTION_RECORD_COUNT && pass; i++) {
+        char_t* res = test_kv_get(tbl, i);
+
+        if(i % 8 == 0) {
+            if(res) {
+                print_error("deleted record is found after compaction");
+                printf("id: %lli value: %s\n", i, res);
+                pass = false;
+            }
+        } else {
+            char_t* value = test_kv_value(i % 2 ? "v1-" : "v2-", i);
+
+            if(!res || !value || strcmp(res, value) != 0) {
+                print_error("latest version is not found after compaction");
+                printf("id: %lli value: %s\n", i, res);
+                pass = false;
+            }
+
+            memory_free(value);
+        }
+
+        memory_free(res);
+    }
+
+    int64_t ids[TEST_COMPACTION_RECORD_COUNT] = {0};
+
+    int64_t count = test_kv_scan(tbl, NULL, NULL, TOSDB_SCAN_DIRECTION_FORWARD, ids, TEST_COMPACTION_RECORD_COUNT);
+
+    if(count != TEST_COMPACTION_RECORD_COUNT - TEST_COMPACTION_RECORD_COUNT / 8) {
+        print_error("live record count mismatch after compaction");
+        printf("count: %lli\n", count);
+        pass = false;
+    }
+
+    return pass;
+}
+
+int32_t test_step7(void) {
+    boolean_t pass = true;
+
+    tosdb_backend_t* backend = tosdb_backend_memory_new(TOSDB_CAP);
+
+    if(!backend) {
+        print_error("cannot create backend");
+
+        return -1;
+    }
+
+    tosdb_backend_t* tomb_backend = tosdb_backend_memory_new(TOSDB_CAP);
+
+    if(!tomb_backend) {
+        print_error("cannot create backend");
+        tosdb_backend_close(backend);
+
+        return -1;
+    }
+
+    tosdb_t* tosdb = test_tosdb_open(backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tosdb_table_t* tbl = test_kv_table_open(tosdb, "compacttable", 8, 128 << 10, 2, true);
+
+    pass = tbl != NULL;
+
+    // three versions are spread over sstables: v1 for all, v2 for even ids, deletion for multiples of 8
+    for(int64_t i = 1; i <= TEST_COMPACTION_RECORD_COUNT && pass; i++) {
+        char_t* value = test_kv_value("v1-", i);
+
+        pass = value && test_kv_upsert(tbl, i, value);
+
+        memory_free(value);
+    }
+
+    for(int64_t i = 2; i <= TEST_COMPACTION_RECORD_COUNT && pass; i += 2) {
+        char_t* value = test_kv_value("v2-", i);
+
+        pass = value && test_kv_upsert(tbl, i, value);
+
+        memory_free(value);
+    }
+
+    for(int64_t i = 8; i <= TEST_COMPACTION_RECORD_COUNT && pass; i += 8) {
+        pass = test_kv_delete(tbl, i);
+    }
+
+    // close persists memtables, so compaction sees every version
+    if(!test_tosdb_close(tosdb) || !pass) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tosdb = test_tosdb_open(backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tbl = test_kv_table_open(tosdb, "compacttable", 8, 128 << 10, 2, false);
+
+    if(!tbl || !tosdb_compact(tosdb, TOSDB_COMPACTION_TYPE_MAJOR)) {
+        print_error("cannot compact tosdb");
+        pass = false;
+
+        goto tdb_close;
+    }
+
+    tosdb_compaction_stats_t stats = {0};
+
+    if(!tosdb_compaction_stats_get(tosdb, &stats) || !stats.compaction_count || stats.failed_compaction_count || !stats.compaction_written_bytes) {
+        print_error("compaction stats mismatch");
+        pass = false;
+    }
+
+    pass &= test_kv_compaction_check(tbl);
+
+tdb_close:
+    if(!test_tosdb_close(tosdb)) {
+        pass = false;
+    }
+
+    if(!pass) {
+        goto backend_close;
+    }
+
+    // compacted sstable lists should be persisted
+    tosdb = test_tosdb_open(backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tbl = test_kv_table_open(tosdb, "compacttable", 8, 128 << 10, 2, false);
+
+    pass = tbl && test_kv_compaction_check(tbl);
+
+    if(!test_tosdb_close(tosdb) || !pass) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    // when every record is deleted, major compaction drops tombstones and writes no sstable
+    tosdb = test_tosdb_open(tomb_backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tbl = test_kv_table_open(tosdb, "tombtable", 8, 128 << 10, 2, true);
+
+    pass = tbl != NULL;
+
+    for(int64_t i = 1; i <= TEST_COMPACTION_RECORD_COUNT && pass; i++) {
+        pass = test_kv_upsert(tbl, i, "tomb") && test_kv_delete(tbl, i);
+    }
+
+    if(!test_tosdb_close(tosdb) || !pass) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tosdb = test_tosdb_open(tomb_backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tbl = test_kv_table_open(tosdb, "tombtable", 8, 128 << 10, 2, false);
+
+    if(!tbl || !tosdb_compact(tosdb, TOSDB_COMPACTION_TYPE_MAJOR)) {
+        print_error("cannot compact tosdb");
+        pass = false;
+    } else {
+        memory_memclean(&stats, sizeof(stats));
+
+        if(!tosdb_compaction_stats_get(tosdb, &stats) || !stats.compaction_count || stats.compaction_written_bytes) {
+            print_error("tombstones are not dropped by major compaction");
+            printf("compaction count: %lli written bytes: %lli\n", stats.compaction_count, stats.compaction_written_bytes);
+            pass = false;
+        }
+
+        int64_t ids[1] = {0};
+
+        if(test_kv_scan(tbl, NULL, NULL, TOSDB_SCAN_DIRECTION_FORWARD, ids, 1) != 0) {
+            print_error("deleted records are found after compaction");
+            pass = false;
+        }
+    }
+
+    if(!test_tosdb_close(tosdb)) {
+        pass = false;
+    }
+
+backend_close:
+    if(!tosdb_backend_close(tomb_backend)) {
+        pass = false;
+    }
+
+    if(!tosdb_backend_close(backend)) {
+        pass = false;
+    }
+
+    if(pass) {
+        print_success("COMPACTION TESTS PASSED");
+    } else {
+        print_error("COMPACTION TESTS FAILED");
+    }
+
+    return pass?0:-1;
+}
+
+#define TEST_VALUELOG_RECORD_COUNT 48
+#define TEST_VALUELOG_BIG_ID        1000
+#define TEST_VALUELOG_BIG_LENGTH    (40 << 10)
+
+char_t* test_kv_long_value(int64_t id, uint64_t len) {
+    char_t* value = memory_malloc(len + 1);
+
+    if(!value) {
+        return NULL;
+    }
+
+    for(uint64_t i = 0; i < len; i++) {
+        value[i] = 'a' + (id + i) % 26;
+    }
+
+    return value;
+}
+
+boolean_t test_kv_long_value_check(tosdb_table_t* tbl, int64_t id, uint64_t len) {
+    char_t* value = test_kv_long_value(id, len);
+    char_t* res = test_kv_get(tbl, id);
+
+    boolean_t pass = value && res && strlen(res) == len && strcmp(res, value) == 0;
+
+    if(!pass) {
+        print_error("value mismatch at valuelog chunk");
+        printf("id: %lli length: %lli found length: %lli\n", id, len, res ? strlen(res) : 0);
+    }
+
+    memory_free(value);
+    memory_free(res);
+
+    return pass;
+}
+
+int32_t test_step8(void) {
+    boolean_t pass = true;
+
+    tosdb_backend_t* backend = tosdb_backend_memory_new(TOSDB_CAP);
+
+    if(!backend) {
+        print_error("cannot create backend");
+
+        return -1;
+    }
+
+    tosdb_t* tosdb = test_tosdb_open(backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    // values are about 200k, so one sstable has several chunks and big value is larger than a chunk
+    tosdb_table_t* tbl = test_kv_table_open(tosdb, "vltable", 1 << 10, 1 << 20, 8, true);
+
+    pass = tbl != NULL;
+
+    for(int64_t i = 1; i <= TEST_VALUELOG_RECORD_COUNT && pass; i++) {
+        uint64_t len = 1000 + (i * 997) % 7000;
+        char_t* value = test_kv_long_value(i, len);
+
+        pass = value && test_kv_upsert(tbl, i, value);
+
+        memory_free(value);
+    }
+
+    if(pass) {
+        char_t* value = test_kv_long_value(TEST_VALUELOG_BIG_ID, TEST_VALUELOG_BIG_LENGTH);
+
+        pass = value && test_kv_upsert(tbl, TEST_VALUELOG_BIG_ID, value);
+
+        memory_free(value);
+    }
+
+    // close persists memtable, so gets below read values from sstable chunks
+    if(!test_tosdb_close(tosdb) || !pass) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tosdb = test_tosdb_open(backend);
+
+    if(!tosdb) {
+        pass = false;
+
+        goto backend_close;
+    }
+
+    tbl = test_kv_table_open(tosdb, "vltable", 1 << 10, 1 << 20, 8, false);
+
+    pass = tbl && test_kv_long_value_check(tbl, TEST_VALUELOG_BIG_ID, TEST_VALUELOG_BIG_LENGTH);
+
+    // reverse order reads chunks out of order, cached and uncached
+    for(int64_t i = TEST_VALUELOG_RECORD_COUNT; i >= 1 && pass; i--) {
+        pass = test_kv_long_value_check(tbl, i, 1000 + (i * 997) % 7000);
+    }
+
+    for(int64_t i = 1; i <= TEST_VALUELOG_RECORD_COUNT && pass; i += 7) {
+        pass = test_kv_long_value_check(tbl, i, 1000 + (i * 997) % 7000);
+    }
+
+    if(!test_tosdb_close(tosdb)) {
+        pass = false;
+    }
+
+backend_close:
+    if(!tosdb_backend_close(backend)) {
+        pass = false;
+    }
+
+    if(pass) {
+        print_success("VALUELOG CHUNK TESTS PASSED");
+    } else {
+        print_error("VALUELOG CHUNK TESTS FAILED");
+    }
+
+    return pass?0:-1;
+}
+
 int32_t main(uint32_t argc, char_t** argv) {
     if(test_step1(argc, argv) != 0) {
         print_error("test step 1 failed");
@@ -1312,5 +2252,29 @@ int32_t main(uint32_t argc, char_t** argv) {
         return -1;
     }
 
+    if(test_step5() != 0) {
+        print_error("test step 5 failed");
+
+        return -1;
+    }
+
+    if(test_step6() != 0) {
+        print_error("test step 6 failed");
+
+        return -1;
+    }
+
+    if(test_step7() != 0) {
+        print_error("test step 7 failed");
+
+        return -1;
+    }
+
+    if(test_step8() != 0) {
+        print_error("test step 8 failed");
+
+        return -1;
+    }
+
     return 0;
 }
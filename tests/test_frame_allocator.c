@@ -0,0 +1,357 @@
+/*
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#define RAMSIZE (64 << 20)
+#include "setup.h"
+#include <memory/frame.h>
+#include <memory/paging.h>
+#include <list.h>
+#include <bplustree.h>
+#include <strings.h>
+#include <utils.h>
+
+/*! frame count of test memory, one order 10 block */
+#define TEST_FA_FRAME_COUNT 1024
+/*! test memory size */
+#define TEST_FA_SIZE        (TEST_FA_FRAME_COUNT * FRAME_SIZE)
+/*! heap size of frame allocator, allocator has no destroy so its heap is dropped at end */
+#define TEST_FA_HEAP_SIZE   (1 << 20)
+
+int32_t            main(void);
+uint32_t           apic_get_local_apic_id(void);
+frame_allocator_t* test_fa_create(memory_heap_t* heap, uint64_t base);
+frame_t*           test_fa_alloc(frame_allocator_t* fa, uint64_t count);
+boolean_t          test_fa_release(frame_allocator_t* fa, uint64_t address, uint64_t count);
+boolean_t          test_fa_check_counts(frame_allocator_t* fa, uint64_t allocated);
+boolean_t          test_fa_mixed_orders(frame_allocator_t* fa);
+boolean_t          test_fa_coalescing(frame_allocator_t* fa, uint64_t base);
+boolean_t          test_fa_double_release(frame_allocator_t* fa);
+
+uint32_t apic_get_local_apic_id(void) {
+    return 0;
+}
+
+int8_t memory_paging_add_va_for_frame_ext(memory_page_table_context_t* table_context, uint64_t va_start, frame_t* frm, memory_paging_page_type_t type) {
+    UNUSED(table_context);
+    UNUSED(va_start);
+    UNUSED(frm);
+    UNUSED(type);
+
+    return -1;
+}
+
+efi_memory_descriptor_t test_fa_mmap[1];
+system_info_t test_fa_sysinfo;
+memory_heap_t* test_fa_heap = NULL;
+
+frame_allocator_t* test_fa_create(memory_heap_t* heap, uint64_t base) {
+    test_fa_mmap[0].type = EFI_CONVENTIONAL_MEMORY;
+    test_fa_mmap[0].physical_start = base;
+    test_fa_mmap[0].page_count = TEST_FA_FRAME_COUNT;
+
+    test_fa_sysinfo.mmap_data = (uint8_t*)test_fa_mmap;
+    test_fa_sysinfo.mmap_size = sizeof(test_fa_mmap);
+    test_fa_sysinfo.mmap_descriptor_size = sizeof(efi_memory_descriptor_t);
+
+    SYSTEM_INFO = &test_fa_sysinfo;
+
+    return frame_allocator_new_ext(heap);
+}
+
+frame_t* test_fa_alloc(frame_allocator_t* fa, uint64_t count) {
+    frame_t* f = NULL;
+
+    if(fa->allocate_frame_by_count(fa, count, FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_USED, &f, NULL) != 0) {
+        return NULL;
+    }
+
+    return f;
+}
+
+boolean_t test_fa_release(frame_allocator_t* fa, uint64_t address, uint64_t count) {
+    frame_t f = {.frame_address = address, .frame_count = count};
+
+    return fa->release_frame(fa, &f) == 0;
+}
+
+boolean_t test_fa_check_counts(frame_allocator_t* fa, uint64_t allocated) {
+    uint64_t total = fa->get_total_frame_count(fa);
+    uint64_t used = fa->get_allocated_frame_count(fa);
+    uint64_t free = fa->get_free_frame_count(fa);
+
+    if(total != TEST_FA_FRAME_COUNT || used != allocated || free != total - allocated) {
+        print_error("frame counts mismatch total 0x%llx allocated 0x%llx free 0x%llx expected allocated 0x%llx", total, used, free, allocated);
+
+        return false;
+    }
+
+    return true;
+}
+
+boolean_t test_fa_mixed_orders(frame_allocator_t* fa) {
+    const uint64_t counts[] = {2, 3, 8, 16, 5, 64, 200, 32};
+    const uint64_t count_len = sizeof(counts) / sizeof(counts[0]);
+
+    frame_t* frms[sizeof(counts) / sizeof(counts[0])] = {0};
+    uint64_t allocated = 0;
+    boolean_t pass = true;
+
+    for(uint64_t i = 0; i < count_len && pass; i++) {
+        frms[i] = test_fa_alloc(fa, counts[i]);
+
+        if(!frms[i] || frms[i]->frame_count != counts[i]) {
+            print_error("cannot allocate 0x%llx frames", counts[i]);
+            pass = false;
+
+            break;
+        }
+
+        allocated += counts[i];
+
+        // block starts are aligned to count rounded up to power of two
+        uint64_t align = 1;
+
+        while(align < counts[i]) {
+            align <<= 1;
+        }
+
+        if((frms[i]->frame_address / FRAME_SIZE) % align) {
+            print_error("block 0x%llx of 0x%llx frames is not aligned", frms[i]->frame_address, counts[i]);
+            pass = false;
+        }
+
+        for(uint64_t j = 0; j < i; j++) {
+            uint64_t s1 = frms[i]->frame_address;
+            uint64_t e1 = s1 + frms[i]->frame_count * FRAME_SIZE;
+            uint64_t s2 = frms[j]->frame_address;
+            uint64_t e2 = s2 + frms[j]->frame_count * FRAME_SIZE;
+
+            if(s1 < e2 && s2 < e1) {
+                print_error("blocks 0x%llx and 0x%llx overlap", s1, s2);
+                pass = false;
+            }
+        }
+    }
+
+    pass &= test_fa_check_counts(fa, allocated);
+
+    // release in a different order than allocation, unused tails of blocks should merge back too
+    for(uint64_t i = 0; i < count_len; i += 2) {
+        if(frms[i] && !test_fa_release(fa, frms[i]->frame_address, frms[i]->frame_count)) {
+            print_error("cannot release 0x%llx frames", frms[i]->frame_count);
+            pass = false;
+        }
+    }
+
+    for(uint64_t i = 1; i < count_len; i += 2) {
+        if(frms[i] && !test_fa_release(fa, frms[i]->frame_address, frms[i]->frame_count)) {
+            print_error("cannot release 0x%llx frames", frms[i]->frame_count);
+            pass = false;
+        }
+    }
+
+    for(uint64_t i = 0; i < count_len; i++) {
+        memory_free_ext(test_fa_heap, frms[i]);
+    }
+
+    pass &= test_fa_check_counts(fa, 0);
+
+    if(pass) {
+        print_success("mixed order allocations passed");
+    }
+
+    return pass;
+}
+
+boolean_t test_fa_coalescing(frame_allocator_t* fa, uint64_t base) {
+    boolean_t pass = true;
+
+    // whole memory is one block only if every released piece merged with its buddies
+    frame_t* all = test_fa_alloc(fa, TEST_FA_FRAME_COUNT);
+
+    if(!all || all->frame_address != base) {
+        print_error("released blocks are not merged");
+
+        memory_free_ext(test_fa_heap, all);
+
+        return false;
+    }
+
+    // release halves as pieces of different orders
+    uint64_t half = TEST_FA_FRAME_COUNT / 2;
+
+    for(uint64_t i = 0; i < half; i += 128) {
+        pass &= test_fa_release(fa, base + i * FRAME_SIZE, 128);
+    }
+
+    pass &= test_fa_check_counts(fa, half);
+
+    frame_t* f = test_fa_alloc(fa, TEST_FA_FRAME_COUNT);
+
+    if(f) {
+        print_error("whole memory is allocated while half of it is used");
+        memory_free_ext(test_fa_heap, f);
+        pass = false;
+    }
+
+    f = test_fa_alloc(fa, half);
+
+    if(!f || f->frame_address != base) {
+        print_error("released quarter blocks are not merged into half block");
+        pass = false;
+    }
+
+    if(f) {
+        pass &= test_fa_release(fa, f->frame_address, f->frame_count);
+        memory_free_ext(test_fa_heap, f);
+    }
+
+    pass &= test_fa_release(fa, base + half * FRAME_SIZE, half / 2);
+    pass &= test_fa_release(fa, base + (half + half / 2) * FRAME_SIZE, half / 2);
+
+    memory_free_ext(test_fa_heap, all);
+
+    pass &= test_fa_check_counts(fa, 0);
+
+    all = test_fa_alloc(fa, TEST_FA_FRAME_COUNT);
+
+    if(!all || all->frame_address != base) {
+        print_error("released halves are not merged");
+        pass = false;
+    }
+
+    if(all) {
+        pass &= test_fa_release(fa, all->frame_address, all->frame_count);
+        memory_free_ext(test_fa_heap, all);
+    }
+
+    pass &= test_fa_check_counts(fa, 0);
+
+    if(pass) {
+        print_success("buddy coalescing passed");
+    }
+
+    return pass;
+}
+
+boolean_t test_fa_double_release(frame_allocator_t* fa) {
+    boolean_t pass = true;
+
+    frame_t* blk = test_fa_alloc(fa, 4);
+    frame_t* single = test_fa_alloc(fa, 1);
+
+    if(!blk || !single) {
+        print_error("cannot allocate frames for double release");
+        memory_free_ext(test_fa_heap, blk);
+        memory_free_ext(test_fa_heap, single);
+
+        return false;
+    }
+
+    if(!test_fa_release(fa, blk->frame_address, blk->frame_count)) {
+        print_error("cannot release block");
+        pass = false;
+    }
+
+    if(test_fa_release(fa, blk->frame_address, blk->frame_count)) {
+        print_error("double release of block is accepted");
+        pass = false;
+    }
+
+    // single frames go to hot frame cache of cpu
+    if(!test_fa_release(fa, single->frame_address, 1)) {
+        print_error("cannot release single frame");
+        pass = false;
+    }
+
+    if(test_fa_release(fa, single->frame_address, 1)) {
+        print_error("double release of cached frame is accepted");
+        pass = false;
+    }
+
+    pass &= test_fa_check_counts(fa, 0);
+
+    // cached frame should be served again, and only once
+    frame_t* f1 = test_fa_alloc(fa, 1);
+    frame_t* f2 = test_fa_alloc(fa, 1);
+
+    if(!f1 || !f2 || f1->frame_address == f2->frame_address) {
+        print_error("hot frame cache returned same frame twice");
+        pass = false;
+    }
+
+    if(f1) {
+        pass &= test_fa_release(fa, f1->frame_address, 1);
+    }
+
+    if(f2) {
+        pass &= test_fa_release(fa, f2->frame_address, 1);
+    }
+
+    pass &= test_fa_check_counts(fa, 0);
+
+    memory_free_ext(test_fa_heap, f1);
+    memory_free_ext(test_fa_heap, f2);
+    memory_free_ext(test_fa_heap, blk);
+    memory_free_ext(test_fa_heap, single);
+
+    if(pass) {
+        print_success("double release rejection passed");
+    }
+
+    return pass;
+}
+
+int32_t main(void) {
+    // frames are taken from test heap, a whole order 10 block is needed for coalescing checks
+    uint8_t* mem = memory_malloc(TEST_FA_SIZE * 2);
+
+    if(!mem) {
+        print_error("cannot allocate test memory");
+
+        return -1;
+    }
+
+    uint64_t base = ((uint64_t)mem + TEST_FA_SIZE - 1) & ~((uint64_t)TEST_FA_SIZE - 1);
+
+    uint8_t* heap_mem = memory_malloc(TEST_FA_HEAP_SIZE);
+
+    if(heap_mem) {
+        test_fa_heap = memory_create_heap_simple((size_t)heap_mem, (size_t)heap_mem + TEST_FA_HEAP_SIZE);
+    }
+
+    frame_allocator_t* fa = NULL;
+
+    if(test_fa_heap) {
+        fa = test_fa_create(test_fa_heap, base);
+    }
+
+    if(!fa) {
+        print_error("cannot create frame allocator");
+        memory_free(heap_mem);
+        memory_free(mem);
+
+        return -1;
+    }
+
+    boolean_t pass = test_fa_check_counts(fa, 0);
+
+    pass &= test_fa_mixed_orders(fa);
+    pass &= test_fa_coalescing(fa, base);
+    pass &= test_fa_double_release(fa);
+
+    SYSTEM_INFO = NULL;
+
+    memory_free(heap_mem);
+    memory_free(mem);
+
+    if(pass) {
+        print_success("TESTS PASSED");
+    } else {
+        print_error("TESTS FAILED");
+    }
+
+    return pass?0:-1;
+}
@@ -0,0 +1,333 @@
+/*
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#define RAMSIZE (64 << 20)
+
+#include "setup.h"
+#include <strings.h>
+
+#define TEST_MEMORY_SIMD_BUFFER_SIZE (8 << 20)
+#define TEST_MEMORY_SIMD_ROUNDS      (64 << 20)
+
+int  main(void);
+void legacy_memcopy(const void* source, void* destination, size_t size);
+void legacy_memset(void* address, uint8_t value, size_t size);
+int8_t legacy_memcompare(const void* mem1, const void* mem2, size_t size);
+size_t legacy_strlen(const char_t* string);
+int8_t legacy_strcmp(const char_t* string1, const char_t* string2);
+boolean_t test_memory_simd_check(uint8_t* src, uint8_t* dst);
+boolean_t test_memory_simd_check_strings(char_t* str1, char_t* str2);
+void test_memory_simd_bench(uint8_t* src, uint8_t* dst, size_t size);
+
+// previous versions, kept here as benchmark baselines
+
+void legacy_memcopy(const void* source, void* destination, size_t size) {
+    const volatile uint8_t* s = source;
+    volatile uint8_t* d = destination;
+
+    for(size_t i = 0; i < size; i++) {
+        d[i] = s[i];
+    }
+}
+
+void legacy_memset(void* address, uint8_t value, size_t size) {
+    asm volatile ("rep stosb" : "+D" (address), "+c" (size) : "a" (value) : "memory");
+}
+
+int8_t legacy_memcompare(const void* mem1, const void* mem2, size_t size) {
+    const uint8_t* m1 = mem1;
+    const uint8_t* m2 = mem2;
+    size_t i = 0;
+
+    for(; i + 8 <= size; i += 8) {
+        if(*(const uint64_t*)(m1 + i) != *(const uint64_t*)(m2 + i)) {
+            break;
+        }
+    }
+
+    for(; i < size; i++) {
+        if(m1[i] != m2[i]) {
+            return m1[i] < m2[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+size_t legacy_strlen(const char_t* string) {
+    const volatile char_t* s = string;
+    size_t ret = 0;
+
+    while(s[ret]) {
+        ret++;
+    }
+
+    return ret;
+}
+
+int8_t legacy_strcmp(const char_t* string1, const char_t* string2) {
+    size_t len1 = legacy_strlen(string1);
+    size_t len2 = legacy_strlen(string2);
+    size_t minlen = MIN(len1, len2);
+
+    int8_t res = legacy_memcompare(string1, string2, minlen);
+
+    if(res) {
+        return res;
+    }
+
+    if(len1 == len2) {
+        return 0;
+    }
+
+    return (minlen == len1) ? -1 : 1;
+}
+
+boolean_t test_memory_simd_check(uint8_t* src, uint8_t* dst) {
+    const size_t sizes[] = {0, 1, 3, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 255, 1000, 2047, 2048, 4099, 65536 + 13};
+
+    for(size_t i = 0; i < TEST_MEMORY_SIMD_BUFFER_SIZE; i++) {
+        src[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for(size_t sa = 0; sa < 4; sa++) {
+            for(size_t da = 0; da < 4; da++) {
+                size_t size = sizes[s];
+
+                memory_memset(dst, 0xAA, size + 64);
+                memory_memcopy(src + sa, dst + da, size);
+
+                if(legacy_memcompare(src + sa, dst + da, size) != 0 || (da && dst[da - 1] != 0xAA) || dst[da + size] != 0xAA) {
+                    printf("memcopy failed size %lli src align %lli dst align %lli\n", size, sa, da);
+
+                    return false;
+                }
+
+                if(memory_memcompare(src + sa, dst + da, size) != 0) {
+                    printf("memcompare equal failed size %lli\n", size);
+
+                    return false;
+                }
+
+                if(size) {
+                    dst[da + size - 1] ^= 0x80;
+
+                    if(memory_memcompare(src + sa, dst + da, size) != legacy_memcompare(src + sa, dst + da, size)) {
+                        printf("memcompare diff failed size %lli\n", size);
+
+                        return false;
+                    }
+                }
+
+                memory_memset(dst + da, (uint8_t)size, size);
+
+                for(size_t i = 0; i < size; i++) {
+                    if(dst[da + i] != (uint8_t)size) {
+                        printf("memset failed size %lli at %lli\n", size, i);
+
+                        return false;
+                    }
+                }
+
+                if(dst[da + size] != 0xAA) {
+                    printf("memset overrun size %lli\n", size);
+
+                    return false;
+                }
+            }
+        }
+    }
+
+    // large copy goes through non-temporal stores
+    memory_memcopy(src, dst, TEST_MEMORY_SIMD_BUFFER_SIZE - 64);
+
+    if(legacy_memcompare(src, dst, TEST_MEMORY_SIMD_BUFFER_SIZE - 64) != 0) {
+        print_error("large memcopy failed");
+
+        return false;
+    }
+
+    return true;
+}
+
+boolean_t test_memory_simd_check_strings(char_t* str1, char_t* str2) {
+    for(size_t a = 0; a < 16; a++) {
+        for(size_t len = 0; len < 100; len++) {
+            for(size_t i = 0; i < len; i++) {
+                str1[a + i] = (char_t)('a' + (i % 26));
+                str2[i] = str1[a + i];
+            }
+
+            str1[a + len] = 0;
+            str2[len] = 0;
+
+            if(strlen(str1 + a) != len) {
+                printf("strlen failed align %lli len %lli\n", a, len);
+
+                return false;
+            }
+
+            if(strcmp(str1 + a, str2) != 0) {
+                printf("strcmp equal failed align %lli len %lli\n", a, len);
+
+                return false;
+            }
+
+            if(len) {
+                str2[len / 2] = (char_t)0xF0;
+
+                if(strcmp(str1 + a, str2) != legacy_strcmp(str1 + a, str2) || strcmp(str2, str1 + a) != legacy_strcmp(str2, str1 + a)) {
+                    printf("strcmp diff failed align %lli len %lli\n", a, len);
+
+                    return false;
+                }
+
+                str2[len / 2] = str1[a + len / 2];
+                str2[len - 1] = 0;
+
+                if(strcmp(str1 + a, str2) != 1 || strcmp(str2, str1 + a) != -1) {
+                    printf("strcmp prefix failed align %lli len %lli\n", a, len);
+
+                    return false;
+                }
+            }
+        }
+    }
+
+    if(strlen(NULL) != 0 || strcmp(NULL, "") != 0 || strcmp(NULL, "a") != -1 || strcmp("a", NULL) != 1) {
+        print_error("null string handling failed");
+
+        return false;
+    }
+
+    return true;
+}
+
+void test_memory_simd_bench(uint8_t* src, uint8_t* dst, size_t size) {
+    uint64_t rounds = TEST_MEMORY_SIMD_ROUNDS / size;
+    uint64_t start, legacy_time, new_time;
+
+    if(rounds == 0) {
+        rounds = 1;
+    }
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        legacy_memcopy(src, dst, size);
+    }
+    legacy_time = time_ns(NULL) - start;
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        memory_memcopy(src, dst, size);
+    }
+    new_time = time_ns(NULL) - start;
+
+    printf("memcopy    size %8lli legacy %10lli ns new %10lli ns\n", size, legacy_time, new_time);
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        legacy_memset(dst, (uint8_t)r, size);
+    }
+    legacy_time = time_ns(NULL) - start;
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        memory_memset(dst, (uint8_t)r, size);
+    }
+    new_time = time_ns(NULL) - start;
+
+    printf("memset     size %8lli legacy %10lli ns new %10lli ns\n", size, legacy_time, new_time);
+
+    memory_memcopy(src, dst, size);
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        legacy_memcompare(src, dst, size);
+    }
+    legacy_time = time_ns(NULL) - start;
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        memory_memcompare(src, dst, size);
+    }
+    new_time = time_ns(NULL) - start;
+
+    printf("memcompare size %8lli legacy %10lli ns new %10lli ns\n", size, legacy_time, new_time);
+
+    memory_memset(src, 'x', size);
+    memory_memset(dst, 'x', size);
+    src[size - 1] = 0;
+    dst[size - 1] = 0;
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        legacy_strlen((char_t*)src);
+    }
+    legacy_time = time_ns(NULL) - start;
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        strlen((char_t*)src);
+    }
+    new_time = time_ns(NULL) - start;
+
+    printf("strlen     size %8lli legacy %10lli ns new %10lli ns\n", size, legacy_time, new_time);
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        legacy_strcmp((char_t*)src, (char_t*)dst);
+    }
+    legacy_time = time_ns(NULL) - start;
+
+    start = time_ns(NULL);
+    for(uint64_t r = 0; r < rounds; r++) {
+        strcmp((char_t*)src, (char_t*)dst);
+    }
+    new_time = time_ns(NULL) - start;
+
+    printf("strcmp     size %8lli legacy %10lli ns new %10lli ns\n", size, legacy_time, new_time);
+}
+
+int main(void){
+    uint8_t* src = memory_malloc(TEST_MEMORY_SIMD_BUFFER_SIZE);
+    uint8_t* dst = memory_malloc(TEST_MEMORY_SIMD_BUFFER_SIZE);
+
+    if(src == NULL || dst == NULL) {
+        print_error("cannot malloc buffers");
+
+        return -1;
+    }
+
+    if(!test_memory_simd_check(src, dst)) {
+        print_error("memory simd check failed");
+
+        return -1;
+    }
+
+    print_success("memory simd check ok");
+
+    if(!test_memory_simd_check_strings((char_t*)src, (char_t*)dst)) {
+        print_error("strings simd check failed");
+
+        return -1;
+    }
+
+    print_success("strings simd check ok");
+
+    const size_t bench_sizes[] = {16, 64, 256, 1024, 4096, 65536, 1 << 20, TEST_MEMORY_SIMD_BUFFER_SIZE};
+
+    for(size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        test_memory_simd_bench(src, dst, bench_sizes[i]);
+    }
+
+    memory_free(src);
+    memory_free(dst);
+
+    print_success("memory simd bench ok");
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+#define RAMSIZE (128 << 20)
+#include "setup.h"
+#include <skiplist.h>
+#include <strings.h>
+
+int32_t main(uint32_t argc, char_t** argv);
+int8_t  integer_cmp(const void* item1, const void* item2);
+int8_t  pair_key_cmp(const void* item1, const void* item2);
+int8_t  pair_subpart_cmp(const void* item1, const void* item2);
+
+typedef struct pair_t {
+    int64_t key;
+    int64_t subpart;
+} pair_t;
+
+int8_t integer_cmp(const void* item1, const void* item2) {
+    int64_t i1 = (int64_t)item1;
+    int64_t i2 = (int64_t)item2;
+
+    if(i1 < i2) {
+        return -1;
+    }
+
+    if(i1 > i2) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int8_t pair_key_cmp(const void* item1, const void* item2) {
+    const pair_t* p1 = item1;
+    const pair_t* p2 = item2;
+
+    return integer_cmp((void*)p1->key, (void*)p2->key);
+}
+
+int8_t pair_subpart_cmp(const void* item1, const void* item2) {
+    const pair_t* p1 = item1;
+    const pair_t* p2 = item2;
+
+    return integer_cmp((void*)p1->subpart, (void*)p2->subpart);
+}
+
+int32_t main(uint32_t argc, char_t** argv) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    boolean_t pass = true;
+
+    index_t* idx = skiplist_create_index_with_unique(integer_cmp, true);
+
+    idx->insert(idx, (void*)1, "elma", NULL);
+    idx->insert(idx, (void*)2, "armut", NULL);
+    idx->insert(idx, (void*)3, "kiraz", NULL);
+    idx->insert(idx, (void*)4, "karpuz", NULL);
+    idx->insert(idx, (void*)5, "çilek", NULL);
+    idx->insert(idx, (void*)6, "vişne", NULL);
+
+    char_t* old = NULL;
+
+    idx->insert(idx, (void*)1, "ayva", (void**)&old);
+
+    if(idx->size(idx) != 6 || !old || strcmp("elma", old) != 0) {
+        print_error("insert cannot replace old data");
+        pass = false;
+    }
+
+    idx->delete(idx, (void*)4, (void**)&old);
+
+    if(idx->size(idx) != 5 || !old || strcmp("karpuz", old) != 0 || idx->contains(idx, (void*)4)) {
+        print_error("delete failed");
+        pass = false;
+    }
+
+    for(int64_t i = 128 * 1024; i > 6; i--) {
+        idx->insert(idx, (void*)i, (void*)i, NULL);
+    }
+
+    if(idx->size(idx) != 128 * 1024 - 1 || idx->find(idx, (void*)123456) != (void*)123456) {
+        print_error("bulk insert failed");
+        pass = false;
+    }
+
+    iterator_t* iter = idx->search(idx, (void*)90, (void*)150, INDEXER_KEY_COMPARATOR_CRITERIA_BETWEEN);
+    int64_t expected = 90;
+
+    // deleting while iterating is allowed
+    while(iter->end_of_iterator(iter) != 0) {
+        int64_t i = (int64_t)iter->get_extra_data(iter);
+
+        if(i != expected) {
+            printf("between search failed expected %lli got %lli\n", expected, i);
+            pass = false;
+
+            break;
+        }
+
+        idx->delete(idx, (void*)i, NULL);
+
+        expected++;
+        iter = iter->next(iter);
+    }
+
+    iter->destroy(iter);
+
+    if(expected != 151 || idx->size(idx) != 128 * 1024 - 1 - 61) {
+        print_error("between search and delete failed");
+        pass = false;
+    }
+
+    iter = idx->search(idx, (void*)120, NULL, INDEXER_KEY_COMPARATOR_CRITERIA_EQUALORGREATER);
+
+    if(iter->end_of_iterator(iter) == 0 || (int64_t)iter->get_extra_data(iter) != 151) {
+        print_error("equal or greater search failed");
+        pass = false;
+    }
+
+    iter->destroy(iter);
+
+    skiplist_destroy_index(idx);
+
+    idx = skiplist_create_index_with_unique(pair_key_cmp, false);
+    skiplist_set_comparator_for_unique_subpart_for_non_unique_index(idx, pair_subpart_cmp);
+
+    for(int64_t i = 0; i < 1000; i++) {
+        pair_t* p = skiplist_arena_malloc(idx, sizeof(pair_t));
+
+        p->key = i % 10;
+        p->subpart = 99 - i / 10;
+
+        idx->insert(idx, p, p, NULL);
+    }
+
+    pair_t* p = skiplist_arena_malloc(idx, sizeof(pair_t));
+    p->key = 3;
+    p->subpart = 50;
+
+    pair_t* old_pair = NULL;
+
+    idx->insert(idx, p, p, (void**)&old_pair);
+
+    if(idx->size(idx) != 1000 || !old_pair || old_pair->key != 3 || old_pair->subpart != 50) {
+        print_error("subpart replace failed");
+        pass = false;
+    }
+
+    iter = idx->search(idx, p, NULL, INDEXER_KEY_COMPARATOR_CRITERIA_EQUAL);
+    expected = 0;
+
+    while(iter->end_of_iterator(iter) != 0) {
+        const pair_t* ip = iter->get_item(iter);
+
+        if(ip->key != 3 || ip->subpart != expected) {
+            printf("equal search failed at %lli\n", expected);
+            pass = false;
+
+            break;
+        }
+
+        expected++;
+        iter = iter->next(iter);
+    }
+
+    iter->destroy(iter);
+
+    if(expected != 100) {
+        print_error("equal search count failed");
+        pass = false;
+    }
+
+    skiplist_destroy_index(idx);
+
+    if(pass) {
+        print_success("TESTS PASSED");
+    } else {
+        print_error("TESTS FAILED");
+    }
+
+    return pass ? 0 : -1;
+}